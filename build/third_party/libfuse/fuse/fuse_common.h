@@ -112,6 +112,8 @@ struct fuse_file_info {
  * FUSE_CAP_SPLICE_MOVE: ability to move data to the fuse device with splice()
  * FUSE_CAP_SPLICE_READ: ability to use splice() to read from the fuse device
  * FUSE_CAP_IOCTL_DIR: ioctl support on directories
+ * FUSE_CAP_READDIRPLUS: readdirplus support
+ * FUSE_CAP_READDIRPLUS_AUTO: adaptive readdirplus support
  * FUSE_CAP_WRITEBACK_CACHE: writeback cache support after kernel 3.15
  */
 #define FUSE_CAP_ASYNC_READ	(1 << 0)
@@ -125,6 +127,8 @@ struct fuse_file_info {
 #define FUSE_CAP_SPLICE_READ	(1 << 9)
 #define FUSE_CAP_FLOCK_LOCKS	(1 << 10)
 #define FUSE_CAP_IOCTL_DIR	(1 << 11)
+#define FUSE_CAP_READDIRPLUS	(1 << 13)
+#define FUSE_CAP_READDIRPLUS_AUTO	(1 << 14)
 #define FUSE_CAP_WRITEBACK_CACHE	(1 << 16)
 
 /**
@@ -78,7 +78,10 @@ int32_t main(int32_t argc, char **argv)
 	ino_t tmpino;
 	int64_t num_local, num_cloud, num_hybrid, retllcode;
 	uint32_t uint32_ret;
-	int64_t downxfersize, upxfersize;
+	int64_t xfer_vals[6];
+	int64_t metacache_vals[6];
+	/* Stalls < 1ms, 10ms, 100ms, 1s, 10s and longer, total and max ms */
+	int64_t stall_vals[8];
 	const char *shm_hcfs_reporter = "/dev/shm/hcfs_reporter";
 	int32_t first_size, rest_size, loglevel, first_upload_interval;
 	int32_t normal_upload_interval, sync_nonbusy_pause_time;
@@ -351,11 +354,44 @@ int32_t main(int32_t argc, char **argv)
 		size_msg = send(fd, &code, sizeof(uint32_t), 0);
 		size_msg = send(fd, &cmd_len, sizeof(uint32_t), 0);
 		size_msg = recv(fd, &reply_len, sizeof(uint32_t), 0);
-		size_msg = recv(fd, &downxfersize, sizeof(int64_t), 0);
-		size_msg = recv(fd, &upxfersize, sizeof(int64_t), 0);
+		size_msg = recv(fd, xfer_vals, sizeof(xfer_vals), 0);
 		printf("Reply len %d\n", reply_len);
 		printf("Download %" PRId64 " bytes, upload %" PRId64 " bytes\n",
-				downxfersize, upxfersize);
+				xfer_vals[0], xfer_vals[1]);
+		if (reply_len >= sizeof(xfer_vals))
+			printf("Upload concurrency %" PRId64 ", sync concurrency %"
+			       PRId64 ", throughput %" PRId64 " KB/s, latency %"
+			       PRId64 " ms\n", xfer_vals[2], xfer_vals[3],
+			       xfer_vals[4], xfer_vals[5]);
+		break;
+	case GETMETACACHESTAT:
+		cmd_len = 0;
+		size_msg = send(fd, &code, sizeof(uint32_t), 0);
+		size_msg = send(fd, &cmd_len, sizeof(uint32_t), 0);
+		size_msg = recv(fd, &reply_len, sizeof(uint32_t), 0);
+		size_msg = recv(fd, metacache_vals, sizeof(metacache_vals), 0);
+		printf("Reply len %d\n", reply_len);
+		printf("Meta cache hit %" PRId64 ", miss %" PRId64
+		       ", evicted %" PRId64 "\n", metacache_vals[0],
+		       metacache_vals[1], metacache_vals[2]);
+		printf("Meta cache entries %" PRId64 ", used %" PRId64
+		       " of %" PRId64 " bytes\n", metacache_vals[3],
+		       metacache_vals[4], metacache_vals[5]);
+		break;
+	case GETCACHESTALLSTAT:
+		cmd_len = 0;
+		size_msg = send(fd, &code, sizeof(uint32_t), 0);
+		size_msg = send(fd, &cmd_len, sizeof(uint32_t), 0);
+		size_msg = recv(fd, &reply_len, sizeof(uint32_t), 0);
+		size_msg = recv(fd, stall_vals, sizeof(stall_vals), 0);
+		printf("Reply len %d\n", reply_len);
+		printf("Stalls on full cache: <1ms %" PRId64 ", <10ms %" PRId64
+		       ", <100ms %" PRId64 ", <1s %" PRId64 ", <10s %" PRId64
+		       ", >=10s %" PRId64 "\n", stall_vals[0], stall_vals[1],
+		       stall_vals[2], stall_vals[3], stall_vals[4],
+		       stall_vals[5]);
+		printf("Total stall %" PRId64 " ms, max stall %" PRId64 " ms\n",
+		       stall_vals[6], stall_vals[7]);
 		break;
 	case CHECKLOC:
 	case CHECKPIN:
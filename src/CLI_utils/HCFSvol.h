@@ -59,6 +59,8 @@ CMD cmd_list[] = { { "create", CREATEVOL },
 		   { "dirtysize", GETDIRTYCACHESIZE },
 		   { "getxfer", GETXFERSTAT },
 		   { "resetxfer", RESETXFERSTAT },
+		   { "metacachestat", GETMETACACHESTAT },
+		   { "cachestallstat", GETCACHESTALLSTAT },
 		   { "cloudstat", CLOUDSTAT },
 		   { "setsyncswitch", SETSYNCSWITCH },
 		   { "getsyncswitch", GETSYNCSWITCH },
@@ -0,0 +1,302 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/* Replays an access trace recorded with config "cache_access_trace" and
+* reports the block hit ratio of the cache replacement policies for a cache
+* holding a given number of blocks.
+*
+* Usage: cache_policy_sim <trace file> <cache size in blocks> */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache_policy.h"
+
+#define SIM_HASH_SIZE 65536
+
+/* Whole inode replacement, as done by the inode passes of
+run_cache_loop. Blocks of the least recently used inode are paged out
+until the cache fits. */
+typedef struct SIM_BLOCK {
+	ino_t this_inode;
+	int64_t block_no;
+	struct SIM_BLOCK *hash_next;
+	struct SIM_BLOCK *inode_next;
+} SIM_BLOCK;
+
+typedef struct SIM_INODE {
+	ino_t this_inode;
+	SIM_BLOCK *blocks;
+	struct SIM_INODE *prev;
+	struct SIM_INODE *next;
+	struct SIM_INODE *hash_next;
+} SIM_INODE;
+
+typedef struct {
+	int64_t hits;
+	int64_t misses;
+} SIM_RESULT;
+
+static SIM_BLOCK *block_hash[SIM_HASH_SIZE];
+static SIM_INODE *inode_hash[SIM_HASH_SIZE];
+/* Head is the most recently used inode */
+static SIM_INODE *inode_lru_head, *inode_lru_tail;
+
+static SIM_BLOCK **_find_block(ino_t this_inode, int64_t block_no)
+{
+	SIM_BLOCK **block_ptr;
+
+	block_ptr = &(block_hash[((uint64_t)this_inode * 31 +
+				  (uint64_t)block_no) % SIM_HASH_SIZE]);
+	while (*block_ptr != NULL) {
+		if (((*block_ptr)->this_inode == this_inode) &&
+		    ((*block_ptr)->block_no == block_no))
+			break;
+		block_ptr = &((*block_ptr)->hash_next);
+	}
+	return block_ptr;
+}
+
+static SIM_INODE **_find_inode(ino_t this_inode)
+{
+	SIM_INODE **inode_ptr;
+
+	inode_ptr = &(inode_hash[(uint64_t)this_inode % SIM_HASH_SIZE]);
+	while (*inode_ptr != NULL) {
+		if ((*inode_ptr)->this_inode == this_inode)
+			break;
+		inode_ptr = &((*inode_ptr)->hash_next);
+	}
+	return inode_ptr;
+}
+
+static void _lru_unlink(SIM_INODE *inode)
+{
+	if (inode->prev != NULL)
+		inode->prev->next = inode->next;
+	else
+		inode_lru_head = inode->next;
+	if (inode->next != NULL)
+		inode->next->prev = inode->prev;
+	else
+		inode_lru_tail = inode->prev;
+	inode->prev = NULL;
+	inode->next = NULL;
+}
+
+static void _lru_push_head(SIM_INODE *inode)
+{
+	inode->next = inode_lru_head;
+	if (inode_lru_head != NULL)
+		inode_lru_head->prev = inode;
+	else
+		inode_lru_tail = inode;
+	inode_lru_head = inode;
+}
+
+/* Returns TRUE on hit */
+static BOOL _inode_lru_access(ino_t this_inode, int64_t block_no,
+			      int64_t capacity, int64_t *num_cached)
+{
+	SIM_INODE **inode_ptr, *inode, *victim;
+	SIM_BLOCK **block_ptr, *block;
+
+	inode_ptr = _find_inode(this_inode);
+	inode = *inode_ptr;
+	if (inode == NULL) {
+		inode = calloc(1, sizeof(SIM_INODE));
+		if (inode == NULL)
+			exit(-ENOMEM);
+		inode->this_inode = this_inode;
+		*inode_ptr = inode;
+	} else {
+		_lru_unlink(inode);
+	}
+	_lru_push_head(inode);
+
+	block_ptr = _find_block(this_inode, block_no);
+	if (*block_ptr != NULL)
+		return TRUE;
+
+	block = calloc(1, sizeof(SIM_BLOCK));
+	if (block == NULL)
+		exit(-ENOMEM);
+	block->this_inode = this_inode;
+	block->block_no = block_no;
+	*block_ptr = block;
+	block->inode_next = inode->blocks;
+	inode->blocks = block;
+	(*num_cached)++;
+
+	while (*num_cached > capacity) {
+		victim = inode_lru_tail;
+		if (victim->blocks == NULL) {
+			/* Nothing cached. Stop tracking the inode */
+			_lru_unlink(victim);
+			inode_ptr = _find_inode(victim->this_inode);
+			*inode_ptr = victim->hash_next;
+			free(victim);
+			continue;
+		}
+		block = victim->blocks;
+		victim->blocks = block->inode_next;
+		block_ptr = _find_block(block->this_inode, block->block_no);
+		*block_ptr = block->hash_next;
+		free(block);
+		(*num_cached)--;
+	}
+	return FALSE;
+}
+
+static void _inode_lru_reset(void)
+{
+	SIM_INODE *inode;
+	SIM_BLOCK *block;
+
+	while (inode_lru_head != NULL) {
+		inode = inode_lru_head;
+		inode_lru_head = inode->next;
+		while (inode->blocks != NULL) {
+			block = inode->blocks;
+			inode->blocks = block->inode_next;
+			free(block);
+		}
+		free(inode);
+	}
+	inode_lru_tail = NULL;
+	memset(block_hash, 0, sizeof(block_hash));
+	memset(inode_hash, 0, sizeof(inode_hash));
+}
+
+/* Returns TRUE on hit */
+static BOOL _block_policy_access(ino_t this_inode, int64_t block_no,
+				 BOOL is_write, int64_t capacity,
+				 int64_t *num_cached)
+{
+	int32_t queue;
+	ino_t victim_inode;
+	int64_t victim_block;
+	BOOL hit;
+
+	queue = cache_policy_lookup(this_inode, block_no);
+	hit = ((queue == CP_QUEUE_A1IN) || (queue == CP_QUEUE_AM));
+	cache_policy_access(this_inode, block_no, block_no, is_write);
+	if (hit == TRUE)
+		return TRUE;
+
+	(*num_cached)++;
+	while (*num_cached > capacity) {
+		if (cache_policy_pick_victim(&victim_inode, &victim_block) < 0)
+			break;
+		cache_policy_evicted(victim_inode, victim_block);
+		(*num_cached)--;
+	}
+	return FALSE;
+}
+
+static int32_t _replay(FILE *fptr, int32_t policy, int64_t capacity,
+		       SIM_RESULT *result)
+{
+	char line[256];
+	char op;
+	uint64_t this_inode;
+	int64_t block_no, num_cached;
+	BOOL hit;
+	int32_t ret;
+
+	if (policy != CACHE_POLICY_INODE) {
+		/* Track twice the capacity so that only paged out blocks
+		are dropped, and 2Q keeps ghosts for half of the cache */
+		ret = init_cache_policy(policy, capacity * 2, NULL);
+		if (ret < 0)
+			return ret;
+	}
+
+	memset(result, 0, sizeof(SIM_RESULT));
+	num_cached = 0;
+	rewind(fptr);
+	while (fgets(line, sizeof(line), fptr) != NULL) {
+		if (sscanf(line, "%" SCNu64 " %" SCNd64 " %c", &this_inode,
+			   &block_no, &op) != 3)
+			continue;
+		if (policy == CACHE_POLICY_INODE)
+			hit = _inode_lru_access((ino_t)this_inode, block_no,
+						capacity, &num_cached);
+		else
+			hit = _block_policy_access((ino_t)this_inode, block_no,
+						   (op == 'W') ? TRUE : FALSE,
+						   capacity, &num_cached);
+		if (hit == TRUE)
+			result->hits++;
+		else
+			result->misses++;
+	}
+
+	if (policy == CACHE_POLICY_INODE)
+		_inode_lru_reset();
+	else
+		destroy_cache_policy();
+	return 0;
+}
+
+int32_t main(int32_t argc, char **argv)
+{
+	FILE *fptr;
+	int64_t capacity;
+	SIM_RESULT result;
+	int32_t count, ret;
+	const int32_t policies[] = {CACHE_POLICY_INODE, CACHE_POLICY_LRU,
+				    CACHE_POLICY_2Q};
+	const char *policy_names[] = {"INODE", "LRU", "2Q"};
+
+	if (argc < 3) {
+		printf("Usage: %s <trace file> <cache size in blocks>\n",
+		       argv[0]);
+		exit(-EINVAL);
+	}
+	capacity = strtoll(argv[2], NULL, 10);
+	if (capacity <= 0) {
+		printf("Invalid cache size\n");
+		exit(-EINVAL);
+	}
+	fptr = fopen(argv[1], "r");
+	if (fptr == NULL) {
+		printf("Cannot open %s\n", argv[1]);
+		exit(-errno);
+	}
+
+	printf("%-8s %12s %12s %8s\n", "Policy", "Hits", "Misses", "Hit%");
+	for (count = 0; count < 3; count++) {
+		ret = _replay(fptr, policies[count], capacity, &result);
+		if (ret < 0) {
+			printf("Unable to replay with %s. Code %d\n",
+			       policy_names[count], -ret);
+			continue;
+		}
+		printf("%-8s %12" PRId64 " %12" PRId64 " %7.2f%%\n",
+		       policy_names[count], result.hits, result.misses,
+		       (result.hits + result.misses > 0) ?
+		       (100.0 * result.hits) / (result.hits + result.misses) :
+		       0.0);
+	}
+	fclose(fptr);
+	return 0;
+}
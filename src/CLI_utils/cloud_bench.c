@@ -0,0 +1,558 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/* Measures put, get and delete throughput and latency of hcfscurl.c
+* against a local mock object store, with threads each owning a curl handle
+* as the upload and download threads do.
+*
+* Usage: cloud_bench [options], see _usage() below.
+*
+* With -S the mock store is only served, so that hcfs can be configured
+* with backend SWIFT at 127.0.0.1:<port> to measure upload_loop end to end
+* (see "HCFSvol xferstat"). */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cloud_mock_store.h"
+#include "curl_pool.h"
+#include "fuseop.h"
+#include "global.h"
+#include "googledrive_curl.h"
+#include "hcfscurl.h"
+#include "params.h"
+
+#define BENCH_CONTAINER "bench"
+
+enum { BENCH_PUT = 0, BENCH_GET, BENCH_DELETE, NUM_BENCH_OPS };
+
+typedef struct {
+	int32_t backend;
+	int32_t num_objs;
+	int64_t obj_size;
+	int32_t num_threads;
+	BOOL use_pool;
+	MOCK_STORE_CONF store;
+} BENCH_CONF;
+
+typedef struct {
+	int32_t thread_idx;
+	int32_t op;
+	/* Latency of each object, in microseconds */
+	int64_t *latency_us;
+	int32_t num_failed;
+} BENCH_WORKER;
+
+SYSTEM_CONF_STRUCT *system_config;
+static BENCH_CONF bench_conf;
+
+/* The rest of hcfs is not linked. Hooks called by hcfscurl.c are stubbed
+here, and Google Drive is not benchmarked. */
+int32_t ignore_sigpipe(void)
+{
+	signal(SIGPIPE, SIG_IGN);
+	return 0;
+}
+
+void update_backend_status(register BOOL status, struct timespec *status_time)
+{
+	(void)status;
+	(void)status_time;
+}
+
+int32_t change_xfer_meta(int64_t xfer_size_upload, int64_t xfer_size_download,
+			 int64_t xfer_throughput, int64_t xfer_total_obj)
+{
+	(void)xfer_size_upload;
+	(void)xfer_size_download;
+	(void)xfer_throughput;
+	(void)xfer_total_obj;
+	return 0;
+}
+
+int32_t add_notify_event(int32_t event_id, const char *event_info_json_str,
+			 char blocking)
+{
+	(void)event_id;
+	(void)event_info_json_str;
+	(void)blocking;
+	return -ENOTSUP;
+}
+
+int32_t hcfs_init_gdrive_backend(CURL_HANDLE *curl_handle)
+{
+	(void)curl_handle;
+	return -1;
+}
+
+void hcfs_destroy_gdrive_backend(CURL *curl)
+{
+	curl_easy_cleanup(curl);
+}
+
+int32_t hcfs_gdrive_reauth(CURL_HANDLE *curl_handle)
+{
+	(void)curl_handle;
+	return -1;
+}
+
+int32_t hcfs_gdrive_test_backend(CURL_HANDLE *curl_handle)
+{
+	(void)curl_handle;
+	return -1;
+}
+
+int32_t hcfs_gdrive_list_container(FILE *fptr, CURL_HANDLE *curl_handle,
+				   GOOGLEDRIVE_OBJ_INFO *more)
+{
+	(void)fptr;
+	(void)curl_handle;
+	(void)more;
+	return -1;
+}
+
+int32_t hcfs_gdrive_get_object(FILE *fptr, char *objname,
+			       CURL_HANDLE *curl_handle,
+			       GOOGLEDRIVE_OBJ_INFO *obj_info)
+{
+	(void)fptr;
+	(void)objname;
+	(void)curl_handle;
+	(void)obj_info;
+	return -1;
+}
+
+int32_t hcfs_gdrive_delete_object(char *objname, CURL_HANDLE *curl_handle,
+				  GOOGLEDRIVE_OBJ_INFO *obj_info)
+{
+	(void)objname;
+	(void)curl_handle;
+	(void)obj_info;
+	return -1;
+}
+
+int32_t hcfs_gdrive_put_object(FILE *fptr, char *objname,
+			       CURL_HANDLE *curl_handle,
+			       GOOGLEDRIVE_OBJ_INFO *obj_info)
+{
+	(void)fptr;
+	(void)objname;
+	(void)curl_handle;
+	(void)obj_info;
+	return -1;
+}
+
+int32_t hcfs_gdrive_post_object(FILE *fptr, char *objname,
+				CURL_HANDLE *curl_handle,
+				GOOGLEDRIVE_OBJ_INFO *obj_info)
+{
+	(void)fptr;
+	(void)objname;
+	(void)curl_handle;
+	(void)obj_info;
+	return -1;
+}
+
+void gdrive_exp_backoff_sleep(int32_t busy_retry_times)
+{
+	(void)busy_retry_times;
+}
+
+static void _usage(const char *name)
+{
+	printf("Usage: %s [options]\n"
+	       "  -b swift|s3  Backend protocol (swift)\n"
+	       "  -n <num>     Number of objects (200)\n"
+	       "  -s <bytes>   Object size (1048576)\n"
+	       "  -t <num>     Concurrent transfers (4)\n"
+	       "  -P           Use one curl handle per transfer, without the\n"
+	       "               shared connection pool\n"
+	       "  -l <ms>      Injected latency per request (0)\n"
+	       "  -w <KB/s>    Injected bandwidth per connection (0, none)\n"
+	       "  -e <1/1000>  Injected error rate (0)\n"
+	       "  -c <code>    HTTP code of errors, or 0 to drop the\n"
+	       "               connection (0). Swift and S3 retry 5xx only\n"
+	       "               after %d seconds.\n"
+	       "  -p <port>    Port of the mock store (any)\n"
+	       "  -S           Only serve the mock store until interrupted\n",
+	       name, RETRY_INTERVAL);
+}
+
+static char *_dup_string(const char *str)
+{
+	char *ret;
+
+	ret = strdup(str);
+	if (ret == NULL)
+		exit(-ENOMEM);
+	return ret;
+}
+
+static void _init_backend_config(int32_t port)
+{
+	char url[100];
+
+	system_config = calloc(1, sizeof(SYSTEM_CONF_STRUCT));
+	hcfs_system = calloc(1, sizeof(SYSTEM_DATA_HEAD));
+	if ((system_config == NULL) || (hcfs_system == NULL))
+		exit(-ENOMEM);
+	hcfs_system->backend_is_online = TRUE;
+	hcfs_system->system_going_down = FALSE;
+
+	system_config->current_backend = bench_conf.backend;
+	snprintf(url, sizeof(url), "127.0.0.1:%d", port);
+	system_config->swift_account = _dup_string("bench");
+	system_config->swift_user = _dup_string("bench");
+	system_config->swift_pass = _dup_string("bench");
+	system_config->swift_url = _dup_string(url);
+	system_config->swift_container = _dup_string(BENCH_CONTAINER);
+	system_config->swift_protocol = _dup_string("http");
+
+	system_config->s3_access = _dup_string("bench");
+	system_config->s3_secret = _dup_string("bench");
+	system_config->s3_url = _dup_string(url);
+	system_config->s3_bucket = _dup_string(BENCH_CONTAINER);
+	system_config->s3_protocol = _dup_string("http");
+	/* Path-style bucket URL, as there is no DNS for the mock store */
+	snprintf(url, sizeof(url), "http://127.0.0.1:%d/%s", port,
+		 BENCH_CONTAINER);
+	system_config->s3_bucket_url = _dup_string(url);
+}
+
+static int64_t _elapsed_us(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000 +
+	       (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+static int32_t _do_one(int32_t op, int32_t obj_idx, CURL_HANDLE *curl_handle,
+		       FILE *fptr)
+{
+	char objname[100];
+	HCFS_encode_object_meta object_meta;
+	int32_t ret;
+
+	snprintf(objname, sizeof(objname), "data_bench_%d", obj_idx);
+	switch (op) {
+	case BENCH_PUT:
+		ret = hcfs_put_object(fptr, objname, curl_handle, NULL, NULL);
+		break;
+	case BENCH_GET:
+		memset(&object_meta, 0, sizeof(HCFS_encode_object_meta));
+		fseek(fptr, 0, SEEK_SET);
+		ret = ftruncate(fileno(fptr), 0);
+		if (ret < 0)
+			return -errno;
+		ret = hcfs_get_object(fptr, objname, curl_handle,
+				      &object_meta, NULL);
+		free(object_meta.enc_session_key);
+		fseek(fptr, 0, SEEK_END);
+		if ((http_is_success(ret) == TRUE) &&
+		    (ftell(fptr) != bench_conf.obj_size))
+			ret = -EIO;
+		break;
+	default:
+		ret = hcfs_delete_object(objname, curl_handle, NULL);
+		break;
+	}
+	return ret;
+}
+
+/* Fill a file with random data, so that the size on the wire is the
+object size */
+static int32_t _fill_object_data(FILE *fptr, uint32_t seed)
+{
+	char buf[4096];
+	int64_t written, this_size;
+	size_t count;
+
+	for (written = 0; written < bench_conf.obj_size;
+	     written += this_size) {
+		for (count = 0; count < sizeof(buf); count++)
+			buf[count] = (char)rand_r(&seed);
+		this_size = bench_conf.obj_size - written;
+		if (this_size > (int64_t)sizeof(buf))
+			this_size = sizeof(buf);
+		if (fwrite(buf, this_size, 1, fptr) != 1)
+			return -EIO;
+	}
+	if (fflush(fptr) != 0)
+		return -errno;
+	return 0;
+}
+
+static void *_bench_worker(void *ptr)
+{
+	BENCH_WORKER *worker;
+	CURL_HANDLE curl_handle;
+	FILE *fptr;
+	struct timespec start;
+	int32_t obj_idx, ret;
+
+	worker = (BENCH_WORKER *)ptr;
+	memset(&curl_handle, 0, sizeof(CURL_HANDLE));
+	snprintf(curl_handle.id, sizeof(curl_handle.id), "bench_%d_%d",
+		 getpid(), worker->thread_idx);
+	curl_handle.curl_backend = NONE;
+
+	/* Each thread uploads from and downloads to its own file */
+	fptr = tmpfile();
+	if ((fptr == NULL) || ((worker->op == BENCH_PUT) &&
+	    (_fill_object_data(fptr, worker->thread_idx + 1) < 0))) {
+		if (fptr != NULL)
+			fclose(fptr);
+		for (obj_idx = worker->thread_idx;
+		     obj_idx < bench_conf.num_objs;
+		     obj_idx += bench_conf.num_threads) {
+			worker->latency_us[obj_idx] = -1;
+			worker->num_failed++;
+		}
+		return NULL;
+	}
+
+	for (obj_idx = worker->thread_idx; obj_idx < bench_conf.num_objs;
+	     obj_idx += bench_conf.num_threads) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		ret = _do_one(worker->op, obj_idx, &curl_handle, fptr);
+		worker->latency_us[obj_idx] = _elapsed_us(&start);
+		if (http_is_success(ret) == FALSE) {
+			worker->num_failed++;
+			worker->latency_us[obj_idx] = -1;
+		}
+		if (bench_conf.use_pool == FALSE) {
+			/* A new handle per transfer, as with no pooling */
+			hcfs_destroy_backend(&curl_handle);
+			curl_handle.curl_backend = NONE;
+		}
+	}
+	hcfs_destroy_backend(&curl_handle);
+	fclose(fptr);
+	return NULL;
+}
+
+static int32_t _compare_latency(const void *a, const void *b)
+{
+	int64_t diff = *(const int64_t *)a - *(const int64_t *)b;
+
+	return (diff > 0) - (diff < 0);
+}
+
+static void _report(const char *name, int64_t *latency_us, int32_t num_failed,
+		    int64_t total_us, BOOL has_data)
+{
+	int32_t num_ok;
+	double seconds;
+
+	/* Failed objects sort first */
+	qsort(latency_us, bench_conf.num_objs, sizeof(int64_t),
+	      _compare_latency);
+	num_ok = bench_conf.num_objs - num_failed;
+	seconds = (total_us > 0) ? total_us / 1000000.0 : 0.000001;
+
+	printf("%-8s %8d %6d %10.1f", name, num_ok, num_failed,
+	       num_ok / seconds);
+	if (has_data == TRUE)
+		printf(" %10.2f", (num_ok * (double)bench_conf.obj_size) /
+				  (1048576.0 * seconds));
+	else
+		printf(" %10s", "-");
+	if (num_ok > 0)
+		printf(" %10.2f %10.2f\n",
+		       latency_us[num_failed + (num_ok - 1) / 2] / 1000.0,
+		       latency_us[num_failed + (num_ok * 99 - 1) / 100] /
+			   1000.0);
+	else
+		printf(" %10s %10s\n", "-", "-");
+}
+
+static int32_t _run_phase(int32_t op, int64_t *latency_us)
+{
+	pthread_t *threads;
+	BENCH_WORKER *workers;
+	struct timespec start;
+	int64_t total_us;
+	int32_t count, num_failed;
+	const char *op_names[] = {"PUT", "GET", "DELETE"};
+
+	threads = calloc(bench_conf.num_threads, sizeof(pthread_t));
+	workers = calloc(bench_conf.num_threads, sizeof(BENCH_WORKER));
+	if ((threads == NULL) || (workers == NULL)) {
+		free(threads);
+		free(workers);
+		return -ENOMEM;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (count = 0; count < bench_conf.num_threads; count++) {
+		workers[count].thread_idx = count;
+		workers[count].op = op;
+		workers[count].latency_us = latency_us;
+		pthread_create(&threads[count], NULL, _bench_worker,
+			       &workers[count]);
+	}
+	num_failed = 0;
+	for (count = 0; count < bench_conf.num_threads; count++) {
+		pthread_join(threads[count], NULL);
+		num_failed += workers[count].num_failed;
+	}
+	total_us = _elapsed_us(&start);
+
+	_report(op_names[op], latency_us, num_failed, total_us,
+		(op != BENCH_DELETE) ? TRUE : FALSE);
+	free(threads);
+	free(workers);
+	return 0;
+}
+
+static int32_t _parse_args(int32_t argc, char **argv, BOOL *serve_only)
+{
+	int32_t opt;
+
+	memset(&bench_conf, 0, sizeof(BENCH_CONF));
+	bench_conf.backend = SWIFT;
+	bench_conf.num_objs = 200;
+	bench_conf.obj_size = 1048576;
+	bench_conf.num_threads = 4;
+	bench_conf.use_pool = TRUE;
+	*serve_only = FALSE;
+
+	while ((opt = getopt(argc, argv, "b:n:s:t:Pl:w:e:c:p:Sh")) != -1) {
+		switch (opt) {
+		case 'b':
+			if (strcasecmp(optarg, "swift") == 0)
+				bench_conf.backend = SWIFT;
+			else if (strcasecmp(optarg, "s3") == 0)
+				bench_conf.backend = S3;
+			else
+				return -EINVAL;
+			break;
+		case 'n':
+			bench_conf.num_objs = atoi(optarg);
+			break;
+		case 's':
+			bench_conf.obj_size = strtoll(optarg, NULL, 10);
+			break;
+		case 't':
+			bench_conf.num_threads = atoi(optarg);
+			break;
+		case 'P':
+			bench_conf.use_pool = FALSE;
+			break;
+		case 'l':
+			bench_conf.store.latency_ms = strtoll(optarg, NULL, 10);
+			break;
+		case 'w':
+			bench_conf.store.bandwidth_kbps =
+			    strtoll(optarg, NULL, 10);
+			break;
+		case 'e':
+			bench_conf.store.error_permille = atoi(optarg);
+			break;
+		case 'c':
+			bench_conf.store.error_code = atoi(optarg);
+			break;
+		case 'p':
+			bench_conf.store.port = atoi(optarg);
+			break;
+		case 'S':
+			*serve_only = TRUE;
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+	if ((bench_conf.num_objs <= 0) || (bench_conf.obj_size < 0) ||
+	    (bench_conf.num_threads <= 0) ||
+	    (bench_conf.store.error_permille < 0) ||
+	    (bench_conf.store.error_permille > 1000))
+		return -EINVAL;
+	if (bench_conf.num_threads > bench_conf.num_objs)
+		bench_conf.num_threads = bench_conf.num_objs;
+	return 0;
+}
+
+int32_t main(int32_t argc, char **argv)
+{
+	int64_t *latency_us;
+	MOCK_STORE_STAT stat;
+	BOOL serve_only;
+	int32_t ret, op;
+
+	if (_parse_args(argc, argv, &serve_only) < 0) {
+		_usage(argv[0]);
+		exit(-EINVAL);
+	}
+
+	ret = start_mock_store(&(bench_conf.store));
+	if (ret < 0) {
+		printf("Unable to start mock store. Code %d\n", -ret);
+		exit(ret);
+	}
+	if (serve_only == TRUE) {
+		printf("Mock store at 127.0.0.1:%d, account %s, token %s\n",
+		       bench_conf.store.port, MOCK_SWIFT_ACCOUNT,
+		       MOCK_SWIFT_TOKEN);
+		while (TRUE)
+			pause();
+	}
+
+	latency_us = calloc(bench_conf.num_objs, sizeof(int64_t));
+	if (latency_us == NULL)
+		exit(-ENOMEM);
+	_init_backend_config(bench_conf.store.port);
+	curl_global_init(CURL_GLOBAL_ALL);
+	if (bench_conf.use_pool == TRUE) {
+		ret = init_curl_pool();
+		if (ret < 0) {
+			printf("Unable to start curl connection pool. Code %d\n",
+			       -ret);
+			exit(ret);
+		}
+	}
+
+	printf("%s, %d objects of %" PRId64 " bytes, %d threads%s\n",
+	       (bench_conf.backend == SWIFT) ? "Swift" : "S3",
+	       bench_conf.num_objs, bench_conf.obj_size,
+	       bench_conf.num_threads,
+	       (bench_conf.use_pool == TRUE) ? "" : ", no pooling");
+	printf("%-8s %8s %6s %10s %10s %10s %10s\n", "Op", "Done", "Fail",
+	       "Objs/s", "MB/s", "p50(ms)", "p99(ms)");
+	for (op = BENCH_PUT; op < NUM_BENCH_OPS; op++)
+		_run_phase(op, latency_us);
+
+	mock_store_get_stat(&stat);
+	printf("Mock store: %" PRId64 " requests, %" PRId64
+	       " injected errors, %" PRId64 " connections\n",
+	       stat.num_requests, stat.num_errors, stat.num_connections);
+
+	destroy_curl_pool();
+	curl_global_cleanup();
+	stop_mock_store();
+	free(latency_us);
+	return 0;
+}
@@ -0,0 +1,567 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/* In-memory object store speaking HTTP/1.1 with keep-alive, used as the
+* backend of cloud_bench. Latency, bandwidth limits and errors can be
+* injected to see how the transfer path behaves on slow or flaky links. */
+
+#include "cloud_mock_store.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MOCK_HASH_SIZE 4096
+#define MOCK_MAX_CONNS 256
+#define MOCK_HEADER_SIZE 8192
+#define MOCK_IO_CHUNK 16384
+
+typedef struct MOCK_OBJECT {
+	char *name;
+	char *data;
+	int64_t size;
+	struct MOCK_OBJECT *next;
+} MOCK_OBJECT;
+
+typedef struct {
+	char method[16];
+	char path[1024];
+	int64_t content_length;
+	int32_t keep_alive;
+} MOCK_REQUEST;
+
+typedef struct {
+	int32_t fd;
+	/* Start time and bytes moved of the body in transfer, for the
+	bandwidth limit */
+	struct timespec start;
+	int64_t num_bytes;
+	uint32_t seed;
+} MOCK_CONN;
+
+static MOCK_STORE_CONF store_conf;
+static MOCK_STORE_STAT store_stat;
+static MOCK_OBJECT *object_hash[MOCK_HASH_SIZE];
+static int32_t listen_fd = -1;
+static pthread_t accept_thread;
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t conn_cond = PTHREAD_COND_INITIALIZER;
+static int32_t conn_fds[MOCK_MAX_CONNS];
+static int32_t num_active_conns;
+
+static uint32_t _hash_name(const char *name)
+{
+	uint32_t hash = 5381;
+
+	while (*name != 0)
+		hash = hash * 33 + (uint8_t)(*name++);
+	return hash % MOCK_HASH_SIZE;
+}
+
+/* Should be called with store_lock locked */
+static MOCK_OBJECT **_find_object(const char *name)
+{
+	MOCK_OBJECT **obj_ptr;
+
+	obj_ptr = &(object_hash[_hash_name(name)]);
+	while (*obj_ptr != NULL) {
+		if (strcmp((*obj_ptr)->name, name) == 0)
+			break;
+		obj_ptr = &((*obj_ptr)->next);
+	}
+	return obj_ptr;
+}
+
+static int64_t _elapsed_ms(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000 +
+	       (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static void _start_throttle(MOCK_CONN *conn)
+{
+	clock_gettime(CLOCK_MONOTONIC, &(conn->start));
+	conn->num_bytes = 0;
+}
+
+/* Sleep until the bytes moved of the body fit in the bandwidth */
+static void _throttle(MOCK_CONN *conn, int64_t num_bytes)
+{
+	int64_t expected_ms, elapsed_ms;
+
+	conn->num_bytes += num_bytes;
+	if (store_conf.bandwidth_kbps <= 0)
+		return;
+	expected_ms = conn->num_bytes * 1000 / (store_conf.bandwidth_kbps *
+						 1024);
+	elapsed_ms = _elapsed_ms(&(conn->start));
+	if (expected_ms > elapsed_ms)
+		usleep((expected_ms - elapsed_ms) * 1000);
+}
+
+static int32_t _send_all(MOCK_CONN *conn, const char *buf, int64_t size,
+			 int32_t throttled)
+{
+	int64_t sent, this_size;
+	ssize_t ret;
+
+	sent = 0;
+	while (sent < size) {
+		this_size = size - sent;
+		if (this_size > MOCK_IO_CHUNK)
+			this_size = MOCK_IO_CHUNK;
+		ret = send(conn->fd, buf + sent, this_size, MSG_NOSIGNAL);
+		if (ret <= 0)
+			return -EIO;
+		sent += ret;
+		if (throttled)
+			_throttle(conn, ret);
+	}
+	return 0;
+}
+
+/* Read the request header. Bytes read past it are left in "buf" and their
+number is returned in "num_extra". */
+static int32_t _read_request(MOCK_CONN *conn, char *buf,
+			     MOCK_REQUEST *req, int64_t *num_extra)
+{
+	int64_t used;
+	ssize_t ret;
+	char *end, *line, *saveptr;
+
+	used = 0;
+	end = NULL;
+	while (end == NULL) {
+		if (used >= MOCK_HEADER_SIZE - 1)
+			return -E2BIG;
+		ret = recv(conn->fd, buf + used, MOCK_HEADER_SIZE - 1 - used,
+			   0);
+		if (ret <= 0)
+			return -ECONNRESET;
+		used += ret;
+		buf[used] = 0;
+		end = strstr(buf, "\r\n\r\n");
+	}
+	*end = 0;
+	*num_extra = used - (end + 4 - buf);
+
+	memset(req, 0, sizeof(MOCK_REQUEST));
+	req->keep_alive = 1;
+	line = strtok_r(buf, "\r\n", &saveptr);
+	if ((line == NULL) ||
+	    (sscanf(line, "%15s %1023s", req->method, req->path) != 2))
+		return -EINVAL;
+	while ((line = strtok_r(NULL, "\r\n", &saveptr)) != NULL) {
+		if (strncasecmp(line, "Content-Length:", 15) == 0)
+			req->content_length = strtoll(line + 15, NULL, 10);
+		else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0)
+			return -ENOTSUP;
+		else if (strncasecmp(line, "Connection: close", 17) == 0)
+			req->keep_alive = 0;
+	}
+	/* Move the extra bytes to the front */
+	memmove(buf, end + 4, *num_extra);
+	return 0;
+}
+
+static int32_t _read_body(MOCK_CONN *conn, char *buf, int64_t num_extra,
+			  int64_t size, char **body)
+{
+	int64_t got, this_size;
+	ssize_t ret;
+
+	*body = malloc(size > 0 ? size : 1);
+	if (*body == NULL)
+		return -ENOMEM;
+	got = (num_extra < size) ? num_extra : size;
+	memcpy(*body, buf, got);
+	_start_throttle(conn);
+	_throttle(conn, got);
+	while (got < size) {
+		this_size = size - got;
+		if (this_size > MOCK_IO_CHUNK)
+			this_size = MOCK_IO_CHUNK;
+		ret = recv(conn->fd, *body + got, this_size, 0);
+		if (ret <= 0) {
+			free(*body);
+			*body = NULL;
+			return -ECONNRESET;
+		}
+		got += ret;
+		_throttle(conn, ret);
+	}
+	return 0;
+}
+
+static int32_t _reply(MOCK_CONN *conn, int32_t code, const char *status,
+		      const char *extra_header, const char *body,
+		      int64_t body_size, int32_t send_body)
+{
+	char header[1024];
+	int32_t len;
+
+	len = snprintf(header, sizeof(header),
+		       "HTTP/1.1 %d %s\r\n%sContent-Length: %" PRId64
+		       "\r\n\r\n", code, status,
+		       (extra_header != NULL) ? extra_header : "", body_size);
+	if (_send_all(conn, header, len, 0) < 0)
+		return -EIO;
+	if ((send_body == 0) || (body_size <= 0))
+		return 0;
+	_start_throttle(conn);
+	return _send_all(conn, body, body_size, 1);
+}
+
+static int32_t _handle_auth(MOCK_CONN *conn)
+{
+	char header[512];
+
+	snprintf(header, sizeof(header),
+		 "X-Storage-Url: http://127.0.0.1:%d/v1/%s\r\n"
+		 "X-Auth-Token: %s\r\n", store_conf.port, MOCK_SWIFT_ACCOUNT,
+		 MOCK_SWIFT_TOKEN);
+	return _reply(conn, 200, "OK", header, NULL, 0, 0);
+}
+
+static int32_t _handle_put(MOCK_CONN *conn, MOCK_REQUEST *req, char *body)
+{
+	MOCK_OBJECT **obj_ptr, *obj;
+	char header[100];
+	uint32_t etag;
+	int64_t count;
+
+	etag = 0;
+	for (count = 0; count < req->content_length; count++)
+		etag = etag * 31 + (uint8_t)body[count];
+
+	pthread_mutex_lock(&store_lock);
+	obj_ptr = _find_object(req->path);
+	obj = *obj_ptr;
+	if (obj == NULL) {
+		obj = calloc(1, sizeof(MOCK_OBJECT));
+		if (obj != NULL)
+			obj->name = strdup(req->path);
+		if ((obj == NULL) || (obj->name == NULL)) {
+			pthread_mutex_unlock(&store_lock);
+			free(obj);
+			free(body);
+			return _reply(conn, 507, "Insufficient Storage", NULL,
+				      NULL, 0, 0);
+		}
+		*obj_ptr = obj;
+		store_stat.num_objects++;
+	} else {
+		free(obj->data);
+	}
+	obj->data = body;
+	obj->size = req->content_length;
+	pthread_mutex_unlock(&store_lock);
+
+	snprintf(header, sizeof(header), "ETag: \"%08x\"\r\n", etag);
+	return _reply(conn, 201, "Created", header, NULL, 0, 0);
+}
+
+static int32_t _handle_get(MOCK_CONN *conn, MOCK_REQUEST *req,
+			   int32_t send_body)
+{
+	MOCK_OBJECT *obj;
+	char *data;
+	int64_t size;
+	int32_t ret;
+
+	pthread_mutex_lock(&store_lock);
+	obj = *(_find_object(req->path));
+	if (obj == NULL) {
+		pthread_mutex_unlock(&store_lock);
+		/* Accounts and containers exist implicitly */
+		if (send_body == 0)
+			return _reply(conn, 204, "No Content", NULL, NULL, 0,
+				      0);
+		return _reply(conn, 404, "Not Found", NULL, NULL, 0, 0);
+	}
+	/* Copy out so that the lock is not held while throttled */
+	size = obj->size;
+	data = malloc(size > 0 ? size : 1);
+	if (data != NULL)
+		memcpy(data, obj->data, size);
+	pthread_mutex_unlock(&store_lock);
+	if (data == NULL)
+		return _reply(conn, 500, "Internal Server Error", NULL, NULL,
+			      0, 0);
+
+	ret = _reply(conn, 200, "OK", NULL, data, size, send_body);
+	free(data);
+	return ret;
+}
+
+static int32_t _handle_delete(MOCK_CONN *conn, MOCK_REQUEST *req)
+{
+	MOCK_OBJECT **obj_ptr, *obj;
+
+	pthread_mutex_lock(&store_lock);
+	obj_ptr = _find_object(req->path);
+	obj = *obj_ptr;
+	if (obj == NULL) {
+		pthread_mutex_unlock(&store_lock);
+		return _reply(conn, 404, "Not Found", NULL, NULL, 0, 0);
+	}
+	*obj_ptr = obj->next;
+	store_stat.num_objects--;
+	pthread_mutex_unlock(&store_lock);
+
+	free(obj->name);
+	free(obj->data);
+	free(obj);
+	return _reply(conn, 204, "No Content", NULL, NULL, 0, 0);
+}
+
+/* Returns 0 if the connection can serve the next request */
+static int32_t _serve_request(MOCK_CONN *conn, char *buf)
+{
+	MOCK_REQUEST req;
+	int64_t num_extra;
+	char *body;
+	int32_t ret, inject_error;
+
+	ret = _read_request(conn, buf, &req, &num_extra);
+	if (ret == -ENOTSUP) {
+		/* Only bodies of known length are supported */
+		_reply(conn, 411, "Length Required", NULL, NULL, 0, 0);
+		return ret;
+	}
+	if (ret < 0)
+		return ret;
+
+	body = NULL;
+	if (req.content_length > 0) {
+		ret = _read_body(conn, buf, num_extra, req.content_length,
+				 &body);
+		if (ret < 0)
+			return ret;
+	}
+
+	inject_error = ((store_conf.error_permille > 0) &&
+			((int32_t)(rand_r(&(conn->seed)) % 1000) <
+			 store_conf.error_permille));
+	pthread_mutex_lock(&store_lock);
+	store_stat.num_requests++;
+	if (inject_error)
+		store_stat.num_errors++;
+	pthread_mutex_unlock(&store_lock);
+
+	if (store_conf.latency_ms > 0)
+		usleep(store_conf.latency_ms * 1000);
+
+	if (inject_error) {
+		free(body);
+		if (store_conf.error_code == 0)
+			return -ECONNRESET;
+		ret = _reply(conn, store_conf.error_code, "Injected Error",
+			     NULL, NULL, 0, 0);
+	} else if (strstr(req.path, "/auth/") == req.path) {
+		free(body);
+		ret = _handle_auth(conn);
+	} else if (strcmp(req.method, "PUT") == 0) {
+		ret = _handle_put(conn, &req, body);
+	} else {
+		free(body);
+		if (strcmp(req.method, "GET") == 0)
+			ret = _handle_get(conn, &req, 1);
+		else if (strcmp(req.method, "HEAD") == 0)
+			ret = _handle_get(conn, &req, 0);
+		else if (strcmp(req.method, "DELETE") == 0)
+			ret = _handle_delete(conn, &req);
+		else
+			ret = _reply(conn, 501, "Not Implemented", NULL, NULL,
+				     0, 0);
+	}
+	if (ret < 0)
+		return ret;
+	return (req.keep_alive == 1) ? 0 : -ECONNRESET;
+}
+
+static void *_serve_conn(void *ptr)
+{
+	MOCK_CONN conn;
+	char *buf;
+	int32_t count;
+
+	memset(&conn, 0, sizeof(MOCK_CONN));
+	conn.fd = (int32_t)(intptr_t)ptr;
+	conn.seed = (uint32_t)conn.fd * 2654435761U;
+
+	buf = malloc(MOCK_HEADER_SIZE);
+	if (buf != NULL) {
+		while (_serve_request(&conn, buf) == 0)
+			;
+		free(buf);
+	}
+	close(conn.fd);
+
+	pthread_mutex_lock(&store_lock);
+	for (count = 0; count < MOCK_MAX_CONNS; count++) {
+		if (conn_fds[count] == conn.fd) {
+			conn_fds[count] = -1;
+			break;
+		}
+	}
+	num_active_conns--;
+	pthread_cond_broadcast(&conn_cond);
+	pthread_mutex_unlock(&store_lock);
+	return NULL;
+}
+
+static void *_accept_loop(void *ptr)
+{
+	pthread_t conn_thread;
+	int32_t fd, count, on = 1;
+
+	(void)ptr;
+	while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		pthread_mutex_lock(&store_lock);
+		for (count = 0; count < MOCK_MAX_CONNS; count++)
+			if (conn_fds[count] < 0)
+				break;
+		if (count >= MOCK_MAX_CONNS) {
+			pthread_mutex_unlock(&store_lock);
+			close(fd);
+			continue;
+		}
+		conn_fds[count] = fd;
+		num_active_conns++;
+		store_stat.num_connections++;
+		pthread_mutex_unlock(&store_lock);
+
+		if (pthread_create(&conn_thread, NULL, _serve_conn,
+				   (void *)(intptr_t)fd) != 0) {
+			pthread_mutex_lock(&store_lock);
+			conn_fds[count] = -1;
+			num_active_conns--;
+			pthread_mutex_unlock(&store_lock);
+			close(fd);
+			continue;
+		}
+		pthread_detach(conn_thread);
+	}
+	return NULL;
+}
+
+/**
+ * Start serving on 127.0.0.1.
+ *
+ * @param conf Injected faults, and the port to listen on. If the port is
+ *             0, the picked port is returned in it.
+ *
+ * @return 0 on success, or negative error code.
+ */
+int32_t start_mock_store(MOCK_STORE_CONF *conf)
+{
+	struct sockaddr_in addr;
+	socklen_t addr_len;
+	int32_t ret, count, on = 1;
+
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (listen_fd < 0)
+		return -errno;
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons((uint16_t)conf->port);
+	addr_len = sizeof(addr);
+	if ((bind(listen_fd, (struct sockaddr *)&addr, addr_len) < 0) ||
+	    (listen(listen_fd, 128) < 0) ||
+	    (getsockname(listen_fd, (struct sockaddr *)&addr,
+			 &addr_len) < 0)) {
+		ret = -errno;
+		close(listen_fd);
+		listen_fd = -1;
+		return ret;
+	}
+	conf->port = ntohs(addr.sin_port);
+
+	memcpy(&store_conf, conf, sizeof(MOCK_STORE_CONF));
+	memset(&store_stat, 0, sizeof(MOCK_STORE_STAT));
+	for (count = 0; count < MOCK_MAX_CONNS; count++)
+		conn_fds[count] = -1;
+	num_active_conns = 0;
+
+	ret = pthread_create(&accept_thread, NULL, _accept_loop, NULL);
+	if (ret != 0) {
+		close(listen_fd);
+		listen_fd = -1;
+		return -ret;
+	}
+	return 0;
+}
+
+/**
+ * Stop serving, close connections and drop all objects.
+ */
+void stop_mock_store(void)
+{
+	MOCK_OBJECT *obj;
+	int32_t count;
+
+	if (listen_fd < 0)
+		return;
+	shutdown(listen_fd, SHUT_RDWR);
+	close(listen_fd);
+	pthread_join(accept_thread, NULL);
+	listen_fd = -1;
+
+	pthread_mutex_lock(&store_lock);
+	for (count = 0; count < MOCK_MAX_CONNS; count++)
+		if (conn_fds[count] >= 0)
+			shutdown(conn_fds[count], SHUT_RDWR);
+	while (num_active_conns > 0)
+		pthread_cond_wait(&conn_cond, &store_lock);
+
+	for (count = 0; count < MOCK_HASH_SIZE; count++) {
+		while (object_hash[count] != NULL) {
+			obj = object_hash[count];
+			object_hash[count] = obj->next;
+			free(obj->name);
+			free(obj->data);
+			free(obj);
+		}
+	}
+	store_stat.num_objects = 0;
+	pthread_mutex_unlock(&store_lock);
+}
+
+void mock_store_get_stat(MOCK_STORE_STAT *stat)
+{
+	pthread_mutex_lock(&store_lock);
+	memcpy(stat, &store_stat, sizeof(MOCK_STORE_STAT));
+	pthread_mutex_unlock(&store_lock);
+}
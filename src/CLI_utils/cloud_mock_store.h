@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GW20_CLI_UTILS_CLOUD_MOCK_STORE_H_
+#define GW20_CLI_UTILS_CLOUD_MOCK_STORE_H_
+
+#include <stdint.h>
+
+/* Account, token and bucket served by the mock store */
+#define MOCK_SWIFT_ACCOUNT "AUTH_bench"
+#define MOCK_SWIFT_TOKEN "bench_token"
+
+typedef struct {
+	/* 0 to pick a free port */
+	int32_t port;
+	/* Delay before each response */
+	int64_t latency_ms;
+	/* Per connection limit of request and response bodies. 0 for none */
+	int64_t bandwidth_kbps;
+	/* Requests failing, in units of 1/1000 */
+	int32_t error_permille;
+	/* HTTP code of failing requests, or 0 to drop the connection */
+	int32_t error_code;
+} MOCK_STORE_CONF;
+
+typedef struct {
+	int64_t num_requests;
+	int64_t num_errors;
+	int64_t num_connections;
+	int64_t num_objects;
+} MOCK_STORE_STAT;
+
+/* Objects are kept in memory, keyed by path. Enough of the Swift
+(v1.0 auth, object PUT/GET/DELETE, HEAD) and path-style S3 protocols is
+spoken for hcfscurl.c. */
+int32_t start_mock_store(MOCK_STORE_CONF *conf);
+void stop_mock_store(void);
+void mock_store_get_stat(MOCK_STORE_STAT *stat);
+
+#endif  /* GW20_CLI_UTILS_CLOUD_MOCK_STORE_H_ */
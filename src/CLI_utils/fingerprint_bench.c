@@ -0,0 +1,341 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/* Measures the MB/s of computing dedup obj_ids of block files, comparing
+* the former get_obj_id (16 KB freads plus separate reads of the bytes to
+* check) with the streaming fingerprint of obj_fingerprint.c. The raw
+* SHA-256 speed of the low level and EVP interfaces of the linked OpenSSL
+* is also reported.
+*
+* Usage: fingerprint_bench [options], see _usage() below. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+#include <openssl/crypto.h>
+#include <openssl/sha.h>
+
+#include "global.h"
+#include "obj_fingerprint.h"
+
+typedef struct {
+	int32_t num_blocks;
+	int64_t block_size;
+	int32_t rounds;
+	char *dir;
+} BENCH_CONF;
+
+static BENCH_CONF bench_conf;
+
+static void _usage(const char *name)
+{
+	printf("Usage: %s [options]\n"
+	       "  -n <num>     Number of block files (64)\n"
+	       "  -s <bytes>   Block size (1048576)\n"
+	       "  -r <num>     Rounds over the blocks (5)\n"
+	       "  -d <dir>     Dir for the block files (/tmp)\n",
+	       name);
+}
+
+static int64_t _elapsed_us(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000LL +
+	       (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+static double _mb_per_sec(int64_t bytes, int64_t elapsed_us)
+{
+	if (elapsed_us <= 0)
+		elapsed_us = 1;
+	return ((double) bytes / 1048576.0) / ((double) elapsed_us / 1e6);
+}
+
+/* get_obj_id as it was before the streaming fingerprint */
+static int32_t _old_obj_id(char *path, uint8_t obj_id[OBJID_LENGTH])
+{
+	FILE *fptr;
+	uint8_t buf[16384];
+	size_t bytes_read;
+	struct stat obj_stat;
+	off_t size, rest;
+	SHA256_CTX ctx;
+	int32_t fd;
+
+	if (access(path, R_OK) == -1)
+		return -1;
+	stat(path, &obj_stat);
+	size = obj_stat.st_size;
+
+	SHA256_Init(&ctx);
+	fptr = fopen(path, "rb");
+	if (fptr == NULL)
+		return -errno;
+	fd = fileno(fptr);
+	while ((bytes_read = fread(buf, 1, sizeof(buf), fptr)) > 0)
+		SHA256_Update(&ctx, buf, bytes_read);
+	SHA256_Final(obj_id, &ctx);
+
+	memset(obj_id + SHA256_DIGEST_LENGTH, 0, BYTES_TO_CHECK * 2);
+	if (size >= BYTES_TO_CHECK) {
+		pread(fd, obj_id + SHA256_DIGEST_LENGTH, BYTES_TO_CHECK, 0);
+		rest = size - BYTES_TO_CHECK;
+		if (rest > BYTES_TO_CHECK)
+			rest = BYTES_TO_CHECK;
+		pread(fd, obj_id + SHA256_DIGEST_LENGTH + BYTES_TO_CHECK, rest,
+		      size - rest);
+	} else {
+		pread(fd, obj_id + SHA256_DIGEST_LENGTH, size, 0);
+	}
+	fclose(fptr);
+	return 0;
+}
+
+static int32_t _stream_obj_id(char *path, uint8_t obj_id[OBJID_LENGTH])
+{
+	off_t size;
+	int32_t fd, ret;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	ret = fingerprint_fd(fd, obj_id, &size);
+	close(fd);
+	return ret;
+}
+
+static void _block_path(char *path, size_t len, int32_t block_idx)
+{
+	snprintf(path, len, "%s/fingerprint_bench_%d_%d", bench_conf.dir,
+		 (int32_t) getpid(), block_idx);
+}
+
+static int32_t _create_blocks(void)
+{
+	char path[512];
+	uint8_t *buf;
+	int64_t pos;
+	int32_t count, fd;
+
+	buf = malloc(bench_conf.block_size);
+	if (buf == NULL)
+		return -ENOMEM;
+	srand(time(NULL));
+	for (count = 0; count < bench_conf.num_blocks; count++) {
+		for (pos = 0; pos < bench_conf.block_size; pos++)
+			buf[pos] = rand() & 0xFF;
+		_block_path(path, sizeof(path), count);
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+		if (fd < 0) {
+			free(buf);
+			return -errno;
+		}
+		if (write(fd, buf, bench_conf.block_size) !=
+		    bench_conf.block_size) {
+			close(fd);
+			free(buf);
+			return -EIO;
+		}
+		close(fd);
+	}
+	free(buf);
+	return 0;
+}
+
+static void _remove_blocks(void)
+{
+	char path[512];
+	int32_t count;
+
+	for (count = 0; count < bench_conf.num_blocks; count++) {
+		_block_path(path, sizeof(path), count);
+		unlink(path);
+	}
+}
+
+/* Runs "func" over all blocks for the configured rounds. Blocks are in
+the page cache after the first round, as they are when just written. */
+static int32_t _bench_files(const char *name,
+			    int32_t (*func)(char *, uint8_t *),
+			    uint8_t *obj_ids)
+{
+	struct timespec start;
+	char path[512];
+	int32_t count, round;
+	int64_t elapsed_us;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (round = 0; round < bench_conf.rounds; round++) {
+		for (count = 0; count < bench_conf.num_blocks; count++) {
+			_block_path(path, sizeof(path), count);
+			if (func(path, obj_ids + count * OBJID_LENGTH) < 0) {
+				printf("Unable to fingerprint %s\n", path);
+				return -EIO;
+			}
+		}
+	}
+	elapsed_us = _elapsed_us(&start);
+	printf("%-28s %10.1f MB/s\n", name,
+	       _mb_per_sec(bench_conf.block_size * bench_conf.num_blocks *
+			   bench_conf.rounds, elapsed_us));
+	return 0;
+}
+
+/* Raw hashing of an in-memory block, without file reads */
+static void _bench_memory(void)
+{
+	struct timespec start;
+	OBJ_FINGERPRINT_CTX ctx;
+	SHA256_CTX sha_ctx;
+	uint8_t *buf, obj_id[OBJID_LENGTH];
+	int64_t total;
+	int32_t count;
+
+	buf = calloc(1, bench_conf.block_size);
+	if (buf == NULL)
+		return;
+	total = bench_conf.block_size * bench_conf.num_blocks *
+		bench_conf.rounds;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (count = 0; count < bench_conf.num_blocks * bench_conf.rounds;
+	     count++) {
+		SHA256_Init(&sha_ctx);
+		SHA256_Update(&sha_ctx, buf, bench_conf.block_size);
+		SHA256_Final(obj_id, &sha_ctx);
+	}
+	printf("%-28s %10.1f MB/s\n", "memory, SHA256_Update",
+	       _mb_per_sec(total, _elapsed_us(&start)));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (count = 0; count < bench_conf.num_blocks * bench_conf.rounds;
+	     count++) {
+		fingerprint_init(&ctx);
+		fingerprint_update(&ctx, buf, bench_conf.block_size);
+		fingerprint_final(&ctx, obj_id, NULL);
+	}
+	printf("%-28s %10.1f MB/s\n", "memory, EVP fingerprint",
+	       _mb_per_sec(total, _elapsed_us(&start)));
+	free(buf);
+}
+
+static const char *_sha_extensions(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	uint32_t eax, ebx, ecx, edx;
+
+	if ((__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) != 0) &&
+	    ((ebx & (1 << 29)) != 0))
+		return "yes";
+	return "no";
+#else
+	return "unknown";
+#endif
+}
+
+static int32_t _parse_args(int32_t argc, char **argv)
+{
+	int32_t opt;
+
+	bench_conf.num_blocks = 64;
+	bench_conf.block_size = 1048576;
+	bench_conf.rounds = 5;
+	bench_conf.dir = "/tmp";
+
+	while ((opt = getopt(argc, argv, "n:s:r:d:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			bench_conf.num_blocks = atoi(optarg);
+			break;
+		case 's':
+			bench_conf.block_size = strtoll(optarg, NULL, 10);
+			break;
+		case 'r':
+			bench_conf.rounds = atoi(optarg);
+			break;
+		case 'd':
+			bench_conf.dir = optarg;
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+	if ((bench_conf.num_blocks <= 0) || (bench_conf.block_size <= 0) ||
+	    (bench_conf.rounds <= 0))
+		return -EINVAL;
+	return 0;
+}
+
+int32_t main(int32_t argc, char **argv)
+{
+	uint8_t *old_ids, *new_ids;
+	int32_t ret;
+
+	if (_parse_args(argc, argv) < 0) {
+		_usage(argv[0]);
+		exit(-EINVAL);
+	}
+
+	old_ids = calloc(bench_conf.num_blocks, OBJID_LENGTH);
+	new_ids = calloc(bench_conf.num_blocks, OBJID_LENGTH);
+	if ((old_ids == NULL) || (new_ids == NULL))
+		exit(-ENOMEM);
+
+	printf("%s, SHA extensions: %s\n", SSLeay_version(SSLEAY_VERSION),
+	       _sha_extensions());
+	printf("%d blocks of %" PRId64 " bytes, %d rounds\n",
+	       bench_conf.num_blocks, bench_conf.block_size,
+	       bench_conf.rounds);
+
+	ret = _create_blocks();
+	if (ret < 0) {
+		printf("Unable to create block files. Code %d\n", -ret);
+		_remove_blocks();
+		exit(ret);
+	}
+
+	ret = _bench_files("files, former get_obj_id", _old_obj_id, old_ids);
+	if (ret == 0)
+		ret = _bench_files("files, streaming", _stream_obj_id,
+				   new_ids);
+	if ((ret == 0) &&
+	    (memcmp(old_ids, new_ids, bench_conf.num_blocks * OBJID_LENGTH)
+	     != 0)) {
+		printf("Error: obj_ids differ\n");
+		ret = -EIO;
+	}
+	if (ret == 0)
+		_bench_memory();
+
+	_remove_blocks();
+	free(old_ids);
+	free(new_ids);
+	return ret;
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/* write_log for the tools that link sources of HCFS without the logger of
+* the daemon. Only errors are printed, to stderr. Declared in logger.h,
+* which is not included as it defines the log file of the daemon. */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+
+int32_t write_log(int32_t level, const char *format, ...)
+{
+	va_list alist;
+
+	if (level > 2)
+		return 0;
+	va_start(alist, format);
+	vfprintf(stderr, format, alist);
+	va_end(alist);
+	return 0;
+}
@@ -758,6 +758,8 @@ int32_t delete_filesystem(char *fsname)
 		errcode = ret;
 		goto errcode_handle;
 	}
+	/* The root inode could be reused by a new filesystem */
+	delete_pathcache_snapshot(FS_root);
 
 	/* Delete FS from database */
 	ret = delete_dir_entry_btree(&temp_entry, &tpage,
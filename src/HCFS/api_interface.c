@@ -1102,7 +1102,7 @@ void api_module(void *index1)
 	int32_t msg_index;
 	uint64_t num_entries;
 	uint32_t api_code, arg_len, ret_len;
-	int64_t llretval, llretval2;
+	int64_t llretval;
 	uint32_t uint32val;
 	bool boolval;
 
@@ -1116,6 +1116,10 @@ void api_module(void *index1)
 	ino_t *pinned_list, *unpinned_list;
 	int32_t loglevel;
 	int64_t max_pinned_size;
+	META_CACHE_STAT metacache_stat;
+	int64_t metacache_vals[6];
+	int64_t xfer_vals[6];
+	int64_t stall_vals[CACHE_STALL_BUCKETS + 2];
 	PTHREAD_T *thread_ptr;
 
 	UNUSED(index1);
@@ -1226,7 +1230,6 @@ void api_module(void *index1)
 
 		retcode = 0;
 		llretval = 0;
-		llretval2 = 0;
 		switch (api_code) {
 		case PIN:
 			memcpy(&reserved_pinned_size, largebuf,
@@ -1393,14 +1396,23 @@ void api_module(void *index1)
 			goto return_llretval;
 		case GETXFERSTAT:
 			retcode = 0;
-			ret_len = sizeof(int64_t) * 2;
+			/* Transferred sizes, followed by current concurrency
+			 * and upload throughput (KB/s) and latency (ms) */
 			sem_wait(&(hcfs_system->access_sem));
-			llretval = hcfs_system->systemdata.xfer_size_download;
-			llretval2 = hcfs_system->systemdata.xfer_size_upload;
+			xfer_vals[0] = hcfs_system->systemdata.xfer_size_download;
+			xfer_vals[1] = hcfs_system->systemdata.xfer_size_upload;
+			xfer_vals[2] = hcfs_system->xfer_concurrency_stat
+					       .upload_concurrency;
+			xfer_vals[3] = hcfs_system->xfer_concurrency_stat
+					       .sync_concurrency;
+			xfer_vals[4] = hcfs_system->xfer_concurrency_stat
+					       .upload_throughput;
+			xfer_vals[5] = hcfs_system->xfer_concurrency_stat
+					       .upload_latency_ms;
 			sem_post(&(hcfs_system->access_sem));
+			ret_len = sizeof(xfer_vals);
 			send(fd1, &ret_len, sizeof(uint32_t), MSG_NOSIGNAL);
-			send(fd1, &llretval, sizeof(int64_t), MSG_NOSIGNAL);
-			send(fd1, &llretval2, sizeof(int64_t), MSG_NOSIGNAL);
+			send(fd1, xfer_vals, sizeof(xfer_vals), MSG_NOSIGNAL);
 			goto no_return;
 		case RESETXFERSTAT:
 			sem_wait(&(hcfs_system->access_sem));
@@ -1408,6 +1420,37 @@ void api_module(void *index1)
 			hcfs_system->systemdata.xfer_size_upload = 0;
 			sem_post(&(hcfs_system->access_sem));
 			goto return_retcode;
+		case GETMETACACHESTAT:
+			retcode = 0;
+			meta_cache_get_stat(&metacache_stat,
+					    &(metacache_vals[3]));
+			metacache_vals[0] = metacache_stat.num_hits;
+			metacache_vals[1] = metacache_stat.num_misses;
+			metacache_vals[2] = metacache_stat.num_evictions;
+			metacache_vals[4] = metacache_stat.mem_used;
+			metacache_vals[5] = MAX_META_MEM_CACHE_BYTES;
+			ret_len = sizeof(metacache_vals);
+			send(fd1, &ret_len, sizeof(uint32_t), MSG_NOSIGNAL);
+			send(fd1, metacache_vals, sizeof(metacache_vals),
+			     MSG_NOSIGNAL);
+			goto no_return;
+		case GETCACHESTALLSTAT:
+			/* Stalls in each histogram bucket, followed by total
+			and max stall time in milliseconds */
+			retcode = 0;
+			sem_wait(&(hcfs_system->access_sem));
+			memcpy(stall_vals,
+			       hcfs_system->cache_stall_stat.num_stalls,
+			       sizeof(int64_t) * CACHE_STALL_BUCKETS);
+			stall_vals[CACHE_STALL_BUCKETS] =
+			    hcfs_system->cache_stall_stat.total_stall_ms;
+			stall_vals[CACHE_STALL_BUCKETS + 1] =
+			    hcfs_system->cache_stall_stat.max_stall_ms;
+			sem_post(&(hcfs_system->access_sem));
+			ret_len = sizeof(stall_vals);
+			send(fd1, &ret_len, sizeof(uint32_t), MSG_NOSIGNAL);
+			send(fd1, stall_vals, sizeof(stall_vals), MSG_NOSIGNAL);
+			goto no_return;
 		case GETMAXPINSIZE:
 			llretval = MAX_PINNED_LIMIT;
 			goto return_llretval;
@@ -673,7 +673,7 @@ int32_t init_progress_info(int32_t fd, int64_t backend_blocks,
 #else
 		block_uploading_status.backend_seq =
 			block_page.block_entries[e_index].seqnum;
-		if (CURRENT_BACKEND == GOOGLEDRIVE)
+		if (BLOCK_ID_IS_RECORDED)
 			strncpy(block_uploading_status.backend_gdrive_id,
 				block_page.block_entries[e_index].blockID,
 				GDRIVE_ID_LENGTH);
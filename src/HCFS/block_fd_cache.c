@@ -0,0 +1,434 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Process-wide cache of opened block files. File handles used to fopen
+* the block file again whenever they moved to another block, so random
+* access over a few blocks paid an open, setbuf and close per request.
+* Entries are keyed by (inode, block) and reference counted. Entries not
+* referenced by any file handle are kept in a LRU list, and the oldest one
+* is closed when there are more than MAX_BLOCK_FD_CACHE_ENTRIES of them.
+*
+* Whoever removes or renames a block file (cache replacement, truncate, inode
+* deletion, restoration) must invalidate the entry first, so that later
+* lookups will open the new file instead of the removed one. Block files
+* removed by other processes cannot be invalidated, so entries of unlinked
+* files are also dropped when found. */
+
+#include "block_fd_cache.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "logger.h"
+
+static BLOCK_FD_CACHE block_fd_cache;
+/* Block files are also moved before the cache is set up at startup */
+static BOOL block_fd_cache_inited = FALSE;
+
+static inline uint32_t _block_fd_hash(ino_t this_inode, int64_t block_no)
+{
+	return (uint32_t)(((uint64_t)this_inode * 31 + (uint64_t)block_no) %
+			  BLOCK_FD_CACHE_HASH_SIZE);
+}
+
+static void _lru_remove(BLOCK_FD_ENTRY *entry)
+{
+	if (entry->lru_prev != NULL)
+		entry->lru_prev->lru_next = entry->lru_next;
+	else
+		block_fd_cache.lru_first = entry->lru_next;
+	if (entry->lru_next != NULL)
+		entry->lru_next->lru_prev = entry->lru_prev;
+	else
+		block_fd_cache.lru_last = entry->lru_prev;
+	entry->lru_prev = NULL;
+	entry->lru_next = NULL;
+	block_fd_cache.num_idle--;
+}
+
+static void _lru_push_front(BLOCK_FD_ENTRY *entry)
+{
+	entry->lru_prev = NULL;
+	entry->lru_next = block_fd_cache.lru_first;
+	if (block_fd_cache.lru_first != NULL)
+		block_fd_cache.lru_first->lru_prev = entry;
+	else
+		block_fd_cache.lru_last = entry;
+	block_fd_cache.lru_first = entry;
+	block_fd_cache.num_idle++;
+}
+
+static void _hash_remove(BLOCK_FD_ENTRY *entry)
+{
+	BLOCK_FD_ENTRY **prev_ptr;
+	uint32_t index;
+
+	index = _block_fd_hash(entry->this_inode, entry->block_no);
+	prev_ptr = &(block_fd_cache.hash_table[index]);
+	while (*prev_ptr != NULL) {
+		if (*prev_ptr == entry) {
+			*prev_ptr = entry->hash_next;
+			break;
+		}
+		prev_ptr = &((*prev_ptr)->hash_next);
+	}
+	entry->hash_next = NULL;
+}
+
+static BLOCK_FD_ENTRY *_hash_find(ino_t this_inode, int64_t block_no)
+{
+	BLOCK_FD_ENTRY *entry;
+
+	entry = block_fd_cache.hash_table[_block_fd_hash(this_inode,
+							 block_no)];
+	while (entry != NULL) {
+		if ((entry->this_inode == this_inode) &&
+		    (entry->block_no == block_no))
+			return entry;
+		entry = entry->hash_next;
+	}
+	return NULL;
+}
+
+static void _free_entry(BLOCK_FD_ENTRY *entry)
+{
+	if (entry->fptr != NULL)
+		fclose(entry->fptr);
+	pthread_rwlock_destroy(&(entry->rw_lock));
+	sem_destroy(&(entry->flock_sem));
+	free(entry);
+}
+
+/* Detach "entry" from the table. Caller must hold table_sem. Returns the
+* entry if it can be closed now. */
+static BLOCK_FD_ENTRY *_invalidate_entry(BLOCK_FD_ENTRY *entry)
+{
+	block_fd_cache.hash_gen[_block_fd_hash(entry->this_inode,
+					       entry->block_no)]++;
+	_hash_remove(entry);
+	entry->invalidated = TRUE;
+	if (entry->refcount > 0)
+		return NULL;
+	_lru_remove(entry);
+	return entry;
+}
+
+/* Check if the block file of "entry" was removed */
+static BOOL _entry_unlinked(BLOCK_FD_ENTRY *entry)
+{
+	struct stat tmpstat;
+
+	if (fstat(fileno(entry->fptr), &tmpstat) < 0)
+		return TRUE;
+	return (tmpstat.st_nlink == 0) ? TRUE : FALSE;
+}
+
+/* Detach the least recently used idle entry if there are too many of them.
+* Caller must hold table_sem and close the returned entry after
+* releasing it. */
+static BLOCK_FD_ENTRY *_pick_victim(void)
+{
+	BLOCK_FD_ENTRY *victim;
+
+	if (block_fd_cache.num_idle <= MAX_BLOCK_FD_CACHE_ENTRIES)
+		return NULL;
+	victim = block_fd_cache.lru_last;
+	_lru_remove(victim);
+	_hash_remove(victim);
+	return victim;
+}
+
+int32_t init_block_fd_cache(void)
+{
+	memset(&block_fd_cache, 0, sizeof(BLOCK_FD_CACHE));
+	sem_init(&(block_fd_cache.table_sem), 0, 1);
+	block_fd_cache_inited = TRUE;
+	return 0;
+}
+
+void destroy_block_fd_cache(void)
+{
+	BLOCK_FD_ENTRY *entry;
+
+	sem_wait(&(block_fd_cache.table_sem));
+	while (block_fd_cache.lru_first != NULL) {
+		entry = block_fd_cache.lru_first;
+		_lru_remove(entry);
+		_hash_remove(entry);
+		_free_entry(entry);
+	}
+	sem_post(&(block_fd_cache.table_sem));
+	block_fd_cache_inited = FALSE;
+}
+
+/************************************************************************
+*
+* Function name: get_block_fd
+*        Inputs: ino_t this_inode, int64_t block_no, const char *blockpath
+*       Summary: Get a reference to the opened block file of "block_no" of
+*                "this_inode", opening "blockpath" if not cached yet.
+*                The reference must be returned with put_block_fd.
+*  Return value: Pointer to the cache entry, or NULL with errno set.
+*
+*************************************************************************/
+BLOCK_FD_ENTRY *get_block_fd(ino_t this_inode, int64_t block_no,
+			     const char *blockpath)
+{
+	BLOCK_FD_ENTRY *entry, *new_entry, *victim;
+	FILE *fptr;
+	uint32_t index, gen;
+	int32_t errcode;
+
+	index = _block_fd_hash(this_inode, block_no);
+	while (TRUE) {
+		victim = NULL;
+		sem_wait(&(block_fd_cache.table_sem));
+		entry = _hash_find(this_inode, block_no);
+		if ((entry != NULL) && (_entry_unlinked(entry) == TRUE)) {
+			/* Removed by a process not sharing this cache */
+			victim = _invalidate_entry(entry);
+			entry = NULL;
+		}
+		if (entry != NULL) {
+			if (entry->refcount == 0)
+				_lru_remove(entry);
+			entry->refcount++;
+			sem_post(&(block_fd_cache.table_sem));
+			return entry;
+		}
+		gen = block_fd_cache.hash_gen[index];
+		sem_post(&(block_fd_cache.table_sem));
+		if (victim != NULL)
+			_free_entry(victim);
+
+		/* Do not hold the table while opening the file */
+		fptr = fopen(blockpath, "r+");
+		if (fptr == NULL)
+			return NULL;
+		setbuf(fptr, NULL);
+
+		new_entry = calloc(1, sizeof(BLOCK_FD_ENTRY));
+		if (new_entry == NULL) {
+			fclose(fptr);
+			errno = ENOMEM;
+			return NULL;
+		}
+		new_entry->this_inode = this_inode;
+		new_entry->block_no = block_no;
+		new_entry->fptr = fptr;
+		new_entry->refcount = 1;
+		pthread_rwlock_init(&(new_entry->rw_lock), NULL);
+		sem_init(&(new_entry->flock_sem), 0, 1);
+
+		sem_wait(&(block_fd_cache.table_sem));
+		if (block_fd_cache.hash_gen[index] != gen) {
+			/* The opened file may be removed meanwhile */
+			sem_post(&(block_fd_cache.table_sem));
+			_free_entry(new_entry);
+			continue;
+		}
+		entry = _hash_find(this_inode, block_no);
+		if (entry != NULL) {
+			/* Someone else opened the same block meanwhile */
+			if (entry->refcount == 0)
+				_lru_remove(entry);
+			entry->refcount++;
+			sem_post(&(block_fd_cache.table_sem));
+			errcode = errno;
+			_free_entry(new_entry);
+			errno = errcode;
+			return entry;
+		}
+		new_entry->hash_next = block_fd_cache.hash_table[index];
+		block_fd_cache.hash_table[index] = new_entry;
+		sem_post(&(block_fd_cache.table_sem));
+
+		return new_entry;
+	}
+}
+
+/************************************************************************
+*
+* Function name: put_block_fd
+*        Inputs: BLOCK_FD_ENTRY *entry
+*       Summary: Return a reference obtained from get_block_fd. The block
+*                file is kept open for later use unless invalidated.
+*  Return value: None
+*
+*************************************************************************/
+void put_block_fd(BLOCK_FD_ENTRY *entry)
+{
+	BLOCK_FD_ENTRY *victim = NULL;
+
+	if (entry == NULL)
+		return;
+
+	sem_wait(&(block_fd_cache.table_sem));
+	entry->refcount--;
+	if (entry->refcount > 0) {
+		sem_post(&(block_fd_cache.table_sem));
+		return;
+	}
+	if (entry->invalidated == TRUE) {
+		victim = entry;
+	} else {
+		_lru_push_front(entry);
+		victim = _pick_victim();
+	}
+	sem_post(&(block_fd_cache.table_sem));
+
+	if (victim != NULL)
+		_free_entry(victim);
+}
+
+/************************************************************************
+*
+* Function name: lock_block_fd
+*        Inputs: BLOCK_FD_ENTRY *entry, int32_t lock_op
+*       Summary: Lock the block file with LOCK_SH or LOCK_EX, both against
+*                other users of "entry" and against other opened
+*                descriptors of the block file.
+*  Return value: 0 if successful, or negation of error code.
+*
+*************************************************************************/
+int32_t lock_block_fd(BLOCK_FD_ENTRY *entry, int32_t lock_op)
+{
+	int32_t ret, errcode;
+
+	if (lock_op == LOCK_EX) {
+		pthread_rwlock_wrlock(&(entry->rw_lock));
+		ret = flock(fileno(entry->fptr), LOCK_EX);
+		if (ret < 0) {
+			errcode = errno;
+			pthread_rwlock_unlock(&(entry->rw_lock));
+			return -errcode;
+		}
+		return 0;
+	}
+
+	pthread_rwlock_rdlock(&(entry->rw_lock));
+	sem_wait(&(entry->flock_sem));
+	if (entry->num_shared == 0) {
+		ret = flock(fileno(entry->fptr), LOCK_SH);
+		if (ret < 0) {
+			errcode = errno;
+			sem_post(&(entry->flock_sem));
+			pthread_rwlock_unlock(&(entry->rw_lock));
+			return -errcode;
+		}
+	}
+	entry->num_shared++;
+	sem_post(&(entry->flock_sem));
+	return 0;
+}
+
+void unlock_block_fd(BLOCK_FD_ENTRY *entry, int32_t lock_op)
+{
+	if (lock_op == LOCK_EX) {
+		flock(fileno(entry->fptr), LOCK_UN);
+		pthread_rwlock_unlock(&(entry->rw_lock));
+		return;
+	}
+
+	sem_wait(&(entry->flock_sem));
+	entry->num_shared--;
+	if (entry->num_shared == 0)
+		flock(fileno(entry->fptr), LOCK_UN);
+	sem_post(&(entry->flock_sem));
+	pthread_rwlock_unlock(&(entry->rw_lock));
+}
+
+/************************************************************************
+*
+* Function name: invalidate_block_fd
+*        Inputs: ino_t this_inode, int64_t block_no
+*       Summary: Drop the cached block file of "block_no" of "this_inode"
+*                after the file is removed or replaced. Users still
+*                holding a reference keep the old file until put_block_fd.
+*  Return value: None
+*
+*************************************************************************/
+void invalidate_block_fd(ino_t this_inode, int64_t block_no)
+{
+	BLOCK_FD_ENTRY *entry, *victim = NULL;
+
+	if (block_fd_cache_inited == FALSE)
+		return;
+
+	sem_wait(&(block_fd_cache.table_sem));
+	/* Files being opened by get_block_fd are not in the table yet */
+	block_fd_cache.hash_gen[_block_fd_hash(this_inode, block_no)]++;
+	entry = _hash_find(this_inode, block_no);
+	if (entry != NULL)
+		victim = _invalidate_entry(entry);
+	sem_post(&(block_fd_cache.table_sem));
+
+	if (victim != NULL)
+		_free_entry(victim);
+}
+
+/* Drop cached block files of "this_inode", or of all inodes if
+* "all_inodes" is TRUE */
+static void _invalidate_block_fds(ino_t this_inode, BOOL all_inodes)
+{
+	BLOCK_FD_ENTRY *entry, *next_entry, *victim_list = NULL;
+	int32_t count;
+
+	if (block_fd_cache_inited == FALSE)
+		return;
+
+	sem_wait(&(block_fd_cache.table_sem));
+	for (count = 0; count < BLOCK_FD_CACHE_HASH_SIZE; count++) {
+		block_fd_cache.hash_gen[count]++;
+		entry = block_fd_cache.hash_table[count];
+		while (entry != NULL) {
+			next_entry = entry->hash_next;
+			if (((all_inodes == TRUE) ||
+			     (entry->this_inode == this_inode)) &&
+			    (_invalidate_entry(entry) != NULL)) {
+				entry->hash_next = victim_list;
+				victim_list = entry;
+			}
+			entry = next_entry;
+		}
+	}
+	sem_post(&(block_fd_cache.table_sem));
+
+	while (victim_list != NULL) {
+		entry = victim_list;
+		victim_list = entry->hash_next;
+		_free_entry(entry);
+	}
+}
+
+/* Drop all cached block files of "this_inode" */
+void invalidate_inode_block_fds(ino_t this_inode)
+{
+	_invalidate_block_fds(this_inode, FALSE);
+}
+
+/* Drop all cached block files, after the block storage is replaced */
+void invalidate_all_block_fds(void)
+{
+	_invalidate_block_fds(0, TRUE);
+}
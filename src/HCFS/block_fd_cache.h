@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef GW20_HCFS_BLOCK_FD_CACHE_H_
+#define GW20_HCFS_BLOCK_FD_CACHE_H_
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "global.h"
+
+/* Max number of idle block files kept open */
+#define MAX_BLOCK_FD_CACHE_ENTRIES 256
+#define BLOCK_FD_CACHE_HASH_SIZE 1024
+
+typedef struct BLOCK_FD_ENTRY {
+	ino_t this_inode;
+	int64_t block_no;
+	FILE *fptr;
+	int32_t refcount;
+	BOOL invalidated;
+	/* flock is per open file description, and the description is
+	shared by all users of this entry. rw_lock serializes users in this
+	process, and only the first shared locker and the last shared
+	unlocker touch the flock. */
+	pthread_rwlock_t rw_lock;
+	sem_t flock_sem;
+	int32_t num_shared;
+	struct BLOCK_FD_ENTRY *hash_next;
+	struct BLOCK_FD_ENTRY *lru_prev;
+	struct BLOCK_FD_ENTRY *lru_next;
+} BLOCK_FD_ENTRY;
+
+typedef struct {
+	sem_t table_sem;
+	BLOCK_FD_ENTRY *hash_table[BLOCK_FD_CACHE_HASH_SIZE];
+	/* Bumped by every invalidation of entries in the bucket */
+	uint32_t hash_gen[BLOCK_FD_CACHE_HASH_SIZE];
+	/* Entries not referenced by anyone, most recently used first */
+	BLOCK_FD_ENTRY *lru_first;
+	BLOCK_FD_ENTRY *lru_last;
+	int32_t num_idle;
+} BLOCK_FD_CACHE;
+
+int32_t init_block_fd_cache(void);
+void destroy_block_fd_cache(void);
+BLOCK_FD_ENTRY *get_block_fd(ino_t this_inode, int64_t block_no,
+			     const char *blockpath);
+void put_block_fd(BLOCK_FD_ENTRY *entry);
+int32_t lock_block_fd(BLOCK_FD_ENTRY *entry, int32_t lock_op);
+void unlock_block_fd(BLOCK_FD_ENTRY *entry, int32_t lock_op);
+void invalidate_block_fd(ino_t this_inode, int64_t block_no);
+void invalidate_inode_block_fds(ino_t this_inode);
+void invalidate_all_block_fds(void);
+
+#endif  /* GW20_HCFS_BLOCK_FD_CACHE_H_ */
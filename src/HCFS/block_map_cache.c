@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Cache of block entry page positions of a single file. seek_page() used
+* to walk the indirect pointer pages in the meta file on every lookup, so
+* that I/O on a large file read up to four pointer pages each time it
+* crossed into another block entry page.
+*
+* Positions are keyed by the index of the block entry page, and kept in a
+* LRU list. The oldest position is dropped when there are more than
+* MAX_BLOCK_MAP_CACHE_PAGES of them. Only pages that exist are cached, and
+* a page never moves once created, so a cached position stays valid until
+* the meta file is replaced. The caller decides whether there is room to
+* cache a new position. */
+
+#include "block_map_cache.h"
+
+#include <errno.h>
+#include <stdlib.h>
+
+static inline uint32_t _block_map_hash(int64_t page_index)
+{
+	return (uint32_t)((uint64_t)page_index % BLOCK_MAP_CACHE_HASH_SIZE);
+}
+
+static void _lru_remove(BLOCK_MAP_CACHE *cache, BLOCK_MAP_CACHE_ENTRY *entry)
+{
+	if (entry->lru_prev != NULL)
+		entry->lru_prev->lru_next = entry->lru_next;
+	else
+		cache->lru_first = entry->lru_next;
+	if (entry->lru_next != NULL)
+		entry->lru_next->lru_prev = entry->lru_prev;
+	else
+		cache->lru_last = entry->lru_prev;
+	entry->lru_prev = NULL;
+	entry->lru_next = NULL;
+}
+
+static void _lru_push_front(BLOCK_MAP_CACHE *cache,
+			    BLOCK_MAP_CACHE_ENTRY *entry)
+{
+	entry->lru_prev = NULL;
+	entry->lru_next = cache->lru_first;
+	if (cache->lru_first != NULL)
+		cache->lru_first->lru_prev = entry;
+	else
+		cache->lru_last = entry;
+	cache->lru_first = entry;
+}
+
+static BLOCK_MAP_CACHE_ENTRY *_find_entry(BLOCK_MAP_CACHE *cache,
+					  int64_t page_index)
+{
+	BLOCK_MAP_CACHE_ENTRY *entry;
+
+	entry = cache->hash_table[_block_map_hash(page_index)];
+	while (entry != NULL) {
+		if (entry->page_index == page_index)
+			return entry;
+		entry = entry->hash_next;
+	}
+	return NULL;
+}
+
+static void _remove_entry(BLOCK_MAP_CACHE *cache,
+			  BLOCK_MAP_CACHE_ENTRY *entry)
+{
+	BLOCK_MAP_CACHE_ENTRY **prev_ptr;
+
+	prev_ptr = &(cache->hash_table[_block_map_hash(entry->page_index)]);
+	while (*prev_ptr != entry)
+		prev_ptr = &((*prev_ptr)->hash_next);
+	*prev_ptr = entry->hash_next;
+
+	_lru_remove(cache, entry);
+	cache->num_pages--;
+	free(entry);
+}
+
+/************************************************************************
+*
+* Function name: block_map_cache_get
+*        Inputs: BLOCK_MAP_CACHE *cache, int64_t page_index
+*       Summary: Find the cached file pos of block entry page "page_index".
+*                The page becomes the most recently used one.
+*  Return value: File pos of the page, or 0 if not cached.
+*
+*************************************************************************/
+int64_t block_map_cache_get(BLOCK_MAP_CACHE *cache, int64_t page_index)
+{
+	BLOCK_MAP_CACHE_ENTRY *entry;
+
+	if (cache == NULL)
+		return 0;
+
+	entry = _find_entry(cache, page_index);
+	if (entry == NULL)
+		return 0;
+
+	if (cache->lru_first != entry) {
+		_lru_remove(cache, entry);
+		_lru_push_front(cache, entry);
+	}
+	return entry->page_pos;
+}
+
+/************************************************************************
+*
+* Function name: block_map_cache_put
+*        Inputs: BLOCK_MAP_CACHE **cache_ptr, int64_t page_index,
+*                int64_t page_pos
+*       Summary: Cache "page_pos" as the file pos of block entry page
+*                "page_index". The cache is allocated if *cache_ptr is
+*                NULL. If the page is already cached, the position is
+*                replaced. If there are too many pages, the least recently
+*                used one is dropped.
+*  Return value: 0 if successful. Otherwise returns negation of error code.
+*
+*************************************************************************/
+int32_t block_map_cache_put(BLOCK_MAP_CACHE **cache_ptr, int64_t page_index,
+			    int64_t page_pos)
+{
+	BLOCK_MAP_CACHE *cache;
+	BLOCK_MAP_CACHE_ENTRY *entry;
+	uint32_t hash_idx;
+
+	if ((page_index < 0) || (page_pos <= 0))
+		return -EINVAL;
+
+	if (*cache_ptr == NULL) {
+		*cache_ptr = calloc(1, sizeof(BLOCK_MAP_CACHE));
+		if (*cache_ptr == NULL)
+			return -ENOMEM;
+	}
+	cache = *cache_ptr;
+
+	entry = _find_entry(cache, page_index);
+	if (entry != NULL) {
+		entry->page_pos = page_pos;
+		if (cache->lru_first != entry) {
+			_lru_remove(cache, entry);
+			_lru_push_front(cache, entry);
+		}
+		return 0;
+	}
+
+	entry = malloc(sizeof(BLOCK_MAP_CACHE_ENTRY));
+	if (entry == NULL)
+		return -ENOMEM;
+	entry->page_index = page_index;
+	entry->page_pos = page_pos;
+
+	hash_idx = _block_map_hash(page_index);
+	entry->hash_next = cache->hash_table[hash_idx];
+	cache->hash_table[hash_idx] = entry;
+	_lru_push_front(cache, entry);
+	cache->num_pages++;
+
+	if (cache->num_pages > MAX_BLOCK_MAP_CACHE_PAGES)
+		block_map_cache_shrink(cache);
+	return 0;
+}
+
+/************************************************************************
+*
+* Function name: block_map_cache_shrink
+*        Inputs: BLOCK_MAP_CACHE *cache
+*       Summary: Drop the least recently used page from the cache.
+*  Return value: Number of bytes freed, or 0 if there is no page to drop.
+*
+*************************************************************************/
+int32_t block_map_cache_shrink(BLOCK_MAP_CACHE *cache)
+{
+	if ((cache == NULL) || (cache->lru_last == NULL))
+		return 0;
+
+	_remove_entry(cache, cache->lru_last);
+	return sizeof(BLOCK_MAP_CACHE_ENTRY);
+}
+
+/************************************************************************
+*
+* Function name: block_map_cache_destroy
+*        Inputs: BLOCK_MAP_CACHE **cache_ptr
+*       Summary: Drop all cached positions and free the cache. *cache_ptr
+*                is set to NULL.
+*  Return value: None.
+*
+*************************************************************************/
+void block_map_cache_destroy(BLOCK_MAP_CACHE **cache_ptr)
+{
+	BLOCK_MAP_CACHE *cache;
+	BLOCK_MAP_CACHE_ENTRY *entry, *next_entry;
+
+	cache = *cache_ptr;
+	if (cache == NULL)
+		return;
+
+	entry = cache->lru_first;
+	while (entry != NULL) {
+		next_entry = entry->lru_next;
+		free(entry);
+		entry = next_entry;
+	}
+	free(cache);
+	*cache_ptr = NULL;
+}
+
+/* Bytes used by the cache, including the cache structure itself */
+int64_t block_map_cache_mem_usage(const BLOCK_MAP_CACHE *cache)
+{
+	if (cache == NULL)
+		return 0;
+	return sizeof(BLOCK_MAP_CACHE) +
+	       (int64_t)cache->num_pages * sizeof(BLOCK_MAP_CACHE_ENTRY);
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef GW20_HCFS_BLOCK_MAP_CACHE_H_
+#define GW20_HCFS_BLOCK_MAP_CACHE_H_
+
+#include <stdint.h>
+
+#include "global.h"
+
+/* Max number of block entry page positions cached for a single file */
+#define MAX_BLOCK_MAP_CACHE_PAGES 1024
+#define BLOCK_MAP_CACHE_HASH_SIZE 256
+
+typedef struct BLOCK_MAP_CACHE_ENTRY {
+	int64_t page_index;
+	int64_t page_pos;
+	struct BLOCK_MAP_CACHE_ENTRY *hash_next;
+	struct BLOCK_MAP_CACHE_ENTRY *lru_prev;
+	struct BLOCK_MAP_CACHE_ENTRY *lru_next;
+} BLOCK_MAP_CACHE_ENTRY;
+
+typedef struct {
+	BLOCK_MAP_CACHE_ENTRY *hash_table[BLOCK_MAP_CACHE_HASH_SIZE];
+	/* Cached pages, most recently used first */
+	BLOCK_MAP_CACHE_ENTRY *lru_first;
+	BLOCK_MAP_CACHE_ENTRY *lru_last;
+	int32_t num_pages;
+} BLOCK_MAP_CACHE;
+
+int64_t block_map_cache_get(BLOCK_MAP_CACHE *cache, int64_t page_index);
+int32_t block_map_cache_put(BLOCK_MAP_CACHE **cache_ptr, int64_t page_index,
+			    int64_t page_pos);
+int32_t block_map_cache_shrink(BLOCK_MAP_CACHE *cache);
+void block_map_cache_destroy(BLOCK_MAP_CACHE **cache_ptr);
+int64_t block_map_cache_mem_usage(const BLOCK_MAP_CACHE *cache);
+
+#endif  /* GW20_HCFS_BLOCK_MAP_CACHE_H_ */
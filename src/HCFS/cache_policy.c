@@ -0,0 +1,393 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/* Block-level cache replacement policies. The read and write paths
+* report the blocks accessed, and cache replacement asks for the next
+* block to page out. If the block cannot be paged out (dirty, pinned, ...)
+* it is kept and moved to the head of its queue, and if it is not in the
+* cache anymore it is forgotten.
+*
+* Blocks cached before startup are not tracked. They are paged out by the
+* whole inode passes in run_cache_loop once there is no tracked block to
+* page out. */
+
+#include "cache_policy.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger.h"
+
+static CACHE_POLICY_CTL cache_policy_ctl;
+
+static inline uint32_t _policy_hash(ino_t this_inode, int64_t block_no)
+{
+	return (uint32_t)(((uint64_t)this_inode * 31 + (uint64_t)block_no) %
+			  CACHE_POLICY_HASH_SIZE);
+}
+
+static CACHE_POLICY_NODE **_policy_find(ino_t this_inode, int64_t block_no)
+{
+	CACHE_POLICY_NODE **node_ptr;
+
+	node_ptr = &(cache_policy_ctl.hash_table[_policy_hash(this_inode,
+							      block_no)]);
+	while (*node_ptr != NULL) {
+		if (((*node_ptr)->this_inode == this_inode) &&
+		    ((*node_ptr)->block_no == block_no))
+			break;
+		node_ptr = &((*node_ptr)->hash_next);
+	}
+	return node_ptr;
+}
+
+static void _queue_unlink(CACHE_POLICY_NODE *node)
+{
+	CACHE_POLICY_QUEUE *queue;
+
+	if (node->queue == CP_QUEUE_NONE)
+		return;
+	queue = &(cache_policy_ctl.queues[(int32_t)node->queue]);
+	if (node->prev != NULL)
+		node->prev->next = node->next;
+	else
+		queue->head = node->next;
+	if (node->next != NULL)
+		node->next->prev = node->prev;
+	else
+		queue->tail = node->prev;
+	node->prev = NULL;
+	node->next = NULL;
+	node->queue = CP_QUEUE_NONE;
+	queue->num_nodes--;
+}
+
+static void _queue_push_head(CACHE_POLICY_NODE *node, int8_t which)
+{
+	CACHE_POLICY_QUEUE *queue;
+
+	_queue_unlink(node);
+	queue = &(cache_policy_ctl.queues[(int32_t)which]);
+	node->prev = NULL;
+	node->next = queue->head;
+	if (queue->head != NULL)
+		queue->head->prev = node;
+	else
+		queue->tail = node;
+	queue->head = node;
+	node->queue = which;
+	queue->num_nodes++;
+}
+
+static void _policy_delete(CACHE_POLICY_NODE *node)
+{
+	CACHE_POLICY_NODE **node_ptr;
+
+	node_ptr = _policy_find(node->this_inode, node->block_no);
+	if (*node_ptr == node)
+		*node_ptr = node->hash_next;
+	_queue_unlink(node);
+	free(node);
+}
+
+static inline int64_t _num_resident(void)
+{
+	return cache_policy_ctl.queues[CP_QUEUE_A1IN].num_nodes +
+	       cache_policy_ctl.queues[CP_QUEUE_AM].num_nodes;
+}
+
+/* Stop tracking the oldest blocks if too many are tracked */
+static void _policy_trim(void)
+{
+	CACHE_POLICY_QUEUE *a1in, *am, *a1out;
+	int64_t kout;
+
+	a1in = &(cache_policy_ctl.queues[CP_QUEUE_A1IN]);
+	am = &(cache_policy_ctl.queues[CP_QUEUE_AM]);
+	a1out = &(cache_policy_ctl.queues[CP_QUEUE_A1OUT]);
+
+	while (_num_resident() > cache_policy_ctl.max_blocks) {
+		if (am->tail != NULL)
+			_policy_delete(am->tail);
+		else
+			_policy_delete(a1in->tail);
+	}
+
+	kout = cache_policy_ctl.max_blocks * CACHE_POLICY_2Q_KOUT_PERCENT / 100;
+	while (a1out->num_nodes > kout)
+		_policy_delete(a1out->tail);
+}
+
+/************************************************************************
+*
+* Function name: init_cache_policy
+*        Inputs: int32_t policy, int64_t max_blocks, const char *trace_path
+*       Summary: Initialize block-level cache replacement "policy" which
+*                tracks at most "max_blocks" cached blocks. If "trace_path"
+*                is not NULL, accesses are also appended to the file.
+*  Return value: 0 if successful. Otherwise returns negation of error code.
+*
+*************************************************************************/
+int32_t init_cache_policy(int32_t policy, int64_t max_blocks,
+			  const char *trace_path)
+{
+	int32_t errcode;
+
+	if ((policy < CACHE_POLICY_INODE) || (policy > CACHE_POLICY_2Q) ||
+	    (max_blocks <= 0))
+		return -EINVAL;
+
+	memset(&cache_policy_ctl, 0, sizeof(CACHE_POLICY_CTL));
+	sem_init(&(cache_policy_ctl.policy_sem), 0, 1);
+	cache_policy_ctl.policy = policy;
+	cache_policy_ctl.max_blocks = max_blocks;
+
+	if ((policy != CACHE_POLICY_INODE) && (trace_path != NULL)) {
+		cache_policy_ctl.trace_fptr = fopen(trace_path, "a");
+		if (cache_policy_ctl.trace_fptr == NULL) {
+			errcode = errno;
+			write_log(0, "Cannot open access trace %s. Code %d, %s\n",
+				  trace_path, errcode, strerror(errcode));
+		}
+	}
+	write_log(5, "Cache replacement policy %d\n", policy);
+	return 0;
+}
+
+/************************************************************************
+*
+* Function name: destroy_cache_policy
+*        Inputs: None
+*       Summary: Free all tracked blocks and close the access trace.
+*  Return value: None
+*
+*************************************************************************/
+void destroy_cache_policy(void)
+{
+	int32_t count;
+	CACHE_POLICY_NODE *node, *next;
+
+	sem_wait(&(cache_policy_ctl.policy_sem));
+	for (count = 0; count < CACHE_POLICY_HASH_SIZE; count++) {
+		node = cache_policy_ctl.hash_table[count];
+		while (node != NULL) {
+			next = node->hash_next;
+			free(node);
+			node = next;
+		}
+		cache_policy_ctl.hash_table[count] = NULL;
+	}
+	memset(cache_policy_ctl.queues, 0, sizeof(cache_policy_ctl.queues));
+	if (cache_policy_ctl.trace_fptr != NULL) {
+		fclose(cache_policy_ctl.trace_fptr);
+		cache_policy_ctl.trace_fptr = NULL;
+	}
+	cache_policy_ctl.policy = CACHE_POLICY_INODE;
+	sem_post(&(cache_policy_ctl.policy_sem));
+	sem_destroy(&(cache_policy_ctl.policy_sem));
+}
+
+BOOL cache_policy_enabled(void)
+{
+	return (cache_policy_ctl.policy != CACHE_POLICY_INODE);
+}
+
+/************************************************************************
+*
+* Function name: cache_policy_access
+*        Inputs: ino_t this_inode, int64_t start_block, int64_t end_block,
+*                BOOL is_write
+*       Summary: Record a read or write of blocks "start_block" to
+*                "end_block" of "this_inode".
+*  Return value: None
+*
+*************************************************************************/
+void cache_policy_access(ino_t this_inode, int64_t start_block,
+			 int64_t end_block, BOOL is_write)
+{
+	CACHE_POLICY_NODE **node_ptr, *node;
+	int64_t block_no;
+
+	if (cache_policy_ctl.policy == CACHE_POLICY_INODE)
+		return;
+
+	sem_wait(&(cache_policy_ctl.policy_sem));
+	for (block_no = start_block; block_no <= end_block; block_no++) {
+		if (cache_policy_ctl.trace_fptr != NULL)
+			fprintf(cache_policy_ctl.trace_fptr,
+				"%" PRIu64 " %" PRId64 " %c\n",
+				(uint64_t)this_inode, block_no,
+				(is_write == TRUE) ? 'W' : 'R');
+
+		node_ptr = _policy_find(this_inode, block_no);
+		node = *node_ptr;
+		if (node == NULL) {
+			node = calloc(1, sizeof(CACHE_POLICY_NODE));
+			if (node == NULL) {
+				write_log(0, "Out of memory in %s\n", __func__);
+				break;
+			}
+			node->this_inode = this_inode;
+			node->block_no = block_no;
+			*node_ptr = node;
+			if (cache_policy_ctl.policy == CACHE_POLICY_2Q)
+				_queue_push_head(node, CP_QUEUE_A1IN);
+			else
+				_queue_push_head(node, CP_QUEUE_AM);
+			_policy_trim();
+			continue;
+		}
+
+		/* Accesses of blocks in A1in are taken as correlated ones
+		and do not promote the block */
+		if (node->queue != CP_QUEUE_A1IN)
+			_queue_push_head(node, CP_QUEUE_AM);
+		if (node->queue == CP_QUEUE_AM)
+			_policy_trim();
+	}
+	sem_post(&(cache_policy_ctl.policy_sem));
+}
+
+/************************************************************************
+*
+* Function name: cache_policy_pick_victim
+*        Inputs: ino_t *this_inode, int64_t *block_no
+*       Summary: Find the block to page out next. The block stays tracked
+*                until cache_policy_evicted, cache_policy_kept or
+*                cache_policy_forget is called for it.
+*  Return value: 0 if found, otherwise -ENOENT.
+*
+*************************************************************************/
+int32_t cache_policy_pick_victim(ino_t *this_inode, int64_t *block_no)
+{
+	CACHE_POLICY_QUEUE *a1in, *am;
+	CACHE_POLICY_NODE *victim;
+	int64_t kin;
+
+	if (cache_policy_ctl.policy == CACHE_POLICY_INODE)
+		return -ENOENT;
+
+	sem_wait(&(cache_policy_ctl.policy_sem));
+	a1in = &(cache_policy_ctl.queues[CP_QUEUE_A1IN]);
+	am = &(cache_policy_ctl.queues[CP_QUEUE_AM]);
+
+	/* 2Q pages out from A1in while it is larger than its share */
+	kin = _num_resident() * CACHE_POLICY_2Q_KIN_PERCENT / 100;
+	if ((a1in->tail != NULL) &&
+	    ((a1in->num_nodes > kin) || (am->tail == NULL)))
+		victim = a1in->tail;
+	else
+		victim = am->tail;
+
+	if (victim == NULL) {
+		sem_post(&(cache_policy_ctl.policy_sem));
+		return -ENOENT;
+	}
+	*this_inode = victim->this_inode;
+	*block_no = victim->block_no;
+	sem_post(&(cache_policy_ctl.policy_sem));
+	return 0;
+}
+
+/************************************************************************
+*
+* Function name: cache_policy_evicted
+*        Inputs: ino_t this_inode, int64_t block_no
+*       Summary: Record that the block is paged out. 2Q remembers blocks
+*                paged out of A1in, so that they go to Am if accessed
+*                again soon.
+*  Return value: None
+*
+*************************************************************************/
+void cache_policy_evicted(ino_t this_inode, int64_t block_no)
+{
+	CACHE_POLICY_NODE *node;
+
+	sem_wait(&(cache_policy_ctl.policy_sem));
+	node = *(_policy_find(this_inode, block_no));
+	if (node != NULL) {
+		if (node->queue == CP_QUEUE_A1IN) {
+			_queue_push_head(node, CP_QUEUE_A1OUT);
+			_policy_trim();
+		} else if (node->queue != CP_QUEUE_A1OUT) {
+			_policy_delete(node);
+		}
+	}
+	sem_post(&(cache_policy_ctl.policy_sem));
+}
+
+/************************************************************************
+*
+* Function name: cache_policy_kept
+*        Inputs: ino_t this_inode, int64_t block_no
+*       Summary: The block picked cannot be paged out now. Move it to the
+*                head of its queue so that other blocks are tried first.
+*  Return value: None
+*
+*************************************************************************/
+void cache_policy_kept(ino_t this_inode, int64_t block_no)
+{
+	CACHE_POLICY_NODE *node;
+
+	sem_wait(&(cache_policy_ctl.policy_sem));
+	node = *(_policy_find(this_inode, block_no));
+	if ((node != NULL) && (node->queue != CP_QUEUE_A1OUT))
+		_queue_push_head(node, node->queue);
+	sem_post(&(cache_policy_ctl.policy_sem));
+}
+
+/************************************************************************
+*
+* Function name: cache_policy_forget
+*        Inputs: ino_t this_inode, int64_t block_no
+*       Summary: Stop tracking the block, e.g. if it is not cached anymore.
+*  Return value: None
+*
+*************************************************************************/
+void cache_policy_forget(ino_t this_inode, int64_t block_no)
+{
+	CACHE_POLICY_NODE *node;
+
+	sem_wait(&(cache_policy_ctl.policy_sem));
+	node = *(_policy_find(this_inode, block_no));
+	if (node != NULL)
+		_policy_delete(node);
+	sem_post(&(cache_policy_ctl.policy_sem));
+}
+
+/************************************************************************
+*
+* Function name: cache_policy_lookup
+*        Inputs: ino_t this_inode, int64_t block_no
+*       Summary: Find the queue the block is on.
+*  Return value: CP_QUEUE_* of the block, or CP_QUEUE_NONE if not tracked.
+*
+*************************************************************************/
+int32_t cache_policy_lookup(ino_t this_inode, int64_t block_no)
+{
+	CACHE_POLICY_NODE *node;
+	int32_t ret;
+
+	sem_wait(&(cache_policy_ctl.policy_sem));
+	node = *(_policy_find(this_inode, block_no));
+	ret = (node != NULL) ? node->queue : CP_QUEUE_NONE;
+	sem_post(&(cache_policy_ctl.policy_sem));
+	return ret;
+}
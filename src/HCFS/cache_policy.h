@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef GW20_HCFS_CACHE_POLICY_H_
+#define GW20_HCFS_CACHE_POLICY_H_
+
+#include <semaphore.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "global.h"
+
+/* Cache replacement policies (config "cache_replace_policy") */
+/* Page out all synced blocks of the least recently used inode */
+#define CACHE_POLICY_INODE 0
+/* Page out the least recently used block */
+#define CACHE_POLICY_LRU 1
+/* 2Q. Blocks accessed once are paged out before blocks accessed again */
+#define CACHE_POLICY_2Q 2
+
+#define CACHE_POLICY_HASH_SIZE 65536
+/* Max number of cached blocks tracked by block-level policies */
+#define CACHE_POLICY_MAX_BLOCKS 131072
+/* Share (in percent) of tracked blocks kept in the 2Q A1in queue, and
+max number of ghost entries in A1out */
+#define CACHE_POLICY_2Q_KIN_PERCENT 25
+#define CACHE_POLICY_2Q_KOUT_PERCENT 50
+/* Max candidates that cannot be paged out in a row before cache
+replacement falls back to whole inode passes */
+#define CACHE_POLICY_MAX_TRIES 64
+
+/* Queues of a tracked block */
+#define CP_QUEUE_NONE 0
+#define CP_QUEUE_A1IN 1 /* 2Q: accessed once, FIFO */
+#define CP_QUEUE_AM 2 /* LRU: all blocks. 2Q: accessed again, LRU */
+#define CP_QUEUE_A1OUT 3 /* 2Q: ghost entries of blocks paged out of A1in */
+#define CP_NUM_QUEUES 4
+
+typedef struct CACHE_POLICY_NODE {
+	ino_t this_inode;
+	int64_t block_no;
+	int8_t queue;
+	/* Queue links. Head of the queue is the most recent one */
+	struct CACHE_POLICY_NODE *prev;
+	struct CACHE_POLICY_NODE *next;
+	struct CACHE_POLICY_NODE *hash_next;
+} CACHE_POLICY_NODE;
+
+typedef struct {
+	CACHE_POLICY_NODE *head;
+	CACHE_POLICY_NODE *tail;
+	int64_t num_nodes;
+} CACHE_POLICY_QUEUE;
+
+typedef struct {
+	sem_t policy_sem;
+	int32_t policy;
+	int64_t max_blocks;
+	CACHE_POLICY_NODE *hash_table[CACHE_POLICY_HASH_SIZE];
+	CACHE_POLICY_QUEUE queues[CP_NUM_QUEUES];
+	/* Access trace for replaying with cache_policy_sim */
+	FILE *trace_fptr;
+} CACHE_POLICY_CTL;
+
+int32_t init_cache_policy(int32_t policy, int64_t max_blocks,
+			  const char *trace_path);
+void destroy_cache_policy(void);
+BOOL cache_policy_enabled(void);
+void cache_policy_access(ino_t this_inode, int64_t start_block,
+			 int64_t end_block, BOOL is_write);
+int32_t cache_policy_pick_victim(ino_t *this_inode, int64_t *block_no);
+void cache_policy_evicted(ino_t this_inode, int64_t block_no);
+void cache_policy_kept(ino_t this_inode, int64_t block_no);
+void cache_policy_forget(ino_t this_inode, int64_t block_no);
+int32_t cache_policy_lookup(ino_t this_inode, int64_t block_no);
+
+#endif  /* GW20_HCFS_CACHE_POLICY_H_ */
@@ -40,6 +40,7 @@
 #include "mount_manager.h"
 #include "FS_manager.h"
 #include "meta_iterator.h"
+#include "block_fd_cache.h"
 
 /**
  * Unmount smart cache.
@@ -330,6 +331,7 @@ int32_t inject_restored_smartcache(ino_t smartcache_ino)
 		fetch_restore_block_path(restored_blockpath,
 				smartcache_ino, count);
 		fetch_block_path(thisblockpath, tmp_ino, count);
+		invalidate_block_fd(tmp_ino, count);
 		ret = rename(restored_blockpath, thisblockpath);
 		if (ret < 0) {
 			write_log(0, "Error: Fail to rename in %s. Code %d",
@@ -440,6 +442,7 @@ errcode_handle:
 		if (access(restored_blockpath, F_OK) == 0)
 			unlink(restored_blockpath);
 		fetch_block_path(thisblockpath, tmp_ino, count);
+		invalidate_block_fd(tmp_ino, count);
 		if (access(thisblockpath, F_OK) == 0)
 			unlink(thisblockpath);
 	}
@@ -682,6 +685,7 @@ int32_t extract_restored_smartcache(ino_t smartcache_ino,
 		fetch_restore_block_path(restored_blockpath,
 				smartcache_ino, count);
 		fetch_block_path(thisblockpath, ino_nowsys, count);
+		invalidate_block_fd(ino_nowsys, count);
 		ret = rename(thisblockpath, restored_blockpath);
 		if (ret < 0) {
 			write_log(0, "Error: Fail to rename in %s. Code %d",
@@ -767,6 +771,7 @@ errcode_handle:
 		if (access(restored_blockpath, F_OK) == 0)
 			unlink(restored_blockpath);
 		fetch_block_path(thisblockpath, ino_nowsys, count);
+		invalidate_block_fd(ino_nowsys, count);
 		if (access(thisblockpath, F_OK) == 0)
 			unlink(thisblockpath);
 	}
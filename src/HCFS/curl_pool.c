@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/* Connection pool of backend transfers. Connections are kept in a pool
+* shared by the easy handles of all upload, download and delete threads, so
+* a slot reuses a connection opened by another slot instead of doing a new
+* TCP and TLS handshake. Transfers are performed in the calling threads. */
+
+#include "curl_pool.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "macro.h"
+
+static CURL_POOL curl_pool;
+
+static void _share_lock(CURL *curl, curl_lock_data data,
+			curl_lock_access access, void *ptr)
+{
+	UNUSED(curl);
+	UNUSED(access);
+	UNUSED(ptr);
+	pthread_mutex_lock(&(curl_pool.share_lock[data]));
+}
+
+static void _share_unlock(CURL *curl, curl_lock_data data, void *ptr)
+{
+	UNUSED(curl);
+	UNUSED(ptr);
+	pthread_mutex_unlock(&(curl_pool.share_lock[data]));
+}
+
+static int32_t _init_share(void)
+{
+	int32_t count;
+
+	curl_pool.share = curl_share_init();
+	if (curl_pool.share == NULL)
+		return -ENOMEM;
+	for (count = 0; count < CURL_LOCK_DATA_LAST; count++)
+		pthread_mutex_init(&(curl_pool.share_lock[count]), NULL);
+	curl_share_setopt(curl_pool.share, CURLSHOPT_LOCKFUNC, _share_lock);
+	curl_share_setopt(curl_pool.share, CURLSHOPT_UNLOCKFUNC,
+			  _share_unlock);
+	curl_share_setopt(curl_pool.share, CURLSHOPT_SHARE,
+			  CURL_LOCK_DATA_DNS);
+	curl_share_setopt(curl_pool.share, CURLSHOPT_SHARE,
+			  CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+	curl_share_setopt(curl_pool.share, CURLSHOPT_SHARE,
+			  CURL_LOCK_DATA_CONNECT);
+#else
+	write_log(4, "Connections are not pooled by libcurl\n");
+#endif
+	pthread_rwlock_init(&(curl_pool.perform_lock), NULL);
+	return 0;
+}
+
+static void _destroy_share(void)
+{
+	int32_t count;
+
+	curl_share_cleanup(curl_pool.share);
+	curl_pool.share = NULL;
+	for (count = 0; count < CURL_LOCK_DATA_LAST; count++)
+		pthread_mutex_destroy(&(curl_pool.share_lock[count]));
+	/* perform_lock is kept, as a thread that saw the pool running might
+	still be about to take it */
+}
+
+/* Options for an easy handle to use the shared pool */
+static void _set_pool_options(CURL *curl)
+{
+	curl_easy_setopt(curl, CURLOPT_SHARE, curl_pool.share);
+	curl_easy_setopt(curl, CURLOPT_MAXCONNECTS,
+			 (long)CURL_POOL_MAX_CONNECTS);
+#if LIBCURL_VERSION_NUM >= 0x071900
+	/* Keep pooled connections alive through NAT and firewalls */
+	curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+	curl_easy_setopt(curl, CURLOPT_TCP_KEEPIDLE,
+			 (long)CURL_POOL_KEEPIDLE_SEC);
+	curl_easy_setopt(curl, CURLOPT_TCP_KEEPINTVL,
+			 (long)CURL_POOL_KEEPINTVL_SEC);
+#endif
+}
+
+/**
+ * Start the connection pool of backend transfers of this process.
+ *
+ * @return 0 on success, or negative error code.
+ */
+int32_t init_curl_pool(void)
+{
+	int32_t ret;
+
+	if (curl_pool_running() == TRUE)
+		return 0;
+
+	/* Forget the pool inherited from the parent process, if any */
+	memset(&curl_pool, 0, sizeof(CURL_POOL));
+	ret = _init_share();
+	if (ret < 0) {
+		write_log(0, "Unable to init curl share handle\n");
+		return ret;
+	}
+	curl_pool.running = TRUE;
+	curl_pool.owner_pid = getpid();
+	write_log(4, "Curl connection pool started\n");
+	return 0;
+}
+
+/**
+ * Stop the connection pool after transfers using it are done. Later
+ * transfers are performed without the shared pool.
+ */
+void destroy_curl_pool(void)
+{
+	if (curl_pool_running() == FALSE)
+		return;
+
+	/* Wait for transfers using the share */
+	pthread_rwlock_wrlock(&(curl_pool.perform_lock));
+	curl_pool.running = FALSE;
+	pthread_rwlock_unlock(&(curl_pool.perform_lock));
+
+	_destroy_share();
+	curl_pool.owner_pid = 0;
+}
+
+BOOL curl_pool_running(void)
+{
+	/* Check the owner first. The lock may be held by a thread that does
+	not exist in a forked child. */
+	if (curl_pool.owner_pid != getpid())
+		return FALSE;
+	return curl_pool.running;
+}
+
+/**
+ * Drop-in replacement of curl_easy_perform. The transfer is performed in
+ * the calling thread, with the connection pool of this process if it is
+ * running. Transfers of different threads run concurrently.
+ *
+ * @param curl The easy handle to perform.
+ *
+ * @return Result of the transfer.
+ */
+CURLcode hcfs_curl_perform(CURL *curl)
+{
+	CURLcode result;
+
+	if (curl_pool_running() == FALSE)
+		return curl_easy_perform(curl);
+
+	pthread_rwlock_rdlock(&(curl_pool.perform_lock));
+	if (curl_pool.running == FALSE) {
+		pthread_rwlock_unlock(&(curl_pool.perform_lock));
+		return curl_easy_perform(curl);
+	}
+	_set_pool_options(curl);
+	result = curl_easy_perform(curl);
+	/* Connections stay in the pool after the handle leaves the share */
+	curl_easy_setopt(curl, CURLOPT_SHARE, NULL);
+	pthread_rwlock_unlock(&(curl_pool.perform_lock));
+	return result;
+}
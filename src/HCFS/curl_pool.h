@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GW20_HCFS_CURL_POOL_H_
+#define GW20_HCFS_CURL_POOL_H_
+
+#include <curl/curl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "global.h"
+
+/* Idle connections kept open in the shared pool */
+#define CURL_POOL_MAX_CONNECTS 64
+/* TCP keep-alive probes for pooled connections */
+#define CURL_POOL_KEEPIDLE_SEC 60
+#define CURL_POOL_KEEPINTVL_SEC 30
+
+/* Connections of a process are pooled and kept alive across the easy
+handles of upload, download and delete threads, through a curl share
+handle. Transfers are still performed in the calling threads. */
+typedef struct {
+	/* Connection pool, DNS cache and TLS sessions of all transfers */
+	CURLSH *share;
+	pthread_mutex_t share_lock[CURL_LOCK_DATA_LAST];
+	/* Held for reading by transfers attached to the share */
+	pthread_rwlock_t perform_lock;
+	BOOL running;
+	/* The pool does not survive fork. Only the owner process uses it. */
+	pid_t owner_pid;
+} CURL_POOL;
+
+int32_t init_curl_pool(void);
+void destroy_curl_pool(void);
+BOOL curl_pool_running(void);
+CURLcode hcfs_curl_perform(CURL *curl);
+
+#endif  /* GW20_HCFS_CURL_POOL_H_ */
@@ -32,6 +32,7 @@
 #include "macro.h"
 #include "logger.h"
 #include "utils.h"
+#include "obj_fingerprint.h"
 
 #if ENABLE(DEDUP)
 /* TODO: If local deduplication is enabled for any reason, restoration of
@@ -1063,62 +1064,29 @@ int32_t decrease_ddt_el_refcount(uint8_t key[], DDT_BTREE_NODE *tnode,
 	return delete_ddt_btree(key, tnode, fd, this_meta, FALSE);
 }
 
+/* Compute the sha256 hash, the first and last bytes to check and the size
+of the object "path", in one read pass */
 int32_t get_obj_id(char *path, uint8_t hash[], uint8_t start_bytes[],
 	       uint8_t end_bytes[], off_t *obj_size)
 {
-
-	FILE *fptr;
-	const int32_t buf_size = 16384;
-	char *buf;
-	int32_t bytes_read;
-	struct stat obj_stat; /* raw file ops */
-	off_t size;
-	SHA256_CTX ctx;
+	uint8_t obj_id[OBJID_LENGTH];
 	int32_t fd;
-	int32_t errcode;
+	int32_t ret;
 
-	if (access(path, R_OK) == -1)
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
 		return -1;
 
-	/* Get file size */
-	stat(path, &obj_stat);
-	size = obj_stat.st_size;
-	*obj_size = size;
-
-	/* Compute hash */
-	SHA256_Init(&ctx);
-	buf = malloc(buf_size);
-
-	fptr = fopen(path, "rb");
-	fd = fileno(fptr);
-
-	while ((bytes_read = fread(buf, 1, buf_size, fptr)))
-		SHA256_Update(&ctx, buf, bytes_read);
-
-	SHA256_Final(hash, &ctx);
-
-	/* Copy bytes to check */
-	memset(start_bytes, 0, BYTES_TO_CHECK);
-	memset(end_bytes, 0, BYTES_TO_CHECK);
-	if (size >= BYTES_TO_CHECK) {
-		PREAD(fd, start_bytes, BYTES_TO_CHECK, 0);
-		size = size - BYTES_TO_CHECK;
-		if (size >= BYTES_TO_CHECK) {
-			PREAD(fd, end_bytes, BYTES_TO_CHECK, (*obj_size - BYTES_TO_CHECK));
-		} else {
-			PREAD(fd, end_bytes, size, (*obj_size - size));
-		}
-	} else {
-		PREAD(fd, start_bytes, size, 0);
-	}
-
-	fclose(fptr);
-	free(buf);
+	ret = fingerprint_fd(fd, obj_id, obj_size);
+	close(fd);
+	if (ret < 0)
+		return ret;
 
+	memcpy(hash, obj_id, SHA256_DIGEST_LENGTH);
+	memcpy(start_bytes, obj_id + SHA256_DIGEST_LENGTH, BYTES_TO_CHECK);
+	memcpy(end_bytes, obj_id + SHA256_DIGEST_LENGTH + BYTES_TO_CHECK,
+	       BYTES_TO_CHECK);
 	return 0;
-
-errcode_handle:
-	return errcode;
 }
 
 int32_t obj_id_to_string(uint8_t obj_id[OBJID_LENGTH],
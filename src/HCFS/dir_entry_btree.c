@@ -36,10 +36,49 @@
 #include "utils.h"
 #include "fuseop.h"
 
-/* TODO: How to integrate dir page reading / updating with mem cache? */
 /* TODO: Revisit how to reduce IO for node updating and GC */
 /* TODO: Remove doubly linked list struct for tree_walk (no use) */
 
+/* Cached b-tree nodes of the dir being changed by this thread, if any */
+static __thread DIR_PAGE_CACHE *btree_page_cache;
+
+/* Write a b-tree node, and refresh the cached copy of the node */
+#define PWRITE_PAGE(fh, page, pos)\
+	do {\
+		PWRITE(fh, page, sizeof(DIR_ENTRY_PAGE), pos);\
+		_page_written(page);\
+	} while (0)
+
+/* Helper function for refreshing a cached node after it is written. If the
+	refresh fails, the node is no longer cached. */
+static inline void _page_written(const DIR_ENTRY_PAGE *page)
+{
+	if (btree_page_cache != NULL)
+		dir_page_cache_update(btree_page_cache, page);
+}
+
+/* Helper function for dropping a node moved to the gc list from cache */
+static inline void _page_freed(int64_t page_pos)
+{
+	if (btree_page_cache != NULL)
+		dir_page_cache_drop(btree_page_cache, page_pos);
+}
+
+/************************************************************************
+*
+* Function name: dir_btree_track_pages
+*        Inputs: DIR_PAGE_CACHE *page_cache
+*       Summary: Keep "page_cache" in step with the nodes written or freed
+*                by b-tree updates from this thread, until called again
+*                with NULL.
+*  Return value: None.
+*
+*************************************************************************/
+void dir_btree_track_pages(DIR_PAGE_CACHE *page_cache)
+{
+	btree_page_cache = page_cache;
+}
+
 /************************************************************************
 *
 * Function name: dentry_binary_search
@@ -229,8 +268,7 @@ int32_t insert_dir_entry_btree(DIR_ENTRY *new_entry, DIR_ENTRY_PAGE *tnode,
 			(tnode->num_entries)++;
 			write_log(10, "Insert node. %d, %ld\n",
 				tnode->num_entries, tnode->this_page_pos);
-			PWRITE(fh, tnode, sizeof(DIR_ENTRY_PAGE),
-							tnode->this_page_pos);
+			PWRITE_PAGE(fh, tnode, tnode->this_page_pos);
 			return 0; /*Insertion completed*/
 		}
 
@@ -287,13 +325,12 @@ int32_t insert_dir_entry_btree(DIR_ENTRY *new_entry, DIR_ENTRY_PAGE *tnode,
 			PREAD(fh, &temp_page2, sizeof(DIR_ENTRY_PAGE),
 						this_meta->tree_walk_list_head);
 			temp_page2.tree_walk_prev = newpage.this_page_pos;
-			PWRITE(fh, &temp_page2, sizeof(DIR_ENTRY_PAGE),
-						this_meta->tree_walk_list_head);
+			PWRITE_PAGE(fh, &temp_page2,
+				this_meta->tree_walk_list_head);
 		}
 
 		/* Write current node to disk */
-		PWRITE(fh, tnode, sizeof(DIR_ENTRY_PAGE),
-							tnode->this_page_pos);
+		PWRITE_PAGE(fh, tnode, tnode->this_page_pos);
 
 		this_meta->tree_walk_list_head = newpage.this_page_pos;
 		PWRITE(fh, this_meta, sizeof(DIR_META_TYPE), meta_pos);
@@ -308,8 +345,7 @@ int32_t insert_dir_entry_btree(DIR_ENTRY *new_entry, DIR_ENTRY_PAGE *tnode,
 				sizeof(DIR_ENTRY) * newpage.num_entries);
 
 		/* Write to disk after finishing */
-		PWRITE(fh, &newpage, sizeof(DIR_ENTRY_PAGE),
-						newpage.this_page_pos);
+		PWRITE_PAGE(fh, &newpage, newpage.this_page_pos);
 
 		/* Pass the median and the file pos of the new node to
 			the parent*/
@@ -363,8 +399,7 @@ int32_t insert_dir_entry_btree(DIR_ENTRY *new_entry, DIR_ENTRY_PAGE *tnode,
 		tnode->child_page_pos[s_index+1] = tmp_overflow_new_page;
 
 		(tnode->num_entries)++;
-		PWRITE(fh, tnode, sizeof(DIR_ENTRY_PAGE),
-							tnode->this_page_pos);
+		PWRITE_PAGE(fh, tnode, tnode->this_page_pos);
 		return 0; /*Insertion completed*/
 	}
 
@@ -431,12 +466,11 @@ int32_t insert_dir_entry_btree(DIR_ENTRY *new_entry, DIR_ENTRY_PAGE *tnode,
 		PREAD(fh, &temp_page2, sizeof(DIR_ENTRY_PAGE),
 					this_meta->tree_walk_list_head);
 		temp_page2.tree_walk_prev = newpage.this_page_pos;
-		PWRITE(fh, &temp_page2, sizeof(DIR_ENTRY_PAGE),
-					this_meta->tree_walk_list_head);
+		PWRITE_PAGE(fh, &temp_page2, this_meta->tree_walk_list_head);
 	}
 
 	/*Write current node to disk*/
-	PWRITE(fh, tnode, sizeof(DIR_ENTRY_PAGE), tnode->this_page_pos);
+	PWRITE_PAGE(fh, tnode, tnode->this_page_pos);
 
 	this_meta->tree_walk_list_head = newpage.this_page_pos;
 	PWRITE(fh, this_meta, sizeof(DIR_META_TYPE), meta_pos);
@@ -452,7 +486,7 @@ int32_t insert_dir_entry_btree(DIR_ENTRY *new_entry, DIR_ENTRY_PAGE *tnode,
 				sizeof(int64_t)*(newpage.num_entries+1));
 
 	/* Write to disk after finishing */
-	PWRITE(fh, &newpage, sizeof(DIR_ENTRY_PAGE), newpage.this_page_pos);
+	PWRITE_PAGE(fh, &newpage, newpage.this_page_pos);
 
 	/* Pass the median and the file pos of the new node to the parent*/
 	*overflow_new_page = newpage.this_page_pos;
@@ -513,8 +547,7 @@ int32_t delete_dir_entry_btree(DIR_ENTRY *to_delete_entry, DIR_ENTRY_PAGE *tnode
 						&(tmp_entries[0]), tmp_size);
 			tnode->num_entries--;
 
-			PWRITE(fh, tnode, sizeof(DIR_ENTRY_PAGE),
-							tnode->this_page_pos);
+			PWRITE_PAGE(fh, tnode, tnode->this_page_pos);
 			return 0;
 		}
 		/*Select and remove the largest element from the left
@@ -573,8 +606,7 @@ int32_t delete_dir_entry_btree(DIR_ENTRY *to_delete_entry, DIR_ENTRY_PAGE *tnode
 		memcpy(&(tnode->dir_entries[entry_to_delete]),
 					&extracted_child, sizeof(DIR_ENTRY));
 
-		PWRITE(fh, tnode, sizeof(DIR_ENTRY_PAGE),
-							tnode->this_page_pos);
+		PWRITE_PAGE(fh, tnode, tnode->this_page_pos);
 		return 0;
 	}
 
@@ -748,6 +780,7 @@ elements into two, using the median as the new parent item. */
 		this_meta->entry_page_gc_list = temp_page.this_page_pos;
 		PWRITE(fh, &temp_page, sizeof(DIR_ENTRY_PAGE),
 						temp_page.this_page_pos);
+		_page_freed(temp_page.this_page_pos);
 
 		if (this_meta->tree_walk_list_head == right_page.this_page_pos)
 			this_meta->tree_walk_list_head =
@@ -769,8 +802,7 @@ elements into two, using the median as the new parent item. */
 						right_page.tree_walk_next);
 					temp_page.tree_walk_prev =
 						right_page.tree_walk_prev;
-					PWRITE(fh, &temp_page,
-						sizeof(DIR_ENTRY_PAGE),
+					PWRITE_PAGE(fh, &temp_page,
 						right_page.tree_walk_next);
 				}
 			}
@@ -791,8 +823,7 @@ elements into two, using the median as the new parent item. */
 						right_page.tree_walk_prev);
 					temp_page.tree_walk_next =
 						right_page.tree_walk_next;
-					PWRITE(fh, &temp_page,
-						sizeof(DIR_ENTRY_PAGE),
+					PWRITE_PAGE(fh, &temp_page,
 						right_page.tree_walk_prev);
 				}
 			}
@@ -809,6 +840,7 @@ elements into two, using the median as the new parent item. */
 			this_meta->entry_page_gc_list = temp_page.this_page_pos;
 			PWRITE(fh, &temp_page, sizeof(DIR_ENTRY_PAGE),
 						temp_page.this_page_pos);
+			_page_freed(temp_page.this_page_pos);
 
 			if (this_meta->tree_walk_list_head ==
 							tnode->this_page_pos)
@@ -825,8 +857,7 @@ elements into two, using the median as the new parent item. */
 						tnode->tree_walk_next);
 					temp_page.tree_walk_prev =
 						tnode->tree_walk_prev;
-					PWRITE(fh, &temp_page,
-						sizeof(DIR_ENTRY_PAGE),
+					PWRITE_PAGE(fh, &temp_page,
 						tnode->tree_walk_next);
 				}
 			}
@@ -840,9 +871,8 @@ elements into two, using the median as the new parent item. */
 							tnode->tree_walk_prev);
 					temp_page.tree_walk_next =
 							tnode->tree_walk_next;
-					PWRITE(fh, &temp_page,
-							sizeof(DIR_ENTRY_PAGE),
-							tnode->tree_walk_prev);
+					PWRITE_PAGE(fh, &temp_page,
+						tnode->tree_walk_prev);
 				}
 			}
 			this_meta->root_entry_page = left_page.this_page_pos;
@@ -868,15 +898,13 @@ elements into two, using the median as the new parent item. */
 			       &(temp_child_page_pos[0]), tmp_size);
 			tnode->num_entries--;
 
-			PWRITE(fh, tnode, sizeof(DIR_ENTRY_PAGE),
-			       tnode->this_page_pos);
+			PWRITE_PAGE(fh, tnode, tnode->this_page_pos);
 		}
 
 		/* Write changes to left node and meta to disk and return */
 		PWRITE(fh, this_meta, sizeof(DIR_META_TYPE), meta_pos);
 
-		PWRITE(fh, &left_page, sizeof(DIR_ENTRY_PAGE),
-		       left_page.this_page_pos);
+		PWRITE_PAGE(fh, &left_page, left_page.this_page_pos);
 
 		return to_return;
 	}
@@ -892,8 +920,7 @@ elements into two, using the median as the new parent item. */
 				&(temp_child_page_pos[0]),
 				sizeof(int64_t) * (median_entry + 1));
 	left_page.num_entries = median_entry;
-	PWRITE(fh, &left_page, sizeof(DIR_ENTRY_PAGE),
-						left_page.this_page_pos);
+	PWRITE_PAGE(fh, &left_page, left_page.this_page_pos);
 
 	/* Copy items to the right of the median to the right page
 		and write to disk */
@@ -904,14 +931,12 @@ elements into two, using the median as the new parent item. */
 			&(temp_child_page_pos[median_entry+1]),
 			sizeof(int64_t) * (temp_total - median_entry));
 	right_page.num_entries = (temp_total - median_entry)-1;
-	PWRITE(fh, &right_page, sizeof(DIR_ENTRY_PAGE),
-						right_page.this_page_pos);
+	PWRITE_PAGE(fh, &right_page, right_page.this_page_pos);
 
 	/* Write median to the current node and write to disk */
 	memcpy(&(tnode->dir_entries[left_node]),
 			&(tmp_entries[median_entry]), sizeof(DIR_ENTRY));
-	PWRITE(fh, tnode, sizeof(DIR_ENTRY_PAGE),
-							tnode->this_page_pos);
+	PWRITE_PAGE(fh, tnode, tnode->this_page_pos);
 
 	return 1;
 
@@ -965,8 +990,7 @@ int32_t extract_largest_child(DIR_ENTRY_PAGE *tnode, int32_t fh,
 							sizeof(DIR_ENTRY));
 		tnode->num_entries--;
 
-		PWRITE(fh, tnode, sizeof(DIR_ENTRY_PAGE),
-							tnode->this_page_pos);
+		PWRITE_PAGE(fh, tnode, tnode->this_page_pos);
 		return 0;
 	}
 
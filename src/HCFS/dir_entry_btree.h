@@ -20,6 +20,10 @@
 #define GW20_HCFS_DIR_ENTRY_BTREE_H_
 
 #include "meta.h"
+#include "dir_page_cache.h"
+
+void dir_btree_track_pages(DIR_PAGE_CACHE *page_cache);
+
 int32_t dentry_binary_search(const DIR_ENTRY *entry_array, const int32_t num_entries,
 			const DIR_ENTRY *new_entry, int32_t *index_to_insert,
 			BOOL is_external);
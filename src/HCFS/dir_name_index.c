@@ -0,0 +1,349 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* In-memory name index of a single directory. Finding a name in the dir
+* entry b-tree costs a root-to-leaf walk, and apps keep looking up names
+* that do not exist (such as ".nomedia"). The index maps every name in the
+* directory to its inode and type, so that lookups in hot directories
+* finish without touching the meta file.
+*
+* A Bloom filter sits in front of the hash table. Missing names are
+* usually rejected by a few bit tests, without walking a hash chain and
+* comparing names. The index does not read the meta file itself. The
+* owner fills it and keeps it coherent with the b-tree. */
+
+#include "dir_name_index.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/* FNV-1a hash of the name, case-folded for external volumes */
+static uint32_t _name_hash(const char *name, BOOL is_external)
+{
+	uint32_t hash = 2166136261U;
+	const unsigned char *ptr;
+
+	for (ptr = (const unsigned char *)name; *ptr != 0; ptr++) {
+		if (is_external == TRUE)
+			hash ^= (uint32_t)tolower(*ptr);
+		else
+			hash ^= (uint32_t)*ptr;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static inline BOOL _name_equal(const DIR_NAME_INDEX *index,
+			       const char *name1, const char *name2)
+{
+	if (index->is_external == TRUE)
+		return (strcasecmp(name1, name2) == 0) ? TRUE : FALSE;
+	return (strcmp(name1, name2) == 0) ? TRUE : FALSE;
+}
+
+/* Bit positions of the filter are derived from the hash by double
+	hashing, so that the name is hashed only once */
+static inline uint32_t _bloom_bit(const DIR_NAME_INDEX *index,
+				  uint32_t hash, int32_t probe)
+{
+	uint32_t hash2;
+
+	hash2 = ((hash >> 17) | (hash << 15)) * 0x9E3779B1U;
+	return (hash + (uint32_t)probe * (hash2 | 1)) % index->bloom_bits;
+}
+
+static void _bloom_add(DIR_NAME_INDEX *index, uint32_t hash)
+{
+	uint32_t bit;
+	int32_t probe;
+
+	for (probe = 0; probe < DIR_NAME_INDEX_BLOOM_PROBES; probe++) {
+		bit = _bloom_bit(index, hash, probe);
+		index->bloom[bit / 8] |= (uint8_t)(1 << (bit % 8));
+	}
+}
+
+static BOOL _bloom_may_contain(const DIR_NAME_INDEX *index, uint32_t hash)
+{
+	uint32_t bit;
+	int32_t probe;
+
+	for (probe = 0; probe < DIR_NAME_INDEX_BLOOM_PROBES; probe++) {
+		bit = _bloom_bit(index, hash, probe);
+		if ((index->bloom[bit / 8] & (1 << (bit % 8))) == 0)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/* Helper for resizing the hash table to "num_buckets" and rebuilding the
+	filter from the indexed names. Deleted names are dropped from the
+	filter here. */
+static int32_t _resize_index(DIR_NAME_INDEX *index, uint32_t num_buckets)
+{
+	DIR_NAME_NODE **new_buckets, *node, *next_node;
+	uint8_t *new_bloom;
+	uint32_t bloom_bits, count, new_idx;
+
+	bloom_bits = num_buckets * DIR_NAME_INDEX_BLOOM_BITS;
+	new_buckets = calloc(num_buckets, sizeof(DIR_NAME_NODE *));
+	if (new_buckets == NULL)
+		return -ENOMEM;
+	new_bloom = calloc((bloom_bits + 7) / 8, 1);
+	if (new_bloom == NULL) {
+		free(new_buckets);
+		return -ENOMEM;
+	}
+
+	for (count = 0; count < index->num_buckets; count++) {
+		node = index->buckets[count];
+		while (node != NULL) {
+			next_node = node->next;
+			new_idx = node->hash % num_buckets;
+			node->next = new_buckets[new_idx];
+			new_buckets[new_idx] = node;
+			node = next_node;
+		}
+	}
+
+	index->mem_usage -= (int64_t)index->num_buckets *
+			    sizeof(DIR_NAME_NODE *) +
+			    (index->bloom_bits + 7) / 8;
+	free(index->buckets);
+	free(index->bloom);
+	index->buckets = new_buckets;
+	index->num_buckets = num_buckets;
+	index->bloom = new_bloom;
+	index->bloom_bits = bloom_bits;
+	index->mem_usage += (int64_t)num_buckets * sizeof(DIR_NAME_NODE *) +
+			    (bloom_bits + 7) / 8;
+
+	for (count = 0; count < num_buckets; count++)
+		for (node = new_buckets[count]; node != NULL; node = node->next)
+			_bloom_add(index, node->hash);
+	return 0;
+}
+
+static DIR_NAME_NODE *_find_node(DIR_NAME_INDEX *index, const char *name,
+				 uint32_t hash, DIR_NAME_NODE ***prev_ptr)
+{
+	DIR_NAME_NODE **link;
+
+	link = &(index->buckets[hash % index->num_buckets]);
+	while (*link != NULL) {
+		if (((*link)->hash == hash) &&
+		    (_name_equal(index, (*link)->d_name, name) == TRUE)) {
+			if (prev_ptr != NULL)
+				*prev_ptr = link;
+			return *link;
+		}
+		link = &((*link)->next);
+	}
+	return NULL;
+}
+
+/************************************************************************
+*
+* Function name: dir_name_index_create
+*        Inputs: int64_t expected_names, BOOL is_external
+*       Summary: Allocate an empty name index sized for "expected_names"
+*                names. If "is_external" is TRUE, names are matched
+*                case-insensitively.
+*  Return value: Pointer to the index, or NULL if out of memory.
+*
+*************************************************************************/
+DIR_NAME_INDEX *dir_name_index_create(int64_t expected_names,
+				      BOOL is_external)
+{
+	DIR_NAME_INDEX *index;
+	uint32_t num_buckets;
+
+	num_buckets = DIR_NAME_INDEX_MIN_BUCKETS;
+	while ((int64_t)num_buckets < expected_names &&
+	       num_buckets < (1U << 30))
+		num_buckets *= 2;
+
+	index = calloc(1, sizeof(DIR_NAME_INDEX));
+	if (index == NULL)
+		return NULL;
+	index->is_external = is_external;
+	index->mem_usage = sizeof(DIR_NAME_INDEX);
+	if (_resize_index(index, num_buckets) < 0) {
+		free(index);
+		return NULL;
+	}
+	return index;
+}
+
+/************************************************************************
+*
+* Function name: dir_name_index_destroy
+*        Inputs: DIR_NAME_INDEX **index_ptr
+*       Summary: Free the index and all indexed names. *index_ptr is set
+*                to NULL.
+*  Return value: None.
+*
+*************************************************************************/
+void dir_name_index_destroy(DIR_NAME_INDEX **index_ptr)
+{
+	DIR_NAME_INDEX *index;
+	DIR_NAME_NODE *node, *next_node;
+	uint32_t count;
+
+	index = *index_ptr;
+	if (index == NULL)
+		return;
+
+	for (count = 0; count < index->num_buckets; count++) {
+		node = index->buckets[count];
+		while (node != NULL) {
+			next_node = node->next;
+			free(node);
+			node = next_node;
+		}
+	}
+	free(index->buckets);
+	free(index->bloom);
+	free(index);
+	*index_ptr = NULL;
+}
+
+/************************************************************************
+*
+* Function name: dir_name_index_insert
+*        Inputs: DIR_NAME_INDEX *index, const DIR_ENTRY *dentry
+*       Summary: Add the name of "dentry" to the index, or update the
+*                inode, type and name if the name is already indexed.
+*  Return value: 0 if successful. Otherwise returns negation of error code.
+*
+*************************************************************************/
+int32_t dir_name_index_insert(DIR_NAME_INDEX *index, const DIR_ENTRY *dentry)
+{
+	DIR_NAME_NODE *node, **prev_ptr;
+	uint32_t hash;
+	size_t name_len;
+	int32_t ret;
+
+	hash = _name_hash(dentry->d_name, index->is_external);
+	name_len = strlen(dentry->d_name);
+
+	node = _find_node(index, dentry->d_name, hash, &prev_ptr);
+	if (node != NULL) {
+		node->d_ino = dentry->d_ino;
+		node->d_type = dentry->d_type;
+		/* Case of the name might change on external volumes */
+		if (strlen(node->d_name) == name_len) {
+			memcpy(node->d_name, dentry->d_name, name_len);
+			return 0;
+		}
+		*prev_ptr = node->next;
+		index->num_names--;
+		index->mem_usage -= sizeof(DIR_NAME_NODE) +
+				    strlen(node->d_name) + 1;
+		free(node);
+	}
+
+	if (index->num_names >= (int64_t)index->num_buckets &&
+	    index->num_buckets < (1U << 30)) {
+		ret = _resize_index(index, index->num_buckets * 2);
+		if (ret < 0)
+			return ret;
+	}
+
+	node = malloc(sizeof(DIR_NAME_NODE) + name_len + 1);
+	if (node == NULL)
+		return -ENOMEM;
+	node->hash = hash;
+	node->d_ino = dentry->d_ino;
+	node->d_type = dentry->d_type;
+	memcpy(node->d_name, dentry->d_name, name_len + 1);
+	node->next = index->buckets[hash % index->num_buckets];
+	index->buckets[hash % index->num_buckets] = node;
+	_bloom_add(index, hash);
+	index->num_names++;
+	index->mem_usage += sizeof(DIR_NAME_NODE) + name_len + 1;
+	return 0;
+}
+
+/************************************************************************
+*
+* Function name: dir_name_index_delete
+*        Inputs: DIR_NAME_INDEX *index, const char *name
+*       Summary: Remove "name" from the index.
+*  Return value: 0 if successful, or -ENOENT if the name is not indexed.
+*
+*************************************************************************/
+int32_t dir_name_index_delete(DIR_NAME_INDEX *index, const char *name)
+{
+	DIR_NAME_NODE *node, **prev_ptr;
+
+	node = _find_node(index, name, _name_hash(name, index->is_external),
+			  &prev_ptr);
+	if (node == NULL)
+		return -ENOENT;
+
+	*prev_ptr = node->next;
+	index->num_names--;
+	index->mem_usage -= sizeof(DIR_NAME_NODE) + strlen(node->d_name) + 1;
+	free(node);
+	return 0;
+}
+
+/************************************************************************
+*
+* Function name: dir_name_index_lookup
+*        Inputs: DIR_NAME_INDEX *index, const char *name, DIR_ENTRY *dentry
+*       Summary: Find "name" in the index. If found and "dentry" is not
+*                NULL, the indexed entry is returned in "dentry".
+*  Return value: 0 if found, or -ENOENT if the name is not in the dir.
+*
+*************************************************************************/
+int32_t dir_name_index_lookup(DIR_NAME_INDEX *index, const char *name,
+			      DIR_ENTRY *dentry)
+{
+	DIR_NAME_NODE *node;
+	uint32_t hash;
+
+	hash = _name_hash(name, index->is_external);
+	if (_bloom_may_contain(index, hash) == FALSE)
+		return -ENOENT;
+
+	node = _find_node(index, name, hash, NULL);
+	if (node == NULL)
+		return -ENOENT;
+
+	if (dentry != NULL) {
+		memset(dentry, 0, sizeof(DIR_ENTRY));
+		dentry->d_ino = node->d_ino;
+		dentry->d_type = node->d_type;
+		strcpy(dentry->d_name, node->d_name);
+	}
+	return 0;
+}
+
+/* Bytes used by the index, including the names */
+int64_t dir_name_index_mem_usage(const DIR_NAME_INDEX *index)
+{
+	if (index == NULL)
+		return 0;
+	return index->mem_usage;
+}
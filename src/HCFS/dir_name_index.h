@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef GW20_HCFS_DIR_NAME_INDEX_H_
+#define GW20_HCFS_DIR_NAME_INDEX_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "global.h"
+#include "meta.h"
+
+/* Bits of the negative lookup filter per indexed name */
+#define DIR_NAME_INDEX_BLOOM_BITS 10
+#define DIR_NAME_INDEX_BLOOM_PROBES 3
+#define DIR_NAME_INDEX_MIN_BUCKETS 256
+
+typedef struct DIR_NAME_NODE {
+	struct DIR_NAME_NODE *next;
+	uint32_t hash;
+	uint64_t d_ino;
+	char d_type;
+	char d_name[];
+} DIR_NAME_NODE;
+
+typedef struct {
+	/* Names are compared case-insensitively if TRUE */
+	BOOL is_external;
+	DIR_NAME_NODE **buckets;
+	uint32_t num_buckets;
+	/* Bloom filter of all indexed names. Names deleted from the index
+	stay in the filter until the filter is rebuilt on growth. */
+	uint8_t *bloom;
+	uint32_t bloom_bits;
+	int64_t num_names;
+	int64_t mem_usage;
+} DIR_NAME_INDEX;
+
+DIR_NAME_INDEX *dir_name_index_create(int64_t expected_names,
+				      BOOL is_external);
+void dir_name_index_destroy(DIR_NAME_INDEX **index_ptr);
+int32_t dir_name_index_insert(DIR_NAME_INDEX *index, const DIR_ENTRY *dentry);
+int32_t dir_name_index_delete(DIR_NAME_INDEX *index, const char *name);
+int32_t dir_name_index_lookup(DIR_NAME_INDEX *index, const char *name,
+			      DIR_ENTRY *dentry);
+int64_t dir_name_index_mem_usage(const DIR_NAME_INDEX *index);
+
+#endif  /* GW20_HCFS_DIR_NAME_INDEX_H_ */
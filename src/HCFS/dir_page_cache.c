@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Cache of the dir entry b-tree nodes of a single directory. Lookups used
+* to read the root and every node on the path from the meta file, so that
+* a name lookup in a large directory touched several pages even when the
+* same directory was searched again and again.
+*
+* The root and the internal nodes are few and are on the path of every
+* lookup, so they are pinned until the cache is destroyed. Leaf pages are
+* kept in a LRU list, and the oldest leaf is dropped when there are more
+* than MAX_DIR_PAGE_CACHE_LEAVES of them. The caller decides whether there
+* is room to cache a new page, and is in charge of dropping the whole cache
+* whenever the b-tree is restructured. */
+
+#include "dir_page_cache.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+static inline uint32_t _dir_page_hash(int64_t page_pos)
+{
+	return (uint32_t)(((uint64_t)page_pos / sizeof(DIR_ENTRY_PAGE)) %
+			  DIR_PAGE_CACHE_HASH_SIZE);
+}
+
+/* A page is pinned if it is the root or has children */
+static inline BOOL _is_pinned_page(const DIR_ENTRY_PAGE *page)
+{
+	if (page->parent_page_pos == 0)
+		return TRUE;
+	if (page->child_page_pos[0] != 0)
+		return TRUE;
+	return FALSE;
+}
+
+static void _lru_remove(DIR_PAGE_CACHE *cache, DIR_PAGE_CACHE_ENTRY *entry)
+{
+	if (entry->lru_prev != NULL)
+		entry->lru_prev->lru_next = entry->lru_next;
+	else
+		cache->lru_first = entry->lru_next;
+	if (entry->lru_next != NULL)
+		entry->lru_next->lru_prev = entry->lru_prev;
+	else
+		cache->lru_last = entry->lru_prev;
+	entry->lru_prev = NULL;
+	entry->lru_next = NULL;
+}
+
+static void _lru_push_front(DIR_PAGE_CACHE *cache, DIR_PAGE_CACHE_ENTRY *entry)
+{
+	entry->lru_prev = NULL;
+	entry->lru_next = cache->lru_first;
+	if (cache->lru_first != NULL)
+		cache->lru_first->lru_prev = entry;
+	else
+		cache->lru_last = entry;
+	cache->lru_first = entry;
+}
+
+static DIR_PAGE_CACHE_ENTRY *_find_entry(DIR_PAGE_CACHE *cache,
+					 int64_t page_pos)
+{
+	DIR_PAGE_CACHE_ENTRY *entry;
+
+	entry = cache->hash_table[_dir_page_hash(page_pos)];
+	while (entry != NULL) {
+		if (entry->page.this_page_pos == page_pos)
+			return entry;
+		entry = entry->hash_next;
+	}
+	return NULL;
+}
+
+static void _remove_entry(DIR_PAGE_CACHE *cache, DIR_PAGE_CACHE_ENTRY *entry)
+{
+	DIR_PAGE_CACHE_ENTRY **prev_ptr;
+
+	prev_ptr = &(cache->hash_table[_dir_page_hash(
+					entry->page.this_page_pos)]);
+	while (*prev_ptr != entry)
+		prev_ptr = &((*prev_ptr)->hash_next);
+	*prev_ptr = entry->hash_next;
+
+	if (entry->is_pinned == FALSE) {
+		_lru_remove(cache, entry);
+		cache->num_leaves--;
+	}
+	cache->num_pages--;
+	free(entry);
+}
+
+/************************************************************************
+*
+* Function name: dir_page_cache_get
+*        Inputs: DIR_PAGE_CACHE *cache, int64_t page_pos
+*       Summary: Find the cached b-tree node at file pos "page_pos". If the
+*                node is a leaf, it becomes the most recently used one.
+*  Return value: Pointer to the cached page, or NULL if not cached.
+*
+*************************************************************************/
+DIR_ENTRY_PAGE *dir_page_cache_get(DIR_PAGE_CACHE *cache, int64_t page_pos)
+{
+	DIR_PAGE_CACHE_ENTRY *entry;
+
+	if (cache == NULL)
+		return NULL;
+
+	entry = _find_entry(cache, page_pos);
+	if (entry == NULL)
+		return NULL;
+
+	if ((entry->is_pinned == FALSE) && (cache->lru_first != entry)) {
+		_lru_remove(cache, entry);
+		_lru_push_front(cache, entry);
+	}
+	return &(entry->page);
+}
+
+/************************************************************************
+*
+* Function name: dir_page_cache_put
+*        Inputs: DIR_PAGE_CACHE **cache_ptr, const DIR_ENTRY_PAGE *page
+*       Summary: Cache a copy of b-tree node "page". The cache is allocated
+*                if *cache_ptr is NULL. If the page is already cached, the
+*                cached copy is replaced. If there are too many leaves, the
+*                least recently used one is dropped.
+*  Return value: 0 if successful. Otherwise returns negation of error code.
+*
+*************************************************************************/
+int32_t dir_page_cache_put(DIR_PAGE_CACHE **cache_ptr,
+			   const DIR_ENTRY_PAGE *page)
+{
+	DIR_PAGE_CACHE *cache;
+	DIR_PAGE_CACHE_ENTRY *entry;
+	uint32_t hash_idx;
+
+	if (page->this_page_pos <= 0)
+		return -EINVAL;
+
+	if (*cache_ptr == NULL) {
+		*cache_ptr = calloc(1, sizeof(DIR_PAGE_CACHE));
+		if (*cache_ptr == NULL)
+			return -ENOMEM;
+	}
+	cache = *cache_ptr;
+
+	entry = _find_entry(cache, page->this_page_pos);
+	if (entry != NULL) {
+		/* Pin state might change if the node got children */
+		_remove_entry(cache, entry);
+	}
+
+	entry = malloc(sizeof(DIR_PAGE_CACHE_ENTRY));
+	if (entry == NULL)
+		return -ENOMEM;
+	memcpy(&(entry->page), page, sizeof(DIR_ENTRY_PAGE));
+	entry->is_pinned = _is_pinned_page(page);
+	entry->lru_prev = NULL;
+	entry->lru_next = NULL;
+
+	hash_idx = _dir_page_hash(page->this_page_pos);
+	entry->hash_next = cache->hash_table[hash_idx];
+	cache->hash_table[hash_idx] = entry;
+	cache->num_pages++;
+
+	if (entry->is_pinned == FALSE) {
+		_lru_push_front(cache, entry);
+		cache->num_leaves++;
+		if (cache->num_leaves > MAX_DIR_PAGE_CACHE_LEAVES)
+			dir_page_cache_shrink(cache);
+	}
+	return 0;
+}
+
+/************************************************************************
+*
+* Function name: dir_page_cache_update
+*        Inputs: DIR_PAGE_CACHE *cache, const DIR_ENTRY_PAGE *page
+*       Summary: Refresh the cached copy of "page" if the page is cached.
+*  Return value: 0 if the page was not cached, and 1 if it was refreshed.
+*                Otherwise returns negation of error code.
+*
+*************************************************************************/
+int32_t dir_page_cache_update(DIR_PAGE_CACHE *cache,
+			      const DIR_ENTRY_PAGE *page)
+{
+	DIR_PAGE_CACHE_ENTRY *entry;
+	int32_t ret;
+
+	if (cache == NULL)
+		return 0;
+
+	entry = _find_entry(cache, page->this_page_pos);
+	if (entry == NULL)
+		return 0;
+
+	if (entry->is_pinned == _is_pinned_page(page)) {
+		memcpy(&(entry->page), page, sizeof(DIR_ENTRY_PAGE));
+		return 1;
+	}
+	ret = dir_page_cache_put(&cache, page);
+	if (ret < 0)
+		return ret;
+	return 1;
+}
+
+/************************************************************************
+*
+* Function name: dir_page_cache_drop
+*        Inputs: DIR_PAGE_CACHE *cache, int64_t page_pos
+*       Summary: Drop the cached b-tree node at file pos "page_pos", if the
+*                node is cached.
+*  Return value: 1 if the node was dropped, and 0 if it was not cached.
+*
+*************************************************************************/
+int32_t dir_page_cache_drop(DIR_PAGE_CACHE *cache, int64_t page_pos)
+{
+	DIR_PAGE_CACHE_ENTRY *entry;
+
+	if (cache == NULL)
+		return 0;
+
+	entry = _find_entry(cache, page_pos);
+	if (entry == NULL)
+		return 0;
+
+	_remove_entry(cache, entry);
+	return 1;
+}
+
+/************************************************************************
+*
+* Function name: dir_page_cache_shrink
+*        Inputs: DIR_PAGE_CACHE *cache
+*       Summary: Drop the least recently used leaf page from the cache.
+*  Return value: Number of bytes freed, or 0 if there is no leaf to drop.
+*
+*************************************************************************/
+int32_t dir_page_cache_shrink(DIR_PAGE_CACHE *cache)
+{
+	if ((cache == NULL) || (cache->lru_last == NULL))
+		return 0;
+
+	_remove_entry(cache, cache->lru_last);
+	return sizeof(DIR_PAGE_CACHE_ENTRY);
+}
+
+/************************************************************************
+*
+* Function name: dir_page_cache_destroy
+*        Inputs: DIR_PAGE_CACHE **cache_ptr
+*       Summary: Drop all cached pages and free the cache. *cache_ptr is
+*                set to NULL.
+*  Return value: None.
+*
+*************************************************************************/
+void dir_page_cache_destroy(DIR_PAGE_CACHE **cache_ptr)
+{
+	DIR_PAGE_CACHE *cache;
+	DIR_PAGE_CACHE_ENTRY *entry, *next_entry;
+	int32_t count;
+
+	cache = *cache_ptr;
+	if (cache == NULL)
+		return;
+
+	for (count = 0; count < DIR_PAGE_CACHE_HASH_SIZE; count++) {
+		entry = cache->hash_table[count];
+		while (entry != NULL) {
+			next_entry = entry->hash_next;
+			free(entry);
+			entry = next_entry;
+		}
+	}
+	free(cache);
+	*cache_ptr = NULL;
+}
+
+/* Bytes used by the cache, including the cache structure itself */
+int64_t dir_page_cache_mem_usage(const DIR_PAGE_CACHE *cache)
+{
+	if (cache == NULL)
+		return 0;
+	return sizeof(DIR_PAGE_CACHE) +
+	       (int64_t)cache->num_pages * sizeof(DIR_PAGE_CACHE_ENTRY);
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef GW20_HCFS_DIR_PAGE_CACHE_H_
+#define GW20_HCFS_DIR_PAGE_CACHE_H_
+
+#include <stdint.h>
+
+#include "global.h"
+#include "meta.h"
+
+/* Max number of leaf pages cached for a single directory */
+#define MAX_DIR_PAGE_CACHE_LEAVES 256
+#define DIR_PAGE_CACHE_HASH_SIZE 64
+
+typedef struct DIR_PAGE_CACHE_ENTRY {
+	DIR_ENTRY_PAGE page;
+	/* Root and internal nodes are pinned and never in the LRU list */
+	BOOL is_pinned;
+	struct DIR_PAGE_CACHE_ENTRY *hash_next;
+	struct DIR_PAGE_CACHE_ENTRY *lru_prev;
+	struct DIR_PAGE_CACHE_ENTRY *lru_next;
+} DIR_PAGE_CACHE_ENTRY;
+
+typedef struct {
+	DIR_PAGE_CACHE_ENTRY *hash_table[DIR_PAGE_CACHE_HASH_SIZE];
+	/* Cached leaf pages, most recently used first */
+	DIR_PAGE_CACHE_ENTRY *lru_first;
+	DIR_PAGE_CACHE_ENTRY *lru_last;
+	int32_t num_pages;
+	int32_t num_leaves;
+} DIR_PAGE_CACHE;
+
+DIR_ENTRY_PAGE *dir_page_cache_get(DIR_PAGE_CACHE *cache, int64_t page_pos);
+int32_t dir_page_cache_put(DIR_PAGE_CACHE **cache_ptr,
+			   const DIR_ENTRY_PAGE *page);
+int32_t dir_page_cache_update(DIR_PAGE_CACHE *cache,
+			      const DIR_ENTRY_PAGE *page);
+int32_t dir_page_cache_drop(DIR_PAGE_CACHE *cache, int64_t page_pos);
+int32_t dir_page_cache_shrink(DIR_PAGE_CACHE *cache);
+void dir_page_cache_destroy(DIR_PAGE_CACHE **cache_ptr);
+int64_t dir_page_cache_mem_usage(const DIR_PAGE_CACHE *cache);
+
+#endif  /* GW20_HCFS_DIR_PAGE_CACHE_H_ */
@@ -26,12 +26,191 @@
 #include <semaphore.h>
 #include <sys/stat.h>
 #include <stdlib.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
 
+#include "fuseop.h"
 #include "macro.h"
 #include "path_reconstruct.h"
 #include "parent_lookup.h"
+#include "rebuild_parent_dirstat.h"
 #include "utils.h"
 
+/* Changes waiting to be added to the lookup db, keyed by the dir where
+the walk to the root starts. Protected by pathlookup_data_lock. The tables
+belong to the process "owner_pid". A forked process drops the copy it
+inherits, and starts its own flush thread once it queues a change. */
+static struct {
+	DIRSTAT_DELTA_ENTRY *hash_table[DIRSTAT_DELTA_HASH_SIZE];
+	int32_t num_entries;
+	/* Changes already summed up per dir, but not yet written to the db
+	because a flush failed. Not added to the ancestors again. */
+	DIRSTAT_DELTA_ENTRY *unapplied[DIRSTAT_DELTA_HASH_SIZE];
+	int32_t num_unapplied;
+	pid_t owner_pid;
+	char marker_path[METAPATHLEN];
+	/* Set if pending changes were lost, so that the marker is kept */
+	BOOL lost_delta;
+	BOOL has_thread;
+	/* Set while rebuilding at init, which runs before processes fork */
+	BOOL no_thread;
+	BOOL stopping;
+	sem_t wake_sem;
+	pthread_t flush_thread;
+} dirstat_delta;
+
+static DIRSTAT_DELTA_ENTRY *_find_delta(DIRSTAT_DELTA_ENTRY **hash_table,
+					ino_t thisinode)
+{
+	DIRSTAT_DELTA_ENTRY *entry;
+
+	entry = hash_table[thisinode % DIRSTAT_DELTA_HASH_SIZE];
+	while (entry != NULL) {
+		if (entry->thisinode == thisinode)
+			return entry;
+		entry = entry->next;
+	}
+	return NULL;
+}
+
+static DIRSTAT_DELTA_ENTRY *_new_delta(DIRSTAT_DELTA_ENTRY **hash_table,
+				       ino_t thisinode)
+{
+	DIRSTAT_DELTA_ENTRY *entry;
+	int32_t hashval;
+
+	entry = calloc(1, sizeof(DIRSTAT_DELTA_ENTRY));
+	if (entry == NULL)
+		return NULL;
+	entry->thisinode = thisinode;
+	hashval = thisinode % DIRSTAT_DELTA_HASH_SIZE;
+	entry->next = hash_table[hashval];
+	hash_table[hashval] = entry;
+	return entry;
+}
+
+static void _remove_delta(DIRSTAT_DELTA_ENTRY **hash_table,
+			  DIRSTAT_DELTA_ENTRY *entry)
+{
+	DIRSTAT_DELTA_ENTRY **prev_ptr;
+
+	prev_ptr = &(hash_table[entry->thisinode % DIRSTAT_DELTA_HASH_SIZE]);
+	while (*prev_ptr != entry)
+		prev_ptr = &((*prev_ptr)->next);
+	*prev_ptr = entry->next;
+	free(entry);
+}
+
+static void _clear_deltas(DIRSTAT_DELTA_ENTRY **hash_table)
+{
+	DIRSTAT_DELTA_ENTRY *entry, *next_entry;
+	int32_t count;
+
+	for (count = 0; count < DIRSTAT_DELTA_HASH_SIZE; count++) {
+		entry = hash_table[count];
+		while (entry != NULL) {
+			next_entry = entry->next;
+			free(entry);
+			entry = next_entry;
+		}
+		hash_table[count] = NULL;
+	}
+}
+
+static inline void _add_delta(DIR_STATS_TYPE *tmpstat,
+			      const DIR_STATS_TYPE *delta)
+{
+	tmpstat->num_local += delta->num_local;
+	tmpstat->num_cloud += delta->num_cloud;
+	tmpstat->num_hybrid += delta->num_hybrid;
+}
+
+static void *_dirstat_flush_loop(void *ptr)
+{
+	struct timespec wait_time;
+
+	UNUSED(ptr);
+	while (dirstat_delta.stopping == FALSE) {
+		clock_gettime(CLOCK_REALTIME, &wait_time);
+		wait_time.tv_sec += DIRSTAT_FLUSH_INTERVAL;
+		sem_timedwait(&(dirstat_delta.wake_sem), &wait_time);
+		if (dirstat_delta.stopping == TRUE)
+			break;
+		sem_wait(&(pathlookup_data_lock));
+		flush_dirstat_delta();
+		sem_post(&(pathlookup_data_lock));
+	}
+	return NULL;
+}
+
+/* Helper for taking over the delta table in this process. Changes
+inherited from the parent process are dropped, as the parent flushes
+them. The flush thread of the parent does not exist in this process.
+pathlookup_data_lock should be locked before calling. */
+static void _own_dirstat_delta(void)
+{
+	if (dirstat_delta.owner_pid == getpid())
+		return;
+
+	_clear_deltas(dirstat_delta.hash_table);
+	dirstat_delta.num_entries = 0;
+	_clear_deltas(dirstat_delta.unapplied);
+	dirstat_delta.num_unapplied = 0;
+	dirstat_delta.owner_pid = getpid();
+	snprintf(dirstat_delta.marker_path, METAPATHLEN, "%s/%s%d",
+		 METAPATH, DIRSTAT_DELTA_MARKER, (int32_t)getpid());
+	dirstat_delta.lost_delta = FALSE;
+	dirstat_delta.has_thread = FALSE;
+	dirstat_delta.stopping = FALSE;
+}
+
+/* Helper for starting the flush thread of this process if not running.
+pathlookup_data_lock should be locked before calling. */
+static void _start_dirstat_flusher(void)
+{
+	if ((dirstat_delta.has_thread == TRUE) ||
+	    (dirstat_delta.no_thread == TRUE))
+		return;
+
+	sem_init(&(dirstat_delta.wake_sem), 0, 0);
+	if (pthread_create(&(dirstat_delta.flush_thread), NULL,
+			   &_dirstat_flush_loop, NULL) != 0) {
+		/* Without the thread, changes are flushed when read or when
+		too many dirs have pending changes */
+		write_log(0, "Unable to start dir statistics flush thread\n");
+		sem_destroy(&(dirstat_delta.wake_sem));
+		return;
+	}
+	dirstat_delta.has_thread = TRUE;
+}
+
+/* Helper for checking whether a previous run exited with changes not
+added to the lookup db. The markers are removed. */
+static BOOL _find_lost_delta(void)
+{
+	DIR *dirp;
+	struct dirent *de;
+	char pathname[METAPATHLEN+300];
+	BOOL found = FALSE;
+
+	dirp = opendir(METAPATH);
+	if (dirp == NULL)
+		return FALSE;
+	while ((de = readdir(dirp)) != NULL) {
+		if (strncmp(de->d_name, DIRSTAT_DELTA_MARKER,
+			    strlen(DIRSTAT_DELTA_MARKER)) != 0)
+			continue;
+		found = TRUE;
+		snprintf(pathname, sizeof(pathname), "%s/%s", METAPATH,
+			 de->d_name);
+		unlink(pathname);
+	}
+	closedir(dirp);
+	return found;
+}
+
 /************************************************************************
 *
 * Function name: init_dirstat_lookup
@@ -42,7 +221,7 @@
 *************************************************************************/
 int32_t init_dirstat_lookup()
 {
-	int32_t errcode;
+	int32_t errcode, ret;
 	char pathname[METAPATHLEN+10];
 
 	/* If system is being restored, also need to init a lookup db */
@@ -58,6 +237,21 @@ int32_t init_dirstat_lookup()
 		goto errcode_handle;
 	}
 	setbuf(dirstat_lookup_data_fptr, NULL);
+
+	/* Changes not flushed before a crash are lost, so count again.
+	The lookup db is rebuilt anyway if the system is being restored. */
+	if (_find_lost_delta() == TRUE) {
+		write_log(2, "Dir statistics not flushed. Rebuilding\n");
+		if (hcfs_system->system_restoring == NOT_RESTORING) {
+			/* The rebuild flushes by itself. Flush threads are
+			started by the processes forked after init */
+			dirstat_delta.no_thread = TRUE;
+			ret = rebuild_dirstat_lookup();
+			dirstat_delta.no_thread = FALSE;
+			if (ret < 0)
+				write_log(0, "Unable to rebuild dir statistics\n");
+		}
+	}
 	return 0;
 errcode_handle:
 	return errcode;
@@ -67,12 +261,27 @@ errcode_handle:
 *
 * Function name: destroy_dirstat_lookup
 *        Inputs: None
-*       Summary: Cleanup dir statistics component for HCFS when shutting down
+*       Summary: Cleanup dir statistics component for HCFS when shutting down.
+*                Pending changes are flushed first.
 *  Return value: None
 *
 *************************************************************************/
 void destroy_dirstat_lookup()
 {
+	sem_wait(&(pathlookup_data_lock));
+	_own_dirstat_delta();
+	flush_dirstat_delta();
+	dirstat_delta.stopping = TRUE;
+	sem_post(&(pathlookup_data_lock));
+
+	if (dirstat_delta.has_thread == TRUE) {
+		sem_post(&(dirstat_delta.wake_sem));
+		pthread_join(dirstat_delta.flush_thread, NULL);
+		sem_destroy(&(dirstat_delta.wake_sem));
+		dirstat_delta.has_thread = FALSE;
+	}
+	dirstat_delta.owner_pid = 0;
+
 	fclose(dirstat_lookup_data_fptr);
 	return;
 }
@@ -104,6 +313,14 @@ int32_t reset_dirstat_lookup(ino_t thisinode)
 		return errcode;
 	}
 
+	/* Changes still pending for the inode must not reach the reset
+	statistics */
+	ret = flush_dirstat_delta_of(thisinode);
+	if (ret < 0) {
+		errcode = ret;
+		goto errcode_handle;
+	}
+
 	filepos = (off_t) ((thisinode - 1) * sizeof(DIR_STATS_TYPE));
 	PWRITE(fileno(dirstat_lookup_data_fptr), &tmpstat,
 	       sizeof(DIR_STATS_TYPE), filepos);
@@ -115,6 +332,44 @@ errcode_handle:
 	return errcode;
 }
 
+/* Helper for adding "newstat" to the changes pending for "baseinode" and
+its ancestors. pathlookup_data_lock should be locked before calling. */
+static int32_t _queue_dirstat_delta(ino_t baseinode,
+				    const DIR_STATS_TYPE *newstat)
+{
+	DIRSTAT_DELTA_ENTRY *entry;
+	int32_t fd, errcode;
+
+	_own_dirstat_delta();
+	entry = _find_delta(dirstat_delta.hash_table, baseinode);
+	if (entry == NULL) {
+		/* If the flush fails, the changes are kept and retried later */
+		if (dirstat_delta.num_entries >= MAX_DIRSTAT_DELTA_ENTRIES)
+			flush_dirstat_delta();
+		if ((dirstat_delta.num_entries == 0) &&
+		    (dirstat_delta.num_unapplied == 0)) {
+			fd = open(dirstat_delta.marker_path,
+				  O_CREAT | O_WRONLY, 0600);
+			if (fd < 0) {
+				errcode = errno;
+				write_log(0, "IO error in %s. Code %d, %s\n",
+					  __func__, errcode, strerror(errcode));
+				return -errcode;
+			}
+			close(fd);
+		}
+		entry = _new_delta(dirstat_delta.hash_table, baseinode);
+		if (entry == NULL) {
+			dirstat_delta.lost_delta = TRUE;
+			return -ENOMEM;
+		}
+		dirstat_delta.num_entries++;
+		_start_dirstat_flusher();
+	}
+	_add_delta(&(entry->delta), newstat);
+	return 0;
+}
+
 /************************************************************************
 *
 * Function name: update_dirstat_file
@@ -123,18 +378,15 @@ errcode_handle:
 *                "*newstat", for all inodes on the tree path from the
 *                parents of "thisinode" to the root.
 *                "thisinode" is the file with the location type change.
+*                The change is kept pending until flush_dirstat_delta().
 *  Return value: 0 if successful. Otherwise returns negation of error code.
 *
 *************************************************************************/
 int32_t update_dirstat_file(ino_t thisinode, DIR_STATS_TYPE *newstat)
 {
-	DIR_STATS_TYPE tmpstat;
-	off_t filepos;
-	ino_t current_inode;
 	ino_t *parentlist;
 	int32_t errcode, ret;
 	int32_t numparents, count;
-	PRIMARY_PARENT_T tmpparent;
 
 	if (!thisinode)
 		return -EINVAL;
@@ -154,26 +406,10 @@ int32_t update_dirstat_file(ino_t thisinode, DIR_STATS_TYPE *newstat)
 	}
 
 	for (count = 0; count < numparents; count++) {
-		current_inode = parentlist[count];
-		while (current_inode > 0) {
-			/* Update the statistics of the current inode */
-			filepos = (off_t) ((current_inode - 1) *
-			                    sizeof(DIR_STATS_TYPE));
-			PREAD(fileno(dirstat_lookup_data_fptr), &tmpstat,
-			       sizeof(DIR_STATS_TYPE), filepos);
-
-			tmpstat.num_local += newstat->num_local;
-			tmpstat.num_cloud += newstat->num_cloud;
-			tmpstat.num_hybrid += newstat->num_hybrid;
-			PWRITE(fileno(dirstat_lookup_data_fptr), &tmpstat,
-			       sizeof(DIR_STATS_TYPE), filepos);
-			/* Find the parent */
-			memset(&tmpparent, 0, sizeof(PRIMARY_PARENT_T));
-			filepos = (off_t) ((current_inode - 1) *
-						sizeof(PRIMARY_PARENT_T));
-			PREAD(fileno(pathlookup_data_fptr), &tmpparent,
-			      sizeof(PRIMARY_PARENT_T), filepos);
-			current_inode = tmpparent.parentinode;
+		ret = _queue_dirstat_delta(parentlist[count], newstat);
+		if (ret < 0) {
+			errcode = ret;
+			goto errcode_handle;
 		}
 	}
 
@@ -197,18 +433,15 @@ errcode_handle:
 *       Summary: Change the dir statistics using the delta specified in
 *                "*newstat", for all inodes on the tree path from "baseinode"
 *                "baseinode" to the root.
+*                The change is kept pending until flush_dirstat_delta().
 *                pathlookup_data_lock should be locked before calling.
 *  Return value: 0 if successful. Otherwise returns negation of error code.
 *
 *************************************************************************/
 int32_t update_dirstat_parent(ino_t baseinode, DIR_STATS_TYPE *newstat)
 {
-	DIR_STATS_TYPE tmpstat;
-	off_t filepos;
-	ino_t current_inode;
 	int32_t ret;
 	int32_t sem_val;
-	PRIMARY_PARENT_T tmpparent;
 
 	if (!baseinode)
 		return -EINVAL;
@@ -216,37 +449,188 @@ int32_t update_dirstat_parent(ino_t baseinode, DIR_STATS_TYPE *newstat)
 	if ((sem_val > 0) || (ret < 0))
 		return -EINVAL;
 
-	current_inode = baseinode;
+	return _queue_dirstat_delta(baseinode, newstat);
+}
+
+/* Helper for adding the change of "entry" to each dir on the path from
+its dir to the root in the unapplied table. Parents are looked up once
+per flush and kept in "walked". Nothing is added if the walk fails. */
+static int32_t _collect_delta(DIRSTAT_DELTA_ENTRY **walked,
+			      const DIRSTAT_DELTA_ENTRY *entry)
+{
+	DIRSTAT_DELTA_ENTRY *node, *dir_entry;
+	ino_t current_inode;
+	int32_t ret;
+
+	/* Find the path, and the dirs to add the change to */
+	current_inode = entry->thisinode;
 	while (current_inode > 0) {
-		/* Update the statistics of the current inode */
-		filepos = (off_t) ((current_inode - 1) *
-		                    sizeof(DIR_STATS_TYPE));
-		PREAD(fileno(dirstat_lookup_data_fptr), &tmpstat,
-		       sizeof(DIR_STATS_TYPE), filepos);
-		tmpstat.num_local += newstat->num_local;
-		tmpstat.num_cloud += newstat->num_cloud;
-		tmpstat.num_hybrid += newstat->num_hybrid;
-		PWRITE(fileno(dirstat_lookup_data_fptr), &tmpstat,
-		       sizeof(DIR_STATS_TYPE), filepos);
-		/* Find the parent */
-		memset(&tmpparent, 0, sizeof(PRIMARY_PARENT_T));
-		filepos = (off_t) ((current_inode - 1) *
-					sizeof(PRIMARY_PARENT_T));
-		PREAD(fileno(pathlookup_data_fptr), &tmpparent,
-		      sizeof(PRIMARY_PARENT_T), filepos);
-		current_inode = tmpparent.parentinode;
+		node = _find_delta(walked, current_inode);
+		if (node == NULL) {
+			node = _new_delta(walked, current_inode);
+			if (node == NULL)
+				return -ENOMEM;
+			ret = lookup_first_parent(current_inode,
+						  &(node->parentinode));
+			if (ret < 0) {
+				_remove_delta(walked, node);
+				return ret;
+			}
+		}
+		if (_find_delta(dirstat_delta.unapplied, current_inode) ==
+		    NULL) {
+			if (_new_delta(dirstat_delta.unapplied,
+				       current_inode) == NULL)
+				return -ENOMEM;
+			dirstat_delta.num_unapplied++;
+		}
+		current_inode = node->parentinode;
 	}
 
+	current_inode = entry->thisinode;
+	while (current_inode > 0) {
+		node = _find_delta(walked, current_inode);
+		dir_entry = _find_delta(dirstat_delta.unapplied, current_inode);
+		_add_delta(&(dir_entry->delta), &(entry->delta));
+		current_inode = node->parentinode;
+	}
 	return 0;
+}
+
+/* Helper for adding the summed up change of a dir to the lookup db */
+static int32_t _apply_dir_delta(const DIRSTAT_DELTA_ENTRY *dir_entry)
+{
+	DIR_STATS_TYPE tmpstat;
+	off_t filepos;
+	int32_t errcode;
+
+	if ((dir_entry->delta.num_local == 0) &&
+	    (dir_entry->delta.num_cloud == 0) &&
+	    (dir_entry->delta.num_hybrid == 0))
+		return 0;
+	filepos = (off_t) ((dir_entry->thisinode - 1) *
+			    sizeof(DIR_STATS_TYPE));
+	PREAD(fileno(dirstat_lookup_data_fptr), &tmpstat,
+	      sizeof(DIR_STATS_TYPE), filepos);
+	_add_delta(&tmpstat, &(dir_entry->delta));
+	PWRITE(fileno(dirstat_lookup_data_fptr), &tmpstat,
+	       sizeof(DIR_STATS_TYPE), filepos);
+	return 0;
+
 errcode_handle:
 	return errcode;
 }
 
+/************************************************************************
+*
+* Function name: flush_dirstat_delta
+*        Inputs: None
+*       Summary: Add the pending changes of this process to the lookup db.
+*                The changes reaching each dir on the way to the root are
+*                summed up first, so that each dir is read and written
+*                only once. Changes that cannot be added are kept, and
+*                are retried at the next flush.
+*                pathlookup_data_lock should be locked before calling.
+*  Return value: 0 if successful. Otherwise returns negation of error code.
+*
+*************************************************************************/
+int32_t flush_dirstat_delta(void)
+{
+	DIRSTAT_DELTA_ENTRY *walked[DIRSTAT_DELTA_HASH_SIZE];
+	DIRSTAT_DELTA_ENTRY *entry, *next_entry;
+	int32_t ret, errcode;
+	int32_t sem_val, count;
+
+	ret = sem_getvalue(&(pathlookup_data_lock), &sem_val);
+	if ((sem_val > 0) || (ret < 0))
+		return -EINVAL;
+
+	_own_dirstat_delta();
+	if ((dirstat_delta.num_entries == 0) &&
+	    (dirstat_delta.num_unapplied == 0))
+		return 0;
+
+	/* A change leaves the pending table once it is added to all dirs
+	on its path */
+	errcode = 0;
+	memset(walked, 0, sizeof(walked));
+	for (count = 0; count < DIRSTAT_DELTA_HASH_SIZE; count++) {
+		entry = dirstat_delta.hash_table[count];
+		while (entry != NULL) {
+			next_entry = entry->next;
+			ret = _collect_delta(walked, entry);
+			if (ret < 0) {
+				errcode = ret;
+			} else {
+				_remove_delta(dirstat_delta.hash_table, entry);
+				dirstat_delta.num_entries--;
+			}
+			entry = next_entry;
+		}
+	}
+	_clear_deltas(walked);
+
+	/* Update the statistics of each dir once */
+	for (count = 0; count < DIRSTAT_DELTA_HASH_SIZE; count++) {
+		entry = dirstat_delta.unapplied[count];
+		while (entry != NULL) {
+			next_entry = entry->next;
+			ret = _apply_dir_delta(entry);
+			if (ret < 0) {
+				errcode = ret;
+			} else {
+				_remove_delta(dirstat_delta.unapplied, entry);
+				dirstat_delta.num_unapplied--;
+			}
+			entry = next_entry;
+		}
+	}
+
+	if (errcode < 0) {
+		write_log(0, "Unable to flush dir statistics. Retry later. "
+			  "Code %d\n", -errcode);
+		return errcode;
+	}
+	if (dirstat_delta.lost_delta == FALSE)
+		unlink(dirstat_delta.marker_path);
+	return 0;
+}
+
+/************************************************************************
+*
+* Function name: flush_dirstat_delta_of
+*        Inputs: ino_t thisinode
+*       Summary: Flush the pending changes if any starts from or is
+*                waiting to be written to "thisinode". Called before the
+*                parent of a dir goes away, as the changes are added along
+*                the path to the root at flush, and before resetting it.
+*                pathlookup_data_lock should be locked before calling.
+*  Return value: 0 if successful. Otherwise returns negation of error code.
+*
+*************************************************************************/
+int32_t flush_dirstat_delta_of(ino_t thisinode)
+{
+	int32_t ret;
+	int32_t sem_val;
+
+	ret = sem_getvalue(&(pathlookup_data_lock), &sem_val);
+	if ((sem_val > 0) || (ret < 0))
+		return -EINVAL;
+
+	_own_dirstat_delta();
+	if ((_find_delta(dirstat_delta.hash_table, thisinode) == NULL) &&
+	    (_find_delta(dirstat_delta.unapplied, thisinode) == NULL))
+		return 0;
+	return flush_dirstat_delta();
+}
+
 /************************************************************************
 *
 * Function name: read_dirstat_lookup
 *        Inputs: ino_t thisinode, DIR_STATS_TYPE *newstat
-*       Summary: Return the dir statistics for "thisinode" via "newstat"
+*       Summary: Return the dir statistics for "thisinode" via "newstat".
+*                Pending changes of this process are flushed first. Changes
+*                queued by other processes show up after their next flush.
 *  Return value: 0 if successful. Otherwise returns negation of error code.
 *
 *************************************************************************/
@@ -268,6 +652,12 @@ int32_t read_dirstat_lookup(ino_t thisinode, DIR_STATS_TYPE *newstat)
 		return errcode;
 	}
 
+	ret = flush_dirstat_delta();
+	if (ret < 0) {
+		errcode = ret;
+		goto errcode_handle;
+	}
+
 	filepos = (off_t) ((thisinode - 1) * sizeof(DIR_STATS_TYPE));
 	PREAD(fileno(dirstat_lookup_data_fptr), &tmpstat,
 	      sizeof(DIR_STATS_TYPE), filepos);
@@ -32,6 +32,31 @@ typedef struct {
 /* Share with path lookup the same resource lock */
 FILE *dirstat_lookup_data_fptr;
 
+/* Changes to the statistics of a dir and its ancestors are kept in memory
+   per dir, and are added to the lookup db in batches. Pending changes are
+   flushed every DIRSTAT_FLUSH_INTERVAL seconds, or once changes are
+   pending for MAX_DIRSTAT_DELTA_ENTRIES dirs. Changes that cannot be
+   added are kept and retried at the next flush.
+   Each process keeps its own changes, and a read flushes only those of
+   the reading process. When the upload and cache processes run apart
+   from fuse (not on Android), their changes show up in reads by fuse
+   after up to DIRSTAT_FLUSH_INTERVAL seconds. */
+#define DIRSTAT_FLUSH_INTERVAL 5
+#define MAX_DIRSTAT_DELTA_ENTRIES 4096
+#define DIRSTAT_DELTA_HASH_SIZE 1024
+/* A file with this prefix and the pid is kept in METAPATH while a process
+   has pending changes. If any is found at startup, the lookup db is
+   rebuilt. */
+#define DIRSTAT_DELTA_MARKER "dirstat_delta_"
+
+typedef struct DIRSTAT_DELTA_ENTRY {
+	ino_t thisinode;
+	/* Only used when flushing */
+	ino_t parentinode;
+	DIR_STATS_TYPE delta;
+	struct DIRSTAT_DELTA_ENTRY *next;
+} DIRSTAT_DELTA_ENTRY;
+
 int32_t init_dirstat_lookup(void);
 void destroy_dirstat_lookup(void);
 
@@ -39,6 +64,8 @@ int32_t reset_dirstat_lookup(ino_t thisinode);
 int32_t update_dirstat_file(ino_t thisinode, DIR_STATS_TYPE *newstat);
 int32_t update_dirstat_parent(ino_t baseinode, DIR_STATS_TYPE *newstat);
 int32_t read_dirstat_lookup(ino_t thisinode, DIR_STATS_TYPE *newstat);
+int32_t flush_dirstat_delta(void);
+int32_t flush_dirstat_delta_of(ino_t thisinode);
 
 #endif  /* GW20_HCFS_DIR_STATISTICS_H_ */
 
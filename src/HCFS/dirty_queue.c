@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/* Priority classes for the upload loop. Each round of the upload loop
+* walks the dirty list in super block, and the inodes found are queued by
+* class. The next inode to sync is picked by weighted round robin among
+* the classes, so that small files and meta changes are not stuck behind
+* large uploads, and no class starves.
+*
+* The dirty list in super block stays the only persistent record of dirty
+* inodes. The class of an inode is derived from its super block entry, so
+* the queues are rebuilt by scanning the list and nothing else is written.
+* The queues are only used by the upload loop thread. */
+
+#include "dirty_queue.h"
+
+#include <inttypes.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "logger.h"
+#include "params.h"
+
+static DIRTY_QUEUE_CTL dirty_queue_ctl;
+
+static const int32_t dirty_weights[NUM_DIRTY_CLASSES] = {
+	DIRTY_WEIGHT_PIN, DIRTY_WEIGHT_META, DIRTY_WEIGHT_SMALL,
+	DIRTY_WEIGHT_BULK};
+
+/**
+ * Find the priority class of a dirty inode
+ *
+ * @param this_entry Super block entry of the inode
+ *
+ * @return One of DIRTY_CLASS_*.
+ */
+int32_t dirty_class_of(const SUPER_BLOCK_ENTRY *this_entry)
+{
+	if ((this_entry->pin_status == ST_PIN) ||
+	    (this_entry->pin_status == ST_PINNING))
+		return DIRTY_CLASS_PIN;
+	if (!S_ISREG(this_entry->inode_stat.mode))
+		return DIRTY_CLASS_META;
+	if (this_entry->inode_stat.size <= DIRTY_SMALL_FILE_SIZE)
+		return DIRTY_CLASS_SMALL;
+	return DIRTY_CLASS_BULK;
+}
+
+/**
+ * Drop all queued inodes, and start scanning from the head of the dirty
+ * list. Called at the beginning of each round of the upload loop.
+ */
+void reset_dirty_queues(void)
+{
+	int32_t count;
+
+	for (count = 0; count < NUM_DIRTY_CLASSES; count++) {
+		dirty_queue_ctl.queues[count].head = 0;
+		dirty_queue_ctl.queues[count].num_inodes = 0;
+		dirty_queue_ctl.credits[count] = dirty_weights[count];
+		dirty_queue_ctl.class_resume[count] = 0;
+	}
+	dirty_queue_ctl.scan_next = 0;
+	dirty_queue_ctl.scan_started = FALSE;
+	dirty_queue_ctl.scan_done = FALSE;
+}
+
+/* Helper function to append "this_inode" to a class queue */
+static void _queue_inode(DIRTY_QUEUE *queue, ino_t this_inode)
+{
+	queue->inodes[(queue->head + queue->num_inodes) % DIRTY_QUEUE_SIZE] =
+		this_inode;
+	queue->num_inodes++;
+}
+
+/* Helper function to check if the scan can still queue inodes of a class */
+static BOOL _class_open(int32_t which_class)
+{
+	return ((dirty_queue_ctl.queues[which_class].num_inodes <
+		 DIRTY_QUEUE_SIZE) &&
+		(dirty_queue_ctl.class_resume[which_class] == 0));
+}
+
+/* Queue inodes from the dirty list, until DIRTY_SCAN_BATCH entries are
+ * read or no class can be queued. Inodes of a class whose queue is full
+ * are skipped, and revisited by _rescan_dirty_class later */
+static void _scan_dirty_list(void)
+{
+	SUPER_BLOCK_ENTRY tempentry;
+	ino_t this_inode;
+	int32_t count, which_class;
+
+	for (count = 0; count < NUM_DIRTY_CLASSES; count++)
+		if (_class_open(count) == TRUE)
+			break;
+	if (count >= NUM_DIRTY_CLASSES)
+		return;
+
+	super_block_list_locking(SB_LL_DIRTY);
+	if (dirty_queue_ctl.scan_started == FALSE) {
+		this_inode = sys_super_block->head.first_dirty_inode;
+		dirty_queue_ctl.scan_started = TRUE;
+	} else {
+		this_inode = dirty_queue_ctl.scan_next;
+	}
+
+	for (count = 0; (count < DIRTY_SCAN_BATCH) && (this_inode != 0);
+	     count++) {
+		if ((read_super_block_entry(this_inode, &tempentry) < 0) ||
+		    (tempentry.status != IS_DIRTY)) {
+			/* The inode left the list after the last scan. Finish
+			this round with what is queued */
+			write_log(10, "Debug: Dirty list changed at inode %"
+				  PRIu64 "\n", (uint64_t)this_inode);
+			this_inode = 0;
+			break;
+		}
+		which_class = dirty_class_of(&tempentry);
+		if (_class_open(which_class) == TRUE)
+			_queue_inode(&(dirty_queue_ctl.queues[which_class]),
+				     this_inode);
+		else if (dirty_queue_ctl.class_resume[which_class] == 0)
+			dirty_queue_ctl.class_resume[which_class] = this_inode;
+		this_inode = tempentry.util_ll_next;
+	}
+	dirty_queue_ctl.scan_next = this_inode;
+	if (this_inode == 0)
+		dirty_queue_ctl.scan_done = TRUE;
+	super_block_list_release(SB_LL_DIRTY);
+}
+
+/* Queue inodes of class "which_class" skipped by _scan_dirty_list, reading
+ * at most DIRTY_SCAN_BATCH entries from where the class was left. The
+ * class is queued by the scan again once the revisit catches up with it */
+static void _rescan_dirty_class(int32_t which_class)
+{
+	SUPER_BLOCK_ENTRY tempentry;
+	DIRTY_QUEUE *queue;
+	ino_t this_inode;
+	int32_t count;
+
+	queue = &(dirty_queue_ctl.queues[which_class]);
+	super_block_list_locking(SB_LL_DIRTY);
+	this_inode = dirty_queue_ctl.class_resume[which_class];
+	for (count = 0; (count < DIRTY_SCAN_BATCH) && (this_inode != 0) &&
+	     (this_inode != dirty_queue_ctl.scan_next); count++) {
+		if ((read_super_block_entry(this_inode, &tempentry) < 0) ||
+		    (tempentry.status != IS_DIRTY)) {
+			write_log(10, "Debug: Dirty list changed at inode %"
+				  PRIu64 "\n", (uint64_t)this_inode);
+			this_inode = 0;
+			break;
+		}
+		if (dirty_class_of(&tempentry) == which_class) {
+			if (queue->num_inodes >= DIRTY_QUEUE_SIZE)
+				break;
+			_queue_inode(queue, this_inode);
+		}
+		this_inode = tempentry.util_ll_next;
+	}
+	if (this_inode == dirty_queue_ctl.scan_next)
+		this_inode = 0;
+	dirty_queue_ctl.class_resume[which_class] = this_inode;
+	super_block_list_release(SB_LL_DIRTY);
+}
+
+/* Pick an inode from the queues by weighted round robin. Returns 0 if all
+ * queues are empty */
+static ino_t _pick_dirty_inode(void)
+{
+	DIRTY_QUEUE *queue;
+	ino_t this_inode;
+	int32_t count;
+	BOOL new_cycle;
+
+	for (new_cycle = FALSE; ; new_cycle = TRUE) {
+		for (count = 0; count < NUM_DIRTY_CLASSES; count++) {
+			queue = &(dirty_queue_ctl.queues[count]);
+			if ((queue->num_inodes == 0) ||
+			    (dirty_queue_ctl.credits[count] <= 0))
+				continue;
+			this_inode = queue->inodes[queue->head];
+			queue->head = (queue->head + 1) % DIRTY_QUEUE_SIZE;
+			queue->num_inodes--;
+			dirty_queue_ctl.credits[count]--;
+			dirty_queue_ctl.num_picked[count]++;
+			return this_inode;
+		}
+		if (new_cycle == TRUE)
+			break;
+		for (count = 0; count < NUM_DIRTY_CLASSES; count++)
+			dirty_queue_ctl.credits[count] = dirty_weights[count];
+	}
+	return 0;
+}
+
+/* Helper function to check if some inodes are skipped and not revisited */
+static BOOL _revisit_pending(void)
+{
+	int32_t count;
+
+	for (count = 0; count < NUM_DIRTY_CLASSES; count++)
+		if (dirty_queue_ctl.class_resume[count] != 0)
+			return TRUE;
+	return FALSE;
+}
+
+/**
+ * Pick the next inode to sync in this round of the upload loop
+ *
+ * Classes are served in priority order, each up to its weight per cycle.
+ * A new cycle begins when no class with queued inodes has credits left.
+ *
+ * @return Inode number, or 0 if every dirty inode was picked this round.
+ */
+ino_t dirty_queue_next(void)
+{
+	ino_t this_inode;
+	int32_t count;
+
+	do {
+		if (dirty_queue_ctl.scan_done == FALSE)
+			_scan_dirty_list();
+		for (count = 0; count < NUM_DIRTY_CLASSES; count++)
+			if ((dirty_queue_ctl.class_resume[count] != 0) &&
+			    (dirty_queue_ctl.queues[count].num_inodes == 0))
+				_rescan_dirty_class(count);
+
+		this_inode = _pick_dirty_inode();
+		if (this_inode != 0)
+			return this_inode;
+	} while ((dirty_queue_ctl.scan_done == FALSE) ||
+		 (_revisit_pending() == TRUE));
+
+	write_log(10, "Debug: Dirty inodes picked %" PRId64 ", %" PRId64
+		  ", %" PRId64 ", %" PRId64 "\n",
+		  dirty_queue_ctl.num_picked[DIRTY_CLASS_PIN],
+		  dirty_queue_ctl.num_picked[DIRTY_CLASS_META],
+		  dirty_queue_ctl.num_picked[DIRTY_CLASS_SMALL],
+		  dirty_queue_ctl.num_picked[DIRTY_CLASS_BULK]);
+	return 0;
+}
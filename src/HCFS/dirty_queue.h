@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef GW20_HCFS_DIRTY_QUEUE_H_
+#define GW20_HCFS_DIRTY_QUEUE_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "global.h"
+#include "super_block.h"
+
+/* Priority classes of dirty inodes, from the highest priority */
+#define DIRTY_CLASS_PIN 0 /* Pinned files */
+#define DIRTY_CLASS_META 1 /* Directories, symlinks and other non-files */
+#define DIRTY_CLASS_SMALL 2 /* Files not larger than DIRTY_SMALL_FILE_SIZE */
+#define DIRTY_CLASS_BULK 3 /* Other files */
+#define NUM_DIRTY_CLASSES 4
+
+#define DIRTY_SMALL_FILE_SIZE (4 * 1048576LL)
+
+/* Inodes picked from each class in one scheduling cycle */
+#define DIRTY_WEIGHT_PIN 4
+#define DIRTY_WEIGHT_META 4
+#define DIRTY_WEIGHT_SMALL 2
+#define DIRTY_WEIGHT_BULK 1
+
+/* Max inodes queued for each class, and max super block entries read
+each time the dirty list is scanned or revisited */
+#define DIRTY_QUEUE_SIZE 256
+#define DIRTY_SCAN_BATCH 128
+
+typedef struct {
+	ino_t inodes[DIRTY_QUEUE_SIZE];
+	int32_t head;
+	int32_t num_inodes;
+} DIRTY_QUEUE;
+
+typedef struct {
+	DIRTY_QUEUE queues[NUM_DIRTY_CLASSES];
+	/* Inodes that can still be picked from each class in this cycle */
+	int32_t credits[NUM_DIRTY_CLASSES];
+	/* Next inode in the dirty list to be queued */
+	ino_t scan_next;
+	/* First inode of each class skipped by the scan because the queue of
+	the class was full, or 0. Inodes of the class from here on are left
+	for revisiting */
+	ino_t class_resume[NUM_DIRTY_CLASSES];
+	BOOL scan_started;
+	BOOL scan_done;
+	int64_t num_picked[NUM_DIRTY_CLASSES];
+} DIRTY_QUEUE_CTL;
+
+int32_t dirty_class_of(const SUPER_BLOCK_ENTRY *this_entry);
+void reset_dirty_queues(void);
+ino_t dirty_queue_next(void);
+
+#endif  /* GW20_HCFS_DIRTY_QUEUE_H_ */
@@ -46,6 +46,7 @@
 #include "control_smartcache.h"
 #include "FS_manager.h"
 #include "backend_generic.h"
+#include "block_fd_cache.h"
 
 #define BLK_INCREMENTS MAX_BLOCK_ENTRIES_PER_PAGE
 
@@ -817,6 +818,7 @@ errcode_handle:
 		for (blkcount = 0; blkcount <= count; blkcount++) {
 			fetch_restore_block_path(blockpath, thisinode,
 						 blkcount);
+			invalidate_block_fd(thisinode, blkcount);
 			unlink(blockpath);
 		}
 	}
@@ -1106,6 +1108,7 @@ int32_t delete_meta_blocks(ino_t thisinode, BOOL delete_block)
 				total_removed_cache_size +=
 				    cache_stat.st_blocks * 512;
 			total_removed_cache_blks += 1;
+			invalidate_block_fd(thisinode, count);
 			UNLINK(thisblockpath);
 		}
 	}
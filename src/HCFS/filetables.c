@@ -115,9 +115,7 @@ int64_t open_fh(ino_t thisinode, int32_t flags, BOOL isdir)
 		dirh_ptr = &(system_fh_table.direntry_table[index]);
 		dirh_ptr->thisinode = thisinode;
 		dirh_ptr->flags = flags;
-		dirh_ptr->snapshot_ptr = NULL;
-		sem_init(&(dirh_ptr->snap_ref_sem), 0, 0);
-		sem_init(&(dirh_ptr->wait_ref_sem), 0, 1);
+		dirh_ptr->snapshot = NULL;
 		system_fh_table.have_nonsnap_dir = TRUE;
 	} else {
 		system_fh_table.entry_table_flags[index] = IS_FH;
@@ -127,9 +125,14 @@ int64_t open_fh(ino_t thisinode, int32_t flags, BOOL isdir)
 		system_fh_table.entry_table[index].flags = flags;
 
 		system_fh_table.entry_table[index].blockfptr = NULL;
+		system_fh_table.entry_table[index].block_fd = NULL;
 		system_fh_table.entry_table[index].opened_block = -1;
 		system_fh_table.entry_table[index].cached_page_index = -1;
 		system_fh_table.entry_table[index].cached_filepos = -1;
+		system_fh_table.entry_table[index].last_read_block = -1;
+		system_fh_table.entry_table[index].read_stride = 1;
+		system_fh_table.entry_table[index].prefetch_depth = 1;
+		system_fh_table.entry_table[index].prefetched_until = -1;
 		sem_init(&(system_fh_table.entry_table[index].block_sem), 0, 1);
 	}
 
@@ -177,26 +180,24 @@ int32_t close_fh(int64_t index)
 		system_fh_table.entry_table_flags[index] = NO_FH;
 		tmp_entry->thisinode = 0;
 
-		if ((tmp_entry->blockfptr != NULL) &&
+		if ((tmp_entry->block_fd != NULL) &&
 				(tmp_entry->opened_block >= 0))
-			fclose(tmp_entry->blockfptr);
+			put_block_fd(tmp_entry->block_fd);
 
 		tmp_entry->meta_cache_ptr = NULL;
 		tmp_entry->blockfptr = NULL;
+		tmp_entry->block_fd = NULL;
 		tmp_entry->opened_block = -1;
 		sem_destroy(&(tmp_entry->block_sem));
 		system_fh_table.last_available_index = index;
 	} else if (system_fh_table.entry_table_flags[index] == IS_DIRH) {
 		tmp_DIRH_entry = &(system_fh_table.direntry_table[index]);
 
-		if (tmp_DIRH_entry->snapshot_ptr != NULL) {
-			fclose(tmp_DIRH_entry->snapshot_ptr);
-			tmp_DIRH_entry->snapshot_ptr = NULL;
-		}
+		/* Readers still holding a reference free it when done */
+		put_dir_snapshot(tmp_DIRH_entry->snapshot);
+		tmp_DIRH_entry->snapshot = NULL;
 		system_fh_table.entry_table_flags[index] = NO_FH;
 		tmp_DIRH_entry->thisinode = 0;
-		sem_destroy(&(tmp_DIRH_entry->snap_ref_sem));
-		sem_destroy(&(tmp_DIRH_entry->wait_ref_sem));
 
 		system_fh_table.last_available_index = index;
 	} else {
@@ -217,31 +218,232 @@ int32_t close_fh(int64_t index)
 	return 0;
 }
 
+static int32_t _compare_snapshot_index(const void *a, const void *b)
+{
+	const DIR_SNAPSHOT_INDEX *index_a = (const DIR_SNAPSHOT_INDEX *) a;
+	const DIR_SNAPSHOT_INDEX *index_b = (const DIR_SNAPSHOT_INDEX *) b;
+
+	if (index_a->page_pos < index_b->page_pos)
+		return -1;
+	if (index_a->page_pos > index_b->page_pos)
+		return 1;
+	return 0;
+}
+
+/* Helper for reserving "size" bytes of memory for dir snapshot pages */
+static BOOL _reserve_snapshot_mem(int64_t size)
+{
+	int64_t new_size;
+
+	new_size = __atomic_add_fetch(&(system_fh_table.snapshot_mem_size),
+				      size, __ATOMIC_SEQ_CST);
+	if (new_size <= MAX_DIR_SNAPSHOT_MEM)
+		return TRUE;
+	__atomic_sub_fetch(&(system_fh_table.snapshot_mem_size), size,
+			   __ATOMIC_SEQ_CST);
+	return FALSE;
+}
+
+static void _release_snapshot_mem(int64_t size)
+{
+	__atomic_sub_fetch(&(system_fh_table.snapshot_mem_size), size,
+			   __ATOMIC_SEQ_CST);
+}
+
+static void _free_dir_snapshot(DIR_SNAPSHOT *snapshot)
+{
+	if (snapshot->fptr != NULL)
+		fclose(snapshot->fptr);
+	free(snapshot->pages);
+	_release_snapshot_mem(snapshot->mem_size);
+	free(snapshot->page_index);
+	sem_destroy(&(snapshot->ref_sem));
+	free(snapshot);
+}
+
+/* Helper for moving the pages of "snapshot" to an unlinked temp file.
+Callers hold fh_table_sem, so the temp file name is not shared. */
+static int32_t _spill_dir_snapshot(DIR_SNAPSHOT *snapshot)
+{
+	char snap_name[METAPATHLEN + 1];
+	ssize_t write_size, ret_ssize;
+	int32_t errcode;
+
+	snprintf(snap_name, METAPATHLEN, "%s/tmp_dirmeta_snap", METAPATH);
+	snapshot->fptr = fopen(snap_name, "w+");
+	if (snapshot->fptr == NULL) {
+		errcode = errno;
+		write_log(0, "Error opening dir snapshot file. Code %d, %s\n",
+			  errcode, strerror(errcode));
+		return -errcode;
+	}
+	unlink(snap_name);
+
+	write_size = sizeof(DIR_ENTRY_PAGE) * snapshot->num_pages;
+	if (write_size > 0) {
+		ret_ssize = PWRITE(fileno(snapshot->fptr), snapshot->pages,
+				   write_size, 0);
+		if (ret_ssize < write_size)
+			return -EIO;
+	}
+	free(snapshot->pages);
+	snapshot->pages = NULL;
+	_release_snapshot_mem(snapshot->mem_size);
+	snapshot->mem_size = 0;
+	return 0;
+
+errcode_handle:
+	return errcode;
+}
+
+/* Helper for appending "page" to "snapshot". Page array and index grow
+to "*alloc_pages" entries (at most "max_pages"). Pages are moved to a
+temp file if the memory for a larger page array cannot be reserved. */
+static int32_t _append_snapshot_page(DIR_SNAPSHOT *snapshot,
+				     const DIR_ENTRY_PAGE *page,
+				     int64_t max_pages, int64_t *alloc_pages)
+{
+	DIR_ENTRY_PAGE *new_pages;
+	DIR_SNAPSHOT_INDEX *new_index;
+	int64_t new_alloc, new_mem, index;
+	ssize_t ret_ssize;
+	int32_t ret, errcode;
+
+	if (snapshot->num_pages >= *alloc_pages) {
+		new_alloc = (*alloc_pages == 0) ? 4 : *alloc_pages * 2;
+		if (new_alloc > max_pages)
+			new_alloc = max_pages;
+		new_index = realloc(snapshot->page_index,
+				    sizeof(DIR_SNAPSHOT_INDEX) * new_alloc);
+		if (new_index == NULL)
+			return -ENOMEM;
+		snapshot->page_index = new_index;
+
+		new_mem = sizeof(DIR_ENTRY_PAGE) * new_alloc;
+		if (snapshot->fptr != NULL) {
+			/* Already kept in file */
+		} else if (_reserve_snapshot_mem(new_mem - snapshot->mem_size)
+			   == TRUE) {
+			new_pages = realloc(snapshot->pages, new_mem);
+			if (new_pages == NULL) {
+				_release_snapshot_mem(new_mem -
+						      snapshot->mem_size);
+				return -ENOMEM;
+			}
+			snapshot->pages = new_pages;
+			snapshot->mem_size = new_mem;
+		} else {
+			write_log(4, "Dir snapshot over memory limit, use file\n");
+			ret = _spill_dir_snapshot(snapshot);
+			if (ret < 0)
+				return ret;
+		}
+		*alloc_pages = new_alloc;
+	}
+
+	index = snapshot->num_pages;
+	if (snapshot->fptr == NULL) {
+		memcpy(&(snapshot->pages[index]), page, sizeof(DIR_ENTRY_PAGE));
+	} else {
+		ret_ssize = PWRITE(fileno(snapshot->fptr), page,
+				   sizeof(DIR_ENTRY_PAGE),
+				   sizeof(DIR_ENTRY_PAGE) * index);
+		if (ret_ssize < (ssize_t) sizeof(DIR_ENTRY_PAGE))
+			return -EIO;
+	}
+	snapshot->page_index[index].page_pos = page->this_page_pos;
+	snapshot->page_index[index].page_index = index;
+	snapshot->num_pages++;
+	return 0;
+
+errcode_handle:
+	return errcode;
+}
+
+/************************************************************************
+*
+* Function name: _create_dir_snapshot
+*        Inputs: META_CACHE_ENTRY_STRUCT *body_ptr,
+*                DIR_SNAPSHOT **snapshot_ptr
+*       Summary: Copy the dir meta and all b-tree pages of the dir in
+*                "body_ptr", following the tree walk list. Pages are
+*                kept in memory up to MAX_DIR_SNAPSHOT_MEM for all
+*                snapshots, and in a temp file otherwise.
+*                The new snapshot has no reference yet.
+*  Return value: 0 if successful. Otherwise returns negation of error code.
+*
+*************************************************************************/
+static int32_t _create_dir_snapshot(META_CACHE_ENTRY_STRUCT *body_ptr,
+				    DIR_SNAPSHOT **snapshot_ptr)
+{
+	DIR_SNAPSHOT *snapshot;
+	DIR_ENTRY_PAGE tmppage;
+	int64_t page_pos, max_pages, alloc_pages;
+	int32_t ret, errcode;
+
+	snapshot = calloc(1, sizeof(DIR_SNAPSHOT));
+	if (snapshot == NULL)
+		return -ENOMEM;
+	sem_init(&(snapshot->ref_sem), 0, 1);
+
+	MREAD(body_ptr, &(snapshot->dir_meta), sizeof(DIR_META_TYPE),
+	      sizeof(HCFS_STAT));
+
+	/* Each page holds at least one of the entries (including "." and
+	"..") so a longer walk means the list is corrupted */
+	max_pages = snapshot->dir_meta.total_children + 3;
+	alloc_pages = 0;
+	page_pos = snapshot->dir_meta.tree_walk_list_head;
+	while (page_pos != 0) {
+		if (snapshot->num_pages >= max_pages) {
+			write_log(0, "Tree walk list of dir meta is broken\n");
+			errcode = -EIO;
+			goto errcode_handle;
+		}
+		MREAD(body_ptr, &tmppage, sizeof(DIR_ENTRY_PAGE), page_pos);
+		ret = _append_snapshot_page(snapshot, &tmppage, max_pages,
+					    &alloc_pages);
+		if (ret < 0) {
+			errcode = ret;
+			goto errcode_handle;
+		}
+		page_pos = tmppage.tree_walk_next;
+	}
+
+	if (snapshot->num_pages > 0)
+		qsort(snapshot->page_index, snapshot->num_pages,
+		      sizeof(DIR_SNAPSHOT_INDEX), _compare_snapshot_index);
+
+	*snapshot_ptr = snapshot;
+	return 0;
+
+errcode_handle:
+	_free_dir_snapshot(snapshot);
+	return errcode;
+}
+
 /************************************************************************
 *
 * Function name: handle_dirmeta_snapshot
-*        Inputs: ino_t thisinode, FILE *metafptr
-*       Summary: Scans filetable and create snapshot of meta for inode
-*                "thisinode". "metafptr" points to the file stream
-*                of the source meta file. "metafptr" needs to be locked.
+*        Inputs: ino_t thisinode, META_CACHE_ENTRY_STRUCT *body_ptr
+*       Summary: Scans filetable and create an in-memory snapshot of the
+*                dir meta of inode "thisinode" for the opened handles of
+*                the dir. The snapshot is shared by these handles.
+*                "body_ptr" needs to be locked with meta file opened.
 *  Return value: 0 if successful. Otherwise returns negation of error code.
 *
 *************************************************************************/
-int32_t handle_dirmeta_snapshot(ino_t thisinode, FILE *metafptr)
+int32_t handle_dirmeta_snapshot(ino_t thisinode,
+				META_CACHE_ENTRY_STRUCT *body_ptr)
 {
 	int count;
 	DIRH_ENTRY *tmp_entry;
-	BOOL snap_created;
-	char snap_name[METAPATHLEN + 1];
-	int64_t ret_pos;
-	int32_t errcode;
-	FILE *snapfptr = NULL;
-	size_t ret_size;
-	uint8_t buf[4096];
+	DIR_SNAPSHOT *snapshot;
+	int32_t ret;
 	BOOL have_opened_nonsnap;
 
-	snap_created = FALSE;
-	if (metafptr == NULL)
+	snapshot = NULL;
+	if (body_ptr == NULL)
 		return -EIO;
 
 	sem_wait(&(system_fh_table.fh_table_sem));
@@ -251,54 +453,29 @@ int32_t handle_dirmeta_snapshot(ino_t thisinode, FILE *metafptr)
 	}
 
 	have_opened_nonsnap = FALSE;
-	snprintf(snap_name, METAPATHLEN, "%s/tmp_dirmeta_snap", METAPATH);
 
 	for (count = 0; count < MAX_OPEN_FILE_ENTRIES; count++) {
 		tmp_entry = &(system_fh_table.direntry_table[count]);
-		if ((system_fh_table.entry_table_flags[count] == IS_DIRH) &&
-		    (tmp_entry->snapshot_ptr == NULL)) {
-			if ((tmp_entry->thisinode == thisinode) &&
-			    (snap_created == FALSE)) {
-				/* Create snapshot */
-				if (access(snap_name, F_OK) == 0)
-					UNLINK(snap_name);
-				ret_pos = FTELL(metafptr);
-				snapfptr = fopen(snap_name, "w");
-				if (snapfptr == NULL) {
-					errcode = -errno;
-					write_log(0, "Error in meta snap\n");
-					write_log(0, "Code %d\n", errcode);
-					errcode = -EIO;
-					goto errcode_handle;
-				}
-				FSEEK(metafptr, 0, SEEK_SET);
-				while (!feof(metafptr)) {
-					ret_size = FREAD(buf, 1, sizeof(buf), metafptr);
-					if (ret_size == 0)
-						break;
-					FWRITE(buf, 1, ret_size, snapfptr);
-				}
-				FSEEK(metafptr, ret_pos, SEEK_SET);
-				fclose(snapfptr);
-				snap_created = TRUE;
-			}
-			if (tmp_entry->thisinode == thisinode) {
-				tmp_entry->snapshot_ptr = fopen(snap_name, "r");
-				if (tmp_entry->snapshot_ptr == NULL) {
-					errcode = -errno;
-					write_log(0, "Error in meta snap\n");
-					write_log(0, "Code %d\n", errcode);
-					errcode = -EIO;
-					goto errcode_handle;
-				}
-				sem_destroy(&(tmp_entry->snap_ref_sem));
-				sem_destroy(&(tmp_entry->wait_ref_sem));
-				sem_init(&(tmp_entry->snap_ref_sem), 0, 0);
-				sem_init(&(tmp_entry->wait_ref_sem), 0, 1);
-			} else {
-				have_opened_nonsnap = TRUE;
+		if ((system_fh_table.entry_table_flags[count] != IS_DIRH) ||
+		    (tmp_entry->snapshot != NULL))
+			continue;
+		if (tmp_entry->thisinode != thisinode) {
+			have_opened_nonsnap = TRUE;
+			continue;
+		}
+		if (snapshot == NULL) {
+			ret = _create_dir_snapshot(body_ptr, &snapshot);
+			if (ret < 0) {
+				write_log(0, "Error in meta snap\n");
+				write_log(0, "Code %d\n", ret);
+				sem_post(&(system_fh_table.fh_table_sem));
+				return ret;
 			}
 		}
+		sem_wait(&(snapshot->ref_sem));
+		snapshot->refcount++;
+		sem_post(&(snapshot->ref_sem));
+		tmp_entry->snapshot = snapshot;
 	}
 
 	if (have_opened_nonsnap)
@@ -306,15 +483,129 @@ int32_t handle_dirmeta_snapshot(ino_t thisinode, FILE *metafptr)
 	else
 		system_fh_table.have_nonsnap_dir = FALSE;
 
-	if (snap_created)
-		unlink(snap_name);
 	sem_post(&(system_fh_table.fh_table_sem));
 	return 0;
-errcode_handle:
-	if (snap_created)
-		unlink(snap_name);
+}
+
+/************************************************************************
+*
+* Function name: get_dirh_snapshot
+*        Inputs: DIRH_ENTRY *dirh_ptr, BOOL drop_snapshot
+*       Summary: Take a reference to the snapshot of dir handle "dirh_ptr".
+*                If "drop_snapshot" is TRUE, the snapshot is detached
+*                from the handle instead, as listing restarts from the
+*                beginning of the dir.
+*  Return value: Pointer to the snapshot, or NULL if there is none to use.
+*                Reference needs to be released by put_dir_snapshot.
+*
+*************************************************************************/
+DIR_SNAPSHOT *get_dirh_snapshot(DIRH_ENTRY *dirh_ptr, BOOL drop_snapshot)
+{
+	DIR_SNAPSHOT *snapshot;
+
+	sem_wait(&(system_fh_table.fh_table_sem));
+	snapshot = dirh_ptr->snapshot;
+	if (snapshot == NULL) {
+		sem_post(&(system_fh_table.fh_table_sem));
+		return NULL;
+	}
+
+	if (drop_snapshot == TRUE) {
+		dirh_ptr->snapshot = NULL;
+		system_fh_table.have_nonsnap_dir = TRUE;
+		sem_post(&(system_fh_table.fh_table_sem));
+		put_dir_snapshot(snapshot);
+		return NULL;
+	}
+
+	sem_wait(&(snapshot->ref_sem));
+	snapshot->refcount++;
+	sem_post(&(snapshot->ref_sem));
 	sem_post(&(system_fh_table.fh_table_sem));
-	if (snapfptr)
-		fclose(snapfptr);
-	return errcode;
+	return snapshot;
+}
+
+/************************************************************************
+*
+* Function name: put_dir_snapshot
+*        Inputs: DIR_SNAPSHOT *snapshot
+*       Summary: Release a reference to "snapshot", and free it after the
+*                last reference is gone.
+*  Return value: None
+*
+*************************************************************************/
+void put_dir_snapshot(DIR_SNAPSHOT *snapshot)
+{
+	BOOL need_free;
+
+	if (snapshot == NULL)
+		return;
+
+	sem_wait(&(snapshot->ref_sem));
+	snapshot->refcount--;
+	need_free = (snapshot->refcount <= 0) ? TRUE : FALSE;
+	sem_post(&(snapshot->ref_sem));
+
+	if (need_free == TRUE)
+		_free_dir_snapshot(snapshot);
+}
+
+/************************************************************************
+*
+* Function name: find_dir_snapshot_page
+*        Inputs: const DIR_SNAPSHOT *snapshot, int64_t page_pos
+*       Summary: Find the page at position "page_pos" of the meta file
+*                in "snapshot".
+*  Return value: Index of the page in "snapshot", or -1 if not found.
+*
+*************************************************************************/
+int64_t find_dir_snapshot_page(const DIR_SNAPSHOT *snapshot,
+			       int64_t page_pos)
+{
+	DIR_SNAPSHOT_INDEX key, *found;
+
+	if (snapshot->num_pages <= 0)
+		return -1;
+
+	key.page_pos = page_pos;
+	found = bsearch(&key, snapshot->page_index, snapshot->num_pages,
+			sizeof(DIR_SNAPSHOT_INDEX), _compare_snapshot_index);
+	if (found == NULL)
+		return -1;
+	return found->page_index;
+}
+
+/************************************************************************
+*
+* Function name: get_dir_snapshot_page
+*        Inputs: const DIR_SNAPSHOT *snapshot, int64_t index,
+*                DIR_ENTRY_PAGE *tmppage
+*       Summary: Get the page at "index" of "snapshot". Pages kept in the
+*                temp file of the snapshot are read into "tmppage".
+*  Return value: Pointer to the page, or NULL if "index" is out of range
+*                or the page cannot be read.
+*
+*************************************************************************/
+DIR_ENTRY_PAGE *get_dir_snapshot_page(const DIR_SNAPSHOT *snapshot,
+				      int64_t index, DIR_ENTRY_PAGE *tmppage)
+{
+	ssize_t ret_ssize;
+	int32_t errcode;
+
+	if ((index < 0) || (index >= snapshot->num_pages))
+		return NULL;
+	if (snapshot->fptr == NULL)
+		return &(snapshot->pages[index]);
+
+	ret_ssize = PREAD(fileno(snapshot->fptr), tmppage,
+			  sizeof(DIR_ENTRY_PAGE), sizeof(DIR_ENTRY_PAGE) * index);
+	if (ret_ssize < (ssize_t) sizeof(DIR_ENTRY_PAGE)) {
+		write_log(0, "Short read of dir snapshot page\n");
+		return NULL;
+	}
+	return tmppage;
+
+errcode_handle:
+	errno = -errcode;
+	return NULL;
 }
@@ -24,6 +24,7 @@
 #include <stdlib.h>
 
 #include "meta_mem_cache.h"
+#include "block_fd_cache.h"
 
 /*BEGIN definition of file handle */
 
@@ -33,28 +34,59 @@
 #define IS_DIRH 2
 #define NO_FH 0
 
+/* Limit of memory used by the pages of all dir snapshots. Pages of a
+snapshot taken over the limit are kept in a temp file instead. */
+#define MAX_DIR_SNAPSHOT_MEM (16 * 1024 * 1024)
+
 typedef struct {
 	ino_t thisinode;
 	int32_t flags;
 	META_CACHE_ENTRY_STRUCT *meta_cache_ptr;
 	char meta_cache_locked;
 	FILE *blockfptr;
+	/* Reference to the block fd cache entry of "opened_block" */
+	BLOCK_FD_ENTRY *block_fd;
 	int64_t opened_block;
 	int64_t cached_page_index;
 	int64_t cached_filepos;
 	uint32_t cached_paged_out_count;
+	/* Sequential read detection for prefetching */
+	int64_t last_read_block;
+	int64_t read_stride;
+	int32_t prefetch_depth;
+	int64_t prefetched_until;
 	sem_t block_sem;
 } FH_ENTRY;
 
+/* Maps a b-tree page position to its index in DIR_SNAPSHOT.pages */
+typedef struct {
+	int64_t page_pos;
+	int64_t page_index;
+} DIR_SNAPSHOT_INDEX;
+
+/* Copy of the b-tree pages of a directory, taken when the dir is
+modified while being listed. Pages are stored in tree walk order, and
+the snapshot is shared by all handles of the dir that were open at the
+time. "refcount" counts both the handles and the readers in progress. */
+typedef struct {
+	DIR_META_TYPE dir_meta;
+	int64_t num_pages;
+	/* Pages are in "pages", or in the unlinked temp file "fptr" if
+	over MAX_DIR_SNAPSHOT_MEM. Read them with get_dir_snapshot_page. */
+	DIR_ENTRY_PAGE *pages;
+	FILE *fptr;
+	int64_t mem_size;
+	/* Sorted by page_pos for locating the page of a readdir offset */
+	DIR_SNAPSHOT_INDEX *page_index;
+	int32_t refcount;
+	sem_t ref_sem;
+} DIR_SNAPSHOT;
+
 typedef struct {
 	ino_t thisinode;
 	int flags;
-	FILE *snapshot_ptr;
-	/* snap_ref_sem value = how many threads are using the snapshot */
-	sem_t snap_ref_sem;
-	/* wait_ref_sem = whether any thread is waiting for other refs to
-	finish. 0 = Yes, 1 = No */
-	sem_t wait_ref_sem;
+	/* Protected by fh_table_sem */
+	DIR_SNAPSHOT *snapshot;
 } DIRH_ENTRY;
 
 typedef struct {
@@ -66,6 +98,8 @@ typedef struct {
 	for the need to create dir snapshot if a dir changing op occurs */
 	BOOL have_nonsnap_dir;
 	int64_t last_available_index;
+	/* Memory used by pages of all dir snapshots, updated atomically */
+	int64_t snapshot_mem_size;
 	sem_t fh_table_sem;
 } FH_TABLE_TYPE;
 
@@ -75,7 +109,14 @@ int32_t init_system_fh_table(void);
 int64_t open_fh(ino_t thisinode, int32_t flags, BOOL isdir);
 int32_t close_fh(int64_t index);
 
-int32_t handle_dirmeta_snapshot(ino_t thisinode, FILE *metafptr);
+int32_t handle_dirmeta_snapshot(ino_t thisinode,
+				META_CACHE_ENTRY_STRUCT *body_ptr);
+DIR_SNAPSHOT *get_dirh_snapshot(DIRH_ENTRY *dirh_ptr, BOOL drop_snapshot);
+void put_dir_snapshot(DIR_SNAPSHOT *snapshot);
+int64_t find_dir_snapshot_page(const DIR_SNAPSHOT *snapshot,
+			       int64_t page_pos);
+DIR_ENTRY_PAGE *get_dir_snapshot_page(const DIR_SNAPSHOT *snapshot,
+				      int64_t index, DIR_ENTRY_PAGE *tmppage);
 
 /*END definition of file handle */
 
@@ -61,6 +61,10 @@
 #include "alias.h"
 #include "api_interface.h"
 #include "atomic_tocloud.h"
+#include "block_fd_cache.h"
+#include "write_buffer.h"
+#include "hcfs_cachebuild.h"
+#include "cache_policy.h"
 #include "dir_statistics.h"
 #include "do_fallocate.h"
 #include "file_present.h"
@@ -846,11 +850,18 @@ static void hfuse_ll_getattr(fuse_req_t req, fuse_ino_t ino,
 		tmpptr = (MOUNT_T *) fuse_req_userdata(req);
 #endif
 
-		ret_code = fetch_inode_stat(hit_inode, &tmp_stat, NULL, NULL);
+		/* Cached stat can be read without locking the entry */
+		ret_code = meta_cache_lookup_stat_snapshot(hit_inode,
+							   &tmp_stat);
+		if (ret_code < 0)
+			ret_code = fetch_inode_stat(hit_inode, &tmp_stat,
+						    NULL, NULL);
 		if (ret_code < 0) {
 			fuse_reply_err(req, -ret_code);
 			return;
 		}
+		/* Size and times must include buffered writes */
+		write_buffer_update_stat(hit_inode, &tmp_stat);
 
 #ifdef _ANDROID_ENV_
 		if (IS_ANDROID_EXTERNAL(tmpptr->volume_type)) {
@@ -1918,6 +1929,7 @@ a directory (for NFS) */
 		fuse_reply_err(req, -ret_val);
 		return;
 	}
+	write_buffer_update_stat(this_ino, &this_stat);
 	convert_hcfsstat_to_sysstat(&output_param.attr, &this_stat);
 
 #ifdef _ANDROID_ENV_
@@ -2626,10 +2638,14 @@ void hfuse_ll_rename(fuse_req_t req, fuse_ino_t parent,
 
 	} /* (parent_inode1 != parent_inode2) */
 
-	/* Clear path cache entry after rename */
+	/* Clear path cache entries after rename. The renamed inode is
+	cleared too, as its cached name and parent are now stale. */
 	if (is_external) {
 		ret_val = delete_pathcache_node(tmpptr->vol_path_cache,
 						old_target_inode);
+		if (ret_val >= 0)
+			ret_val = delete_pathcache_node(
+			    tmpptr->vol_path_cache, self_inode);
 		if (ret_val < 0) {
 			_cleanup_rename(body_ptr, old_target_ptr, parent1_ptr,
 					parent2_ptr);
@@ -3018,6 +3034,7 @@ int32_t truncate_delete_block(BLOCK_ENTRY_PAGE *temppage, int32_t start_index,
 			/* Leave loop directly */
 			break;
 		}
+		invalidate_block_fd(inode_index, tmp_blk_index);
 
 		/* Update block seq */
 		tmpentry->seqnum = filemeta->finished_seq;
@@ -3664,6 +3681,9 @@ int32_t hfuse_ll_truncate(ino_t this_inode,
 				goto errcode_handle;
 			}
 		}
+		/* Pages past the new end are emptied, so their cached
+		positions are of no more use */
+		meta_cache_drop_block_map(*body_ptr);
 		write_log(10, "Debug truncate update xattr\n");
 		/* Will need to remember the old offset, so that sync to cloud
 		process can check the block status and delete them */
@@ -3955,49 +3975,100 @@ int32_t read_wait_full_cache(BLOCK_ENTRY_PAGE *temppage, int64_t entry_index,
 	return 0;
 }
 
-/* Helper function for read operation. Will prefetch a block from backend for
-*  reading. */
-/* TODO: For prefetching, need to prevent opening multiple threads
-to prefetch the same block (waste of resource, but not critical though as
-only one thread will actually download the block) */
-int32_t read_prefetch_cache(BLOCK_ENTRY_PAGE *tpage, int64_t eindex,
-		ino_t this_inode, int64_t block_index, off_t this_page_fpos)
+/* Helper function for read operation. Will queue blocks following "bindex"
+*  for prefetching. The prefetch depth doubles up to MAX_PREFETCH_DEPTH as
+*  long as the handle keeps reading with the same stride, and falls back to
+*  one block on random access. */
+int32_t read_prefetch_cache(FH_ENTRY *fh_ptr, BLOCK_ENTRY_PAGE *tpage,
+		int64_t eindex, ino_t this_inode, int64_t block_index,
+		off_t this_page_fpos)
 {
-	int32_t ret;
-	PREFETCH_STRUCT_TYPE *temp_prefetch;
-	pthread_t prefetch_thread;
-
-	if ((eindex+1) >= MAX_BLOCK_ENTRIES_PER_PAGE)
+	int32_t ret, count;
+	int64_t stride, target, target_eindex, seqnum;
+	off_t target_fpos;
+
+	stride = block_index - fh_ptr->last_read_block;
+	if ((fh_ptr->last_read_block >= 0) && (stride > 0) &&
+	    (stride == fh_ptr->read_stride)) {
+		if (fh_ptr->prefetch_depth < MAX_PREFETCH_DEPTH)
+			fh_ptr->prefetch_depth *= 2;
+		if (fh_ptr->prefetch_depth > MAX_PREFETCH_DEPTH)
+			fh_ptr->prefetch_depth = MAX_PREFETCH_DEPTH;
+	} else {
+		fh_ptr->read_stride = ((fh_ptr->last_read_block >= 0) &&
+			(stride > 0) && (stride <= MAX_PREFETCH_DEPTH)) ?
+			stride : 1;
+		fh_ptr->prefetch_depth = 1;
+		fh_ptr->prefetched_until = block_index;
+	}
+	fh_ptr->last_read_block = block_index;
+
+	/* Cannot prefetch, and only fail if the next block is in the cloud */
+	if (hcfs_system->sync_paused) {
+		if (((eindex + 1) < MAX_BLOCK_ENTRIES_PER_PAGE) &&
+		    (((tpage->block_entries[eindex + 1]).status == ST_CLOUD) ||
+		     ((tpage->block_entries[eindex + 1]).status == ST_CtoL)))
+			return -EIO;
 		return 0;
-	if (((tpage->block_entries[eindex+1]).status == ST_CLOUD) ||
-		((tpage->block_entries[eindex+1]).status == ST_CtoL)) {
+	}
 
-		if (hcfs_system->sync_paused)
-			return -EIO;
+	for (count = 1; count <= fh_ptr->prefetch_depth; count++) {
+		target = block_index + count * fh_ptr->read_stride;
+		if (target <= fh_ptr->prefetched_until)
+			continue;
 
-		temp_prefetch = malloc(sizeof(PREFETCH_STRUCT_TYPE));
-		if (temp_prefetch == NULL) {
-			write_log(0, "Error cannot open prefetch\n");
-			return -ENOMEM;
-		}
-		temp_prefetch->this_inode = this_inode;
-		temp_prefetch->block_no = block_index + 1;
-		temp_prefetch->seqnum = tpage->block_entries[eindex+1].seqnum;
-		temp_prefetch->page_start_fpos = this_page_fpos;
-		temp_prefetch->entry_index = eindex + 1;
-		write_log(10, "Prefetching block %lld for inode %" PRIu64 "\n",
-			block_index + 1, (uint64_t)this_inode);
-		ret = pthread_create(&(prefetch_thread),
-			&prefetch_thread_attr, (void *)&prefetch_block,
-			((void *)temp_prefetch));
-		if (ret != 0) {
-			write_log(0, "Error number %d\n", ret);
-			return -EAGAIN;
+		target_eindex = eindex + (target - block_index);
+		if (target_eindex < MAX_BLOCK_ENTRIES_PER_PAGE) {
+			/* Same page. Skip if not in the cloud */
+			if (((tpage->block_entries[target_eindex]).status !=
+			     ST_CLOUD) &&
+			    ((tpage->block_entries[target_eindex]).status !=
+			     ST_CtoL)) {
+				fh_ptr->prefetched_until = target;
+				continue;
+			}
+			seqnum = tpage->block_entries[target_eindex].seqnum;
+			target_fpos = this_page_fpos;
+		} else {
+			/* Page will be resolved by prefetch threads */
+			seqnum = PREFETCH_ANY_SEQNUM;
+			target_fpos = 0;
 		}
+
+		ret = enqueue_prefetch_block(this_inode, target, seqnum,
+				target_fpos);
+		if (ret < 0)
+			return ret;
+		fh_ptr->prefetched_until = target;
 	}
 	return 0;
 }
 
+/* Helper function for read/write operation. Return the opened block of
+*  the file handle to the block fd cache. */
+static void _close_opened_block(FH_ENTRY *fh_ptr)
+{
+	put_block_fd(fh_ptr->block_fd);
+	fh_ptr->block_fd = NULL;
+	fh_ptr->blockfptr = NULL;
+	fh_ptr->opened_block = -1;
+}
+
+/* Helper function for read/write operation. Open block "bindex" for the
+*  file handle through the block fd cache. */
+static int32_t _open_cached_block(FH_ENTRY *fh_ptr, ino_t this_inode,
+		int64_t bindex, const char *blockpath)
+{
+	fh_ptr->block_fd = get_block_fd(this_inode, bindex, blockpath);
+	if (fh_ptr->block_fd == NULL) {
+		fh_ptr->opened_block = -1;
+		return -errno;
+	}
+	fh_ptr->blockfptr = fh_ptr->block_fd->fptr;
+	fh_ptr->opened_block = bindex;
+	return 0;
+}
+
 /* Helper function for read operation. Will fetch a block from backend for
 *  reading. */
 int32_t read_fetch_backend(ino_t this_inode, int64_t bindex, FH_ENTRY *fh_ptr,
@@ -4017,6 +4088,10 @@ int32_t read_fetch_backend(ino_t this_inode, int64_t bindex, FH_ENTRY *fh_ptr,
 	if (ret < 0)
 		return ret;
 
+	/* The block file may have been paged out by another process, so
+	 * drop the cached descriptor before the block file is recreated */
+	invalidate_block_fd(this_inode, bindex);
+
 	fh_ptr->blockfptr = fopen(thisblockpath, "a+");
 	if (fh_ptr->blockfptr == NULL) {
 		errcode = errno;
@@ -4125,6 +4200,7 @@ int32_t read_fetch_backend(ino_t this_inode, int64_t bindex, FH_ENTRY *fh_ptr,
 					NULL, NULL, tpage, page_fpos,
 					fh_ptr->meta_cache_ptr);
 				/* Unlink this block */
+				invalidate_block_fd(this_inode, bindex);
 				if (access(thisblockpath, F_OK) == 0)
 					unlink(thisblockpath);
 			}
@@ -4219,8 +4295,10 @@ int32_t read_fetch_backend(ino_t this_inode, int64_t bindex, FH_ENTRY *fh_ptr,
 	}
 	fh_ptr->meta_cache_locked = FALSE;
 	meta_cache_unlock_entry(fh_ptr->meta_cache_ptr);
-	setbuf(fh_ptr->blockfptr, NULL);
-	fh_ptr->opened_block = bindex;
+	/* The block will be opened again through the block fd cache */
+	flock(fileno(fh_ptr->blockfptr), LOCK_UN);
+	fclose(fh_ptr->blockfptr);
+	fh_ptr->blockfptr = NULL;
 
 	return 0;
 error_handling:
@@ -4234,6 +4312,148 @@ error_handling:
 	return ret;
 }
 
+/* A cloud block to be fetched for a read spanning several blocks */
+typedef struct {
+	ino_t this_inode;
+	int64_t block_index;
+	off_t page_fpos;
+	int64_t entry_index;
+	int32_t ret;
+	BOOL queued;
+	FETCH_WAIT_TYPE waiter;
+} READ_FETCH_JOB;
+
+static int32_t _read_fetch_job(void *ptr)
+{
+	READ_FETCH_JOB *job;
+	FH_ENTRY tmp_fh;
+	BLOCK_ENTRY_PAGE temppage;
+
+	job = (READ_FETCH_JOB *) ptr;
+
+	/* The handle of the read is in use by the reader */
+	memset(&tmp_fh, 0, sizeof(FH_ENTRY));
+	tmp_fh.thisinode = job->this_inode;
+	tmp_fh.opened_block = -1;
+	tmp_fh.cached_page_index = -1;
+	tmp_fh.cached_filepos = -1;
+
+	job->ret = read_fetch_backend(job->this_inode, job->block_index,
+			&tmp_fh, &temppage, job->page_fpos, job->entry_index);
+	return job->ret;
+}
+
+/* Helper function for read operation. If a read spans several blocks
+*  that are only in the cloud, fetch them concurrently instead of one
+*  after another in _read_block. All but the first block are fetched by
+*  the prefetch threads, ahead of prefetches, if threads are free, and by
+*  this thread otherwise. Returns the first block that failed to be
+*  fetched with its error in "reterr", or -1 if there is none. */
+static int64_t _read_fetch_blocks(FH_ENTRY *fh_ptr, int64_t start_block,
+		int64_t end_block, uint8_t pin_s, int32_t *reterr)
+{
+	READ_FETCH_JOB jobs[MAX_READ_FETCH_CONCURRENCY];
+	BLOCK_ENTRY_PAGE temppage;
+	int64_t block_index, page_index, cur_page, failed_block;
+	int64_t entry_index;
+	off_t page_fpos;
+	int32_t count, num_jobs, ret;
+	uint8_t status;
+
+	if (end_block <= start_block)
+		return -1;
+	/* Let _read_block wait for cache space */
+	if ((hcfs_system->sync_paused == TRUE) ||
+	    (hcfs_system->systemdata.cache_size > CACHE_LIMITS(pin_s)))
+		return -1;
+
+	fh_ptr->meta_cache_ptr = meta_cache_lock_entry(fh_ptr->thisinode);
+	if (fh_ptr->meta_cache_ptr == NULL)
+		return -1;
+	fh_ptr->meta_cache_locked = TRUE;
+
+	num_jobs = 0;
+	cur_page = -1;
+	page_fpos = 0;
+	for (block_index = start_block; (block_index <= end_block) &&
+	     (num_jobs < MAX_READ_FETCH_CONCURRENCY); block_index++) {
+		page_index = block_index / MAX_BLOCK_ENTRIES_PER_PAGE;
+		if (page_index != cur_page) {
+			cur_page = page_index;
+			page_fpos = seek_page(fh_ptr->meta_cache_ptr,
+					page_index, 0);
+			if (page_fpos > 0) {
+				ret = meta_cache_lookup_file_data(
+					fh_ptr->thisinode, NULL, NULL,
+					&temppage, page_fpos,
+					fh_ptr->meta_cache_ptr);
+				if (ret < 0)
+					break;
+			}
+		}
+		/* Blocks of a missing page are holes */
+		if (page_fpos <= 0)
+			continue;
+
+		entry_index = block_index % MAX_BLOCK_ENTRIES_PER_PAGE;
+		status = temppage.block_entries[entry_index].status;
+		if ((status != ST_CLOUD) && (status != ST_CtoL))
+			continue;
+
+		jobs[num_jobs].this_inode = fh_ptr->thisinode;
+		jobs[num_jobs].block_index = block_index;
+		jobs[num_jobs].page_fpos = page_fpos;
+		jobs[num_jobs].entry_index = entry_index;
+		jobs[num_jobs].ret = 0;
+		jobs[num_jobs].queued = FALSE;
+		num_jobs++;
+	}
+	fh_ptr->meta_cache_locked = FALSE;
+	meta_cache_unlock_entry(fh_ptr->meta_cache_ptr);
+
+	/* A single fetch is left to _read_block */
+	if (num_jobs < 2)
+		return -1;
+
+	write_log(10, "Debug read: fetching %d blocks of inode %" PRIu64
+		  " at once\n", num_jobs, (uint64_t)fh_ptr->thisinode);
+
+	/* The first block is fetched by this thread */
+	for (count = 1; count < num_jobs; count++) {
+		jobs[count].waiter.fetch_fn = &_read_fetch_job;
+		jobs[count].waiter.arg = (void *)&(jobs[count]);
+		sem_init(&(jobs[count].waiter.done), 0, 0);
+		ret = enqueue_waited_fetch(jobs[count].this_inode,
+				jobs[count].block_index, &(jobs[count].waiter));
+		if (ret == 0)
+			jobs[count].queued = TRUE;
+		else if (ret != -EBUSY)
+			write_log(4, "Warn: Fail to queue fetch of block %"
+				  PRId64 ". Code %d\n",
+				  jobs[count].block_index, -ret);
+	}
+	_read_fetch_job((void *)&(jobs[0]));
+	for (count = 1; count < num_jobs; count++) {
+		if (jobs[count].queued == TRUE) {
+			sem_wait(&(jobs[count].waiter.done));
+			jobs[count].ret = jobs[count].waiter.ret;
+		} else {
+			_read_fetch_job((void *)&(jobs[count]));
+		}
+		sem_destroy(&(jobs[count].waiter.done));
+	}
+
+	failed_block = -1;
+	for (count = 0; count < num_jobs; count++) {
+		if (jobs[count].ret < 0) {
+			failed_block = jobs[count].block_index;
+			*reterr = jobs[count].ret;
+			break;
+		}
+	}
+	return failed_block;
+}
+
 /* Function for reading from a single block for read operation. Will fetch
 *  block from backend if needed. */
 size_t _read_block(char *buf, size_t size, int64_t bindex, off_t offset,
@@ -4321,27 +4541,21 @@ size_t _read_block(char *buf, size_t size, int64_t bindex, off_t offset,
 		write_log(10, "Debug opened block %" PRIu64 ", bindex %" PRIu64
 			      "\n",
 			  fh_ptr->opened_block, bindex);
-		if (fh_ptr->opened_block == bindex) {
-			fclose(fh_ptr->blockfptr);
-			fh_ptr->opened_block = -1;
-		}
+		if (fh_ptr->opened_block == bindex)
+			_close_opened_block(fh_ptr);
 		break;
 	default:
 		/* Close the cached file if paged out previously */
 		if (((temppage).block_entries[entry_index].paged_out_count !=
 		     fh_ptr->cached_paged_out_count) &&
-		    (fh_ptr->opened_block != -1)) {
-			fclose(fh_ptr->blockfptr);
-			fh_ptr->opened_block = -1;
-		}
+		    (fh_ptr->opened_block != -1))
+			_close_opened_block(fh_ptr);
 		break;
 	}
 
 	while (fh_ptr->opened_block != bindex) {
-		if (fh_ptr->opened_block != -1) {
-			fclose(fh_ptr->blockfptr);
-			fh_ptr->opened_block = -1;
-		}
+		if (fh_ptr->opened_block != -1)
+			_close_opened_block(fh_ptr);
 
 		ret = read_wait_full_cache(&temppage, entry_index, fh_ptr,
 			this_page_fpos, pin_s);
@@ -4352,10 +4566,14 @@ size_t _read_block(char *buf, size_t size, int64_t bindex, off_t offset,
 		}
 
 		/* return -EIO when failing to fetching from cloud */
-		ret = read_prefetch_cache(&temppage, entry_index,
-			this_inode, bindex, this_page_fpos);
-		if (ret < 0)
-			write_log(5, "Fail to prefetch block. Code %d\n", -ret);
+		if (bindex != fh_ptr->last_read_block) {
+			ret = read_prefetch_cache(fh_ptr, &temppage,
+				entry_index, this_inode, bindex,
+				this_page_fpos);
+			if ((ret < 0) && (ret != -ENOSPC))
+				write_log(5, "Fail to prefetch block. Code %d\n",
+					  -ret);
+		}
 
 		switch ((temppage).block_entries[entry_index].status) {
 		case ST_NONE:
@@ -4396,11 +4614,9 @@ size_t _read_block(char *buf, size_t size, int64_t bindex, off_t offset,
 				return 0;
 			}
 
-			fh_ptr->blockfptr = fopen(thisblockpath, "r+");
-			if (fh_ptr->blockfptr != NULL) {
-				setbuf(fh_ptr->blockfptr, NULL);
-				fh_ptr->opened_block = bindex;
-
+			ret = _open_cached_block(fh_ptr, this_inode, bindex,
+					thisblockpath);
+			if (ret == 0) {
 				BLOCK_ENTRY *tptr;
 				tptr = &(temppage.block_entries[entry_index]);
 				fh_ptr->cached_paged_out_count =
@@ -4426,9 +4642,9 @@ size_t _read_block(char *buf, size_t size, int64_t bindex, off_t offset,
 	}
 
 	if (fill_zeros != TRUE) {
-		ret = flock(fileno(fh_ptr->blockfptr), LOCK_SH);
+		ret = lock_block_fd(fh_ptr->block_fd, LOCK_SH);
 		if (ret < 0) {
-			errnum = errno;
+			errnum = -ret;
 			write_log(0, "Error in read. Code %d, %s\n", errnum,
 					strerror(errnum));
 			sem_post(&(fh_ptr->block_sem));
@@ -4449,7 +4665,7 @@ size_t _read_block(char *buf, size_t size, int64_t bindex, off_t offset,
 			this_bytes_read = size;
 		}
 
-		flock(fileno(fh_ptr->blockfptr), LOCK_UN);
+		unlock_block_fd(fh_ptr->block_fd, LOCK_SH);
 
 	} else {
 		write_log(5, "Padding zeros? %ld %ld\n", offset, size);
@@ -4467,6 +4683,206 @@ errcode_handle:
 	return 0;
 }
 
+/* Helper function for read operation. Update the access time of the file
+*  after reading. */
+static int32_t _read_update_atime(FH_ENTRY *fh_ptr)
+{
+	HCFS_STAT temp_stat;
+	int32_t ret;
+
+	fh_ptr->meta_cache_ptr = meta_cache_lock_entry(fh_ptr->thisinode);
+	if (fh_ptr->meta_cache_ptr == NULL)
+		return -errno;
+
+	fh_ptr->meta_cache_locked = TRUE;
+
+	/*Update and flush file meta*/
+
+	ret = meta_cache_lookup_file_data(fh_ptr->thisinode,
+		&temp_stat, NULL, NULL, 0, fh_ptr->meta_cache_ptr);
+	if (ret < 0) {
+		fh_ptr->meta_cache_locked = FALSE;
+		meta_cache_close_file(fh_ptr->meta_cache_ptr);
+		meta_cache_unlock_entry(fh_ptr->meta_cache_ptr);
+		return ret;
+	}
+
+	set_timestamp_now(&temp_stat, A_TIME);
+
+	/* Write changes to disk but do not sync to backend */
+	ret = meta_cache_update_stat_nosync(
+	    fh_ptr->thisinode, &temp_stat, fh_ptr->meta_cache_ptr);
+	if (ret < 0) {
+		fh_ptr->meta_cache_locked = FALSE;
+		meta_cache_close_file(fh_ptr->meta_cache_ptr);
+		meta_cache_unlock_entry(fh_ptr->meta_cache_ptr);
+		return ret;
+	}
+
+	fh_ptr->meta_cache_locked = FALSE;
+	meta_cache_unlock_entry(fh_ptr->meta_cache_ptr);
+	return 0;
+}
+
+/* Helper function for read operation. Check that all blocks of a read are
+*  in the local cache, and queue prefetching as _read_block would do.
+*  Returns 0 if all blocks are local, 1 if not, or negation of error code. */
+static int32_t _read_check_local_blocks(FH_ENTRY *fh_ptr,
+		int64_t start_block, int64_t end_block)
+{
+	BLOCK_ENTRY_PAGE temppage;
+	int64_t block_index, page_index, cur_page, entry_index;
+	off_t page_fpos;
+	int32_t ret;
+	uint8_t status;
+
+	sem_wait(&(fh_ptr->block_sem));
+	fh_ptr->meta_cache_ptr = meta_cache_lock_entry(fh_ptr->thisinode);
+	if (fh_ptr->meta_cache_ptr == NULL) {
+		ret = -errno;
+		sem_post(&(fh_ptr->block_sem));
+		return ret;
+	}
+	fh_ptr->meta_cache_locked = TRUE;
+
+	ret = 0;
+	cur_page = -1;
+	for (block_index = start_block; block_index <= end_block;
+	     block_index++) {
+		page_index = block_index / MAX_BLOCK_ENTRIES_PER_PAGE;
+		if (page_index != cur_page) {
+			cur_page = page_index;
+			page_fpos = seek_page(fh_ptr->meta_cache_ptr,
+					page_index, 0);
+			if (page_fpos <= 0) {
+				ret = (page_fpos < 0) ? (int32_t)page_fpos : 1;
+				break;
+			}
+			ret = meta_cache_lookup_file_data(fh_ptr->thisinode,
+				NULL, NULL, &temppage, page_fpos,
+				fh_ptr->meta_cache_ptr);
+			if (ret < 0)
+				break;
+		}
+
+		entry_index = block_index % MAX_BLOCK_ENTRIES_PER_PAGE;
+		status = temppage.block_entries[entry_index].status;
+		if ((status != ST_LDISK) && (status != ST_BOTH) &&
+		    (status != ST_LtoC)) {
+			ret = 1;
+			break;
+		}
+
+		if (block_index != fh_ptr->last_read_block) {
+			ret = read_prefetch_cache(fh_ptr, &temppage,
+				entry_index, fh_ptr->thisinode, block_index,
+				page_fpos);
+			if ((ret < 0) && (ret != -ENOSPC))
+				write_log(5, "Fail to prefetch block. Code %d\n",
+					  -ret);
+			ret = 0;
+		}
+	}
+
+	fh_ptr->meta_cache_locked = FALSE;
+	if (ret < 0)
+		meta_cache_close_file(fh_ptr->meta_cache_ptr);
+	meta_cache_unlock_entry(fh_ptr->meta_cache_ptr);
+	sem_post(&(fh_ptr->block_sem));
+	return ret;
+}
+
+/* Helper function for read operation. Reply a read of blocks that are all
+*  in the local cache with the block files themselves, so that libfuse can
+*  splice the data to the kernel without copying it to a buffer of ours.
+*  Returns 0 if the request is replied, or a negative value if the read
+*  should go through _read_block instead. */
+static int32_t _read_reply_from_blocks(fuse_req_t req, FH_ENTRY *fh_ptr,
+		size_t size, off_t offset, int64_t start_block,
+		int64_t end_block)
+{
+	struct {
+		struct fuse_bufvec bufv;
+		struct fuse_buf more_bufs[MAX_SPLICE_READ_BLOCKS - 1];
+	} read_vec;
+	BLOCK_FD_ENTRY *block_fds[MAX_SPLICE_READ_BLOCKS];
+	char thisblockpath[400];
+	struct stat blockstat; /* block ops */
+	struct fuse_buf *this_buf;
+	int64_t block_index;
+	int32_t count, num_blocks, num_locked, ret, reply_ret;
+	size_t total_size, this_size;
+	off_t this_offset;
+
+	num_blocks = (int32_t)(end_block - start_block + 1);
+	if (num_blocks > MAX_SPLICE_READ_BLOCKS)
+		return -EINVAL;
+
+	ret = _read_check_local_blocks(fh_ptr, start_block, end_block);
+	if (ret != 0)
+		return (ret < 0) ? ret : -EAGAIN;
+
+	memset(&read_vec, 0, sizeof(read_vec));
+	read_vec.bufv.count = num_blocks;
+	num_locked = 0;
+	total_size = 0;
+	ret = 0;
+	for (count = 0; count < num_blocks; count++) {
+		block_index = start_block + count;
+		this_offset = (offset + (off_t)total_size) % MAX_BLOCK_SIZE;
+		this_size = MAX_BLOCK_SIZE - this_offset;
+		if (size - total_size < this_size)
+			this_size = size - total_size;
+
+		/* Block might be paged out after the status check */
+		ret = fetch_block_path(thisblockpath, fh_ptr->thisinode,
+				block_index);
+		if (ret < 0)
+			break;
+		block_fds[count] = get_block_fd(fh_ptr->thisinode,
+				block_index, thisblockpath);
+		if (block_fds[count] == NULL) {
+			ret = -errno;
+			break;
+		}
+		ret = lock_block_fd(block_fds[count], LOCK_SH);
+		if (ret < 0) {
+			put_block_fd(block_fds[count]);
+			break;
+		}
+		num_locked++;
+
+		/* Short block files need zero padding */
+		if ((fstat(fileno(block_fds[count]->fptr), &blockstat) < 0) ||
+		    (blockstat.st_size < this_offset + (off_t)this_size)) {
+			ret = -EAGAIN;
+			break;
+		}
+
+		this_buf = &(read_vec.bufv.buf[count]);
+		this_buf->size = this_size;
+		this_buf->flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+		this_buf->fd = fileno(block_fds[count]->fptr);
+		this_buf->pos = this_offset;
+		total_size += this_size;
+	}
+
+	/* The request is done even if the reply fails */
+	if (ret == 0) {
+		reply_ret = fuse_reply_data(req, &(read_vec.bufv), 0);
+		if (reply_ret < 0)
+			write_log(0, "Error: Fail to reply read of inode %"
+				  PRIu64 ". Code %d\n",
+				  (uint64_t)fh_ptr->thisinode, -reply_ret);
+	}
+
+	for (count = 0; count < num_locked; count++) {
+		unlock_block_fd(block_fds[count], LOCK_SH);
+		put_block_fd(block_fds[count]);
+	}
+	return ret;
+}
+
 /************************************************************************
 *
 * Function name: hfuse_ll_read
@@ -4475,6 +4891,10 @@ errcode_handle:
 *       Summary: Read "size_org" bytes from the file "ino", starting from
 *                "offset". Returned data is sent via fuse_reply_buf.
 *                File handle is provided by the structure in "file_info".
+*                Reads of cached blocks are replied with the block files,
+*                so that data can be spliced to the kernel. Cloud blocks
+*                spanned by the read are fetched at once, and data before
+*                a failed block is returned as a short read.
 *
 *************************************************************************/
 void hfuse_ll_read(fuse_req_t req, fuse_ino_t ino,
@@ -4491,7 +4911,8 @@ void hfuse_ll_read(fuse_req_t req, fuse_ino_t ino,
 	size_t size;
 	char *buf;
 	char noatime;
-	int32_t ret, errcode;
+	int32_t ret, errcode, fetch_err;
+	int64_t failed_block;
 	ino_t thisinode;
 
 	thisinode = real_ino(req, ino);
@@ -4524,6 +4945,13 @@ void hfuse_ll_read(fuse_req_t req, fuse_ino_t ino,
 	else
 		noatime = FALSE;
 
+	/* Read what was written through any handle of the file */
+	ret = write_buffer_flush_inode(fh_ptr->thisinode);
+	if (ret < 0) {
+		fuse_reply_err(req, -ret);
+		return;
+	}
+
 	fh_ptr->meta_cache_ptr = meta_cache_lock_entry(fh_ptr->thisinode);
 	if (fh_ptr->meta_cache_ptr == NULL) {
 		fuse_reply_err(req, errno);
@@ -4573,6 +5001,23 @@ void hfuse_ll_read(fuse_req_t req, fuse_ino_t ino,
 
 	fh_ptr->meta_cache_locked = FALSE;
 	meta_cache_unlock_entry(fh_ptr->meta_cache_ptr);
+
+	/* Cached blocks are sent without copying them to a buffer */
+	if (_read_reply_from_blocks(req, fh_ptr, size, offset, start_block,
+				    end_block) == 0) {
+		cache_usage_index_touch(fh_ptr->thisinode, FALSE);
+		cache_policy_access(fh_ptr->thisinode, start_block,
+				    end_block, FALSE);
+		if (noatime == FALSE) {
+			ret = _read_update_atime(fh_ptr);
+			if (ret < 0)
+				write_log(4, "Warn: Fail to update atime of %"
+					  PRIu64 ". Code %d\n",
+					  (uint64_t)fh_ptr->thisinode, -ret);
+		}
+		return;
+	}
+
 	buf = malloc(sizeof(char)*size);
 
 	if (buf == NULL) {
@@ -4580,6 +5025,11 @@ void hfuse_ll_read(fuse_req_t req, fuse_ino_t ino,
 		return;
 	}
 
+	/* Fetch cloud blocks of the read at once */
+	fetch_err = 0;
+	failed_block = _read_fetch_blocks(fh_ptr, start_block, end_block,
+			pin_s, &fetch_err);
+
 	/* Read data from each block involved */
 	for (block_index = start_block; block_index <= end_block;
 				block_index++) {
@@ -4590,10 +5040,23 @@ void hfuse_ll_read(fuse_req_t req, fuse_ino_t ino,
 		if (((off_t)size - total_bytes_read) < target_bytes_read)
 			target_bytes_read = (off_t)size - total_bytes_read;
 
-		this_bytes_read = _read_block(&buf[total_bytes_read],
+		if (block_index == failed_block) {
+			this_bytes_read = 0;
+			errcode = fetch_err;
+		} else {
+			this_bytes_read = _read_block(&buf[total_bytes_read],
 				target_bytes_read, block_index, current_offset,
 				fh_ptr, fh_ptr->thisinode, &errcode, pin_s);
+		}
 		if ((this_bytes_read == 0) && (errcode < 0)) {
+			/* Return what was read before the failed block */
+			if (total_bytes_read > 0) {
+				write_log(4, "Warn: Short read of inode %"
+					  PRIu64 ". Code %d\n",
+					  (uint64_t)fh_ptr->thisinode,
+					  -errcode);
+				break;
+			}
 			fuse_reply_err(req, -errcode);
 			free(buf);
 			return;
@@ -4606,46 +5069,19 @@ void hfuse_ll_read(fuse_req_t req, fuse_ino_t ino,
 			break;
 	}
 
+	if (total_bytes_read > 0) {
+		cache_usage_index_touch(fh_ptr->thisinode, FALSE);
+		cache_policy_access(fh_ptr->thisinode, start_block,
+				    (offset + total_bytes_read - 1) /
+				    MAX_BLOCK_SIZE, FALSE);
+	}
 	if ((total_bytes_read > 0) && (noatime == FALSE)) {
-		fh_ptr->meta_cache_ptr =
-				meta_cache_lock_entry(fh_ptr->thisinode);
-		if (fh_ptr->meta_cache_ptr == NULL) {
-			fuse_reply_err(req, errno);
-			free(buf);
-			return;
-		}
-
-		fh_ptr->meta_cache_locked = TRUE;
-
-		/*Update and flush file meta*/
-
-		ret = meta_cache_lookup_file_data(fh_ptr->thisinode,
-			&temp_stat, NULL, NULL, 0, fh_ptr->meta_cache_ptr);
-		if (ret < 0) {
-			fh_ptr->meta_cache_locked = FALSE;
-			meta_cache_close_file(fh_ptr->meta_cache_ptr);
-			meta_cache_unlock_entry(fh_ptr->meta_cache_ptr);
-			fuse_reply_err(req, -ret);
-			free(buf);
-			return;
-		}
-
-		set_timestamp_now(&temp_stat, A_TIME);
-
-		/* Write changes to disk but do not sync to backend */
-		ret = meta_cache_update_stat_nosync(
-		    fh_ptr->thisinode, &temp_stat, fh_ptr->meta_cache_ptr);
+		ret = _read_update_atime(fh_ptr);
 		if (ret < 0) {
-			fh_ptr->meta_cache_locked = FALSE;
-			meta_cache_close_file(fh_ptr->meta_cache_ptr);
-			meta_cache_unlock_entry(fh_ptr->meta_cache_ptr);
 			fuse_reply_err(req, -ret);
 			free(buf);
 			return;
 		}
-
-		fh_ptr->meta_cache_locked = FALSE;
-		meta_cache_unlock_entry(fh_ptr->meta_cache_ptr);
 	}
 	fuse_reply_buf(req, buf, total_bytes_read);
 	free(buf);
@@ -4729,6 +5165,10 @@ int32_t _write_fetch_backend(ino_t this_inode, int64_t bindex, FH_ENTRY *fh_ptr,
 	if (ret < 0)
 		return ret;
 
+	/* The block file may have been paged out by another process, so
+	 * drop the cached descriptor before the block file is recreated */
+	invalidate_block_fd(this_inode, bindex);
+
 	fh_ptr->blockfptr = fopen(thisblockpath, "a+");
 	if (fh_ptr->blockfptr == NULL) {
 		errcode = errno;
@@ -4983,10 +5423,8 @@ size_t _write_block(const char *buf, size_t size, int64_t bindex,
 		if ((tmpdiff > 0) &&
 			((tmpdiff + tmpcachesize) > max_cache_size)) {
 			/* Need to sleep for full here or return ENOSPC */
-			if (fh_ptr->opened_block != -1) {
-				fclose(fh_ptr->blockfptr);
-				fh_ptr->opened_block = -1;
-			}
+			if (fh_ptr->opened_block != -1)
+				_close_opened_block(fh_ptr);
 			if (CURRENT_BACKEND == NONE ||
 			    hcfs_system->system_restoring == RESTORING_STAGE1) {
 				*reterr = -ENOSPC;
@@ -5033,19 +5471,15 @@ size_t _write_block(const char *buf, size_t size, int64_t bindex,
 	case ST_TODELETE:
 	case ST_CLOUD:
 	case ST_CtoL:
-		if (fh_ptr->opened_block == bindex) {
-			fclose(fh_ptr->blockfptr);
-			fh_ptr->opened_block = -1;
-		}
+		if (fh_ptr->opened_block == bindex)
+			_close_opened_block(fh_ptr);
 		break;
 	default:
 		/* Close the cached file if paged out previously */
 		if (((temppage).block_entries[entry_index].paged_out_count !=
 		     fh_ptr->cached_paged_out_count) &&
-		    (fh_ptr->opened_block != -1)) {
-			fclose(fh_ptr->blockfptr);
-			fh_ptr->opened_block = -1;
-		}
+		    (fh_ptr->opened_block != -1))
+			_close_opened_block(fh_ptr);
 		break;
 	}
 
@@ -5055,10 +5489,8 @@ size_t _write_block(const char *buf, size_t size, int64_t bindex,
 		int64_t seq;
 		/* If the cached block is not the one we are writing to,
 		*  close the one already opened. */
-		if (fh_ptr->opened_block != -1) {
-			fclose(fh_ptr->blockfptr);
-			fh_ptr->opened_block = -1;
-		}
+		if (fh_ptr->opened_block != -1)
+			_close_opened_block(fh_ptr);
 
 		ret = write_wait_full_cache(&temppage, entry_index, fh_ptr,
 					    this_page_fpos, pin);
@@ -5181,16 +5613,14 @@ size_t _write_block(const char *buf, size_t size, int64_t bindex,
 			break;
 		}
 
-		fh_ptr->blockfptr = fopen(thisblockpath, "r+");
-		if (fh_ptr->blockfptr == NULL) {
-			errnum = errno;
+		ret = _open_cached_block(fh_ptr, this_inode, bindex,
+				thisblockpath);
+		if (ret < 0) {
 			*reterr = -EIO;
 			write_log(0, "Error in write. Code %d, %s\n",
-				errnum, strerror(errnum));
+				-ret, strerror(-ret));
 			return 0;
 		}
-		setbuf(fh_ptr->blockfptr, NULL);
-		fh_ptr->opened_block = bindex;
 		fh_ptr->cached_paged_out_count =
 			(temppage).block_entries[entry_index].paged_out_count;
 	} else {
@@ -5256,9 +5686,9 @@ size_t _write_block(const char *buf, size_t size, int64_t bindex,
 		}
 	}
 
-	ret = flock(fileno(fh_ptr->blockfptr), LOCK_EX);
+	ret = lock_block_fd(fh_ptr->block_fd, LOCK_EX);
 	if (ret < 0) {
-		errnum = errno;
+		errnum = -ret;
 		*reterr = -EIO;
 		write_log(0, "Error in write. Code %d, %s\n",
 			errnum, strerror(errnum));
@@ -5312,30 +5742,24 @@ size_t _write_block(const char *buf, size_t size, int64_t bindex,
 		goto errcode_handle;
 	}
 
-	flock(fileno(fh_ptr->blockfptr), LOCK_UN);
+	unlock_block_fd(fh_ptr->block_fd, LOCK_EX);
 
 	return this_bytes_written;
 
 errcode_handle:
-	flock(fileno(fh_ptr->blockfptr), LOCK_UN);
+	unlock_block_fd(fh_ptr->block_fd, LOCK_EX);
 	*reterr = errcode;
 	return 0;
 }
 
-/************************************************************************
-*
-* Function name: hfuse_ll_write
-*        Inputs: fuse_req_t req, fuse_ino_t ino, const char *buf,
-*                size_t size, off_t offset, struct fuse_file_info *file_info
-*       Summary: Write "size" bytes to the file "ino", starting from
-*                "offset", from the buffer pointed by "buf". File handle
-*                is provided by the structure in "file_info".
-*
-*************************************************************************/
-void hfuse_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
-		size_t size, off_t offset, struct fuse_file_info *file_info)
+/* Helper function for write operation. Write "size" bytes to the file of
+*  "fh_ptr" starting from "offset", and update the file size and the
+*  system and mount statistics once for the whole write. Caller must hold
+*  block_sem of "fh_ptr". Returns the number of bytes written, or
+*  negation of error code. */
+static int64_t _write_to_file(MOUNT_T *tmpptr, FH_ENTRY *fh_ptr,
+		const char *buf, size_t size, off_t offset)
 {
-	FH_ENTRY *fh_ptr;
 	int64_t start_block, end_block;
 	int64_t block_index;
 	off_t total_bytes_written;
@@ -5344,8 +5768,6 @@ void hfuse_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
 	size_t target_bytes_written;
 	HCFS_STAT temp_stat;
 	int32_t ret, errcode;
-	ino_t thisinode;
-	MOUNT_T *tmpptr;
 	FILE_META_TYPE thisfilemeta;
 	int64_t pin_sizediff, amount_preallocated;
 	int64_t old_metasize, new_metasize, delta_meta_size;
@@ -5354,43 +5776,6 @@ void hfuse_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
 	int64_t max_pinned_size;
 	long avail_space, avail_space1, avail_space2;
 
-	write_log(10, "Debug write: size %zu, offset %lld\n", size, offset);
-
-	tmpptr = (MOUNT_T *) fuse_req_userdata(req);
-
-	thisinode = real_ino(req, ino);
-
-	/* If size after writing is greater than max file size,
-	return -EFBIG */
-	if (size > (size_t) MAX_FILE_SIZE) {
-		fuse_reply_err(req, EFBIG);
-		return;
-	}
-
-	if (offset > (off_t) (MAX_FILE_SIZE - size)) {
-		fuse_reply_err(req, EFBIG);
-		return;
-	}
-
-	if (offset < 0) {
-		fuse_reply_err(req, EINVAL);
-		return;
-	}
-
-	if (system_fh_table.entry_table_flags[file_info->fh] != IS_FH) {
-		fuse_reply_err(req, EBADF);
-		return;
-	}
-
-	if (size <= 0) {
-		fuse_reply_write(req, 0);
-		return;
-	}
-
-	/*Sleep if cache already full (don't do this now)*/
-/*	if (hcfs_system->systemdata.cache_size > CACHE_HARD_LIMIT)
-		sleep_on_cache_full();
-*/
 	total_bytes_written = 0;
 
 	/* Decide the block indices for the first byte and last byte of
@@ -5399,28 +5784,11 @@ void hfuse_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
 	start_block = (offset / MAX_BLOCK_SIZE);
 	end_block = ((offset + ((off_t)size) - 1) / MAX_BLOCK_SIZE);
 
-	fh_ptr = &(system_fh_table.entry_table[file_info->fh]);
-
-	/* Check if ino passed in is the same as the one stored */
-
-	if (fh_ptr->thisinode != (ino_t) thisinode) {
-		fuse_reply_err(req, EBADFD);
-		return;
-	}
-
-	write_log(10, "flags %d\n", fh_ptr->flags & O_ACCMODE);
-	if ((!((fh_ptr->flags & O_ACCMODE) == O_WRONLY)) &&
-			(!((fh_ptr->flags & O_ACCMODE) == O_RDWR))) {
-		fuse_reply_err(req, EBADF);
-		return;
-	}
-
-	sem_wait(&(fh_ptr->block_sem));
 	fh_ptr->meta_cache_ptr = meta_cache_lock_entry(fh_ptr->thisinode);
 	if (fh_ptr->meta_cache_ptr == NULL) {
-		test_and_notify_no_space(errno);
-		fuse_reply_err(req, errno);
-		return;
+		errcode = -errno;
+		test_and_notify_no_space(-errcode);
+		return errcode;
 	}
 	fh_ptr->meta_cache_locked = TRUE;
 
@@ -5434,10 +5802,8 @@ void hfuse_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
 		fh_ptr->meta_cache_locked = FALSE;
 		meta_cache_close_file(fh_ptr->meta_cache_ptr);
 		meta_cache_unlock_entry(fh_ptr->meta_cache_ptr);
-		sem_post(&(fh_ptr->block_sem));
 		test_and_notify_no_space(-ret);
-		fuse_reply_err(req, -ret);
-		return;
+		return ret;
 	}
 
 	/* If the file is pinned, need to change the pinned_size
@@ -5448,10 +5814,8 @@ void hfuse_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
 		fh_ptr->meta_cache_locked = FALSE;
 		meta_cache_close_file(fh_ptr->meta_cache_ptr);
 		meta_cache_unlock_entry(fh_ptr->meta_cache_ptr);
-		sem_post(&(fh_ptr->block_sem));
 		test_and_notify_no_space(-ret);
-		fuse_reply_err(req, -ret);
-		return;
+		return ret;
 	}
 
 	/* Remember now sequence number */
@@ -5463,9 +5827,7 @@ void hfuse_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
 		fh_ptr->meta_cache_locked = FALSE;
 		meta_cache_close_file(fh_ptr->meta_cache_ptr);
 		meta_cache_unlock_entry(fh_ptr->meta_cache_ptr);
-		sem_post(&(fh_ptr->block_sem));
-		fuse_reply_err(req, EIO);
-		return;
+		return -EIO;
 	}
 
 	write_log(10, "Debug: system size: %lld, system quota %lld",
@@ -5490,10 +5852,8 @@ void hfuse_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
 			fh_ptr->meta_cache_locked = FALSE;
 			meta_cache_close_file(fh_ptr->meta_cache_ptr);
 			meta_cache_unlock_entry(fh_ptr->meta_cache_ptr);
-			sem_post(&(fh_ptr->block_sem));
 			notify_avail_space(0);
-			fuse_reply_err(req, ENOSPC);
-			return;
+			return -ENOSPC;
 		}
 
 		hcfs_system->systemdata.pinned_size += pin_sizediff;
@@ -5586,10 +5946,8 @@ void hfuse_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
 			fh_ptr->meta_cache_locked = FALSE;
 			meta_cache_close_file(fh_ptr->meta_cache_ptr);
 			meta_cache_unlock_entry(fh_ptr->meta_cache_ptr);
-			sem_post(&(fh_ptr->block_sem));
 			test_and_notify_no_space(-ret);
-			fuse_reply_err(req, -ret);
-			return;
+			return ret;
 		}
 
 		temp_stat.size = (offset + total_bytes_written);
@@ -5603,10 +5961,8 @@ void hfuse_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
 				fh_ptr->meta_cache_locked = FALSE;
 				meta_cache_close_file(fh_ptr->meta_cache_ptr);
 				meta_cache_unlock_entry(fh_ptr->meta_cache_ptr);
-				sem_post(&(fh_ptr->block_sem));
 				test_and_notify_no_space(-ret);
-				fuse_reply_err(req, -ret);
-				return;
+				return ret;
 			}
 		}
 	}
@@ -5620,39 +5976,160 @@ void hfuse_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
 		fh_ptr->meta_cache_locked = FALSE;
 		meta_cache_close_file(fh_ptr->meta_cache_ptr);
 		meta_cache_unlock_entry(fh_ptr->meta_cache_ptr);
-		sem_post(&(fh_ptr->block_sem));
 		test_and_notify_no_space(-ret);
-		fuse_reply_err(req, -ret);
+		return ret;
+	}
+
+	fh_ptr->meta_cache_locked = FALSE;
+	meta_cache_unlock_entry(fh_ptr->meta_cache_ptr);
+
+	avail_space1 = max_pinned_size - hcfs_system->systemdata.pinned_size;
+	avail_space2 =
+	    hcfs_system->systemdata.system_quota -
+	    hcfs_system->systemdata.system_size;
+	avail_space = avail_space1 < avail_space2 ? avail_space1 : avail_space2;
+	notify_avail_space(avail_space - WRITEBACK_CACHE_RESERVE_SPACE);
+
+	if (total_bytes_written > 0) {
+		cache_usage_index_touch(fh_ptr->thisinode, TRUE);
+		cache_policy_access(fh_ptr->thisinode, start_block,
+				    (offset + total_bytes_written - 1) /
+				    MAX_BLOCK_SIZE, TRUE);
+	}
+	return total_bytes_written;
+errcode_handle:
+	/* If op failed and size won't be extended, revert the preallocated
+	pinned space */
+	if (amount_preallocated > 0) {
+		sem_wait(&(hcfs_system->access_sem));
+		hcfs_system->systemdata.pinned_size -= amount_preallocated;
+		if (hcfs_system->systemdata.pinned_size < 0)
+			hcfs_system->systemdata.pinned_size = 0;
+		sem_post(&(hcfs_system->access_sem));
+	}
+
+	test_and_notify_no_space(-errcode);
+	return errcode;
+}
+
+/************************************************************************
+*
+* Function name: write_buffered_data
+*        Inputs: MOUNT_T *mptr, ino_t this_inode, const char *buf,
+*                size_t size, off_t offset
+*       Summary: Write out data collected by the write buffer of
+*                "this_inode". The file handle that wrote the data might
+*                be in use or closed, so a temporary handle is used.
+*  Return value: Number of bytes written, or negation of error code.
+*
+*************************************************************************/
+int64_t write_buffered_data(MOUNT_T *mptr, ino_t this_inode,
+			    const char *buf, size_t size, off_t offset)
+{
+	FH_ENTRY tmp_fh;
+	int64_t ret;
+
+	memset(&tmp_fh, 0, sizeof(FH_ENTRY));
+	tmp_fh.thisinode = this_inode;
+	tmp_fh.flags = O_WRONLY;
+	tmp_fh.opened_block = -1;
+	tmp_fh.cached_page_index = -1;
+	tmp_fh.cached_filepos = -1;
+	sem_init(&(tmp_fh.block_sem), 0, 1);
+
+	sem_wait(&(tmp_fh.block_sem));
+	ret = _write_to_file(mptr, &tmp_fh, buf, size, offset);
+	if (tmp_fh.opened_block != -1)
+		_close_opened_block(&tmp_fh);
+	sem_post(&(tmp_fh.block_sem));
+	sem_destroy(&(tmp_fh.block_sem));
+
+	return ret;
+}
+
+/************************************************************************
+*
+* Function name: hfuse_ll_write
+*        Inputs: fuse_req_t req, fuse_ino_t ino, const char *buf,
+*                size_t size, off_t offset, struct fuse_file_info *file_info
+*       Summary: Write "size" bytes to the file "ino", starting from
+*                "offset", from the buffer pointed by "buf". File handle
+*                is provided by the structure in "file_info". Small
+*                sequential writes are collected in the write buffer of
+*                the file and written out later.
+*
+*************************************************************************/
+void hfuse_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
+		size_t size, off_t offset, struct fuse_file_info *file_info)
+{
+	FH_ENTRY *fh_ptr;
+	int64_t ret_size;
+	ino_t thisinode;
+	MOUNT_T *tmpptr;
+
+	write_log(10, "Debug write: size %zu, offset %lld\n", size, offset);
+
+	tmpptr = (MOUNT_T *) fuse_req_userdata(req);
+
+	thisinode = real_ino(req, ino);
+
+	/* If size after writing is greater than max file size,
+	return -EFBIG */
+	if (size > (size_t) MAX_FILE_SIZE) {
+		fuse_reply_err(req, EFBIG);
+		return;
+	}
+
+	if (offset > (off_t) (MAX_FILE_SIZE - size)) {
+		fuse_reply_err(req, EFBIG);
+		return;
+	}
+
+	if (offset < 0) {
+		fuse_reply_err(req, EINVAL);
+		return;
+	}
+
+	if (system_fh_table.entry_table_flags[file_info->fh] != IS_FH) {
+		fuse_reply_err(req, EBADF);
+		return;
+	}
+
+	if (size <= 0) {
+		fuse_reply_write(req, 0);
+		return;
+	}
+
+	fh_ptr = &(system_fh_table.entry_table[file_info->fh]);
+
+	/* Check if ino passed in is the same as the one stored */
+
+	if (fh_ptr->thisinode != (ino_t) thisinode) {
+		fuse_reply_err(req, EBADFD);
 		return;
 	}
 
-	fh_ptr->meta_cache_locked = FALSE;
-	meta_cache_unlock_entry(fh_ptr->meta_cache_ptr);
-	sem_post(&(fh_ptr->block_sem));
-
-	avail_space1 = max_pinned_size - hcfs_system->systemdata.pinned_size;
-	avail_space2 =
-	    hcfs_system->systemdata.system_quota -
-	    hcfs_system->systemdata.system_size;
-	avail_space = avail_space1 < avail_space2 ? avail_space1 : avail_space2;
-	notify_avail_space(avail_space - WRITEBACK_CACHE_RESERVE_SPACE);
-
-	fuse_reply_write(req, total_bytes_written);
-	return;
-errcode_handle:
-	/* If op failed and size won't be extended, revert the preallocated
-	pinned space */
-	if (amount_preallocated > 0) {
-		sem_wait(&(hcfs_system->access_sem));
-		hcfs_system->systemdata.pinned_size -= amount_preallocated;
-		if (hcfs_system->systemdata.pinned_size < 0)
-			hcfs_system->systemdata.pinned_size = 0;
-		sem_post(&(hcfs_system->access_sem));
+	write_log(10, "flags %d\n", fh_ptr->flags & O_ACCMODE);
+	if ((!((fh_ptr->flags & O_ACCMODE) == O_WRONLY)) &&
+			(!((fh_ptr->flags & O_ACCMODE) == O_RDWR))) {
+		fuse_reply_err(req, EBADF);
+		return;
 	}
 
+	sem_wait(&(fh_ptr->block_sem));
+	/* Buffered data of the file is written out before the write if they
+	cannot be merged */
+	ret_size = write_buffer_append(tmpptr, thisinode,
+				       (int64_t) file_info->fh, buf, size, offset);
+	if (ret_size == 0)
+		ret_size = _write_to_file(tmpptr, fh_ptr, buf, size, offset);
 	sem_post(&(fh_ptr->block_sem));
-	test_and_notify_no_space(-errcode);
-	fuse_reply_err(req, -errcode);
+
+	if (ret_size < 0) {
+		fuse_reply_err(req, (int32_t) -ret_size);
+		return;
+	}
+	fuse_reply_write(req, (size_t) ret_size);
 }
 
 /************************************************************************
@@ -5754,20 +6231,21 @@ void hfuse_ll_statfs(fuse_req_t req, fuse_ino_t ino)
 * Function name: hfuse_ll_flush
 *        Inputs: fuse_req_t req, fuse_ino_t ino,
 *                struct fuse_file_info *file_info
-*       Summary: Flush the file content. Not used now as cache mode is not
-*                write back.
+*       Summary: Flush the file content on close. Data buffered by the
+*                write buffer is written out, and errors of earlier
+*                flushes of the handle are reported.
 *
 *************************************************************************/
 void hfuse_ll_flush(fuse_req_t req, fuse_ino_t ino,
 				struct fuse_file_info *file_info)
 {
-	/* ino_t thisinode; */
+	ino_t thisinode;
+	int32_t ret;
 
-	UNUSED(ino);
-	UNUSED(file_info);
-	/* thisinode = */real_ino(req, ino);
+	thisinode = real_ino(req, ino);
 
-	fuse_reply_err(req, 0);
+	ret = write_buffer_flush_fh(thisinode, (int64_t) file_info->fh);
+	fuse_reply_err(req, -ret);
 }
 
 /************************************************************************
@@ -5782,6 +6260,7 @@ void hfuse_ll_release(fuse_req_t req, fuse_ino_t ino,
 			struct fuse_file_info *file_info)
 {
 	ino_t thisinode;
+	int32_t ret;
 
 	thisinode = real_ino(req, ino);
 
@@ -5803,6 +6282,12 @@ void hfuse_ll_release(fuse_req_t req, fuse_ino_t ino,
 		return;
 	}
 
+	/* Errors cannot be reported to the app anymore */
+	ret = write_buffer_flush_fh(thisinode, (int64_t) file_info->fh);
+	if (ret < 0)
+		write_log(0, "Error: Lost buffered writes of inode %" PRIu64
+			  ". Code %d\n", (uint64_t)thisinode, -ret);
+
 	close_fh(file_info->fh);
 	fuse_reply_err(req, 0);
 }
@@ -5812,20 +6297,21 @@ void hfuse_ll_release(fuse_req_t req, fuse_ino_t ino,
 * Function name: hfuse_ll_fsync
 *        Inputs: fuse_req_t req, fuse_ino_t ino, int32_t isdatasync,
 *                struct fuse_file_info *file_info
-*       Summary: Conduct "fsync". Do nothing now (see hfuse_flush).
+*       Summary: Conduct "fsync". Data buffered by the write buffer is
+*                written out to the local cache (see hfuse_ll_flush).
 *
 *************************************************************************/
 void hfuse_ll_fsync(fuse_req_t req, fuse_ino_t ino, int32_t isdatasync,
 					struct fuse_file_info *file_info)
 {
-	/* ino_t thisinode; */
+	ino_t thisinode;
+	int32_t ret;
 
-	UNUSED(ino);
 	UNUSED(isdatasync);
-	UNUSED(file_info);
-	/* thisinode = */real_ino(req, ino);
+	thisinode = real_ino(req, ino);
 
-	fuse_reply_err(req, 0);
+	ret = write_buffer_flush_fh(thisinode, (int64_t) file_info->fh);
+	fuse_reply_err(req, -ret);
 }
 
 /************************************************************************
@@ -5892,126 +6378,106 @@ static void hfuse_ll_opendir(fuse_req_t req, fuse_ino_t ino,
 	fuse_reply_open(req, file_info);
 }
 
+/* Map the d_type of a dir entry to the file type bits of st_mode */
+static mode_t _dtype_to_mode(char d_type)
+{
+	switch (d_type) {
+	case D_ISREG:
+		return S_IFREG;
+	case D_ISDIR:
+		return S_IFDIR;
+	case D_ISLNK:
+		return S_IFLNK;
+	case D_ISFIFO:
+		return S_IFIFO;
+	case D_ISSOCK:
+		return S_IFSOCK;
+	default:
+		return 0;
+	}
+}
+
+/* Called by _walk_dir_entries for each entry. Returns the space needed by
+the entry, and only consumes the entry if it fits in "bufsize". */
+typedef size_t (*READDIR_FILLER)(fuse_req_t req, void *filler_data,
+				 const DIR_ENTRY *dentry, off_t next_offset,
+				 size_t bufsize);
+
 /************************************************************************
 *
-* Function name: hfuse_ll_readdir
+* Function name: _walk_dir_entries
 *        Inputs: fuse_req_t req, fuse_ino_t ino, size_t size,
-*                off_t offset, struct fuse_file_info *file_info
-*       Summary: Read directory content starting from "offset". This
-*                implementation can return partial results and continue
-*                reading in follow-up calls.
+*                off_t offset, struct fuse_file_info *file_info,
+*                READDIR_FILLER filler, void *filler_data
+*       Summary: Walk the entries of the opened dir starting from "offset",
+*                passing each to "filler" until "size" bytes are used.
+*                Pages come from the snapshot of the handle if the dir
+*                was modified during the listing. Offset of an entry is
+*                (page pos * (MAX_DIR_ENTRIES_PER_PAGE + 1) +
+*                entry index + 1).
+*  Return value: Number of bytes used if successful. Otherwise returns
+*                negation of error code.
 *
 *************************************************************************/
-void hfuse_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
-			off_t offset, struct fuse_file_info *file_info)
+static int64_t _walk_dir_entries(fuse_req_t req, fuse_ino_t ino,
+				 size_t size, off_t offset,
+				 struct fuse_file_info *file_info,
+				 READDIR_FILLER filler, void *filler_data)
 {
-	/* Now will read partial entries and deal with others later */
 	ino_t this_inode;
 	int32_t count;
 	off_t thisfile_pos;
 	DIR_META_TYPE tempmeta;
 	DIR_ENTRY_PAGE _temp_page, *temp_page;
-	struct stat tempstat; /* fuse reply sys stat */
 	HCFS_STAT thisstat;
-	struct timeval tmp_time1, tmp_time2;
 	META_CACHE_ENTRY_STRUCT *body_ptr;
 	int64_t countn;
 	off_t nextentry_pos;
 	int32_t page_start;
-	char *buf, *tmpstrptr;;
-	off_t buf_pos;
+	char *tmpstrptr;
+	size_t buf_pos;
 	size_t entry_size;
-	int32_t ret;
-	char this_type;
+	int32_t ret, errcode;
 	DIRH_ENTRY *dirh_ptr;
-	int32_t snap_access_val;
-	struct timespec snap_sleep;
-	BOOL use_snap;
-
-	snap_sleep.tv_sec = 0;
-	snap_sleep.tv_nsec = 100000000;
-	buf = NULL;
-	use_snap = FALSE;
-
-	gettimeofday(&tmp_time1, NULL);
+	DIR_SNAPSHOT *snapshot;
+	int64_t snap_index;
+	BOOL buf_full;
 
 	this_inode = real_ino(req, ino);
 
 	write_log(10, "DEBUG readdir entering readdir, ");
 	write_log(10, "size %ld, offset %ld\n", size, offset);
 
-	if (system_fh_table.entry_table_flags[file_info->fh] != IS_DIRH) {
-		fuse_reply_err(req, EBADF);
-		return;
-	}
+	if (system_fh_table.entry_table_flags[file_info->fh] != IS_DIRH)
+		return -EBADF;
 
 	dirh_ptr = &(system_fh_table.direntry_table[file_info->fh]);
 
-	if (dirh_ptr == NULL) {
-		fuse_reply_err(req, EBADF);
-		return;
-	}
-
 	/* Check if ino passed in is the same as the one stored */
-
-	if (dirh_ptr->thisinode != this_inode) {
-		fuse_reply_err(req, EBADF);
-		return;
-	}
+	if (dirh_ptr->thisinode != this_inode)
+		return -EBADF;
 
 	body_ptr = meta_cache_lock_entry(this_inode);
-	if (body_ptr == NULL) {
-		fuse_reply_err(req, errno);
-		return;
-	}
+	if (body_ptr == NULL)
+		return -errno;
 	ret = meta_cache_lookup_dir_data(this_inode, &thisstat, &tempmeta,
 						NULL, body_ptr);
 	if (ret < 0) {
 		meta_cache_close_file(body_ptr);
 		meta_cache_unlock_entry(body_ptr);
-		fuse_reply_err(req, -ret);
-		return;
-	}
-
-	/* If snapshot of dir is created, and offset is 0, need to wait
-	for other snapshot references to finish and then close the snapshot */
-	if (dirh_ptr->snapshot_ptr != NULL) {
-		sem_wait(&(dirh_ptr->wait_ref_sem));
-		if (offset == 0) {
-			/* Need to wait for threads using this snapshot
-			to finish */
-			sem_getvalue(&(dirh_ptr->snap_ref_sem),
-				     &snap_access_val);
-			while (snap_access_val > 0) {
-				nanosleep(&snap_sleep, NULL);
-				sem_getvalue(&(dirh_ptr->snap_ref_sem),
-					     &snap_access_val);
-			}
-
-			sem_wait(&(system_fh_table.fh_table_sem));
-			fclose(dirh_ptr->snapshot_ptr);
-			dirh_ptr->snapshot_ptr = NULL;
-			system_fh_table.have_nonsnap_dir = TRUE;
-			sem_post(&(system_fh_table.fh_table_sem));
-		}
-		sem_post(&(dirh_ptr->wait_ref_sem));
-		if ((dirh_ptr->snapshot_ptr != NULL) && (offset != 0)) {
-			sem_post(&(dirh_ptr->snap_ref_sem));
-			use_snap = TRUE;
-			PREAD(fileno(dirh_ptr->snapshot_ptr), &tempmeta,
-			      sizeof(DIR_META_TYPE), sizeof(HCFS_STAT));
-		}
+		return ret;
 	}
 
-	buf = malloc(sizeof(char)*size);
-	if (buf == NULL) {
-		meta_cache_close_file(body_ptr);
-		meta_cache_unlock_entry(body_ptr);
-		fuse_reply_err(req, ENOMEM);
-		return;
-	}
+	/* Listing from offset 0 restarts from the live dir, so the snapshot
+	of the handle is dropped. Otherwise keep using the snapshot if the dir
+	was modified after the listing started. */
+	snapshot = get_dirh_snapshot(dirh_ptr, (offset == 0) ? TRUE : FALSE);
+	if (snapshot != NULL)
+		memcpy(&tempmeta, &(snapshot->dir_meta), sizeof(DIR_META_TYPE));
 
 	buf_pos = 0;
+	buf_full = FALSE;
+	snap_index = -1;
 
 	page_start = 0;
 	if (offset >= MAX_DIR_ENTRIES_PER_PAGE) {
@@ -6019,82 +6485,66 @@ void hfuse_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
 		page_start = offset % (MAX_DIR_ENTRIES_PER_PAGE + 1);
 		write_log(10, "readdir starts at offset %ld, entry number %d\n",
 						thisfile_pos, page_start);
+	} else {
+		thisfile_pos = tempmeta.tree_walk_list_head;
+	}
+
+	if (snapshot != NULL) {
+		if (thisfile_pos != 0) {
+			snap_index = find_dir_snapshot_page(snapshot,
+							    thisfile_pos);
+			if (snap_index < 0) {
+				write_log(0, "Readdir offset not in snapshot\n");
+				errcode = -EINVAL;
+				goto errcode_handle;
+			}
+		}
+	} else if ((page_start != 0) ||
+		   (tempmeta.total_children > (MAX_DIR_ENTRIES_PER_PAGE-2))) {
 		if (body_ptr->meta_opened == FALSE) {
 			ret = meta_cache_open_file(body_ptr);
 			if (ret < 0) {
-				meta_cache_close_file(body_ptr);
-				meta_cache_unlock_entry(body_ptr);
-				fuse_reply_err(req, -ret);
-				free(buf);
-				return;
+				errcode = ret;
+				goto errcode_handle;
 			}
 		}
 		meta_cache_drop_pages(body_ptr);
-	} else {
-		thisfile_pos = tempmeta.tree_walk_list_head;
-
-		if (tempmeta.total_children > (MAX_DIR_ENTRIES_PER_PAGE-2)) {
-			if (body_ptr->meta_opened == FALSE) {
-				ret = meta_cache_open_file(body_ptr);
-				if (ret < 0) {
-					meta_cache_close_file(body_ptr);
-					meta_cache_unlock_entry(body_ptr);
-					fuse_reply_err(req, -ret);
-					free(buf);
-					return;
-				}
-			}
-			meta_cache_drop_pages(body_ptr);
-		}
 	}
 
 	write_log(10, "Debug readdir file pos %ld\n", thisfile_pos);
 	countn = 0;
-	while (thisfile_pos != 0) {
+	while ((thisfile_pos != 0) && (buf_full == FALSE)) {
 		write_log(10, "Now %ldth iteration\n", countn);
 		countn++;
 		temp_page = &_temp_page;
-		memset(temp_page, 0, sizeof(DIR_ENTRY_PAGE));
-		temp_page->this_page_pos = thisfile_pos;
-		if (use_snap == TRUE) {
-			FSEEK(dirh_ptr->snapshot_ptr, thisfile_pos, SEEK_SET);
-			FREAD(temp_page, sizeof(DIR_ENTRY_PAGE), 1,
-			      dirh_ptr->snapshot_ptr);
+		if (snapshot != NULL) {
+			temp_page = get_dir_snapshot_page(snapshot, snap_index,
+							  &_temp_page);
+			if ((temp_page == NULL) ||
+			    (temp_page->this_page_pos != thisfile_pos)) {
+				errcode = -EIO;
+				goto errcode_handle;
+			}
 		} else if ((tempmeta.total_children <=
 			    (MAX_DIR_ENTRIES_PER_PAGE - 2)) &&
 			   (page_start == 0)) {
+			memset(temp_page, 0, sizeof(DIR_ENTRY_PAGE));
+			temp_page->this_page_pos = thisfile_pos;
 			ret = meta_cache_lookup_dir_data(this_inode, NULL,
 						NULL, temp_page, body_ptr);
 			if (ret < 0) {
-				meta_cache_close_file(body_ptr);
-				meta_cache_unlock_entry(body_ptr);
-				fuse_reply_err(req, -ret);
-				free(buf);
-				return;
+				errcode = ret;
+				goto errcode_handle;
 			}
 		} else {
-			temp_page = MREAD(body_ptr, NULL, sizeof(DIR_ENTRY_PAGE),
-			      thisfile_pos);
+			temp_page = MREAD(body_ptr, NULL,
+					  sizeof(DIR_ENTRY_PAGE), thisfile_pos);
 		}
 
 		write_log(10, "Debug readdir page start %d %d\n", page_start,
 			temp_page->num_entries);
 		for (count = page_start; count < temp_page->num_entries;
 								count++) {
-			memset(&tempstat, 0, sizeof(tempstat));
-			tempstat.st_ino = temp_page->dir_entries[count].d_ino;
-			this_type = temp_page->dir_entries[count].d_type;
-			if (this_type == D_ISREG)
-				tempstat.st_mode = S_IFREG;
-			else if (this_type == D_ISDIR)
-				tempstat.st_mode = S_IFDIR;
-			else if (this_type == D_ISLNK)
-				tempstat.st_mode = S_IFLNK;
-			else if (this_type == D_ISFIFO)
-				tempstat.st_mode = S_IFIFO;
-			else if (this_type == D_ISSOCK)
-				tempstat.st_mode = S_IFSOCK;
-
 			/* Rebuild parent lookup / dir statistics here
 			(excluding . and ..), for every pair of (parent / child)
 			discovered here */
@@ -6103,36 +6553,37 @@ void hfuse_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
 				tmpstrptr = temp_page->dir_entries[count].d_name;
 				if ((strcmp(tmpstrptr, ".") != 0) &&
 				    (strcmp(tmpstrptr, "..") != 0))
-					rebuild_parent_stat(tempstat.st_ino,
-						this_inode, this_type);
+					rebuild_parent_stat(
+					    temp_page->dir_entries[count].d_ino,
+					    this_inode,
+					    temp_page->dir_entries[count].d_type);
 			}
 
 			nextentry_pos = temp_page->this_page_pos *
 				(MAX_DIR_ENTRIES_PER_PAGE + 1) + (count+1);
-			entry_size = fuse_add_direntry(
-			    req, &buf[buf_pos], (size - buf_pos),
-			    temp_page->dir_entries[count].d_name, &tempstat,
-			    nextentry_pos);
+			entry_size = filler(req, filler_data,
+					    &(temp_page->dir_entries[count]),
+					    nextentry_pos, (size - buf_pos));
 			write_log(10, "Debug readdir entry %s, %" PRIu64 "\n",
 				temp_page->dir_entries[count].d_name,
-				(uint64_t)tempstat.st_ino);
+				(uint64_t)temp_page->dir_entries[count].d_ino);
 			write_log(10, "Debug readdir entry size %ld\n",
 				entry_size);
 			if (entry_size > (size - buf_pos)) {
-				meta_cache_unlock_entry(body_ptr);
 				write_log(10,
 					"Readdir breaks, next offset %ld, ",
 					nextentry_pos);
 				write_log(10, "file pos %lld, entry %d\n",
 					temp_page->this_page_pos, (count+1));
-				fuse_reply_buf(req, buf, buf_pos);
-				free(buf);
-				return;
+				buf_full = TRUE;
+				break;
 			}
 			buf_pos += entry_size;
 		}
 		page_start = 0;
 		thisfile_pos = temp_page->tree_walk_next;
+		if (snapshot != NULL)
+			snap_index++;
 	}
 
 	ret = 0;
@@ -6144,9 +6595,74 @@ void hfuse_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
 	}
 	meta_cache_close_file(body_ptr);
 	meta_cache_unlock_entry(body_ptr);
+	put_dir_snapshot(snapshot);
+	if (ret < 0)
+		return ret;
+	return buf_pos;
+
+errcode_handle:
+	meta_cache_close_file(body_ptr);
+	meta_cache_unlock_entry(body_ptr);
+	put_dir_snapshot(snapshot);
+	return errcode;
+}
+
+typedef struct {
+	char *buf;
+	size_t buf_pos;
+} READDIR_FILLER_DATA;
+
+static size_t _readdir_filler(fuse_req_t req, void *filler_data,
+			      const DIR_ENTRY *dentry, off_t next_offset,
+			      size_t bufsize)
+{
+	READDIR_FILLER_DATA *data = (READDIR_FILLER_DATA *) filler_data;
+	struct stat tempstat; /* fuse reply sys stat */
+	size_t entry_size;
+
+	memset(&tempstat, 0, sizeof(tempstat));
+	tempstat.st_ino = dentry->d_ino;
+	tempstat.st_mode = _dtype_to_mode(dentry->d_type);
+
+	entry_size = fuse_add_direntry(req, &(data->buf[data->buf_pos]),
+				       bufsize, dentry->d_name, &tempstat,
+				       next_offset);
+	if (entry_size <= bufsize)
+		data->buf_pos += entry_size;
+	return entry_size;
+}
+
+/************************************************************************
+*
+* Function name: hfuse_ll_readdir
+*        Inputs: fuse_req_t req, fuse_ino_t ino, size_t size,
+*                off_t offset, struct fuse_file_info *file_info
+*       Summary: Read directory content starting from "offset". This
+*                implementation can return partial results and continue
+*                reading in follow-up calls.
+*
+*************************************************************************/
+void hfuse_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
+			off_t offset, struct fuse_file_info *file_info)
+{
+	READDIR_FILLER_DATA filler_data;
+	struct timeval tmp_time1, tmp_time2;
+	int64_t ret;
+
+	gettimeofday(&tmp_time1, NULL);
+
+	filler_data.buf = malloc(sizeof(char)*size);
+	if (filler_data.buf == NULL) {
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	filler_data.buf_pos = 0;
+
+	ret = _walk_dir_entries(req, ino, size, offset, file_info,
+				_readdir_filler, &filler_data);
 	if (ret < 0) {
 		fuse_reply_err(req, -ret);
-		free(buf);
+		free(filler_data.buf);
 		return;
 	}
 	gettimeofday(&tmp_time2, NULL);
@@ -6155,23 +6671,188 @@ void hfuse_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
 			(tmp_time2.tv_sec - tmp_time1.tv_sec)
 			+ 0.000001 * (tmp_time2.tv_usec - tmp_time1.tv_usec));
 
-	fuse_reply_buf(req, buf, buf_pos);
+	fuse_reply_buf(req, filler_data.buf, filler_data.buf_pos);
 
-	free(buf);
+	free(filler_data.buf);
+}
 
-	if (use_snap == TRUE)
-		sem_trywait(&(dirh_ptr->snap_ref_sem));
+#ifdef FUSE_CAP_READDIRPLUS
+typedef struct {
+	DIR_ENTRY dentry;
+	off_t next_offset;
+} READDIRPLUS_ENTRY;
+
+typedef struct {
+	READDIRPLUS_ENTRY *entries;
+	int64_t num_entries;
+	int64_t max_entries;
+} READDIRPLUS_FILLER_DATA;
+
+/* Entries are only collected here. Attributes are filled after the dir
+is unlocked, as the space needed by an entry only depends on its name. */
+static size_t _readdirplus_filler(fuse_req_t req, void *filler_data,
+				  const DIR_ENTRY *dentry, off_t next_offset,
+				  size_t bufsize)
+{
+	READDIRPLUS_FILLER_DATA *data = (READDIRPLUS_FILLER_DATA *) filler_data;
+	size_t entry_size;
 
-	return;
+	entry_size = fuse_add_direntry_plus(req, NULL, 0, dentry->d_name,
+					    NULL, 0);
+	if ((entry_size > bufsize) ||
+	    (data->num_entries >= data->max_entries))
+		return bufsize + 1;
+
+	memcpy(&(data->entries[data->num_entries].dentry), dentry,
+	       sizeof(DIR_ENTRY));
+	data->entries[data->num_entries].next_offset = next_offset;
+	data->num_entries++;
+	return entry_size;
+}
+
+/************************************************************************
+*
+* Function name: _fill_readdirplus_param
+*        Inputs: fuse_req_t req, const DIR_ENTRY *dentry,
+*                struct fuse_entry_param *param
+*       Summary: Fill the lookup result of "dentry" for readdirplus. Stat
+*                and generation come from the super block entry, with the
+*                stat replaced by the one in meta cache if cached. The
+*                lookup count is increased if "param->ino" is set. If the
+*                attributes cannot be provided here, "param->ino" is 0 and
+*                the kernel looks up the entry when needed.
+*  Return value: None
+*
+*************************************************************************/
+static void _fill_readdirplus_param(fuse_req_t req, const DIR_ENTRY *dentry,
+				    struct fuse_entry_param *param)
+{
+	MOUNT_T *tmpptr;
+	SUPER_BLOCK_ENTRY sb_entry;
+	HCFS_STAT this_stat, cached_stat;
+	uint64_t this_gen;
+	int32_t ret_val;
+
+	memset(param, 0, sizeof(struct fuse_entry_param));
+	param->attr.st_ino = dentry->d_ino;
+	param->attr.st_mode = _dtype_to_mode(dentry->d_type);
+
+	/* Lookup count is not increased for "." and ".." */
+	if ((strcmp(dentry->d_name, ".") == 0) ||
+	    (strcmp(dentry->d_name, "..") == 0))
+		return;
+
+	/* Meta might not be restored yet */
+	if (hcfs_system->system_restoring == RESTORING_STAGE2)
+		return;
+
+	tmpptr = (MOUNT_T *) fuse_req_userdata(req);
+#ifdef _ANDROID_ENV_
+	/* Stat of external volume is rewritten by path in lookup */
+	if (IS_ANDROID_EXTERNAL(tmpptr->volume_type))
+		return;
+#endif
+	/* Lookup might substitute the minimal apk for the apk */
+	if ((hcfs_system->use_minimal_apk == TRUE) &&
+	    (tmpptr->f_ino == hcfs_system->data_app_root) &&
+	    (is_apk(dentry->d_name) == TRUE))
+		return;
+
+	ret_val = super_block_read(dentry->d_ino, &sb_entry);
+	if ((ret_val == 0) && (sb_entry.inode_stat.ino == dentry->d_ino)) {
+		memcpy(&this_stat, &(sb_entry.inode_stat), sizeof(HCFS_STAT));
+		this_gen = sb_entry.generation;
+		if (meta_cache_lookup_stat_snapshot(dentry->d_ino,
+						    &cached_stat) == 0)
+			memcpy(&this_stat, &cached_stat, sizeof(HCFS_STAT));
+	} else {
+		ret_val = fetch_inode_stat(dentry->d_ino, &this_stat,
+					   &this_gen, NULL);
+		if (ret_val < 0)
+			return;
+	}
+	write_buffer_update_stat(dentry->d_ino, &this_stat);
+
+	if (S_ISFILE(this_stat.mode))
+		ret_val = lookup_increase(tmpptr->lookup_table, dentry->d_ino,
+				1, D_ISREG);
+	else if (S_ISDIR(this_stat.mode))
+		ret_val = lookup_increase(tmpptr->lookup_table, dentry->d_ino,
+				1, D_ISDIR);
+	else if (S_ISLNK(this_stat.mode))
+		ret_val = lookup_increase(tmpptr->lookup_table, dentry->d_ino,
+				1, D_ISLNK);
+	else
+		ret_val = -EINVAL;
+	if (ret_val < 0)
+		return;
+
+	convert_hcfsstat_to_sysstat(&(param->attr), &this_stat);
+	param->ino = (fuse_ino_t) dentry->d_ino;
+	param->generation = this_gen;
+	param->attr_timeout = REPLY_ATTR_TIMEOUT;
+}
+
+/************************************************************************
+*
+* Function name: hfuse_ll_readdirplus
+*        Inputs: fuse_req_t req, fuse_ino_t ino, size_t size,
+*                off_t offset, struct fuse_file_info *file_info
+*       Summary: Same as hfuse_ll_readdir, but also reply the lookup
+*                result of each entry so that the kernel does not need
+*                to look up the entries one by one after listing.
+*
+*************************************************************************/
+void hfuse_ll_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size,
+			  off_t offset, struct fuse_file_info *file_info)
+{
+	READDIRPLUS_FILLER_DATA filler_data;
+	struct fuse_entry_param param;
+	char *buf;
+	size_t buf_pos;
+	int64_t count;
+	int64_t ret;
+
+	buf = malloc(sizeof(char)*size);
+	filler_data.max_entries = size /
+		fuse_add_direntry_plus(req, NULL, 0, "", NULL, 0) + 1;
+	filler_data.entries = malloc(sizeof(READDIRPLUS_ENTRY) *
+				     filler_data.max_entries);
+	filler_data.num_entries = 0;
+	if ((buf == NULL) || (filler_data.entries == NULL)) {
+		fuse_reply_err(req, ENOMEM);
+		free(buf);
+		free(filler_data.entries);
+		return;
+	}
+
+	ret = _walk_dir_entries(req, ino, size, offset, file_info,
+				_readdirplus_filler, &filler_data);
+	if (ret < 0) {
+		fuse_reply_err(req, -ret);
+		free(buf);
+		free(filler_data.entries);
+		return;
+	}
+
+	/* Fill attributes of the collected entries in one batch */
+	buf_pos = 0;
+	for (count = 0; count < filler_data.num_entries; count++) {
+		_fill_readdirplus_param(req,
+					&(filler_data.entries[count].dentry),
+					&param);
+		buf_pos += fuse_add_direntry_plus(req, &buf[buf_pos],
+				(size - buf_pos),
+				filler_data.entries[count].dentry.d_name,
+				&param, filler_data.entries[count].next_offset);
+	}
+
+	fuse_reply_buf(req, buf, buf_pos);
 
-errcode_handle:
-	meta_cache_close_file(body_ptr);
-	meta_cache_unlock_entry(body_ptr);
-	fuse_reply_err(req, -errcode);
 	free(buf);
-	if (use_snap == TRUE)
-		sem_trywait(&(dirh_ptr->snap_ref_sem));
+	free(filler_data.entries);
 }
+#endif  /* FUSE_CAP_READDIRPLUS */
 
 /************************************************************************
 *
@@ -6223,10 +6904,13 @@ void hfuse_ll_init(void *userdata, struct fuse_conn_info *conn)
 {
 	MOUNT_T *tmpptr;
 
-	UNUSED(conn);
 	tmpptr = (MOUNT_T *)userdata;
 	write_log(10, "Root inode is %" PRIu64 "\n", (uint64_t)tmpptr->f_ino);
 
+	/* Let read replies splice data from block files */
+	if (conn->capable & FUSE_CAP_SPLICE_WRITE)
+		conn->want |= FUSE_CAP_SPLICE_WRITE;
+
 	lookup_increase(tmpptr->lookup_table, tmpptr->f_ino, 1, D_ISDIR);
 }
 
@@ -6367,6 +7051,13 @@ void hfuse_ll_setattr(fuse_req_t req,
 	attr_changed = FALSE;
 	only_atime_changed = TRUE;
 
+	/* Truncate and size checks must see buffered writes */
+	ret_val = write_buffer_flush_inode(this_inode);
+	if (ret_val < 0) {
+		fuse_reply_err(req, -ret_val);
+		return;
+	}
+
 	body_ptr = meta_cache_lock_entry(this_inode);
 	if (body_ptr == NULL) {
 		fuse_reply_err(req, errno);
@@ -6646,7 +7337,9 @@ static void hfuse_ll_access(fuse_req_t req, fuse_ino_t ino, int32_t mode)
 
 	thisinode = real_ino(req, ino);
 
-	ret_val = fetch_inode_stat(thisinode, &thisstat, NULL, NULL);
+	ret_val = meta_cache_lookup_stat_snapshot(thisinode, &thisstat);
+	if (ret_val < 0)
+		ret_val = fetch_inode_stat(thisinode, &thisstat, NULL, NULL);
 
 	if (ret_val < 0) {
 		fuse_reply_err(req, -ret_val);
@@ -8113,6 +8806,12 @@ static void hfuse_ll_fallocate(fuse_req_t req, fuse_ino_t ino, int32_t mode,
 		return;
 	}
 
+	ret_val = write_buffer_flush_inode(this_inode);
+	if (ret_val < 0) {
+		fuse_reply_err(req, -ret_val);
+		return;
+	}
+
 	body_ptr = meta_cache_lock_entry(this_inode);
 	if (body_ptr == NULL) {
 		fuse_reply_err(req, errno);
@@ -8182,6 +8881,9 @@ struct fuse_lowlevel_ops hfuse_ops = {
 	.mknod = hfuse_ll_mknod,
 	.mkdir = hfuse_ll_mkdir,
 	.readdir = hfuse_ll_readdir,
+#ifdef FUSE_CAP_READDIRPLUS
+	.readdirplus = hfuse_ll_readdirplus,
+#endif
 	.opendir = hfuse_ll_opendir,
 	.access = hfuse_ll_access,
 	.rename = hfuse_ll_rename,
@@ -8293,7 +8995,10 @@ int32_t hook_fuse(int32_t argc, char **argv)
 	init_alias_group();
 
 	startup_finish_delete();
+	init_block_fd_cache();
+	init_write_buffer();
 	init_download_control();
+	init_prefetch_control();
 	init_pin_scheduler();
 
 	/* Check and cleanup meta / data no longer in use from content
@@ -8335,11 +9040,15 @@ int32_t hook_fuse(int32_t argc, char **argv)
 	if (hcfs_system->system_restoring == RESTORING_STAGE2)
 		destroy_rebuild_sb(FALSE);
 
+	destroy_prefetch_control();
+	/* Write out buffered data while mounts are still there */
+	destroy_write_buffer();
 	destroy_mount_mgr();
 	destroy_fs_manager();
 	release_meta_cache_headers();
 	destroy_download_control();
 	destroy_pin_scheduler();
+	destroy_block_fd_cache();
 #ifndef _ANDROID_ENV_ /* Not in Android */
 	destroy_fuse_proc_communication(communicate_tid, socket_fd);
 #endif
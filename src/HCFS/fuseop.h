@@ -118,6 +118,24 @@ typedef struct {
 	int32_t xfer_now_window;
 } SYSTEM_DATA_TYPE;
 
+/* Histogram of the time threads stalled on full cache. Bucket i counts
+stalls shorter than 10^i milliseconds, and the last bucket the rest */
+#define CACHE_STALL_BUCKETS 6
+
+typedef struct {
+	int64_t num_stalls[CACHE_STALL_BUCKETS];
+	int64_t total_stall_ms;
+	int64_t max_stall_ms;
+} CACHE_STALL_STAT;
+
+/* Adaptive upload concurrency and the throughput it is based on */
+typedef struct {
+	int32_t upload_concurrency;
+	int32_t sync_concurrency;
+	int64_t upload_throughput; /* KB/s */
+	int64_t upload_latency_ms;
+} XFER_CONCURRENCY_STAT;
+
 typedef struct {
 	FILE *system_val_fptr;
 	SYSTEM_DATA_TYPE systemdata;
@@ -135,6 +153,13 @@ typedef struct {
 
 	/* Semaphore for controlling cache management */
 	sem_t something_to_replace;
+	/* Wakes up cache management if cache size reaches the soft limit or
+	cache space is freed while threads are waiting on full cache */
+	sem_t cache_event_sem;
+	/* Protected by access_sem */
+	CACHE_STALL_STAT cache_stall_stat;
+	/* Updated by the upload process. Protected by access_sem */
+	XFER_CONCURRENCY_STAT xfer_concurrency_stat;
 
 	pthread_mutex_t immediate_sync_meta_mutex;
 	pthread_cond_t immediate_sync_meta_cond;
@@ -164,6 +189,10 @@ typedef struct {
 
 	int32_t system_restoring;
 	struct timespec backend_status_last_time;
+
+	/* Bumped by the owner of parent lookup after each change to its
+	log, so that forked processes only read the log when it changed */
+	int64_t parent_log_seq;
 } SYSTEM_DATA_HEAD;
 
 SYSTEM_DATA_HEAD *hcfs_system;
@@ -188,6 +217,10 @@ bool mgmt_app_is_created;
 
 /* FUSE op parameters */
 #define REPLY_ATTR_TIMEOUT 0.1 /* Timeout for cached getattr results */
+/* Max number of cloud blocks fetched at once for a single read */
+#define MAX_READ_FETCH_CONCURRENCY 4
+/* Max number of cached blocks replied without copying for a single read */
+#define MAX_SPLICE_READ_BLOCKS 4
 
 #define FUSE_HCFS_AVAIL_SPACE_NOTIFY	_IOW(0xff, 0x01, long)
 #define WRITEBACK_CACHE_RESERVE_SPACE (1 * 1024 * 1024)
@@ -104,6 +104,8 @@
 #define ISSKIPDEX 50
 #define SET_UPLOAD_INTERVAL 51
 #define GETMAXMETASIZE 52
+#define GETMETACACHESTAT 53
+#define GETCACHESTALLSTAT 54
 
 #define DEFAULT_PIN FALSE
 
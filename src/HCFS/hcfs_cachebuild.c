@@ -225,6 +225,24 @@ int32_t compare_cache_usage(CACHE_USAGE_NODE *first_node,
 	return 0;
 }
 
+/* Marking something_to_replace as false */
+static int32_t _clear_something_to_replace(void)
+{
+	int32_t ret, errcode;
+
+	do {
+		ret = sem_trywait(&(hcfs_system->something_to_replace));
+		if (ret < 0) {
+			errcode = (int32_t) errno;
+			if (errcode != EAGAIN)
+				return -errcode;
+		} else {
+			errcode = 0;
+		}
+	} while (errcode == 0);
+	return 0;
+}
+
 /************************************************************************
 *
 * Function name: build_cache_usage
@@ -258,17 +276,9 @@ int32_t build_cache_usage(void)
 
 	write_log(10, "Initialized cache usage hash table\n");
 
-	/* Marking something_to_replace as false */
-	do {
-		ret = sem_trywait(&(hcfs_system->something_to_replace));
-		if (ret < 0) {
-			errcode = (int32_t) errno;
-			if (errcode != EAGAIN)
-				return -errcode;
-		} else {
-			errcode = 0;
-		}
-	} while (errcode == 0);
+	ret = _clear_something_to_replace();
+	if (ret < 0)
+		return ret;
 
 	for (count = 0; count < NUMSUBDIR; count++) {
 		write_log(10, "Now processing subfolder %d\n", count);
@@ -406,3 +416,662 @@ int32_t build_cache_usage(void)
 	/* TODO: Perhaps could merge linked lists from all hash entries */
 	return 0;
 }
+
+static CACHE_USAGE_INDEX cache_usage_index;
+
+static inline time_t _node_time(CACHE_USAGE_NODE *node)
+{
+	if (node->last_access_time > node->last_mod_time)
+		return node->last_access_time;
+	return node->last_mod_time;
+}
+
+/* Returns TRUE if node1 should be paged out before node2. Least recently
+used first, and then the one with more clean cache. */
+static BOOL _victim_before(CACHE_USAGE_NODE *node1, CACHE_USAGE_NODE *node2)
+{
+	time_t time1, time2;
+
+	time1 = _node_time(node1);
+	time2 = _node_time(node2);
+	if (time1 != time2)
+		return (time1 < time2);
+	return (node1->clean_cache_size > node2->clean_cache_size);
+}
+
+static void _heap_set(int64_t pos, CACHE_USAGE_NODE *node)
+{
+	cache_usage_index.heap[pos] = node;
+	node->heap_pos = pos;
+}
+
+static void _heap_sift_up(int64_t pos)
+{
+	CACHE_USAGE_NODE *node, *parent;
+
+	node = cache_usage_index.heap[pos];
+	while (pos > 0) {
+		parent = cache_usage_index.heap[(pos - 1) / 2];
+		if (_victim_before(node, parent) == FALSE)
+			break;
+		_heap_set(pos, parent);
+		pos = (pos - 1) / 2;
+	}
+	_heap_set(pos, node);
+}
+
+static void _heap_sift_down(int64_t pos)
+{
+	CACHE_USAGE_NODE *node, **heap;
+	int64_t child;
+
+	heap = cache_usage_index.heap;
+	node = heap[pos];
+	while (TRUE) {
+		child = pos * 2 + 1;
+		if (child >= cache_usage_index.heap_size)
+			break;
+		if ((child + 1 < cache_usage_index.heap_size) &&
+		    (_victim_before(heap[child + 1], heap[child]) == TRUE))
+			child++;
+		if (_victim_before(heap[child], node) == FALSE)
+			break;
+		_heap_set(pos, heap[child]);
+		pos = child;
+	}
+	_heap_set(pos, node);
+}
+
+static int32_t _heap_push(CACHE_USAGE_NODE *node)
+{
+	CACHE_USAGE_NODE **new_heap;
+	int64_t new_max;
+
+	if (cache_usage_index.heap_size >= cache_usage_index.heap_max) {
+		new_max = (cache_usage_index.heap_max > 0) ?
+			  cache_usage_index.heap_max * 2 : 1024;
+		new_heap = realloc(cache_usage_index.heap,
+				   sizeof(CACHE_USAGE_NODE *) * new_max);
+		if (new_heap == NULL) {
+			write_log(0, "Out of memory in %s\n", __func__);
+			return -ENOMEM;
+		}
+		cache_usage_index.heap = new_heap;
+		cache_usage_index.heap_max = new_max;
+	}
+	_heap_set(cache_usage_index.heap_size, node);
+	cache_usage_index.heap_size++;
+	_heap_sift_up(node->heap_pos);
+	return 0;
+}
+
+static void _heap_remove(CACHE_USAGE_NODE *node)
+{
+	int64_t pos;
+	CACHE_USAGE_NODE *last;
+
+	pos = node->heap_pos;
+	node->heap_pos = -1;
+	cache_usage_index.heap_size--;
+	if (pos == cache_usage_index.heap_size)
+		return;
+
+	last = cache_usage_index.heap[cache_usage_index.heap_size];
+	_heap_set(pos, last);
+	_heap_sift_up(pos);
+	_heap_sift_down(last->heap_pos);
+}
+
+/* Put the node in, move it within or remove it from the heap after
+its content is changed */
+static void _heap_fix(CACHE_USAGE_NODE *node)
+{
+	BOOL is_candidate;
+
+	is_candidate = ((node->clean_cache_size > 0) && (node->picked == FALSE));
+	if (node->heap_pos < 0) {
+		if (is_candidate == TRUE)
+			_heap_push(node);
+		return;
+	}
+	if (is_candidate == FALSE) {
+		_heap_remove(node);
+		return;
+	}
+	_heap_sift_up(node->heap_pos);
+	_heap_sift_down(node->heap_pos);
+}
+
+static CACHE_USAGE_NODE **_index_find(ino_t this_inode)
+{
+	CACHE_USAGE_NODE **node_ptr;
+
+	node_ptr = &(cache_usage_index.hash_table[this_inode %
+						  CACHE_USAGE_INDEX_HASH_SIZE]);
+	while (*node_ptr != NULL) {
+		if ((*node_ptr)->this_inode == this_inode)
+			break;
+		node_ptr = &((*node_ptr)->index_next);
+	}
+	return node_ptr;
+}
+
+static void _index_insert(CACHE_USAGE_NODE *node)
+{
+	CACHE_USAGE_NODE **head;
+
+	head = &(cache_usage_index.hash_table[node->this_inode %
+					      CACHE_USAGE_INDEX_HASH_SIZE]);
+	node->index_next = *head;
+	*head = node;
+	node->heap_pos = -1;
+	node->picked = FALSE;
+	node->picked_next = NULL;
+	cache_usage_index.num_nodes++;
+	_heap_fix(node);
+}
+
+/* Remove the node from the index. Nodes in the picked list are freed
+when the round of replacement is over. */
+static void _index_delete(CACHE_USAGE_NODE **node_ptr)
+{
+	CACHE_USAGE_NODE *node;
+
+	node = *node_ptr;
+	*node_ptr = node->index_next;
+	node->index_next = NULL;
+	if (node->heap_pos >= 0)
+		_heap_remove(node);
+	cache_usage_index.num_nodes--;
+	if (node->picked == FALSE)
+		free(node);
+	else
+		node->this_inode = 0;
+}
+
+static void _index_clear(void)
+{
+	int32_t count;
+	CACHE_USAGE_NODE *node, *next;
+
+	for (count = 0; count < CACHE_USAGE_INDEX_HASH_SIZE; count++) {
+		node = cache_usage_index.hash_table[count];
+		while (node != NULL) {
+			next = node->index_next;
+			if (node->picked == FALSE)
+				free(node);
+			else
+				node->this_inode = 0;
+			node = next;
+		}
+		cache_usage_index.hash_table[count] = NULL;
+	}
+	cache_usage_index.heap_size = 0;
+	cache_usage_index.num_nodes = 0;
+}
+
+static void _index_free_picked(void)
+{
+	CACHE_USAGE_NODE *node, *next;
+
+	node = cache_usage_index.picked_list;
+	while (node != NULL) {
+		next = node->picked_next;
+		free(node);
+		node = next;
+	}
+	cache_usage_index.picked_list = NULL;
+}
+
+static void _cache_usage_index_path(char *path)
+{
+	snprintf(path, METAPATHLEN, "%s/cache_usage_index", METAPATH);
+}
+
+/************************************************************************
+*
+* Function name: _load_cache_usage_index
+*        Inputs: None
+*       Summary: Load the index persisted at last shutdown. The file is
+*                removed after loading, so that a crash afterwards leads to
+*                a full block scan at next startup instead of a stale index.
+*  Return value: 0 if successful, otherwise negation of error code.
+*
+*************************************************************************/
+static int32_t _load_cache_usage_index(void)
+{
+	char path[METAPATHLEN];
+	FILE *fptr;
+	CACHE_USAGE_INDEX_HEAD head;
+	CACHE_USAGE_RECORD record;
+	CACHE_USAGE_NODE *node;
+	struct stat filestat;
+	int64_t count;
+	size_t ret_size;
+	int32_t errcode;
+
+	_cache_usage_index_path(path);
+	fptr = fopen(path, "r");
+	if (fptr == NULL)
+		return -errno;
+
+	unlink(path);
+	if (fstat(fileno(fptr), &filestat) < 0) {
+		errcode = -errno;
+		goto errcode_handle;
+	}
+	ret_size = FREAD(&head, sizeof(CACHE_USAGE_INDEX_HEAD), 1, fptr);
+	if ((ret_size < 1) ||
+	    (memcmp(head.magic, CACHE_USAGE_INDEX_MAGIC, 4) != 0) ||
+	    (head.version != CACHE_USAGE_INDEX_VERSION) ||
+	    (head.num_records < 0) ||
+	    (filestat.st_size != (off_t)(sizeof(CACHE_USAGE_INDEX_HEAD) +
+			head.num_records * sizeof(CACHE_USAGE_RECORD)))) {
+		write_log(2, "Persisted cache usage index is invalid\n");
+		errcode = -EINVAL;
+		goto errcode_handle;
+	}
+
+	for (count = 0; count < head.num_records; count++) {
+		ret_size = FREAD(&record, sizeof(CACHE_USAGE_RECORD), 1, fptr);
+		if (ret_size < 1) {
+			errcode = -EIO;
+			goto errcode_handle;
+		}
+		node = calloc(1, sizeof(CACHE_USAGE_NODE));
+		if (node == NULL) {
+			errcode = -ENOMEM;
+			goto errcode_handle;
+		}
+		node->this_inode = (ino_t) record.this_inode;
+		node->clean_cache_size = record.clean_cache_size;
+		node->dirty_cache_size = record.dirty_cache_size;
+		node->last_access_time = (time_t) record.last_access_time;
+		node->last_mod_time = (time_t) record.last_mod_time;
+		_index_insert(node);
+	}
+	fclose(fptr);
+	write_log(5, "Loaded cache usage of %" PRId64 " inodes\n",
+		  cache_usage_index.num_nodes);
+	return 0;
+
+errcode_handle:
+	fclose(fptr);
+	_index_clear();
+	return errcode;
+}
+
+/************************************************************************
+*
+* Function name: _save_cache_usage_index
+*        Inputs: None
+*       Summary: Persist the index next to the superblock.
+*  Return value: 0 if successful, otherwise negation of error code.
+*
+*************************************************************************/
+static int32_t _save_cache_usage_index(void)
+{
+	char path[METAPATHLEN], tmppath[METAPATHLEN + 10];
+	FILE *fptr;
+	CACHE_USAGE_INDEX_HEAD head;
+	CACHE_USAGE_RECORD record;
+	CACHE_USAGE_NODE *node;
+	int32_t count, errcode;
+
+	_cache_usage_index_path(path);
+	snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+	fptr = fopen(tmppath, "w");
+	if (fptr == NULL) {
+		errcode = errno;
+		write_log(0, "IO error in %s. Code %d, %s\n", __func__,
+			  errcode, strerror(errcode));
+		return -errcode;
+	}
+
+	memset(&head, 0, sizeof(CACHE_USAGE_INDEX_HEAD));
+	memcpy(head.magic, CACHE_USAGE_INDEX_MAGIC, 4);
+	head.version = CACHE_USAGE_INDEX_VERSION;
+	head.num_records = cache_usage_index.num_nodes;
+	FWRITE(&head, sizeof(CACHE_USAGE_INDEX_HEAD), 1, fptr);
+
+	memset(&record, 0, sizeof(CACHE_USAGE_RECORD));
+	for (count = 0; count < CACHE_USAGE_INDEX_HASH_SIZE; count++) {
+		node = cache_usage_index.hash_table[count];
+		while (node != NULL) {
+			record.this_inode = (uint64_t) node->this_inode;
+			record.clean_cache_size = node->clean_cache_size;
+			record.dirty_cache_size = node->dirty_cache_size;
+			record.last_access_time =
+				(int64_t) node->last_access_time;
+			record.last_mod_time = (int64_t) node->last_mod_time;
+			FWRITE(&record, sizeof(CACHE_USAGE_RECORD), 1, fptr);
+			node = node->index_next;
+		}
+	}
+	fflush(fptr);
+	FSYNC(fileno(fptr));
+	fclose(fptr);
+
+	if (rename(tmppath, path) < 0) {
+		errcode = errno;
+		write_log(0, "IO error in %s. Code %d, %s\n", __func__,
+			  errcode, strerror(errcode));
+		unlink(tmppath);
+		return -errcode;
+	}
+	return 0;
+
+errcode_handle:
+	fclose(fptr);
+	unlink(tmppath);
+	return errcode;
+}
+
+/************************************************************************
+*
+* Function name: init_cache_usage_index
+*        Inputs: None
+*       Summary: Initialize the cache usage index, and load the index
+*                persisted at last shutdown if there is one.
+*  Return value: 0 if successful, otherwise negation of error code.
+*
+*************************************************************************/
+int32_t init_cache_usage_index(void)
+{
+	int32_t ret;
+
+	memset(&cache_usage_index, 0, sizeof(CACHE_USAGE_INDEX));
+	sem_init(&(cache_usage_index.index_sem), 0, 1);
+
+	if (CACHE_USAGE_INDEX_INCREMENTAL == FALSE)
+		return 0;
+
+	ret = _load_cache_usage_index();
+	if (ret == 0)
+		cache_usage_index.loaded = TRUE;
+	else if (ret != -ENOENT)
+		write_log(4, "Rebuilding cache usage index. Code %d\n", -ret);
+	return 0;
+}
+
+/************************************************************************
+*
+* Function name: destroy_cache_usage_index
+*        Inputs: None
+*       Summary: Persist the cache usage index and free all nodes.
+*  Return value: None
+*
+*************************************************************************/
+void destroy_cache_usage_index(void)
+{
+	int32_t ret;
+
+	sem_wait(&(cache_usage_index.index_sem));
+	if ((CACHE_USAGE_INDEX_INCREMENTAL == TRUE) &&
+	    (cache_usage_index.loaded == TRUE)) {
+		ret = _save_cache_usage_index();
+		if (ret < 0)
+			write_log(0, "Unable to save cache usage index. Code %d\n",
+				  -ret);
+	}
+	_index_clear();
+	_index_free_picked();
+	free(cache_usage_index.heap);
+	cache_usage_index.heap = NULL;
+	cache_usage_index.heap_max = 0;
+	cache_usage_index.loaded = FALSE;
+	sem_post(&(cache_usage_index.index_sem));
+	sem_destroy(&(cache_usage_index.index_sem));
+}
+
+/************************************************************************
+*
+* Function name: cache_usage_index_update
+*        Inputs: ino_t this_inode, int64_t cached_size, int64_t dirty_size
+*       Summary: Set the cache usage of "this_inode" to the per-file
+*                statistics just written to its meta.
+*  Return value: None
+*
+*************************************************************************/
+void cache_usage_index_update(ino_t this_inode, int64_t cached_size,
+			      int64_t dirty_size)
+{
+	CACHE_USAGE_NODE **node_ptr, *node;
+	int64_t clean_size;
+
+	clean_size = cached_size - dirty_size;
+	if (clean_size < 0)
+		clean_size = 0;
+	if (dirty_size < 0)
+		dirty_size = 0;
+
+	sem_wait(&(cache_usage_index.index_sem));
+	node_ptr = _index_find(this_inode);
+	node = *node_ptr;
+	if (node == NULL) {
+		if (cached_size <= 0)
+			goto out;
+		node = calloc(1, sizeof(CACHE_USAGE_NODE));
+		if (node == NULL) {
+			write_log(0, "Out of memory in %s\n", __func__);
+			goto out;
+		}
+		node->this_inode = this_inode;
+		node->clean_cache_size = clean_size;
+		node->dirty_cache_size = dirty_size;
+		/* Newly cached data is not paged out first */
+		node->last_access_time = time(NULL);
+		_index_insert(node);
+		goto out;
+	}
+
+	if (cached_size <= 0) {
+		_index_delete(node_ptr);
+		goto out;
+	}
+	node->clean_cache_size = clean_size;
+	node->dirty_cache_size = dirty_size;
+	_heap_fix(node);
+out:
+	sem_post(&(cache_usage_index.index_sem));
+}
+
+/************************************************************************
+*
+* Function name: cache_usage_index_touch
+*        Inputs: ino_t this_inode, BOOL is_modify
+*       Summary: Record an access (or modification if "is_modify" is TRUE)
+*                of the cached data of "this_inode".
+*  Return value: None
+*
+*************************************************************************/
+void cache_usage_index_touch(ino_t this_inode, BOOL is_modify)
+{
+	CACHE_USAGE_NODE *node;
+	time_t now;
+
+	now = time(NULL);
+	sem_wait(&(cache_usage_index.index_sem));
+	node = *(_index_find(this_inode));
+	if (node != NULL) {
+		if (is_modify == TRUE)
+			node->last_mod_time = now;
+		else
+			node->last_access_time = now;
+		if (node->heap_pos >= 0)
+			_heap_sift_down(node->heap_pos);
+	}
+	sem_post(&(cache_usage_index.index_sem));
+}
+
+/************************************************************************
+*
+* Function name: cache_usage_index_remove
+*        Inputs: ino_t this_inode
+*       Summary: Drop "this_inode" from the index when it is deleted.
+*  Return value: None
+*
+*************************************************************************/
+void cache_usage_index_remove(ino_t this_inode)
+{
+	CACHE_USAGE_NODE **node_ptr;
+
+	sem_wait(&(cache_usage_index.index_sem));
+	node_ptr = _index_find(this_inode);
+	if (*node_ptr != NULL)
+		_index_delete(node_ptr);
+	sem_post(&(cache_usage_index.index_sem));
+}
+
+/************************************************************************
+*
+* Function name: cache_usage_index_lookup
+*        Inputs: ino_t this_inode, CACHE_USAGE_NODE *node
+*       Summary: Copy the cache usage of "this_inode" to "node".
+*  Return value: 0 if found, otherwise -ENOENT.
+*
+*************************************************************************/
+int32_t cache_usage_index_lookup(ino_t this_inode, CACHE_USAGE_NODE *node)
+{
+	CACHE_USAGE_NODE *found;
+	int32_t ret;
+
+	sem_wait(&(cache_usage_index.index_sem));
+	found = *(_index_find(this_inode));
+	if (found != NULL) {
+		memcpy(node, found, sizeof(CACHE_USAGE_NODE));
+		ret = 0;
+	} else {
+		ret = -ENOENT;
+	}
+	sem_post(&(cache_usage_index.index_sem));
+	return ret;
+}
+
+/************************************************************************
+*
+* Function name: cache_usage_index_pick_victim
+*        Inputs: ino_t *this_inode, int64_t recent_int
+*       Summary: Pick the least recently used inode with clean cache that
+*                is not yet picked in this round of replacement. Inodes
+*                used in the last "recent_int" seconds are not picked.
+*  Return value: 0 if an inode is picked. -EAGAIN if all candidates are
+*                used recently, or -ENOENT if there is no candidate.
+*
+*************************************************************************/
+int32_t cache_usage_index_pick_victim(ino_t *this_inode, int64_t recent_int)
+{
+	CACHE_USAGE_NODE *node;
+	int32_t ret;
+
+	sem_wait(&(cache_usage_index.index_sem));
+	if (cache_usage_index.heap_size <= 0) {
+		ret = -ENOENT;
+		goto out;
+	}
+	node = cache_usage_index.heap[0];
+	if ((recent_int > 0) && ((time(NULL) - _node_time(node)) < recent_int)) {
+		ret = -EAGAIN;
+		goto out;
+	}
+
+	_heap_remove(node);
+	node->picked = TRUE;
+	node->picked_next = cache_usage_index.picked_list;
+	cache_usage_index.picked_list = node;
+	*this_inode = node->this_inode;
+	ret = 0;
+out:
+	sem_post(&(cache_usage_index.index_sem));
+	return ret;
+}
+
+/************************************************************************
+*
+* Function name: cache_usage_index_reset_round
+*        Inputs: None
+*       Summary: Start a new round of replacement. Inodes picked in the
+*                last round can be picked again.
+*  Return value: None
+*
+*************************************************************************/
+void cache_usage_index_reset_round(void)
+{
+	CACHE_USAGE_NODE *node, *next;
+
+	sem_wait(&(cache_usage_index.index_sem));
+	node = cache_usage_index.picked_list;
+	cache_usage_index.picked_list = NULL;
+	while (node != NULL) {
+		next = node->picked_next;
+		node->picked_next = NULL;
+		node->picked = FALSE;
+		/* Node deleted from the index while being picked */
+		if (node->this_inode == 0)
+			free(node);
+		else
+			_heap_fix(node);
+		node = next;
+	}
+	sem_post(&(cache_usage_index.index_sem));
+}
+
+/************************************************************************
+*
+* Function name: build_cache_usage_index
+*        Inputs: BOOL force_scan
+*       Summary: Make sure the cache usage index covers all local blocks.
+*                The block cache is scanned only if the index is not
+*                loaded yet or if "force_scan" is TRUE.
+*  Return value: 0 if successful, otherwise negation of error code.
+*
+*************************************************************************/
+int32_t build_cache_usage_index(BOOL force_scan)
+{
+	CACHE_USAGE_NODE **node_ptr, *node, *scanned, *next;
+	int32_t count, ret;
+
+	if ((force_scan == FALSE) && (cache_usage_index.loaded == TRUE))
+		return _clear_something_to_replace();
+
+	ret = build_cache_usage();
+	if (ret < 0)
+		return ret;
+
+	sem_wait(&(cache_usage_index.index_sem));
+	if ((force_scan == TRUE) || (CACHE_USAGE_INDEX_INCREMENTAL == FALSE))
+		_index_clear();
+
+	/* Move the scanned nodes into the index. Usage updated by fuse
+	operations during the scan is newer than the scanned one. */
+	for (count = 0; count < CACHE_USAGE_NUM_ENTRIES; count++) {
+		scanned = inode_cache_usage_hash[count];
+		while (scanned != NULL) {
+			next = scanned->next_node;
+			scanned->next_node = NULL;
+			node_ptr = _index_find(scanned->this_inode);
+			node = *node_ptr;
+			if (node == NULL) {
+				_index_insert(scanned);
+			} else {
+				if (node->last_access_time <
+				    scanned->last_access_time)
+					node->last_access_time =
+						scanned->last_access_time;
+				if (node->last_mod_time < scanned->last_mod_time)
+					node->last_mod_time =
+						scanned->last_mod_time;
+				_heap_fix(node);
+				free(scanned);
+			}
+			scanned = next;
+		}
+		inode_cache_usage_hash[count] = NULL;
+	}
+	nonempty_cache_hash_entries = 0;
+	cache_usage_index.loaded = TRUE;
+	write_log(5, "Cache usage index rebuilt, %" PRId64 " inodes\n",
+		  cache_usage_index.num_nodes);
+	sem_post(&(cache_usage_index.index_sem));
+	return 0;
+}
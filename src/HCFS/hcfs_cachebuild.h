@@ -23,9 +23,33 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <semaphore.h>
+#include <stdint.h>
+
+#include "global.h"
 
 #define CACHE_USAGE_NUM_ENTRIES 8
 
+#define CACHE_USAGE_INDEX_HASH_SIZE 4096
+#define CACHE_USAGE_INDEX_MAGIC "HCUI"
+#define CACHE_USAGE_INDEX_VERSION 1
+/* Min interval (in seconds) between two full block scans used for
+correcting the cache usage index */
+#define CACHE_USAGE_RESCAN_INT 3600
+
+/* The index is kept current by update_file_stats() and the access hooks
+in fuse operations, so it is only incremental where cache management
+runs in the fuse process, which is the Android build. Off Android,
+run_cache_loop runs in its own forked process and never sees these
+updates. Using the index there would need the updates passed between the
+processes (e.g. through shared memory like the system meta), so the
+index is instead rebuilt by a full block scan on every pass as before,
+and is neither saved nor loaded. */
+#ifdef _ANDROID_ENV_
+#define CACHE_USAGE_INDEX_INCREMENTAL TRUE
+#else
+#define CACHE_USAGE_INDEX_INCREMENTAL FALSE
+#endif
+
 typedef struct usage_node_template {
 	ino_t this_inode;
 	int64_t clean_cache_size;
@@ -33,8 +57,45 @@ typedef struct usage_node_template {
 	time_t last_access_time;
 	time_t last_mod_time;
 	struct usage_node_template *next_node;
+	/* Following fields are used by the cache usage index */
+	struct usage_node_template *index_next;
+	struct usage_node_template *picked_next;
+	int64_t heap_pos; /* -1 if not a replacement candidate */
+	BOOL picked;
 } CACHE_USAGE_NODE;
 
+/* Per-inode cache usage kept up to date by the read / write / fetch /
+eviction paths. Nodes with clean cache are kept in a min-heap ordered
+by the last access or modification time, so that the next victim of
+cache replacement is found without scanning the block cache. */
+typedef struct {
+	sem_t index_sem;
+	CACHE_USAGE_NODE *hash_table[CACHE_USAGE_INDEX_HASH_SIZE];
+	CACHE_USAGE_NODE **heap;
+	int64_t heap_size;
+	int64_t heap_max;
+	int64_t num_nodes;
+	/* Nodes picked as victims in this round of replacement */
+	CACHE_USAGE_NODE *picked_list;
+	/* TRUE if the index covers all local blocks */
+	BOOL loaded;
+} CACHE_USAGE_INDEX;
+
+/* On-disk format of the persisted index */
+typedef struct {
+	char magic[4];
+	int32_t version;
+	int64_t num_records;
+} CACHE_USAGE_INDEX_HEAD;
+
+typedef struct {
+	uint64_t this_inode;
+	int64_t clean_cache_size;
+	int64_t dirty_cache_size;
+	int64_t last_access_time;
+	int64_t last_mod_time;
+} CACHE_USAGE_RECORD;
+
 CACHE_USAGE_NODE *inode_cache_usage_hash[CACHE_USAGE_NUM_ENTRIES];
 int32_t nonempty_cache_hash_entries;
 
@@ -52,4 +113,15 @@ int32_t compare_cache_usage(CACHE_USAGE_NODE *first_node,
 					CACHE_USAGE_NODE *second_node);
 int32_t build_cache_usage(void);
 
+int32_t init_cache_usage_index(void);
+void destroy_cache_usage_index(void);
+void cache_usage_index_update(ino_t this_inode, int64_t cached_size,
+			      int64_t dirty_size);
+void cache_usage_index_touch(ino_t this_inode, BOOL is_modify);
+void cache_usage_index_remove(ino_t this_inode);
+int32_t cache_usage_index_lookup(ino_t this_inode, CACHE_USAGE_NODE *node);
+int32_t cache_usage_index_pick_victim(ino_t *this_inode, int64_t recent_int);
+void cache_usage_index_reset_round(void);
+int32_t build_cache_usage_index(BOOL force_scan);
+
 #endif  /* GW20_HCFS_HCFS_CACHEBUILD_H_ */
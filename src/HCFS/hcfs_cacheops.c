@@ -36,6 +36,8 @@
 #include <inttypes.h>
 
 #include "hcfs_cachebuild.h"
+#include "cache_policy.h"
+#include "block_fd_cache.h"
 #include "params.h"
 #include "fuseop.h"
 #include "super_block.h"
@@ -49,10 +51,113 @@
 
 #define BLK_INCREMENTS MAX_BLOCK_ENTRIES_PER_PAGE
 
+/*
+ * Wait until cache management is woken up or timeout_sec passed.
+ *
+ * @param timeout_sec Max time to wait in seconds.
+ * @param seconds_slept Seconds waited are added to this if not NULL.
+ */
+static void _wait_cache_event(int32_t timeout_sec, int64_t *seconds_slept)
+{
+	struct timespec abstime, starttime, endtime;
+	int32_t ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &starttime);
+	clock_gettime(CLOCK_REALTIME, &abstime);
+	abstime.tv_sec += timeout_sec;
+	do {
+		ret = sem_timedwait(&(hcfs_system->cache_event_sem), &abstime);
+	} while ((ret < 0) && (errno == EINTR));
+
+	if (seconds_slept != NULL) {
+		clock_gettime(CLOCK_MONOTONIC, &endtime);
+		*seconds_slept += endtime.tv_sec - starttime.tv_sec;
+	}
+}
+
+/* Wake up threads waiting on full cache if there is space for them */
+static void _wake_cache_sleepers(void)
+{
+	int32_t ret, semval;
+
+	if (hcfs_system->systemdata.cache_size >=
+	    (CACHE_HARD_LIMIT - CACHE_DELTA))
+		return;
+	semval = 0;
+	ret = sem_getvalue(&(hcfs_system->num_cache_sleep_sem), &semval);
+	if ((ret == 0) && (semval > 0))
+		notify_sleep_on_cache(0);
+}
+
 /* TODO: Consider whether need to update block status when throwing
 out blocks and sync to cloud, and how this may interact with meta
 sync in upload process */
 
+/*
+ * Helper function for paging out one local block that has been synced
+ * to backend. Meta file should be locked by the caller.
+ *
+ * @param metafptr File pointer of the locked meta file.
+ * @param this_inode The inode of the block.
+ * @param blockno The block to be paged out.
+ * @param pagepos File position of the block entry page.
+ * @param temppage The block entry page read from pagepos.
+ * @param page_index Index of the block in the page.
+ *
+ * @return 0 on success, 1 if meta cannot be updated, otherwise negative
+ *         error code.
+ */
+static int32_t _page_out_block(FILE *metafptr, ino_t this_inode,
+			       int64_t blockno, int64_t pagepos,
+			       BLOCK_ENTRY_PAGE *temppage, int32_t page_index)
+{
+	BLOCK_ENTRY *blk_entry_ptr;
+	char thisblockpath[400];
+	struct stat block_stat; /* block ops */
+	int64_t block_size_blk;
+	int32_t ret, errcode;
+	size_t ret_size;
+
+	blk_entry_ptr = &(temppage->block_entries[page_index]);
+	blk_entry_ptr->status = ST_CLOUD;
+	/* Increase the counter for the number of times
+	this block is paged out. Reset to zero if
+	overflow */
+	blk_entry_ptr->paged_out_count++;
+	if (blk_entry_ptr->paged_out_count > (UINT32_MAX - (uint32_t) 10))
+		blk_entry_ptr->paged_out_count = 0;
+	write_log(10, "Debug status changed to ST_CLOUD, block %lld, inode %lld\n",
+		  blockno, this_inode);
+	FSEEK(metafptr, pagepos, SEEK_SET);
+	ret_size = FWRITE(temppage, sizeof(BLOCK_ENTRY_PAGE), 1, metafptr);
+	if (ret_size < 1)
+		return 1;
+	ret = fetch_block_path(thisblockpath, this_inode, blockno);
+	if (ret < 0)
+		return ret;
+	ret = stat(thisblockpath, &block_stat);
+	if (ret < 0) {
+		errcode = errno;
+		write_log(0, "IO error in %s. Code %d, %s\n", __func__, errcode,
+			  strerror(errcode));
+		return -errcode;
+	}
+	block_size_blk = block_stat.st_blocks * 512;
+	change_system_meta(0, 0, -block_size_blk, -1, 0, 0, TRUE);
+	invalidate_block_fd(this_inode, blockno);
+	ret = unlink(thisblockpath);
+	if (ret < 0) {
+		errcode = errno;
+		write_log(0, "IO error in %s. Code %d, %s\n", __func__, errcode,
+			  strerror(errcode));
+		return -errcode;
+	}
+	return update_file_stats(metafptr, 0, -1, -block_size_blk, 0, this_inode);
+
+errcode_handle:
+	return errcode;
+}
+
 /*
  * Helper function for removing local cached block for blocks that
  * has been synced to backend already.
@@ -72,12 +177,10 @@ int32_t _remove_synced_block(ino_t this_inode, struct timeval *builttime,
 	FILE *metafptr;
 	int64_t current_block;
 	int64_t total_blocks;
-	int64_t block_size_blk;
 	HCFS_STAT temphead_stat;
-	struct stat block_stat; /* block ops */
 	FILE_META_TYPE temphead;
+	FILE_STATS_TYPE tempstats;
 	int64_t pagepos;
-	char thisblockpath[400];
 	BLOCK_ENTRY_PAGE temppage;
 	int32_t page_index;
 	int64_t timediff;
@@ -184,54 +287,11 @@ int32_t _remove_synced_block(ino_t this_inode, struct timeval *builttime,
 			if (blk_entry_ptr->status == ST_BOTH) {
 				/*Only delete blocks that exists on both
 					cloud and local*/
-				blk_entry_ptr->status = ST_CLOUD;
-				/* Increase the counter for the number of times
-				this block is paged out. Reset to zero if
-				overflow */
-				blk_entry_ptr->paged_out_count++;
-				if (blk_entry_ptr->paged_out_count >
-				    (UINT32_MAX - (uint32_t) 10))
-					blk_entry_ptr->paged_out_count = 0;
-				write_log(10,
-					"Debug status changed to ST_CLOUD, block %lld, inode %lld\n",
-						current_block, this_inode);
-				FSEEK(metafptr, pagepos, SEEK_SET);
-				ret_size = FWRITE(&temppage,
-					sizeof(BLOCK_ENTRY_PAGE), 1, metafptr);
-				if (ret_size < 1)
+				ret = _page_out_block(metafptr, this_inode,
+						current_block, pagepos, &temppage,
+						page_index);
+				if (ret > 0)
 					break;
-				ret = fetch_block_path(thisblockpath,
-						this_inode, current_block);
-				if (ret < 0) {
-					errcode = ret;
-					goto errcode_handle;
-				}
-				ret = stat(thisblockpath, &block_stat);
-				if (ret < 0) {
-					errcode = errno;
-					write_log(0,
-						"IO error in %s. Code %d, %s\n",
-						__func__, errcode,
-						strerror(errcode));
-					errcode = -errcode;
-					goto errcode_handle;
-				}
-				block_size_blk = block_stat.st_blocks * 512;
-				change_system_meta(0, 0, -block_size_blk,
-						-1, 0, 0, TRUE);
-				ret = unlink(thisblockpath);
-				if (ret < 0) {
-					errcode = errno;
-					write_log(0,
-						"IO error in %s. Code %d, %s\n",
-						__func__, errcode,
-						strerror(errcode));
-					errcode = -errcode;
-					goto errcode_handle;
-				}
-				ret = update_file_stats(metafptr, 0, -1,
-							-block_size_blk,
-							0, this_inode);
 				if (ret < 0) {
 					errcode = ret;
 					goto errcode_handle;
@@ -252,12 +312,12 @@ int32_t _remove_synced_block(ino_t this_inode, struct timeval *builttime,
 					(CACHE_HARD_LIMIT - CACHE_DELTA))
 				notify_sleep_on_cache(0);
 
-			/* If cache size < soft limit, take a break and wait
-			for exceeding soft limit. Stop paging out these blocks
-			if cache size is still < soft limit after 5 mins.
+			/* If cache size < low watermark, take a break and
+			wait for exceeding soft limit. Stop paging out these
+			blocks if cache size is still < soft limit after 5 mins.
 			Otherwise lock meta and remove next block. */
 			if (hcfs_system->systemdata.cache_size <
-						CACHE_SOFT_LIMIT) {
+						CACHE_RECLAIM_LOW) {
 				flock(fileno(metafptr), LOCK_UN);
 
 				semptr = &(hcfs_system->num_cache_sleep_sem);
@@ -273,8 +333,7 @@ int32_t _remove_synced_block(ino_t this_inode, struct timeval *builttime,
 					if ((timediff > SCAN_INT) ||
 						((*seconds_slept) > SCAN_INT))
 						break;
-					sleep(1);
-					(*seconds_slept)++;
+					_wait_cache_event(1, seconds_slept);
 					if (hcfs_system->system_going_down
 						== TRUE)
 						break;
@@ -325,8 +384,20 @@ int32_t _remove_synced_block(ino_t this_inode, struct timeval *builttime,
 			page_index++;
 		}
 
+		/* Correct the cache usage index with per-file statistics in
+		case it drifted from the meta */
+		if (pread(fileno(metafptr), &tempstats, sizeof(FILE_STATS_TYPE),
+			  sizeof(HCFS_STAT) + sizeof(FILE_META_TYPE)) ==
+		    sizeof(FILE_STATS_TYPE))
+			cache_usage_index_update(this_inode,
+						 tempstats.cached_size,
+						 tempstats.dirty_data_size);
+
 		flock(fileno(metafptr), LOCK_UN);
 		fclose(metafptr);
+	} else {
+		/* Not a regular file (anymore). Nothing to page out */
+		cache_usage_index_remove(this_inode);
 	}
 	return 0;
 
@@ -337,6 +408,145 @@ errcode_handle:
 }
 
 
+/*
+ * Helper function for paging out a single block picked by the block
+ * replacement policy.
+ *
+ * @param this_inode The inode of the block.
+ * @param blockno The block to be paged out.
+ *
+ * @return 0 on success, 1 if the block cannot be paged out now, -ENOENT
+ *         if the block is not cached locally, otherwise negative error code.
+ */
+static int32_t _page_out_single_block(ino_t this_inode, int64_t blockno)
+{
+	SUPER_BLOCK_ENTRY tempentry;
+	char thismetapath[METAPATHLEN];
+	FILE *metafptr;
+	HCFS_STAT temphead_stat;
+	FILE_META_TYPE temphead;
+	BLOCK_ENTRY_PAGE temppage;
+	int64_t pagepos;
+	int32_t page_index, ret, errcode;
+	size_t ret_size;
+
+	ret = super_block_read(this_inode, &tempentry);
+	if (ret < 0)
+		return ret;
+	if ((tempentry.inode_stat.ino == 0) ||
+	    (!S_ISREG(tempentry.inode_stat.mode)))
+		return -ENOENT;
+
+	ret = fetch_meta_path(thismetapath, this_inode);
+	if (ret < 0)
+		return ret;
+	metafptr = fopen(thismetapath, "r+");
+	if (metafptr == NULL) {
+		errcode = errno;
+		if (errcode != ENOENT)
+			write_log(0, "IO error in %s. Code %d, %s\n",
+				  __func__, errcode, strerror(errcode));
+		return -errcode;
+	}
+	setbuf(metafptr, NULL);
+	flock(fileno(metafptr), LOCK_EX);
+	if (access(thismetapath, F_OK) < 0) {
+		errcode = -errno;
+		goto errcode_handle;
+	}
+
+	FREAD(&temphead_stat, sizeof(HCFS_STAT), 1, metafptr);
+	FREAD(&temphead, sizeof(FILE_META_TYPE), 1, metafptr);
+	if (P_IS_PIN(temphead.local_pin)) {
+		errcode = 1;
+		goto errcode_handle;
+	}
+	if (blockno >= BLOCKS_OF_SIZE(temphead_stat.size, MAX_BLOCK_SIZE)) {
+		errcode = -ENOENT;
+		goto errcode_handle;
+	}
+
+	pagepos = seek_page2(&temphead, metafptr, blockno / BLK_INCREMENTS, 0);
+	if (pagepos <= 0) {
+		errcode = (pagepos == 0) ? -ENOENT : pagepos;
+		goto errcode_handle;
+	}
+	FSEEK(metafptr, pagepos, SEEK_SET);
+	ret_size = FREAD(&temppage, sizeof(BLOCK_ENTRY_PAGE), 1, metafptr);
+	if (ret_size < 1) {
+		errcode = -EIO;
+		goto errcode_handle;
+	}
+
+	page_index = blockno % BLK_INCREMENTS;
+	switch (temppage.block_entries[page_index].status) {
+	case ST_BOTH:
+		errcode = _page_out_block(metafptr, this_inode, blockno,
+					  pagepos, &temppage, page_index);
+		break;
+	case ST_NONE:
+	case ST_CLOUD:
+		errcode = -ENOENT;
+		break;
+	default:
+		/* Dirty or being synced */
+		errcode = 1;
+		break;
+	}
+
+errcode_handle:
+	flock(fileno(metafptr), LOCK_UN);
+	fclose(metafptr);
+	return errcode;
+}
+
+/*
+ * Page out blocks picked by the block replacement policy until cache size
+ * drops below the soft limit or no candidate could be paged out.
+ *
+ * @return Number of blocks paged out.
+ */
+static int64_t _remove_policy_victims(void)
+{
+	ino_t this_inode;
+	int64_t blockno, num_removed;
+	int32_t ret, num_tries;
+
+	num_removed = 0;
+	num_tries = 0;
+	while ((hcfs_system->systemdata.cache_size >= CACHE_RECLAIM_LOW) &&
+	       (num_tries < CACHE_POLICY_MAX_TRIES)) {
+		if (hcfs_system->system_going_down == TRUE)
+			break;
+		if (cache_policy_pick_victim(&this_inode, &blockno) < 0)
+			break;
+
+		ret = _page_out_single_block(this_inode, blockno);
+		if (ret == 0) {
+			cache_policy_evicted(this_inode, blockno);
+			num_removed++;
+			num_tries = 0;
+			if (hcfs_system->systemdata.cache_size <
+			    (CACHE_HARD_LIMIT - CACHE_DELTA))
+				notify_sleep_on_cache(0);
+			continue;
+		}
+
+		if (ret == -ENOENT) {
+			/* Already paged out or deleted elsewhere */
+			cache_policy_forget(this_inode, blockno);
+		} else {
+			if (ret < 0)
+				write_log(4, "Unable to page out block %"
+					  PRIu64 "_%lld. Code %d\n",
+					  (uint64_t)this_inode, blockno, -ret);
+			cache_policy_kept(this_inode, blockno);
+		}
+		num_tries++;
+	}
+	return num_removed;
+}
+
 static int32_t _check_cache_replace_result(int64_t *num_removed_inode)
 {
 	/* If number of removed inodes = 0, and cache size is full, and
@@ -351,10 +561,10 @@ static int32_t _check_cache_replace_result(int64_t *num_removed_inode)
 			write_log(4, "Cache size exceeds threshold, "
 				"but nothing can be paged out\n");
 			notify_sleep_on_cache(-EIO);
-			sleep(2);
-			/* Try again after 2 seconds just in case some thread
-			slipped by status changes
-			before we wait on something_to_replace*/
+			/* Try again after a thread started waiting (or after
+			2 seconds) just in case some thread slipped by status
+			changes before we wait on something_to_replace*/
+			_wait_cache_event(2, NULL);
 			notify_sleep_on_cache(-EIO);
 		}
 		/* If in the previous round no replace is done,
@@ -372,8 +582,6 @@ static int32_t _check_cache_replace_result(int64_t *num_removed_inode)
 and scan for mtime greater than the last update time for uploads, and scan
 for atime for cache replacement*/
 
-/*TODO: Now pick victims with small inode number. Will need to implement
-	something smarter.*/
 /*Only kick the blocks that's stored on cloud, i.e., stored_where ==ST_BOTH*/
 /* TODO: Something better for checking if the inode have cache to be kicked
 out. Will need to consider whether to force checking of replacement? */
@@ -381,9 +589,9 @@ out. Will need to consider whether to force checking of replacement? */
 *
 * Function name: run_cache_loop
 *        Inputs: None
-*       Summary: Main loop for scanning for cache usage and remove cached
-*                blocks from local disk if synced to backend and if total
-*                cache size exceeds some threshold.
+*       Summary: Main loop for picking victims from the cache usage index
+*                and remove cached blocks from local disk if synced to
+*                backend and if total cache size exceeds some threshold.
 *  Return value: None
 *
 *************************************************************************/
@@ -394,14 +602,12 @@ void run_cache_loop(void)
 #endif
 {
 	ino_t this_inode;
-	struct timeval builttime, currenttime;
+	struct timeval builttime, currenttime, scantime;
 	int64_t seconds_slept;
-	int32_t e_index;
 	char skip_recent, do_something;
-	time_t node_time;
-	CACHE_USAGE_NODE *this_cache_node;
+	BOOL force_scan;
 	int32_t ret, semval;
-	int64_t num_removed_inode;
+	int64_t num_removed_inode, num_removed_blocks;
 	sem_t *semptr;
 
 #ifdef _ANDROID_ENV_
@@ -412,16 +618,15 @@ void run_cache_loop(void)
 		if (hcfs_system->system_going_down == TRUE)
 			break;
 		num_removed_inode = 0;
-		ret = build_cache_usage();
+		ret = build_cache_usage_index(FALSE);
 		if (ret < 0) {
 			write_log(0, "Error in cache mgmt.\n");
 			sleep(10);
 		}
 	}
 	gettimeofday(&builttime, NULL);
+	scantime = builttime;
 
-	/*Index for doing the round robin in cache dropping*/
-	e_index = 0;
 	skip_recent = TRUE;
 	do_something = FALSE;
 
@@ -431,104 +636,90 @@ void run_cache_loop(void)
 		          hcfs_system->systemdata.cache_size);
 		seconds_slept = 0;
 
-		while (hcfs_system->systemdata.cache_size >= CACHE_SOFT_LIMIT) {
+		/* Page out until cache size drops below the low watermark */
+		while (hcfs_system->systemdata.cache_size >= CACHE_RECLAIM_LOW) {
 			if (hcfs_system->system_going_down == TRUE)
 				break;
 
+			/* Space might be freed by others, e.g. file deletion */
+			_wake_cache_sleepers();
+
 			write_log(10, "Need to throw out something\n");
-			if (nonempty_cache_hash_entries <= 0) {
-				/* All empty */
-				write_log(10, "Recomputing cache usage\n");
-				_check_cache_replace_result(&num_removed_inode);
-				do_something = FALSE;
 
-				ret = build_cache_usage();
-				if (ret < 0) {
-					write_log(0, "Error in cache mgmt.\n");
-					sleep(10);
+			/* Page out single blocks picked by the block
+			replacement policy first. Fall back to paging out
+			whole inodes if no block could be paged out. */
+			if ((cache_policy_enabled() == TRUE) &&
+			    (hcfs_system->system_restoring != RESTORING_STAGE2)) {
+				num_removed_blocks = _remove_policy_victims();
+				if (num_removed_blocks > 0) {
+					num_removed_inode += num_removed_blocks;
+					do_something = TRUE;
 					continue;
 				}
-				gettimeofday(&builttime, NULL);
-				e_index = 0;
-				skip_recent = TRUE;
 			}
 
-			/* End of hash table. Restart at index 0 */
-			if (e_index >= CACHE_USAGE_NUM_ENTRIES) {
-				if ((do_something == FALSE) &&
-						(skip_recent == FALSE)) {
-					write_log(10, "Recomputing cache usage part 2\n");
-					_check_cache_replace_result(&num_removed_inode);
-					do_something = FALSE;
-					ret = build_cache_usage();
-					if (ret < 0) {
-						write_log(0,
-							"Error in cache mgmt.\n");
-						sleep(10);
-						continue;
-					}
-					gettimeofday(&builttime, NULL);
-					e_index = 0;
-					skip_recent = TRUE;
-				} else {
-					if ((do_something == FALSE) &&
-							(skip_recent == TRUE))
-						skip_recent = FALSE;
-					e_index = 0;
-					do_something = FALSE;
-				}
-			}
+			ret = cache_usage_index_pick_victim(&this_inode,
+					(skip_recent == TRUE) ? SCAN_INT : 0);
 
-			/* skip empty bucket */
-			if (inode_cache_usage_hash[e_index] == NULL) {
-				e_index++;
-			//	write_log(10, "Skipping, part 1\n");
+			/* Only recently used inodes are left. Page them out
+			too if nothing else could be done. */
+			if (ret == -EAGAIN) {
+				skip_recent = FALSE;
+				do_something = FALSE;
 				continue;
 			}
 
-			/* All dirty. Local data cannot be deleted. */
-			if (inode_cache_usage_hash[e_index]->clean_cache_size
-									<= 0) {
-				e_index++;
-			//	write_log(10, "Skipping, part 2\n");
-				continue;
-			}
+			/* All candidates are processed. Start a new round */
+			if (ret == -ENOENT) {
+				write_log(10, "Restarting cache replacement\n");
+				/* Nothing can be paged out now. If soft limit is
+				not reached, wait for cache size to grow instead */
+				if ((num_removed_inode == 0) &&
+				    (hcfs_system->systemdata.cache_size <
+				     CACHE_SOFT_LIMIT)) {
+					cache_usage_index_reset_round();
+					skip_recent = TRUE;
+					do_something = FALSE;
+					break;
+				}
+				_check_cache_replace_result(&num_removed_inode);
+				cache_usage_index_reset_round();
 
-			if (skip_recent == TRUE) {
+				/* Scan the block cache only if the index is not
+				maintained by this process, or once in a while
+				if nothing could be done with the index */
 				gettimeofday(&currenttime, NULL);
-				node_time = inode_cache_usage_hash[e_index]->
-							last_access_time;
-				if (node_time <
-					inode_cache_usage_hash[e_index]->
-								last_mod_time)
-					node_time =
-						inode_cache_usage_hash[e_index]
-							->last_mod_time;
-				if ((currenttime.tv_sec - node_time) <
-				     SCAN_INT) {
-					e_index++;
-			//		write_log(10, "Skipping, part 3\n");
+				force_scan = FALSE;
+				if ((CACHE_USAGE_INDEX_INCREMENTAL == FALSE) ||
+				    ((do_something == FALSE) &&
+				     ((currenttime.tv_sec - scantime.tv_sec) >
+				      CACHE_USAGE_RESCAN_INT)))
+					force_scan = TRUE;
+
+				ret = build_cache_usage_index(force_scan);
+				if (ret < 0) {
+					write_log(0, "Error in cache mgmt.\n");
+					sleep(10);
 					continue;
 				}
+				if (force_scan == TRUE)
+					scantime = currenttime;
+				gettimeofday(&builttime, NULL);
+				skip_recent = TRUE;
+				do_something = FALSE;
+				continue;
 			}
 			do_something = TRUE;
 
-			this_inode =
-				inode_cache_usage_hash[e_index]->this_inode;
 			write_log(10, "Preparing to remove blocks in %" PRIu64 "\n",
 			          (uint64_t)this_inode);
 
-			this_cache_node =
-				return_cache_usage_node(
-				inode_cache_usage_hash[e_index]->this_inode);
-
-			if (this_cache_node)
-				free(this_cache_node);
-			e_index++;
-
 			ret = _remove_synced_block(this_inode, &builttime,
 								&seconds_slept);
-			if (ret < 0)
+			if (ret == -ENOENT)
+				cache_usage_index_remove(this_inode);
+			else if (ret < 0)
 				sleep(10);
 			else if (ret == 0)
 				num_removed_inode++;
@@ -540,7 +731,7 @@ void run_cache_loop(void)
 
 		while (hcfs_system->systemdata.cache_size < CACHE_SOFT_LIMIT) {
 			gettimeofday(&currenttime, NULL);
-			/*Rebuild cache usage every five minutes if cache usage
+			/*Start a new round every five minutes if cache usage
 			not near full*/
 			write_log(10, "Checking cache size %lld, %lld\n",
 			          hcfs_system->systemdata.cache_size,
@@ -560,20 +751,24 @@ void run_cache_loop(void)
 			if (((currenttime.tv_sec-builttime.tv_sec) >
 			      SCAN_INT) ||
 			     (seconds_slept > SCAN_INT)) {
-				ret = build_cache_usage();
+				cache_usage_index_reset_round();
+				force_scan = (CACHE_USAGE_INDEX_INCREMENTAL ==
+					      FALSE) ? TRUE : FALSE;
+				ret = build_cache_usage_index(force_scan);
 				if (ret < 0) {
 					write_log(0, "Error in cache mgmt.\n");
 					sleep(10);
 					continue;
 				}
+				if (force_scan == TRUE)
+					scantime = currenttime;
 				num_removed_inode = 0;
 				gettimeofday(&builttime, NULL);
 				seconds_slept = 0;
-				e_index = 0;
 				skip_recent = TRUE;
 				do_something = FALSE;
 			}
-			sleep(1);
+			_wait_cache_event(1, &seconds_slept);
 
 			if (hcfs_system->system_going_down == TRUE)
 				break;
@@ -583,8 +778,6 @@ void run_cache_loop(void)
 			                   &semval);
 			if ((ret == 0) && (semval > 0))
 				notify_sleep_on_cache(0);
-
-			seconds_slept++;
 		}
 	}
 	notify_sleep_on_cache(-ESHUTDOWN);
@@ -593,6 +786,51 @@ void run_cache_loop(void)
 #endif
 }
 
+/* Add a stall on full cache to the stall histogram */
+static void _record_cache_stall(struct timespec *starttime,
+				struct timespec *endtime)
+{
+	CACHE_STALL_STAT *stat;
+	int64_t stall_ms, bound;
+	int32_t bucket;
+
+	stall_ms = (endtime->tv_sec - starttime->tv_sec) * 1000 +
+		   (endtime->tv_nsec - starttime->tv_nsec) / 1000000;
+	if (stall_ms < 0)
+		stall_ms = 0;
+
+	bucket = 0;
+	bound = 1;
+	while ((bucket < CACHE_STALL_BUCKETS - 1) && (stall_ms >= bound)) {
+		bucket++;
+		bound *= 10;
+	}
+
+	stat = &(hcfs_system->cache_stall_stat);
+	sem_wait(&(hcfs_system->access_sem));
+	stat->num_stalls[bucket]++;
+	stat->total_stall_ms += stall_ms;
+	if (stall_ms > stat->max_stall_ms)
+		stat->max_stall_ms = stall_ms;
+	sem_post(&(hcfs_system->access_sem));
+}
+
+/************************************************************************
+*
+* Function name: wakeup_cache_management
+*        Inputs: None
+*       Summary: Wake up cache management waiting for cache size changes
+*                or for threads sleeping on full cache.
+*  Return value: None
+*
+*************************************************************************/
+void wakeup_cache_management(void)
+{
+	int32_t semval;
+
+	sem_check_and_release(&(hcfs_system->cache_event_sem), &semval);
+}
+
 /************************************************************************
 *
 * Function name: sleep_on_cache_full
@@ -607,6 +845,7 @@ int32_t sleep_on_cache_full(void)
 {
 	int32_t cache_replace_status;
 	int32_t num_replace;
+	struct timespec starttime, endtime;
 
 	/* Check cache replacement status */
 	cache_replace_status = hcfs_system->systemdata.cache_replace_status;
@@ -627,12 +866,16 @@ int32_t sleep_on_cache_full(void)
 	int32_t sem_val = 0;
 	sem_check_and_release(&(hcfs_system->sync_control_sem), &sem_val);
 
+	clock_gettime(CLOCK_MONOTONIC, &starttime);
 	sem_post(&(hcfs_system->num_cache_sleep_sem)); /* Count++ */
+	wakeup_cache_management();
 	sem_wait(&(hcfs_system->check_cache_sem)); /* Sleep a while */
 	sem_wait(&(hcfs_system->num_cache_sleep_sem)); /* Count-- */
 	cache_replace_status = hcfs_system->systemdata.cache_replace_status;
 	sem_post(&(hcfs_system->check_cache_replace_status_sem)); /*Get status*/
 	sem_post(&(hcfs_system->check_next_sem));
+	clock_gettime(CLOCK_MONOTONIC, &endtime);
+	_record_cache_stall(&starttime, &endtime);
 
 	return cache_replace_status;
 }
@@ -26,8 +26,15 @@
 
 #define SCAN_INT 300
 
+/* Once cache size reaches CACHE_SOFT_LIMIT, cache replacement pages out
+blocks until cache size drops below this low watermark */
+#define CACHE_RECLAIM_LOW \
+	((CACHE_SOFT_LIMIT > CACHE_DELTA) ? (CACHE_SOFT_LIMIT - CACHE_DELTA) :\
+	 CACHE_SOFT_LIMIT)
+
 int32_t sleep_on_cache_full(void);
 void notify_sleep_on_cache(int32_t cache_replace_status);
+void wakeup_cache_management(void);
 #ifdef _ANDROID_ENV_
 void *run_cache_loop(void *ptr);
 #else
@@ -715,7 +715,7 @@ void dsync_single_inode(DSYNC_THREAD_TYPE *ptr)
 				sem_post(&(delete_ctl.delete_op_sem));
 				tmp_tn = &(delete_ctl.threads_no[curl_id]);
 				tmp_dt = &(delete_ctl.delete_threads[curl_id]);
-				if (CURRENT_BACKEND == GOOGLEDRIVE) {
+				if (BLOCK_ID_IS_RECORDED) {
 					memset(&(tmp_dt->gdrive_info), 0,
 					       sizeof(GOOGLEDRIVE_OBJ_INFO));
 					strncpy(
@@ -940,7 +940,8 @@ int32_t do_block_delete(ino_t this_inode, int64_t block_no, int64_t seq,
 			objname, (uint64_t)this_inode, block_no);
 		sprintf(curl_handle->id, "delete_blk_%" PRIu64 "_%" PRId64"_%"PRId64,
 				(uint64_t)this_inode, block_no, seq);
-		ret_val = hcfs_delete_object(objname, curl_handle, gdrive_info);
+		ret_val = hcfs_delete_multipart_object(objname, curl_handle,
+						       gdrive_info);
 		/* Already retried in get object if necessary */
 		if ((ret_val >= 200) && (ret_val <= 299))
 			ret = 0;
@@ -1068,10 +1069,10 @@ void *delete_loop(void *ptr)
 		}
 
 		write_log(10, "Debug statistics %d, %d\n",
-		          sys_super_block->head.num_to_be_deleted,
+		          SB_HEAD_COUNTER(num_to_be_deleted),
 		          dsync_ctl.total_active_dsync_threads);
 		/* Sleep if backend is online and system is running */
-		if (sys_super_block->head.num_to_be_deleted <=
+		if (SB_HEAD_COUNTER(num_to_be_deleted) <=
 		    dsync_ctl.total_active_dsync_threads) {
 			sem_wait(&(hcfs_system->dsync_wait_sem));
 			continue;
@@ -1089,7 +1090,7 @@ void *delete_loop(void *ptr)
 		retry_inode = pull_retry_inode(&(dsync_ctl.retry_list));
 		sem_post(&(dsync_ctl.dsync_op_sem));
 
-		super_block_share_locking();
+		super_block_list_locking(SB_LL_TO_DELETE);
 		if (retry_inode > 0) { /* Jump to retried inode */
 			inode_to_check = retry_inode;
 		} else {
@@ -1123,7 +1124,7 @@ anything can be deleted */
 				inode_to_check = tempentry.util_ll_next;
 			}
 		}
-		super_block_share_release();
+		super_block_list_release(SB_LL_TO_DELETE);
 
 		write_log(6, "Inode to delete is %" PRIu64 "\n",
 		          (uint64_t) inode_to_dsync);
@@ -212,7 +212,8 @@ errcode_handle:
 *  Return value: None
 *
 * Note: For prefetch, will not attempt to return error code to others,
-*       but will just log error and give up prefetching.
+*       but will just log error and give up prefetching. "ptr" is owned
+*       by the caller.
 *
 *************************************************************************/
 void prefetch_block(PREFETCH_STRUCT_TYPE *ptr)
@@ -242,16 +243,13 @@ void prefetch_block(PREFETCH_STRUCT_TYPE *ptr)
 	}
 
 	metafptr = fopen(thismetapath, "r+");
-	if (metafptr == NULL) {
-		free(ptr);
+	if (metafptr == NULL)
 		return;
-	}
 	mopen = TRUE;
 	setbuf(metafptr, NULL);
 
 	blockfptr = fopen(thisblockpath, "a+");
 	if (blockfptr == NULL) {
-		free(ptr);
 		fclose(metafptr);
 		return;
 	}
@@ -259,7 +257,6 @@ void prefetch_block(PREFETCH_STRUCT_TYPE *ptr)
 
 	blockfptr = fopen(thisblockpath, "r+");
 	if (blockfptr == NULL) {
-		free(ptr);
 		fclose(metafptr);
 		return;
 	}
@@ -353,7 +350,6 @@ void prefetch_block(PREFETCH_STRUCT_TYPE *ptr)
 	fclose(blockfptr);
 	flock(fileno(metafptr), LOCK_UN);
 	fclose(metafptr);
-	free(ptr);
 
 	return;
 
@@ -367,7 +363,312 @@ errcode_handle:
 	if (mopen == TRUE)
 		fclose(metafptr);
 	UNUSED(errcode);
-	free(ptr);
+}
+
+/* Helper for prefetch workers. Fill page position and seqnum of a job that
+ * was queued across a page boundary, and check that the block is still
+ * in the cloud. "job" is the private copy of the worker. Returns 1 if the
+ * block should be fetched, 0 if not. */
+static int32_t _resolve_prefetch_job(PREFETCH_STRUCT_TYPE *job)
+{
+	META_CACHE_ENTRY_STRUCT *body_ptr;
+	BLOCK_ENTRY_PAGE temppage;
+	int64_t page_pos;
+	int32_t ret;
+	char status;
+
+	body_ptr = meta_cache_lock_entry(job->this_inode);
+	if (body_ptr == NULL)
+		return 0;
+
+	page_pos = job->page_start_fpos;
+	if (page_pos == 0)
+		page_pos = seek_page(body_ptr,
+				job->block_no / MAX_BLOCK_ENTRIES_PER_PAGE, 0);
+	if (page_pos <= 0) {
+		meta_cache_close_file(body_ptr);
+		meta_cache_unlock_entry(body_ptr);
+		return 0;
+	}
+	ret = meta_cache_lookup_file_data(job->this_inode, NULL, NULL,
+			&temppage, page_pos, body_ptr);
+	meta_cache_close_file(body_ptr);
+	meta_cache_unlock_entry(body_ptr);
+	if (ret < 0)
+		return 0;
+
+	status = temppage.block_entries[job->entry_index].status;
+	if ((status != ST_CLOUD) && (status != ST_CtoL))
+		return 0;
+	if ((job->seqnum != PREFETCH_ANY_SEQNUM) &&
+	    (job->seqnum != temppage.block_entries[job->entry_index].seqnum))
+		return 0;
+
+	job->page_start_fpos = page_pos;
+	job->seqnum = temppage.block_entries[job->entry_index].seqnum;
+	return 1;
+}
+
+static BOOL _same_prefetch_job(const PREFETCH_STRUCT_TYPE *job,
+			       ino_t this_inode, int64_t block_no,
+			       int64_t seqnum)
+{
+	if ((job->this_inode != this_inode) || (job->block_no != block_no))
+		return FALSE;
+	if ((job->seqnum == PREFETCH_ANY_SEQNUM) ||
+	    (seqnum == PREFETCH_ANY_SEQNUM))
+		return TRUE;
+	return (job->seqnum == seqnum);
+}
+
+/************************************************************************
+*
+* Function name: enqueue_prefetch_block
+*        Inputs: ino_t this_inode, int64_t block_no, int64_t seqnum,
+*                off_t page_start_fpos
+*       Summary: Queue block "block_no" of "this_inode" for prefetching.
+*                "seqnum" can be PREFETCH_ANY_SEQNUM and "page_start_fpos"
+*                can be 0 if the block entry page was not read by the
+*                caller. Requests already queued or being fetched are
+*                dropped.
+*  Return value: 0 if queued or duplicated, -ENOSPC if the queue is full,
+*                or other negation of error code.
+*
+*************************************************************************/
+int32_t enqueue_prefetch_block(ino_t this_inode, int64_t block_no,
+			       int64_t seqnum, off_t page_start_fpos)
+{
+	PREFETCH_STRUCT_TYPE *job;
+	int32_t count, idx;
+
+	if (block_no < 0)
+		return -EINVAL;
+
+	sem_wait(&(prefetch_thread_ctl.ctl_op_sem));
+	if (prefetch_thread_ctl.terminating == TRUE) {
+		sem_post(&(prefetch_thread_ctl.ctl_op_sem));
+		return -ESHUTDOWN;
+	}
+
+	for (count = 0; count < MAX_PREFETCH_CONCURRENCY; count++) {
+		if (prefetch_thread_ctl.working_active[count] == FALSE)
+			continue;
+		if (_same_prefetch_job(&(prefetch_thread_ctl.working[count]),
+				this_inode, block_no, seqnum)) {
+			sem_post(&(prefetch_thread_ctl.ctl_op_sem));
+			return 0;
+		}
+	}
+	for (count = 0; count < prefetch_thread_ctl.num_queued; count++) {
+		idx = (prefetch_thread_ctl.queue_head + count) %
+			MAX_PREFETCH_QUEUE_LEN;
+		if (_same_prefetch_job(&(prefetch_thread_ctl.queue[idx]),
+				this_inode, block_no, seqnum)) {
+			sem_post(&(prefetch_thread_ctl.ctl_op_sem));
+			return 0;
+		}
+	}
+
+	if (prefetch_thread_ctl.num_queued >= MAX_PREFETCH_QUEUE_LEN) {
+		sem_post(&(prefetch_thread_ctl.ctl_op_sem));
+		return -ENOSPC;
+	}
+
+	idx = (prefetch_thread_ctl.queue_head +
+		prefetch_thread_ctl.num_queued) % MAX_PREFETCH_QUEUE_LEN;
+	job = &(prefetch_thread_ctl.queue[idx]);
+	job->this_inode = this_inode;
+	job->block_no = block_no;
+	job->seqnum = seqnum;
+	job->page_start_fpos = page_start_fpos;
+	job->entry_index = block_no % MAX_BLOCK_ENTRIES_PER_PAGE;
+	job->waiter = NULL;
+	prefetch_thread_ctl.num_queued++;
+	sem_post(&(prefetch_thread_ctl.ctl_op_sem));
+
+	sem_post(&(prefetch_thread_ctl.job_sem));
+	write_log(10, "Prefetching block %" PRId64 " for inode %" PRIu64 "\n",
+		  block_no, (uint64_t)this_inode);
+	return 0;
+}
+
+/************************************************************************
+*
+* Function name: enqueue_waited_fetch
+*        Inputs: ino_t this_inode, int64_t block_no, FETCH_WAIT_TYPE *waiter
+*       Summary: Queue a fetch of block "block_no" of "this_inode" that a
+*                reader waits for. The job is put before all prefetches,
+*                and a prefetch thread runs "waiter->fetch_fn", stores its
+*                return value in "waiter->ret" and posts "waiter->done".
+*                "done" should be initialized by the caller. The job is
+*                only queued if a prefetch thread is free to take it, so
+*                that the reader never waits behind running prefetches.
+*  Return value: 0 if queued, -EBUSY if all prefetch threads are busy,
+*                -ENOSPC if the queue is full, or other negation of error
+*                code. The caller should do the fetch itself if not queued.
+*
+*************************************************************************/
+int32_t enqueue_waited_fetch(ino_t this_inode, int64_t block_no,
+			     FETCH_WAIT_TYPE *waiter)
+{
+	PREFETCH_STRUCT_TYPE *job;
+	int32_t count, num_idle;
+
+	sem_wait(&(prefetch_thread_ctl.ctl_op_sem));
+	if (prefetch_thread_ctl.terminating == TRUE) {
+		sem_post(&(prefetch_thread_ctl.ctl_op_sem));
+		return -ESHUTDOWN;
+	}
+	if (prefetch_thread_ctl.num_queued >= MAX_PREFETCH_QUEUE_LEN) {
+		sem_post(&(prefetch_thread_ctl.ctl_op_sem));
+		return -ENOSPC;
+	}
+	num_idle = 0;
+	for (count = 0; count < MAX_PREFETCH_CONCURRENCY; count++)
+		if (prefetch_thread_ctl.working_active[count] == FALSE)
+			num_idle++;
+	if (prefetch_thread_ctl.num_waited_queued >= num_idle) {
+		sem_post(&(prefetch_thread_ctl.ctl_op_sem));
+		return -EBUSY;
+	}
+
+	prefetch_thread_ctl.queue_head = (prefetch_thread_ctl.queue_head +
+		MAX_PREFETCH_QUEUE_LEN - 1) % MAX_PREFETCH_QUEUE_LEN;
+	job = &(prefetch_thread_ctl.queue[prefetch_thread_ctl.queue_head]);
+	memset(job, 0, sizeof(PREFETCH_STRUCT_TYPE));
+	/* Prefetches of the same block are dropped meanwhile */
+	job->this_inode = this_inode;
+	job->block_no = block_no;
+	job->seqnum = PREFETCH_ANY_SEQNUM;
+	job->waiter = waiter;
+	prefetch_thread_ctl.num_queued++;
+	prefetch_thread_ctl.num_waited_queued++;
+	sem_post(&(prefetch_thread_ctl.ctl_op_sem));
+
+	sem_post(&(prefetch_thread_ctl.job_sem));
+	return 0;
+}
+
+/* Worker routine of prefetch threads. Take one job from the queue at a
+ * time and fetch it. The job is worked on in a private copy, and the
+ * copy in the working slot, which enqueue_prefetch_block scans for
+ * duplicates, is only changed under ctl_op_sem. */
+static void *_prefetch_worker(void *arg)
+{
+	int32_t slot;
+	PREFETCH_STRUCT_TYPE job;
+	PREFETCH_STRUCT_TYPE *working;
+
+	slot = *((int32_t *)arg);
+	free(arg);
+	working = &(prefetch_thread_ctl.working[slot]);
+
+	while (TRUE) {
+		sem_wait(&(prefetch_thread_ctl.job_sem));
+		sem_wait(&(prefetch_thread_ctl.ctl_op_sem));
+		if (prefetch_thread_ctl.terminating == TRUE) {
+			sem_post(&(prefetch_thread_ctl.ctl_op_sem));
+			break;
+		}
+		if (prefetch_thread_ctl.num_queued <= 0) {
+			sem_post(&(prefetch_thread_ctl.ctl_op_sem));
+			continue;
+		}
+		memcpy(&job, &(prefetch_thread_ctl.queue[
+			prefetch_thread_ctl.queue_head]),
+			sizeof(PREFETCH_STRUCT_TYPE));
+		prefetch_thread_ctl.queue_head =
+			(prefetch_thread_ctl.queue_head + 1) %
+			MAX_PREFETCH_QUEUE_LEN;
+		prefetch_thread_ctl.num_queued--;
+		if (job.waiter != NULL)
+			prefetch_thread_ctl.num_waited_queued--;
+		memcpy(working, &job, sizeof(PREFETCH_STRUCT_TYPE));
+		prefetch_thread_ctl.working_active[slot] = TRUE;
+		sem_post(&(prefetch_thread_ctl.ctl_op_sem));
+
+		if (job.waiter != NULL) {
+			job.waiter->ret = job.waiter->fetch_fn(
+					job.waiter->arg);
+			sem_post(&(job.waiter->done));
+		} else if ((hcfs_system->sync_paused == FALSE) &&
+		    (hcfs_system->system_going_down == FALSE) &&
+		    (_resolve_prefetch_job(&job) == 1)) {
+			/* Publish the resolved seqnum for dedup */
+			sem_wait(&(prefetch_thread_ctl.ctl_op_sem));
+			working->seqnum = job.seqnum;
+			working->page_start_fpos = job.page_start_fpos;
+			sem_post(&(prefetch_thread_ctl.ctl_op_sem));
+			prefetch_block(&job);
+		}
+
+		sem_wait(&(prefetch_thread_ctl.ctl_op_sem));
+		prefetch_thread_ctl.working_active[slot] = FALSE;
+		sem_post(&(prefetch_thread_ctl.ctl_op_sem));
+	}
+
+	return NULL;
+}
+
+int32_t init_prefetch_control(void)
+{
+	int32_t count, ret;
+	int32_t *slot;
+
+	memset(&prefetch_thread_ctl, 0, sizeof(PREFETCH_THREAD_CTL));
+	sem_init(&(prefetch_thread_ctl.ctl_op_sem), 0, 1);
+	sem_init(&(prefetch_thread_ctl.job_sem), 0, 0);
+
+	for (count = 0; count < MAX_PREFETCH_CONCURRENCY; count++) {
+		slot = malloc(sizeof(int32_t));
+		if (slot == NULL)
+			return -ENOMEM;
+		*slot = count;
+		ret = pthread_create(&(prefetch_thread_ctl.pf_thread[count]),
+				NULL, &_prefetch_worker, (void *)slot);
+		if (ret != 0) {
+			write_log(0, "Error: Fail to create prefetch thread. "
+				  "Code %d\n", ret);
+			free(slot);
+			return -ret;
+		}
+	}
+
+	write_log(5, "Init prefetch thread control\n");
+	return 0;
+}
+
+int32_t destroy_prefetch_control(void)
+{
+	int32_t count, idx;
+	FETCH_WAIT_TYPE *waiter;
+
+	sem_wait(&(prefetch_thread_ctl.ctl_op_sem));
+	prefetch_thread_ctl.terminating = TRUE;
+	sem_post(&(prefetch_thread_ctl.ctl_op_sem));
+
+	for (count = 0; count < MAX_PREFETCH_CONCURRENCY; count++)
+		sem_post(&(prefetch_thread_ctl.job_sem));
+	for (count = 0; count < MAX_PREFETCH_CONCURRENCY; count++)
+		pthread_join(prefetch_thread_ctl.pf_thread[count], NULL);
+
+	/* Readers still waiting on queued fetches are failed */
+	for (count = 0; count < prefetch_thread_ctl.num_queued; count++) {
+		idx = (prefetch_thread_ctl.queue_head + count) %
+			MAX_PREFETCH_QUEUE_LEN;
+		waiter = prefetch_thread_ctl.queue[idx].waiter;
+		if (waiter == NULL)
+			continue;
+		waiter->ret = -ESHUTDOWN;
+		sem_post(&(waiter->done));
+	}
+	prefetch_thread_ctl.num_queued = 0;
+	prefetch_thread_ctl.num_waited_queued = 0;
+
+	sem_destroy(&(prefetch_thread_ctl.ctl_op_sem));
+	sem_destroy(&(prefetch_thread_ctl.job_sem));
+	write_log(5, "Terminate prefetch threads\n");
+	return 0;
 }
 
 int32_t init_download_control()
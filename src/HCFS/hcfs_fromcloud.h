@@ -38,20 +38,51 @@
 
 #define MAX_PIN_DL_CONCURRENCY ((MAX_DOWNLOAD_CURL_HANDLE) / 2)
 
+/* Prefetch workers never take more than a quarter of the download handles,
+ * so demand reads in read_fetch_backend always have handles to use. */
+#define MAX_PREFETCH_CONCURRENCY ((MAX_DOWNLOAD_CURL_HANDLE) / 4)
+#define MAX_PREFETCH_QUEUE_LEN 64
+#define MAX_PREFETCH_DEPTH 8
+#define PREFETCH_ANY_SEQNUM -1
+
 /* Download action type */
 #define READ_BLOCK 0 /* Read block. High priority */
 #define PIN_BLOCK 1 /* Pin a block */
 #define FETCH_FILE_META 2 /* Download meta file by sync thread */
 #define RESTORE_FETCH_OBJ 3 /* Download object in restoring mode */
 
+/* A fetch run by prefetch threads for a reader, who waits on "done" for
+ * the return value of "fetch_fn" */
+typedef struct {
+	int32_t (*fetch_fn)(void *arg);
+	void *arg;
+	int32_t ret;
+	sem_t done;
+} FETCH_WAIT_TYPE;
+
 typedef struct {
 	ino_t this_inode;
 	int64_t block_no;
-	int64_t seqnum;
-	off_t page_start_fpos;
+	int64_t seqnum; /* PREFETCH_ANY_SEQNUM if not known yet */
+	off_t page_start_fpos; /* 0 if page is not resolved yet */
 	int32_t entry_index;
+	FETCH_WAIT_TYPE *waiter; /* NULL if this is a prefetch */
 } PREFETCH_STRUCT_TYPE;
 
+typedef struct {
+	sem_t ctl_op_sem; /* Protect queue and working slots */
+	sem_t job_sem; /* Number of queued prefetch jobs */
+	pthread_t pf_thread[MAX_PREFETCH_CONCURRENCY];
+	PREFETCH_STRUCT_TYPE queue[MAX_PREFETCH_QUEUE_LEN];
+	int32_t queue_head;
+	int32_t num_queued;
+	int32_t num_waited_queued; /* Queued jobs with a waiter */
+	/* Jobs being processed, kept for dedup of new requests */
+	PREFETCH_STRUCT_TYPE working[MAX_PREFETCH_CONCURRENCY];
+	BOOL working_active[MAX_PREFETCH_CONCURRENCY];
+	BOOL terminating;
+} PREFETCH_THREAD_CTL;
+
 typedef struct {
 	ino_t this_inode;
 	int64_t block_no;
@@ -80,8 +111,14 @@ typedef struct {
 
 DOWNLOAD_USERMETA_CTL download_usermeta_ctl;
 DOWNLOAD_THREAD_CTL download_thread_ctl;
-pthread_attr_t prefetch_thread_attr;
+PREFETCH_THREAD_CTL prefetch_thread_ctl;
 void prefetch_block(PREFETCH_STRUCT_TYPE *ptr);
+int32_t enqueue_prefetch_block(ino_t this_inode, int64_t block_no,
+			       int64_t seqnum, off_t page_start_fpos);
+int32_t enqueue_waited_fetch(ino_t this_inode, int64_t block_no,
+			     FETCH_WAIT_TYPE *waiter);
+int32_t init_prefetch_control(void);
+int32_t destroy_prefetch_control(void);
 int32_t fetch_from_cloud(FILE *fptr,
 			 char action_from,
 			 char *objname,
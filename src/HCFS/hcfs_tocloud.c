@@ -59,6 +59,7 @@ TODO: Cleanup temp files in /dev/shm at system startup
 #include "macro.h"
 #include "metaops.h"
 #include "dedup_table.h"
+#include "obj_fingerprint.h"
 #include "utils.h"
 #include "atomic_tocloud.h"
 #include "hfuse_system.h"
@@ -72,6 +73,7 @@ TODO: Cleanup temp files in /dev/shm at system startup
 #include "recover_super_block.h"
 #include "pthread_control.h"
 #include "backend_generic.h"
+#include "dirty_queue.h"
 
 #define BLK_INCREMENTS MAX_BLOCK_ENTRIES_PER_PAGE
 
@@ -126,6 +128,76 @@ errcode_handle:
 	return errcode;
 }
 
+/* Return a queue token of a finished transfer, unless the token has to be
+taken back because the concurrency limit was lowered */
+static inline void _release_upload_token(void)
+{
+	if (xfer_concurrency_take_back(&(upload_ctl.concurrency)) == FALSE)
+		sem_post(&(upload_ctl.upload_queue_sem));
+}
+
+static inline void _release_sync_token(void)
+{
+	if (xfer_concurrency_take_back(&(sync_ctl.concurrency)) == FALSE)
+		sem_post(&(sync_ctl.sync_queue_sem));
+}
+
+/* Reclaim an upload thread slot. Caller should lock upload_op_sem. */
+static inline void _release_upload_slot(int32_t index)
+{
+	upload_ctl.threads_in_use[index] = FALSE;
+	upload_ctl.threads_created[index] = FALSE;
+	upload_ctl.threads_finished[index] = FALSE;
+	upload_ctl.total_active_upload_threads--;
+	upload_ctl.free_slots[upload_ctl.num_free_slots++] = index;
+	_release_upload_token();
+}
+
+/**
+ * Feed the result of an upload to the concurrency control.
+ *
+ * Upload concurrency is adjusted according to measured throughput, latency
+ * and error rate. Sync concurrency follows half of upload concurrency, as
+ * each syncing inode keeps at least one upload busy for its meta. The
+ * result is published to hcfs_system for GETXFERSTAT.
+ *
+ * @param xfer_size Bytes uploaded.
+ * @param start Monotonic time when the upload began.
+ * @param success Whether the upload succeeded.
+ */
+static void _record_upload_result(int64_t xfer_size,
+				  const struct timespec *start, BOOL success)
+{
+	struct timespec now;
+	int64_t latency_ms, throughput;
+	int32_t num_tokens, upload_limit, sync_limit;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	latency_ms = (now.tv_sec - start->tv_sec) * 1000 +
+		     (now.tv_nsec - start->tv_nsec) / 1000000;
+	num_tokens = xfer_concurrency_record(&(upload_ctl.concurrency),
+					     xfer_size, latency_ms, success,
+					     &now);
+	for (; num_tokens > 0; num_tokens--)
+		sem_post(&(upload_ctl.upload_queue_sem));
+
+	xfer_concurrency_get_stat(&(upload_ctl.concurrency), &upload_limit,
+				  &throughput, &latency_ms);
+	num_tokens = xfer_concurrency_set_limit(&(sync_ctl.concurrency),
+						upload_limit / 2);
+	for (; num_tokens > 0; num_tokens--)
+		sem_post(&(sync_ctl.sync_queue_sem));
+	xfer_concurrency_get_stat(&(sync_ctl.concurrency), &sync_limit,
+				  NULL, NULL);
+
+	sem_wait(&(hcfs_system->access_sem));
+	hcfs_system->xfer_concurrency_stat.upload_concurrency = upload_limit;
+	hcfs_system->xfer_concurrency_stat.sync_concurrency = sync_limit;
+	hcfs_system->xfer_concurrency_stat.upload_throughput = throughput;
+	hcfs_system->xfer_concurrency_stat.upload_latency_ms = latency_ms;
+	sem_post(&(hcfs_system->access_sem));
+}
+
 static inline int32_t _set_inode_sync_error(ino_t inode)
 {
 	int32_t count1;
@@ -334,9 +406,10 @@ static inline void _sync_terminate_thread(int32_t index)
 			sync_ctl.threads_error[index] = FALSE;
 			sync_ctl.is_revert[index] = FALSE;
 			sync_ctl.total_active_sync_threads--;
+			sync_ctl.free_slots[sync_ctl.num_free_slots++] = index;
 			sem_check_and_release(&(hcfs_system->sync_wait_sem),
 			                      &sync_status);
-			sem_post(&(sync_ctl.sync_queue_sem));
+			_release_sync_token();
 		}
 	}
 }
@@ -449,11 +522,7 @@ static inline int32_t _upload_terminate_thread(int32_t index)
 		}
 
 		/* Do NOT need to lock upload_op_sem. It is locked by caller. */
-		upload_ctl.threads_in_use[index] = FALSE;
-		upload_ctl.threads_created[index] = FALSE;
-		upload_ctl.threads_finished[index] = FALSE;
-		upload_ctl.total_active_upload_threads--;
-		sem_post(&(upload_ctl.upload_queue_sem));
+		_release_upload_slot(index);
 
 		return 0;
 	}
@@ -470,12 +539,7 @@ static inline int32_t _upload_terminate_thread(int32_t index)
 		if (sync_ctl.threads_error[count1] == TRUE) {
 			sem_post(&(sync_ctl.sync_op_sem));
 
-			upload_ctl.threads_in_use[index] = FALSE;
-			upload_ctl.threads_created[index] = FALSE;
-			upload_ctl.threads_finished[index] = FALSE;
-			upload_ctl.total_active_upload_threads--;
-
-			sem_post(&(upload_ctl.upload_queue_sem));
+			_release_upload_slot(index);
 			return 0; /* Error already marked */
 		}
 	}
@@ -518,7 +582,7 @@ static inline int32_t _upload_terminate_thread(int32_t index)
 		blk_obj_id, NULL, &finish_uploading);
 
 #else
-	if (CURRENT_BACKEND != GOOGLEDRIVE)
+	if (!BLOCK_ID_IS_RECORDED)
 		blockid = NULL;
 	/* TODO: Remove this? */
 	if (blockid) {
@@ -577,11 +641,7 @@ static inline int32_t _upload_terminate_thread(int32_t index)
 #endif */
 
 	/* Finally reclaim the uploaded-thread. */
-	upload_ctl.threads_in_use[index] = FALSE;
-	upload_ctl.threads_created[index] = FALSE;
-	upload_ctl.threads_finished[index] = FALSE;
-	upload_ctl.total_active_upload_threads--;
-	sem_post(&(upload_ctl.upload_queue_sem));
+	_release_upload_slot(index);
 
 	return 0;
 
@@ -624,11 +684,7 @@ void collect_finished_upload_threads(void *ptr)
 			/* Reset uploaded flag for upload thread */
 			upload_ctl.upload_threads[count].is_upload = FALSE;
 #endif
-			upload_ctl.threads_in_use[count] = FALSE;
-			upload_ctl.threads_created[count] = FALSE;
-			upload_ctl.threads_finished[count] = FALSE;
-			upload_ctl.total_active_upload_threads--;
-			sem_post(&(upload_ctl.upload_queue_sem));
+			_release_upload_slot(count);
 		}
 
 		sem_post(&(upload_ctl.upload_op_sem));
@@ -643,7 +699,9 @@ void init_sync_control(void)
 
 	memset(&sync_ctl, 0, sizeof(SYNC_THREAD_CONTROL));
 	sem_init(&(sync_ctl.sync_op_sem), 0, 1);
-	sem_init(&(sync_ctl.sync_queue_sem), 0, MAX_SYNC_CONCURRENCY);
+	init_xfer_concurrency(&(sync_ctl.concurrency), MIN_SYNC_CONCURRENCY,
+			      MAX_SYNC_CONCURRENCY, INIT_UPLOAD_CONCURRENCY / 2);
+	sem_init(&(sync_ctl.sync_queue_sem), 0, sync_ctl.concurrency.limit);
 	sem_init(&(sync_ctl.sync_finished_sem), 0, 0);
 	memset(&(sync_ctl.threads_in_use), 0,
 	       sizeof(ino_t) * MAX_SYNC_CONCURRENCY);
@@ -652,6 +710,10 @@ void init_sync_control(void)
 	memset(&(sync_ctl.threads_finished), 0,
 	       sizeof(char) * MAX_SYNC_CONCURRENCY);
 	sync_ctl.total_active_sync_threads = 0;
+	/* Slot 0 is on top of the stack */
+	for (count = 0; count < MAX_SYNC_CONCURRENCY; count++)
+		sync_ctl.free_slots[count] = MAX_SYNC_CONCURRENCY - count - 1;
+	sync_ctl.num_free_slots = MAX_SYNC_CONCURRENCY;
 	sync_ctl.retry_list.list_size = MAX_SYNC_CONCURRENCY;
 	sync_ctl.retry_list.num_retry = 0;
 	sync_ctl.retry_list.retry_inode = (ino_t *)
@@ -697,7 +759,10 @@ void init_upload_control(void)
 	}
 
 	sem_init(&(upload_ctl.upload_op_sem), 0, 1);
-	sem_init(&(upload_ctl.upload_queue_sem), 0, MAX_UPLOAD_CONCURRENCY);
+	init_xfer_concurrency(&(upload_ctl.concurrency), MIN_UPLOAD_CONCURRENCY,
+			      MAX_UPLOAD_CONCURRENCY, INIT_UPLOAD_CONCURRENCY);
+	sem_init(&(upload_ctl.upload_queue_sem), 0,
+		 upload_ctl.concurrency.limit);
 	sem_init(&(upload_ctl.upload_finished_sem), 0, 0);
 	memset(&(upload_ctl.threads_in_use), 0,
 	       sizeof(char) * MAX_UPLOAD_CONCURRENCY);
@@ -706,6 +771,10 @@ void init_upload_control(void)
 	memset(&(upload_ctl.threads_finished), 0,
 	       sizeof(char) * MAX_UPLOAD_CONCURRENCY);
 	upload_ctl.total_active_upload_threads = 0;
+	for (count = 0; count < MAX_UPLOAD_CONCURRENCY; count++)
+		upload_ctl.free_slots[count] =
+		    MAX_UPLOAD_CONCURRENCY - count - 1;
+	upload_ctl.num_free_slots = MAX_UPLOAD_CONCURRENCY;
 	PTHREAD_REUSE_set_exithandler();
 
 	pthread_create(&(upload_ctl.upload_handler_thread), NULL,
@@ -772,7 +841,8 @@ errcode_handle:
 /**
  * select_upload_thread()
  *
- * Select an appropriate thread to upload/delete a block or meta.
+ * Select an appropriate thread to upload/delete a block or meta. Caller
+ * should hold a token of upload_queue_sem and lock upload_op_sem.
  *
  * @return usable curl index
  */ 
@@ -786,43 +856,37 @@ int32_t select_upload_thread(BOOL is_block, BOOL is_delete,
 				int64_t e_index, int32_t progress_fd,
 				char backend_delete_type)
 {
-	int32_t which_curl, count;
+	int32_t count;
 
-	which_curl = -1;
-	for (count = 0; count < MAX_UPLOAD_CONCURRENCY; count++) {
-		if (upload_ctl.threads_in_use[count] == FALSE) {
-			upload_ctl.threads_in_use[count] = TRUE;
-			upload_ctl.threads_created[count] = FALSE;
-			upload_ctl.threads_finished[count] = FALSE;
-			upload_ctl.upload_threads[count].is_block = is_block;
-			upload_ctl.upload_threads[count].is_delete = is_delete;
-			upload_ctl.upload_threads[count].inode = this_inode;
-			upload_ctl.upload_threads[count].blockno = block_count;
-			upload_ctl.upload_threads[count].seq = seq;
-			upload_ctl.upload_threads[count].progress_fd =
-								progress_fd;
-			upload_ctl.upload_threads[count].page_filepos =
-			    page_pos;
-			upload_ctl.upload_threads[count].page_entry_index =
-			    e_index;
-			upload_ctl.upload_threads[count].which_curl = count;
-			upload_ctl.upload_threads[count].backend_delete_type =
-							backend_delete_type;
-			upload_ctl.upload_threads[count].which_index = count;
+	/* Should not happen as slots are bounded by upload_queue_sem */
+	if (upload_ctl.num_free_slots <= 0)
+		return -1;
+	count = upload_ctl.free_slots[--upload_ctl.num_free_slots];
+	upload_ctl.threads_in_use[count] = TRUE;
+	upload_ctl.threads_created[count] = FALSE;
+	upload_ctl.threads_finished[count] = FALSE;
+	upload_ctl.upload_threads[count].is_block = is_block;
+	upload_ctl.upload_threads[count].is_delete = is_delete;
+	upload_ctl.upload_threads[count].inode = this_inode;
+	upload_ctl.upload_threads[count].blockno = block_count;
+	upload_ctl.upload_threads[count].seq = seq;
+	upload_ctl.upload_threads[count].progress_fd = progress_fd;
+	upload_ctl.upload_threads[count].page_filepos = page_pos;
+	upload_ctl.upload_threads[count].page_entry_index = e_index;
+	upload_ctl.upload_threads[count].which_curl = count;
+	upload_ctl.upload_threads[count].backend_delete_type =
+	    backend_delete_type;
+	upload_ctl.upload_threads[count].which_index = count;
 #if ENABLE(DEDUP)
-			upload_ctl.upload_threads[count].is_upload = is_upload;
-			if (is_upload == TRUE) {
-				memcpy(upload_ctl.upload_threads[count].obj_id,
-				       old_obj_id, OBJID_LENGTH);
-			}
+	upload_ctl.upload_threads[count].is_upload = is_upload;
+	if (is_upload == TRUE) {
+		memcpy(upload_ctl.upload_threads[count].obj_id,
+		       old_obj_id, OBJID_LENGTH);
+	}
 #endif
 
-			upload_ctl.total_active_upload_threads++;
-			which_curl = count;
-			break;
-		}
-	}
-	return which_curl;
+	upload_ctl.total_active_upload_threads++;
+	return count;
 }
 
 /**
@@ -1468,12 +1532,8 @@ store in some other file */
 		}
 
 		sem_wait(&(upload_ctl.upload_op_sem));
-		upload_ctl.threads_in_use[which_curl] = FALSE;
-		upload_ctl.threads_created[which_curl] = FALSE;
-		upload_ctl.threads_finished[which_curl] = FALSE;
-		upload_ctl.total_active_upload_threads--;
+		_release_upload_slot(which_curl);
 		sem_post(&(upload_ctl.upload_op_sem));
-		sem_post(&(upload_ctl.upload_queue_sem));
 
 		if (sync_error == FALSE) {
 			/* Check the error in sync_thread */
@@ -1486,12 +1546,8 @@ store in some other file */
 		fclose(toupload_metafptr);
 
 		sem_wait(&(upload_ctl.upload_op_sem));
-		upload_ctl.threads_in_use[which_curl] = FALSE;
-		upload_ctl.threads_created[which_curl] = FALSE;
-		upload_ctl.threads_finished[which_curl] = FALSE;
-		upload_ctl.total_active_upload_threads--;
+		_release_upload_slot(which_curl);
 		sem_post(&(upload_ctl.upload_op_sem));
-		sem_post(&(upload_ctl.upload_queue_sem));
 
 		/* Delete those uploaded blocks if local meta is removed */
 		if (S_ISREG(ptr->this_mode))
@@ -1587,12 +1643,8 @@ store in some other file */
 errcode_handle:
 	if (cleanup_meta == TRUE) {
 		sem_wait(&(upload_ctl.upload_op_sem));
-		upload_ctl.threads_in_use[which_curl] = FALSE;
-		upload_ctl.threads_created[which_curl] = FALSE;
-		upload_ctl.threads_finished[which_curl] = FALSE;
-		upload_ctl.total_active_upload_threads--;
+		_release_upload_slot(which_curl);
 		sem_post(&(upload_ctl.upload_op_sem));
-		sem_post(&(upload_ctl.upload_queue_sem));
 	}
 
 	flock(fileno(local_metafptr), LOCK_UN);
@@ -1627,8 +1679,6 @@ int32_t do_block_sync(ino_t this_inode, int64_t block_no,
 	char obj_id_str[OBJID_STRING_LENGTH];
 	uint8_t old_obj_id[OBJID_LENGTH];
 	uint8_t obj_id[OBJID_LENGTH];
-	uint8_t start_bytes[BYTES_TO_CHECK];
-	uint8_t end_bytes[BYTES_TO_CHECK];
 	off_t obj_size;
 	FILE *ddt_fptr;
 	DDT_BTREE_NODE tree_root;
@@ -1648,9 +1698,13 @@ int32_t do_block_sync(ino_t this_inode, int64_t block_no,
 	}
 
 #if ENABLE(DEDUP)
-	/* Compute hash of block */
-	get_obj_id(filename, obj_id, start_bytes, end_bytes, &obj_size);
-	/* compute_hash(filename, hash_key); */
+	/* Compute obj_id of block from the file opened for upload. The
+	file offset is kept, so the upload reads it from the start. */
+	ret = fingerprint_fd(fileno(fptr), obj_id, &obj_size);
+	if (ret < 0) {
+		fclose(fptr);
+		return ret;
+	}
 
 	/* Get dedup table meta */
 	ddt_fptr = get_ddt_btree_meta(obj_id, &tree_root, &ddt_meta);
@@ -1663,9 +1717,6 @@ int32_t do_block_sync(ino_t this_inode, int64_t block_no,
 
 	/* Copy new obj_id and reserve old one */
 	memcpy(old_obj_id, id_in_meta, OBJID_LENGTH);
-	memcpy(&(obj_id[SHA256_DIGEST_LENGTH]), start_bytes, BYTES_TO_CHECK);
-	memcpy(&(obj_id[SHA256_DIGEST_LENGTH + BYTES_TO_CHECK]), end_bytes,
-	       BYTES_TO_CHECK);
 	memcpy(id_in_meta, obj_id, OBJID_LENGTH);
 
 	/* Check if upload is needed */
@@ -1734,8 +1785,10 @@ int32_t do_block_sync(ino_t this_inode, int64_t block_no,
 		FILE *new_fptr = transform_fd(fptr, object_key, &data,
 					      ENABLE_ENCRYPT, ENABLE_COMPRESS);
 		write_log(10, "start to put..\n");
-		ret_val = hcfs_put_object(new_fptr, objname, curl_handle,
-					  http_meta, gdrive_info);
+		/* Large blocks are sent in parts on Swift and S3 */
+		ret_val = hcfs_put_multipart_object(new_fptr, objname,
+						    curl_handle, http_meta,
+						    gdrive_info);
 
 		fclose(new_fptr);
 		if (object_key != NULL)
@@ -1836,6 +1889,7 @@ void con_object_sync(UPLOAD_THREAD_TYPE *thread_ptr)
 	int32_t which_curl, ret, errcode, which_index = 0;
 	char local_metapath[300];
 	struct stat filestat; /* raw file ops */
+	struct timespec start_time;
 	int64_t filesize;
 
 	filesize = 0;
@@ -1851,6 +1905,7 @@ void con_object_sync(UPLOAD_THREAD_TYPE *thread_ptr)
 
 	which_curl = thread_ptr->which_curl;
 	which_index = thread_ptr->which_index;
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
 	if (thread_ptr->is_block == TRUE) {
 #if ENABLE(DEDUP)
 		/* Get old object id (object id on cloud) */
@@ -1884,6 +1939,12 @@ void con_object_sync(UPLOAD_THREAD_TYPE *thread_ptr)
 				&(thread_ptr->gdrive_obj_info));
 	}
 
+	/* Only transfers with backend count. Local errors say nothing
+	 * about the network */
+	if ((ret == 0) || (ret == -ENOTCONN))
+		_record_upload_result(filestat.st_size, &start_time,
+				      (ret == 0) ? TRUE : FALSE);
+
 	if (ret < 0) {
 		write_log(6, "error code %d in %s", ret, __func__);
 		goto errcode_handle;
@@ -2044,12 +2105,8 @@ errcode_handle:
 #if ENABLE(DEDUP)
 	upload_ctl.upload_threads[count].is_upload = FALSE;
 #endif
-	upload_ctl.threads_in_use[which_curl] = FALSE;
-	upload_ctl.threads_created[which_curl] = FALSE;
-	upload_ctl.threads_finished[which_curl] = FALSE;
-	upload_ctl.total_active_upload_threads--;
+	_release_upload_slot(which_curl);
 	sem_post(&(upload_ctl.upload_op_sem));
-	sem_post(&(upload_ctl.upload_queue_sem));
 	return errcode;
 }
 
@@ -2068,8 +2125,8 @@ void dispatch_delete_block(int32_t which_curl)
  * to upload data of "this_inode". sync_single_inode() is main function for
  * uploading a inode.
  *
- * @return thread index when succeeding in starting uploading.
- *         Otherwise return -1.
+ * @return 0 when succeeding in starting uploading. Otherwise negative
+ *         error code.
  */
 static inline int32_t _sync_mark(ino_t this_inode, mode_t this_mode,
 			     SYNC_THREAD_TYPE *sync_threads)
@@ -2078,76 +2135,66 @@ static inline int32_t _sync_mark(ino_t this_inode, mode_t this_mode,
 	int32_t progress_fd;
 	char progress_file_path[300];
 
-	ret = 0;
-
-	for (count = 0; count < MAX_SYNC_CONCURRENCY; count++) {
-		if (sync_ctl.threads_in_use[count] == 0) {
-			/* Open progress file. If it exist, then revert
-			uploading. Otherwise open a new progress file */
-			fetch_progress_file_path(progress_file_path,
-				this_inode);
-			if (access(progress_file_path, F_OK) == 0) {
-				progress_fd = open(progress_file_path, O_RDWR);
-				if (progress_fd < 0) {
-					ret = -errno;
-					break;
-				}
-				sync_ctl.is_revert[count] = TRUE;
-				sync_threads[count].is_revert = TRUE;
-			} else {
-				progress_fd = create_progress_file(this_inode);
-				if (progress_fd < 0) {
-					ret = -1;
-					break;
-				}
-				sync_ctl.is_revert[count] = FALSE;
-				sync_threads[count].is_revert = FALSE;
-			}
-
-			/* Notify fuse process that it is going to upload */
-			ret = comm2fuseproc(this_inode, TRUE,
-					progress_fd, sync_ctl.is_revert[count],
-					FALSE);
-			if (ret < 0) {
-				write_log(2, "Fail to tagging inode %lld as "
-					"UPLOADING.\n", this_inode);
-				del_progress_file(progress_fd, this_inode);
-				break;
-			}
-			/* Prepare data */
-			sync_ctl.threads_in_use[count] = this_inode;
-			sync_ctl.threads_created[count] = FALSE;
-			sync_ctl.threads_finished[count] = FALSE;
-			sync_ctl.threads_error[count] = FALSE;
-			sync_ctl.continue_nexttime[count] = FALSE;
-			sync_ctl.progress_fd[count] = progress_fd;
-			sync_threads[count].inode = this_inode;
-			sync_threads[count].this_mode = this_mode;
-			sync_threads[count].progress_fd = progress_fd;
-			sync_threads[count].which_index = count;
-
-			write_log(10, "Before syncing: inode %" PRIu64
-				      ", mode %d\n",
-				  (uint64_t)sync_threads[count].inode,
-				  sync_threads[count].this_mode);
-
-			if (sync_ctl.is_revert[count] == TRUE)
-				PTHREAD_REUSE_run(
-					&(sync_ctl.inode_sync_thread[count]),
-					(void *)&continue_inode_sync,
-					(void *)&(sync_threads[count]));
-			else
-				PTHREAD_REUSE_run(
-					&(sync_ctl.inode_sync_thread[count]),
-					(void *)&sync_single_inode,
-					(void *)&(sync_threads[count]));
-			sync_ctl.threads_created[count] = TRUE;
-			sync_ctl.total_active_sync_threads++;
-			break;
-		}
+	if (sync_ctl.num_free_slots <= 0)
+		return -EBUSY;
+	/* Take the slot only after the inode is tagged as uploading */
+	count = sync_ctl.free_slots[sync_ctl.num_free_slots - 1];
+
+	/* Open progress file. If it exist, then revert
+	uploading. Otherwise open a new progress file */
+	fetch_progress_file_path(progress_file_path, this_inode);
+	if (access(progress_file_path, F_OK) == 0) {
+		progress_fd = open(progress_file_path, O_RDWR);
+		if (progress_fd < 0)
+			return -errno;
+		sync_ctl.is_revert[count] = TRUE;
+		sync_threads[count].is_revert = TRUE;
+	} else {
+		progress_fd = create_progress_file(this_inode);
+		if (progress_fd < 0)
+			return -1;
+		sync_ctl.is_revert[count] = FALSE;
+		sync_threads[count].is_revert = FALSE;
 	}
 
-	return ret;
+	/* Notify fuse process that it is going to upload */
+	ret = comm2fuseproc(this_inode, TRUE, progress_fd,
+			    sync_ctl.is_revert[count], FALSE);
+	if (ret < 0) {
+		write_log(2, "Fail to tagging inode %lld as "
+			"UPLOADING.\n", this_inode);
+		del_progress_file(progress_fd, this_inode);
+		return ret;
+	}
+	/* Prepare data */
+	sync_ctl.num_free_slots--;
+	sync_ctl.threads_in_use[count] = this_inode;
+	sync_ctl.threads_created[count] = FALSE;
+	sync_ctl.threads_finished[count] = FALSE;
+	sync_ctl.threads_error[count] = FALSE;
+	sync_ctl.continue_nexttime[count] = FALSE;
+	sync_ctl.progress_fd[count] = progress_fd;
+	sync_threads[count].inode = this_inode;
+	sync_threads[count].this_mode = this_mode;
+	sync_threads[count].progress_fd = progress_fd;
+	sync_threads[count].which_index = count;
+
+	write_log(10, "Before syncing: inode %" PRIu64 ", mode %d\n",
+		  (uint64_t)sync_threads[count].inode,
+		  sync_threads[count].this_mode);
+
+	if (sync_ctl.is_revert[count] == TRUE)
+		PTHREAD_REUSE_run(&(sync_ctl.inode_sync_thread[count]),
+				  (void *)&continue_inode_sync,
+				  (void *)&(sync_threads[count]));
+	else
+		PTHREAD_REUSE_run(&(sync_ctl.inode_sync_thread[count]),
+				  (void *)&sync_single_inode,
+				  (void *)&(sync_threads[count]));
+	sync_ctl.threads_created[count] = TRUE;
+	sync_ctl.total_active_sync_threads++;
+
+	return 0;
 }
 
 static inline void _write_upload_loop_status_log(char *sync_paused_status)
@@ -2296,7 +2343,7 @@ void upload_loop(void)
 				break;
 
 			/* Avoid busy polling */
-			if (sys_super_block->head.num_dirty <=
+			if (SB_HEAD_COUNTER(num_dirty) <=
 			    sync_ctl.total_active_sync_threads) {
 				sem_wait(&(hcfs_system->sync_wait_sem));
 				if (hcfs_system->system_going_down == TRUE)
@@ -2318,6 +2365,7 @@ void upload_loop(void)
 				              &nonbusy_pause_time);
 
 			ino_check = 0;
+			reset_dirty_queues();
 			consecutive_skips = FALSE;
 			skip_everyone = TRUE;
 			shortest_wait = NORMAL_UPLOAD_DELAY;
@@ -2366,19 +2414,16 @@ void upload_loop(void)
 		retry_inode = pull_retry_inode(&(sync_ctl.retry_list));
 		sem_post(&(sync_ctl.sync_op_sem));
 
-		super_block_exclusive_locking();
 		if (retry_inode > 0) { /* Retried inode has higher priority */
 			ino_check = retry_inode;
 			write_log(6, "Info: Retry to sync inode %"PRIu64,
 					(uint64_t)ino_check);
 		} else {
-			if (ino_check == 0) {
-				ino_check =
-					sys_super_block->head.first_dirty_inode;
-				write_log(10, "Debug: first dirty inode"
-					" is inode %"PRIu64,
-					(uint64_t)ino_check);
-			}
+			/* Pick by priority class among the dirty inodes not
+			picked yet in this round */
+			ino_check = dirty_queue_next();
+			write_log(10, "Debug: next dirty inode is inode %"
+				PRIu64"\n", (uint64_t)ino_check);
 		}
 
 		ino_sync = 0;
@@ -2386,34 +2431,24 @@ void upload_loop(void)
 			ino_sync = ino_check;
 
 /* FEATURE TODO: double check that super block entry will be reconstructed here */
-			ret_val = read_super_block_entry(ino_sync, &tempentry);
+			/* TODO: Revert in_transit inode after crashing. (Maybe
+			in superblock?) */
+			ret_val = super_block_start_transit(ino_sync,
+							    &tempentry);
 			if ((ret_val < 0) || (tempentry.status != IS_DIRTY)) {
+				/* Inode was synced or removed after it was
+				queued. This is expected, so skip it quietly */
 				if (ret_val == 0)
-					write_log(4, "Warn: Status of inode %"
-						PRIu64" is %d",
+					write_log(10, "Debug: Skip inode %"
+						PRIu64" of status %d\n",
 						(uint64_t)ino_sync,
 						tempentry.status);
 				ino_sync = 0;
-				ino_check = 0;
 			} else {
-				if (tempentry.in_transit == TRUE) {
-					/* TODO: Revert in_transit inode after
-					crashing. (Maybe in superblock?) */
-					ino_check = tempentry.util_ll_next;
-				} else {
-					tempentry.in_transit = TRUE;
-					tempentry.mod_after_in_transit = FALSE;
-					ino_check = tempentry.util_ll_next;
-					ret = write_super_block_entry(
-					    ino_sync, &tempentry);
-					if (ret < 0)
-						ino_sync = 0;
-				}
 				/* Fetch the timestamp for the last sync */
 				last_synctime = tempentry.lastsync_time;
 			}
 		}
-		super_block_exclusive_release();
 		write_log(10, "%lld, %lld, %d, %llu, %llu\n",
 		          hcfs_system->systemdata.unpin_dirty_data_size,
 			hcfs_system->systemdata.pinned_size,
@@ -2495,7 +2530,7 @@ void upload_loop(void)
 					if (ret < 0) {
 						ino_check = 0;
 					}
-					sem_post(&(sync_ctl.sync_queue_sem));
+					_release_sync_token();
 					sem_post(&(sync_ctl.sync_op_sem));
 				} else {
 					sem_post(&(sync_ctl.sync_op_sem));
@@ -2503,10 +2538,10 @@ void upload_loop(void)
 			} else {  /*If already syncing to cloud*/
 
 				sem_post(&(sync_ctl.sync_op_sem));
-				sem_post(&(sync_ctl.sync_queue_sem));
+				_release_sync_token();
 			}
 		} else {
-			sem_post(&(sync_ctl.sync_queue_sem));
+			_release_sync_token();
 		}
 		write_log(10, "Next inode to check is %" PRIu64 "\n",
 		          (uint64_t) ino_check);
@@ -34,9 +34,12 @@
 #include "tocloud_tools.h"
 #include "googledrive_curl.h"
 #include "pthread_control.h"
+#include "xfer_concurrency.h"
 
-#define MAX_UPLOAD_CONCURRENCY 16
-#define MAX_SYNC_CONCURRENCY 8
+/* Number of thread slots. The slots in use are bounded by the adaptive
+limits in upload_ctl.concurrency and sync_ctl.concurrency */
+#define MAX_UPLOAD_CONCURRENCY 32
+#define MAX_SYNC_CONCURRENCY 16
 
 typedef struct {
 	BOOL have_new_pkgbackup;
@@ -80,7 +83,7 @@ typedef struct {
 } SYNC_THREAD_TYPE;
 
 typedef struct {
-	/*Initialize this to MAX_UPLOAD_CONCURRENCY. Decrease when
+	/*Initialize this to the concurrency limit. Decrease when
 	created a thread for upload, and increase when a thread
 	finished and is joined by the handler thread*/
 	sem_t upload_queue_sem;
@@ -93,6 +96,10 @@ typedef struct {
 	char threads_created[MAX_UPLOAD_CONCURRENCY];
 	char threads_finished[MAX_UPLOAD_CONCURRENCY];
 	int32_t total_active_upload_threads;
+	/* Stack of unused slots, protected by upload_op_sem */
+	int32_t free_slots[MAX_UPLOAD_CONCURRENCY];
+	int32_t num_free_slots;
+	XFER_CONCURRENCY concurrency;
 	/*upload threads: used for upload objects to backends*/
 } UPLOAD_THREAD_CONTROL;
 
@@ -127,6 +134,11 @@ typedef struct {
 							continue uploading
 							next time */
 	int32_t total_active_sync_threads;
+	/* Stack of unused slots, protected by sync_op_sem */
+	int32_t free_slots[MAX_SYNC_CONCURRENCY];
+	int32_t num_free_slots;
+	/* Follows half of the upload concurrency */
+	XFER_CONCURRENCY concurrency;
 	/*sync threads: used for syncing meta/block in a single inode*/
 } SYNC_THREAD_CONTROL;
 
@@ -26,6 +26,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 #include <openssl/hmac.h>
 #include <openssl/engine.h>
@@ -275,6 +276,39 @@ errcode_handle:
 	return -1;
 }
 
+/**
+ * Find the ETag in the HTTP header of a response, without quotes.
+ *
+ * @param fptr Opened file of the HTTP header.
+ * @param etag Buffer of MULTIPART_ETAG_LEN bytes to hold the ETag.
+ *
+ * @return 0 if found, -ENOENT if not, or other negative error code.
+ */
+static int32_t _parse_http_header_etag(FILE *fptr, char *etag)
+{
+	char linebuf[256];
+	char *value;
+	size_t len;
+
+	etag[0] = 0;
+	if (fseek(fptr, 0, SEEK_SET) < 0)
+		return -errno;
+	while (fgets(linebuf, sizeof(linebuf), fptr) != NULL) {
+		if (strncasecmp(linebuf, "ETag:", 5) != 0)
+			continue;
+		value = linebuf + 5;
+		while ((*value == ' ') || (*value == '"'))
+			value++;
+		len = strcspn(value, "\"\r\n");
+		if ((len == 0) || (len >= MULTIPART_ETAG_LEN))
+			return -EINVAL;
+		memcpy(etag, value, len);
+		etag[len] = 0;
+		return 0;
+	}
+	return -ENOENT;
+}
+
 /************************************************************************
  *
  * Function name: parse_http_header_coding_meta
@@ -913,21 +947,26 @@ errcode_handle:
 
 /************************************************************************
 *
-* Function name: hcfs_swift_put_object
-*        Inputs: FILE *fptr, char *objname, CURL_HANDLE *curl_handle
-*       Summary: For Swift backends, put to object "objname" by reading
-*                from opened file pointed by "fptr", using curl handle
-*                pointed by "curl_handle".
+* Function name: _swift_put_object_range
+*        Inputs: FILE *fptr, off_t offset, off_t objsize, char *objname,
+*                CURL_HANDLE *curl_handle, HTTP_meta *object_meta,
+*                char *etag
+*       Summary: For Swift backends, put "objsize" bytes starting from
+*                "offset" of opened file "fptr" to object "objname". If
+*                "etag" is not NULL, the ETag of the new object is
+*                returned in it.
 *  Return value: Return code from request (HTTP return code), or -1 if error.
 *
 *************************************************************************/
-int32_t hcfs_swift_put_object(FILE *fptr,
-			      char *objname,
-			      CURL_HANDLE *curl_handle,
-			      HTTP_meta *object_meta)
+static int32_t _swift_put_object_range(FILE *fptr,
+				       off_t offset,
+				       off_t objsize,
+				       char *objname,
+				       CURL_HANDLE *curl_handle,
+				       HTTP_meta *object_meta,
+				       char *etag)
 {
 	struct curl_slist *chunk = NULL;
-	int64_t objsize;
 	object_put_control put_control;
 	CURLcode res;
 	char *url = NULL;
@@ -936,7 +975,6 @@ int32_t hcfs_swift_put_object(FILE *fptr,
 	CURL *curl;
 	char header_filename[100];
 	int32_t ret_val, errcode;
-	int64_t ret_pos;
 	double time_spent;
 	int64_t xfer_thpt;
 
@@ -972,19 +1010,7 @@ int32_t hcfs_swift_put_object(FILE *fptr,
 		}
 	}
 
-	FSEEK(fptr, 0, SEEK_END);
-	ret_pos = FTELL(fptr);
-	objsize = ret_pos;
-	FSEEK(fptr, 0, SEEK_SET);
-	/* write_log(10, "object size: %d, objname: %s\n", objsize, objname); */
-
-	if (objsize < 0) {
-		fclose(swift_header_fptr);
-		unlink(header_filename);
-		curl_slist_free_all(chunk);
-
-		return -1;
-	}
+	FSEEK(fptr, offset, SEEK_SET);
 
 	put_control.fptr = fptr;
 	put_control.object_size = objsize;
@@ -1033,6 +1059,9 @@ int32_t hcfs_swift_put_object(FILE *fptr,
 	    (ret_val >= 400 && ret_val <= 403))
 		update_backend_status(FALSE, NULL);
 
+	if ((etag != NULL) && http_is_success(ret_val))
+		_parse_http_header_etag(swift_header_fptr, etag);
+
 	fclose(swift_header_fptr);
 	swift_header_fptr = NULL;
 	UNLINK(header_filename);
@@ -1044,7 +1073,7 @@ int32_t hcfs_swift_put_object(FILE *fptr,
 		change_xfer_meta(objsize, 0, xfer_thpt, 1);
 		write_log(10,
 			  "Upload obj %s, size %"PRId64", in %f seconds, %"PRId64" KB/s\n",
-			  objname, objsize, time_spent, xfer_thpt);
+			  objname, (int64_t)objsize, time_spent, xfer_thpt);
 	} else {
 		/* We still need to record this failure for xfer throughput */
 		change_xfer_meta(0, 0, 0, 1);
@@ -1062,6 +1091,44 @@ errcode_handle:
 	return -1;
 }
 
+/************************************************************************
+*
+* Function name: hcfs_swift_put_object
+*        Inputs: FILE *fptr, char *objname, CURL_HANDLE *curl_handle
+*       Summary: For Swift backends, put to object "objname" by reading
+*                from opened file pointed by "fptr", using curl handle
+*                pointed by "curl_handle".
+*  Return value: Return code from request (HTTP return code), or -1 if error.
+*
+*************************************************************************/
+int32_t hcfs_swift_put_object(FILE *fptr,
+			      char *objname,
+			      CURL_HANDLE *curl_handle,
+			      HTTP_meta *object_meta)
+{
+	int64_t objsize;
+	int32_t errcode;
+	int64_t ret_pos;
+
+	/* For SWIFTTOKEN backend - token not set situation */
+	if (swift_auth_string[0] == 0)
+		return 401;
+
+	FSEEK(fptr, 0, SEEK_END);
+	ret_pos = FTELL(fptr);
+	objsize = ret_pos;
+	/* write_log(10, "object size: %d, objname: %s\n", objsize, objname); */
+
+	if (objsize < 0)
+		return -1;
+
+	return _swift_put_object_range(fptr, 0, objsize, objname, curl_handle,
+				       object_meta, NULL);
+
+errcode_handle:
+	return -1;
+}
+
 /************************************************************************
 *
 * Function name: hcfs_swift_get_object
@@ -2266,19 +2333,27 @@ int32_t hcfs_delete_object(char *objname,
 
 /************************************************************************
 *
-* Function name: hcfs_S3_put_object
-*        Inputs: FILE *fptr, char *objname, CURL_HANDLE *curl_handle
-*       Summary: For S3 backends, put to object "objname" by reading
-*                from opened file pointed by "fptr", using curl handle
-*                pointed by "curl_handle".
+* Function name: _S3_put_object_range
+*        Inputs: FILE *fptr, off_t offset, off_t objsize, char *objname,
+*                CURL_HANDLE *curl_handle, HTTP_meta *object_meta,
+*                char *etag
+*       Summary: For S3 backends, put "objsize" bytes starting from
+*                "offset" of opened file "fptr" to object "objname", which
+*                may carry a sub-resource such as "?partNumber=1&uploadId=".
+*                If "etag" is not NULL, the ETag of the new object is
+*                returned in it.
 *  Return value: Return code from request (HTTP return code), or -1 if error.
 *
 *************************************************************************/
-int32_t hcfs_S3_put_object(FILE *fptr, char *objname, CURL_HANDLE *curl_handle,
-		       HTTP_meta *object_meta)
+static int32_t _S3_put_object_range(FILE *fptr,
+				    off_t offset,
+				    off_t objsize,
+				    char *objname,
+				    CURL_HANDLE *curl_handle,
+				    HTTP_meta *object_meta,
+				    char *etag)
 {
 	struct curl_slist *chunk = NULL;
-	off_t objsize;
 	object_put_control put_control;
 	CURLcode res;
 	char *url = NULL;
@@ -2292,8 +2367,7 @@ int32_t hcfs_S3_put_object(FILE *fptr, char *objname, CURL_HANDLE *curl_handle,
 	char AWS_auth_string[200];
 	char S3_signature[200];
 	int32_t ret_val, errcode;
-	char resource[200];
-	int64_t ret_pos;
+	char resource[400];
 	double time_spent;
 	int64_t xfer_thpt;
 
@@ -2335,18 +2409,7 @@ int32_t hcfs_S3_put_object(FILE *fptr, char *objname, CURL_HANDLE *curl_handle,
 		}
 	}
 
-	FSEEK(fptr, 0, SEEK_END);
-	ret_pos = FTELL(fptr);
-	objsize = ret_pos;
-	FSEEK(fptr, 0, SEEK_SET);
-
-	if (objsize < 0) {
-		fclose(S3_header_fptr);
-		unlink(header_filename);
-		curl_slist_free_all(chunk);
-
-		return -1;
-	}
+	FSEEK(fptr, offset, SEEK_SET);
 
 	put_control.fptr = fptr;
 	put_control.object_size = objsize;
@@ -2396,6 +2459,9 @@ int32_t hcfs_S3_put_object(FILE *fptr, char *objname, CURL_HANDLE *curl_handle,
 	    (ret_val >= 400 && ret_val <= 403))
 		update_backend_status(FALSE, NULL);
 
+	if ((etag != NULL) && http_is_success(ret_val))
+		_parse_http_header_etag(S3_header_fptr, etag);
+
 	fclose(S3_header_fptr);
 	S3_header_fptr = NULL;
 	UNLINK(header_filename);
@@ -2425,6 +2491,37 @@ errcode_handle:
 	return -1;
 }
 
+/************************************************************************
+*
+* Function name: hcfs_S3_put_object
+*        Inputs: FILE *fptr, char *objname, CURL_HANDLE *curl_handle
+*       Summary: For S3 backends, put to object "objname" by reading
+*                from opened file pointed by "fptr", using curl handle
+*                pointed by "curl_handle".
+*  Return value: Return code from request (HTTP return code), or -1 if error.
+*
+*************************************************************************/
+int32_t hcfs_S3_put_object(FILE *fptr, char *objname, CURL_HANDLE *curl_handle,
+		       HTTP_meta *object_meta)
+{
+	off_t objsize;
+	int32_t errcode;
+	int64_t ret_pos;
+
+	FSEEK(fptr, 0, SEEK_END);
+	ret_pos = FTELL(fptr);
+	objsize = ret_pos;
+
+	if (objsize < 0)
+		return -1;
+
+	return _S3_put_object_range(fptr, 0, objsize, objname, curl_handle,
+				    object_meta, NULL);
+
+errcode_handle:
+	return -1;
+}
+
 /************************************************************************
 *
 * Function name: hcfs_S3_get_object
@@ -2667,3 +2764,614 @@ errcode_handle:
 	return -1;
 }
 
+
+/* Put a range of the file to Swift or S3 backends */
+static int32_t _put_object_range(FILE *fptr, off_t offset, off_t size,
+				 char *objname, CURL_HANDLE *curl_handle,
+				 HTTP_meta *object_meta, char *etag)
+{
+	if (CURRENT_BACKEND == S3)
+		return _S3_put_object_range(fptr, offset, size, objname,
+					    curl_handle, object_meta, etag);
+	return _swift_put_object_range(fptr, offset, size, objname,
+				       curl_handle, object_meta, etag);
+}
+
+static int32_t _http_can_retry(int32_t code)
+{
+	if (CURRENT_BACKEND == S3)
+		return _S3_http_can_retry(code);
+	return _swift_http_can_retry(code);
+}
+
+/**
+ * Put one part of a multipart upload. Only this part is resent if the
+ * request fails and can be retried.
+ *
+ * @param fptr Opened file of the whole object.
+ * @param offset Starting offset of the part in the file.
+ * @param size Size of the part.
+ * @param partname Object name of the part, with sub-resource if any.
+ * @param curl_handle Curl handle of this upload.
+ * @param object_meta Object meta to be attached, or NULL if none.
+ * @param etag Buffer to hold the ETag of the part, or NULL if not needed.
+ *
+ * @return Return code from request (HTTP return code), or -1 if error.
+ */
+static int32_t _put_object_part(FILE *fptr, off_t offset, off_t size,
+				char *partname, CURL_HANDLE *curl_handle,
+				HTTP_meta *object_meta, char *etag)
+{
+	int32_t ret_val, num_retries;
+
+	num_retries = 0;
+	ret_val = _put_object_range(fptr, offset, size, partname, curl_handle,
+				    object_meta, etag);
+	while ((!http_is_success(ret_val)) &&
+	       ((_http_can_retry(ret_val)) && (num_retries < MAX_RETRIES))) {
+		num_retries++;
+		write_log(2, "Retrying upload of %s in 10 seconds", partname);
+		sleep(RETRY_INTERVAL);
+		if ((CURRENT_BACKEND != S3) && (ret_val == 401)) {
+			ret_val = hcfs_swift_reauth(curl_handle);
+			if ((ret_val < 200) || (ret_val > 299))
+				continue;
+		}
+		ret_val = _put_object_range(fptr, offset, size, partname,
+					    curl_handle, object_meta, etag);
+	}
+	return ret_val;
+}
+
+/* Helper for finding the size of each part so that an object of "objsize"
+ * is put in at most MAX_UPLOAD_PARTS parts */
+static off_t _multipart_part_size(off_t objsize)
+{
+	off_t part_size;
+
+	part_size = (objsize + MAX_UPLOAD_PARTS - 1) / MAX_UPLOAD_PARTS;
+	if (part_size < MULTIPART_PART_SIZE)
+		part_size = MULTIPART_PART_SIZE;
+	return part_size;
+}
+
+/**
+ * Delete segments of Swift object "objname", starting from the first one
+ * until a segment cannot be deleted or "max_part" segments are deleted.
+ *
+ * @return Number of segments deleted.
+ */
+static int32_t _swift_delete_segments(char *objname, CURL_HANDLE *curl_handle,
+				      int32_t max_part)
+{
+	char segname[500];
+	int32_t part, ret_val;
+
+	for (part = 1; part <= max_part; part++) {
+		snprintf(segname, sizeof(segname), "%s%s_%04d",
+			 SWIFT_SEGMENT_PREFIX, objname, part);
+		ret_val = hcfs_delete_object(segname, curl_handle, NULL);
+		if (!http_is_success(ret_val)) {
+			if (ret_val != 404)
+				write_log(4, "Unable to delete segment %s. "
+					  "Code %d\n", segname, ret_val);
+			break;
+		}
+	}
+	return part - 1;
+}
+
+/************************************************************************
+*
+* Function name: _swift_put_segmented_object
+*        Inputs: FILE *fptr, off_t objsize, char *objname,
+*                CURL_HANDLE *curl_handle, HTTP_meta *object_meta
+*       Summary: For Swift backends, upload the object as a static large
+*                object. The file is sent in segments named
+*                "segment_<objname>_<part>", and the manifest listing the
+*                segments is then put to "objname" with the object meta.
+*  Return value: Return code from request (HTTP return code), or -1 if error.
+*
+*************************************************************************/
+static int32_t _swift_put_segmented_object(FILE *fptr,
+					   off_t objsize,
+					   char *objname,
+					   CURL_HANDLE *curl_handle,
+					   HTTP_meta *object_meta)
+{
+	char manifest_filename[100];
+	char partname[500];
+	char etag[MULTIPART_ETAG_LEN];
+	char etag_string[MULTIPART_ETAG_LEN + 2];
+	FILE *manifest_fptr;
+	off_t offset, part_size, max_part_size;
+	int64_t manifest_size;
+	int32_t part, num_parts, ret_val, errcode;
+
+	sprintf(manifest_filename, "/dev/shm/swiftmanifest%s.tmp",
+		curl_handle->id);
+	manifest_fptr = fopen(manifest_filename, "w+");
+	if (manifest_fptr == NULL) {
+		errcode = errno;
+		write_log(0, "IO error in %s. Code %d, %s\n", __func__, errcode,
+			  strerror(errcode));
+		return -1;
+	}
+
+	ret_val = -1;
+	max_part_size = _multipart_part_size(objsize);
+	num_parts = (objsize + max_part_size - 1) / max_part_size;
+	fprintf(manifest_fptr, "[");
+	for (part = 1; part <= num_parts; part++) {
+		offset = (off_t)(part - 1) * max_part_size;
+		part_size = objsize - offset;
+		if (part_size > max_part_size)
+			part_size = max_part_size;
+		snprintf(partname, sizeof(partname), "%s%s_%04d",
+			 SWIFT_SEGMENT_PREFIX, objname, part);
+		ret_val = _put_object_part(fptr, offset, part_size, partname,
+					   curl_handle, NULL, etag);
+		if (!http_is_success(ret_val))
+			goto segment_fail;
+
+		/* Swift checks the segments against the manifest */
+		if (etag[0] != 0)
+			snprintf(etag_string, sizeof(etag_string), "\"%s\"",
+				 etag);
+		else
+			strcpy(etag_string, "null");
+		fprintf(manifest_fptr,
+			"%s{\"path\": \"/%s/%s\", \"etag\": %s, "
+			"\"size_bytes\": %" PRId64 "}",
+			(part > 1) ? ", " : "", SWIFT_CONTAINER, partname,
+			etag_string, (int64_t)part_size);
+	}
+	fprintf(manifest_fptr, "]");
+	fflush(manifest_fptr);
+	manifest_size = FTELL(manifest_fptr);
+
+	snprintf(partname, sizeof(partname), "%s?multipart-manifest=put",
+		 objname);
+	ret_val = _put_object_part(manifest_fptr, 0, manifest_size, partname,
+				   curl_handle, object_meta, NULL);
+	if (!http_is_success(ret_val))
+		goto segment_fail;
+
+	fclose(manifest_fptr);
+	unlink(manifest_filename);
+	return ret_val;
+
+errcode_handle:
+	ret_val = -1;
+segment_fail:
+	write_log(4, "Failed to upload %s in segments. Code %d\n", objname,
+		  ret_val);
+	fclose(manifest_fptr);
+	unlink(manifest_filename);
+	/* Uploaded segments are not referred by any manifest */
+	_swift_delete_segments(objname, curl_handle,
+			       (part > num_parts) ? num_parts : part - 1);
+	return ret_val;
+}
+
+/* Copy the content of the first XML element "tag" in the file to "value" */
+static int32_t _find_xml_element(FILE *fptr, const char *tag, char *value,
+				 size_t value_size)
+{
+	char buf[4096];
+	char start_tag[64], end_tag[64];
+	char *start, *end;
+	size_t size;
+
+	if (fseek(fptr, 0, SEEK_SET) < 0)
+		return -errno;
+	size = fread(buf, 1, sizeof(buf) - 1, fptr);
+	buf[size] = 0;
+
+	snprintf(start_tag, sizeof(start_tag), "<%s>", tag);
+	snprintf(end_tag, sizeof(end_tag), "</%s>", tag);
+	start = strstr(buf, start_tag);
+	if (start == NULL)
+		return -ENOENT;
+	start += strlen(start_tag);
+	end = strstr(start, end_tag);
+	if (end == NULL)
+		return -ENOENT;
+	if ((size_t)(end - start) >= value_size)
+		return -EINVAL;
+	memcpy(value, start, end - start);
+	value[end - start] = 0;
+	return 0;
+}
+
+/**
+ * Send a request of S3 multipart upload other than putting a part.
+ *
+ * @param method "POST" or "DELETE".
+ * @param objname Object name with the sub-resource of the request.
+ * @param curl_handle Curl handle of this upload.
+ * @param object_meta Object meta to be attached, or NULL if none.
+ * @param body_fptr Opened file of the request body, or NULL if none.
+ * @param resp_fptr Opened file to hold the response body, or NULL if not
+ *                  needed.
+ *
+ * @return Return code from request (HTTP return code), or -1 if error.
+ */
+static int32_t _S3_multipart_request(char *method,
+				     char *objname,
+				     CURL_HANDLE *curl_handle,
+				     HTTP_meta *object_meta,
+				     FILE *body_fptr,
+				     FILE *resp_fptr)
+{
+	struct curl_slist *chunk = NULL;
+	object_put_control put_control;
+	CURLcode res;
+	char *url = NULL;
+	FILE *S3_header_fptr = NULL;
+	CURL *curl;
+	char header_filename[100];
+	char date_string[100];
+	char object_string[150];
+	char date_string_header[100];
+	char AWS_auth_string[200];
+	char S3_signature[200];
+	char resource[600];
+	int64_t body_size;
+	int32_t ret_val, errcode;
+
+	body_size = 0;
+	if (body_fptr != NULL) {
+		FSEEK(body_fptr, 0, SEEK_END);
+		body_size = FTELL(body_fptr);
+		FSEEK(body_fptr, 0, SEEK_SET);
+	}
+	if (resp_fptr != NULL) {
+		FSEEK(resp_fptr, 0, SEEK_SET);
+		FTRUNCATE(fileno(resp_fptr), 0);
+	}
+
+	sprintf(header_filename, "/dev/shm/s3multiparthead%s.tmp",
+		curl_handle->id);
+	snprintf(resource, sizeof(resource), "%s/%s", S3_BUCKET, objname);
+	curl = curl_handle->curl;
+
+	S3_header_fptr = fopen(header_filename, "w+");
+	if (S3_header_fptr == NULL) {
+		errcode = errno;
+		write_log(0, "IO error in %s. Code %d, %s\n", __func__, errcode,
+			  strerror(errcode));
+		return -1;
+	}
+
+	generate_S3_sig(method, date_string, S3_signature, resource,
+			object_meta);
+	sprintf(date_string_header, "date: %s", date_string);
+	sprintf(AWS_auth_string, "authorization: AWS %s:%s", S3_ACCESS,
+		S3_signature);
+
+	/* Content type is not signed */
+	chunk = curl_slist_append(chunk, "Expect:");
+	chunk = curl_slist_append(chunk, "Content-Type:");
+	chunk = curl_slist_append(chunk, date_string_header);
+	chunk = curl_slist_append(chunk, AWS_auth_string);
+	if (object_meta != NULL) {
+		int32_t i;
+
+		for (i = 0; i < object_meta->count; i++) {
+			sprintf(object_string, "x-amz-meta-%s: %s",
+				object_meta->data[2 * i],
+				object_meta->data[2 * i + 1]);
+			chunk = curl_slist_append(chunk, object_string);
+		}
+	}
+
+	ASPRINTF(&url, "%s/%s", S3_BUCKET_URL, objname);
+
+	set_default_curl(curl);
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, chunk);
+	curl_easy_setopt(curl, CURLOPT_WRITEHEADER, S3_header_fptr);
+	if (resp_fptr != NULL) {
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)resp_fptr);
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_file_fn);
+	}
+	if (strcmp(method, "DELETE") == 0) {
+		curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+	} else {
+		put_control.fptr = body_fptr;
+		put_control.object_size = body_size;
+		put_control.remaining_size = body_size;
+		curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+		curl_easy_setopt(curl, CURLOPT_INFILESIZE, body_size);
+		curl_easy_setopt(curl, CURLOPT_READDATA, (void *)&put_control);
+		curl_easy_setopt(curl, CURLOPT_READFUNCTION,
+				 read_file_function);
+	}
+	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method);
+
+	res = HTTP_PERFORM_RETRY(curl);
+	update_backend_status((res == CURLE_OK), NULL);
+	FREE(url);
+	/* Response body of later requests on this handle is not kept */
+	if (resp_fptr != NULL)
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)stdout);
+	curl_slist_free_all(chunk);
+	chunk = NULL;
+
+	if (res != CURLE_OK) {
+		if (res != CURLE_ABORTED_BY_CALLBACK)
+			write_log(4, "Curl op failed %s\n",
+			          curl_easy_strerror(res));
+		ret_val = -1;
+	} else {
+		ret_val = parse_http_header_retcode(S3_header_fptr);
+	}
+
+	if ((ret_val >= 500 && ret_val <= 505) ||
+	    (ret_val >= 400 && ret_val <= 403))
+		update_backend_status(FALSE, NULL);
+
+	fclose(S3_header_fptr);
+	unlink(header_filename);
+	return ret_val;
+
+errcode_handle:
+	if (S3_header_fptr != NULL) {
+		fclose(S3_header_fptr);
+		unlink(header_filename);
+	}
+	curl_slist_free_all(chunk);
+	return -1;
+}
+
+static int32_t _S3_multipart_request_retry(char *method,
+					   char *objname,
+					   CURL_HANDLE *curl_handle,
+					   HTTP_meta *object_meta,
+					   FILE *body_fptr,
+					   FILE *resp_fptr)
+{
+	int32_t ret_val, num_retries;
+
+	num_retries = 0;
+	ret_val = _S3_multipart_request(method, objname, curl_handle,
+					object_meta, body_fptr, resp_fptr);
+	while ((!http_is_success(ret_val)) &&
+	       ((_S3_http_can_retry(ret_val)) &&
+		(num_retries < MAX_RETRIES))) {
+		num_retries++;
+		write_log(2, "Retrying backend operation in 10 seconds");
+		sleep(RETRY_INTERVAL);
+		ret_val = _S3_multipart_request(method, objname, curl_handle,
+						object_meta, body_fptr,
+						resp_fptr);
+	}
+	return ret_val;
+}
+
+/************************************************************************
+*
+* Function name: _S3_put_multipart_object
+*        Inputs: FILE *fptr, off_t objsize, char *objname,
+*                CURL_HANDLE *curl_handle, HTTP_meta *object_meta
+*       Summary: For S3 backends, upload the object with multipart upload.
+*                The upload is aborted if any part cannot be uploaded.
+*  Return value: Return code from request (HTTP return code), or -1 if error.
+*
+*************************************************************************/
+static int32_t _S3_put_multipart_object(FILE *fptr,
+					off_t objsize,
+					char *objname,
+					CURL_HANDLE *curl_handle,
+					HTTP_meta *object_meta)
+{
+	char body_filename[100], resp_filename[100];
+	char partname[600];
+	char upload_id[MULTIPART_UPLOADID_LEN];
+	char etag[MULTIPART_ETAG_LEN];
+	FILE *body_fptr = NULL, *resp_fptr = NULL;
+	off_t offset, part_size, max_part_size;
+	int32_t part, num_parts, ret_val, errcode;
+
+	sprintf(body_filename, "/dev/shm/s3multipartbody%s.tmp",
+		curl_handle->id);
+	sprintf(resp_filename, "/dev/shm/s3multipartresp%s.tmp",
+		curl_handle->id);
+	body_fptr = fopen(body_filename, "w+");
+	if (body_fptr != NULL)
+		resp_fptr = fopen(resp_filename, "w+");
+	if ((body_fptr == NULL) || (resp_fptr == NULL)) {
+		errcode = errno;
+		write_log(0, "IO error in %s. Code %d, %s\n", __func__, errcode,
+			  strerror(errcode));
+		ret_val = -1;
+		goto out;
+	}
+
+	/* Initiate the upload. Object meta is given here */
+	snprintf(partname, sizeof(partname), "%s?uploads", objname);
+	ret_val = _S3_multipart_request_retry("POST", partname, curl_handle,
+					      object_meta, NULL, resp_fptr);
+	if (!http_is_success(ret_val))
+		goto out;
+	if (_find_xml_element(resp_fptr, "UploadId", upload_id,
+			      sizeof(upload_id)) < 0) {
+		write_log(4, "Unable to find upload ID of %s\n", objname);
+		ret_val = -1;
+		goto out;
+	}
+
+	fprintf(body_fptr, "<CompleteMultipartUpload>");
+	max_part_size = _multipart_part_size(objsize);
+	num_parts = (objsize + max_part_size - 1) / max_part_size;
+	for (part = 1; part <= num_parts; part++) {
+		offset = (off_t)(part - 1) * max_part_size;
+		part_size = objsize - offset;
+		if (part_size > max_part_size)
+			part_size = max_part_size;
+		snprintf(partname, sizeof(partname),
+			 "%s?partNumber=%d&uploadId=%s", objname, part,
+			 upload_id);
+		ret_val = _put_object_part(fptr, offset, part_size, partname,
+					   curl_handle, NULL, etag);
+		if (!http_is_success(ret_val))
+			goto abort_upload;
+		if (etag[0] == 0) {
+			write_log(4, "Missing ETag of part %d of %s\n", part,
+				  objname);
+			ret_val = -1;
+			goto abort_upload;
+		}
+		fprintf(body_fptr, "<Part><PartNumber>%d</PartNumber>"
+			"<ETag>\"%s\"</ETag></Part>", part, etag);
+	}
+	fprintf(body_fptr, "</CompleteMultipartUpload>");
+	fflush(body_fptr);
+
+	snprintf(partname, sizeof(partname), "%s?uploadId=%s", objname,
+		 upload_id);
+	ret_val = _S3_multipart_request_retry("POST", partname, curl_handle,
+					      NULL, body_fptr, resp_fptr);
+	if (!http_is_success(ret_val))
+		goto abort_upload;
+	/* Completion can fail after a success response code */
+	if (_find_xml_element(resp_fptr, "Code", etag, sizeof(etag)) == 0) {
+		write_log(4, "Unable to complete upload of %s. %s\n", objname,
+			  etag);
+		ret_val = -1;
+		goto abort_upload;
+	}
+	goto out;
+
+abort_upload:
+	write_log(4, "Failed to upload %s in parts. Code %d\n", objname,
+		  ret_val);
+	snprintf(partname, sizeof(partname), "%s?uploadId=%s", objname,
+		 upload_id);
+	_S3_multipart_request_retry("DELETE", partname, curl_handle, NULL,
+				    NULL, NULL);
+out:
+	if (body_fptr != NULL) {
+		fclose(body_fptr);
+		unlink(body_filename);
+	}
+	if (resp_fptr != NULL) {
+		fclose(resp_fptr);
+		unlink(resp_filename);
+	}
+	return ret_val;
+}
+
+/************************************************************************
+*
+* Function name: hcfs_put_multipart_object
+*        Inputs: FILE *fptr, char *objname, CURL_HANDLE *curl_handle,
+*                HTTP_meta *object_meta, added_info_t *more
+*       Summary: Put to object "objname" as hcfs_put_object does. For Swift
+*                and S3 backends, objects larger than
+*                MULTIPART_UPLOAD_THRESHOLD are streamed from "fptr" in
+*                parts of MULTIPART_PART_SIZE, enlarged if needed to keep
+*                at most MAX_UPLOAD_PARTS parts, and a failed part is
+*                retried alone. For Swift, the file ID in "more" is set to
+*                SWIFT_SEGMENTS_ID and the number of segments if the object
+*                is put in segments, or cleared if not.
+*  Return value: Return code from request (HTTP return code), or -1 if error.
+*
+*************************************************************************/
+int32_t hcfs_put_multipart_object(FILE *fptr,
+				  char *objname,
+				  CURL_HANDLE *curl_handle,
+				  HTTP_meta *object_meta,
+				  added_info_t *more)
+{
+	GOOGLEDRIVE_OBJ_INFO *obj_info;
+	int64_t objsize;
+	off_t part_size;
+	int32_t ret_val, errcode;
+
+	if ((fptr == NULL) || ((CURRENT_BACKEND != SWIFT) &&
+	    (CURRENT_BACKEND != SWIFTTOKEN) && (CURRENT_BACKEND != S3)))
+		return hcfs_put_object(fptr, objname, curl_handle, object_meta,
+				       more);
+
+	obj_info = NULL;
+	if ((CURRENT_BACKEND == SWIFT) || (CURRENT_BACKEND == SWIFTTOKEN)) {
+		obj_info = (GOOGLEDRIVE_OBJ_INFO *)more;
+		if (obj_info != NULL)
+			obj_info->fileID[0] = 0;
+	}
+
+	FSEEK(fptr, 0, SEEK_END);
+	objsize = FTELL(fptr);
+	if (objsize <= MULTIPART_UPLOAD_THRESHOLD)
+		return hcfs_put_object(fptr, objname, curl_handle, object_meta,
+				       more);
+
+	ret_val = ignore_sigpipe();
+	if (ret_val < 0)
+		return ret_val;
+
+	if (curl_handle->curl_backend == NONE) {
+		ret_val = hcfs_init_backend(curl_handle);
+		if (http_is_success(ret_val) == FALSE) {
+			write_log(5, "Error connecting to backend\n");
+			sleep(5);
+			return ret_val;
+		}
+	}
+
+	if (CURRENT_BACKEND == S3)
+		return _S3_put_multipart_object(fptr, objsize, objname,
+						curl_handle, object_meta);
+	ret_val = _swift_put_segmented_object(fptr, objsize, objname,
+					      curl_handle, object_meta);
+	/* Recorded so that the segments are deleted with the object */
+	if (http_is_success(ret_val) && (obj_info != NULL)) {
+		part_size = _multipart_part_size(objsize);
+		snprintf(obj_info->fileID, sizeof(obj_info->fileID),
+			 "%s%" PRId64, SWIFT_SEGMENTS_ID,
+			 (int64_t)((objsize + part_size - 1) / part_size));
+	}
+	return ret_val;
+
+errcode_handle:
+	return -1;
+}
+
+/************************************************************************
+*
+* Function name: hcfs_delete_multipart_object
+*        Inputs: char *objname, CURL_HANDLE *curl_handle,
+*                added_info_t *more
+*       Summary: Delete object "objname" that may have been uploaded by
+*                hcfs_put_multipart_object. For Swift, segments are deleted
+*                after the manifest only if the file ID in "more" records
+*                SWIFT_SEGMENTS_ID.
+*  Return value: Return code from request (HTTP return code), or -1 if error.
+*
+*************************************************************************/
+int32_t hcfs_delete_multipart_object(char *objname,
+				     CURL_HANDLE *curl_handle,
+				     added_info_t *more)
+{
+	GOOGLEDRIVE_OBJ_INFO *obj_info;
+	int32_t ret_val, num_segments;
+
+	num_segments = 0;
+	obj_info = (GOOGLEDRIVE_OBJ_INFO *)more;
+	if (((CURRENT_BACKEND == SWIFT) || (CURRENT_BACKEND == SWIFTTOKEN)) &&
+	    (obj_info != NULL) &&
+	    (strncmp(obj_info->fileID, SWIFT_SEGMENTS_ID,
+		     strlen(SWIFT_SEGMENTS_ID)) == 0))
+		num_segments = atoi(obj_info->fileID +
+				    strlen(SWIFT_SEGMENTS_ID));
+
+	ret_val = hcfs_delete_object(objname, curl_handle, more);
+	if (!http_is_success(ret_val) || (num_segments <= 0))
+		return ret_val;
+
+	/* Segments are no longer referred by the manifest */
+	_swift_delete_segments(objname, curl_handle, num_segments);
+	return ret_val;
+}
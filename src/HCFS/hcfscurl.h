@@ -28,6 +28,7 @@
 #include <curl/curl.h>
 #include <semaphore.h>
 #include <pthread.h>
+#include "curl_pool.h"
 #include "objmeta.h"
 #include "params.h"
 
@@ -120,9 +121,36 @@ int32_t hcfs_get_object(FILE *fptr,
 int32_t hcfs_delete_object(char *objname,
 			   CURL_HANDLE *curl_handle,
 			   added_info_t *);
+int32_t hcfs_put_multipart_object(FILE *fptr,
+				  char *objname,
+				  CURL_HANDLE *curl_handle,
+				  HTTP_meta *,
+				  added_info_t *);
+int32_t hcfs_delete_multipart_object(char *objname,
+				     CURL_HANDLE *curl_handle,
+				     added_info_t *);
 int32_t hcfs_list_container(FILE *fptr,
 			    CURL_HANDLE *curl_handle,
 			    added_info_t *more);
+/* Objects larger than the threshold are uploaded in parts to Swift and
+ * S3 backends, so that a failed part is resent alone. S3 does not accept
+ * parts smaller than 5MB except the last one. */
+#define MULTIPART_UPLOAD_THRESHOLD (8 * 1048576)
+#define MULTIPART_PART_SIZE (5 * 1048576)
+#define MAX_UPLOAD_PARTS 1000
+#define MULTIPART_ETAG_LEN 80
+#define MULTIPART_UPLOADID_LEN 256
+#define SWIFT_SEGMENT_PREFIX "segment_"
+/* A Swift block object put in segments records this ID in its block entry,
+ * followed by the number of segments. Only objects with this ID are deleted
+ * with their segments. */
+#define SWIFT_SEGMENTS_ID "swift_segments_"
+/* Backends recording an ID of each block object in its block entry. Google
+ * Drive records the file ID, and Swift records SWIFT_SEGMENTS_ID. */
+#define BLOCK_ID_IS_RECORDED                                                   \
+	((CURRENT_BACKEND == GOOGLEDRIVE) || (CURRENT_BACKEND == SWIFT) ||     \
+	 (CURRENT_BACKEND == SWIFTTOKEN))
+
 /* Tools */
 #define MAX_RETRIES 5
 #ifdef UNITTEST
@@ -46,6 +46,8 @@
 #include "hcfs_fromcloud.h"
 #include "hcfs_clouddelete.h"
 #include "hcfs_cacheops.h"
+#include "hcfs_cachebuild.h"
+#include "cache_policy.h"
 #include "monitor.h"
 #include "params.h"
 #include "utils.h"
@@ -65,6 +67,7 @@
 #include "recover_super_block.h"
 #include "apk_mgmt.h"
 #include "backend_generic.h"
+#include "block_fd_cache.h"
 
 /* TODO: A monitor thread to write system info periodically to a
 	special directory in /dev/shm */
@@ -82,6 +85,7 @@ int32_t init_hcfs_system_data(int8_t restoring_status)
 {
 	int32_t errcode, ret;
 	int64_t quota;
+	pthread_attr_t write_sys_attr;
 
 #ifdef _ANDROID_ENV_
 	hcfs_system = (SYSTEM_DATA_HEAD *)malloc(sizeof(SYSTEM_DATA_HEAD));
@@ -105,6 +109,7 @@ int32_t init_hcfs_system_data(int8_t restoring_status)
 
 	/* Init cache management control */
 	sem_init(&(hcfs_system->something_to_replace), 1, 1);
+	sem_init(&(hcfs_system->cache_event_sem), 1, 0);
 
 	sem_init(&(hcfs_system->fuse_sem), 1, 0);
 	sem_init(&(hcfs_system->num_cache_sleep_sem), 1, 0);
@@ -167,11 +172,11 @@ int32_t init_hcfs_system_data(int8_t restoring_status)
 	FREAD(&(hcfs_system->systemdata), sizeof(SYSTEM_DATA_TYPE), 1,
 	      hcfs_system->system_val_fptr);
 
-	pthread_attr_init(&prefetch_thread_attr);
-	pthread_attr_setdetachstate(&prefetch_thread_attr,
-						PTHREAD_CREATE_DETACHED);
+	pthread_attr_init(&write_sys_attr);
+	pthread_attr_setdetachstate(&write_sys_attr, PTHREAD_CREATE_DETACHED);
 	PTHREAD_REUSE_set_exithandler();
-	PTHREAD_REUSE_create(&(write_sys_thread), &prefetch_thread_attr);
+	PTHREAD_REUSE_create(&(write_sys_thread), &write_sys_attr);
+	pthread_attr_destroy(&write_sys_attr);
 
 	/* Use backup quota temporarily. It will be updated later. */
 	ret = get_quota_from_backup(&quota);
@@ -306,6 +311,14 @@ int32_t init_hfuse(int8_t restoring_status)
 		ret_val = init_pathlookup();
 	if (ret_val == 0)
 		ret_val = init_dirstat_lookup();
+	if (ret_val == 0)
+		ret_val = init_cache_usage_index();
+	/* Block replacement relies on access tracking in this process */
+	if (ret_val == 0)
+		ret_val = init_cache_policy(
+		    (CACHE_USAGE_INDEX_INCREMENTAL == TRUE) ?
+		    CACHE_REPLACE_POLICY : CACHE_POLICY_INODE,
+		    CACHE_POLICY_MAX_BLOCKS, CACHE_ACCESS_TRACE);
 
 	return ret_val;
 }
@@ -489,6 +502,7 @@ and then create a new blockpath */
 	if (access(RESTORE_BLOCKPATH, F_OK) == 0) {
 		/* Need to rename the path to the current one */
 		/* First check if need to rename old path to todelete */
+		invalidate_all_block_fds();
 		if (access(BLOCKPATH, F_OK) == 0)
 			rename(BLOCKPATH, todelete_blockpath);
 		rename(RESTORE_BLOCKPATH, BLOCKPATH);
@@ -707,6 +721,10 @@ int32_t main(int32_t argc, char **argv)
 	if (ret_val < 0)
 		exit(ret_val);
 
+	/* Transfers to backend share one connection pool */
+	if (CURRENT_BACKEND != NONE)
+		init_curl_pool();
+
 	/* Init backend related services and super block */
 	if ((CURRENT_BACKEND != NONE) &&
 	    (restoring_status != RESTORING_STAGE1)) {
@@ -785,6 +803,7 @@ int32_t main(int32_t argc, char **argv)
 			pthread_join(cache_loop_thread, NULL);
 		destroy_monitor_loop_thread();
 		pthread_join(monitor_loop_thread, NULL);
+		destroy_curl_pool();
 		write_log(10, "Debug: All threads terminated\n");
 	}
 
@@ -800,6 +819,8 @@ int32_t main(int32_t argc, char **argv)
 	sync_hcfs_system_data(TRUE);
 	sem_post(&(hcfs_system->access_sem));
 	super_block_destroy();
+	destroy_cache_usage_index();
+	destroy_cache_policy();
 	destroy_dirstat_lookup();
 	destroy_pathlookup();
 	destroy_pkg_cache();
@@ -831,6 +852,7 @@ int32_t main(int32_t argc, char **argv)
 		sem_init(&download_curl_control_sem, 0, 1);
 
 		if (CURRENT_BACKEND != NONE) {
+			init_curl_pool();
 			/* Update quota from cloud */
 			memset(&download_usermeta_ctl, 0,
 					sizeof(DOWNLOAD_USERMETA_CTL));
@@ -846,9 +868,12 @@ int32_t main(int32_t argc, char **argv)
 		if (CURRENT_BACKEND != NONE) {
 			for (proc_idx = 1; proc_idx < CHILD_NUM; ++proc_idx)
 				waitpid(child_pids[proc_idx], NULL, 0);
+			destroy_curl_pool();
 		}
 		write_log(4, "HCFS (fuse) shutting down normally\n");
 		close_log();
+		destroy_cache_usage_index();
+		destroy_cache_policy();
 		destroy_dirstat_lookup();
 		destroy_pathlookup();
 
@@ -857,6 +882,7 @@ int32_t main(int32_t argc, char **argv)
 	case 1:
 		open_log("cache_maintain.log");
 		run_cache_loop();
+		destroy_dirstat_lookup();
 		write_log(4, "HCFS (cache) shutting down normally\n");
 		close_log();
 		break;
@@ -864,6 +890,7 @@ int32_t main(int32_t argc, char **argv)
 		open_log("backend_upload.log");
 
 		/* Init curl handle */
+		init_curl_pool();
 		sem_init(&download_curl_sem, 0,
 				MAX_DOWNLOAD_CURL_HANDLE);
 		sem_init(&download_curl_control_sem, 0, 1);
@@ -876,6 +903,8 @@ int32_t main(int32_t argc, char **argv)
 		upload_loop();
 		pthread_join(delete_loop_thread, NULL);
 		pthread_join(monitor_loop_thread, NULL);
+		destroy_curl_pool();
+		destroy_dirstat_lookup();
 		write_log(4, "HCFS (sync) shutting down normally\n");
 		close_log();
 		break;
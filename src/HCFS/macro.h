@@ -446,7 +446,7 @@ extern __thread int32_t errcode;
 	do {\
 		int num_retries = 0;\
 		while (num_retries < MAX_RETRIES) {\
-			res = curl_easy_perform(A);\
+			res = hcfs_curl_perform(A);\
 			if ((res == CURLE_OPERATION_TIMEDOUT) &&\
 			    (hcfs_system->backend_is_online == TRUE)) {\
 				num_retries++;\
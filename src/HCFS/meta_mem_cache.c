@@ -22,6 +22,7 @@
 #include <unistd.h>
 #include <time.h>
 #include <pthread.h>
+#include <sched.h>
 #include <string.h>
 #include <errno.h>
 #include <dirent.h>
@@ -50,9 +51,15 @@
 	}
 /* TODO: Consider whether want to use write-back mode for meta caching */
 
+/* Number of seqlock retries before a stat snapshot gives up */
+#define MAX_STAT_SNAPSHOT_RETRY 64
+
 META_CACHE_HEADER_STRUCT *meta_mem_cache;
 sem_t num_entry_sem;
 int64_t current_meta_mem_cache_entries;
+META_CACHE_STAT meta_cache_stat;
+/* Header index where the next CLOCK sweep starts */
+static int32_t meta_cache_clock_hand;
 
 /* Helper function for opening meta file if not already opened */
 static inline int32_t _open_file(META_CACHE_ENTRY_STRUCT *body_ptr)
@@ -83,6 +90,76 @@ inline BOOL is_now_uploading(META_CACHE_ENTRY_STRUCT *body_ptr)
 	return body_ptr->uploading_info.is_uploading;
 }
 
+/* Helper function for replacing the cached stat under the stat seqlock.
+	Entry lock must be held, so writers are already serialized. */
+static inline void _set_cached_stat(META_CACHE_ENTRY_STRUCT *body_ptr,
+				    const HCFS_STAT *inode_stat)
+{
+	uint32_t seq;
+
+	seq = __atomic_load_n(&(body_ptr->stat_seq), __ATOMIC_RELAXED);
+	__atomic_store_n(&(body_ptr->stat_seq), seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(&(body_ptr->this_stat), inode_stat, sizeof(HCFS_STAT));
+	__atomic_store_n(&(body_ptr->stat_seq), seq + 2, __ATOMIC_RELEASE);
+}
+
+/* Helper function for recomputing the bytes charged for an entry, and
+	applying the difference to the cache total. Entry lock must be held. */
+static inline void _account_entry_mem(META_CACHE_ENTRY_STRUCT *body_ptr)
+{
+	int64_t new_usage;
+
+	new_usage = sizeof(META_CACHE_LOOKUP_ENTRY_STRUCT);
+	if (body_ptr->dir_meta != NULL)
+		new_usage += sizeof(DIR_META_TYPE);
+	if (body_ptr->file_meta != NULL)
+		new_usage += sizeof(FILE_META_TYPE);
+	if (body_ptr->symlink_meta != NULL)
+		new_usage += sizeof(SYMLINK_META_TYPE);
+	if (body_ptr->dir_entry_cache[0] != NULL)
+		new_usage += sizeof(DIR_ENTRY_PAGE);
+	if (body_ptr->dir_entry_cache[1] != NULL)
+		new_usage += sizeof(DIR_ENTRY_PAGE);
+	new_usage += dir_page_cache_mem_usage(body_ptr->dir_page_cache);
+	new_usage += dir_name_index_mem_usage(body_ptr->name_index);
+	new_usage += dir_name_index_mem_usage(body_ptr->partial_name_index);
+	new_usage += block_map_cache_mem_usage(body_ptr->block_map_cache);
+	if (body_ptr->mmap_addr != NULL)
+		new_usage += body_ptr->mmap_len;
+
+	if (new_usage == body_ptr->mem_usage)
+		return;
+	__atomic_add_fetch(&(meta_cache_stat.mem_used),
+			   new_usage - body_ptr->mem_usage, __ATOMIC_RELAXED);
+	body_ptr->mem_usage = new_usage;
+}
+
+/* Helper function for returning the bytes of an entry being freed */
+static inline void _release_entry_mem(META_CACHE_ENTRY_STRUCT *body_ptr)
+{
+	__atomic_sub_fetch(&(meta_cache_stat.mem_used), body_ptr->mem_usage,
+			   __ATOMIC_RELAXED);
+	body_ptr->mem_usage = 0;
+}
+
+/* Helper function for waiting until no lockless reader can still hold a
+	lookup entry just unlinked from chain "index". Header lock must be
+	held. Readers arriving after the generation flip use the other slot
+	and cannot see the unlinked entry, so the wait is bounded. */
+static inline void _wait_lockless_readers(int32_t index)
+{
+	META_CACHE_HEADER_STRUCT *header;
+	uint32_t old_gen;
+
+	header = &(meta_mem_cache[index]);
+	old_gen = __atomic_fetch_add(&(header->reader_gen), 1,
+				     __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&(header->num_readers[old_gen & 1]),
+			       __ATOMIC_SEQ_CST) > 0)
+		sched_yield();
+}
+
 /**
  * Get meta size from meta cache
  *
@@ -207,6 +284,8 @@ int32_t init_meta_cache_headers(void)
 						NUM_META_MEM_CACHE_HEADERS);
 
 	current_meta_mem_cache_entries = 0;
+	memset(&meta_cache_stat, 0, sizeof(META_CACHE_STAT));
+	meta_cache_clock_hand = 0;
 
 	ret = sem_init(&num_entry_sem, 0, 1);
 	if (ret < 0) {
@@ -251,6 +330,7 @@ int32_t release_meta_cache_headers(void)
 	ret_val = flush_clean_all_meta_cache();
 
 	current_meta_mem_cache_entries = 0;
+	meta_cache_stat.mem_used = 0;
 
 	free(meta_mem_cache);
 	return ret_val;
@@ -484,6 +564,9 @@ int32_t flush_clean_all_meta_cache(void)
 			continue;
 		}
 		this_ptr = meta_mem_cache[count].meta_cache_entries;
+		__atomic_store_n(&(meta_mem_cache[count].meta_cache_entries),
+				 NULL, __ATOMIC_RELEASE);
+		_wait_lockless_readers(count);
 		while (this_ptr != NULL) {
 			sem_wait(&((this_ptr->body).access_sem));
 			if ((this_ptr->body).something_dirty == TRUE)
@@ -538,6 +621,10 @@ int32_t free_single_meta_cache_entry(META_CACHE_LOOKUP_ENTRY_STRUCT *entry_ptr)
 		free(entry_body->dir_entry_cache[0]);
 	if (entry_body->dir_entry_cache[1] != NULL)
 		free(entry_body->dir_entry_cache[1]);
+	dir_page_cache_destroy(&(entry_body->dir_page_cache));
+	dir_name_index_destroy(&(entry_body->name_index));
+	dir_name_index_destroy(&(entry_body->partial_name_index));
+	block_map_cache_destroy(&(entry_body->block_map_cache));
 	if (entry_body->meta_opened) {
 		if (entry_body->fptr != NULL) {
 			MUNMAP(entry_body);
@@ -545,6 +632,7 @@ int32_t free_single_meta_cache_entry(META_CACHE_LOOKUP_ENTRY_STRUCT *entry_ptr)
 		}
 		entry_body->meta_opened = FALSE;
 	}
+	_release_entry_mem(entry_body);
 
 	return 0;
 }
@@ -590,7 +678,7 @@ processing the new one */
 	_ASSERT_CACHE_LOCK_IS_LOCKED_(&(body_ptr->access_sem));
 
 	if (inode_stat != NULL) {
-		memcpy(&(body_ptr->this_stat), inode_stat, sizeof(HCFS_STAT));
+		_set_cached_stat(body_ptr, inode_stat);
 		body_ptr->stat_dirty = TRUE;
 	}
 
@@ -683,7 +771,7 @@ processing the new one */
 	_ASSERT_CACHE_LOCK_IS_LOCKED_(&(body_ptr->access_sem));
 
 	if (inode_stat != NULL) {
-		memcpy(&(body_ptr->this_stat), inode_stat, sizeof(HCFS_STAT));
+		_set_cached_stat(body_ptr, inode_stat);
 		body_ptr->stat_dirty = TRUE;
 	}
 
@@ -756,7 +844,7 @@ int32_t meta_cache_update_stat_nosync(ino_t this_inode,
 	_ASSERT_CACHE_LOCK_IS_LOCKED_(&(body_ptr->access_sem));
 
 	if (inode_stat != NULL) {
-		memcpy(&(body_ptr->this_stat), inode_stat, sizeof(HCFS_STAT));
+		_set_cached_stat(body_ptr, inode_stat);
 		body_ptr->stat_dirty = TRUE;
 	}
 
@@ -932,6 +1020,7 @@ int32_t meta_cache_lookup_dir_data(ino_t this_inode,
 				   META_CACHE_ENTRY_STRUCT *body_ptr)
 {
 	int32_t ret, errcode;
+	DIR_ENTRY_PAGE *cached_page;
 
 	UNUSED(this_inode);
 	_ASSERT_CACHE_LOCK_IS_LOCKED_(&(body_ptr->access_sem));
@@ -970,6 +1059,14 @@ int32_t meta_cache_lookup_dir_data(ino_t this_inode,
 				/* TODO: consider swapping entries 0 and 1 */
 				memcpy(dir_page, (body_ptr->dir_entry_cache[1]),
 						sizeof(DIR_ENTRY_PAGE));
+			} else if ((cached_page = dir_page_cache_get(
+					body_ptr->dir_page_cache,
+					dir_page->this_page_pos)) != NULL) {
+				/* Pages not cached here are not added, so that
+				a readdir scan does not push out the leaves
+				used by lookups */
+				memcpy(dir_page, cached_page,
+						sizeof(DIR_ENTRY_PAGE));
 			} else {
 				/* Cannot find the requested page in cache */
 				ret = _open_file(body_ptr);
@@ -997,6 +1094,24 @@ errcode_handle:
 	return errcode;
 }
 
+/* Helper function for updating the name index with the entries of a dir
+	entry page being written. Entries are never removed from a page this
+	way, so updating the indexed names is enough. */
+static void _sync_name_index_page(META_CACHE_ENTRY_STRUCT *body_ptr,
+				  const DIR_ENTRY_PAGE *dir_page)
+{
+	int32_t count;
+
+	for (count = 0; count < dir_page->num_entries; count++) {
+		if (dir_name_index_insert(body_ptr->name_index,
+				&(dir_page->dir_entries[count])) < 0) {
+			dir_name_index_destroy(&(body_ptr->name_index));
+			break;
+		}
+	}
+	_account_entry_mem(body_ptr);
+}
+
 /************************************************************************
 *
 * Function name: meta_cache_update_dir_data
@@ -1031,7 +1146,7 @@ the new one */
 	_ASSERT_CACHE_LOCK_IS_LOCKED_(&(bptr->access_sem));
 
 	if (inode_stat != NULL) {
-		memcpy(&(bptr->this_stat), inode_stat, sizeof(HCFS_STAT));
+		_set_cached_stat(bptr, inode_stat);
 		bptr->stat_dirty = TRUE;
 	}
 
@@ -1069,6 +1184,12 @@ the new one */
 					return ret;
 			}
 		}
+		ret = dir_page_cache_update(bptr->dir_page_cache, dir_page);
+		if (ret < 0)
+			return ret;
+		if (bptr->name_index != NULL)
+			_sync_name_index_page(bptr, dir_page);
+		dir_name_index_destroy(&(bptr->partial_name_index));
 	}
 
 	gettimeofday(&(bptr->last_access_time), NULL);
@@ -1087,6 +1208,203 @@ the new one */
 	return 0;
 }
 
+/* Helper function for caching a b-tree node read from the meta file. The
+	node shares the byte budget of the meta cache, so the least recently
+	used leaves of this dir are dropped to make room. If there is still
+	no room, the node is simply not cached. */
+static void _cache_btree_node(META_CACHE_ENTRY_STRUCT *body_ptr,
+			      const DIR_ENTRY_PAGE *tpage)
+{
+	int64_t mem_used;
+
+	mem_used = __atomic_load_n(&(meta_cache_stat.mem_used),
+				   __ATOMIC_RELAXED);
+	while (mem_used + (int64_t)sizeof(DIR_PAGE_CACHE_ENTRY) >
+	       MAX_META_MEM_CACHE_BYTES) {
+		if (dir_page_cache_shrink(body_ptr->dir_page_cache) == 0)
+			return;
+		_account_entry_mem(body_ptr);
+		mem_used = __atomic_load_n(&(meta_cache_stat.mem_used),
+					   __ATOMIC_RELAXED);
+	}
+
+	if (dir_page_cache_put(&(body_ptr->dir_page_cache), tpage) < 0)
+		return;
+	_account_entry_mem(body_ptr);
+}
+
+/* Helper function for searching "childname" in the dir entry b-tree
+	rooted at "root_pos". Nodes on the path are taken from the b-tree node
+	cache if possible, and are read from the meta file and cached if not.
+	Returns 0 if found, -ENOENT if not found, or negation of error code. */
+static int32_t _search_dir_page_cache(META_CACHE_ENTRY_STRUCT *body_ptr,
+				      const char *childname, int64_t root_pos,
+				      int32_t *result_index,
+				      DIR_ENTRY_PAGE *result_page,
+				      BOOL is_external)
+{
+	DIR_ENTRY tmp_entry;
+	DIR_ENTRY_PAGE temppage, *tpage;
+	int64_t page_pos;
+	int32_t s_index, ret, errcode;
+
+	strcpy(tmp_entry.d_name, childname);
+	page_pos = root_pos;
+
+	while (page_pos > 0) {
+		tpage = dir_page_cache_get(body_ptr->dir_page_cache, page_pos);
+		if (tpage == NULL) {
+			MREAD(body_ptr, &temppage, sizeof(DIR_ENTRY_PAGE),
+			      page_pos);
+			tpage = &temppage;
+			_cache_btree_node(body_ptr, tpage);
+		}
+
+		s_index = 0;
+		ret = dentry_binary_search(tpage->dir_entries,
+				tpage->num_entries, &tmp_entry, &s_index,
+				is_external);
+		if (ret >= 0) {
+			*result_index = ret;
+			memcpy(result_page, tpage, sizeof(DIR_ENTRY_PAGE));
+			return 0;
+		}
+		if ((s_index < 0) || (s_index > tpage->num_entries))
+			return -EIO;
+		page_pos = tpage->child_page_pos[s_index];
+	}
+	return -ENOENT;
+
+errcode_handle:
+	return errcode;
+}
+
+/* Helper function for building the name index of a dir by walking the
+	tree walk list. At most DIR_NAME_INDEX_BUILD_PAGES nodes are read per
+	call, so a lookup holding the entry lock never reads the whole dir.
+	Returns 0 once the index is done, 1 if more nodes are to be walked,
+	or negation of error code. */
+static int32_t _build_name_index(META_CACHE_ENTRY_STRUCT *body_ptr,
+				 const DIR_META_TYPE *dir_meta,
+				 BOOL is_external)
+{
+	DIR_NAME_INDEX *index;
+	DIR_ENTRY_PAGE temppage;
+	int64_t page_pos;
+	int32_t count, num_read, ret, errcode;
+
+	ret = _open_file(body_ptr);
+	if (ret < 0)
+		return ret;
+
+	if (body_ptr->partial_name_index == NULL) {
+		body_ptr->partial_name_index = dir_name_index_create(
+				dir_meta->total_children + 2, is_external);
+		if (body_ptr->partial_name_index == NULL)
+			return -ENOMEM;
+		body_ptr->name_index_next_page = dir_meta->tree_walk_list_head;
+		body_ptr->name_index_walked_pages = 0;
+	}
+	index = body_ptr->partial_name_index;
+
+	page_pos = body_ptr->name_index_next_page;
+	for (num_read = 0; num_read < DIR_NAME_INDEX_BUILD_PAGES;
+	     num_read++) {
+		if (page_pos <= 0)
+			break;
+		/* Each node holds at least one entry. A longer walk means
+		the list is broken. */
+		body_ptr->name_index_walked_pages++;
+		if (body_ptr->name_index_walked_pages >
+		    dir_meta->total_children + 2) {
+			errcode = -EIO;
+			goto errcode_handle;
+		}
+		MREAD(body_ptr, &temppage, sizeof(DIR_ENTRY_PAGE), page_pos);
+		if ((temppage.num_entries < 0) ||
+		    (temppage.num_entries > MAX_DIR_ENTRIES_PER_PAGE)) {
+			errcode = -EIO;
+			goto errcode_handle;
+		}
+		for (count = 0; count < temppage.num_entries; count++) {
+			ret = dir_name_index_insert(index,
+					&(temppage.dir_entries[count]));
+			if (ret < 0) {
+				errcode = ret;
+				goto errcode_handle;
+			}
+		}
+		page_pos = temppage.tree_walk_next;
+	}
+	body_ptr->name_index_next_page = page_pos;
+
+	if (page_pos > 0) {
+		_account_entry_mem(body_ptr);
+		return 1;
+	}
+	body_ptr->name_index = index;
+	body_ptr->partial_name_index = NULL;
+	_account_entry_mem(body_ptr);
+	return 0;
+
+errcode_handle:
+	dir_name_index_destroy(&(body_ptr->partial_name_index));
+	_account_entry_mem(body_ptr);
+	return errcode;
+}
+
+/* Helper function for looking up "childname" in the name index. Building
+	the index starts on the lookup that makes a large dir hot, if the meta
+	cache has room for it, and goes on over the following lookups. Returns
+	0 if found, -ENOENT if the name is not in the dir, or 1 if the index
+	cannot answer. */
+static int32_t _lookup_name_index(META_CACHE_ENTRY_STRUCT *body_ptr,
+				  const DIR_META_TYPE *dir_meta,
+				  const char *childname, BOOL is_external,
+				  DIR_ENTRY *dentry)
+{
+	int64_t est_usage, mem_used;
+	int32_t ret;
+
+	if (body_ptr->name_index == NULL) {
+		/* Lookups in small dirs only touch the cached root */
+		if ((dir_meta->total_children <= MAX_DIR_ENTRIES_PER_PAGE) ||
+		    (dir_meta->total_children > DIR_NAME_INDEX_MAX_NAMES))
+			return 1;
+		if (body_ptr->partial_name_index == NULL) {
+			body_ptr->name_index_lookups++;
+			if (body_ptr->name_index_lookups <
+			    DIR_NAME_INDEX_HOT_LOOKUPS)
+				return 1;
+			body_ptr->name_index_lookups = 0;
+
+			est_usage = (dir_meta->total_children + 2) *
+				    (int64_t)(sizeof(DIR_NAME_NODE) + 32);
+			mem_used = __atomic_load_n(&(meta_cache_stat.mem_used),
+						   __ATOMIC_RELAXED);
+			if (mem_used + est_usage > MAX_META_MEM_CACHE_BYTES)
+				return 1;
+		} else if (body_ptr->partial_name_index->is_external !=
+			   is_external) {
+			return 1;
+		}
+
+		ret = _build_name_index(body_ptr, dir_meta, is_external);
+		if (ret < 0) {
+			write_log(4, "Cannot build name index of inode %"
+				  PRIu64 ". Code %d\n",
+				  (uint64_t)body_ptr->inode_num, -ret);
+			return 1;
+		}
+		if (ret > 0)
+			return 1;
+	}
+
+	if (body_ptr->name_index->is_external != is_external)
+		return 1;
+	return dir_name_index_lookup(body_ptr->name_index, childname, dentry);
+}
+
 /************************************************************************
 *
 * Function name: meta_cache_seek_dir_entry
@@ -1108,7 +1426,7 @@ int32_t meta_cache_seek_dir_entry(ino_t this_inode, DIR_ENTRY_PAGE *result_page,
 {
 	char thismetapath[METAPATHLEN];
 	DIR_META_TYPE dir_meta;
-	DIR_ENTRY_PAGE temppage, *rootpage, tmp_resultpage;
+	DIR_ENTRY_PAGE temppage, tmp_resultpage;
 	DIR_ENTRY_PAGE *tmp_page_ptr;
 	int32_t ret, errcode;
 	int64_t nextfilepos;
@@ -1197,6 +1515,15 @@ int32_t meta_cache_seek_dir_entry(ino_t this_inode, DIR_ENTRY_PAGE *result_page,
 	if (nextfilepos <= 0)
 		return 0;
 
+	/* Names missing from the name index are not in the dir. Finish
+	the lookup without reading the meta file. */
+	ret = _lookup_name_index(body_ptr, &dir_meta, childname, is_external,
+				 NULL);
+	if (ret == -ENOENT) {
+		gettimeofday(&(body_ptr->last_access_time), NULL);
+		return 0;
+	}
+
 	memset(&temppage, 0, sizeof(DIR_ENTRY_PAGE));
 
 	if (body_ptr->meta_opened == FALSE) {
@@ -1219,12 +1546,8 @@ int32_t meta_cache_seek_dir_entry(ino_t this_inode, DIR_ENTRY_PAGE *result_page,
 		body_ptr->meta_opened = TRUE;
 	}
 
-	/*Read the root node*/
-	rootpage = MREAD(body_ptr, NULL, sizeof(DIR_ENTRY_PAGE), nextfilepos);
-
-	ret = search_dir_entry_btree(childname, rootpage,
-			fileno(body_ptr->fptr), &tmp_index, &tmp_resultpage,
-			is_external);
+	ret = _search_dir_page_cache(body_ptr, childname, nextfilepos,
+			&tmp_index, &tmp_resultpage, is_external);
 	if ((ret < 0) && (ret != -ENOENT)) {
 		errcode = ret;
 		goto errcode_handle;
@@ -1266,6 +1589,253 @@ errcode_handle:
 	return errcode;
 }
 
+/************************************************************************
+*
+* Function name: meta_cache_lookup_dir_name
+*        Inputs: ino_t this_inode, const char *childname, DIR_ENTRY *dentry,
+*                META_CACHE_ENTRY_STRUCT *body_ptr, BOOL is_external
+*       Summary: Find the dir entry of "childname" in dir "this_inode" and
+*                return it in "dentry". The name index is used if the dir
+*                has one. Otherwise the b-tree is searched.
+*  Return value: 0 if found, -ENOENT if not found. Otherwise returns
+*                negation of error code.
+*
+*************************************************************************/
+int32_t meta_cache_lookup_dir_name(ino_t this_inode, const char *childname,
+				   DIR_ENTRY *dentry,
+				   META_CACHE_ENTRY_STRUCT *body_ptr,
+				   BOOL is_external)
+{
+	DIR_ENTRY_PAGE temppage;
+	int32_t ret, tmp_index;
+
+	_ASSERT_CACHE_LOCK_IS_LOCKED_(&(body_ptr->access_sem));
+
+	/* Stage 2 of restoration rebuilds dir statistics in
+	meta_cache_seek_dir_entry for every entry found */
+	if ((body_ptr->name_index != NULL) &&
+	    (body_ptr->name_index->is_external == is_external) &&
+	    (hcfs_system->system_restoring != RESTORING_STAGE2)) {
+		gettimeofday(&(body_ptr->last_access_time), NULL);
+		return dir_name_index_lookup(body_ptr->name_index, childname,
+					     dentry);
+	}
+
+	ret = meta_cache_seek_dir_entry(this_inode, &temppage, &tmp_index,
+					childname, body_ptr, is_external);
+	if (ret < 0)
+		return ret;
+	if (tmp_index < 0)
+		return -ENOENT;
+
+	memcpy(dentry, &(temppage.dir_entries[tmp_index]), sizeof(DIR_ENTRY));
+	return 0;
+}
+
+/************************************************************************
+*
+* Function name: meta_cache_name_index_add
+*        Inputs: META_CACHE_ENTRY_STRUCT *body_ptr, const DIR_ENTRY *dentry
+*       Summary: Add a new dir entry to the name index of the dir, if the
+*                dir has one. Must be called after the entry is inserted
+*                to the b-tree. The index is dropped if it cannot be
+*                updated.
+*  Return value: 0 if successful, or -EINVAL if the entry is not locked.
+*
+*************************************************************************/
+int32_t meta_cache_name_index_add(META_CACHE_ENTRY_STRUCT *body_ptr,
+				  const DIR_ENTRY *dentry)
+{
+	_ASSERT_CACHE_LOCK_IS_LOCKED_(&(body_ptr->access_sem));
+
+	if (body_ptr->name_index == NULL)
+		return 0;
+	if (dir_name_index_insert(body_ptr->name_index, dentry) < 0)
+		dir_name_index_destroy(&(body_ptr->name_index));
+	_account_entry_mem(body_ptr);
+	return 0;
+}
+
+/************************************************************************
+*
+* Function name: meta_cache_name_index_remove
+*        Inputs: META_CACHE_ENTRY_STRUCT *body_ptr, const char *name
+*       Summary: Remove "name" from the name index of the dir, if the dir
+*                has one. Must be called after the entry is deleted from
+*                the b-tree. The index is dropped if the name was not
+*                indexed, as the index is no longer trusted.
+*  Return value: 0 if successful, or -EINVAL if the entry is not locked.
+*
+*************************************************************************/
+int32_t meta_cache_name_index_remove(META_CACHE_ENTRY_STRUCT *body_ptr,
+				     const char *name)
+{
+	_ASSERT_CACHE_LOCK_IS_LOCKED_(&(body_ptr->access_sem));
+
+	if (body_ptr->name_index == NULL)
+		return 0;
+	if (dir_name_index_delete(body_ptr->name_index, name) < 0) {
+		write_log(4, "Name index of inode %" PRIu64 " is out of sync\n",
+			  (uint64_t)body_ptr->inode_num);
+		dir_name_index_destroy(&(body_ptr->name_index));
+	}
+	_account_entry_mem(body_ptr);
+	return 0;
+}
+
+/************************************************************************
+*
+* Function name: meta_cache_drop_name_index
+*        Inputs: META_CACHE_ENTRY_STRUCT *body_ptr
+*       Summary: Drop the name index of the dir. Used when the b-tree might
+*                be left in an unknown state by a failed update.
+*  Return value: 0 if successful, or -EINVAL if the entry is not locked.
+*
+*************************************************************************/
+int32_t meta_cache_drop_name_index(META_CACHE_ENTRY_STRUCT *body_ptr)
+{
+	_ASSERT_CACHE_LOCK_IS_LOCKED_(&(body_ptr->access_sem));
+
+	dir_name_index_destroy(&(body_ptr->name_index));
+	dir_name_index_destroy(&(body_ptr->partial_name_index));
+	body_ptr->name_index_lookups = 0;
+	_account_entry_mem(body_ptr);
+	return 0;
+}
+
+/************************************************************************
+*
+* Function name: meta_cache_track_dir_pages
+*        Inputs: META_CACHE_ENTRY_STRUCT *body_ptr, BOOL enable
+*       Summary: If "enable" is TRUE, b-tree nodes of the dir written or
+*                freed by this thread are refreshed or dropped in the
+*                cached nodes of the dir as they are written. Must be
+*                called with FALSE once the b-tree update is done.
+*  Return value: 0 if successful, or -EINVAL if the entry is not locked.
+*
+*************************************************************************/
+int32_t meta_cache_track_dir_pages(META_CACHE_ENTRY_STRUCT *body_ptr,
+				   BOOL enable)
+{
+	_ASSERT_CACHE_LOCK_IS_LOCKED_(&(body_ptr->access_sem));
+
+	if (enable == TRUE) {
+		/* Entries may move between nodes already walked and nodes
+		not walked yet, so a partly built name index is dropped */
+		dir_name_index_destroy(&(body_ptr->partial_name_index));
+		dir_btree_track_pages(body_ptr->dir_page_cache);
+		return 0;
+	}
+	dir_btree_track_pages(NULL);
+	_account_entry_mem(body_ptr);
+	return 0;
+}
+
+/************************************************************************
+*
+* Function name: meta_cache_refresh_dir_page
+*        Inputs: META_CACHE_ENTRY_STRUCT *body_ptr,
+*                const DIR_ENTRY_PAGE *page
+*       Summary: Refresh the cached copies of b-tree node "page" after the
+*                node is written to the meta file directly.
+*  Return value: 0 if successful, or -EINVAL if the entry is not locked.
+*
+*************************************************************************/
+int32_t meta_cache_refresh_dir_page(META_CACHE_ENTRY_STRUCT *body_ptr,
+				    const DIR_ENTRY_PAGE *page)
+{
+	int32_t count;
+
+	_ASSERT_CACHE_LOCK_IS_LOCKED_(&(body_ptr->access_sem));
+
+	for (count = 0; count < 2; count++) {
+		if ((body_ptr->dir_entry_cache[count] != NULL) &&
+		    ((body_ptr->dir_entry_cache[count])->this_page_pos ==
+		     page->this_page_pos))
+			memcpy(body_ptr->dir_entry_cache[count], page,
+			       sizeof(DIR_ENTRY_PAGE));
+	}
+	/* The node is dropped if it cannot be refreshed */
+	dir_page_cache_update(body_ptr->dir_page_cache, page);
+	_account_entry_mem(body_ptr);
+	return 0;
+}
+
+/************************************************************************
+*
+* Function name: meta_cache_lookup_block_map
+*        Inputs: META_CACHE_ENTRY_STRUCT *body_ptr, int64_t page_index
+*       Summary: Find the file pos of block entry page "page_index" among
+*                the positions cached for the file.
+*  Return value: File pos of the page, 0 if not cached, or -EINVAL if the
+*                entry is not locked.
+*
+*************************************************************************/
+int64_t meta_cache_lookup_block_map(META_CACHE_ENTRY_STRUCT *body_ptr,
+				    int64_t page_index)
+{
+	_ASSERT_CACHE_LOCK_IS_LOCKED_(&(body_ptr->access_sem));
+
+	return block_map_cache_get(body_ptr->block_map_cache, page_index);
+}
+
+/************************************************************************
+*
+* Function name: meta_cache_add_block_map
+*        Inputs: META_CACHE_ENTRY_STRUCT *body_ptr, int64_t page_index,
+*                int64_t page_pos
+*       Summary: Cache the file pos of block entry page "page_index". The
+*                positions share the byte budget of the meta cache, so the
+*                least recently used positions of this file are dropped to
+*                make room. If there is still no room, the position is
+*                simply not cached.
+*  Return value: 0 if successful, or -EINVAL if the entry is not locked.
+*
+*************************************************************************/
+int32_t meta_cache_add_block_map(META_CACHE_ENTRY_STRUCT *body_ptr,
+				 int64_t page_index, int64_t page_pos)
+{
+	int64_t mem_used, extra_mem;
+
+	_ASSERT_CACHE_LOCK_IS_LOCKED_(&(body_ptr->access_sem));
+
+	extra_mem = sizeof(BLOCK_MAP_CACHE_ENTRY);
+	if (body_ptr->block_map_cache == NULL)
+		extra_mem += sizeof(BLOCK_MAP_CACHE);
+	mem_used = __atomic_load_n(&(meta_cache_stat.mem_used),
+				   __ATOMIC_RELAXED);
+	while (mem_used + extra_mem > MAX_META_MEM_CACHE_BYTES) {
+		if (block_map_cache_shrink(body_ptr->block_map_cache) == 0)
+			return 0;
+		_account_entry_mem(body_ptr);
+		mem_used = __atomic_load_n(&(meta_cache_stat.mem_used),
+					   __ATOMIC_RELAXED);
+	}
+
+	if (block_map_cache_put(&(body_ptr->block_map_cache), page_index,
+				page_pos) < 0)
+		return 0;
+	_account_entry_mem(body_ptr);
+	return 0;
+}
+
+/************************************************************************
+*
+* Function name: meta_cache_drop_block_map
+*        Inputs: META_CACHE_ENTRY_STRUCT *body_ptr
+*       Summary: Drop the cached block entry page positions of the file.
+*  Return value: 0 if successful, or -EINVAL if the entry is not locked.
+*
+*************************************************************************/
+int32_t meta_cache_drop_block_map(META_CACHE_ENTRY_STRUCT *body_ptr)
+{
+	_ASSERT_CACHE_LOCK_IS_LOCKED_(&(body_ptr->access_sem));
+
+	block_map_cache_destroy(&(body_ptr->block_map_cache));
+	_account_entry_mem(body_ptr);
+	return 0;
+}
+
 /************************************************************************
 *
 * Function name: meta_cache_remove
@@ -1336,13 +1906,15 @@ int32_t meta_cache_remove(ino_t this_inode)
 	if (body_ptr->dir_entry_cache[1] != NULL)
 		free(body_ptr->dir_entry_cache[1]);
 
+	dir_page_cache_destroy(&(body_ptr->dir_page_cache));
+	dir_name_index_destroy(&(body_ptr->name_index));
+	dir_name_index_destroy(&(body_ptr->partial_name_index));
+	block_map_cache_destroy(&(body_ptr->block_map_cache));
 
-	current_ptr->inode_num = 0;
+	__atomic_store_n(&(current_ptr->inode_num), 0, __ATOMIC_RELAXED);
 
 	sem_post(&((current_ptr->body).access_sem));
 
-	memset(body_ptr, 0, sizeof(META_CACHE_ENTRY_STRUCT));
-
 	if (current_ptr->next != NULL)
 		current_ptr->next->prev = prev_ptr;
 
@@ -1350,12 +1922,18 @@ int32_t meta_cache_remove(ino_t this_inode)
 		meta_mem_cache[index].last_entry = prev_ptr;
 
 	if (prev_ptr != NULL)
-		prev_ptr->next = current_ptr->next;
+		__atomic_store_n(&(prev_ptr->next), current_ptr->next,
+				 __ATOMIC_RELEASE);
 	else
-		meta_mem_cache[index].meta_cache_entries = current_ptr->next;
+		__atomic_store_n(&(meta_mem_cache[index].meta_cache_entries),
+				 current_ptr->next, __ATOMIC_RELEASE);
 
 	meta_mem_cache[index].num_entries--;
 
+	/* Lockless stat readers may still be looking at the entry */
+	_wait_lockless_readers(index);
+	_release_entry_mem(body_ptr);
+	memset(body_ptr, 0, sizeof(META_CACHE_ENTRY_STRUCT));
 	free(current_ptr);
 
 	sem_wait(&num_entry_sem);
@@ -1384,18 +1962,23 @@ static inline int32_t _expire_entry(META_CACHE_LOOKUP_ENTRY_STRUCT *lptr,
 	if (lptr->next != NULL)
 		lptr->next->prev = lptr->prev;
 	if (lptr->prev != NULL)
-		lptr->prev->next = lptr->next;
+		__atomic_store_n(&(lptr->prev->next), lptr->next,
+				 __ATOMIC_RELEASE);
 	if (meta_mem_cache[cindex].last_entry == lptr)
 		meta_mem_cache[cindex].last_entry = lptr->prev;
 	if (meta_mem_cache[cindex].meta_cache_entries == lptr)
-		meta_mem_cache[cindex].meta_cache_entries = lptr->next;
+		__atomic_store_n(&(meta_mem_cache[cindex].meta_cache_entries),
+				 lptr->next, __ATOMIC_RELEASE);
 	meta_mem_cache[cindex].num_entries--;
 
 	sem_post(&(lptr->body).access_sem);
+	_wait_lockless_readers(cindex);
 	free(lptr);
 	sem_wait(&num_entry_sem);
 	current_meta_mem_cache_entries--;
 	sem_post(&num_entry_sem);
+	__atomic_add_fetch(&(meta_cache_stat.num_evictions), 1,
+			   __ATOMIC_RELAXED);
 	sem_post(&(meta_mem_cache[cindex].header_sem));
 
 	return 0;
@@ -1411,33 +1994,37 @@ errhandle:
 *
 * Function name: expire_meta_mem_cache_entry
 *        Inputs: None
-*       Summary: Try to expire some cache entry that has not been used
-*                in a given period of time.
+*       Summary: Evict one meta cache entry chosen by CLOCK replacement.
 *  Return value: If successfully expire something, returns 0.
 *                If not, returns -EBUSY.
 *                Returns negation of error code if error.
 *          Note: How to expire:
-*                Starting from some random header index, check from
-*                last_entry to find out if can lock some entry. If so,
-*                expire it if last_access_time > 0.5 sec.
-*                Move to the next index if cannot expire anything,
-*                wrap back to 0 if overflow.
+*                The clock hand sweeps meta_mem_cache[] from where the
+*                last sweep stopped, checking each chain from last_entry.
+*                Entries that cannot be locked or are uploading are
+*                skipped. A referenced entry (clock_ref > 0) loses one
+*                reference and is passed over, and the first entry found
+*                with no reference is evicted. As each sweep takes one
+*                reference away, META_CACHE_MAX_CLOCK_REF + 1 sweeps are
+*                enough to find a victim if any entry can be evicted.
 *
 *************************************************************************/
 int32_t expire_meta_mem_cache_entry(void)
 {
-	int32_t start_index, cindex;
-	struct timeval current_time, *atime_ptr;
+	int32_t cindex, count;
+	int32_t num_sweeps;
 	META_CACHE_LOOKUP_ENTRY_STRUCT *lptr;
-	double float_current_time, float_access_time;
 	int32_t ret;
 
-	gettimeofday(&current_time, NULL);
-	srandom((uint32_t)(current_time.tv_usec));
-	start_index = (random() % NUM_META_MEM_CACHE_HEADERS);
-	cindex = start_index;
+	cindex = __atomic_load_n(&meta_cache_clock_hand, __ATOMIC_RELAXED);
+	num_sweeps = META_CACHE_MAX_CLOCK_REF + 1;
 	/* Go through meta_mem_cache[] */
-	do {
+	for (count = 0; count < num_sweeps * NUM_META_MEM_CACHE_HEADERS;
+	     count++) {
+		if (meta_mem_cache[cindex].num_entries <= 0) {
+			cindex = ((cindex + 1) % NUM_META_MEM_CACHE_HEADERS);
+			continue;
+		}
 		sem_wait(&(meta_mem_cache[cindex].header_sem));
 		lptr = meta_mem_cache[cindex].last_entry;
 		while (lptr != NULL) {
@@ -1445,35 +2032,67 @@ int32_t expire_meta_mem_cache_entry(void)
 				lptr = lptr->prev;
 				continue;
 			}
-			gettimeofday(&current_time, NULL);
-			float_current_time = (current_time.tv_sec * 1.0)
-				+ (current_time.tv_usec * 0.000001);
-			atime_ptr = &((lptr->body).last_access_time);
-			float_access_time = (atime_ptr->tv_sec * 1.0) +
-					(atime_ptr->tv_usec * 0.000001);
-			if ((float_current_time - float_access_time > 0.5) &&
-			    (lptr->body.uploading_info.is_uploading == FALSE)) {
+			if (lptr->body.uploading_info.is_uploading == TRUE) {
+				sem_post(&(lptr->body).access_sem);
+				lptr = lptr->prev;
+				continue;
+			}
+			if (__atomic_load_n(&((lptr->body).clock_ref),
+					    __ATOMIC_RELAXED) <= 0) {
 				/* Expire the entry */
+				__atomic_store_n(&meta_cache_clock_hand, cindex,
+						 __ATOMIC_RELAXED);
 				ret = _expire_entry(lptr, cindex);
 				return ret;
 			}
-			/* If find that current_time < last_access_time,
-				fix last_access_time to be current_time */
-			if (float_current_time < float_access_time)
-				gettimeofday(atime_ptr, NULL);
-
+			/* Give it a second chance */
+			__atomic_sub_fetch(&((lptr->body).clock_ref), 1,
+					   __ATOMIC_RELAXED);
 			sem_post(&(lptr->body).access_sem);
 			lptr = lptr->prev;
 		}
 
 		sem_post(&(meta_mem_cache[cindex].header_sem));
 		cindex = ((cindex + 1) % NUM_META_MEM_CACHE_HEADERS);
-	} while (cindex != start_index);
+	}
 
 	/* Nothing was expired */
+	__atomic_store_n(&meta_cache_clock_hand, cindex, __ATOMIC_RELAXED);
 	return -EBUSY;
 }
 
+/************************************************************************
+*
+* Function name: meta_cache_get_stat
+*        Inputs: META_CACHE_STAT *cache_stat, int64_t *num_entries
+*       Summary: Copy the hit, miss and eviction counters and the bytes
+*                used by the meta cache to "cache_stat", and the number
+*                of cached entries to "num_entries".
+*  Return value: 0 if successful. Otherwise returns negation of error code.
+*
+*************************************************************************/
+int32_t meta_cache_get_stat(META_CACHE_STAT *cache_stat,
+			    int64_t *num_entries)
+{
+	if (cache_stat == NULL)
+		return -EINVAL;
+
+	cache_stat->num_hits = __atomic_load_n(&(meta_cache_stat.num_hits),
+					       __ATOMIC_RELAXED);
+	cache_stat->num_misses = __atomic_load_n(
+			&(meta_cache_stat.num_misses), __ATOMIC_RELAXED);
+	cache_stat->num_evictions = __atomic_load_n(
+			&(meta_cache_stat.num_evictions), __ATOMIC_RELAXED);
+	cache_stat->mem_used = __atomic_load_n(&(meta_cache_stat.mem_used),
+					       __ATOMIC_RELAXED);
+	if (num_entries != NULL) {
+		sem_wait(&num_entry_sem);
+		*num_entries = current_meta_mem_cache_entries;
+		sem_post(&num_entry_sem);
+	}
+	return 0;
+}
+
 /************************************************************************
 *
 * Function name: meta_cache_lock_entry
@@ -1490,11 +2109,11 @@ META_CACHE_ENTRY_STRUCT *meta_cache_lock_entry(ino_t this_inode)
 	int32_t ret_val, ret;
 	int32_t index;
 	META_CACHE_LOOKUP_ENTRY_STRUCT *current_ptr;
-	char need_new, expire_done;
+	char need_new, expire_done, over_budget;
 	SUPER_BLOCK_ENTRY tempentry;
 	META_CACHE_ENTRY_STRUCT *result_ptr;
 	struct timespec time_to_sleep;
-	int32_t errcount;
+	int32_t errcount, busycount;
 
 	time_to_sleep.tv_sec = 0;
 	time_to_sleep.tv_nsec = 99999999; /*0.1 sec sleep*/
@@ -1504,9 +2123,11 @@ META_CACHE_ENTRY_STRUCT *meta_cache_lock_entry(ino_t this_inode)
 	sem_wait(&(meta_mem_cache[index].header_sem));
 
 	need_new = TRUE;
+	over_budget = FALSE;
 
 	while (need_new == TRUE) {
 		errcount = 0;
+		busycount = 0;
 		current_ptr = meta_mem_cache[index].meta_cache_entries;
 		while (current_ptr != NULL) {
 			if (current_ptr->inode_num == this_inode) { /* A hit */
@@ -1515,13 +2136,27 @@ META_CACHE_ENTRY_STRUCT *meta_cache_lock_entry(ino_t this_inode)
 			}
 			current_ptr = current_ptr->next;
 		}
-		if (need_new == FALSE)
+		if (need_new == FALSE) {
+			if (__atomic_load_n(&((current_ptr->body).clock_ref),
+					    __ATOMIC_RELAXED) <
+			    META_CACHE_MAX_CLOCK_REF)
+				__atomic_add_fetch(
+					&((current_ptr->body).clock_ref), 1,
+					__ATOMIC_RELAXED);
+			__atomic_add_fetch(&(meta_cache_stat.num_hits), 1,
+					   __ATOMIC_RELAXED);
 			break;
+		}
 
-		/*Probe whether entries full and expire some entry if full */
+		/*Probe whether entries or memory budget full and expire
+		some entry if full */
 		sem_wait(&num_entry_sem);
-		if (current_meta_mem_cache_entries >
-						MAX_META_MEM_CACHE_ENTRIES) {
+		if ((over_budget == FALSE) &&
+		    ((current_meta_mem_cache_entries >
+						MAX_META_MEM_CACHE_ENTRIES) ||
+		     (__atomic_load_n(&(meta_cache_stat.mem_used),
+				      __ATOMIC_RELAXED) >
+						MAX_META_MEM_CACHE_BYTES))) {
 			sem_post(&num_entry_sem);
 
 			/* Will need to release current header_sem, then
@@ -1532,9 +2167,22 @@ META_CACHE_ENTRY_STRUCT *meta_cache_lock_entry(ino_t this_inode)
 				ret_val = expire_meta_mem_cache_entry();
 				/* Sleep if cannot find one, then
 						retry */
-				if (ret_val < 0) {
-					if (ret_val != -EBUSY)
-						errcount++;
+				if (ret_val == -EBUSY) {
+					/* All entries are in use, maybe by
+					this thread. Go over the budget
+					instead of waiting forever */
+					busycount++;
+					if (busycount >=
+					    META_CACHE_MAX_BUSY_RETRIES) {
+						write_log(4, "Meta cache over "
+							"budget as all entries "
+							"are in use\n");
+						over_budget = TRUE;
+						break;
+					}
+					nanosleep(&time_to_sleep, NULL);
+				} else if (ret_val < 0) {
+					errcount++;
 					if (errcount > 5) {
 						write_log(0,
 							"Lock meta cache err");
@@ -1584,25 +2232,30 @@ META_CACHE_ENTRY_STRUCT *meta_cache_lock_entry(ino_t this_inode)
 
 		memset(current_ptr, 0, sizeof(META_CACHE_LOOKUP_ENTRY_STRUCT));
 
+		current_ptr->inode_num = this_inode;
+		sem_init(&((current_ptr->body).access_sem), 0, 1);
+		(current_ptr->body).inode_num = this_inode;
+		(current_ptr->body).meta_opened = FALSE;
+		(current_ptr->body).need_inc_seq = TRUE;
+		memcpy(&((current_ptr->body).this_stat),
+		       &(tempentry.inode_stat), sizeof(HCFS_STAT));
+		_account_entry_mem(&(current_ptr->body));
+		__atomic_add_fetch(&(meta_cache_stat.num_misses), 1,
+				   __ATOMIC_RELAXED);
+
+		/* Entry must be complete before lockless readers can see it */
 		current_ptr->next = meta_mem_cache[index].meta_cache_entries;
 		if (meta_mem_cache[index].meta_cache_entries != NULL)
 			meta_mem_cache[index].meta_cache_entries->prev =
 								current_ptr;
-		meta_mem_cache[index].meta_cache_entries = current_ptr;
+		__atomic_store_n(&(meta_mem_cache[index].meta_cache_entries),
+				 current_ptr, __ATOMIC_RELEASE);
 		if (meta_mem_cache[index].last_entry == NULL)
 			meta_mem_cache[index].last_entry = current_ptr;
-		current_ptr->inode_num = this_inode;
-		sem_init(&((current_ptr->body).access_sem), 0, 1);
 		meta_mem_cache[index].num_entries++;
 		sem_wait(&num_entry_sem);
 		current_meta_mem_cache_entries++;
 		sem_post(&num_entry_sem);
-
-		(current_ptr->body).inode_num = this_inode;
-		(current_ptr->body).meta_opened = FALSE;
-		(current_ptr->body).need_inc_seq = TRUE;
-		memcpy(&((current_ptr->body).this_stat),
-		       &(tempentry.inode_stat), sizeof(HCFS_STAT));
 		/* need_new = FALSE; */
 		break;
 	}
@@ -1649,6 +2302,8 @@ int32_t meta_cache_unlock_entry(META_CACHE_ENTRY_STRUCT *target_ptr)
 
 	if (target_ptr->can_be_synced_cloud_later == TRUE)
 		target_ptr->can_be_synced_cloud_later = FALSE;
+	/* Pages and mmaps may have changed while the entry was locked */
+	_account_entry_mem(target_ptr);
 	/* Unlock meta file if opened */
 	if (target_ptr->meta_opened == TRUE)
 		flock(fileno(target_ptr->fptr), LOCK_UN);
@@ -1724,6 +2379,7 @@ int32_t meta_cache_drop_pages(META_CACHE_ENTRY_STRUCT *body_ptr)
 		body_ptr->dir_entry_cache[1] = NULL;
 		body_ptr->dir_entry_cache_dirty[1] = FALSE;
 	}
+	_account_entry_mem(body_ptr);
 
 	UNUSED(ret_val);
 	/* TODO: variable ‘ret_val’ set but not used */
@@ -1755,7 +2411,7 @@ int32_t meta_cache_update_symlink_data(
 
 	/* Update stat */
 	if (inode_stat != NULL) {
-		memcpy(&(bptr->this_stat), inode_stat, sizeof(HCFS_STAT));
+		_set_cached_stat(bptr, inode_stat);
 		bptr->stat_dirty = TRUE;
 	}
 
@@ -1841,6 +2497,87 @@ errcode_handle:
 	return errcode;
 }
 
+/************************************************************************
+*
+* Function name: meta_cache_lookup_stat_snapshot
+*        Inputs: ino_t this_inode, HCFS_STAT *inode_stat
+*       Summary: Copy the cached stat of "this_inode" to "inode_stat"
+*                without locking the hash chain or the cache entry.
+*                Chain is walked with atomic loads, and the stat is read
+*                under the per-entry seqlock.
+*  Return value: 0 if successful. -ENOENT if inode is not cached, and
+*                -EAGAIN if the stat kept changing during the copy. Caller
+*                should fall back to meta_cache_lock_entry() on error.
+*
+*************************************************************************/
+int32_t meta_cache_lookup_stat_snapshot(ino_t this_inode,
+					HCFS_STAT *inode_stat)
+{
+	META_CACHE_HEADER_STRUCT *header;
+	META_CACHE_LOOKUP_ENTRY_STRUCT *current_ptr;
+	uint32_t gen, seq_begin, seq_end;
+	int32_t slot, count, ret;
+
+	if (this_inode == 0)
+		return -ENOENT;
+
+	header = &(meta_mem_cache[hash_inode_to_meta_cache(this_inode)]);
+
+	/* Register as a reader of the chain. Retry if an entry was unlinked
+	 * in between, as the writer might not have seen this reader. */
+	while (TRUE) {
+		gen = __atomic_load_n(&(header->reader_gen), __ATOMIC_SEQ_CST);
+		slot = gen & 1;
+		__atomic_add_fetch(&(header->num_readers[slot]), 1,
+				   __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&(header->reader_gen),
+				    __ATOMIC_SEQ_CST) == gen)
+			break;
+		__atomic_sub_fetch(&(header->num_readers[slot]), 1,
+				   __ATOMIC_SEQ_CST);
+	}
+
+	current_ptr = __atomic_load_n(&(header->meta_cache_entries),
+				      __ATOMIC_ACQUIRE);
+	while (current_ptr != NULL) {
+		if (__atomic_load_n(&(current_ptr->inode_num),
+				    __ATOMIC_RELAXED) == this_inode)
+			break;
+		current_ptr = __atomic_load_n(&(current_ptr->next),
+					      __ATOMIC_ACQUIRE);
+	}
+
+	ret = -ENOENT;
+	for (count = 0; current_ptr != NULL &&
+	     count < MAX_STAT_SNAPSHOT_RETRY; count++) {
+		seq_begin = __atomic_load_n(&(current_ptr->body.stat_seq),
+					    __ATOMIC_ACQUIRE);
+		if (seq_begin & 1) {
+			ret = -EAGAIN;
+			continue;
+		}
+		memcpy(inode_stat, &(current_ptr->body.this_stat),
+		       sizeof(HCFS_STAT));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		seq_end = __atomic_load_n(&(current_ptr->body.stat_seq),
+					  __ATOMIC_RELAXED);
+		if (seq_begin == seq_end) {
+			/* Mark as referenced for CLOCK. Skip the store if
+			 * already marked to keep the entry read-only. */
+			if (__atomic_load_n(&(current_ptr->body.clock_ref),
+					    __ATOMIC_RELAXED) <= 0)
+				__atomic_store_n(&(current_ptr->body.clock_ref),
+						 1, __ATOMIC_RELAXED);
+			ret = 0;
+			break;
+		}
+		ret = -EAGAIN;
+	}
+
+	__atomic_sub_fetch(&(header->num_readers[slot]), 1, __ATOMIC_SEQ_CST);
+	return ret;
+}
+
 /**
  * Set info about inode uploading
  *
@@ -27,10 +27,11 @@ All reads / writes go through the caches, and a parameter (TODO) controls
 when to write dirty cache entries back to files (could be write through or
 after several seconds). */
 
-/* A hard limit defines the upper bound on the number of entries
-	(or mem used?) */
-/* Dynamically allocate memory and release memory when not being used
-	for a int64_t time (controlled by a parameter) */
+/* Hard limits define the upper bound on the number of entries
+	(MAX_META_MEM_CACHE_ENTRIES) and on the bytes used by the entries
+	(MAX_META_MEM_CACHE_BYTES) */
+/* Entries are replaced with CLOCK (see expire_meta_mem_cache_entry),
+	so entries touched only once by a scan go before hot entries */
 
 /* Will keep cache entry even after file is closed, until expired or need
 	to be replaced */
@@ -42,12 +43,15 @@ after several seconds). */
 Each meta cache entry keeps
 1. Struct stat
 2. Struct DIR_META_TYPE or FILE_META_TYPE
-3. Up to two dir entry pages cached
-4. Up to two block entry pages cached  (deleted)
+3. Up to two dir entry pages cached for updates, plus the b-tree nodes of
+   the dir kept for lookups (see dir_page_cache.h), and a name index if
+   the dir is large and hot (see dir_name_index.h)
+4. Up to two block entry pages cached  (deleted). Positions of block entry
+   pages of a file are kept instead (see block_map_cache.h)
 5. Up to two xattr pages cached (pending)
 6. Number of opened handles to the inode
 7. Semaphore to the entry
-8. Last access time
+8. Last access time, CLOCK reference count and bytes used
 9. Dirty or clean status for items 1 to 5
 
 Lookup of cache entry:
@@ -66,6 +70,12 @@ If deleting cache entry, will need to acquire both the header lock and
 the entry lock before proceeding. If cache entry lock cannot be acquired
 immediately, should release header lock and sleep for a int16_t time, or skip
 to other entries.
+
+Stat-only lookups (getattr, access) can skip both locks. They walk the
+chain with atomic loads and copy the stat under the per-entry seqlock.
+Writers still add and remove entries under the header lock, but publish
+the chain pointers atomically and wait for the lockless readers of the
+chain to drain before freeing an unlinked entry.
 */
 
 #include <inttypes.h>
@@ -75,6 +85,9 @@ to other entries.
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include "block_map_cache.h"
+#include "dir_name_index.h"
+#include "dir_page_cache.h"
 #include "fuseop.h"
 
 /* Structure UPLOADING_INFO includes some information used to check whether this
@@ -88,6 +101,10 @@ typedef struct {
 
 typedef struct {
 	HCFS_STAT this_stat;
+	/* Seqlock counter for this_stat. Odd while the stat is being
+	 * rewritten, so that meta_cache_lookup_stat_snapshot() can read
+	 * the stat without locking the entry. */
+	uint32_t stat_seq;
 	ino_t inode_num;
 	char stat_dirty;
 	DIR_META_TYPE *dir_meta;	 /* Only used if inode is a dir */
@@ -102,6 +119,26 @@ typedef struct {
 	/*Zero if not pointed to any page*/
 	DIR_ENTRY_PAGE *dir_entry_cache[2];
 	char dir_entry_cache_dirty[2];
+	/* B-tree nodes cached for name lookups. Always clean, as updated
+	pages go through dir_entry_cache and are refreshed here. Nodes
+	written by b-tree inserts and deletes are refreshed as they are
+	written (see meta_cache_track_dir_pages()). */
+	DIR_PAGE_CACHE *dir_page_cache;
+	/* Name index of a large dir, built after DIR_NAME_INDEX_HOT_LOOKUPS
+	lookups. Kept coherent by dir_add_entry(), dir_remove_entry() and
+	meta_cache_update_dir_data(). */
+	DIR_NAME_INDEX *name_index;
+	int32_t name_index_lookups;
+	/* Name index being built, DIR_NAME_INDEX_BUILD_PAGES nodes of the
+	tree walk list per lookup. "name_index_next_page" is the next node
+	to walk. Discarded if the b-tree is changed before it is done. */
+	DIR_NAME_INDEX *partial_name_index;
+	int64_t name_index_next_page;
+	int64_t name_index_walked_pages;
+	/* Positions of block entry pages. Filled by seek_page() and
+	create_page(), and dropped on truncate and when the entry is
+	removed from the cache. */
+	BLOCK_MAP_CACHE *block_map_cache;
 
 	sem_t access_sem;
 	char something_dirty;
@@ -111,6 +148,12 @@ typedef struct {
 	/*TODO: Need to think whether system clock change could affect the
 	involved operations*/
 	struct timeval last_access_time;
+	/* CLOCK reference count. New entries start cold at zero, each hit
+	 * adds one up to META_CACHE_MAX_CLOCK_REF, and each pass of the
+	 * clock hand takes one away. Only cold entries are evicted. */
+	int32_t clock_ref;
+	/* Bytes charged to the cache for this entry */
+	int64_t mem_usage;
 	UPLOADING_INFO uploading_info; /* Only in memory */
 	/* [can_be_synced_cloud_later] is always false unless calling
 	 * meta_cache_sync_later() before meta_cache_update_xxx().  This flag
@@ -134,11 +177,29 @@ struct meta_cache_lookup_struct {
 
 typedef struct meta_cache_lookup_struct META_CACHE_LOOKUP_ENTRY_STRUCT;
 
+/* Counters of the meta cache exported through the API socket */
+typedef struct {
+	int64_t num_hits;
+	int64_t num_misses;
+	int64_t num_evictions;
+	int64_t mem_used;
+} META_CACHE_STAT;
+
+#define META_CACHE_MAX_CLOCK_REF 3
+/* Tries to evict an entry before going over the meta cache budget when
+ * all entries are in use */
+#define META_CACHE_MAX_BUSY_RETRIES 10
+
 typedef struct {
 	META_CACHE_LOOKUP_ENTRY_STRUCT *meta_cache_entries;
 	sem_t header_sem;
 	int32_t num_entries;
 	META_CACHE_LOOKUP_ENTRY_STRUCT *last_entry;
+	/* Lockless readers walking this chain, counted in two slots picked
+	 * by reader_gen. Lookup entries unlinked from the chain are freed
+	 * only after the readers in the old slot drained. */
+	uint32_t reader_gen;
+	int32_t num_readers[2];
 } META_CACHE_HEADER_STRUCT;
 
 int32_t meta_cache_get_meta_size(META_CACHE_ENTRY_STRUCT *ptr,
@@ -194,6 +255,25 @@ int32_t meta_cache_seek_dir_entry(ino_t this_inode,
 				  const char *childname,
 				  META_CACHE_ENTRY_STRUCT *body_ptr,
 				  BOOL is_external);
+int32_t meta_cache_lookup_dir_name(ino_t this_inode,
+				   const char *childname,
+				   DIR_ENTRY *dentry,
+				   META_CACHE_ENTRY_STRUCT *body_ptr,
+				   BOOL is_external);
+int32_t meta_cache_name_index_add(META_CACHE_ENTRY_STRUCT *body_ptr,
+				  const DIR_ENTRY *dentry);
+int32_t meta_cache_name_index_remove(META_CACHE_ENTRY_STRUCT *body_ptr,
+				     const char *name);
+int32_t meta_cache_drop_name_index(META_CACHE_ENTRY_STRUCT *body_ptr);
+int32_t meta_cache_track_dir_pages(META_CACHE_ENTRY_STRUCT *body_ptr,
+				   BOOL enable);
+int32_t meta_cache_refresh_dir_page(META_CACHE_ENTRY_STRUCT *body_ptr,
+				    const DIR_ENTRY_PAGE *page);
+int64_t meta_cache_lookup_block_map(META_CACHE_ENTRY_STRUCT *body_ptr,
+				    int64_t page_index);
+int32_t meta_cache_add_block_map(META_CACHE_ENTRY_STRUCT *body_ptr,
+				 int64_t page_index, int64_t page_pos);
+int32_t meta_cache_drop_block_map(META_CACHE_ENTRY_STRUCT *body_ptr);
 
 int32_t meta_cache_remove(ino_t this_inode);
 int32_t meta_cache_push_dir_page(META_CACHE_ENTRY_STRUCT *body_ptr,
@@ -211,6 +291,9 @@ int32_t meta_cache_lookup_symlink_data(ino_t this_inode,
 				       SYMLINK_META_TYPE *symlink_meta_ptr,
 				       META_CACHE_ENTRY_STRUCT *body_ptr);
 
+int32_t meta_cache_lookup_stat_snapshot(ino_t this_inode,
+					HCFS_STAT *inode_stat);
+
 META_CACHE_ENTRY_STRUCT *meta_cache_lock_entry(ino_t this_inode);
 int32_t meta_cache_unlock_entry(META_CACHE_ENTRY_STRUCT *target_ptr);
 int32_t meta_cache_open_file(META_CACHE_ENTRY_STRUCT *body_ptr);
@@ -218,6 +301,8 @@ int32_t meta_cache_close_file(META_CACHE_ENTRY_STRUCT *body_ptr);
 int32_t meta_cache_drop_pages(META_CACHE_ENTRY_STRUCT *body_ptr);
 
 int32_t expire_meta_mem_cache_entry(void);
+int32_t meta_cache_get_stat(META_CACHE_STAT *cache_stat,
+			    int64_t *num_entries);
 
 int32_t meta_cache_set_uploading_info(META_CACHE_ENTRY_STRUCT *body_ptr,
 				      BOOL is_now_uploading,
@@ -43,6 +43,8 @@
 #include "lookup_count.h"
 #include "super_block.h"
 #include "filetables.h"
+#include "block_fd_cache.h"
+#include "hcfs_cachebuild.h"
 #include "xattr_ops.h"
 #include "hcfs_fromcloud.h"
 #include "utils.h"
@@ -162,7 +164,7 @@ int32_t dir_add_entry(ino_t parent_inode,
 	if (ret < 0)
 		return ret;
 
-	ret = handle_dirmeta_snapshot(parent_inode, body_ptr->fptr);
+	ret = handle_dirmeta_snapshot(parent_inode, body_ptr);
 	if (ret < 0) {
 		errcode = ret;
 		goto errcode_handle;
@@ -171,10 +173,9 @@ int32_t dir_add_entry(ino_t parent_inode,
 	MREAD(body_ptr, &tpage, sizeof(DIR_ENTRY_PAGE),
 	      parent_meta.root_entry_page);
 
-	/* Drop all cached pages first before inserting */
 	/*
-	 * TODO: Future changes could remove this limitation if
-	 * can update cache with each node change in b-tree
+	 * Flush and drop the pages cached for updates first before
+	 * inserting. Cached b-tree nodes are refreshed as they are written.
 	 */
 	ret = meta_cache_drop_pages(body_ptr);
 	if (ret < 0) {
@@ -184,17 +185,23 @@ int32_t dir_add_entry(ino_t parent_inode,
 
 	/* Recursive routine for B-tree insertion*/
 	/* Temp space for traversing the tree is allocated before calling */
+	meta_cache_track_dir_pages(body_ptr, TRUE);
 	ret = insert_dir_entry_btree(&temp_entry, &tpage,
 			fileno(body_ptr->fptr), &overflow_entry,
 			&overflow_new_page, &parent_meta, temp_dir_entries,
 			temp_child_page_pos, is_external, sizeof(HCFS_STAT));
+	meta_cache_track_dir_pages(body_ptr, FALSE);
 
 	/* An error occured and the routine will terminate now */
 	/* TODO: Consider error recovering here */
 	if (ret < 0) {
+		/* The tree is left as is if the name already exists */
+		if (ret != -EEXIST)
+			meta_cache_drop_name_index(body_ptr);
 		meta_cache_close_file(body_ptr);
 		return ret;
 	}
+	meta_cache_name_index_add(body_ptr, &temp_entry);
 
 	/*
 	 * If return value is 1, we need to handle overflow by splitting
@@ -255,6 +262,7 @@ int32_t dir_add_entry(ino_t parent_inode,
 			}
 			MWRITE(body_ptr, &tpage2, sizeof(DIR_ENTRY_PAGE),
 			       parent_meta.tree_walk_list_head);
+			meta_cache_refresh_dir_page(body_ptr, &tpage2);
 		}
 
 
@@ -289,6 +297,7 @@ int32_t dir_add_entry(ino_t parent_inode,
 		tpage.parent_page_pos = new_root.this_page_pos;
 		MWRITE(body_ptr, &tpage, sizeof(DIR_ENTRY_PAGE),
 		       tpage.this_page_pos);
+		meta_cache_refresh_dir_page(body_ptr, &tpage);
 
 		/*
 		 * If no_need_rewrite is true, we have already write
@@ -306,6 +315,7 @@ int32_t dir_add_entry(ino_t parent_inode,
 			tpage2.parent_page_pos = new_root.this_page_pos;
 			MWRITE(body_ptr, &tpage2, sizeof(DIR_ENTRY_PAGE),
 			       overflow_new_page);
+			meta_cache_refresh_dir_page(body_ptr, &tpage2);
 		}
 
 		/*
@@ -403,18 +413,16 @@ int32_t dir_remove_entry(ino_t parent_inode,
 	if (ret < 0)
 		return ret;
 
-	ret = handle_dirmeta_snapshot(parent_inode, body_ptr->fptr);
+	ret = handle_dirmeta_snapshot(parent_inode, body_ptr);
 	if (ret < 0) {
 		errcode = ret;
 		goto errcode_handle;
 	}
 
-	/* Drop all cached pages first before deleting */
 	/*
-	 * TODO: Future changes could remove this limitation if can
-	 * update cache with each node change in b-tree
+	 * Flush and drop the pages cached for updates first before
+	 * deleting. Cached b-tree nodes are refreshed as they are written.
 	 */
-
 	ret = meta_cache_drop_pages(body_ptr);
 	if (ret < 0) {
 		errcode = ret;
@@ -426,10 +434,14 @@ int32_t dir_remove_entry(ino_t parent_inode,
 	      parent_meta.root_entry_page);
 
 	/* Recursive B-tree deletion routine*/
+	meta_cache_track_dir_pages(body_ptr, TRUE);
 	ret = delete_dir_entry_btree(&temp_entry, &tpage,
 			fileno(body_ptr->fptr), &parent_meta, temp_dir_entries,
 			temp_child_page_pos, is_external, sizeof(HCFS_STAT));
+	meta_cache_track_dir_pages(body_ptr, FALSE);
 	if (ret < 0) {
+		if (ret != -ENOENT)
+			meta_cache_drop_name_index(body_ptr);
 		errcode = ret;
 		goto errcode_handle;
 	}
@@ -446,6 +458,7 @@ int32_t dir_remove_entry(ino_t parent_inode,
 		if (S_ISDIR(child_mode))
 			parent_stat.nlink--;
 
+		meta_cache_name_index_remove(body_ptr, childname);
 		parent_meta.total_children--;
 		write_log(10, "TOTAL CHILDREN is now %lld\n",
 						parent_meta.total_children);
@@ -951,6 +964,13 @@ int64_t seek_page(META_CACHE_ENTRY_STRUCT *body_ptr,
 
 	which_indirect = check_page_level(target_page);
 
+	/* Skip walking the indirect pages if the position is cached */
+	if (which_indirect > 0) {
+		filepos = meta_cache_lookup_block_map(body_ptr, target_page);
+		if (filepos != 0)
+			return filepos;
+	}
+
 	switch (which_indirect) {
 	case 0:
 		filepos = temp_meta.direct;
@@ -1000,6 +1020,9 @@ int64_t seek_page(META_CACHE_ENTRY_STRUCT *body_ptr,
 		break;
 	}
 
+	if ((which_indirect > 0) && (filepos > 0))
+		meta_cache_add_block_map(body_ptr, target_page, filepos);
+
 	return filepos;
 }
 
@@ -1245,6 +1268,10 @@ int64_t create_page(META_CACHE_ENTRY_STRUCT *body_ptr, int64_t target_page)
 		break;
 	}
 
+	/* Existing pages never move, so only the new page is recorded */
+	if ((which_indirect > 0) && (filepos > 0))
+		meta_cache_add_block_map(body_ptr, target_page, filepos);
+
 	return filepos;
 
 errcode_handle:
@@ -1673,6 +1700,9 @@ int32_t actual_delete_inode(ino_t this_inode, char d_type, ino_t root_inode,
 		}
 		flock(fileno(metafptr), LOCK_UN);
 		fclose(metafptr);
+		/* Do not keep deleted block files open */
+		invalidate_inode_block_fds(this_inode);
+		cache_usage_index_remove(this_inode);
 
 		/*
 		 * Remove to-delete meta if no backend or this inode
@@ -2004,27 +2034,24 @@ int32_t lookup_dir(ino_t parent, const char *childname, DIR_ENTRY *dentry,
 		   BOOL is_external)
 {
 	META_CACHE_ENTRY_STRUCT *cache_entry;
-	DIR_ENTRY_PAGE temp_page;
-	int32_t temp_index, ret_val;
+	DIR_ENTRY temp_entry;
+	int32_t ret_val;
 
 	cache_entry = meta_cache_lock_entry(parent);
 	if (cache_entry == NULL)
 		return -errno;
 
-	ret_val = meta_cache_seek_dir_entry(parent, &temp_page,
-			&temp_index, childname, cache_entry, is_external);
+	ret_val = meta_cache_lookup_dir_name(parent, childname, &temp_entry,
+			cache_entry, is_external);
 	meta_cache_close_file(cache_entry);
 	meta_cache_unlock_entry(cache_entry);
 
 	if (ret_val < 0)
 		return ret_val;
-	if (temp_index < 0)
-		return -ENOENT;
-	if (temp_page.dir_entries[temp_index].d_ino == 0)
+	if (temp_entry.d_ino == 0)
 		return -ENOENT;
 
-	memcpy(dentry, &(temp_page.dir_entries[temp_index]),
-			sizeof(DIR_ENTRY));
+	memcpy(dentry, &temp_entry, sizeof(DIR_ENTRY));
 	return 0;
 }
 
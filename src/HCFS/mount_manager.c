@@ -592,6 +592,7 @@ int32_t mount_FS(char *fsname, char *mp, char mp_mode)
 	MOUNT_T *tmp_info, *new_info;
 	DIR_ENTRY tmp_entry;
 	char temppath[METAPATHLEN];
+	pthread_attr_t volstat_attr;
 
 	sem_wait(&(fs_mgr_head->op_lock));
 	sem_wait(&(mount_mgr.mount_lock));
@@ -790,8 +791,10 @@ int32_t mount_FS(char *fsname, char *mp, char mp_mode)
 		errcode = -ENOMEM;
 		goto errcode_handle;
 	}
-	PTHREAD_REUSE_create(new_info->write_volstat_thread,
-	                     &prefetch_thread_attr);
+	pthread_attr_init(&volstat_attr);
+	pthread_attr_setdetachstate(&volstat_attr, PTHREAD_CREATE_DETACHED);
+	PTHREAD_REUSE_create(new_info->write_volstat_thread, &volstat_attr);
+	pthread_attr_destroy(&volstat_attr);
 
 	/* read stat */
 	ret = read_FS_statistics(new_info);
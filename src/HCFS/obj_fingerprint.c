@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "obj_fingerprint.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "global.h"
+#include "logger.h"
+
+/************************************************************************
+*
+* Function name: fingerprint_init
+*        Inputs: OBJ_FINGERPRINT_CTX *ctx
+*       Summary: Start computing the obj_id of a new object.
+*  Return value: 0 if successful. Otherwise returns negation of error code.
+*
+*************************************************************************/
+int32_t fingerprint_init(OBJ_FINGERPRINT_CTX *ctx)
+{
+	memset(ctx, 0, sizeof(OBJ_FINGERPRINT_CTX));
+	ctx->md_ctx = EVP_MD_CTX_create();
+	if (ctx->md_ctx == NULL) {
+		write_log(0, "Out of memory in %s\n", __func__);
+		return -ENOMEM;
+	}
+	if (EVP_DigestInit_ex(ctx->md_ctx, EVP_sha256(), NULL) != 1) {
+		write_log(0, "Unable to init sha256 in %s\n", __func__);
+		EVP_MD_CTX_destroy(ctx->md_ctx);
+		ctx->md_ctx = NULL;
+		return -EIO;
+	}
+	return 0;
+}
+
+/************************************************************************
+*
+* Function name: fingerprint_update
+*        Inputs: OBJ_FINGERPRINT_CTX *ctx, const uint8_t *buf, size_t len
+*       Summary: Feed the next "len" bytes of the object to the obj_id.
+*  Return value: 0 if successful. Otherwise returns negation of error code.
+*
+*************************************************************************/
+int32_t fingerprint_update(OBJ_FINGERPRINT_CTX *ctx, const uint8_t *buf,
+			   size_t len)
+{
+	size_t head_len, keep;
+
+	if (len == 0)
+		return 0;
+	if (EVP_DigestUpdate(ctx->md_ctx, buf, len) != 1) {
+		write_log(0, "Unable to update sha256 in %s\n", __func__);
+		return -EIO;
+	}
+
+	/* First bytes of the object */
+	head_len = 0;
+	if (ctx->size < BYTES_TO_CHECK) {
+		head_len = BYTES_TO_CHECK - ctx->size;
+		if (head_len > len)
+			head_len = len;
+		memcpy(ctx->start_bytes + ctx->size, buf, head_len);
+	}
+	ctx->size += len;
+	buf += head_len;
+	len -= head_len;
+
+	/* Last bytes of the rest */
+	if (len >= BYTES_TO_CHECK) {
+		memcpy(ctx->end_bytes, buf + len - BYTES_TO_CHECK,
+		       BYTES_TO_CHECK);
+		ctx->end_len = BYTES_TO_CHECK;
+	} else if (len > 0) {
+		keep = BYTES_TO_CHECK - len;
+		if (keep > (size_t) ctx->end_len)
+			keep = ctx->end_len;
+		memmove(ctx->end_bytes, ctx->end_bytes + ctx->end_len - keep,
+			keep);
+		memcpy(ctx->end_bytes + keep, buf, len);
+		ctx->end_len = keep + len;
+	}
+	return 0;
+}
+
+/************************************************************************
+*
+* Function name: fingerprint_final
+*        Inputs: OBJ_FINGERPRINT_CTX *ctx, uint8_t obj_id[],
+*                off_t *obj_size
+*       Summary: Finish the obj_id of the object fed to "ctx", and return
+*                the obj_id and the object size. Bytes to check that the
+*                object is too short for are zero. "ctx" is cleaned up.
+*  Return value: 0 if successful. Otherwise returns negation of error code.
+*
+*************************************************************************/
+int32_t fingerprint_final(OBJ_FINGERPRINT_CTX *ctx,
+			  uint8_t obj_id[OBJID_LENGTH], off_t *obj_size)
+{
+	int32_t ret;
+
+	memset(obj_id, 0, OBJID_LENGTH);
+	ret = 0;
+	if (EVP_DigestFinal_ex(ctx->md_ctx, obj_id, NULL) != 1) {
+		write_log(0, "Unable to finish sha256 in %s\n", __func__);
+		ret = -EIO;
+	}
+	memcpy(obj_id + SHA256_DIGEST_LENGTH, ctx->start_bytes, BYTES_TO_CHECK);
+	memcpy(obj_id + SHA256_DIGEST_LENGTH + BYTES_TO_CHECK, ctx->end_bytes,
+	       ctx->end_len);
+	if (obj_size != NULL)
+		*obj_size = ctx->size;
+	fingerprint_cleanup(ctx);
+	return ret;
+}
+
+/************************************************************************
+*
+* Function name: fingerprint_cleanup
+*        Inputs: OBJ_FINGERPRINT_CTX *ctx
+*       Summary: Free up "ctx" without finishing the obj_id.
+*  Return value: None
+*
+*************************************************************************/
+void fingerprint_cleanup(OBJ_FINGERPRINT_CTX *ctx)
+{
+	if (ctx->md_ctx != NULL)
+		EVP_MD_CTX_destroy(ctx->md_ctx);
+	ctx->md_ctx = NULL;
+}
+
+/************************************************************************
+*
+* Function name: fingerprint_fd
+*        Inputs: int32_t fd, uint8_t obj_id[], off_t *obj_size
+*       Summary: Compute the obj_id of the whole file "fd" in one read
+*                pass. The file offset of "fd" is not changed.
+*  Return value: 0 if successful. Otherwise returns negation of error code.
+*
+*************************************************************************/
+int32_t fingerprint_fd(int32_t fd, uint8_t obj_id[OBJID_LENGTH],
+		       off_t *obj_size)
+{
+	OBJ_FINGERPRINT_CTX ctx;
+	uint8_t *buf;
+	ssize_t ret_size;
+	off_t offset;
+	int32_t ret, errcode;
+
+	buf = malloc(FINGERPRINT_READ_SIZE);
+	if (buf == NULL) {
+		write_log(0, "Out of memory in %s\n", __func__);
+		return -ENOMEM;
+	}
+	ret = fingerprint_init(&ctx);
+	if (ret < 0) {
+		free(buf);
+		return ret;
+	}
+
+	offset = 0;
+	while (TRUE) {
+		ret_size = pread(fd, buf, FINGERPRINT_READ_SIZE, offset);
+		if (ret_size < 0) {
+			if (errno == EINTR)
+				continue;
+			errcode = errno;
+			write_log(0, "IO error in %s. Code %d, %s\n", __func__,
+				  errcode, strerror(errcode));
+			fingerprint_cleanup(&ctx);
+			free(buf);
+			return -errcode;
+		}
+		if (ret_size == 0)
+			break;
+		ret = fingerprint_update(&ctx, buf, ret_size);
+		if (ret < 0) {
+			fingerprint_cleanup(&ctx);
+			free(buf);
+			return ret;
+		}
+		offset += ret_size;
+	}
+	free(buf);
+
+	return fingerprint_final(&ctx, obj_id, obj_size);
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GW20_HCFS_OBJ_FINGERPRINT_H_
+#define GW20_HCFS_OBJ_FINGERPRINT_H_
+
+#include <inttypes.h>
+#include <sys/types.h>
+#include <openssl/evp.h>
+
+#include "dedup_table.h"
+
+/* Size of reads when fingerprinting a block file */
+#define FINGERPRINT_READ_SIZE (64 * 1024)
+
+/*
+ * Streaming computation of the obj_id of an object (see dedup_table.h),
+ * so the content can be fed in the same pass that reads it for other
+ * uses. The hash goes through EVP, which picks the SHA extensions of the
+ * CPU if available.
+ */
+typedef struct {
+	EVP_MD_CTX *md_ctx;
+	int64_t size;
+	uint8_t start_bytes[BYTES_TO_CHECK];
+	/* Last bytes of the object after the first BYTES_TO_CHECK */
+	uint8_t end_bytes[BYTES_TO_CHECK];
+	int32_t end_len;
+} OBJ_FINGERPRINT_CTX;
+
+int32_t fingerprint_init(OBJ_FINGERPRINT_CTX *ctx);
+int32_t fingerprint_update(OBJ_FINGERPRINT_CTX *ctx, const uint8_t *buf,
+			   size_t len);
+int32_t fingerprint_final(OBJ_FINGERPRINT_CTX *ctx,
+			  uint8_t obj_id[OBJID_LENGTH], off_t *obj_size);
+void fingerprint_cleanup(OBJ_FINGERPRINT_CTX *ctx);
+
+int32_t fingerprint_fd(int32_t fd, uint8_t obj_id[OBJID_LENGTH],
+		       off_t *obj_size);
+
+#endif  /* GW20_HCFS_OBJ_FINGERPRINT_H_ */
@@ -56,6 +56,11 @@ typedef struct {
 	char *s3_protocol;
 	char *s3_bucket_url;
 	char *googledrive_folder;
+	/* Cache replacement */
+	int32_t cache_replace_policy;
+	char *cache_access_trace;
+	/* Memory budget of each volume's path cache */
+	int64_t path_cache_mem_limit;
 } SYSTEM_CONF_STRUCT;
 
 extern SYSTEM_CONF_STRUCT *system_config;
@@ -98,6 +103,9 @@ extern SYSTEM_CONF_STRUCT *system_config;
 #define CACHE_HARD_LIMIT system_config->cache_hard_limit
 #define CACHE_DELTA system_config->cache_update_delta
 #define META_SPACE_LIMIT system_config->meta_space_limit
+#define CACHE_REPLACE_POLICY system_config->cache_replace_policy
+#define CACHE_ACCESS_TRACE system_config->cache_access_trace
+#define PATH_CACHE_MEM_LIMIT system_config->path_cache_mem_limit
 
 /* Use xattr "user.lastsync" to check the last sync complete time, and
 use the following two parameters to decide how long to wait until the
@@ -110,6 +118,7 @@ next sync start for an inode */
 #define DEFAULT_FIRST_UPLOAD_DELAY 30
 #define DEFAULT_NORMAL_UPLOAD_DELAY 60
 #define DEFAULT_SYNC_NONBUSY_PAUSE_TIME 10
+#define DEFAULT_PATH_CACHE_MEM_LIMIT (4LL * 1024 * 1024)
 
 #define MAX_PINNED_RATIO 0.8
 #define MAX_PINNED_LIMIT (CACHE_HARD_LIMIT * MAX_PINNED_RATIO)
@@ -119,7 +128,15 @@ next sync start for an inode */
 #define MAX_BLOCK_SIZE system_config->max_block_size
 
 #define MAX_META_MEM_CACHE_ENTRIES 5000
+/* Memory budget of meta cache entries, including cached pages and mmaps */
+#define MAX_META_MEM_CACHE_BYTES (32LL * 1024 * 1024)
 #define NUM_META_MEM_CACHE_HEADERS 5000
+/* Dirs larger than a dir entry page get an in-memory name index after
+	this many lookups */
+#define DIR_NAME_INDEX_HOT_LOOKUPS 8
+#define DIR_NAME_INDEX_MAX_NAMES 200000
+/* Dir entry pages read into the name index per lookup while building */
+#define DIR_NAME_INDEX_BUILD_PAGES 32
 #define META_CACHE_FLUSH_NOW TRUE
 
 #define METAPATHLEN 400
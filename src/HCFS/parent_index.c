@@ -0,0 +1,433 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* In-memory table of the parents of each inode, replacing the lookups in
+* the primary parent file and the secondary PLOOKUP pages on disk.
+*
+* The table uses open addressing with linear probing, keyed by the child
+* inode. Each slot holds one (child, parent) pair in 16 bytes, so that a
+* probe sequence is scanned within a few cache lines without following
+* pointers. The parents of a child with hard links sit on the same probe
+* sequence, in the order they were added, and the first one is the parent
+* used for path reconstruction. Deleted slots are filled by shifting the
+* following slots backward, so that there are no tombstones and the order
+* of the remaining parents is kept. */
+
+#include "parent_index.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+static inline int64_t _home_slot(const PARENT_INDEX *index, ino_t child)
+{
+	/* Fibonacci hashing, as inode numbers are mostly sequential */
+	return (int64_t)(((uint64_t)child * 0x9E3779B97F4A7C15ULL) >>
+			 index->hash_shift);
+}
+
+static int32_t _alloc_slots(PARENT_INDEX *index, int64_t num_slots)
+{
+	int32_t bits;
+
+	for (bits = 0; ((int64_t)1 << bits) < num_slots; bits++)
+		;
+	index->slots = calloc((size_t)1 << bits, sizeof(PARENT_INDEX_SLOT));
+	if (index->slots == NULL)
+		return -ENOMEM;
+	index->num_slots = (int64_t)1 << bits;
+	index->num_used = 0;
+	index->hash_shift = 64 - bits;
+	return 0;
+}
+
+/* Helper for putting a pair after the other parents of the child */
+static void _insert_pair(PARENT_INDEX *index, ino_t child, ino_t parent)
+{
+	int64_t pos, mask;
+
+	mask = index->num_slots - 1;
+	pos = _home_slot(index, child);
+	while (index->slots[pos].child != 0)
+		pos = (pos + 1) & mask;
+	index->slots[pos].child = child;
+	index->slots[pos].parent = parent;
+	index->num_used++;
+	if (child > index->max_child)
+		index->max_child = child;
+}
+
+/* Helper for moving all pairs to a table of "num_slots" slots */
+static int32_t _resize(PARENT_INDEX *index, int64_t num_slots)
+{
+	PARENT_INDEX old_index;
+	PARENT_INDEX_ITER iter;
+	PARENT_INDEX_SLOT pair;
+	int32_t ret;
+
+	if (num_slots < PARENT_INDEX_MIN_SLOTS)
+		num_slots = PARENT_INDEX_MIN_SLOTS;
+	old_index = *index;
+	ret = _alloc_slots(index, num_slots);
+	if (ret < 0) {
+		*index = old_index;
+		return ret;
+	}
+
+	parent_index_iter_init(&old_index, &iter);
+	while (parent_index_iter_next(&old_index, &iter, &pair) == TRUE)
+		_insert_pair(index, pair.child, pair.parent);
+	free(old_index.slots);
+	return 0;
+}
+
+/* Helper for finding the slot of a pair. Returns -1 if not found. */
+static int64_t _find_pair(const PARENT_INDEX *index, ino_t child,
+			  ino_t parent)
+{
+	int64_t pos, mask;
+
+	if (index->num_slots == 0)
+		return -1;
+
+	mask = index->num_slots - 1;
+	pos = _home_slot(index, child);
+	while (index->slots[pos].child != 0) {
+		if ((index->slots[pos].child == child) &&
+		    (index->slots[pos].parent == parent))
+			return pos;
+		pos = (pos + 1) & mask;
+	}
+	return -1;
+}
+
+/* Helper for emptying a slot, and moving back the following slots that
+can be found from a probe sequence passing the emptied slot */
+static void _remove_slot(PARENT_INDEX *index, int64_t pos)
+{
+	int64_t next, home, mask;
+
+	mask = index->num_slots - 1;
+	next = pos;
+	while (TRUE) {
+		next = (next + 1) & mask;
+		if (index->slots[next].child == 0)
+			break;
+		home = _home_slot(index, index->slots[next].child);
+		/* Keep the slot if its home is cyclically in (pos, next] */
+		if ((pos <= next) ? ((pos < home) && (home <= next)) :
+				    ((pos < home) || (home <= next)))
+			continue;
+		index->slots[pos] = index->slots[next];
+		pos = next;
+	}
+	index->slots[pos].child = 0;
+	index->slots[pos].parent = 0;
+	index->num_used--;
+}
+
+/* Helper for shrinking the table after deletions. The table is kept as is
+if memory cannot be allocated. */
+static void _shrink_if_sparse(PARENT_INDEX *index)
+{
+	if ((index->num_slots > PARENT_INDEX_MIN_SLOTS) &&
+	    (index->num_used * 10 <
+	     index->num_slots * PARENT_INDEX_SHRINK_LOAD))
+		_resize(index, index->num_slots / 2);
+}
+
+/************************************************************************
+*
+* Function name: parent_index_init
+*        Inputs: PARENT_INDEX *index, int64_t num_pairs
+*       Summary: Init an empty index with room for "num_pairs" pairs
+*                before the table needs to grow.
+*  Return value: 0 if successful. Otherwise returns negation of error code.
+*
+*************************************************************************/
+int32_t parent_index_init(PARENT_INDEX *index, int64_t num_pairs)
+{
+	int64_t num_slots;
+
+	memset(index, 0, sizeof(PARENT_INDEX));
+	num_slots = (num_pairs * 10) / PARENT_INDEX_GROW_LOAD + 1;
+	if (num_slots < PARENT_INDEX_MIN_SLOTS)
+		num_slots = PARENT_INDEX_MIN_SLOTS;
+	return _alloc_slots(index, num_slots);
+}
+
+/************************************************************************
+*
+* Function name: parent_index_destroy
+*        Inputs: PARENT_INDEX *index
+*       Summary: Free the slots of the index.
+*  Return value: None
+*
+*************************************************************************/
+void parent_index_destroy(PARENT_INDEX *index)
+{
+	free(index->slots);
+	memset(index, 0, sizeof(PARENT_INDEX));
+}
+
+/************************************************************************
+*
+* Function name: parent_index_first
+*        Inputs: const PARENT_INDEX *index, ino_t child
+*       Summary: Find the first parent of "child" still in the index.
+*  Return value: The parent inode, or 0 if there is none.
+*
+*************************************************************************/
+ino_t parent_index_first(const PARENT_INDEX *index, ino_t child)
+{
+	int64_t pos, mask;
+
+	if (index->num_slots == 0)
+		return 0;
+
+	mask = index->num_slots - 1;
+	pos = _home_slot(index, child);
+	while (index->slots[pos].child != 0) {
+		if (index->slots[pos].child == child)
+			return index->slots[pos].parent;
+		pos = (pos + 1) & mask;
+	}
+	return 0;
+}
+
+/************************************************************************
+*
+* Function name: parent_index_find
+*        Inputs: const PARENT_INDEX *index, ino_t child, ino_t parent
+*       Summary: Check if the pair of "child" and "parent" is in the index.
+*  Return value: TRUE if found. Otherwise FALSE.
+*
+*************************************************************************/
+BOOL parent_index_find(const PARENT_INDEX *index, ino_t child, ino_t parent)
+{
+	return (_find_pair(index, child, parent) >= 0) ? TRUE : FALSE;
+}
+
+/************************************************************************
+*
+* Function name: parent_index_fetch
+*        Inputs: const PARENT_INDEX *index, ino_t child, ino_t *parents,
+*                int32_t max_parents
+*       Summary: Copy at most "max_parents" parents of "child" to
+*                "parents", in the order they were added. "parents" can be
+*                NULL if "max_parents" is 0.
+*  Return value: Number of parents of "child", which can be more than
+*                "max_parents".
+*
+*************************************************************************/
+int32_t parent_index_fetch(const PARENT_INDEX *index, ino_t child,
+			   ino_t *parents, int32_t max_parents)
+{
+	int64_t pos, mask;
+	int32_t num_parents;
+
+	if (index->num_slots == 0)
+		return 0;
+
+	mask = index->num_slots - 1;
+	pos = _home_slot(index, child);
+	num_parents = 0;
+	while (index->slots[pos].child != 0) {
+		if (index->slots[pos].child == child) {
+			if (num_parents < max_parents)
+				parents[num_parents] = index->slots[pos].parent;
+			num_parents++;
+		}
+		pos = (pos + 1) & mask;
+	}
+	return num_parents;
+}
+
+/************************************************************************
+*
+* Function name: parent_index_add
+*        Inputs: PARENT_INDEX *index, ino_t child, ino_t parent
+*       Summary: Add "parent" as the last parent of "child". The table
+*                grows if it is getting full.
+*  Return value: 0 if successful. Otherwise returns negation of error code.
+*
+*************************************************************************/
+int32_t parent_index_add(PARENT_INDEX *index, ino_t child, ino_t parent)
+{
+	int32_t ret;
+
+	if ((child <= 0) || (parent <= 0))
+		return -EINVAL;
+
+	ret = parent_index_reserve(index, 1);
+	if (ret < 0)
+		return ret;
+	_insert_pair(index, child, parent);
+	return 0;
+}
+
+/************************************************************************
+*
+* Function name: parent_index_reserve
+*        Inputs: PARENT_INDEX *index, int64_t num_pairs
+*       Summary: Grow the table if needed so that "num_pairs" more pairs
+*                can be added without growing it.
+*  Return value: 0 if successful. Otherwise returns negation of error code.
+*
+*************************************************************************/
+int32_t parent_index_reserve(PARENT_INDEX *index, int64_t num_pairs)
+{
+	int64_t num_slots;
+
+	num_slots = index->num_slots;
+	if (num_slots < PARENT_INDEX_MIN_SLOTS)
+		num_slots = PARENT_INDEX_MIN_SLOTS;
+	while ((index->num_used + num_pairs) * 10 >
+	       num_slots * PARENT_INDEX_GROW_LOAD)
+		num_slots *= 2;
+	if (num_slots == index->num_slots)
+		return 0;
+	return _resize(index, num_slots);
+}
+
+/************************************************************************
+*
+* Function name: parent_index_delete
+*        Inputs: PARENT_INDEX *index, ino_t child, ino_t parent
+*       Summary: Delete one pair of "child" and "parent" from the index.
+*  Return value: 0 if successful, or -ENOENT if the pair is not found.
+*
+*************************************************************************/
+int32_t parent_index_delete(PARENT_INDEX *index, ino_t child, ino_t parent)
+{
+	int64_t pos;
+
+	pos = _find_pair(index, child, parent);
+	if (pos < 0)
+		return -ENOENT;
+	_remove_slot(index, pos);
+	_shrink_if_sparse(index);
+	return 0;
+}
+
+/************************************************************************
+*
+* Function name: parent_index_replace
+*        Inputs: PARENT_INDEX *index, ino_t child, ino_t parent1,
+*                ino_t parent2
+*       Summary: Replace parent "parent1" of "child" with "parent2",
+*                keeping its place among the parents of "child".
+*  Return value: 0 if successful, or negation of error code.
+*
+*************************************************************************/
+int32_t parent_index_replace(PARENT_INDEX *index, ino_t child,
+			     ino_t parent1, ino_t parent2)
+{
+	int64_t pos;
+
+	if (parent2 <= 0)
+		return -EINVAL;
+
+	pos = _find_pair(index, child, parent1);
+	if (pos < 0)
+		return -ENOENT;
+	index->slots[pos].parent = parent2;
+	return 0;
+}
+
+/************************************************************************
+*
+* Function name: parent_index_delete_all
+*        Inputs: PARENT_INDEX *index, ino_t child
+*       Summary: Delete all parents of "child" from the index.
+*  Return value: Number of parents deleted.
+*
+*************************************************************************/
+int32_t parent_index_delete_all(PARENT_INDEX *index, ino_t child)
+{
+	int64_t pos, mask;
+	int32_t num_deleted;
+
+	if (index->num_slots == 0)
+		return 0;
+
+	mask = index->num_slots - 1;
+	pos = _home_slot(index, child);
+	num_deleted = 0;
+	while (index->slots[pos].child != 0) {
+		if (index->slots[pos].child == child) {
+			/* A following slot may have moved here */
+			_remove_slot(index, pos);
+			num_deleted++;
+			continue;
+		}
+		pos = (pos + 1) & mask;
+	}
+	if (num_deleted > 0)
+		_shrink_if_sparse(index);
+	return num_deleted;
+}
+
+/************************************************************************
+*
+* Function name: parent_index_iter_init
+*        Inputs: const PARENT_INDEX *index, PARENT_INDEX_ITER *iter
+*       Summary: Start walking all pairs in the index. The walk starts
+*                after an empty slot, so that the parents of each child
+*                are returned in the order they were added.
+*  Return value: None
+*
+*************************************************************************/
+void parent_index_iter_init(const PARENT_INDEX *index,
+			    PARENT_INDEX_ITER *iter)
+{
+	int64_t pos;
+
+	/* The table is never full, so there is an empty slot */
+	for (pos = 0; pos < index->num_slots; pos++)
+		if (index->slots[pos].child == 0)
+			break;
+	iter->start = pos + 1;
+	iter->count = 0;
+}
+
+/************************************************************************
+*
+* Function name: parent_index_iter_next
+*        Inputs: const PARENT_INDEX *index, PARENT_INDEX_ITER *iter,
+*                PARENT_INDEX_SLOT *pair
+*       Summary: Return the next pair of the walk in "pair".
+*  Return value: TRUE if a pair is returned, or FALSE if the walk is done.
+*
+*************************************************************************/
+BOOL parent_index_iter_next(const PARENT_INDEX *index,
+			    PARENT_INDEX_ITER *iter, PARENT_INDEX_SLOT *pair)
+{
+	int64_t pos;
+
+	while (iter->count < index->num_slots) {
+		pos = (iter->start + iter->count) & (index->num_slots - 1);
+		iter->count++;
+		if (index->slots[pos].child != 0) {
+			*pair = index->slots[pos];
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef GW20_HCFS_PARENT_INDEX_H_
+#define GW20_HCFS_PARENT_INDEX_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "global.h"
+
+/* Number of slots is a power of 2, and at least this many */
+#define PARENT_INDEX_MIN_SLOTS 1024
+/* The table grows when more than 7/10 of the slots are used, and shrinks
+when less than 1/10 of them are */
+#define PARENT_INDEX_GROW_LOAD 7
+#define PARENT_INDEX_SHRINK_LOAD 1
+
+/* A (child, parent) pair. A child with more than one parent has one slot
+for each of them. */
+typedef struct {
+	ino_t child;  /* 0 if the slot is empty */
+	ino_t parent;
+} PARENT_INDEX_SLOT;
+
+typedef struct {
+	PARENT_INDEX_SLOT *slots;
+	int64_t num_slots;
+	int64_t num_used;
+	int32_t hash_shift;
+	/* Upper bound of the inode numbers added */
+	ino_t max_child;
+} PARENT_INDEX;
+
+typedef struct {
+	int64_t start;
+	int64_t count;
+} PARENT_INDEX_ITER;
+
+int32_t parent_index_init(PARENT_INDEX *index, int64_t num_pairs);
+void parent_index_destroy(PARENT_INDEX *index);
+ino_t parent_index_first(const PARENT_INDEX *index, ino_t child);
+BOOL parent_index_find(const PARENT_INDEX *index, ino_t child, ino_t parent);
+int32_t parent_index_fetch(const PARENT_INDEX *index, ino_t child,
+			   ino_t *parents, int32_t max_parents);
+int32_t parent_index_add(PARENT_INDEX *index, ino_t child, ino_t parent);
+int32_t parent_index_reserve(PARENT_INDEX *index, int64_t num_pairs);
+int32_t parent_index_delete(PARENT_INDEX *index, ino_t child, ino_t parent);
+int32_t parent_index_replace(PARENT_INDEX *index, ino_t child,
+			     ino_t parent1, ino_t parent2);
+int32_t parent_index_delete_all(PARENT_INDEX *index, ino_t child);
+void parent_index_iter_init(const PARENT_INDEX *index,
+			    PARENT_INDEX_ITER *iter);
+BOOL parent_index_iter_next(const PARENT_INDEX *index,
+			    PARENT_INDEX_ITER *iter, PARENT_INDEX_SLOT *pair);
+
+#endif  /* GW20_HCFS_PARENT_INDEX_H_ */
@@ -21,9 +21,12 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <limits.h>
+#include <sys/stat.h>
 
+#include "dir_statistics.h"
 #include "logger.h"
 #include "meta_mem_cache.h"
 #include "fuseop.h"
@@ -32,365 +35,747 @@
 #include "global.h"
 #include "utils.h"
 
-/************************************************************************
-*
-* Function name: fetch_all_parents
-*        Inputs: ino_t self_inode, int32_t *parentnum, ino_t **parentlist
-*       Summary: Returns the list of parents for "self_inode" in "parentlist".
-*                The number of parents is returned in "parentnum".
-*                When calling the function, "*parentlist" should be NULL, and
-*                after the function returns, the caller should free
-*                "parentlist".
-*                pathlookup_data_lock should be locked before calling.
-*  Return value: 0 if successful. Otherwise returns negation of error code.
-*
-*************************************************************************/
-int32_t fetch_all_parents(ino_t self_inode, int32_t *parentnum, ino_t **parentlist)
+/* The parents of all inodes are kept in memory, so that path
+reconstruction and dir statistics do not read the disk. Changes are
+written to the log only. */
+static struct {
+	PARENT_INDEX index;
+	int32_t log_fd;
+	int64_t generation;
+	int64_t num_log_records;
+	/* Pos in the log up to which the changes are in the index */
+	off_t log_pos;
+	/* Process loading the index. Processes forked from it only read the
+	index, and follow the log for the changes made after the fork. */
+	pid_t owner_pid;
+	/* Value of hcfs_system->parent_log_seq the index is up to date with */
+	int64_t log_seq;
+} parent_lookup = {.log_fd = -1};
+
+/* Helper for applying a logged change to the index */
+static int32_t _apply_record(const PARENT_LOG_RECORD *record)
 {
-	int32_t totalnum;
-	PRIMARY_PARENT_T tmpparent;
-	int32_t sem_val;
-	off_t filepos;
-	int32_t errcode, ret;
-	ssize_t ret_ssize;
-	int32_t hashval, tmpmaxnum;
-	PLOOKUP_PAGE_T tmppage;
-	int64_t tmppos;
-	uint8_t count;
-	ino_t *tmpptr;
-
-	if (self_inode <= 0)
+	PARENT_INDEX *index = &(parent_lookup.index);
+
+	switch (record->op) {
+	case PARENT_LOG_ADD:
+		return parent_index_add(index, record->self_inode,
+					record->parent_inode1);
+	case PARENT_LOG_DELETE:
+		return parent_index_delete(index, record->self_inode,
+					   record->parent_inode1);
+	case PARENT_LOG_REPLACE:
+		return parent_index_replace(index, record->self_inode,
+					    record->parent_inode1,
+					    record->parent_inode2);
+	case PARENT_LOG_RESET:
+		parent_index_delete_all(index, record->self_inode);
+		if (record->parent_inode1 == 0)
+			return 0;
+		return parent_index_add(index, record->self_inode,
+					record->parent_inode1);
+	default:
 		return -EINVAL;
+	}
+}
 
-	ret = sem_getvalue(&(pathlookup_data_lock), &sem_val);
-	if ((sem_val > 0) || (ret < 0))
+/* Helper for checking that "record" can be applied to the index before
+it is logged. Room for the added pair is made here, so that applying the
+record after logging it does not fail. */
+static int32_t _prepare_record(const PARENT_LOG_RECORD *record)
+{
+	PARENT_INDEX *index = &(parent_lookup.index);
+
+	switch (record->op) {
+	case PARENT_LOG_ADD:
+		if ((record->self_inode <= 0) || (record->parent_inode1 <= 0))
+			return -EINVAL;
+		return parent_index_reserve(index, 1);
+	case PARENT_LOG_DELETE:
+		if (parent_index_find(index, record->self_inode,
+				      record->parent_inode1) == FALSE)
+			return -ENOENT;
+		return 0;
+	case PARENT_LOG_REPLACE:
+		if (record->parent_inode2 <= 0)
+			return -EINVAL;
+		if (parent_index_find(index, record->self_inode,
+				      record->parent_inode1) == FALSE)
+			return -ENOENT;
+		return 0;
+	case PARENT_LOG_RESET:
+		if (record->parent_inode1 == 0)
+			return 0;
+		return parent_index_reserve(index, 1);
+	default:
 		return -EINVAL;
+	}
+}
 
-	filepos = (off_t) ((self_inode - 1) * sizeof(PRIMARY_PARENT_T));
-	memset(&tmpparent, 0, sizeof(PRIMARY_PARENT_T));
-	ret_ssize = PREAD(fileno(pathlookup_data_fptr), &tmpparent,
-	      sizeof(PRIMARY_PARENT_T), filepos);
+/* Helper for applying the records in the log after log_pos. A record
+that is not completely written yet is left for later. */
+static int32_t _read_log(void)
+{
+	PARENT_LOG_RECORD records[PARENT_LOG_READ_RECORDS];
+	ssize_t ret_ssize;
+	int32_t count, num_records, ret, errcode;
+
+	while (TRUE) {
+		ret_ssize = PREAD(parent_lookup.log_fd, records,
+				  sizeof(records), parent_lookup.log_pos);
+		num_records = ret_ssize / sizeof(PARENT_LOG_RECORD);
+		for (count = 0; count < num_records; count++) {
+			ret = _apply_record(&(records[count]));
+			if (ret == -ENOMEM)
+				return ret;
+			if (ret < 0)
+				write_log(2, "Skipped parent log record %d of "
+					  "inode %" PRIu64 ". (%d)\n",
+					  records[count].op,
+					  (uint64_t)records[count].self_inode,
+					  ret);
+		}
+		parent_lookup.log_pos +=
+			num_records * sizeof(PARENT_LOG_RECORD);
+		parent_lookup.num_log_records += num_records;
+		if (ret_ssize < (ssize_t)sizeof(records))
+			break;
+	}
+	return 0;
+errcode_handle:
+	return errcode;
+}
 
-	if (ret_ssize != sizeof(PRIMARY_PARENT_T)) {
-		write_log(2, "Short-read when querying parent db. (Inode %"
-		          PRIu64 ")\n", (uint64_t) self_inode);
-		*parentnum = 0;
-		return 0;
+/* Helper for loading the snapshot to an empty index. Returns -ENOENT if
+there is no snapshot. */
+static int32_t _read_snapshot(void)
+{
+	char pathname[METAPATHLEN + 30];
+	PARENT_SNAPSHOT_HEAD head;
+	PARENT_INDEX_SLOT pairs[PARENT_LOG_READ_RECORDS];
+	FILE *fptr;
+	int64_t num_left;
+	size_t ret_size, num_read, count;
+	int32_t ret, errcode;
+
+	snprintf(pathname, sizeof(pathname), "%s/parentlookup_snapshot",
+		 METAPATH);
+	fptr = fopen(pathname, "r");
+	if (fptr == NULL) {
+		errcode = errno;
+		if (errcode == ENOENT)
+			return -ENOENT;
+		write_log(0, "IO error in %s. Code %d, %s\n", __func__,
+			  errcode, strerror(errcode));
+		return -errcode;
 	}
 
-	if ((tmpparent.parentinode == 0) && (tmpparent.haveothers == FALSE)) {
-		*parentnum = 0;
-		return 0;
+	ret_size = FREAD(&head, sizeof(PARENT_SNAPSHOT_HEAD), 1, fptr);
+	if ((ret_size != 1) ||
+	    (memcmp(head.magic, PARENT_SNAPSHOT_MAGIC,
+		    sizeof(head.magic)) != 0) ||
+	    (head.version != PARENT_LOOKUP_VERSION) || (head.num_pairs < 0)) {
+		write_log(0, "Parent lookup snapshot is corrupted\n");
+		errcode = -EIO;
+		goto errcode_handle;
 	}
-	totalnum = 0;
 
-	*parentlist = (ino_t *) calloc(10, sizeof(ino_t));
-	if (*parentlist == NULL)
-		return -ENOMEM;
+	ret = parent_index_init(&(parent_lookup.index), head.num_pairs);
+	if (ret < 0) {
+		errcode = ret;
+		goto errcode_handle;
+	}
+	num_left = head.num_pairs;
+	while (num_left > 0) {
+		num_read = PARENT_LOG_READ_RECORDS;
+		if (num_left < PARENT_LOG_READ_RECORDS)
+			num_read = num_left;
+		ret_size = FREAD(pairs, sizeof(PARENT_INDEX_SLOT), num_read,
+				 fptr);
+		if (ret_size != num_read) {
+			write_log(0, "Parent lookup snapshot is truncated\n");
+			errcode = -EIO;
+			goto errcode_handle;
+		}
+		for (count = 0; count < num_read; count++) {
+			ret = parent_index_add(&(parent_lookup.index),
+					       pairs[count].child,
+					       pairs[count].parent);
+			if (ret < 0) {
+				errcode = ret;
+				goto errcode_handle;
+			}
+		}
+		num_left -= num_read;
+	}
+	parent_lookup.generation = head.generation;
+	fclose(fptr);
+	return 0;
 
-	tmpmaxnum = 10;
+errcode_handle:
+	fclose(fptr);
+	return errcode;
+}
 
-	/* If primary lookup is not empty */
-	if (tmpparent.parentinode > 0) {
-		memcpy(&((*parentlist)[totalnum]), &(tmpparent.parentinode),
-		       sizeof(ino_t));
-		totalnum++;
-	}
-	if (tmpparent.haveothers == FALSE) {
-		*parentnum = totalnum;
+/* Helper for loading the snapshot, and the changes logged after it.
+"log_valid" is FALSE if the log does not apply to the snapshot. */
+static int32_t _load_parent_lookup(BOOL *log_valid)
+{
+	PARENT_LOG_HEAD loghead;
+	ssize_t ret_ssize;
+	int32_t ret, errcode;
+
+	parent_index_destroy(&(parent_lookup.index));
+	parent_lookup.generation = 0;
+	ret = _read_snapshot();
+	if (ret == -ENOENT)
+		ret = parent_index_init(&(parent_lookup.index), 0);
+	if (ret < 0)
+		return ret;
+
+	parent_lookup.log_pos = sizeof(PARENT_LOG_HEAD);
+	parent_lookup.num_log_records = 0;
+	*log_valid = FALSE;
+	ret_ssize = PREAD(parent_lookup.log_fd, &loghead,
+			  sizeof(PARENT_LOG_HEAD), 0);
+	/* The log is not started yet, or its changes are already in the
+	snapshot */
+	if ((ret_ssize < (ssize_t)sizeof(PARENT_LOG_HEAD)) ||
+	    (memcmp(loghead.magic, PARENT_LOG_MAGIC,
+		    sizeof(loghead.magic)) != 0) ||
+	    (loghead.generation != parent_lookup.generation))
 		return 0;
+
+	*log_valid = TRUE;
+	return _read_log();
+errcode_handle:
+	return errcode;
+}
+
+/* Helper for telling forked processes that the log has changed */
+static void _log_changed(void)
+{
+	parent_lookup.log_seq = __atomic_add_fetch(
+		&(hcfs_system->parent_log_seq), 1, __ATOMIC_RELEASE);
+}
+
+/* Helper for starting an empty log for the current snapshot */
+static int32_t _reset_log(void)
+{
+	PARENT_LOG_HEAD loghead;
+	ssize_t ret_ssize;
+	int32_t errcode;
+
+	if (ftruncate(parent_lookup.log_fd, 0) < 0) {
+		errcode = errno;
+		write_log(0, "IO error in %s. Code %d, %s\n", __func__,
+			  errcode, strerror(errcode));
+		return -errcode;
 	}
+	memset(&loghead, 0, sizeof(PARENT_LOG_HEAD));
+	memcpy(loghead.magic, PARENT_LOG_MAGIC, sizeof(loghead.magic));
+	loghead.version = PARENT_LOOKUP_VERSION;
+	loghead.generation = parent_lookup.generation;
+	/* The log is opened with O_APPEND */
+	ret_ssize = write(parent_lookup.log_fd, &loghead,
+			  sizeof(PARENT_LOG_HEAD));
+	if (ret_ssize != sizeof(PARENT_LOG_HEAD)) {
+		errcode = (ret_ssize < 0) ? errno : EIO;
+		write_log(0, "IO error in %s. Code %d, %s\n", __func__,
+			  errcode, strerror(errcode));
+		return -errcode;
+	}
+	parent_lookup.log_pos = sizeof(PARENT_LOG_HEAD);
+	parent_lookup.num_log_records = 0;
+	_log_changed();
+	return 0;
+}
 
-	hashval = self_inode % PLOOKUP_HASH_NUM_ENTRIES;
+/* Helper for saving the index as the snapshot of the next generation,
+and then starting an empty log. Until the log is reset, the old log is
+ignored as the new snapshot already has its changes. */
+static int32_t _compact_parent_lookup(void)
+{
+	char pathname[METAPATHLEN + 30], tmppath[METAPATHLEN + 30];
+	PARENT_SNAPSHOT_HEAD head;
+	PARENT_INDEX_ITER iter;
+	PARENT_INDEX_SLOT pairs[PARENT_LOG_READ_RECORDS];
+	FILE *fptr;
+	int32_t num_pairs, errcode;
+
+	snprintf(pathname, sizeof(pathname), "%s/parentlookup_snapshot",
+		 METAPATH);
+	snprintf(tmppath, sizeof(tmppath), "%s/parentlookup_snapshot.tmp",
+		 METAPATH);
+	fptr = fopen(tmppath, "w");
+	if (fptr == NULL) {
+		errcode = errno;
+		write_log(0, "IO error in %s. Code %d, %s\n", __func__,
+			  errcode, strerror(errcode));
+		return -errcode;
+	}
 
-	tmppos = parent_lookup_head.hash_head[hashval];
-	while (tmppos != 0) {
-		PREAD(fileno(plookup2_fptr), &tmppage, sizeof(PLOOKUP_PAGE_T),
-		      tmppos);
-		if (tmppage.thisinode == self_inode)
-			break;
-		tmppos = tmppage.nextlookup;
+	memset(&head, 0, sizeof(PARENT_SNAPSHOT_HEAD));
+	memcpy(head.magic, PARENT_SNAPSHOT_MAGIC, sizeof(head.magic));
+	head.version = PARENT_LOOKUP_VERSION;
+	head.generation = parent_lookup.generation + 1;
+	head.num_pairs = parent_lookup.index.num_used;
+	FWRITE(&head, sizeof(PARENT_SNAPSHOT_HEAD), 1, fptr);
+
+	num_pairs = 0;
+	parent_index_iter_init(&(parent_lookup.index), &iter);
+	while (parent_index_iter_next(&(parent_lookup.index), &iter,
+				      &(pairs[num_pairs])) == TRUE) {
+		num_pairs++;
+		if (num_pairs < PARENT_LOG_READ_RECORDS)
+			continue;
+		FWRITE(pairs, sizeof(PARENT_INDEX_SLOT), num_pairs, fptr);
+		num_pairs = 0;
+	}
+	if (num_pairs > 0)
+		FWRITE(pairs, sizeof(PARENT_INDEX_SLOT), num_pairs, fptr);
+
+	if ((fflush(fptr) != 0) || (fsync(fileno(fptr)) < 0)) {
+		errcode = errno;
+		write_log(0, "IO error in %s. Code %d, %s\n", __func__,
+			  errcode, strerror(errcode));
+		errcode = -errcode;
+		goto errcode_handle;
+	}
+	fclose(fptr);
+	fptr = NULL;
+	if (rename(tmppath, pathname) < 0) {
+		errcode = errno;
+		write_log(0, "IO error in %s. Code %d, %s\n", __func__,
+			  errcode, strerror(errcode));
+		errcode = -errcode;
+		goto errcode_handle;
 	}
-	if (tmppos == 0) {  /* If cannot find entry in hash table */
-		*parentnum = totalnum;
+
+	parent_lookup.generation = head.generation;
+	return _reset_log();
+
+errcode_handle:
+	if (fptr != NULL)
+		fclose(fptr);
+	unlink(tmppath);
+	return errcode;
+}
+
+/* Helper for adding the parents in the lookup db of older versions to
+the index. "found" is FALSE if there is no such db. */
+static int32_t _import_old_lookup_db(BOOL *found)
+{
+	char pathname[METAPATHLEN + 30];
+	FILE *primary_fptr, *secondary_fptr;
+	PRIMARY_PARENT_T tmpparent;
+	PLOOKUP_HEAD_T lookup_head;
+	PLOOKUP_PAGE_T headpage, tmppage;
+	ino_t this_inode;
+	int64_t tmppos;
+	int32_t hashval, count, ret, errcode;
+
+	*found = FALSE;
+	secondary_fptr = NULL;
+	snprintf(pathname, sizeof(pathname), "%s/pathlookup_db", METAPATH);
+	if (access(pathname, F_OK) != 0)
 		return 0;
+	*found = TRUE;
+	primary_fptr = fopen(pathname, "r");
+	if (primary_fptr == NULL) {
+		errcode = errno;
+		write_log(0, "IO error in %s. Code %d, %s\n", __func__,
+			  errcode, strerror(errcode));
+		return -errcode;
 	}
 
-	/* Starts reading the parents from here */
-	while (tmppos != 0) {
-		for (count = 0; count < tmppage.num_parents; count++) {
-			memcpy(&((*parentlist)[totalnum]),
-			       &(tmppage.parents[count]), sizeof(ino_t));
-			totalnum++;
-			if (totalnum >= tmpmaxnum) {
-				tmpmaxnum += 10;
-				tmpptr = (ino_t *) realloc(*parentlist,
-			                      tmpmaxnum * sizeof(ino_t));
-				if (tmpptr == NULL) {
-					/* Cannot allocate more memory */
-					free(*parentlist);
-					*parentlist = NULL;
-					errcode = -ENOMEM;
-					goto errcode_handle;
-				}
-				*parentlist = tmpptr;
+	/* Primary parents are stored by inode number */
+	this_inode = 1;
+	while (FREAD(&tmpparent, sizeof(PRIMARY_PARENT_T), 1,
+		     primary_fptr) == 1) {
+		if (tmpparent.parentinode > 0) {
+			ret = parent_index_add(&(parent_lookup.index),
+					       this_inode,
+					       tmpparent.parentinode);
+			if (ret < 0) {
+				errcode = ret;
+				goto errcode_handle;
 			}
 		}
-		tmppos = tmppage.nextpage;
-		if (tmppos != 0) {
-			/* Read the next page in the same inode */
-			PREAD(fileno(plookup2_fptr), &tmppage,
+		this_inode++;
+	}
+
+	snprintf(pathname, sizeof(pathname), "%s/parentlookup2_db",
+		 METAPATH);
+	secondary_fptr = fopen(pathname, "r");
+	if (secondary_fptr == NULL) {
+		fclose(primary_fptr);
+		return 0;
+	}
+	memset(&lookup_head, 0, sizeof(PLOOKUP_HEAD_T));
+	PREAD(fileno(secondary_fptr), &lookup_head, sizeof(PLOOKUP_HEAD_T), 0);
+
+	/* Other parents are in the pages chained from the hash table */
+	for (hashval = 0; hashval < PLOOKUP_HASH_NUM_ENTRIES; hashval++) {
+		tmppos = lookup_head.hash_head[hashval];
+		while (tmppos != 0) {
+			PREAD(fileno(secondary_fptr), &headpage,
 			      sizeof(PLOOKUP_PAGE_T), tmppos);
+			memset(&tmpparent, 0, sizeof(PRIMARY_PARENT_T));
+			PREAD(fileno(primary_fptr), &tmpparent,
+			      sizeof(PRIMARY_PARENT_T),
+			      (off_t)((headpage.thisinode - 1) *
+				      sizeof(PRIMARY_PARENT_T)));
+			tmppage = headpage;
+			while (tmpparent.haveothers == TRUE) {
+				for (count = 0; count < tmppage.num_parents;
+				     count++) {
+					ret = parent_index_add(
+						&(parent_lookup.index),
+						tmppage.thisinode,
+						tmppage.parents[count]);
+					if (ret < 0) {
+						errcode = ret;
+						goto errcode_handle;
+					}
+				}
+				if (tmppage.nextpage == 0)
+					break;
+				PREAD(fileno(secondary_fptr), &tmppage,
+				      sizeof(PLOOKUP_PAGE_T),
+				      tmppage.nextpage);
+			}
+			tmppos = headpage.nextlookup;
 		}
 	}
-	*parentnum = totalnum;
 
+	fclose(primary_fptr);
+	fclose(secondary_fptr);
 	return 0;
+
 errcode_handle:
+	fclose(primary_fptr);
+	if (secondary_fptr != NULL)
+		fclose(secondary_fptr);
 	return errcode;
 }
 
-/* Helper function for allocating a new lookup page */
-static inline int64_t _alloc_new_page(int32_t *reterr)
-{
-	int64_t ret_pos, tmppos;
-	PLOOKUP_PAGE_T tmppage;
-
-	if (parent_lookup_head.gc_head != 0) {
-		tmppos = parent_lookup_head.gc_head;
-		PREAD(fileno(plookup2_fptr), &tmppage,
-		      sizeof(PLOOKUP_PAGE_T), tmppos);
-		parent_lookup_head.gc_head = tmppage.gc_next;
-		PWRITE(fileno(plookup2_fptr), &parent_lookup_head,
-		       sizeof(PLOOKUP_HEAD_T), 0);
-	} else {
-		FSEEK(plookup2_fptr, 0, SEEK_END);
-		ret_pos = FTELL(plookup2_fptr);
-		tmppos = ret_pos;
-	}
-	*reterr = 0;
-	return tmppos;
-errcode_handle:
-	*reterr = errcode;
-	return 0;
-}
-/* Helper function for adding a new page for a new inode to the head */
-static inline int32_t _add_to_head(ino_t self_inode, ino_t parent_inode)
+/* Helper for processes forked from the owner of the index. Changes made
+by the owner are read from the log, and the index is loaded again if the
+log was merged into a new snapshot. The log is not read if the owner
+did not change it since the last time. */
+static int32_t _follow_log(void)
 {
-	int32_t hashval;
-	PLOOKUP_PAGE_T tmppage;
-	int64_t tmppos;
-	int32_t errcode;
+	PARENT_LOG_HEAD loghead;
+	ssize_t ret_ssize;
+	BOOL log_valid;
+	int64_t log_seq;
+	int32_t ret, errcode;
 
-	hashval = self_inode % PLOOKUP_HASH_NUM_ENTRIES;
-	tmppos = _alloc_new_page(&errcode);
-	if (tmppos == 0) {
-		if (errcode >= 0)
-			errcode = -EIO;
-		goto errcode_handle;
-	}
-	parent_lookup_head.hash_head[hashval] = tmppos;
-	memset(&tmppage, 0, sizeof(PLOOKUP_PAGE_T));
-	tmppage.thisinode = self_inode;
-	tmppage.num_parents = 1;
-	tmppage.parents[0] = parent_inode;
-	PWRITE(fileno(plookup2_fptr), &tmppage, sizeof(PLOOKUP_PAGE_T),
-	       tmppos);
-	PWRITE(fileno(plookup2_fptr), &parent_lookup_head,
-	       sizeof(PLOOKUP_HEAD_T), 0);
+	if (parent_lookup.owner_pid == getpid())
+		return 0;
+
+	/* Changes logged after this are followed the next time */
+	log_seq = __atomic_load_n(&(hcfs_system->parent_log_seq),
+				  __ATOMIC_ACQUIRE);
+	if (log_seq == parent_lookup.log_seq)
+		return 0;
+
+	ret_ssize = PREAD(parent_lookup.log_fd, &loghead,
+			  sizeof(PARENT_LOG_HEAD), 0);
+	/* Being reset by the owner, which changes the seq again after */
+	if (ret_ssize < (ssize_t)sizeof(PARENT_LOG_HEAD))
+		return 0;
+	if (loghead.generation != parent_lookup.generation)
+		ret = _load_parent_lookup(&log_valid);
+	else
+		ret = _read_log();
+	if (ret < 0)
+		return ret;
+	parent_lookup.log_seq = log_seq;
 	return 0;
 errcode_handle:
 	return errcode;
 }
 
-/* Helper function for adding a new inode to the end of the hash linked
-list */
-static inline int32_t _add_to_tail(ino_t self_inode, ino_t parent_inode,
-                               int64_t prevpos)
+/* Helper for adding a change to the log, and then making the change to
+the index */
+static int32_t _change_parent_lookup(const PARENT_LOG_RECORD *record)
 {
-	PLOOKUP_PAGE_T tmppage;
-	int64_t tmppos;
-	int32_t errcode;
+	ssize_t ret_ssize;
+	int32_t ret, errcode;
 
-	tmppos = _alloc_new_page(&errcode);
-	if (tmppos == 0) {
-		if (errcode >= 0)
-			errcode = -EIO;
-		goto errcode_handle;
+	if (parent_lookup.owner_pid != getpid()) {
+		write_log(0, "Parent lookup can only be changed by process %d\n",
+			  parent_lookup.owner_pid);
+		return -EPERM;
 	}
 
-	memset(&tmppage, 0, sizeof(PLOOKUP_PAGE_T));
-	tmppage.thisinode = self_inode;
-	tmppage.num_parents = 1;
-	tmppage.parents[0] = parent_inode;
-	PWRITE(fileno(plookup2_fptr), &tmppage, sizeof(PLOOKUP_PAGE_T),
-	       tmppos);
+	/* The record is logged before the index is changed, so that the
+	index never has a change that is not in the log */
+	ret = _prepare_record(record);
+	if (ret < 0)
+		return ret;
 
-	/* Write link update to the previous page */
-	PREAD(fileno(plookup2_fptr), &tmppage, sizeof(PLOOKUP_PAGE_T),
-	       prevpos);
-	tmppage.nextlookup = tmppos;
-	PWRITE(fileno(plookup2_fptr), &tmppage, sizeof(PLOOKUP_PAGE_T),
-	       prevpos);
+	ret_ssize = write(parent_lookup.log_fd, record,
+			  sizeof(PARENT_LOG_RECORD));
+	if (ret_ssize != sizeof(PARENT_LOG_RECORD)) {
+		errcode = (ret_ssize < 0) ? errno : EIO;
+		write_log(0, "IO error in %s. Code %d, %s\n", __func__,
+			  errcode, strerror(errcode));
+		/* Drop a partly written record so later ones stay aligned */
+		if ((ret_ssize > 0) && (ftruncate(parent_lookup.log_fd,
+						  parent_lookup.log_pos) < 0))
+			write_log(0, "Unable to truncate parent log. Code %d\n",
+				  errno);
+		return -errcode;
+	}
+	parent_lookup.log_pos += sizeof(PARENT_LOG_RECORD);
+	parent_lookup.num_log_records++;
+	_log_changed();
+
+	ret = _apply_record(record);
+	if (ret < 0) {
+		/* Not expected after _prepare_record. Replaying the log
+		fails the same way, so the index still matches the log. */
+		write_log(0, "Unable to apply parent log record %d of inode %"
+			  PRIu64 ". (%d)\n", record->op,
+			  (uint64_t)record->self_inode, ret);
+		return ret;
+	}
 
+	if ((parent_lookup.num_log_records > PARENT_LOG_COMPACT_RECORDS) &&
+	    (parent_lookup.num_log_records >
+	     parent_lookup.index.num_used)) {
+		/* The change is logged, so try again on the next one */
+		ret = _compact_parent_lookup();
+		if (ret < 0)
+			write_log(0, "Unable to compact parent lookup. (%d)\n",
+				  ret);
+	}
 	return 0;
-errcode_handle:
-	return errcode;
 }
 
-/* Helper function for adding a new page to the end of the page linked
-list for the same inode */
-static inline int32_t _add_new_page(ino_t self_inode, ino_t parent_inode,
-                               int64_t prevpos)
+/************************************************************************
+*
+* Function name: init_parent_lookup
+*        Inputs: None
+*       Summary: Load the parent index from the snapshot and the log in
+*                metastorage. The parent lookup db of older versions is
+*                imported if there is no snapshot yet. The log is merged
+*                into a new snapshot if it has any change.
+*  Return value: 0 if successful. Otherwise returns negation of error code.
+*
+*************************************************************************/
+int32_t init_parent_lookup(void)
 {
-	PLOOKUP_PAGE_T tmppage;
-	int64_t tmppos;
-	int32_t errcode;
+	char pathname[METAPATHLEN + 30];
+	struct stat logstat;
+	BOOL found, log_valid;
+	int32_t ret, errcode;
+
+	memset(&parent_lookup, 0, sizeof(parent_lookup));
+	parent_lookup.owner_pid = getpid();
+	parent_lookup.log_seq = __atomic_load_n(&(hcfs_system->parent_log_seq),
+						__ATOMIC_ACQUIRE);
+
+	snprintf(pathname, sizeof(pathname), "%s/parentlookup_log", METAPATH);
+	parent_lookup.log_fd = open(pathname, O_RDWR | O_CREAT | O_APPEND,
+				    0600);
+	if (parent_lookup.log_fd < 0) {
+		errcode = errno;
+		write_log(0, "Unexpected error in init: %d (%s)\n", errcode,
+			  strerror(errcode));
+		return -errcode;
+	}
 
-	tmppos = _alloc_new_page(&errcode);
-	if (tmppos == 0) {
-		if (errcode >= 0)
-			errcode = -EIO;
-		goto errcode_handle;
+	snprintf(pathname, sizeof(pathname), "%s/parentlookup_snapshot",
+		 METAPATH);
+	if (access(pathname, F_OK) != 0) {
+		ret = parent_index_init(&(parent_lookup.index), 0);
+		if (ret < 0)
+			goto error_handle;
+		ret = _import_old_lookup_db(&found);
+		if (ret < 0)
+			goto error_handle;
+		if (found == TRUE) {
+			ret = _compact_parent_lookup();
+			if (ret < 0)
+				goto error_handle;
+			snprintf(pathname, sizeof(pathname), "%s/pathlookup_db",
+				 METAPATH);
+			unlink(pathname);
+			snprintf(pathname, sizeof(pathname),
+				 "%s/parentlookup2_db", METAPATH);
+			unlink(pathname);
+			write_log(2, "Imported %" PRId64 " parents from the old "
+				  "parent lookup db\n",
+				  parent_lookup.index.num_used);
+			return 0;
+		}
+		parent_index_destroy(&(parent_lookup.index));
 	}
 
-	memset(&tmppage, 0, sizeof(PLOOKUP_PAGE_T));
-	tmppage.thisinode = self_inode;
-	tmppage.num_parents = 1;
-	tmppage.parents[0] = parent_inode;
-	PWRITE(fileno(plookup2_fptr), &tmppage, sizeof(PLOOKUP_PAGE_T),
-	       tmppos);
+	ret = _load_parent_lookup(&log_valid);
+	if (ret < 0)
+		goto error_handle;
+	if (fstat(parent_lookup.log_fd, &logstat) < 0) {
+		ret = -errno;
+		goto error_handle;
+	}
+	if (log_valid == FALSE)
+		ret = _reset_log();
+	else if ((parent_lookup.num_log_records > 0) ||
+		 (logstat.st_size != parent_lookup.log_pos))
+		/* Also drops a record not completely written */
+		ret = _compact_parent_lookup();
+	if (ret < 0)
+		goto error_handle;
+	write_log(4, "Loaded %" PRId64 " parents to parent lookup\n",
+		  parent_lookup.index.num_used);
+	return 0;
 
-	/* Write link update to the previous page */
-	PREAD(fileno(plookup2_fptr), &tmppage, sizeof(PLOOKUP_PAGE_T),
-	       prevpos);
-	tmppage.nextpage = tmppos;
-	PWRITE(fileno(plookup2_fptr), &tmppage, sizeof(PLOOKUP_PAGE_T),
-	       prevpos);
+error_handle:
+	write_log(0, "Unable to load parent lookup. (%d)\n", ret);
+	destroy_parent_lookup();
+	return ret;
+}
 
-	return 0;
-errcode_handle:
-	return errcode;
+/************************************************************************
+*
+* Function name: destroy_parent_lookup
+*        Inputs: None
+*       Summary: Close the log and free the parent index.
+*  Return value: None
+*
+*************************************************************************/
+void destroy_parent_lookup(void)
+{
+	if (parent_lookup.log_fd >= 0)
+		close(parent_lookup.log_fd);
+	parent_lookup.log_fd = -1;
+	parent_index_destroy(&(parent_lookup.index));
 }
 
 /************************************************************************
 *
-* Function name: lookup_add_parent
-*        Inputs: ino_t self_inode, ino_t parent_inode
-*       Summary: Add a parent "parent_inode" to the parent lookup for
-*                "self_inode".
+* Function name: fetch_all_parents
+*        Inputs: ino_t self_inode, int32_t *parentnum, ino_t **parentlist
+*       Summary: Returns the list of parents for "self_inode" in "parentlist".
+*                The number of parents is returned in "parentnum".
+*                When calling the function, "*parentlist" should be NULL, and
+*                after the function returns, the caller should free
+*                "parentlist".
 *                pathlookup_data_lock should be locked before calling.
 *  Return value: 0 if successful. Otherwise returns negation of error code.
 *
 *************************************************************************/
-int32_t lookup_add_parent(ino_t self_inode, ino_t parent_inode)
+int32_t fetch_all_parents(ino_t self_inode, int32_t *parentnum, ino_t **parentlist)
 {
-	off_t filepos;
-	int32_t ret;
+	int32_t totalnum;
 	int32_t sem_val;
-	PRIMARY_PARENT_T tmpparent;
-	int32_t hashval;
-	PLOOKUP_PAGE_T tmppage;
-	int64_t tmppos, prevpos;
+	int32_t ret;
 
-	if ((self_inode <= 0) || (parent_inode <= 0))
+	if (self_inode <= 0)
 		return -EINVAL;
 
 	ret = sem_getvalue(&(pathlookup_data_lock), &sem_val);
 	if ((sem_val > 0) || (ret < 0))
 		return -EINVAL;
 
-	memset(&tmpparent, 0, sizeof(PRIMARY_PARENT_T));
-	filepos = (off_t) ((self_inode - 1) * sizeof(PRIMARY_PARENT_T));
-	PREAD(fileno(pathlookup_data_fptr), &tmpparent,
-	      sizeof(PRIMARY_PARENT_T), filepos);
+	ret = _follow_log();
+	if (ret < 0)
+		return ret;
 
-	if (tmpparent.parentinode == 0) {
-		/* Add the parent to the primary lookup db */
-		tmpparent.parentinode = parent_inode;
-		PWRITE(fileno(pathlookup_data_fptr), &tmpparent,
-		       sizeof(PRIMARY_PARENT_T), filepos);
+	totalnum = parent_index_fetch(&(parent_lookup.index), self_inode,
+				      NULL, 0);
+	if (totalnum == 0) {
+		*parentnum = 0;
 		return 0;
 	}
-	/* Need to find an entry in the secondary lookup */
-	if (tmpparent.haveothers == FALSE) {
-		tmpparent.haveothers = TRUE;
-		PWRITE(fileno(pathlookup_data_fptr), &tmpparent,
-		       sizeof(PRIMARY_PARENT_T), filepos);
-	}
 
-	hashval = self_inode % PLOOKUP_HASH_NUM_ENTRIES;
-	tmppos = parent_lookup_head.hash_head[hashval];
-	if (tmppos == 0) {
-		/* Add a new page to the hash head */
-		ret = _add_to_head(self_inode, parent_inode);
-		return ret;
-	}
+	*parentlist = (ino_t *) calloc(totalnum, sizeof(ino_t));
+	if (*parentlist == NULL)
+		return -ENOMEM;
+	parent_index_fetch(&(parent_lookup.index), self_inode, *parentlist,
+			   totalnum);
+	*parentnum = totalnum;
+	return 0;
+}
 
-	prevpos = 0;
-	while (tmppos != 0) {
-		PREAD(fileno(plookup2_fptr), &tmppage, sizeof(PLOOKUP_PAGE_T),
-		      tmppos);
-		if (tmppage.thisinode == self_inode)
-			break;
-		prevpos = tmppos;
-		tmppos = tmppage.nextlookup;
-	}
+/************************************************************************
+*
+* Function name: lookup_first_parent
+*        Inputs: ino_t self_inode, ino_t *parentptr
+*       Summary: Returns the first parent of "self_inode", which is the
+*                one used for path reconstruction, in "parentptr". The
+*                parent is 0 if there is none.
+*                pathlookup_data_lock should be locked before calling.
+*  Return value: 0 if successful. Otherwise returns negation of error code.
+*
+*************************************************************************/
+int32_t lookup_first_parent(ino_t self_inode, ino_t *parentptr)
+{
+	int32_t sem_val;
+	int32_t ret;
+
+	if (self_inode <= 0)
+		return -EINVAL;
+
+	ret = sem_getvalue(&(pathlookup_data_lock), &sem_val);
+	if ((sem_val > 0) || (ret < 0))
+		return -EINVAL;
 
-	if (tmppos == 0) {
-		/* Add a new page to the tail of the linked list */
-		ret = _add_to_tail(self_inode, parent_inode, prevpos);
+	ret = _follow_log();
+	if (ret < 0)
 		return ret;
-	}
 
-	/* Check for empty slot for the new parent */
-	prevpos = 0;
-	while (tmppos != 0) {
-		if (tmppage.num_parents < MAX_PARENTS_PER_PAGE) {
-			tmppage.parents[tmppage.num_parents] = parent_inode;
-			tmppage.num_parents++;
-			PWRITE(fileno(plookup2_fptr), &tmppage,
-			      sizeof(PLOOKUP_PAGE_T), tmppos);
-			return 0;
-		}
-		prevpos = tmppos;
-		tmppos = tmppage.nextpage;
-		if (tmppos != 0) {
-			/* Read the next page in the same inode */
-			PREAD(fileno(plookup2_fptr), &tmppage,
-			      sizeof(PLOOKUP_PAGE_T), tmppos);
-		}
-	}
-	/* No empty slot for the existing pages. Allocate a new one */
+	*parentptr = parent_index_first(&(parent_lookup.index), self_inode);
+	return 0;
+}
 
-	ret = _add_new_page(self_inode, parent_inode, prevpos);
-	return ret;
+/************************************************************************
+*
+* Function name: lookup_max_inode
+*        Inputs: ino_t *maxptr
+*       Summary: Returns in "maxptr" an inode number no less than any
+*                inode with a parent.
+*                pathlookup_data_lock should be locked before calling.
+*  Return value: 0 if successful. Otherwise returns negation of error code.
+*
+*************************************************************************/
+int32_t lookup_max_inode(ino_t *maxptr)
+{
+	int32_t sem_val;
+	int32_t ret;
 
-errcode_handle:
-	return errcode;
+	ret = sem_getvalue(&(pathlookup_data_lock), &sem_val);
+	if ((sem_val > 0) || (ret < 0))
+		return -EINVAL;
+
+	ret = _follow_log();
+	if (ret < 0)
+		return ret;
+
+	*maxptr = parent_lookup.index.max_child;
+	return 0;
 }
 
 /************************************************************************
 *
-* Function name: lookup_delete_parent
+* Function name: lookup_add_parent
 *        Inputs: ino_t self_inode, ino_t parent_inode
-*       Summary: Deletes a parent "parent_inode" from the parent lookup for
+*       Summary: Add a parent "parent_inode" to the parent lookup for
 *                "self_inode".
 *                pathlookup_data_lock should be locked before calling.
 *  Return value: 0 if successful. Otherwise returns negation of error code.
 *
 *************************************************************************/
-int32_t lookup_delete_parent(ino_t self_inode, ino_t parent_inode)
+int32_t lookup_add_parent(ino_t self_inode, ino_t parent_inode)
 {
-	off_t filepos;
+	PARENT_LOG_RECORD record;
 	int32_t ret;
 	int32_t sem_val;
-	int64_t prevllpos, prevpagepos, tmppos, tmpnextpos;
-	PRIMARY_PARENT_T tmpparent;
-	int32_t hashval;
-	PLOOKUP_PAGE_T tmppage, prevpage, nextpage;
-	uint8_t deleteall;
-	int8_t count;
 
 	if ((self_inode <= 0) || (parent_inode <= 0))
 		return -EINVAL;
@@ -399,163 +784,45 @@ int32_t lookup_delete_parent(ino_t self_inode, ino_t parent_inode)
 	if ((sem_val > 0) || (ret < 0))
 		return -EINVAL;
 
-	filepos = (off_t) ((self_inode - 1) * sizeof(PRIMARY_PARENT_T));
-	PREAD(fileno(pathlookup_data_fptr), &tmpparent,
-	      sizeof(PRIMARY_PARENT_T), filepos);
-
-	if (tmpparent.parentinode == parent_inode) {
-		/* Remove the parent from the primary lookup db */
-		tmpparent.parentinode = 0;
-		PWRITE(fileno(pathlookup_data_fptr), &tmpparent,
-		       sizeof(PRIMARY_PARENT_T), filepos);
-		return 0;
-	}
-
-	if (tmpparent.haveothers == FALSE)
-		return -ENOENT;
-
-	hashval = self_inode % PLOOKUP_HASH_NUM_ENTRIES;
-	tmppos = parent_lookup_head.hash_head[hashval];
-
-	/* prevllpos is kept so that the entire inode can be removed
-	if empty */
-	prevllpos = 0;
-	while (tmppos != 0) {
-		PREAD(fileno(plookup2_fptr), &tmppage, sizeof(PLOOKUP_PAGE_T),
-		      tmppos);
-		if (tmppage.thisinode == self_inode)
-			break;
-		prevllpos = tmppos;
-		tmppos = tmppage.nextlookup;
-	}
-	if (tmppos == 0) {  /* If cannot find entry in hash table */
-		/* Flag in primary lookup db is not valid. Reset. */
-		filepos = (off_t) ((self_inode - 1) * sizeof(PRIMARY_PARENT_T));
-		PREAD(fileno(pathlookup_data_fptr), &tmpparent,
-		      sizeof(PRIMARY_PARENT_T), filepos);
-		tmpparent.haveothers = FALSE;
-		PWRITE(fileno(pathlookup_data_fptr), &tmpparent,
-		      sizeof(PRIMARY_PARENT_T), filepos);
-		return -ENOENT;
-	}
-
-	/* Search the page list for the inode found */
-	/* Starts reading the parents from here */
-	prevpagepos = 0;
-	while (tmppos != 0) {
-		for (count = 0; count < tmppage.num_parents; count++) {
-			if (tmppage.parents[count] == parent_inode)
-				break;
-		}
-		if (count < tmppage.num_parents) /* If found */
-			break;
-		prevpagepos = tmppos; /* This is for tracking linked list */
-		tmppos = tmppage.nextpage;
-		if (tmppos != 0) {
-			/* Read the next page in the same inode */
-			PREAD(fileno(plookup2_fptr), &tmppage,
-			      sizeof(PLOOKUP_PAGE_T), tmppos);
-		}
-	}
-
-	/* Did not find the parent to be replaced */
-	if (tmppos == 0)
-		return -ENOENT;
-
-	/* Found the entry. Need to delete */
-	tmppage.num_parents--;
-	if (tmppage.num_parents > 0) {
-		/* If there are other parents in this page */
-		if ((tmppage.num_parents - count) > 0)
-			memmove(&(tmppage.parents[count]),
-			        &(tmppage.parents[count+1]),
-			        sizeof(ino_t) * (tmppage.num_parents - count));
-		PWRITE(fileno(plookup2_fptr), &tmppage,
-		       sizeof(PLOOKUP_PAGE_T), tmppos);
-		return 0;
-	}
+	memset(&record, 0, sizeof(PARENT_LOG_RECORD));
+	record.op = PARENT_LOG_ADD;
+	record.self_inode = self_inode;
+	record.parent_inode1 = parent_inode;
+	return _change_parent_lookup(&record);
+}
 
-	/* There is nothing left in this page. Delete and put to gc */
-	tmpnextpos = tmppage.nextpage;
-	if ((prevpagepos == 0) && (tmpnextpos == 0)) {
-		/* Nothing left for this inode */
-		deleteall = TRUE;
-		tmpnextpos = tmppage.nextlookup;
-	} else {
-		deleteall = FALSE;
-	}
+/************************************************************************
+*
+* Function name: lookup_delete_parent
+*        Inputs: ino_t self_inode, ino_t parent_inode
+*       Summary: Deletes a parent "parent_inode" from the parent lookup for
+*                "self_inode".
+*                pathlookup_data_lock should be locked before calling.
+*  Return value: 0 if successful. Otherwise returns negation of error code.
+*
+*************************************************************************/
+int32_t lookup_delete_parent(ino_t self_inode, ino_t parent_inode)
+{
+	PARENT_LOG_RECORD record;
+	int32_t ret;
+	int32_t sem_val;
 
-	if (deleteall == FALSE) {
-		if (prevpagepos != 0) {
-			PREAD(fileno(plookup2_fptr), &prevpage,
-			      sizeof(PLOOKUP_PAGE_T), prevpagepos);
-			prevpage.nextpage = tmpnextpos;
-			PWRITE(fileno(plookup2_fptr), &prevpage,
-			       sizeof(PLOOKUP_PAGE_T), prevpagepos);
-		} else if (prevllpos == 0) {
-			/* The next page is the new head. Need to
-			change the linked list for the hash */
-			/* Here the new head is also the first in the
-			hash linked list */
-			PREAD(fileno(plookup2_fptr), &nextpage,
-			      sizeof(PLOOKUP_PAGE_T), tmpnextpos);
-			nextpage.nextlookup = tmppage.nextlookup;
-			PWRITE(fileno(plookup2_fptr), &nextpage,
-			       sizeof(PLOOKUP_PAGE_T), tmpnextpos);
-			parent_lookup_head.hash_head[hashval] = tmpnextpos;
-			PWRITE(fileno(plookup2_fptr), &parent_lookup_head,
-			       sizeof(PLOOKUP_HEAD_T), 0);
-		} else {
-			/* The next page is the new head. Need to
-			change the linked list for the hash */
-			/* Here also need to update the link in the previous
-			inode on the hash linked list */
-			PREAD(fileno(plookup2_fptr), &nextpage,
-			      sizeof(PLOOKUP_PAGE_T), tmpnextpos);
-			nextpage.nextlookup = tmppage.nextlookup;
-			PWRITE(fileno(plookup2_fptr), &nextpage,
-			       sizeof(PLOOKUP_PAGE_T), tmpnextpos);
-			PREAD(fileno(plookup2_fptr), &prevpage,
-			      sizeof(PLOOKUP_PAGE_T), prevllpos);
-			prevpage.nextlookup = tmpnextpos;
-			PWRITE(fileno(plookup2_fptr), &prevpage,
-			      sizeof(PLOOKUP_PAGE_T), prevllpos);
-		}
-	} else {
-		/* If need to delete the entire inode from the secondary db */
-		if (prevllpos == 0) {
-			parent_lookup_head.hash_head[hashval] = tmpnextpos;
-			PWRITE(fileno(plookup2_fptr), &parent_lookup_head,
-			       sizeof(PLOOKUP_HEAD_T), 0);
-		} else {
-			PREAD(fileno(plookup2_fptr), &prevpage,
-			      sizeof(PLOOKUP_PAGE_T), prevllpos);
-			prevpage.nextlookup = tmpnextpos;
-			PWRITE(fileno(plookup2_fptr), &prevpage,
-			      sizeof(PLOOKUP_PAGE_T), prevllpos);
-		}
-		/* Mark haveothers as FALSE in the primary lookup db */
-		filepos = (off_t) ((self_inode - 1) * sizeof(PRIMARY_PARENT_T));
-		PREAD(fileno(pathlookup_data_fptr), &tmpparent,
-		      sizeof(PRIMARY_PARENT_T), filepos);
-		tmpparent.haveothers = FALSE;
-		PWRITE(fileno(pathlookup_data_fptr), &tmpparent,
-		      sizeof(PRIMARY_PARENT_T), filepos);
-	}
+	if ((self_inode <= 0) || (parent_inode <= 0))
+		return -EINVAL;
 
-	/* Recycle the old page */
-	memset(&tmppage, 0, sizeof(PLOOKUP_PAGE_T));
-	tmppage.gc_next = parent_lookup_head.gc_head;
-	parent_lookup_head.gc_head = tmppos;
-	PWRITE(fileno(plookup2_fptr), &tmppage,
-		       sizeof(PLOOKUP_PAGE_T), tmppos);
-	PWRITE(fileno(plookup2_fptr), &parent_lookup_head,
-		       sizeof(PLOOKUP_HEAD_T), 0);
+	ret = sem_getvalue(&(pathlookup_data_lock), &sem_val);
+	if ((sem_val > 0) || (ret < 0))
+		return -EINVAL;
 
-	return 0;
+	/* Pending dir statistics starting from this inode need the path to
+	the root, so add them now. Errors are logged there. */
+	flush_dirstat_delta_of(self_inode);
 
-errcode_handle:
-	return errcode;
+	memset(&record, 0, sizeof(PARENT_LOG_RECORD));
+	record.op = PARENT_LOG_DELETE;
+	record.self_inode = self_inode;
+	record.parent_inode1 = parent_inode;
+	return _change_parent_lookup(&record);
 }
 
 /************************************************************************
@@ -570,14 +837,9 @@ errcode_handle:
 int32_t lookup_replace_parent(ino_t self_inode, ino_t parent_inode1,
 			  ino_t parent_inode2)
 {
-	off_t filepos;
+	PARENT_LOG_RECORD record;
 	int32_t ret;
 	int32_t sem_val;
-	PRIMARY_PARENT_T tmpparent;
-	int32_t hashval;
-	PLOOKUP_PAGE_T tmppage;
-	int64_t tmppos;
-	uint8_t count;
 
 	if (((self_inode <= 0) || (parent_inode1 <= 0)) || (parent_inode2 <= 0))
 		return -EINVAL;
@@ -586,54 +848,40 @@ int32_t lookup_replace_parent(ino_t self_inode, ino_t parent_inode1,
 	if ((sem_val > 0) || (ret < 0))
 		return -EINVAL;
 
-	filepos = (off_t) ((self_inode - 1) * sizeof(PRIMARY_PARENT_T));
-	PREAD(fileno(pathlookup_data_fptr), &tmpparent,
-	      sizeof(PRIMARY_PARENT_T), filepos);
+	memset(&record, 0, sizeof(PARENT_LOG_RECORD));
+	record.op = PARENT_LOG_REPLACE;
+	record.self_inode = self_inode;
+	record.parent_inode1 = parent_inode1;
+	record.parent_inode2 = parent_inode2;
+	return _change_parent_lookup(&record);
+}
 
-	if (tmpparent.parentinode == parent_inode1) {
-		/* Replace the parent */
-		tmpparent.parentinode = parent_inode2;
-		PWRITE(fileno(pathlookup_data_fptr), &tmpparent,
-		       sizeof(PRIMARY_PARENT_T), filepos);
-		return 0;
-	}
+/************************************************************************
+*
+* Function name: lookup_reset_parent
+*        Inputs: ino_t self_inode, ino_t parent_inode
+*       Summary: Drop all parents of "self_inode", and then add
+*                "parent_inode" as the only parent if it is not 0.
+*                pathlookup_data_lock should be locked before calling.
+*  Return value: 0 if successful. Otherwise returns negation of error code.
+*
+*************************************************************************/
+int32_t lookup_reset_parent(ino_t self_inode, ino_t parent_inode)
+{
+	PARENT_LOG_RECORD record;
+	int32_t ret;
+	int32_t sem_val;
 
-	if (tmpparent.haveothers == FALSE)
-		return -ENOENT;
+	if (self_inode <= 0)
+		return -EINVAL;
 
-	hashval = self_inode % PLOOKUP_HASH_NUM_ENTRIES;
-	tmppos = parent_lookup_head.hash_head[hashval];
-	while (tmppos != 0) {
-		PREAD(fileno(plookup2_fptr), &tmppage, sizeof(PLOOKUP_PAGE_T),
-		      tmppos);
-		if (tmppage.thisinode == self_inode)
-			break;
-		tmppos = tmppage.nextlookup;
-	}
-	if (tmppos == 0)  /* If cannot find entry in hash table */
-		return -ENOENT;
-
-	/* Starts reading the parents from here */
-	while (tmppos != 0) {
-		for (count = 0; count < tmppage.num_parents; count++) {
-			if (tmppage.parents[count] == parent_inode1) {
-				tmppage.parents[count] = parent_inode2;
-				PWRITE(fileno(plookup2_fptr), &tmppage,
-				      sizeof(PLOOKUP_PAGE_T), tmppos);
-				return 0;
-			}
-		}
-		tmppos = tmppage.nextpage;
-		if (tmppos != 0) {
-			/* Read the next page in the same inode */
-			PREAD(fileno(plookup2_fptr), &tmppage,
-			      sizeof(PLOOKUP_PAGE_T), tmppos);
-		}
-	}
+	ret = sem_getvalue(&(pathlookup_data_lock), &sem_val);
+	if ((sem_val > 0) || (ret < 0))
+		return -EINVAL;
 
-	/* Did not find the parent to be replaced */
-	return -ENOENT;
-errcode_handle:
-	return errcode;
+	memset(&record, 0, sizeof(PARENT_LOG_RECORD));
+	record.op = PARENT_LOG_RESET;
+	record.self_inode = self_inode;
+	record.parent_inode1 = parent_inode;
+	return _change_parent_lookup(&record);
 }
-
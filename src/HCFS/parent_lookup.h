@@ -26,7 +26,10 @@
 #include <stdint.h>
 
 #include "params.h"
+#include "parent_index.h"
 
+/* Parent lookup db used before the parent index. Only read when importing
+the parents to the index. */
 #define MAX_PARENTS_PER_PAGE 32
 #define PLOOKUP_HASH_NUM_ENTRIES 1024
 typedef struct {
@@ -48,16 +51,57 @@ typedef struct {
 	int64_t gc_head;
 } PLOOKUP_HEAD_T;
 
-PLOOKUP_HEAD_T parent_lookup_head;	
+/* The parent index is saved as a snapshot of all pairs, followed by a log
+of the changes made after the snapshot. The log is merged into a new
+snapshot at startup, or when it has more records than both
+PARENT_LOG_COMPACT_RECORDS and the number of pairs. */
+#define PARENT_SNAPSHOT_MAGIC "PIDX"
+#define PARENT_LOG_MAGIC "PLOG"
+#define PARENT_LOOKUP_VERSION 1
+#define PARENT_LOG_COMPACT_RECORDS 65536
+#define PARENT_LOG_READ_RECORDS 256
+
+typedef struct {
+	char magic[4];
+	int32_t version;
+	/* The log only applies to the snapshot of the same generation */
+	int64_t generation;
+	int64_t num_pairs;
+} PARENT_SNAPSHOT_HEAD;
+
+typedef struct {
+	char magic[4];
+	int32_t version;
+	int64_t generation;
+} PARENT_LOG_HEAD;
+
+enum {
+	PARENT_LOG_ADD = 1,
+	PARENT_LOG_DELETE,
+	PARENT_LOG_REPLACE,
+	PARENT_LOG_RESET
+};
+
+typedef struct {
+	int32_t op;
+	int32_t reserved;
+	ino_t self_inode;
+	ino_t parent_inode1;
+	ino_t parent_inode2;
+} PARENT_LOG_RECORD;
 
-FILE *plookup2_fptr;
 /* API for calling from outside */
 
+int32_t init_parent_lookup(void);
+void destroy_parent_lookup(void);
 int32_t fetch_all_parents(ino_t self_inode, int32_t *parentnum, ino_t **parentlist);
+int32_t lookup_first_parent(ino_t self_inode, ino_t *parentptr);
+int32_t lookup_max_inode(ino_t *maxptr);
 int32_t lookup_add_parent(ino_t self_inode, ino_t parent_inode);
 int32_t lookup_delete_parent(ino_t self_inode, ino_t parent_inode);
 int32_t lookup_replace_parent(ino_t self_inode, ino_t parent_inode1,
 			  ino_t parent_inode2);
+int32_t lookup_reset_parent(ino_t self_inode, ino_t parent_inode);
 
 #endif  /* GW20_HCFS_PARENT_LOOKUP_H_ */
 
@@ -25,6 +25,7 @@
 #include <string.h>
 #include <limits.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <inttypes.h>
 
 #include "logger.h"
@@ -35,11 +36,417 @@
 #include "global.h"
 #include "utils.h"
 
+/* Helper for hashing inode numbers into the node table */
+static inline int64_t _node_hash(PATH_CACHE *cacheptr, ino_t thisinode)
+{
+	return (int64_t)((((uint64_t) thisinode * 0x9E3779B97F4A7C15ULL) >>
+			  32) & (uint64_t)(cacheptr->num_buckets - 1));
+}
+
+/* Helper for hashing names into the name table (FNV-1a) */
+static uint32_t _name_hash(const char *name, int32_t len)
+{
+	uint32_t hashval = 2166136261U;
+	int32_t count;
+
+	for (count = 0; count < len; count++) {
+		hashval ^= (uint8_t) name[count];
+		hashval *= 16777619U;
+	}
+	return hashval;
+}
+
+/* Helper for finding the interned copy of a name, adding one if needed */
+static PATH_NAME *_intern_name(PATH_CACHE *cacheptr, const char *name)
+{
+	PATH_NAME *tmpname;
+	int32_t len;
+	uint32_t hashval;
+	int64_t index;
+
+	len = strlen(name);
+	hashval = _name_hash(name, len);
+	index = hashval & (cacheptr->num_buckets - 1);
+
+	for (tmpname = cacheptr->name_table[index]; tmpname != NULL;
+	     tmpname = tmpname->next) {
+		if ((tmpname->hashval == hashval) && (tmpname->len == len) &&
+		    (memcmp(tmpname->name, name, len) == 0)) {
+			(tmpname->refcount)++;
+			return tmpname;
+		}
+	}
+
+	tmpname = malloc(sizeof(PATH_NAME) + len + 1);
+	if (tmpname == NULL) {
+		write_log(0, "Out of memory\n");
+		return NULL;
+	}
+	tmpname->refcount = 1;
+	tmpname->hashval = hashval;
+	tmpname->len = len;
+	memcpy(tmpname->name, name, len + 1);
+	tmpname->next = cacheptr->name_table[index];
+	cacheptr->name_table[index] = tmpname;
+	cacheptr->mem_used += sizeof(PATH_NAME) + len + 1;
+	return tmpname;
+}
+
+/* Helper for dropping a reference to an interned name */
+static void _release_name(PATH_CACHE *cacheptr, PATH_NAME *nameptr)
+{
+	PATH_NAME **prevptr;
+	int64_t index;
+
+	if (nameptr == NULL)
+		return;
+	(nameptr->refcount)--;
+	if (nameptr->refcount > 0)
+		return;
+
+	index = nameptr->hashval & (cacheptr->num_buckets - 1);
+	for (prevptr = &(cacheptr->name_table[index]); *prevptr != NULL;
+	     prevptr = &((*prevptr)->next)) {
+		if (*prevptr == nameptr) {
+			*prevptr = nameptr->next;
+			break;
+		}
+	}
+	cacheptr->mem_used -= sizeof(PATH_NAME) + nameptr->len + 1;
+	free(nameptr);
+}
+
+/* Helper for removing a leaf from the LRU list */
+static void _lru_remove(PATH_CACHE *cacheptr, PATH_LOOKUP *node)
+{
+	if (node->lru_prev != NULL)
+		(node->lru_prev)->lru_next = node->lru_next;
+	else if (cacheptr->lru_first == node)
+		cacheptr->lru_first = node->lru_next;
+	if (node->lru_next != NULL)
+		(node->lru_next)->lru_prev = node->lru_prev;
+	else if (cacheptr->lru_last == node)
+		cacheptr->lru_last = node->lru_prev;
+	node->lru_prev = NULL;
+	node->lru_next = NULL;
+}
+
+/* Helper for queueing a leaf as the most recently used one */
+static void _lru_push_front(PATH_CACHE *cacheptr, PATH_LOOKUP *node)
+{
+	node->lru_prev = NULL;
+	node->lru_next = cacheptr->lru_first;
+	if (cacheptr->lru_first != NULL)
+		(cacheptr->lru_first)->lru_prev = node;
+	else
+		cacheptr->lru_last = node;
+	cacheptr->lru_first = node;
+}
+
+/* Helper for queueing a leaf as the least recently used one */
+static void _lru_push_back(PATH_CACHE *cacheptr, PATH_LOOKUP *node)
+{
+	node->lru_next = NULL;
+	node->lru_prev = cacheptr->lru_last;
+	if (cacheptr->lru_last != NULL)
+		(cacheptr->lru_last)->lru_next = node;
+	else
+		cacheptr->lru_first = node;
+	cacheptr->lru_last = node;
+}
+
+/* Helper for linking a node to the node of its parent. The parent is
+no longer a leaf. */
+static void _attach_child(PATH_CACHE *cacheptr, PATH_LOOKUP *node,
+			  PATH_LOOKUP *parent_node)
+{
+	node->parent_node = parent_node;
+	if (parent_node == NULL)
+		return;
+	if (parent_node->num_children == 0)
+		_lru_remove(cacheptr, parent_node);
+	(parent_node->num_children)++;
+}
+
+/* Helper for unlinking a node from the node of its parent. A parent
+becoming a leaf was so far only used through its children, so it is
+queued to be dropped first. */
+static void _detach_child(PATH_CACHE *cacheptr, PATH_LOOKUP *node)
+{
+	PATH_LOOKUP *parent_node = node->parent_node;
+
+	node->parent_node = NULL;
+	if (parent_node == NULL)
+		return;
+	(parent_node->num_children)--;
+	if (parent_node->num_children == 0)
+		_lru_push_back(cacheptr, parent_node);
+}
+
+/* Helper for finding the node of an inode */
+static PATH_LOOKUP *_find_node(PATH_CACHE *cacheptr, ino_t thisinode)
+{
+	PATH_LOOKUP *node;
+
+	node = cacheptr->hashtable[_node_hash(cacheptr, thisinode)];
+	while (node != NULL) {
+		if (node->child == thisinode)
+			return node;
+		node = node->next;
+	}
+	return NULL;
+}
+
+/* Helper for adding an empty leaf node for an inode */
+static PATH_LOOKUP *_new_node(PATH_CACHE *cacheptr, ino_t thisinode)
+{
+	PATH_LOOKUP *node;
+	int64_t index;
+
+	node = calloc(1, sizeof(PATH_LOOKUP));
+	if (node == NULL) {
+		write_log(0, "Out of memory\n");
+		return NULL;
+	}
+	node->child = thisinode;
+	node->valid = FALSE;
+	index = _node_hash(cacheptr, thisinode);
+	node->next = cacheptr->hashtable[index];
+	cacheptr->hashtable[index] = node;
+	_lru_push_front(cacheptr, node);
+	(cacheptr->num_nodes)++;
+	cacheptr->mem_used += sizeof(PATH_LOOKUP);
+	return node;
+}
+
+/* Helper for removing a leaf node from the cache */
+static void _remove_node(PATH_CACHE *cacheptr, PATH_LOOKUP *node)
+{
+	PATH_LOOKUP **prevptr;
+	int64_t index;
+
+	index = _node_hash(cacheptr, node->child);
+	for (prevptr = &(cacheptr->hashtable[index]); *prevptr != NULL;
+	     prevptr = &((*prevptr)->next)) {
+		if (*prevptr == node) {
+			*prevptr = node->next;
+			break;
+		}
+	}
+	_lru_remove(cacheptr, node);
+	_detach_child(cacheptr, node);
+	_release_name(cacheptr, node->name);
+	free(node);
+	(cacheptr->num_nodes)--;
+	cacheptr->mem_used -= sizeof(PATH_LOOKUP);
+}
+
+/* Helper for dropping least recently used leaves until the cache is
+within its memory budget. Ancestors left without children are dropped
+next. */
+static void _shrink_pathcache(PATH_CACHE *cacheptr)
+{
+	while ((cacheptr->mem_used > cacheptr->mem_limit) &&
+	       (cacheptr->lru_last != NULL))
+		_remove_node(cacheptr, cacheptr->lru_last);
+}
+
+/* Helper for setting the name and parent of a node */
+static int32_t _set_node(PATH_CACHE *cacheptr, PATH_LOOKUP *node,
+			 ino_t parentinode, PATH_LOOKUP *parent_node,
+			 const char *name)
+{
+	PATH_NAME *nameptr;
+
+	nameptr = _intern_name(cacheptr, name);
+	if (nameptr == NULL)
+		return -ENOMEM;
+	_release_name(cacheptr, node->name);
+	node->name = nameptr;
+	if (node->parent_node != parent_node) {
+		_detach_child(cacheptr, node);
+		_attach_child(cacheptr, node, parent_node);
+	}
+	node->parent = parentinode;
+	node->valid = TRUE;
+	return 0;
+}
+
+/* Helper for the path of the snapshot of a path cache */
+static void _snapshot_path(char *pathname, int32_t len, ino_t root_inode)
+{
+	snprintf(pathname, len, "%s/pathcache_%" PRIu64, METAPATH,
+		 (uint64_t) root_inode);
+}
+
+/* Helper for warming up a new path cache from the snapshot saved by
+the previous mount. The snapshot is removed after loading, so nodes
+left stale by a crash are never loaded. */
+static void _load_pathcache(PATH_CACHE *cacheptr)
+{
+	char pathname[METAPATHLEN + 64];
+	char name[MAX_FILENAME_LEN + 1];
+	FILE *fptr;
+	PATH_CACHE_SNAPSHOT_HEAD head;
+	PATH_CACHE_SNAPSHOT_NODE snapnode;
+	PATH_LOOKUP *node, *parent_node;
+	int64_t count;
+
+	_snapshot_path(pathname, sizeof(pathname), cacheptr->root_inode);
+	fptr = fopen(pathname, "r");
+	if (fptr == NULL)
+		return;
+
+	if ((fread(&head, sizeof(head), 1, fptr) != 1) ||
+	    (memcmp(head.magic, PATH_CACHE_SNAPSHOT_MAGIC, 4) != 0) ||
+	    (head.version != PATH_CACHE_SNAPSHOT_VERSION) ||
+	    (head.root_inode != cacheptr->root_inode)) {
+		write_log(2, "Ignoring invalid path cache snapshot %s\n",
+			  pathname);
+		goto end;
+	}
+
+	for (count = 0; count < head.num_nodes; count++) {
+		if (cacheptr->mem_used >= cacheptr->mem_limit)
+			break;
+		if (fread(&snapnode, sizeof(snapnode), 1, fptr) != 1)
+			break;
+		if ((snapnode.name_len <= 0) ||
+		    (snapnode.name_len > MAX_FILENAME_LEN))
+			break;
+		if (fread(name, snapnode.name_len, 1, fptr) != 1)
+			break;
+		name[snapnode.name_len] = 0;
+
+		if (_find_node(cacheptr, snapnode.child) != NULL)
+			continue;
+		parent_node = NULL;
+		if (snapnode.parent != cacheptr->root_inode) {
+			parent_node = _find_node(cacheptr, snapnode.parent);
+			if (parent_node == NULL)
+				continue;
+		}
+		node = _new_node(cacheptr, snapnode.child);
+		if (node == NULL)
+			break;
+		if (_set_node(cacheptr, node, snapnode.parent, parent_node,
+			      name) < 0) {
+			_remove_node(cacheptr, node);
+			break;
+		}
+	}
+	write_log(10, "Loaded %" PRId64 " nodes to path cache of %" PRIu64
+		  "\n", cacheptr->num_nodes, (uint64_t) cacheptr->root_inode);
+end:
+	fclose(fptr);
+	unlink(pathname);
+}
+
+typedef struct {
+	int32_t depth;
+	PATH_LOOKUP *node;
+} PATH_CACHE_SAVE_ENTRY;
+
+static int32_t _compare_depth(const void *ptr1, const void *ptr2)
+{
+	const PATH_CACHE_SAVE_ENTRY *entry1 = ptr1, *entry2 = ptr2;
+
+	return entry1->depth - entry2->depth;
+}
+
+/* Helper for saving the nodes whose whole ancestor chain is valid to a
+snapshot, parents first */
+static int32_t _save_pathcache(PATH_CACHE *cacheptr)
+{
+	char pathname[METAPATHLEN + 64], tmppath[METAPATHLEN + 70];
+	FILE *fptr = NULL;
+	PATH_CACHE_SNAPSHOT_HEAD head;
+	PATH_CACHE_SNAPSHOT_NODE snapnode;
+	PATH_CACHE_SAVE_ENTRY *entries;
+	PATH_LOOKUP *node, *tmpnode;
+	int64_t count, num_entries;
+	int32_t depth, errcode;
+
+	if (cacheptr->num_nodes <= 0)
+		return 0;
+	entries = malloc(sizeof(PATH_CACHE_SAVE_ENTRY) * cacheptr->num_nodes);
+	if (entries == NULL) {
+		write_log(0, "Out of memory\n");
+		return -ENOMEM;
+	}
+
+	num_entries = 0;
+	for (count = 0; count < cacheptr->num_buckets; count++) {
+		for (node = cacheptr->hashtable[count]; node != NULL;
+		     node = node->next) {
+			depth = 0;
+			for (tmpnode = node; tmpnode != NULL;
+			     tmpnode = tmpnode->parent_node) {
+				if (tmpnode->valid == FALSE)
+					break;
+				depth++;
+			}
+			if (tmpnode != NULL)
+				continue;
+			entries[num_entries].depth = depth;
+			entries[num_entries].node = node;
+			num_entries++;
+		}
+	}
+	qsort(entries, num_entries, sizeof(PATH_CACHE_SAVE_ENTRY),
+	      _compare_depth);
+
+	_snapshot_path(pathname, sizeof(pathname), cacheptr->root_inode);
+	snprintf(tmppath, sizeof(tmppath), "%s.tmp", pathname);
+	fptr = fopen(tmppath, "w");
+	if (fptr == NULL) {
+		errcode = errno;
+		write_log(0, "Unable to save path cache. Code %d, %s\n",
+			  errcode, strerror(errcode));
+		errcode = -errcode;
+		goto errcode_handle;
+	}
+
+	memset(&head, 0, sizeof(head));
+	memcpy(head.magic, PATH_CACHE_SNAPSHOT_MAGIC, 4);
+	head.version = PATH_CACHE_SNAPSHOT_VERSION;
+	head.root_inode = cacheptr->root_inode;
+	head.num_nodes = num_entries;
+	FWRITE(&head, sizeof(head), 1, fptr);
+	for (count = 0; count < num_entries; count++) {
+		node = entries[count].node;
+		memset(&snapnode, 0, sizeof(snapnode));
+		snapnode.child = node->child;
+		snapnode.parent = node->parent;
+		snapnode.name_len = node->name->len;
+		FWRITE(&snapnode, sizeof(snapnode), 1, fptr);
+		FWRITE(node->name->name, node->name->len, 1, fptr);
+	}
+	fclose(fptr);
+	fptr = NULL;
+	if (rename(tmppath, pathname) < 0) {
+		errcode = -errno;
+		goto errcode_handle;
+	}
+	free(entries);
+	return 0;
+
+errcode_handle:
+	if (fptr != NULL) {
+		fclose(fptr);
+		unlink(tmppath);
+	}
+	free(entries);
+	return errcode;
+}
+
 /************************************************************************
 *
 * Function name: init_pathcache
 *        Inputs: ino_t root_inode
-*       Summary: Allocate a new cache for inode to path lookup
+*       Summary: Allocate a new cache for inode to path lookup, sized by
+*                PATH_CACHE_MEM_LIMIT, and warm it up from the snapshot
+*                saved by the previous mount of the volume.
 *  Return value: Pointer to the new path cache structure if successful.
 *                NULL otherwise.
 *
@@ -48,8 +455,9 @@ PATH_CACHE * init_pathcache(ino_t root_inode)
 {
 	int32_t ret, errcode;
 	PATH_CACHE *tmpptr;
+	int64_t num_buckets;
 
-	tmpptr = malloc(sizeof(PATH_CACHE));
+	tmpptr = calloc(1, sizeof(PATH_CACHE));
 	if (tmpptr == NULL) {
 		write_log(0, "Out of memory\n");
 		goto errcode_handle;
@@ -62,17 +470,30 @@ PATH_CACHE * init_pathcache(ino_t root_inode)
 		goto errcode_handle;
 	}
 
-	memset((tmpptr->hashtable), 0,
-		sizeof(PATH_HEAD_ENTRY) * NUM_LOOKUP_ENTRY);
-	tmpptr->gfirst = NULL;
-	tmpptr->num_nodes = 0;
+	tmpptr->mem_limit = PATH_CACHE_MEM_LIMIT;
+	num_buckets = MIN_PATH_CACHE_BUCKETS;
+	while (num_buckets < tmpptr->mem_limit / PATH_CACHE_BYTES_PER_NODE)
+		num_buckets *= 2;
+	tmpptr->num_buckets = num_buckets;
+	tmpptr->hashtable = calloc(num_buckets, sizeof(PATH_LOOKUP *));
+	tmpptr->name_table = calloc(num_buckets, sizeof(PATH_NAME *));
+	if ((tmpptr->hashtable == NULL) || (tmpptr->name_table == NULL)) {
+		write_log(0, "Out of memory\n");
+		goto errcode_handle;
+	}
+	tmpptr->mem_used = 2 * num_buckets * sizeof(void *);
 	tmpptr->root_inode = root_inode;
 
+	_load_pathcache(tmpptr);
+
 	return tmpptr;
 
 errcode_handle:
-	if (tmpptr != NULL)
+	if (tmpptr != NULL) {
+		free(tmpptr->hashtable);
+		free(tmpptr->name_table);
 		free(tmpptr);
+	}
 	return NULL;
 }
 
@@ -80,14 +501,17 @@ errcode_handle:
 *
 * Function name: destroy_pathcache
 *        Inputs: PATH_CACHE *cacheptr
-*       Summary: Free up cache pointed by "cacheptr" for inode to path lookup
+*       Summary: Save a snapshot of the cache pointed by "cacheptr" for
+*                the next mount, then free up the cache.
 *  Return value: 0 if successful. Otherwise returns negation of error code.
 *
 *************************************************************************/
 int32_t destroy_pathcache(PATH_CACHE *cacheptr)
 {
 	PATH_LOOKUP *tmp, *next;
-	int32_t count, ret, errcode;
+	PATH_NAME *tmpname, *nextname;
+	int64_t count;
+	int32_t ret, errcode;
 
 	if (cacheptr == NULL)
 		return -EINVAL;
@@ -101,15 +525,24 @@ int32_t destroy_pathcache(PATH_CACHE *cacheptr)
 		goto errcode_handle;
 	}
 
-	for (count = 0; count < NUM_LOOKUP_ENTRY; count++) {
-		tmp = (cacheptr->hashtable[count]).first;
+	_save_pathcache(cacheptr);
 
+	for (count = 0; count < cacheptr->num_buckets; count++) {
+		tmp = cacheptr->hashtable[count];
 		while (tmp != NULL) {
 			next = tmp->next;
 			free(tmp);
 			tmp = next;
 		}
+		tmpname = cacheptr->name_table[count];
+		while (tmpname != NULL) {
+			nextname = tmpname->next;
+			free(tmpname);
+			tmpname = nextname;
+		}
 	}
+	free(cacheptr->hashtable);
+	free(cacheptr->name_table);
 	sem_post(&(cacheptr->pathcache_lock));
 	free(cacheptr);
 	return 0;
@@ -118,114 +551,6 @@ errcode_handle:
 	return errcode;
 }
 
-/* Internal function for dropping a certain number of least-referenced
-entries */
-void drop_cache_entry(PATH_CACHE *cacheptr)
-{
-	int32_t num_dropped, hashval;
-	PATH_LOOKUP *tmpptr;
-
-	num_dropped = 0;
-	while (num_dropped < NUM_NODES_DROP) {
-		tmpptr = cacheptr->gfirst;
-		if (!tmpptr || cacheptr->num_nodes <= 0)
-			break;
-		cacheptr->gfirst = tmpptr->gnext;
-		if (cacheptr->gfirst != NULL)
-			(cacheptr->gfirst)->gprev = NULL;
-
-		if (tmpptr->prev == NULL) {
-			hashval = (tmpptr->child) % NUM_LOOKUP_ENTRY;
-			(cacheptr->hashtable[hashval]).first = tmpptr->next;
-		} else {
-			(tmpptr->prev)->next = tmpptr->next;
-		}
-		if (tmpptr->next == NULL) {
-			hashval = (tmpptr->child) % NUM_LOOKUP_ENTRY;
-			(cacheptr->hashtable[hashval]).last = tmpptr->prev;
-		} else {
-			(tmpptr->next)->prev = tmpptr->prev;
-		}
-		free(tmpptr);
-		(cacheptr->num_nodes)--;
-		num_dropped++;
-	}
-}
-
-/* Internal function for adding a cache entry. */
-/* Queue the new node to the tail of the ring */
-void add_cache_entry(PATH_CACHE *cacheptr, PATH_LOOKUP *newnode)
-{
-	int32_t hashindex;
-
-	if (cacheptr->num_nodes >= MAX_LOOKUP_NODES)
-		drop_cache_entry(cacheptr);
-
-	hashindex = (newnode->child) % NUM_LOOKUP_ENTRY;
-
-	/* Change the ring structure */
-	if ((cacheptr->hashtable[hashindex]).last != NULL)
-		((cacheptr->hashtable[hashindex]).last)->next = newnode;
-	else
-		(cacheptr->hashtable[hashindex]).first = newnode;
-	newnode->prev = (cacheptr->hashtable[hashindex]).last;
-	newnode->next = NULL;
-	(cacheptr->hashtable[hashindex]).last = newnode;
-
-	/* Change the global linked list */
-	if (cacheptr->gfirst != NULL)
-		(cacheptr->gfirst)->gprev = newnode;
-	newnode->gnext = cacheptr->gfirst;
-	newnode->gprev = NULL;
-	cacheptr->gfirst = newnode;
-	(cacheptr->num_nodes)++;
-}
-
-/* Helper function for repositioning the node according to usage */
-void _node_reposition(PATH_LOOKUP *tmpptr, int32_t hashindex, PATH_CACHE *cacheptr)
-{
-	PATH_LOOKUP *tmpprev, *tmpgnext;
-	while (tmpptr->prev != NULL) {
-		if ((tmpptr->lookupcount) > ((tmpptr->prev)->lookupcount)) {
-			/* Exchange tmpptr with tmpptr->prev */
-			tmpprev = tmpptr->prev;
-			if (tmpptr->next == NULL)
-				(cacheptr->hashtable[hashindex]).last = tmpprev;
-			else
-				(tmpptr->next)->prev = tmpprev;
-			if (tmpprev->prev == NULL)
-				(cacheptr->hashtable[hashindex]).first = tmpptr;
-			else
-				(tmpprev->prev)->next = tmpptr;
-			tmpptr->prev = tmpprev->prev;
-			tmpprev->next = tmpptr->next;
-			tmpptr->next = tmpprev;
-			tmpprev->prev = tmpptr;
-		} else {
-			break;
-		}
-	}
-
-	while (tmpptr->gnext != NULL) {
-		if ((tmpptr->lookupcount) > ((tmpptr->gnext)->lookupcount)) {
-			/* Exchange tmpptr with tmpptr->gnext */
-			tmpgnext = tmpptr->gnext;
-			if (tmpptr->gprev == NULL)
-				cacheptr->gfirst = tmpgnext;
-			else
-				(tmpptr->gprev)->gnext = tmpgnext;
-			if (tmpgnext->gnext != NULL)
-				(tmpgnext->gnext)->gprev = tmpptr;
-			tmpptr->gnext = tmpgnext->gnext;
-			tmpgnext->gprev = tmpptr->gprev;
-			tmpptr->gprev = tmpgnext;
-			tmpgnext->gnext = tmpptr;
-		} else {
-			break;
-		}
-	}
-}
-
 int32_t search_inode(ino_t parent, ino_t child, DIR_ENTRY *dentry)
 {
 	META_CACHE_ENTRY_STRUCT *cache_entry;
@@ -279,189 +604,130 @@ errcode_handle:
 	return errcode;
 }
 
-/************************************************************************
-*
-* Function name: lookup_name
-*        Inputs: PATH_CACHE *cacheptr, ino_t thisinode, PATH_LOOKUP *retnode
-*       Summary: Lookup the path cache entry for thisinode. If cannot be
-*                found, use pathlookup_read_parent to find the parent inode,
-*                then read dir file to find the name of thisinode. The result
-*                is constructed into a new node and added to the cache.
-*  Return value: 0 if successful. Otherwise returns negation of error code.
-*
-*************************************************************************/
-int32_t lookup_name(PATH_CACHE *cacheptr, ino_t thisinode, PATH_LOOKUP *retnode)
+/* Helper for finding the parent and the name of an inode from the
+parent lookup and the dir entries of the parent */
+static int32_t _lookup_parent_name(ino_t thisinode, ino_t *parentptr,
+				   DIR_ENTRY *dentry)
 {
 	int32_t ret, errcode;
-	int32_t hashindex;
-	PATH_LOOKUP *tmpptr;
 	ino_t parentinode, *parentlist;
 	int32_t numparents;
-	DIR_ENTRY tmpentry;
 
-	hashindex = thisinode % NUM_LOOKUP_ENTRY;
-
-	tmpptr = (cacheptr->hashtable[hashindex]).first;
+	ret = sem_wait(&(pathlookup_data_lock));
+	if (ret < 0) {
+		errcode = errno;
+		write_log(0, "Unexpected error: %d (%s)\n", errcode,
+			  strerror(errcode));
+		errcode = -errcode;
+		return errcode;
+	}
 
-	while (tmpptr != NULL) {
-		if (thisinode == tmpptr->child) {
-			/* We found the node. Update the lookup count
-			and the position if needed, and return the result */
-			memcpy(retnode, tmpptr, sizeof(PATH_LOOKUP));
-			(tmpptr->lookupcount)++;
-			_node_reposition(tmpptr, hashindex, cacheptr);
-			return 0;
-		}
-		tmpptr = tmpptr->next;
-	}
-        ret = sem_wait(&(pathlookup_data_lock));
-        if (ret < 0) {
-                errcode = errno;
-                write_log(0, "Unexpected error: %d (%s)\n", errcode,
-                          strerror(errcode));
-                errcode = -errcode;
-                return errcode;
-        }
-
-	/* Did not find the node. Proceed to lookup and then add to cache */
-
-        parentlist = NULL;
-        ret = fetch_all_parents(thisinode, &numparents, &parentlist);
-        if (ret < 0) {
-                errcode = ret;
-                goto errcode_handle;
-        }
+	parentlist = NULL;
+	ret = fetch_all_parents(thisinode, &numparents, &parentlist);
+	sem_post(&(pathlookup_data_lock));
+	if (ret < 0)
+		return ret;
 
 	/* If there is no parent, return error */
 	if (numparents <= 0) {
-		errcode = -ENOENT;
+		free(parentlist);
 		write_log(10, "Cannot find parent in lookup\n");
-		goto errcode_handle;
+		return -ENOENT;
 	}
 
 	parentinode = parentlist[0];
 	free(parentlist);
-	parentlist = NULL;
-	sem_post(&(pathlookup_data_lock));
 
 	write_log(10, "Debug parent lookup %" PRIu64 " %" PRIu64 "\n",
 	          (uint64_t) thisinode, (uint64_t) parentinode);
-	ret = search_inode(parentinode, thisinode, &tmpentry);
-	if (ret < 0) {
-		errcode = ret;
-		goto errcode_handle;
-	}
-
-	tmpptr = malloc(sizeof(PATH_LOOKUP));
-	if (tmpptr == NULL) {
-		errcode = -ENOMEM;
-		write_log(0, "Out of memory\n");
-		goto errcode_handle;
-	}
-	memset(tmpptr, 0, sizeof(PATH_LOOKUP));
-	write_log(10, "Sizeof path_lookup %d\n", sizeof(PATH_LOOKUP));
-	tmpptr->self = tmpptr;
-	tmpptr->child = thisinode;
-	tmpptr->parent = parentinode;
-	snprintf((tmpptr->childname), MAX_FILENAME_LEN+1, "%s",
-		tmpentry.d_name);
-	tmpptr->lookupcount = 1;
-
-	/* Add new node to cache */
-	add_cache_entry(cacheptr, tmpptr);
-	memcpy(retnode, tmpptr, sizeof(PATH_LOOKUP));
+	ret = search_inode(parentinode, thisinode, dentry);
+	if (ret < 0)
+		return ret;
+	*parentptr = parentinode;
 	return 0;
-errcode_handle:
-	sem_post(&(pathlookup_data_lock));
-	if (parentlist != NULL)
-		free(parentlist);
-	return errcode;
 }
 
-
-/************************************************************************
-*
-* Function name: construct_path_iterate
-*        Inputs: PATH_CACHE *cacheptr, ino_t thisinode, char **result,
-*                int32_t bufsize
-*       Summary: Recursively prepend the name of thisinode to the
-*                pathname pointed by *result. bufsize indicates the
-*                buffer size storing the pathname.
-*  Return value: 0 if successful. Otherwise returns negation of error code.
-*
-*************************************************************************/
-int32_t construct_path_iterate(PATH_CACHE *cacheptr, ino_t thisinode, char **result,
-		int32_t bufsize)
+/* Helper for finding the node of thisinode with a valid name and
+parent, looking up the inode and its uncached ancestors if needed */
+static int32_t _resolve_node(PATH_CACHE *cacheptr, ino_t thisinode,
+			     PATH_LOOKUP **nodeptr)
 {
-	char *current_path = NULL, *tmpptr;
-	PATH_LOOKUP cachenode;
-	ino_t parent_inode;
-	int32_t ret, pathlen, errcode;
+	PATH_LOOKUP *node, *parent_node;
+	ino_t parentinode;
+	DIR_ENTRY tmpentry;
+	int32_t ret;
 
-	write_log(10, "Debug path iterate %" PRIu64 "\n",
-		  (uint64_t) thisinode);
+	node = _find_node(cacheptr, thisinode);
+	if ((node != NULL) && (node->valid == TRUE)) {
+		*nodeptr = node;
+		return 0;
+	}
 
-	memset(&cachenode, 0, sizeof(PATH_LOOKUP));
-	ret = lookup_name(cacheptr, thisinode, &cachenode);
+	ret = _lookup_parent_name(thisinode, &parentinode, &tmpentry);
+	if (ret < 0)
+		return ret;
 
-	if (ret < 0) {
-		errcode = ret;
-		goto errcode_handle;
+	parent_node = NULL;
+	if (parentinode != cacheptr->root_inode) {
+		ret = _resolve_node(cacheptr, parentinode, &parent_node);
+		if (ret < 0)
+			return ret;
 	}
 
-	parent_inode = cachenode.parent;
-	current_path = calloc(bufsize + strlen(cachenode.childname) + 1,
-				sizeof(char));
-	if (current_path == NULL) {
-		errcode = -ENOMEM;
-		write_log(0, "Out of memory\n");
-		goto errcode_handle;
+	if (node == NULL) {
+		node = _new_node(cacheptr, thisinode);
+		if (node == NULL)
+			return -ENOMEM;
 	}
-	pathlen = bufsize + strlen(cachenode.childname) + 1;
+	ret = _set_node(cacheptr, node, parentinode, parent_node,
+			tmpentry.d_name);
+	if (ret < 0)
+		return ret;
+	*nodeptr = node;
+	return 0;
+}
 
-	if (pathlen > PATH_MAX) {
-		errcode = -ENAMETOOLONG;
-		write_log(0, "Unexpected error %d\n", ENAMETOOLONG);
-		free(current_path);
-		goto errcode_handle;
-	}
+/* Helper for joining the names from the root down to "node". Ancestors
+invalidated since being cached are looked up again. */
+static int32_t _build_path(PATH_CACHE *cacheptr, PATH_LOOKUP *node,
+			   char **result)
+{
+	PATH_LOOKUP *tmpnode;
+	char *pathbuf;
+	int64_t pathlen, pos;
+	int32_t ret;
 
-	if ((*result)[0] == '\0')
-		snprintf(current_path, pathlen, "%s", cachenode.childname);
-	else
-		snprintf(current_path, pathlen, "%s/%s",
-			cachenode.childname, *result);
-
-	if (parent_inode == cacheptr->root_inode) {
-		tmpptr = *result;
-		*result = current_path;
-		if (tmpptr != NULL)
-			free(tmpptr);
-		current_path = calloc(pathlen + 1, sizeof(char));
-		if (current_path == NULL) {
-			errcode = -ENOMEM;
-			write_log(0, "Out of memory\n");
-			goto errcode_handle;
+	pathlen = 0;
+	for (tmpnode = node; tmpnode != NULL;
+	     tmpnode = tmpnode->parent_node) {
+		if (tmpnode->valid == FALSE) {
+			ret = _resolve_node(cacheptr, tmpnode->child, &tmpnode);
+			if (ret < 0)
+				return ret;
+		}
+		pathlen += tmpnode->name->len + 1;
+		if (pathlen >= PATH_MAX) {
+			write_log(0, "Unexpected error %d\n", ENAMETOOLONG);
+			return -ENAMETOOLONG;
 		}
-		pathlen = pathlen + 1;
-		snprintf(current_path, pathlen, "/%s", *result);
-		tmpptr = *result;
-		*result = current_path;
-		free(tmpptr);
-		return 0;
-	}
-	tmpptr = *result;
-	*result = current_path;
-	if (tmpptr != NULL)
-		free(tmpptr);
-	return construct_path_iterate(cacheptr, parent_inode, result, pathlen);
-errcode_handle:
-	tmpptr = *result;
-	if (tmpptr != NULL) {
-		*result = NULL;
-		free(tmpptr);
 	}
-	return errcode;
+
+	pathbuf = malloc(pathlen + 1);
+	if (pathbuf == NULL) {
+		write_log(0, "Out of memory\n");
+		return -ENOMEM;
+	}
+	pos = pathlen;
+	pathbuf[pos] = '\0';
+	for (tmpnode = node; tmpnode != NULL;
+	     tmpnode = tmpnode->parent_node) {
+		pos -= tmpnode->name->len;
+		memcpy(pathbuf + pos, tmpnode->name->name, tmpnode->name->len);
+		pos--;
+		pathbuf[pos] = '/';
+	}
+	*result = pathbuf;
+	return 0;
 }
 
 /************************************************************************
@@ -479,10 +745,10 @@ int32_t construct_path(PATH_CACHE *cacheptr, ino_t thisinode, char **result,
                    ino_t rootinode)
 {
 	int32_t ret, errcode;
-	char *tmpbuf;
 	char pathname[200];
 	FILE *fptr;
 	int64_t ret_pos;
+	PATH_LOOKUP *node;
 
 	ret = sem_wait(&(cacheptr->pathcache_lock));
 	if (ret < 0) {
@@ -492,19 +758,28 @@ int32_t construct_path(PATH_CACHE *cacheptr, ino_t thisinode, char **result,
 		errcode = -errcode;
 		return errcode;
 	}
-	tmpbuf = calloc(10, sizeof(char));
-	if (tmpbuf == NULL) {
-		errcode = -ENOMEM;
-		write_log(0, "Out of Memory\n");
-		goto errcode_handle;
-	}
 
-	tmpbuf[0] = '\0';
-	*result = tmpbuf;
+	*result = NULL;
 	if (thisinode == cacheptr->root_inode) {
-		snprintf(*result, 10, "/");
+		*result = strdup("/");
+		if (*result == NULL) {
+			errcode = -ENOMEM;
+			write_log(0, "Out of Memory\n");
+			goto errcode_handle;
+		}
 	} else {
-		ret = construct_path_iterate(cacheptr, thisinode, result, 10);
+		write_log(10, "Debug path lookup %" PRIu64 "\n",
+			  (uint64_t) thisinode);
+		ret = _resolve_node(cacheptr, thisinode, &node);
+		if (ret == 0) {
+			/* Keep recently used leaves in the cache */
+			if (node->num_children == 0) {
+				_lru_remove(cacheptr, node);
+				_lru_push_front(cacheptr, node);
+			}
+			ret = _build_path(cacheptr, node, result);
+		}
+		_shrink_pathcache(cacheptr);
 		if ((ret < 0) && (ret != -ENOENT)) {
 			errcode = ret;
 			goto errcode_handle;
@@ -526,8 +801,6 @@ int32_t construct_path(PATH_CACHE *cacheptr, ino_t thisinode, char **result,
 				fclose(fptr);
 				goto errcode_handle;
 			}
-			free(*result);
-			*result = NULL;
 			*result = (char *) malloc(((size_t) ret_pos) + 10);
 			if (*result == NULL) {
 				errcode = -ENOMEM;
@@ -554,13 +827,14 @@ errcode_handle:
 * Function name: delete_pathcache_node
 *        Inputs: PATH_CACHE *cacheptr, ino_t todelete
 *       Summary: Delete inode "todelete" from cache if found in cache.
+*                If other cached nodes are under "todelete", the node is
+*                only marked to be looked up again.
 *  Return value: 0 if successful. Otherwise returns negation of error code.
 *
 *************************************************************************/
 int32_t delete_pathcache_node(PATH_CACHE *cacheptr, ino_t todelete)
 {
 	int32_t ret, errcode;
-	int32_t hashindex;
 	PATH_LOOKUP *tmpptr;
 
 	ret = sem_wait(&(cacheptr->pathcache_lock));
@@ -572,45 +846,43 @@ int32_t delete_pathcache_node(PATH_CACHE *cacheptr, ino_t todelete)
 		return errcode;
 	}
 
-	hashindex = todelete % NUM_LOOKUP_ENTRY;
-
-	tmpptr = (cacheptr->hashtable[hashindex]).first;
-
-	while (tmpptr != NULL) {
-		if (todelete == tmpptr->child) {
-			/* We found the node. Delete it */
-			if (tmpptr->next != NULL)
-				(tmpptr->next)->prev = tmpptr->prev;
-			else
-				(cacheptr->hashtable[hashindex]).last =
-						tmpptr->prev;
-			if (tmpptr->prev != NULL)
-				(tmpptr->prev)->next = tmpptr->next;
-			else
-				(cacheptr->hashtable[hashindex]).first =
-						tmpptr->next;
-
-			if (tmpptr->gnext != NULL)
-				(tmpptr->gnext)->gprev = tmpptr->gprev;
-			if (tmpptr->gprev != NULL)
-				(tmpptr->gprev)->gnext = tmpptr->gnext;
-			else
-				cacheptr->gfirst = tmpptr->gnext;
-
-			memset(tmpptr, 0, sizeof(PATH_LOOKUP));
-			free(tmpptr);
-			(cacheptr->num_nodes)--;
-			sem_post(&(cacheptr->pathcache_lock));
-			return 0;
-		}
-		tmpptr = tmpptr->next;
+	/* If the node is not cached, just return without an error */
+	tmpptr = _find_node(cacheptr, todelete);
+	if (tmpptr != NULL) {
+		if (tmpptr->num_children == 0)
+			_remove_node(cacheptr, tmpptr);
+		else
+			tmpptr->valid = FALSE;
 	}
-	/* Did not find the node. Just return without an error.*/
 
 	sem_post(&(cacheptr->pathcache_lock));
 	return 0;
 }
 
+/************************************************************************
+*
+* Function name: delete_pathcache_snapshot
+*        Inputs: ino_t root_inode
+*       Summary: Remove the path cache snapshot of the volume with root
+*                "root_inode", for use when the volume is deleted.
+*  Return value: 0 if successful. Otherwise returns negation of error code.
+*
+*************************************************************************/
+int32_t delete_pathcache_snapshot(ino_t root_inode)
+{
+	char pathname[METAPATHLEN + 64];
+	int32_t errcode;
+
+	_snapshot_path(pathname, sizeof(pathname), root_inode);
+	if ((unlink(pathname) < 0) && (errno != ENOENT)) {
+		errcode = errno;
+		write_log(0, "Unable to remove %s. Code %d, %s\n", pathname,
+			  errcode, strerror(errcode));
+		return -errcode;
+	}
+	return 0;
+}
+
 /************************************************************************
 *
 * Function name: init_pathlookup
@@ -622,8 +894,6 @@ int32_t delete_pathcache_node(PATH_CACHE *cacheptr, ino_t todelete)
 int32_t init_pathlookup()
 {
 	int32_t ret, errcode;
-	char pathname[METAPATHLEN+10];
-	BOOL need_init;
 
 	ret = sem_init(&(pathlookup_data_lock), 0, 1);
 	if (ret < 0) {
@@ -634,46 +904,11 @@ int32_t init_pathlookup()
 		goto errcode_handle;
 	}
 
-	snprintf(pathname, METAPATHLEN, "%s/pathlookup_db", METAPATH);
-	if (access(pathname, F_OK) != 0) {
-		MKNOD(pathname, S_IFREG | 0600, 0);
-	}
-
-	pathlookup_data_fptr = fopen(pathname, "r+");
-	if (pathlookup_data_fptr == NULL) {
-		errcode = errno;
-		write_log(0, "Unexpected error in init: %d (%s)\n", errcode,
-			strerror(errcode));
-		errcode = -errcode;
-		goto errcode_handle;
-	}
-	setbuf(pathlookup_data_fptr, NULL);
-
-	need_init = FALSE;
-	snprintf(pathname, METAPATHLEN, "%s/parentlookup2_db", METAPATH);
-	if (access(pathname, F_OK) != 0) {
-		MKNOD(pathname, S_IFREG | 0600, 0);
-		need_init = TRUE;
-	}
-	plookup2_fptr = fopen(pathname, "r+");
-	if (plookup2_fptr == NULL) {
-		errcode = errno;
-		write_log(0, "Unexpected error in init: %d (%s)\n", errcode,
-			strerror(errcode));
-		errcode = -errcode;
+	ret = init_parent_lookup();
+	if (ret < 0) {
+		errcode = ret;
 		goto errcode_handle;
 	}
-	setbuf(plookup2_fptr, NULL);
-	if (need_init == TRUE) {
-		/* Init the parent lookup secondary db if just created */
-		memset(&parent_lookup_head, 0, sizeof(PLOOKUP_HEAD_T));
-		PWRITE(fileno(plookup2_fptr), &parent_lookup_head,
-		       sizeof(PLOOKUP_HEAD_T), 0);
-	} else {
-		/* Otherwise read from database */
-		PREAD(fileno(plookup2_fptr), &parent_lookup_head,
-		       sizeof(PLOOKUP_HEAD_T), 0);
-	}
 
 	return 0;
 errcode_handle:
@@ -690,8 +925,7 @@ errcode_handle:
 *************************************************************************/
 void destroy_pathlookup()
 {
-	fclose(pathlookup_data_fptr);
-	fclose(plookup2_fptr);
+	destroy_parent_lookup();
 	sem_destroy(&(pathlookup_data_lock));
 	return;
 }
@@ -700,15 +934,13 @@ void destroy_pathlookup()
 *
 * Function name: pathlookup_write_parent
 *        Inputs: ino_t self_inode, ino_t parent_inode
-*       Summary: Writes the parent inode to a file in metastorage, and reset
-*                haveothers to FALSE.
+*       Summary: Sets the parent inode as the only parent in the parent
+*                lookup.
 *  Return value: 0 if successful. Otherwise returns negation of error code.
 *
 *************************************************************************/
 int32_t pathlookup_write_parent(ino_t self_inode, ino_t parent_inode)
 {
-	off_t filepos;
-	PRIMARY_PARENT_T tmpparent;
 	int32_t ret;
 	int32_t errcode;
 
@@ -721,32 +953,23 @@ int32_t pathlookup_write_parent(ino_t self_inode, ino_t parent_inode)
 		return errcode;
 	}
 
-	filepos = (off_t) ((self_inode - 1) * sizeof(PRIMARY_PARENT_T));
-	tmpparent.parentinode = parent_inode;
-	tmpparent.haveothers = FALSE;
-	PWRITE(fileno(pathlookup_data_fptr), &tmpparent,
-	       sizeof(PRIMARY_PARENT_T), filepos);
+	ret = lookup_reset_parent(self_inode, parent_inode);
 
 	sem_post(&(pathlookup_data_lock));
-	return 0;
-errcode_handle:
-	sem_post(&(pathlookup_data_lock));
-	return errcode;
+	return ret;
 }
 
 /************************************************************************
 *
 * Function name: pathlookup_read_parent
 *        Inputs: ino_t self_inode, ino_t *parentptr
-*       Summary: Reads the parent inode from a file in metastorage and store
-*                in the ino_t structure pointed by parentptr
+*       Summary: Reads the first parent inode from the parent lookup and
+*                store in the ino_t structure pointed by parentptr
 *  Return value: 0 if successful. Otherwise returns negation of error code.
 *
 *************************************************************************/
 int32_t pathlookup_read_parent(ino_t self_inode, ino_t *parentptr)
 {
-	off_t filepos;
-	PRIMARY_PARENT_T tmpparent;
 	int32_t ret;
 	int32_t errcode;
 
@@ -759,15 +982,7 @@ int32_t pathlookup_read_parent(ino_t self_inode, ino_t *parentptr)
 		return errcode;
 	}
 
-	filepos = (off_t) ((self_inode - 1) * sizeof(PRIMARY_PARENT_T));
-	memset(&tmpparent, 0, sizeof(PRIMARY_PARENT_T));
-	PREAD(fileno(pathlookup_data_fptr), &tmpparent,
-	       sizeof(PRIMARY_PARENT_T), filepos);
-	*parentptr = tmpparent.parentinode;
-	sem_post(&(pathlookup_data_lock));
-	return 0;
-errcode_handle:
+	ret = lookup_first_parent(self_inode, parentptr);
 	sem_post(&(pathlookup_data_lock));
-	return errcode;
+	return ret;
 }
-
@@ -22,56 +22,90 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <semaphore.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 #include "params.h"
+#include "global.h"
 
-#define MAX_LOOKUP_NODES 4096
-#define NUM_LOOKUP_ENTRY 4096
-#define NUM_NODES_DROP 128
+/* The hash tables of a path cache are sized from its memory budget,
+assuming this many bytes per cached node (node plus interned name) */
+#define PATH_CACHE_BYTES_PER_NODE 128
+#define MIN_PATH_CACHE_BUCKETS 1024
 
+#define PATH_CACHE_SNAPSHOT_MAGIC "PCSN"
+#define PATH_CACHE_SNAPSHOT_VERSION 1
+
+/* Names are interned, so that nodes having the same name share one copy */
+struct path_name {
+	struct path_name *next;
+	int32_t refcount;
+	uint32_t hashval;
+	int32_t len;
+	char name[];
+};
+typedef struct path_name PATH_NAME;
+
+/* A node links to the node of its parent, so cached paths share the
+nodes of their common ancestors. Nodes with no cached children (leaves)
+are kept in a LRU list and are the only ones dropped. */
 struct path_lookup {
 	ino_t child;
 	ino_t parent;
-	char childname[MAX_FILENAME_LEN+1];
-	int64_t lookupcount;
-	struct path_lookup *prev;
+	PATH_NAME *name;
+	/* NULL if the parent is the root */
+	struct path_lookup *parent_node;
+	int32_t num_children;
+	/* FALSE if the name and parent need to be looked up again */
+	BOOL valid;
 	struct path_lookup *next;
-	struct path_lookup *gprev;
-	struct path_lookup *gnext;
-	struct path_lookup *self;
+	struct path_lookup *lru_prev;
+	struct path_lookup *lru_next;
 };
 typedef struct path_lookup PATH_LOOKUP;
 
-typedef struct {
-	PATH_LOOKUP *first;
-	PATH_LOOKUP *last;
-} PATH_HEAD_ENTRY;
-
 /* There could be multiple such hash table, one for each mounted volume */
 typedef struct {
-	PATH_HEAD_ENTRY hashtable[NUM_LOOKUP_ENTRY];
-	PATH_LOOKUP *gfirst;
-	int32_t num_nodes;
+	PATH_LOOKUP **hashtable;
+	PATH_NAME **name_table;
+	int64_t num_buckets;
+	/* Leaves, most recently used first */
+	PATH_LOOKUP *lru_first;
+	PATH_LOOKUP *lru_last;
+	int64_t num_nodes;
+	int64_t mem_used;
+	int64_t mem_limit;
 	sem_t pathcache_lock;
 	ino_t root_inode;
 } PATH_CACHE;
 
+/* Snapshot of a path cache, saved when the cache is destroyed and
+loaded into the cache of the next mount. Each node is followed by
+name_len bytes of its name, and parents come before their children. */
+typedef struct {
+	char magic[4];
+	int32_t version;
+	ino_t root_inode;
+	int64_t num_nodes;
+} PATH_CACHE_SNAPSHOT_HEAD;
+
+typedef struct {
+	ino_t child;
+	ino_t parent;
+	int32_t name_len;
+} PATH_CACHE_SNAPSHOT_NODE;
+
 sem_t pathlookup_data_lock;
-FILE *pathlookup_data_fptr;
 
 /* API for calling from outside */
 PATH_CACHE * init_pathcache(ino_t root_inode);
 int32_t destroy_pathcache(PATH_CACHE *cacheptr);
 
-int32_t lookup_name(PATH_CACHE *cacheptr, ino_t thisinode, PATH_LOOKUP *retnode);
-int32_t construct_path_iterate(PATH_CACHE *cacheptr, ino_t thisinode, char **result,
-		int32_t bufsize);
-
 int32_t construct_path(PATH_CACHE *cacheptr, ino_t thisinode, char **result,
                    ino_t rootinode);
 
 int32_t delete_pathcache_node(PATH_CACHE *cacheptr, ino_t todelete);
+int32_t delete_pathcache_snapshot(ino_t root_inode);
 
 int32_t init_pathlookup(void);
 void destroy_pathlookup(void);
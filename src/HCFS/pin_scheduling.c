@@ -238,7 +238,7 @@ void pinning_loop()
 		}
 
 		/* Check inodes in queue */
-		if (sys_super_block->head.num_pinning_inodes == 0) {
+		if (SB_HEAD_COUNTER(num_pinning_inodes) == 0) {
 			write_log(10, "Debug: pinning manager takes a break\n");
 			sem_wait(&(hcfs_system->pin_wait_sem));
 			continue;
@@ -254,15 +254,15 @@ void pinning_loop()
 
 		if (start_from_head == TRUE) {
 			/* Sleep 1 sec if inodes are now being handled */
-			super_block_share_locking();
+			super_block_list_locking(SB_LL_PIN);
 			if (sys_super_block->head.num_pinning_inodes <=
 				pinning_scheduler.total_active_pinning) {
-				super_block_share_release();
+				super_block_list_release(SB_LL_PIN);
 				sem_wait(&(hcfs_system->pin_wait_sem));
 				continue;
 			}
 			now_inode = sys_super_block->head.first_pin_inode;
-			super_block_share_release();
+			super_block_list_release(SB_LL_PIN);
 			start_from_head = FALSE;
 		}
 
@@ -285,7 +285,10 @@ void pinning_loop()
 				}
 			}
 			sem_post(&(pinning_scheduler.ctl_op_sem));
+			/* Pin links are consistent under list lock */
+			super_block_list_locking(SB_LL_PIN);
 			ret = super_block_read(now_inode, &sb_entry);
+			super_block_list_release(SB_LL_PIN);
 			if (ret < 0) {
 				write_log(0, "Error: Fail to read sb "
 /* FEATURE TODO: double check that super block entry will be rebuilt
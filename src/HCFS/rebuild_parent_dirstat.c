@@ -36,8 +36,8 @@ static inline int32_t _update_stats(ino_t p_inode, DIR_STATS_TYPE *tmpstat_in)
 {
 	off_t filepos;
 	ino_t current_inode;
-	PRIMARY_PARENT_T tmpparent;
 	DIR_STATS_TYPE tmpstat;
+	int32_t ret;
 
 	current_inode = p_inode;
 	while (current_inode > 0) {
@@ -53,12 +53,37 @@ static inline int32_t _update_stats(ino_t p_inode, DIR_STATS_TYPE *tmpstat_in)
 		PWRITE(fileno(dirstat_lookup_data_fptr), &tmpstat,
 		       sizeof(DIR_STATS_TYPE), filepos);
 		/* Find the parent */
-		memset(&tmpparent, 0, sizeof(PRIMARY_PARENT_T));
-		filepos = (off_t) ((current_inode - 1) *
-					sizeof(PRIMARY_PARENT_T));
-		PREAD(fileno(pathlookup_data_fptr), &tmpparent,
-		      sizeof(PRIMARY_PARENT_T), filepos);
-		current_inode = tmpparent.parentinode;
+		ret = lookup_first_parent(current_inode, &current_inode);
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+errcode_handle:
+	return errcode;
+}
+
+/* Helper for translating info of blocks in a locked file meta to the
+location of the file */
+static int32_t _read_file_location(FILE *metafptr, DIR_STATS_TYPE *tmp_dirstat)
+{
+	FILE_STATS_TYPE meta_stats;
+
+	FSEEK(metafptr, sizeof(HCFS_STAT) + sizeof(FILE_META_TYPE),
+	      SEEK_SET);
+	FREAD(&meta_stats, sizeof(FILE_STATS_TYPE), 1, metafptr);
+	memset(tmp_dirstat, 0, sizeof(DIR_STATS_TYPE));
+	write_log(10, "Local blocks: %" PRId64 ", %" PRId64 "\n",
+	          meta_stats.num_blocks, meta_stats.num_cached_blocks);
+	if ((meta_stats.num_blocks == 0) ||
+	    	(meta_stats.num_blocks ==
+	         meta_stats.num_cached_blocks)) {
+		/* If local */
+		tmp_dirstat->num_local = 1;
+	} else if (meta_stats.num_cached_blocks == 0) {
+		/* If cloud */
+		tmp_dirstat->num_cloud = 1;
+	} else {
+		tmp_dirstat->num_hybrid = 1;
 	}
 	return 0;
 errcode_handle:
@@ -85,7 +110,6 @@ int32_t rebuild_parent_stat(ino_t this_inode, ino_t p_inode, int8_t d_type)
 	off_t filepos;
 	char metapath[METAPATHLEN];
 	FILE *metafptr;
-	FILE_STATS_TYPE meta_stats;
 	DIR_STATS_TYPE tmp_dirstat;
 
 	metafptr = NULL;
@@ -168,23 +192,10 @@ int32_t rebuild_parent_stat(ino_t this_inode, ino_t p_inode, int8_t d_type)
 			errcode = -errcode;
 			goto errcode_handle;
 		}
-		/* Translate info of blocks to file location */
-		FSEEK(metafptr, sizeof(HCFS_STAT) + sizeof(FILE_META_TYPE),
-		      SEEK_SET);
-		FREAD(&meta_stats, sizeof(FILE_STATS_TYPE), 1, metafptr);
-		memset(&tmp_dirstat, 0, sizeof(DIR_STATS_TYPE));
-		write_log(10, "Local blocks: %" PRId64 ", %" PRId64 "\n",
-		          meta_stats.num_blocks, meta_stats.num_cached_blocks);
-		if ((meta_stats.num_blocks == 0) ||
-		    	(meta_stats.num_blocks ==
-		         meta_stats.num_cached_blocks)) {
-			/* If local */
-			tmp_dirstat.num_local = 1;
-		} else if (meta_stats.num_cached_blocks == 0) {
-			/* If cloud */
-			tmp_dirstat.num_cloud = 1;
-		} else {
-			tmp_dirstat.num_hybrid = 1;
+		ret = _read_file_location(metafptr, &tmp_dirstat);
+		if (ret < 0) {
+			errcode = ret;
+			goto errcode_handle;
 		}
 		flock(fileno(metafptr), LOCK_UN);
 		fclose(metafptr);
@@ -212,3 +223,102 @@ errcode_handle:
 	sem_post(&(pathlookup_data_lock));
 	return errcode;
 }
+
+/* Helper for adding the location of a regular file "this_inode" to the
+statistics of all its parents. Inodes without local meta are skipped.
+pathlookup_data_lock should be locked before calling. */
+static int32_t _recount_file(ino_t this_inode)
+{
+	char metapath[METAPATHLEN];
+	FILE *metafptr;
+	HCFS_STAT this_stat;
+	DIR_STATS_TYPE tmp_dirstat;
+	ino_t *parent_list;
+	int32_t num_parents, count;
+	int32_t ret, errcode;
+
+	ret = fetch_meta_path(metapath, this_inode);
+	if (ret < 0)
+		return ret;
+	metafptr = fopen(metapath, "r");
+	if (metafptr == NULL)
+		return 0;
+	flock(fileno(metafptr), LOCK_EX);
+	FSEEK(metafptr, 0, SEEK_SET);
+	FREAD(&this_stat, sizeof(HCFS_STAT), 1, metafptr);
+	if (!S_ISREG(this_stat.mode)) {
+		flock(fileno(metafptr), LOCK_UN);
+		fclose(metafptr);
+		return 0;
+	}
+	ret = _read_file_location(metafptr, &tmp_dirstat);
+	flock(fileno(metafptr), LOCK_UN);
+	fclose(metafptr);
+	metafptr = NULL;
+	if (ret < 0)
+		return ret;
+
+	parent_list = NULL;
+	num_parents = 0;
+	ret = fetch_all_parents(this_inode, &num_parents, &parent_list);
+	if (ret < 0)
+		return ret;
+	for (count = 0; count < num_parents; count++) {
+		ret = update_dirstat_parent(parent_list[count], &tmp_dirstat);
+		if (ret < 0)
+			break;
+	}
+	free(parent_list);
+	return ret;
+
+errcode_handle:
+	flock(fileno(metafptr), LOCK_UN);
+	fclose(metafptr);
+	return errcode;
+}
+
+/**********************************************************************//**
+*
+* Rebuilds the dir statistics db by counting again the location of every
+* regular file found in the parent lookup db. Used at startup if changes to
+* the statistics were not flushed before the system went down.
+*
+* @return 0 if successful. Otherwise returns negation of error code.
+*
+*************************************************************************/
+int32_t rebuild_dirstat_lookup(void)
+{
+	ino_t this_inode, max_inode;
+	int32_t ret, errcode;
+
+	sem_wait(&(pathlookup_data_lock));
+	ret = lookup_max_inode(&max_inode);
+	if (ret < 0) {
+		errcode = ret;
+		goto errcode_handle;
+	}
+
+	/* Statistics of all dirs start from zero */
+	if (ftruncate(fileno(dirstat_lookup_data_fptr), 0) < 0) {
+		errcode = -errno;
+		goto errcode_handle;
+	}
+
+	for (this_inode = 1; this_inode <= max_inode; this_inode++) {
+		ret = _recount_file(this_inode);
+		if (ret < 0)
+			write_log(0, "Unable to count inode %" PRIu64 ". (%d)\n",
+				  (uint64_t)this_inode, ret);
+	}
+
+	/* Each dir is updated once for all the files counted */
+	ret = flush_dirstat_delta();
+	sem_post(&(pathlookup_data_lock));
+	write_log(4, "Rebuilt dir statistics of %" PRIu64 " inodes\n",
+		  (uint64_t)max_inode);
+	return ret;
+
+errcode_handle:
+	sem_post(&(pathlookup_data_lock));
+	return errcode;
+}
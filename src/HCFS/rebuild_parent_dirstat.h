@@ -26,6 +26,7 @@
 #include <unistd.h>
 
 int32_t rebuild_parent_stat(ino_t this_inode, ino_t p_inode, int8_t d_type);
+int32_t rebuild_dirstat_lookup(void);
 
 #endif  /* GW20_HCFS_REBUILD_PARENT_DIRSTAT_H_ */
 
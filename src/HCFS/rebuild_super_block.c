@@ -920,15 +920,19 @@ int32_t rebuild_super_block_entry(ino_t this_inode,
 	sb_entry.pin_status = ST_UNPIN;
 	sb_entry.lastsync_time = get_current_sectime();
 
+	/* Entry is written as a whole, so no one else may update it */
+	super_block_update_lock_range(this_inode, 1);
 	super_block_exclusive_locking();
 	/* Check again */
 	ret = read_super_block_entry(this_inode, &tmp_sb_entry);
 	if (ret < 0) {
 		super_block_exclusive_release();
+		super_block_update_release_range(this_inode, 1);
 		return ret;
 	}
 	if (tmp_sb_entry.this_index > 0) {
 		super_block_exclusive_release();
+		super_block_update_release_range(this_inode, 1);
 		return 0;
 	}
 
@@ -939,6 +943,7 @@ int32_t rebuild_super_block_entry(ino_t this_inode,
 			ret = pin_ll_enqueue(this_inode, &sb_entry);
 			if (ret < 0) {
 				super_block_exclusive_release();
+				super_block_update_release_range(this_inode, 1);
 				return ret;
 			}
 			sb_entry.pin_status = ST_PINNING;
@@ -949,9 +954,11 @@ int32_t rebuild_super_block_entry(ino_t this_inode,
 	ret = write_super_block_entry(this_inode, &sb_entry);
 	if (ret < 0) {
 		super_block_exclusive_release();
+		super_block_update_release_range(this_inode, 1);
 		return ret;
 	}
 	super_block_exclusive_release();
+	super_block_update_release_range(this_inode, 1);
 	write_log(10, "Debug: Rebuilding sb entry %"PRIu64" has completed.\n",
 			(uint64_t)this_inode);
 	return 0;
@@ -1191,6 +1198,7 @@ int32_t restore_meta_super_block_entry(ino_t this_inode, HCFS_STAT *ret_stat)
 			write_log(4, "Warn: Begin to remove inode %"PRIu64
 				" from parent", (uint64_t)this_inode);
 			prune_this_entry(this_inode);
+			super_block_update_lock_range(this_inode, 1);
 			super_block_exclusive_locking();
 			read_super_block_entry(this_inode, &sb_entry);
 			if (sb_entry.status != TO_BE_RECLAIMED) {
@@ -1200,6 +1208,7 @@ int32_t restore_meta_super_block_entry(ino_t this_inode, HCFS_STAT *ret_stat)
 				write_super_block_entry(this_inode, &sb_entry);
 			}
 			super_block_exclusive_release();
+			super_block_update_release_range(this_inode, 1);
 		}
 		write_log(2, "Warn: Fail to restore meta%"PRIu64". Code %d",
 			(uint64_t)this_inode, -ret);
@@ -507,6 +507,8 @@ int32_t update_reconstruct_result(RECOVERY_ROUND_DATA round_data)
 		if (ret_code < 0) {                                            \
 			write_log(0, "%s %s", error_msg, errmsg);              \
 			super_block_exclusive_release();                       \
+			super_block_update_release_range(start_inode,          \
+							 num_entry_handle);    \
 			free(sb_entry_arr);                                    \
 			free(meta_cache_arr);                                  \
 			set_recovery_flag(FALSE, 0, 0);                        \
@@ -520,7 +522,7 @@ void *recover_sb_queue_worker(void *ptr __attribute__((unused)))
 	BOOL system_going_down = FALSE;
 	char error_msg[] = "SB queue recovery worker aborted.";
 	int32_t ret_code, count;
-	int64_t buf_size, num_entry_handle;
+	int64_t buf_size, num_entry_handle = 0;
 	ino_t start_inode, end_inode;
 	SUPER_BLOCK_ENTRY *sb_entry_arr = NULL;
 	META_CACHE_ENTRY_STRUCT **meta_cache_arr = NULL;
@@ -608,6 +610,9 @@ void *recover_sb_queue_worker(void *ptr __attribute__((unused)))
 			meta_cache_arr[count] = tmp_meta_cache_entry;
 		}
 
+		/* Entries are read and written back as a whole, so updates
+		 * of single entries must wait */
+		super_block_update_lock_range(start_inode, num_entry_handle);
 		super_block_exclusive_locking();
 
 		_CALL_N_CHECK_RETCODE(_batch_read_sb_entries(sb_entry_arr,
@@ -628,16 +633,20 @@ void *recover_sb_queue_worker(void *ptr __attribute__((unused)))
 		_CALL_N_CHECK_RETCODE(update_reconstruct_result(recover_round),
 				      "Error update reconstruct result.");
 
-		/* Prepare for next round */
-		start_inode += num_entry_handle;
-
-		_CALL_N_CHECK_RETCODE(update_recover_progress(start_inode, end_inode),
-				      "Error log recovery progress.");
+		_CALL_N_CHECK_RETCODE(
+		    update_recover_progress(start_inode + num_entry_handle,
+					    end_inode),
+		    "Error log recovery progress.");
 
-		set_recovery_flag(TRUE, start_inode, end_inode);
+		set_recovery_flag(TRUE, start_inode + num_entry_handle,
+				  end_inode);
 
 		/* Unlock for a while to avoid block other ops too much time */
 		super_block_exclusive_release();
+		super_block_update_release_range(start_inode, num_entry_handle);
+
+		/* Prepare for next round */
+		start_inode += num_entry_handle;
 
 		/* Unlock all locked meta_cache_entry */
 		for (count = 0; count < num_entry_handle; count++) {
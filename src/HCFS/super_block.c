@@ -20,6 +20,9 @@
 /* TODO: Consider to convert super inode to multiple files and use striping
 *	for efficiency*/
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include "super_block.h"
 
 #ifndef _ANDROID_ENV_
@@ -28,10 +31,12 @@
 #endif
 #include <sys/time.h>
 #include <sys/file.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
 #include <errno.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <inttypes.h>
 
@@ -52,6 +57,337 @@
 #define SB_ENTRY_SIZE ((int32_t)sizeof(SUPER_BLOCK_ENTRY))
 #define SB_HEAD_SIZE ((int32_t)sizeof(SUPER_BLOCK_HEAD))
 
+/* The super block file is mapped with MAP_SHARED, so that reading and
+updating the head and entries are memcpy instead of pread/pwrite. The
+mapping shares the page cache with pread/pwrite and with forked processes,
+so what reaches the disk, and when, is the same as before. Only the part
+of the file known to be allocated is accessed through the mapping, as a
+store to a hole could not report ENOSPC except by SIGBUS. If the file
+cannot be mapped, pread/pwrite are used as before, and so they are for the
+part beyond the allocated length once fallocate fails. */
+static SB_MAP sb_map = {.addr = NULL, .fd = -1};
+
+/* Length of a mapping covering "min_len" bytes of the super block file */
+static int64_t _sb_map_target_len(int64_t min_len)
+{
+	int64_t new_len;
+
+	new_len = min_len * SB_MAP_GROWTH;
+	if (new_len < SB_MAP_MIN_LEN)
+		new_len = SB_MAP_MIN_LEN;
+	if (new_len > SB_MAP_MAX_LEN)
+		new_len = SB_MAP_MAX_LEN;
+	/* Whole pages only */
+	return new_len & ~((int64_t)sysconf(_SC_PAGESIZE) - 1);
+}
+
+static void _sb_map_init(void)
+{
+	struct stat sbstat;
+	void *addr;
+	int64_t map_len;
+	int32_t errcode;
+
+	if (fstat(sys_super_block->iofptr, &sbstat) < 0) {
+		errcode = errno;
+		write_log(4, "Super block is not mapped. Code %d, %s\n",
+			  errcode, strerror(errcode));
+		return;
+	}
+	map_len = _sb_map_target_len(sbstat.st_size);
+	addr = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    sys_super_block->iofptr, 0);
+	if (addr == MAP_FAILED) {
+		errcode = errno;
+		write_log(4, "Super block is not mapped. Code %d, %s\n",
+			  errcode, strerror(errcode));
+		return;
+	}
+	sem_init(&(sb_map.map_sem), 0, 1);
+	sb_map.len = map_len;
+	sb_map.num_retired = 0;
+	sb_map.valid_len = 0;
+	sb_map.alloc_failed = FALSE;
+	sb_map.fd = sys_super_block->iofptr;
+	__atomic_store_n(&(sb_map.addr), (char *)addr, __ATOMIC_RELEASE);
+}
+
+static void _sb_map_destroy(void)
+{
+	int32_t count;
+
+	if (sb_map.addr == NULL)
+		return;
+	munmap(sb_map.addr, sb_map.len);
+	for (count = 0; count < sb_map.num_retired; count++)
+		munmap(sb_map.retired_addr[count], sb_map.retired_len[count]);
+	sb_map.addr = NULL;
+	sb_map.len = 0;
+	sb_map.num_retired = 0;
+	sb_map.fd = -1;
+	sb_map.valid_len = 0;
+	sb_map.alloc_failed = FALSE;
+	sem_destroy(&(sb_map.map_sem));
+}
+
+/* Grow the mapping to cover "end" bytes of the file. The old mapping is
+kept as is if it cannot be grown. Readers check the length before they
+use the address, so the address is published first. Caller must hold
+map_sem. */
+static void _sb_map_grow(int64_t end)
+{
+	void *addr;
+	int64_t new_len;
+
+	new_len = _sb_map_target_len(end);
+	if (new_len < end || new_len <= sb_map.len)
+		return;
+
+	/* Growing in place keeps the address readers are using */
+	addr = mremap(sb_map.addr, sb_map.len, new_len, 0);
+	if (addr != MAP_FAILED) {
+		__atomic_store_n(&(sb_map.len), new_len, __ATOMIC_RELEASE);
+		return;
+	}
+
+	if (sb_map.num_retired >= SB_MAP_MAX_RETIRED)
+		return;
+	addr = mmap(NULL, new_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    sb_map.fd, 0);
+	if (addr == MAP_FAILED) {
+		write_log(4, "Super block mapping is not grown. Code %d\n",
+			  errno);
+		return;
+	}
+	sb_map.retired_addr[sb_map.num_retired] = sb_map.addr;
+	sb_map.retired_len[sb_map.num_retired] = sb_map.len;
+	sb_map.num_retired++;
+	__atomic_store_n(&(sb_map.addr), (char *)addr, __ATOMIC_RELEASE);
+	__atomic_store_n(&(sb_map.len), new_len, __ATOMIC_RELEASE);
+}
+
+/* Check if "count" bytes from "offset" can be accessed through the
+mapping, and return the address of the mapping if so, or NULL if not. If
+the file grew, make sure the new part has no holes before using it. */
+static char *_sb_map_covers(off_t offset, size_t count)
+{
+	struct stat sbstat;
+	int64_t new_len, end, map_len;
+	int32_t errcode;
+	char *addr;
+
+	if ((sb_map.addr == NULL) || (sb_map.fd != sys_super_block->iofptr) ||
+	    (offset < 0))
+		return NULL;
+	end = offset + count;
+	map_len = __atomic_load_n(&(sb_map.len), __ATOMIC_ACQUIRE);
+	if ((end <= map_len) &&
+	    (end <= __atomic_load_n(&(sb_map.valid_len), __ATOMIC_ACQUIRE)))
+		return __atomic_load_n(&(sb_map.addr), __ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&(sb_map.alloc_failed), __ATOMIC_ACQUIRE) == TRUE)
+		return NULL;
+
+	sem_wait(&(sb_map.map_sem));
+	if (end > sb_map.len)
+		_sb_map_grow(end);
+	if ((end <= sb_map.len) && (end > sb_map.valid_len) &&
+	    (fstat(sb_map.fd, &sbstat) == 0)) {
+		new_len = (sbstat.st_size < sb_map.len) ? sbstat.st_size :
+							   sb_map.len;
+		/* Allocating blocks already there changes nothing */
+		if (new_len > sb_map.valid_len) {
+			if (fallocate(sb_map.fd, 0, sb_map.valid_len,
+				      new_len - sb_map.valid_len) == 0) {
+				__atomic_store_n(&(sb_map.valid_len), new_len,
+						 __ATOMIC_RELEASE);
+			} else {
+				/* Not retried, as it usually fails the same
+				way again (EOPNOTSUPP) */
+				errcode = errno;
+				write_log(4, "Super block mapping is not "
+					  "extended. Code %d, %s\n", errcode,
+					  strerror(errcode));
+				__atomic_store_n(&(sb_map.alloc_failed), TRUE,
+						 __ATOMIC_RELEASE);
+			}
+		}
+	}
+	addr = NULL;
+	if ((end <= sb_map.len) && (end <= sb_map.valid_len))
+		addr = sb_map.addr;
+	sem_post(&(sb_map.map_sem));
+	return addr;
+}
+
+/* pread on the super block file, through the mapping if possible */
+static ssize_t _sb_pread(void *buf, size_t count, off_t offset)
+{
+	char *addr;
+
+	addr = _sb_map_covers(offset, count);
+	if (addr != NULL) {
+		memcpy(buf, addr + offset, count);
+		return count;
+	}
+	return pread(sys_super_block->iofptr, buf, count, offset);
+}
+
+/* pwrite on the super block file, through the mapping if possible */
+static ssize_t _sb_pwrite(const void *buf, size_t count, off_t offset)
+{
+	char *addr;
+	ssize_t ret;
+
+	addr = _sb_map_covers(offset, count);
+	if (addr != NULL) {
+		memcpy(addr + offset, buf, count);
+		return count;
+	}
+	ret = pwrite(sys_super_block->iofptr, buf, count, offset);
+
+	/* Appending leaves no hole, so the new part can be mapped now */
+	if ((ret > 0) && (sb_map.addr != NULL) &&
+	    (sb_map.fd == sys_super_block->iofptr) &&
+	    (__atomic_load_n(&(sb_map.alloc_failed), __ATOMIC_ACQUIRE) ==
+	     FALSE)) {
+		sem_wait(&(sb_map.map_sem));
+		if ((offset <= sb_map.valid_len) &&
+		    (offset + ret > sb_map.valid_len) &&
+		    (offset + ret <= sb_map.len))
+			__atomic_store_n(&(sb_map.valid_len), offset + ret,
+					 __ATOMIC_RELEASE);
+		sem_post(&(sb_map.map_sem));
+	}
+	return ret;
+}
+
+/* Lock guarding the super block entry of "this_inode" */
+static inline sem_t *_entry_lock(ino_t this_inode)
+{
+	return &(sys_super_block->entry_lock_sem[this_inode %
+						 SB_ENTRY_LOCK_NUM]);
+}
+
+/* Lock serializing updates of the entry of "this_inode" that cannot be
+done within one entry lock section */
+static inline sem_t *_entry_update_lock(ino_t this_inode)
+{
+	return &(sys_super_block->entry_update_sem[this_inode %
+						  SB_ENTRY_LOCK_NUM]);
+}
+
+/* Lock guarding the linked list an entry with "status" is in, or NULL
+if the list has no own lock */
+static sem_t *_status_list_lock(char status)
+{
+	switch (status) {
+	case IS_DIRTY:
+		return &(sys_super_block->list_lock_sem[SB_LL_DIRTY]);
+	case TO_BE_DELETED:
+		return &(sys_super_block->list_lock_sem[SB_LL_TO_DELETE]);
+	default:
+		return NULL;
+	}
+}
+
+/* Helper function for reading the entry of "this_inode". Entry lock of the
+	entry must be held */
+static int32_t _read_entry(ino_t this_inode, SUPER_BLOCK_ENTRY *inode_ptr)
+{
+	ssize_t ret_val;
+	int32_t errcode;
+
+	if (this_inode <= 0) {
+		errcode = EINVAL;
+		write_log(0,
+			"Error in %s, inode number is %"PRIu64". Code %d,"
+			" %s\n", __func__, (uint64_t)this_inode, errcode,
+			strerror(errcode));
+		return -errcode;
+	}
+	ret_val = _sb_pread(inode_ptr, SB_ENTRY_SIZE,
+			    SB_HEAD_SIZE + (this_inode-1) * SB_ENTRY_SIZE);
+	errcode = errno;
+	if (ret_val < 0) {
+		write_log(0,
+			"Error in reading super block entry. Code %d, %s\n",
+			errcode, strerror(errcode));
+		return -errcode;
+	}
+	if (ret_val < SB_ENTRY_SIZE) {
+		write_log(0, "Short-read in reading super block entry.\n");
+		return -EIO;
+	}
+	return 0;
+}
+
+/* Helper function for writing the entry of "this_inode". Entry lock of the
+	entry must be held */
+static int32_t _write_entry(ino_t this_inode, SUPER_BLOCK_ENTRY *inode_ptr)
+{
+	ssize_t ret_val;
+	int32_t errcode;
+
+	ret_val = _sb_pwrite(inode_ptr, SB_ENTRY_SIZE,
+			     SB_HEAD_SIZE + (this_inode-1) * SB_ENTRY_SIZE);
+	errcode = errno;
+	if (ret_val < 0) {
+		write_log(0,
+			"Error in writing super block entry. Code %d, %s\n",
+			errcode, strerror(errcode));
+		return -errcode;
+	}
+	if (ret_val < SB_ENTRY_SIZE) {
+		write_log(0, "Short-write in writing super block entry.\n");
+		return -EIO;
+	}
+	return 0;
+}
+
+/* Helper function for writing "inode_ptr" to the entry of "this_inode",
+	with the linked list links kept as on disk. Links are changed in place
+	when neighbors are enqueued or dequeued, so the links in a copy read
+	without the exclusive lock might be out of date */
+static int32_t _write_entry_keep_links(ino_t this_inode,
+				       SUPER_BLOCK_ENTRY *inode_ptr)
+{
+	SUPER_BLOCK_ENTRY cur_entry;
+	int32_t ret;
+
+	sem_wait(_entry_lock(this_inode));
+	ret = _read_entry(this_inode, &cur_entry);
+	if (ret >= 0) {
+		inode_ptr->util_ll_next = cur_entry.util_ll_next;
+		inode_ptr->util_ll_prev = cur_entry.util_ll_prev;
+		inode_ptr->pin_ll_next = cur_entry.pin_ll_next;
+		inode_ptr->pin_ll_prev = cur_entry.pin_ll_prev;
+		ret = _write_entry(this_inode, inode_ptr);
+	}
+	sem_post(_entry_lock(this_inode));
+	return ret;
+}
+
+/* Helper function for setting the link at "link_offset" (such as
+	util_ll_next) of the entry of "this_inode" to "link_inode". The entry
+	is updated in place, so that concurrent updates of other fields of the
+	entry are kept. */
+static int32_t _set_entry_link(ino_t this_inode, size_t link_offset,
+			       ino_t link_inode)
+{
+	SUPER_BLOCK_ENTRY tempentry;
+	int32_t ret;
+
+	sem_wait(_entry_lock(this_inode));
+	ret = _read_entry(this_inode, &tempentry);
+	if (ret == 0) {
+		memcpy((char *)&tempentry + link_offset, &link_inode,
+		       sizeof(ino_t));
+		ret = _write_entry(this_inode, &tempentry);
+	}
+	sem_post(_entry_lock(this_inode));
+	return ret;
+}
+
 /************************************************************************
 *
 * Function name: write_super_block_head
@@ -65,8 +401,7 @@ int32_t write_super_block_head(void)
 	ssize_t ret_val;
 	int32_t errcode;
 
-	ret_val = pwrite(sys_super_block->iofptr, &(sys_super_block->head),
-							SB_HEAD_SIZE, 0);
+	ret_val = _sb_pwrite(&(sys_super_block->head), SB_HEAD_SIZE, 0);
 	if (ret_val < 0) {
 		errcode = errno;
 		write_log(0, "Error in writing super block head. Code %d, %s\n",
@@ -91,31 +426,12 @@ int32_t write_super_block_head(void)
 *************************************************************************/
 int32_t read_super_block_entry(ino_t this_inode, SUPER_BLOCK_ENTRY *inode_ptr)
 {
-	ssize_t ret_val;
-	int32_t errcode;
+	int32_t ret;
 
-	if (this_inode <= 0) {
-		errcode = EINVAL;
-		write_log(0,
-			"Error in %s, inode number is %"PRIu64". Code %d,"
-			" %s\n", __func__, (uint64_t)this_inode, errcode,
-			strerror(errcode));
-		return -errcode;
-	}
-	ret_val = pread(sys_super_block->iofptr, inode_ptr, SB_ENTRY_SIZE,
-			SB_HEAD_SIZE + (this_inode-1) * SB_ENTRY_SIZE);
-	if (ret_val < 0) {
-		errcode = errno;
-		write_log(0,
-			"Error in reading super block entry. Code %d, %s\n",
-			errcode, strerror(errcode));
-		return -errcode;
-	}
-	if (ret_val < SB_ENTRY_SIZE) {
-		write_log(0, "Short-read in reading super block entry.\n");
-		return -EIO;
-	}
-	return 0;
+	sem_wait(_entry_lock(this_inode));
+	ret = _read_entry(this_inode, inode_ptr);
+	sem_post(_entry_lock(this_inode));
+	return ret;
 }
 
 /************************************************************************
@@ -129,23 +445,12 @@ int32_t read_super_block_entry(ino_t this_inode, SUPER_BLOCK_ENTRY *inode_ptr)
 *************************************************************************/
 int32_t write_super_block_entry(ino_t this_inode, SUPER_BLOCK_ENTRY *inode_ptr)
 {
-	ssize_t ret_val;
-	int32_t errcode;
+	int32_t ret;
 
-	ret_val = pwrite(sys_super_block->iofptr, inode_ptr, SB_ENTRY_SIZE,
-				SB_HEAD_SIZE + (this_inode-1) * SB_ENTRY_SIZE);
-	if (ret_val < 0) {
-		errcode = errno;
-		write_log(0,
-			"Error in writing super block entry. Code %d, %s\n",
-			errcode, strerror(errcode));
-		return -errcode;
-	}
-	if (ret_val < SB_ENTRY_SIZE) {
-		write_log(0, "Short-write in writing super block entry.\n");
-		return -EIO;
-	}
-	return 0;
+	sem_wait(_entry_lock(this_inode));
+	ret = _write_entry(this_inode, inode_ptr);
+	sem_post(_entry_lock(this_inode));
+	return ret;
 }
 
 /************************************************************************
@@ -158,7 +463,7 @@ int32_t write_super_block_entry(ino_t this_inode, SUPER_BLOCK_ENTRY *inode_ptr)
 *************************************************************************/
 int32_t super_block_init(void)
 {
-	int32_t errcode;
+	int32_t errcode, count;
 	ssize_t ret;
 #ifndef _ANDROID_ENV_
 	int32_t shm_key;
@@ -188,6 +493,12 @@ int32_t super_block_init(void)
 	sem_init(&(sys_super_block->share_lock_sem), 1, 1);
 	sem_init(&(sys_super_block->share_CR_lock_sem), 1, 1);
 	sys_super_block->share_counter = 0;
+	for (count = 0; count < SB_ENTRY_LOCK_NUM; count++) {
+		sem_init(&(sys_super_block->entry_lock_sem[count]), 1, 1);
+		sem_init(&(sys_super_block->entry_update_sem[count]), 1, 1);
+	}
+	for (count = 0; count < NUM_SB_LL; count++)
+		sem_init(&(sys_super_block->list_lock_sem[count]), 1, 1);
 
 	sys_super_block->iofptr = open(SUPERBLOCK, O_RDWR);
 
@@ -263,6 +574,7 @@ int32_t super_block_init(void)
 		return -EIO;
 	}
 
+	_sb_map_init();
 	return 0;
 }
 
@@ -283,8 +595,7 @@ int32_t super_block_destroy(void)
 	ret_val = 0;
 
 	super_block_exclusive_locking();
-	ret = pwrite(sys_super_block->iofptr, &(sys_super_block->head),
-							SB_HEAD_SIZE, 0);
+	ret = _sb_pwrite(&(sys_super_block->head), SB_HEAD_SIZE, 0);
 	if (ret < 0) {
 		errcode = errno;
 		write_log(0, "Error in closing super block. ");
@@ -297,6 +608,7 @@ int32_t super_block_destroy(void)
 		}
 	}
 
+	_sb_map_destroy();
 	close(sys_super_block->iofptr);
 	fclose(sys_super_block->unclaimed_list_fptr);
 
@@ -310,20 +622,15 @@ int32_t super_block_destroy(void)
 * Function name: super_block_read
 *        Inputs: ino_t this_inode, SUPER_BLOCK_ENTRY *inode_ptr
 *       Summary: Read the super block entry of inode number "this_inode"
-*                from disk to the space pointed by "inode_ptr. This
-*                function includes locking for concurrent access control.
+*                from disk to the space pointed by "inode_ptr. The entry
+*                is read under its entry lock, so this does not wait for
+*                updates of other entries or linked lists.
 *  Return value: 0 if successful. Otherwise returns negation of error code.
 *
 *************************************************************************/
 int32_t super_block_read(ino_t this_inode, SUPER_BLOCK_ENTRY *inode_ptr)
 {
-	int32_t ret_val;
-
-	super_block_share_locking();
-	ret_val = read_super_block_entry(this_inode, inode_ptr);
-	super_block_share_release();
-
-	return ret_val;
+	return read_super_block_entry(this_inode, inode_ptr);
 }
 
 /************************************************************************
@@ -348,30 +655,34 @@ int32_t super_block_write(ino_t this_inode, SUPER_BLOCK_ENTRY *inode_ptr)
 			return ret_val;
 	}
 
-	super_block_exclusive_locking();
-	if (inode_ptr->status != IS_DIRTY) { /* Add to dirty node list */
-		ret_val = ll_dequeue(this_inode, inode_ptr);
-		if (ret_val < 0) {
-			super_block_exclusive_release();
-			return ret_val;
-		}
-		ret_val = ll_enqueue(this_inode, IS_DIRTY, inode_ptr);
-		if (ret_val < 0) {
-			super_block_exclusive_release();
-			return ret_val;
-		}
-		ret_val = write_super_block_head();
-		if (ret_val < 0) {
-			super_block_exclusive_release();
-			return ret_val;
-		}
+	sem_wait(_entry_update_lock(this_inode));
+	if (inode_ptr->status == IS_DIRTY) {
+		/* Already in dirty list, so only the entry is written */
+		if (inode_ptr->in_transit == TRUE)
+			inode_ptr->mod_after_in_transit = TRUE;
+		ret_val = _write_entry_keep_links(this_inode, inode_ptr);
+		sem_post(_entry_update_lock(this_inode));
+		return ret_val;
 	}
+
+	super_block_exclusive_locking();
+	/* Add to dirty node list */
+	ret_val = ll_dequeue(this_inode, inode_ptr);
+	if (ret_val < 0)
+		goto out;
+	ret_val = ll_enqueue(this_inode, IS_DIRTY, inode_ptr);
+	if (ret_val < 0)
+		goto out;
+	ret_val = write_super_block_head();
+	if (ret_val < 0)
+		goto out;
 	if (inode_ptr->in_transit == TRUE)
 		inode_ptr->mod_after_in_transit = TRUE;
 	ret_val = write_super_block_entry(this_inode, inode_ptr);
 
+out:
 	super_block_exclusive_release();
-
+	sem_post(_entry_update_lock(this_inode));
 	return ret_val;
 }
 
@@ -392,51 +703,66 @@ int32_t super_block_update_stat(ino_t this_inode,
 	int32_t ret_val;
 	SUPER_BLOCK_ENTRY tempentry;
 
-	super_block_exclusive_locking();
+	sem_wait(_entry_update_lock(this_inode));
 
-	/* Read the old content of super block entry first */
-	ret_val = read_super_block_entry(this_inode, &tempentry);
+	/* Read the old content of super block entry first. If no linked
+	list is changed, the entry is updated in place */
+	sem_wait(_entry_lock(this_inode));
+	ret_val = _read_entry(this_inode, &tempentry);
 	if (ret_val >= 0 && tempentry.inode_stat.ino == 0) {
+		sem_post(_entry_lock(this_inode));
+		sem_post(_entry_update_lock(this_inode));
 		/* Do nothing when inode not exist */
 		write_log(4, "Warn: Try to update stat of removed"
 				" inode %"PRIu64". Status is %d.",
 				(uint64_t)this_inode, tempentry.status);
-		super_block_exclusive_release();
 		return 0;
 	}
-	if ((ret_val >= 0) && (no_sync == FALSE)) {
-		if (tempentry.status != IS_DIRTY) {
-			ret_val = ll_dequeue(this_inode, &tempentry);
-			if (ret_val < 0) {
-				super_block_exclusive_release();
-				return ret_val;
-			}
-			ret_val = ll_enqueue(this_inode, IS_DIRTY, &tempentry);
-			if (ret_val < 0) {
-				super_block_exclusive_release();
-				return ret_val;
-			}
-			ret_val = write_super_block_head();
-			if (ret_val < 0) {
-				super_block_exclusive_release();
-				return ret_val;
-			}
-		}
-		if (tempentry.in_transit == TRUE)
+	if ((ret_val >= 0) &&
+	    ((no_sync == TRUE) || (tempentry.status == IS_DIRTY))) {
+		/* Only update the copy of stat in super block if no_sync is
+		true, as there is nothing to sync to the backend */
+		if ((no_sync == FALSE) && (tempentry.in_transit == TRUE))
 			tempentry.mod_after_in_transit = TRUE;
-
-		memcpy(&(tempentry.inode_stat), newstat, sizeof(HCFS_STAT));
-		/* Write the updated content back */
-		ret_val = write_super_block_entry(this_inode, &tempentry);
-	} else if ((ret_val >= 0) && (no_sync == TRUE)) {
-		/* Only update the copy of stat in super block, but do not
-		sync to the backend */
 		memcpy(&(tempentry.inode_stat), newstat, sizeof(HCFS_STAT));
-		/* Write the updated content back */
-		ret_val = write_super_block_entry(this_inode, &tempentry);
+		ret_val = _write_entry(this_inode, &tempentry);
+		sem_post(_entry_lock(this_inode));
+		sem_post(_entry_update_lock(this_inode));
+		return ret_val;
+	}
+	sem_post(_entry_lock(this_inode));
+	if (ret_val < 0) {
+		sem_post(_entry_update_lock(this_inode));
+		return ret_val;
 	}
-	super_block_exclusive_release();
 
+	/* Need to add the entry to dirty list. Links of the entry might
+	be changed by list updates meanwhile, so read it again */
+	super_block_exclusive_locking();
+	ret_val = read_super_block_entry(this_inode, &tempentry);
+	if (ret_val < 0)
+		goto out;
+	if (tempentry.status != IS_DIRTY) {
+		ret_val = ll_dequeue(this_inode, &tempentry);
+		if (ret_val < 0)
+			goto out;
+		ret_val = ll_enqueue(this_inode, IS_DIRTY, &tempentry);
+		if (ret_val < 0)
+			goto out;
+		ret_val = write_super_block_head();
+		if (ret_val < 0)
+			goto out;
+	}
+	if (tempentry.in_transit == TRUE)
+		tempentry.mod_after_in_transit = TRUE;
+
+	memcpy(&(tempentry.inode_stat), newstat, sizeof(HCFS_STAT));
+	/* Write the updated content back */
+	ret_val = write_super_block_entry(this_inode, &tempentry);
+
+out:
+	super_block_exclusive_release();
+	sem_post(_entry_update_lock(this_inode));
 	return ret_val;
 }
 
@@ -455,62 +781,89 @@ int32_t super_block_mark_dirty(ino_t this_inode)
 	char need_write;
 	int64_t now_meta_size, dirty_delta_meta_size;
 
-	need_write = FALSE;
-	super_block_exclusive_locking();
+	sem_wait(_entry_update_lock(this_inode));
 
 	ret_val = read_super_block_entry(this_inode, &tempentry);
-	if (ret_val >= 0) {
-		if (tempentry.inode_stat.ino == 0) {
-			/* Do nothing when inode not exist */
-			write_log(4, "Warn: Try to mark dirty of removed"
-				" inode %"PRIu64". Status is %d.",
-				(uint64_t)this_inode, tempentry.status);
-			super_block_exclusive_release();
-			return 0;
-		}
-		if (tempentry.status == NO_LL) {
+	if (ret_val < 0)
+		goto out;
+	if (tempentry.inode_stat.ino == 0) {
+		/* Do nothing when inode not exist */
+		write_log(4, "Warn: Try to mark dirty of removed"
+			" inode %"PRIu64". Status is %d.",
+			(uint64_t)this_inode, tempentry.status);
+		goto out;
+	}
+
+	if (tempentry.status == NO_LL) {
+		super_block_exclusive_locking();
+		/* Links might be changed by list updates, so read again */
+		ret_val = read_super_block_entry(this_inode, &tempentry);
+		if (ret_val >= 0)
 			ret_val = ll_enqueue(this_inode, IS_DIRTY, &tempentry);
-			if (ret_val < 0) {
-				super_block_exclusive_release();
-				return ret_val;
-			}
+		if (ret_val >= 0)
 			ret_val = write_super_block_head();
-			if (ret_val < 0) {
-				super_block_exclusive_release();
-				return ret_val;
-			}
-			need_write = TRUE;
-		} else if (tempentry.status == IS_DIRTY) {
-			/* When marking dirty again, just update
-			 * dirty meta size */
-			get_meta_size(this_inode, NULL, &now_meta_size);
-			if (now_meta_size > 0) {
-				dirty_delta_meta_size = now_meta_size -
-						tempentry.dirty_meta_size;
-				if (dirty_delta_meta_size != 0) {
-					tempentry.dirty_meta_size =
-							now_meta_size;
-					change_system_meta_ignore_dirty(
-					    this_inode, 0, 0, 0, 0,
-					    dirty_delta_meta_size, 0, TRUE);
-					need_write = TRUE;
-				}
+		if (ret_val >= 0) {
+			if (tempentry.in_transit == TRUE)
+				tempentry.mod_after_in_transit = TRUE;
+			ret_val = write_super_block_entry(this_inode,
+							  &tempentry);
+		}
+		super_block_exclusive_release();
+		goto out;
+	}
+
+	/* No linked list is changed, so the entry is updated in place. When
+	marking dirty again, just update dirty meta size */
+	now_meta_size = 0;
+	if (tempentry.status == IS_DIRTY)
+		get_meta_size(this_inode, NULL, &now_meta_size);
+
+	need_write = FALSE;
+	dirty_delta_meta_size = 0;
+	sem_wait(_entry_lock(this_inode));
+	ret_val = _read_entry(this_inode, &tempentry);
+	if (ret_val >= 0) {
+		if ((tempentry.status == IS_DIRTY) && (now_meta_size > 0)) {
+			dirty_delta_meta_size = now_meta_size -
+					tempentry.dirty_meta_size;
+			if (dirty_delta_meta_size != 0) {
+				tempentry.dirty_meta_size = now_meta_size;
+				need_write = TRUE;
 			}
 		}
 		if (tempentry.in_transit == TRUE) {
 			need_write = TRUE;
 			tempentry.mod_after_in_transit = TRUE;
 		}
-
 		if (need_write == TRUE)
-			ret_val = write_super_block_entry(this_inode,
-								&tempentry);
+			ret_val = _write_entry(this_inode, &tempentry);
 	}
-	super_block_exclusive_release();
+	sem_post(_entry_lock(this_inode));
+	if ((ret_val >= 0) && (dirty_delta_meta_size != 0))
+		change_system_meta_ignore_dirty(this_inode, 0, 0, 0, 0,
+				dirty_delta_meta_size, 0, TRUE);
 
+out:
+	sem_post(_entry_update_lock(this_inode));
 	return ret_val;
 }
 
+/* Helper function for checking if ending or starting the transit of an
+	entry "sb_entry" moves the entry in or out of dirty list */
+static BOOL _transit_changes_list(const SUPER_BLOCK_ENTRY *sb_entry,
+				  BOOL is_start_transit,
+				  char transit_incomplete)
+{
+	if ((is_start_transit == TRUE) || (sb_entry->status != IS_DIRTY) ||
+	    (transit_incomplete == TRUE))
+		return FALSE;
+	/* Re-queued if modified during transit and sync point is set, and
+	dequeued if not modified during transit */
+	if (sb_entry->mod_after_in_transit == TRUE)
+		return sys_super_block->sync_point_is_set;
+	return TRUE;
+}
+
 /************************************************************************
 *
 * Function name: super_block_update_transit
@@ -528,77 +881,108 @@ int32_t super_block_update_transit(ino_t this_inode, BOOL is_start_transit,
 	int32_t ret_val;
 	SUPER_BLOCK_ENTRY tempentry;
 
-	super_block_exclusive_locking();
+	sem_wait(_entry_update_lock(this_inode));
 
-	ret_val = read_super_block_entry(this_inode, &tempentry);
-	if (ret_val >= 0) {
-		if (((is_start_transit == FALSE) && /* End of transit */
-				(tempentry.status == IS_DIRTY)) &&
-				((transit_incomplete != TRUE))) { /* Complete */
-			/* We are done first this upload, so update the xattr
-			"user.lastsync" */
+	/* Update the entry in place if no linked list is changed */
+	sem_wait(_entry_lock(this_inode));
+	ret_val = _read_entry(this_inode, &tempentry);
+	if ((ret_val >= 0) && (_transit_changes_list(&tempentry,
+			is_start_transit, transit_incomplete) == FALSE)) {
+		if ((is_start_transit == FALSE) &&
+		    (tempentry.status == IS_DIRTY) &&
+		    (transit_incomplete != TRUE))
 			tempentry.lastsync_time = get_current_sectime();
-			if (tempentry.mod_after_in_transit == TRUE) {
-				/* If sync point is set, relocate this inode
-				 * so that it is going to be last one. */
-				if (sys_super_block->sync_point_is_set
-						== TRUE) {
-					write_log(10, "Debug: Re-queue inode %"
-						PRIu64, (uint64_t)this_inode);
-					ret_val = ll_dequeue(this_inode,
-						&tempentry);
-					if (ret_val < 0) {
-						super_block_exclusive_release();
-						return ret_val;
-					}
-					ret_val = ll_enqueue(this_inode,
-						IS_DIRTY, &tempentry);
-					if (ret_val < 0) {
-						super_block_exclusive_release();
-						return ret_val;
-					}
-					ret_val = write_super_block_head();
-					if (ret_val < 0) {
-						super_block_exclusive_release();
-						return ret_val;
-					}
-				}
-			} else {
+		tempentry.in_transit = is_start_transit;
+		tempentry.mod_after_in_transit = FALSE;
+		ret_val = _write_entry(this_inode, &tempentry);
+		sem_post(_entry_lock(this_inode));
+		sem_post(_entry_update_lock(this_inode));
+		return ret_val;
+	}
+	sem_post(_entry_lock(this_inode));
+	if (ret_val < 0) {
+		sem_post(_entry_update_lock(this_inode));
+		return ret_val;
+	}
+
+	super_block_exclusive_locking();
+	/* Links might be changed by list updates, so read again */
+	ret_val = read_super_block_entry(this_inode, &tempentry);
+	if (ret_val < 0)
+		goto out;
+	if (_transit_changes_list(&tempentry, is_start_transit,
+				  transit_incomplete) == TRUE) {
+		/* We are done first this upload, so update the xattr
+		"user.lastsync" */
+		tempentry.lastsync_time = get_current_sectime();
+		if (tempentry.mod_after_in_transit == TRUE) {
+			/* If sync point is set, relocate this inode
+			 * so that it is going to be last one. */
+			write_log(10, "Debug: Re-queue inode %"
+				PRIu64, (uint64_t)this_inode);
+			ret_val = ll_dequeue(this_inode, &tempentry);
+			if (ret_val < 0)
+				goto out;
+			ret_val = ll_enqueue(this_inode, IS_DIRTY,
+					     &tempentry);
+			if (ret_val < 0)
+				goto out;
+		} else {
 			/* If finished syncing and no more mod is done after
 			*  queueing the inode for syncing */
 			/* Remove from is_dirty list */
-				ret_val = ll_dequeue(this_inode, &tempentry);
-				if (ret_val < 0) {
-					super_block_exclusive_release();
-					return ret_val;
-				}
-				ret_val = write_super_block_head();
-				if (ret_val < 0) {
-					super_block_exclusive_release();
-					return ret_val;
-				}
-			}
+			ret_val = ll_dequeue(this_inode, &tempentry);
+			if (ret_val < 0)
+				goto out;
 		}
-		tempentry.in_transit = is_start_transit;
-		tempentry.mod_after_in_transit = FALSE;
-		ret_val = write_super_block_entry(this_inode, &tempentry);
+		ret_val = write_super_block_head();
+		if (ret_val < 0)
+			goto out;
 	}
-	super_block_exclusive_release();
+	tempentry.in_transit = is_start_transit;
+	tempentry.mod_after_in_transit = FALSE;
+	ret_val = write_super_block_entry(this_inode, &tempentry);
 
+out:
+	super_block_exclusive_release();
+	sem_post(_entry_update_lock(this_inode));
 	return ret_val;
 }
 
 /************************************************************************
 *
-* Function name: super_block_to_delete
-*        Inputs: ino_t this_inode
-*       Summary: Mark the inode "this_inode" as "to be deleted" in the
-*                super block. This is the status when a filesystem object
-*                is deleted but garbage collection is not yet done.
+* Function name: super_block_start_transit
+*        Inputs: ino_t this_inode, SUPER_BLOCK_ENTRY *inode_ptr
+*       Summary: Mark inode "this_inode" in transit before syncing it, if
+*                the inode is in dirty list and not in transit yet. The
+*                entry is returned in "inode_ptr".
 *  Return value: 0 if successful. Otherwise returns negation of error code.
 *
 *************************************************************************/
-int32_t super_block_to_delete(ino_t this_inode, BOOL enqueue_now)
+int32_t super_block_start_transit(ino_t this_inode,
+				  SUPER_BLOCK_ENTRY *inode_ptr)
+{
+	int32_t ret_val;
+
+	sem_wait(_entry_update_lock(this_inode));
+	super_block_exclusive_locking();
+	sem_wait(_entry_lock(this_inode));
+	ret_val = _read_entry(this_inode, inode_ptr);
+	if ((ret_val >= 0) && (inode_ptr->status == IS_DIRTY) &&
+	    (inode_ptr->in_transit == FALSE)) {
+		inode_ptr->in_transit = TRUE;
+		inode_ptr->mod_after_in_transit = FALSE;
+		ret_val = _write_entry(this_inode, inode_ptr);
+	}
+	sem_post(_entry_lock(this_inode));
+	super_block_exclusive_release();
+	sem_post(_entry_update_lock(this_inode));
+	return ret_val;
+}
+
+/* Helper function for super_block_to_delete(). Entry update lock of the
+	entry is held */
+static int32_t _super_block_to_delete(ino_t this_inode, BOOL enqueue_now)
 {
 	int32_t ret_val;
 	SUPER_BLOCK_ENTRY tempentry;
@@ -631,7 +1015,7 @@ int32_t super_block_to_delete(ino_t this_inode, BOOL enqueue_now)
 				tempentry.status = NO_LL;
 			}
 		}
-		sys_super_block->head.num_active_inodes--;
+		SB_HEAD_COUNTER_ADD(num_active_inodes, -1);
 		ret_val = write_super_block_head();
 
 		if (ret_val >= 0) {
@@ -655,16 +1039,27 @@ int32_t super_block_to_delete(ino_t this_inode, BOOL enqueue_now)
 
 /************************************************************************
 *
-* Function name: super_block_enqueue_delete
+* Function name: super_block_to_delete
 *        Inputs: ino_t this_inode
-*       Summary: After involking super_block_to_delete() with param
-*                enqueue_now = false, use this function to enqueue entry
-*                of "this_inode" to delete queue so that another thread
-*                can delete data and meta on cloud.
+*       Summary: Mark the inode "this_inode" as "to be deleted" in the
+*                super block. This is the status when a filesystem object
+*                is deleted but garbage collection is not yet done.
 *  Return value: 0 if successful. Otherwise returns negation of error code.
 *
 *************************************************************************/
-int32_t super_block_enqueue_delete(ino_t this_inode)
+int32_t super_block_to_delete(ino_t this_inode, BOOL enqueue_now)
+{
+	int32_t ret_val;
+
+	sem_wait(_entry_update_lock(this_inode));
+	ret_val = _super_block_to_delete(this_inode, enqueue_now);
+	sem_post(_entry_update_lock(this_inode));
+	return ret_val;
+}
+
+/* Helper function for super_block_enqueue_delete(). Entry update lock of
+	the entry is held */
+static int32_t _super_block_enqueue_delete(ino_t this_inode)
 {
 	int32_t ret_val;
 	SUPER_BLOCK_ENTRY tempentry;
@@ -707,16 +1102,28 @@ error_handle:
 
 /************************************************************************
 *
-* Function name: super_block_delete
+* Function name: super_block_enqueue_delete
 *        Inputs: ino_t this_inode
-*       Summary: Mark the inode "this_inode" as "to be reclaimed" in the
-*                super block. This is the status when a filesystem object
-*                is deleted and garbage collection is done. The inode number
-*                is ready to be recycled and reused.
+*       Summary: After involking super_block_to_delete() with param
+*                enqueue_now = false, use this function to enqueue entry
+*                of "this_inode" to delete queue so that another thread
+*                can delete data and meta on cloud.
 *  Return value: 0 if successful. Otherwise returns negation of error code.
 *
 *************************************************************************/
-int32_t super_block_delete(ino_t this_inode)
+int32_t super_block_enqueue_delete(ino_t this_inode)
+{
+	int32_t ret_val;
+
+	sem_wait(_entry_update_lock(this_inode));
+	ret_val = _super_block_enqueue_delete(this_inode);
+	sem_post(_entry_update_lock(this_inode));
+	return ret_val;
+}
+
+/* Helper function for super_block_delete(). Entry update lock of the entry
+	is held */
+static int32_t _super_block_delete(ino_t this_inode)
 {
 	int32_t ret_val;
 	SUPER_BLOCK_ENTRY tempentry;
@@ -806,7 +1213,7 @@ int32_t super_block_delete(ino_t this_inode)
 		return -EIO;
 	}
 
-	sys_super_block->head.num_to_be_reclaimed++;
+	SB_HEAD_COUNTER_ADD(num_to_be_reclaimed, 1);
 	ret_val = write_super_block_head();
 
 	super_block_exclusive_release();
@@ -817,6 +1224,27 @@ errcode_handle:
 	return errcode;
 }
 
+/************************************************************************
+*
+* Function name: super_block_delete
+*        Inputs: ino_t this_inode
+*       Summary: Mark the inode "this_inode" as "to be reclaimed" in the
+*                super block. This is the status when a filesystem object
+*                is deleted and garbage collection is done. The inode number
+*                is ready to be recycled and reused.
+*  Return value: 0 if successful. Otherwise returns negation of error code.
+*
+*************************************************************************/
+int32_t super_block_delete(ino_t this_inode)
+{
+	int32_t ret_val;
+
+	sem_wait(_entry_update_lock(this_inode));
+	ret_val = _super_block_delete(this_inode);
+	sem_post(_entry_update_lock(this_inode));
+	return ret_val;
+}
+
 /* Helper function for sorting entries in the super block */
 static int32_t compino(const void *firstino, const void *secondino)
 {
@@ -945,7 +1373,7 @@ int32_t super_block_reclaim(void)
 				sys_super_block->head.last_reclaimed_inode =
 							unclaimed_list[count];
 			tempentry.status = RECLAIMED;
-			sys_super_block->head.num_inode_reclaimed++;
+			SB_HEAD_COUNTER_ADD(num_inode_reclaimed, 1);
 			tempentry.util_ll_next = last_reclaimed;
 			last_reclaimed = unclaimed_list[count];
 			sys_super_block->head.first_reclaimed_inode =
@@ -960,7 +1388,7 @@ int32_t super_block_reclaim(void)
 		}
 	}
 
-	sys_super_block->head.num_to_be_reclaimed = 0;
+	SB_HEAD_COUNTER_SET(num_to_be_reclaimed, 0);
 
 	ret_val = write_super_block_head();
 	if (ret_val < 0) {
@@ -1025,7 +1453,7 @@ static int32_t _fullscan_reclaim_bundle(ino_t first_reclaimed_inode,
 		sys_super_block->head.last_reclaimed_inode =
 				last_reclaimed_inode;
 	}
-	sys_super_block->head.num_inode_reclaimed += num_reclaim;
+	SB_HEAD_COUNTER_ADD(num_inode_reclaimed, num_reclaim);
 	ret = write_super_block_head();
 	if (ret < 0)
 		goto error_handle;
@@ -1117,7 +1545,7 @@ static int32_t _handle_temp_unclaimed_file()
 	}
 
 	/* Update num to-be-reclaim */
-	sys_super_block->head.num_to_be_reclaimed = total_inode;
+	SB_HEAD_COUNTER_SET(num_to_be_reclaimed, total_inode);
 	ret = write_super_block_head();
 	errcode = ret;
 
@@ -1158,8 +1586,8 @@ int32_t super_block_reclaim_fullscan(void)
 	super_block_exclusive_locking();
 	sys_super_block->now_reclaim_fullscan = TRUE;
 
-	sys_super_block->head.num_inode_reclaimed = 0;
-	sys_super_block->head.num_to_be_reclaimed = 0;
+	SB_HEAD_COUNTER_SET(num_inode_reclaimed, 0);
+	SB_HEAD_COUNTER_SET(num_to_be_reclaimed, 0);
 
 	retval = lseek(sys_super_block->iofptr, SB_HEAD_SIZE, SEEK_SET);
 	if (retval == (off_t) -1) {
@@ -1303,11 +1731,12 @@ ino_t super_block_new_inode(HCFS_STAT *in_stat,
 
 	if (sys_super_block->head.num_inode_reclaimed > 0) {
 		this_inode = sys_super_block->head.first_reclaimed_inode;
-		retsize = pread(sys_super_block->iofptr, &tempentry,
-				SB_ENTRY_SIZE, SB_HEAD_SIZE +
+		sem_wait(_entry_lock(this_inode));
+		retsize = _sb_pread(&tempentry, SB_ENTRY_SIZE, SB_HEAD_SIZE +
 						(this_inode-1) * SB_ENTRY_SIZE);
+		errcode = errno;
+		sem_post(_entry_lock(this_inode));
 		if (retsize < 0) {
-			errcode = errno;
 			write_log(0, "IO error in alloc inode. Code %d, %s\n",
 				errcode, strerror(errcode));
 		}
@@ -1321,12 +1750,12 @@ ino_t super_block_new_inode(HCFS_STAT *in_stat,
 		if (new_first_reclaimed == 0) {
 			/*TODO: Need to check if num_inode_reclaimed is 0.
 				If not, need to rescan super inode*/
-			sys_super_block->head.num_inode_reclaimed = 0;
+			SB_HEAD_COUNTER_SET(num_inode_reclaimed, 0);
 			sys_super_block->head.first_reclaimed_inode = 0;
 			sys_super_block->head.last_reclaimed_inode = 0;
 		} else {
 			/*Update super inode head regularly*/
-			sys_super_block->head.num_inode_reclaimed--;
+			SB_HEAD_COUNTER_ADD(num_inode_reclaimed, -1);
 			sys_super_block->head.first_reclaimed_inode =
 							new_first_reclaimed;
 		}
@@ -1340,13 +1769,13 @@ ino_t super_block_new_inode(HCFS_STAT *in_stat,
 
 		/* If need to append a new super inode and add total
 		*  inode count*/
-		sys_super_block->head.num_total_inodes++;
+		SB_HEAD_COUNTER_ADD(num_total_inodes, 1);
 		this_inode = sys_super_block->head.num_total_inodes + 1;
 		/* Inode starts from 2 */
 		this_generation = 1;
 		update_size = TRUE;
 	}
-	sys_super_block->head.num_active_inodes++;
+	SB_HEAD_COUNTER_ADD(num_active_inodes, 1);
 
 	/*Update the new super inode entry*/
 	memset(&tempentry, 0, SB_ENTRY_SIZE);
@@ -1360,10 +1789,12 @@ ino_t super_block_new_inode(HCFS_STAT *in_stat,
 	memcpy(&tempstat, in_stat, sizeof(HCFS_STAT));
 	tempstat.ino = this_inode;
 	memcpy(&(tempentry.inode_stat), &tempstat, sizeof(HCFS_STAT));
-	retsize = pwrite(sys_super_block->iofptr, &tempentry, SB_ENTRY_SIZE,
-				SB_HEAD_SIZE + (this_inode-1) * SB_ENTRY_SIZE);
+	sem_wait(_entry_lock(this_inode));
+	retsize = _sb_pwrite(&tempentry, SB_ENTRY_SIZE,
+			     SB_HEAD_SIZE + (this_inode-1) * SB_ENTRY_SIZE);
+	errcode = errno;
+	sem_post(_entry_lock(this_inode));
 	if (retsize < 0) {
-		errcode = errno;
 		write_log(0, "IO error in alloc inode. Code %d, %s\n",
 			errcode, strerror(errcode));
 	}
@@ -1372,8 +1803,7 @@ ino_t super_block_new_inode(HCFS_STAT *in_stat,
 		return 0;
 	}
 
-	retsize = pwrite(sys_super_block->iofptr, &(sys_super_block->head),
-							SB_HEAD_SIZE, 0);
+	retsize = _sb_pwrite(&(sys_super_block->head), SB_HEAD_SIZE, 0);
 	if (retsize < 0) {
 		errcode = errno;
 		write_log(0, "IO error in alloc inode. Code %d, %s\n",
@@ -1453,7 +1883,7 @@ int32_t ll_rebuild_dirty(ino_t missing_inode)
 		if (ret < 0)
 			return ret;
 
-		sys_super_block->head.num_dirty = 1;
+		SB_HEAD_COUNTER_SET(num_dirty, 1);
 		sem_check_and_release(&(hcfs_system->sync_wait_sem),
 		                      &sync_status);
 		ret = write_super_block_head();
@@ -1519,7 +1949,7 @@ int32_t ll_rebuild_dirty(ino_t missing_inode)
 			return ret;
 
 		sys_super_block->head.last_dirty_inode = tempentry.this_index;
-		sys_super_block->head.num_dirty += 1;
+		SB_HEAD_COUNTER_ADD(num_dirty, 1);
 		sem_check_and_release(&(hcfs_system->sync_wait_sem),
 		                      &sync_status);
 		ret = write_super_block_head();
@@ -1543,22 +1973,12 @@ int32_t ll_rebuild_dirty(ino_t missing_inode)
 	return 0;
 }
 
-/************************************************************************
-*
-* Function name: ll_enqueue
-*        Inputs: ino_t thisinode, char which_ll, SUPER_BLOCK_ENTRY *this_entry
-*       Summary: Enqueue super block entry "this_entry" (with inode number
-*                "thisinode") to the linked list "which_ll".
-*                "which_ll" can be one of NO_LL, IS_DIRTY, TO_BE_DELETED,
-*                TO_BE_RECLAIMED, or RECLAIMED.
-*  Return value: 0 if successful. Otherwise returns negation of error code.
-*
-*************************************************************************/
-int32_t ll_enqueue(ino_t thisinode, char which_ll, SUPER_BLOCK_ENTRY *this_entry)
+/* Enqueue "this_entry" to "which_ll". List lock of "which_ll" is held */
+static int32_t _ll_enqueue(ino_t thisinode, char which_ll,
+			   SUPER_BLOCK_ENTRY *this_entry)
 {
 	SUPER_BLOCK_ENTRY tempentry, tempentry2;
-	int32_t ret, errcode;
-	ssize_t retsize;
+	int32_t ret;
 	int64_t now_meta_size, dirty_delta_meta_size;
 	int32_t need_rebuild;
 	BOOL sb_enqueue_later = FALSE;
@@ -1582,12 +2002,6 @@ int32_t ll_enqueue(ino_t thisinode, char which_ll, SUPER_BLOCK_ENTRY *this_entry
 		}
 		return 0;
 	}
-	if (this_entry->status != NO_LL) {
-		ret = ll_dequeue(thisinode, this_entry);
-		if (ret < 0)
-			return ret;
-	}
-
 	if (which_ll == NO_LL)
 		return 0;
 
@@ -1613,7 +2027,7 @@ int32_t ll_enqueue(ino_t thisinode, char which_ll, SUPER_BLOCK_ENTRY *this_entry
 			sys_super_block->head.last_dirty_inode = thisinode;
 			this_entry->util_ll_next = 0;
 			this_entry->util_ll_prev = 0;
-			sys_super_block->head.num_dirty++;
+			SB_HEAD_COUNTER_ADD(num_dirty, 1);
 			sem_check_and_release(&(hcfs_system->sync_wait_sem),
 			                      &sync_status);
 		} else {
@@ -1654,26 +2068,12 @@ int32_t ll_enqueue(ino_t thisinode, char which_ll, SUPER_BLOCK_ENTRY *this_entry
 					sys_super_block->head.last_dirty_inode;
 			sys_super_block->head.last_dirty_inode = thisinode;
 			this_entry->util_ll_next = 0;
-			sys_super_block->head.num_dirty++;
+			SB_HEAD_COUNTER_ADD(num_dirty, 1);
 			sem_check_and_release(&(hcfs_system->sync_wait_sem),
 			                      &sync_status);
-			retsize = pread(sys_super_block->iofptr, &tempentry,
-				SB_ENTRY_SIZE, SB_HEAD_SIZE +
-				((this_entry->util_ll_prev-1) * SB_ENTRY_SIZE));
-			if (retsize < 0) {
-				errcode = errno;
-				write_log(0, "IO error in superblock.");
-				write_log(0, " Code %d, %s\n",
-					errcode, strerror(errcode));
-				return -errcode;
-			}
-			if (retsize < SB_ENTRY_SIZE) {
-				write_log(0, "IO error in superblock.");
-				return -EIO;
-			}
-
-			tempentry.util_ll_next = thisinode;
-			ret = write_super_block_entry(this_entry->util_ll_prev, &tempentry);
+			ret = _set_entry_link(this_entry->util_ll_prev,
+				offsetof(SUPER_BLOCK_ENTRY, util_ll_next),
+				thisinode);
 			if (ret < 0)
 				return ret;
 		}
@@ -1690,7 +2090,7 @@ int32_t ll_enqueue(ino_t thisinode, char which_ll, SUPER_BLOCK_ENTRY *this_entry
 			sys_super_block->head.last_to_delete_inode = thisinode;
 			this_entry->util_ll_next = 0;
 			this_entry->util_ll_prev = 0;
-			sys_super_block->head.num_to_be_deleted++;
+			SB_HEAD_COUNTER_ADD(num_to_be_deleted, 1);
 			/* Continue dsync thread if stopped */
 			sem_check_and_release(&(hcfs_system->dsync_wait_sem),
 			                      &pause_status);
@@ -1699,39 +2099,15 @@ int32_t ll_enqueue(ino_t thisinode, char which_ll, SUPER_BLOCK_ENTRY *this_entry
 				sys_super_block->head.last_to_delete_inode;
 			sys_super_block->head.last_to_delete_inode = thisinode;
 			this_entry->util_ll_next = 0;
-			sys_super_block->head.num_to_be_deleted++;
+			SB_HEAD_COUNTER_ADD(num_to_be_deleted, 1);
 			/* Continue dsync thread if stopped */
 			sem_check_and_release(&(hcfs_system->dsync_wait_sem),
 			                      &pause_status);
-			retsize = pread(sys_super_block->iofptr, &tempentry,
-				SB_ENTRY_SIZE, SB_HEAD_SIZE +
-				((this_entry->util_ll_prev-1) * SB_ENTRY_SIZE));
-			if (retsize < 0) {
-				errcode = errno;
-				write_log(0, "IO error in superblock.");
-				write_log(0, " Code %d, %s\n",
-					errcode, strerror(errcode));
-				return -errcode;
-			}
-			if (retsize < SB_ENTRY_SIZE) {
-				write_log(0, "IO error in superblock.");
-				return -EIO;
-			}
-			tempentry.util_ll_next = thisinode;
-			retsize = pwrite(sys_super_block->iofptr, &tempentry,
-				SB_ENTRY_SIZE, SB_HEAD_SIZE +
-				((this_entry->util_ll_prev-1) * SB_ENTRY_SIZE));
-			if (retsize < 0) {
-				errcode = errno;
-				write_log(0, "IO error in superblock.");
-				write_log(0, " Code %d, %s\n",
-					errcode, strerror(errcode));
-				return -errcode;
-			}
-			if (retsize < SB_ENTRY_SIZE) {
-				write_log(0, "IO error in superblock.");
-				return -EIO;
-			}
+			ret = _set_entry_link(this_entry->util_ll_prev,
+				offsetof(SUPER_BLOCK_ENTRY, util_ll_next),
+				thisinode);
+			if (ret < 0)
+				return ret;
 		}
 		break;
 	default:
@@ -1744,14 +2120,39 @@ int32_t ll_enqueue(ino_t thisinode, char which_ll, SUPER_BLOCK_ENTRY *this_entry
 
 /************************************************************************
 *
-* Function name: ll_dequeue
-*        Inputs: ino_t thisinode, SUPER_BLOCK_ENTRY *this_entry
-*       Summary: Dequeue super block entry "this_entry" (with inode number
-*                "thisinode") from the current linked list.
+* Function name: ll_enqueue
+*        Inputs: ino_t thisinode, char which_ll, SUPER_BLOCK_ENTRY *this_entry
+*       Summary: Enqueue super block entry "this_entry" (with inode number
+*                "thisinode") to the linked list "which_ll".
+*                "which_ll" can be one of NO_LL, IS_DIRTY, TO_BE_DELETED,
+*                TO_BE_RECLAIMED, or RECLAIMED.
 *  Return value: 0 if successful. Otherwise returns negation of error code.
 *
 *************************************************************************/
-int32_t ll_dequeue(ino_t thisinode, SUPER_BLOCK_ENTRY *this_entry)
+int32_t ll_enqueue(ino_t thisinode, char which_ll, SUPER_BLOCK_ENTRY *this_entry)
+{
+	sem_t *list_lock;
+	int32_t ret;
+
+	/* Leave the old list first, so only one list lock is held */
+	if ((this_entry->status != which_ll) &&
+	    (this_entry->status != NO_LL)) {
+		ret = ll_dequeue(thisinode, this_entry);
+		if (ret < 0)
+			return ret;
+	}
+
+	list_lock = _status_list_lock(which_ll);
+	if (list_lock != NULL)
+		sem_wait(list_lock);
+	ret = _ll_enqueue(thisinode, which_ll, this_entry);
+	if (list_lock != NULL)
+		sem_post(list_lock);
+	return ret;
+}
+
+/* Dequeue "this_entry" from its list. List lock of the list is held */
+static int32_t _ll_dequeue(ino_t thisinode, SUPER_BLOCK_ENTRY *this_entry)
 {
 	SUPER_BLOCK_ENTRY prev, next;
 	char old_which_ll;
@@ -1836,13 +2237,9 @@ int32_t ll_dequeue(ino_t thisinode, SUPER_BLOCK_ENTRY *this_entry)
 		}
 	} else {
 		temp_inode = this_entry->util_ll_next;
-		if (this_entry->status != IS_DIRTY || need_rebuild) {
-			ret = read_super_block_entry(temp_inode, &next);
-			if (ret < 0)
-				return ret;
-		}
-		next.util_ll_prev = this_entry->util_ll_prev;
-		ret = write_super_block_entry(temp_inode, &next);
+		ret = _set_entry_link(temp_inode,
+				      offsetof(SUPER_BLOCK_ENTRY, util_ll_prev),
+				      this_entry->util_ll_prev);
 		if (ret < 0)
 			return ret;
 	}
@@ -1862,13 +2259,9 @@ int32_t ll_dequeue(ino_t thisinode, SUPER_BLOCK_ENTRY *this_entry)
 		}
 	} else {
 		temp_inode = this_entry->util_ll_prev;
-		if (this_entry->status != IS_DIRTY || need_rebuild) {
-			ret = read_super_block_entry(temp_inode, &prev);
-			if (ret < 0)
-				return ret;
-		}
-		prev.util_ll_next = this_entry->util_ll_next;
-		ret = write_super_block_entry(temp_inode, &prev);
+		ret = _set_entry_link(temp_inode,
+				      offsetof(SUPER_BLOCK_ENTRY, util_ll_next),
+				      this_entry->util_ll_next);
 		if (ret < 0)
 			return ret;
 	}
@@ -1876,13 +2269,13 @@ int32_t ll_dequeue(ino_t thisinode, SUPER_BLOCK_ENTRY *this_entry)
 	switch (old_which_ll) {
 	case IS_DIRTY:
 		/* Update dirty meta size */
-		sys_super_block->head.num_dirty--;
+		SB_HEAD_COUNTER_ADD(num_dirty, -1);
 		change_system_meta(0, 0, 0, 0,
 			-(this_entry->dirty_meta_size), 0, TRUE);
 		this_entry->dirty_meta_size = 0;
 		break;
 	case TO_BE_DELETED:
-		sys_super_block->head.num_to_be_deleted--;
+		SB_HEAD_COUNTER_ADD(num_to_be_deleted, -1);
 		break;
 	default:
 		break;
@@ -1894,6 +2287,29 @@ int32_t ll_dequeue(ino_t thisinode, SUPER_BLOCK_ENTRY *this_entry)
 	return 0;
 }
 
+/************************************************************************
+*
+* Function name: ll_dequeue
+*        Inputs: ino_t thisinode, SUPER_BLOCK_ENTRY *this_entry
+*       Summary: Dequeue super block entry "this_entry" (with inode number
+*                "thisinode") from the current linked list.
+*  Return value: 0 if successful. Otherwise returns negation of error code.
+*
+*************************************************************************/
+int32_t ll_dequeue(ino_t thisinode, SUPER_BLOCK_ENTRY *this_entry)
+{
+	sem_t *list_lock;
+	int32_t ret;
+
+	list_lock = _status_list_lock(this_entry->status);
+	if (list_lock != NULL)
+		sem_wait(list_lock);
+	ret = _ll_dequeue(thisinode, this_entry);
+	if (list_lock != NULL)
+		sem_post(list_lock);
+	return ret;
+}
+
 /************************************************************************
 *
 * Function name: super_block_share_locking
@@ -1968,20 +2384,103 @@ int32_t super_block_exclusive_release(void)
 	return 0;
 }
 
-/**
- * Mark pin_status from ST_PINNING to ST_PIN
- *
- * This function is used when a file in super block pinning queue
- * finishes fetching all block from cloud to local. If the pin_status
- * is still ST_PINNING, it is dequeued from pinning queue and pin_status
- * will be changed to ST_PIN. In case that pin_status is ST_UNPIN,
- * ST_PIN, ST_DEL, ignore them and do nothing.
- *
- * @param this_inode Inode number to be mark as ST_PIN
- *
- * @return 0 on success, otherwise negative error code.
- */
-int32_t super_block_finish_pinning(ino_t this_inode)
+/* Helper for checking if entry update lock "index" guards any of the
+"num_inodes" inodes from "start_inode" */
+static BOOL _update_lock_in_range(int32_t index, ino_t start_inode,
+				  int64_t num_inodes)
+{
+	int64_t offset;
+
+	if (num_inodes >= SB_ENTRY_LOCK_NUM)
+		return TRUE;
+	offset = (index - (int64_t)(start_inode % SB_ENTRY_LOCK_NUM) +
+		  SB_ENTRY_LOCK_NUM) % SB_ENTRY_LOCK_NUM;
+	return (offset < num_inodes) ? TRUE : FALSE;
+}
+
+/************************************************************************
+*
+* Function name: super_block_update_lock_range
+*        Inputs: ino_t start_inode, int64_t num_inodes
+*       Summary: Locks the entry update locks of "num_inodes" inodes from
+*                "start_inode". Entries in the range can then be read and
+*                written back as a whole under the exclusive lock without
+*                losing updates done only under entry locks. Must be
+*                called before super_block_exclusive_locking.
+*  Return value: 0 if successful. Otherwise returns -1.
+*
+*************************************************************************/
+int32_t super_block_update_lock_range(ino_t start_inode, int64_t num_inodes)
+{
+	int32_t count;
+
+	if (num_inodes <= 0)
+		return -1;
+	/* Locked in the same order by everyone locking more than one */
+	for (count = 0; count < SB_ENTRY_LOCK_NUM; count++)
+		if (_update_lock_in_range(count, start_inode, num_inodes))
+			sem_wait(&(sys_super_block->entry_update_sem[count]));
+	return 0;
+}
+
+/************************************************************************
+*
+* Function name: super_block_update_release_range
+*        Inputs: ino_t start_inode, int64_t num_inodes
+*       Summary: Releases the locks locked by super_block_update_lock_range.
+*  Return value: 0 if successful. Otherwise returns -1.
+*
+*************************************************************************/
+int32_t super_block_update_release_range(ino_t start_inode,
+					 int64_t num_inodes)
+{
+	int32_t count;
+
+	if (num_inodes <= 0)
+		return -1;
+	for (count = 0; count < SB_ENTRY_LOCK_NUM; count++)
+		if (_update_lock_in_range(count, start_inode, num_inodes))
+			sem_post(&(sys_super_block->entry_update_sem[count]));
+	return 0;
+}
+
+/************************************************************************
+*
+* Function name: super_block_list_locking
+*        Inputs: int32_t which_list
+*       Summary: Locks linked list "which_list" (SB_LL_DIRTY,
+*                SB_LL_TO_DELETE or SB_LL_PIN) of the super block. This is
+*                enough for walking the list without modifying it.
+*  Return value: 0 if successful. Otherwise returns -1.
+*
+*************************************************************************/
+int32_t super_block_list_locking(int32_t which_list)
+{
+	if ((which_list < 0) || (which_list >= NUM_SB_LL))
+		return -1;
+	sem_wait(&(sys_super_block->list_lock_sem[which_list]));
+	return 0;
+}
+
+/************************************************************************
+*
+* Function name: super_block_list_release
+*        Inputs: int32_t which_list
+*       Summary: Releases the lock of linked list "which_list".
+*  Return value: 0 if successful. Otherwise returns -1.
+*
+*************************************************************************/
+int32_t super_block_list_release(int32_t which_list)
+{
+	if ((which_list < 0) || (which_list >= NUM_SB_LL))
+		return -1;
+	sem_post(&(sys_super_block->list_lock_sem[which_list]));
+	return 0;
+}
+
+/* Helper function for super_block_finish_pinning(). Entry update lock of
+	the entry is held */
+static int32_t _super_block_finish_pinning(ino_t this_inode)
 {
 	SUPER_BLOCK_ENTRY this_entry;
 	int32_t ret;
@@ -2022,29 +2521,35 @@ int32_t super_block_finish_pinning(ino_t this_inode)
 }
 
 /**
- * Let status of an inode be ST_PIN or ST_PINNING
+ * Mark pin_status from ST_PINNING to ST_PIN
  *
- * If the inode number with status ST_UNPIN, then it will be push into
- * pinning queue and set pin_status as ST_PINNING when it is a regfile.
- * Otherwise pin_status will be directly set to ST_PIN.
+ * This function is used when a file in super block pinning queue
+ * finishes fetching all block from cloud to local. If the pin_status
+ * is still ST_PINNING, it is dequeued from pinning queue and pin_status
+ * will be changed to ST_PIN. In case that pin_status is ST_UNPIN,
+ * ST_PIN, ST_DEL, ignore them and do nothing.
  *
- * @param this_inode Inode number to be handled
- * @param this_mode Mode of "this_inode"
+ * @param this_inode Inode number to be mark as ST_PIN
  *
  * @return 0 on success, otherwise negative error code.
  */
-int32_t super_block_mark_pin(ino_t this_inode, mode_t this_mode)
+int32_t super_block_finish_pinning(ino_t this_inode)
+{
+	int32_t ret;
+
+	sem_wait(_entry_update_lock(this_inode));
+	ret = _super_block_finish_pinning(this_inode);
+	sem_post(_entry_update_lock(this_inode));
+	return ret;
+}
+
+/* Helper function for super_block_mark_pin(). Entry update lock of the
+	entry is held */
+static int32_t _super_block_mark_pin(ino_t this_inode, mode_t this_mode)
 {
 	SUPER_BLOCK_ENTRY this_entry;
 	int32_t ret = 0;
 
-	/* Try fetching meta file from backend if in restoring mode */
-	if (hcfs_system->system_restoring == RESTORING_STAGE2) {
-		ret = restore_meta_super_block_entry(this_inode, NULL);
-		if (ret < 0)
-			return ret;
-	}
-
 	super_block_exclusive_locking();
 	ret = read_super_block_entry(this_inode, &this_entry);
 	if (ret < 0) {
@@ -2079,30 +2584,42 @@ int32_t super_block_mark_pin(ino_t this_inode, mode_t this_mode)
 }
 
 /**
- * Let status of an inode be ST_UNPIN
+ * Let status of an inode be ST_PIN or ST_PINNING
  *
- * If pin_status is ST_PINNING, it means the inode is in pinning queue, so
- * dequeue from the pinning queue and set status to ST_UNPIN. On the other
- * hand, ST_PIN means all blocks of the file are local, so just change the
- * status to ST_UNPIN directly.
+ * If the inode number with status ST_UNPIN, then it will be push into
+ * pinning queue and set pin_status as ST_PINNING when it is a regfile.
+ * Otherwise pin_status will be directly set to ST_PIN.
  *
  * @param this_inode Inode number to be handled
  * @param this_mode Mode of "this_inode"
  *
  * @return 0 on success, otherwise negative error code.
  */
-int32_t super_block_mark_unpin(ino_t this_inode, mode_t this_mode)
+int32_t super_block_mark_pin(ino_t this_inode, mode_t this_mode)
 {
-	SUPER_BLOCK_ENTRY this_entry;
 	int32_t ret;
 
-	/* Try fetching meta file from backend if in restoring mode */
+	/* Try fetching meta file from backend if in restoring mode. This
+	may rebuild the entry, so entry update lock is not held yet */
 	if (hcfs_system->system_restoring == RESTORING_STAGE2) {
 		ret = restore_meta_super_block_entry(this_inode, NULL);
 		if (ret < 0)
 			return ret;
 	}
 
+	sem_wait(_entry_update_lock(this_inode));
+	ret = _super_block_mark_pin(this_inode, this_mode);
+	sem_post(_entry_update_lock(this_inode));
+	return ret;
+}
+
+/* Helper function for super_block_mark_unpin(). Entry update lock of the
+	entry is held */
+static int32_t _super_block_mark_unpin(ino_t this_inode, mode_t this_mode)
+{
+	SUPER_BLOCK_ENTRY this_entry;
+	int32_t ret;
+
 	super_block_exclusive_locking();
 	ret = read_super_block_entry(this_inode, &this_entry);
 	if (ret < 0) {
@@ -2139,9 +2656,39 @@ int32_t super_block_mark_unpin(ino_t this_inode, mode_t this_mode)
 	return 0;
 }
 
+/**
+ * Let status of an inode be ST_UNPIN
+ *
+ * If pin_status is ST_PINNING, it means the inode is in pinning queue, so
+ * dequeue from the pinning queue and set status to ST_UNPIN. On the other
+ * hand, ST_PIN means all blocks of the file are local, so just change the
+ * status to ST_UNPIN directly.
+ *
+ * @param this_inode Inode number to be handled
+ * @param this_mode Mode of "this_inode"
+ *
+ * @return 0 on success, otherwise negative error code.
+ */
+int32_t super_block_mark_unpin(ino_t this_inode, mode_t this_mode)
+{
+	int32_t ret;
+
+	/* Try fetching meta file from backend if in restoring mode. This
+	may rebuild the entry, so entry update lock is not held yet */
+	if (hcfs_system->system_restoring == RESTORING_STAGE2) {
+		ret = restore_meta_super_block_entry(this_inode, NULL);
+		if (ret < 0)
+			return ret;
+	}
+
+	sem_wait(_entry_update_lock(this_inode));
+	ret = _super_block_mark_unpin(this_inode, this_mode);
+	sem_post(_entry_update_lock(this_inode));
+	return ret;
+}
+
 int32_t pin_ll_enqueue(ino_t this_inode, SUPER_BLOCK_ENTRY *this_entry)
 {
-	SUPER_BLOCK_ENTRY last_entry;
 	int32_t ret;
 	int32_t pause_status;
 
@@ -2150,6 +2697,7 @@ int32_t pin_ll_enqueue(ino_t this_inode, SUPER_BLOCK_ENTRY *this_entry)
 		return this_entry->pin_status;
 	}
 
+	sem_wait(&(sys_super_block->list_lock_sem[SB_LL_PIN]));
 	if (sys_super_block->head.last_pin_inode == 0) {
 		this_entry->pin_ll_next = 0;
 		this_entry->pin_ll_prev = 0;
@@ -2169,35 +2717,31 @@ int32_t pin_ll_enqueue(ino_t this_inode, SUPER_BLOCK_ENTRY *this_entry)
 		if (ret < 0)
 			goto error_handling;
 
-		ret = read_super_block_entry(
-			sys_super_block->head.last_pin_inode, &last_entry);
-		if (ret < 0)
-			goto error_handling;
-		last_entry.pin_ll_next = this_inode;
-		ret = write_super_block_entry(
-			sys_super_block->head.last_pin_inode, &last_entry);
+		ret = _set_entry_link(sys_super_block->head.last_pin_inode,
+				offsetof(SUPER_BLOCK_ENTRY, pin_ll_next),
+				this_inode);
 		if (ret < 0)
 			goto error_handling;
 
 		sys_super_block->head.last_pin_inode = this_inode;
 	}
 
-	sys_super_block->head.num_pinning_inodes++;
+	SB_HEAD_COUNTER_ADD(num_pinning_inodes, 1);
 	sem_check_and_release(&(hcfs_system->pin_wait_sem), &pause_status);
 
 	ret = write_super_block_head();
 	if (ret < 0)
 		goto error_handling;
 
-	return 0;
+	ret = 0;
 
 error_handling:
+	sem_post(&(sys_super_block->list_lock_sem[SB_LL_PIN]));
 	return ret;
 }
 
 int32_t pin_ll_dequeue(ino_t this_inode, SUPER_BLOCK_ENTRY *this_entry)
 {
-	SUPER_BLOCK_ENTRY prev_entry, next_entry;
 	ino_t prev_inode, next_inode;
 	int32_t ret;
 
@@ -2208,21 +2752,21 @@ int32_t pin_ll_dequeue(ino_t this_inode, SUPER_BLOCK_ENTRY *this_entry)
 
 	prev_inode = this_entry->pin_ll_prev;
 	next_inode = this_entry->pin_ll_next;
+	sem_wait(&(sys_super_block->list_lock_sem[SB_LL_PIN]));
 	if ((next_inode == 0) && (prev_inode == 0) &&
 		(sys_super_block->head.first_pin_inode != this_inode)) {
 		write_log(0, "Error: Inode %"PRIu64" is not in pinning "
 			"queue but be requested to dequeue. In %s\n",
 			(uint64_t)this_inode, __func__);
-		return -EIO;
+		ret = -EIO;
+		goto error_handling;
 	}
 
 	/* Handle prev pointer */
 	if (prev_inode != 0) {
-		ret = read_super_block_entry(prev_inode, &prev_entry);
-		if (ret < 0)
-			goto error_handling;
-		prev_entry.pin_ll_next = next_inode;
-		ret = write_super_block_entry(prev_inode, &prev_entry);
+		ret = _set_entry_link(prev_inode,
+				offsetof(SUPER_BLOCK_ENTRY, pin_ll_next),
+				next_inode);
 		if (ret < 0)
 			goto error_handling;
 	} else {
@@ -2231,11 +2775,9 @@ int32_t pin_ll_dequeue(ino_t this_inode, SUPER_BLOCK_ENTRY *this_entry)
 
 	/* Handle next pointer */
 	if (next_inode != 0) {
-		ret = read_super_block_entry(next_inode, &next_entry);
-		if (ret < 0)
-			goto error_handling;
-		next_entry.pin_ll_prev = prev_inode;
-		ret = write_super_block_entry(next_inode, &next_entry);
+		ret = _set_entry_link(next_inode,
+				offsetof(SUPER_BLOCK_ENTRY, pin_ll_prev),
+				prev_inode);
 		if (ret < 0)
 			goto error_handling;
 	} else {
@@ -2249,14 +2791,15 @@ int32_t pin_ll_dequeue(ino_t this_inode, SUPER_BLOCK_ENTRY *this_entry)
 	if (ret < 0)
 		goto error_handling;
 
-	sys_super_block->head.num_pinning_inodes--;
+	SB_HEAD_COUNTER_ADD(num_pinning_inodes, -1);
 	ret = write_super_block_head();
 	if (ret < 0)
 		goto error_handling;
 
-	return 0;
+	ret = 0;
 
 error_handling:
+	sem_post(&(sys_super_block->list_lock_sem[SB_LL_PIN]));
 	return ret;
 }
 
@@ -42,6 +42,27 @@
 #define ST_PINNING 2
 #define ST_PIN 3
 
+/* Number of locks shared by super block entries. An entry is guarded by
+lock (inode number % SB_ENTRY_LOCK_NUM) while being read or written */
+#define SB_ENTRY_LOCK_NUM 64
+
+/* Linked lists in super block that have their own locks */
+#define SB_LL_DIRTY 0
+#define SB_LL_TO_DELETE 1
+#define SB_LL_PIN 2
+#define NUM_SB_LL 3
+
+/* Counters in super block head are updated atomically, so that they can
+be checked without locking super block */
+#define SB_HEAD_COUNTER(field) \
+	__atomic_load_n(&(sys_super_block->head.field), __ATOMIC_RELAXED)
+#define SB_HEAD_COUNTER_ADD(field, delta) \
+	__atomic_add_fetch(&(sys_super_block->head.field), (delta), \
+			   __ATOMIC_RELAXED)
+#define SB_HEAD_COUNTER_SET(field, value) \
+	__atomic_store_n(&(sys_super_block->head.field), (value), \
+			 __ATOMIC_RELAXED)
+
 /* Struct to track the status of queue recovery in superblock */
 typedef struct SB_RECOVERY_META {
 	BOOL is_ongoing; /* Super Block entries recovery ongoing */
@@ -99,6 +120,38 @@ typedef struct {
 	int64_t num_active_inodes;
 } SUPER_BLOCK_HEAD;
 
+/* The mapping of the super block file is SB_MAP_GROWTH times the size of
+the file, at least SB_MAP_MIN_LEN, and is grown the same way when the file
+outgrows it. Entries beyond SB_MAP_MAX_LEN, or beyond the mapping if it
+cannot grow, are accessed with pread/pwrite */
+#define SB_MAP_MIN_LEN (4LL * 1024 * 1024)
+#define SB_MAP_GROWTH 2
+#define SB_MAP_MAX_LEN \
+	((sizeof(void *) >= 8) ? (4LL * 1024 * 1024 * 1024) : \
+	 (256LL * 1024 * 1024))
+/* Mappings replaced by a larger one at a different address. They are
+only unmapped at unmount, as readers might still be using them. */
+#define SB_MAP_MAX_RETIRED 16
+
+/* SB_MAP defines the shared mapping of the super block file used by
+this process */
+typedef struct {
+	char *addr;
+	int64_t len;
+	char *retired_addr[SB_MAP_MAX_RETIRED];
+	int64_t retired_len[SB_MAP_MAX_RETIRED];
+	int32_t num_retired;
+	/* Bytes from the start of the file that are allocated on disk, and
+	so can be accessed through the mapping */
+	int64_t valid_len;
+	/* Set once fallocate fails. valid_len is then no longer extended,
+	and accesses beyond it go to pread/pwrite without taking map_sem */
+	BOOL alloc_failed;
+	/* File descriptor the mapping belongs to */
+	int32_t fd;
+	sem_t map_sem;
+} SB_MAP;
+
 /* SUPER_BLOCK_CONTROL defines the structure for controling super block */
 typedef struct {
 	SUPER_BLOCK_HEAD head;
@@ -109,6 +162,18 @@ typedef struct {
 	sem_t share_lock_sem;
 	sem_t share_CR_lock_sem;
 	int32_t share_counter;
+	/* Entry locks are only held while copying an entry, or while
+	updating an entry in place, and no other lock is taken meanwhile */
+	sem_t entry_lock_sem[SB_ENTRY_LOCK_NUM];
+	/* Serializes updates of an entry that cannot be done within one
+	entry lock section. Taken before the exclusive lock. At most one
+	is held, except by super_block_update_lock_range that locks them
+	in index order */
+	sem_t entry_update_sem[SB_ENTRY_LOCK_NUM];
+	/* Guards first/last inode and counter of each linked list. Taken
+	after exclusive lock when modifying a list. Readers of a list only
+	need the list lock */
+	sem_t list_lock_sem[NUM_SB_LL];
 	BOOL now_reclaim_fullscan;
 	BOOL sync_point_is_set; /* Indicate if need to sync all data */
 	struct SYNC_POINT_INFO *sync_point_info; /* NULL if no sync point */
@@ -142,11 +207,18 @@ int32_t write_super_block_entry(ino_t this_inode, SUPER_BLOCK_ENTRY *inode_ptr);
 
 int32_t super_block_update_transit(ino_t this_inode, BOOL is_start_transit,
 	char transit_incomplete);
+int32_t super_block_start_transit(ino_t this_inode,
+				  SUPER_BLOCK_ENTRY *inode_ptr);
 int32_t super_block_mark_dirty(ino_t this_inode);
 int32_t super_block_share_locking(void);
 int32_t super_block_share_release(void);
 int32_t super_block_exclusive_locking(void);
 int32_t super_block_exclusive_release(void);
+int32_t super_block_update_lock_range(ino_t start_inode, int64_t num_inodes);
+int32_t super_block_update_release_range(ino_t start_inode,
+					 int64_t num_inodes);
+int32_t super_block_list_locking(int32_t which_list);
+int32_t super_block_list_release(int32_t which_list);
 
 int32_t super_block_finish_pinning(ino_t this_inode);
 int32_t super_block_mark_pin(ino_t this_inode, mode_t this_mode);
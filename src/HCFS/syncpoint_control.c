@@ -214,6 +214,7 @@ void check_sync_complete(char which_ll, ino_t this_inode)
 	SYNC_POINT_DATA *data;
 	BOOL sync_complete;
 	pthread_t event_thread;
+	pthread_attr_t event_attr;
 	int32_t ret;
 
 	data = &(sys_super_block->sync_point_info->data);
@@ -271,10 +272,13 @@ void check_sync_complete(char which_ll, ino_t this_inode)
 		} else if (ret > 0) {
 			write_log(4, "Warn: Retry to send "
 					"sync_complete event\n");
-			ret = pthread_create(&event_thread,
-					&prefetch_thread_attr,
+			pthread_attr_init(&event_attr);
+			pthread_attr_setdetachstate(&event_attr,
+					PTHREAD_CREATE_DETACHED);
+			ret = pthread_create(&event_thread, &event_attr,
 					(void *)&sync_complete_send_event,
 					NULL);
+			pthread_attr_destroy(&event_attr);
 			if (ret != 0) {
 				write_log(0, "Error: Fail to create"
 						" thread in %s. Code %d\n",
@@ -97,7 +97,7 @@ int32_t change_block_status_to_BOTH(ino_t inode, int64_t blockno,
 	if (local_status == ST_LtoC && local_seq == toupload_seq) {
 		tmp_page.block_entries[e_index].status = ST_BOTH;
 		tmp_page.block_entries[e_index].uploaded = TRUE;
-		if (CURRENT_BACKEND == GOOGLEDRIVE)
+		if (BLOCK_ID_IS_RECORDED && (blockid != NULL))
 			strncpy(tmp_page.block_entries[e_index].blockID,
 				blockid, 64);
 		ret = fetch_block_path(blockpath, inode, blockno);
@@ -459,7 +459,7 @@ int delete_backend_blocks(int progress_fd, long long total_blocks, ino_t inode,
 			block_info, block_objid, inode);
 #else
 		block_seq = 0;
-		if (CURRENT_BACKEND == GOOGLEDRIVE)
+		if (BLOCK_ID_IS_RECORDED)
 			ret =
 			    _choose_deleted_block(delete_which_one, block_info,
 						  &block_seq, blockID, inode);
@@ -475,7 +475,7 @@ int delete_backend_blocks(int progress_fd, long long total_blocks, ino_t inode,
 				page_pos != 0) {
 			/* In case of deleting those blocks just uploaded,
 			 * try to revert block status if needed. */
-			if (CURRENT_BACKEND == GOOGLEDRIVE)
+			if (BLOCK_ID_IS_RECORDED)
 				ret = _revert_block_status(
 				    local_metafptr, inode, block_count,
 				    page_pos, e_index, blockID);
@@ -508,7 +508,7 @@ int delete_backend_blocks(int progress_fd, long long total_blocks, ino_t inode,
 			inode, block_count, block_seq,
 			page_pos, e_index, progress_fd, delete_which_one);
 #endif
-		if (CURRENT_BACKEND == GOOGLEDRIVE) {
+		if (BLOCK_ID_IS_RECORDED) {
 			UPLOAD_THREAD_TYPE *upload_ptr =
 			    &(upload_ctl.upload_threads[which_curl]);
 			memset(&(upload_ptr->gdrive_obj_info), 0,
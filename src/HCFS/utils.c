@@ -45,6 +45,8 @@
 #include "hcfs_tocloud.h"
 #include "hcfs_clouddelete.h"
 #include "hcfs_cacheops.h"
+#include "hcfs_cachebuild.h"
+#include "cache_policy.h"
 #include "monitor.h"
 #include "FS_manager.h"
 #include "mount_manager.h"
@@ -369,6 +371,8 @@ int32_t read_system_config(const char *config_path, SYSTEM_CONF_STRUCT *config)
 	config->first_upload_delay = DEFAULT_FIRST_UPLOAD_DELAY;
 	config->normal_upload_delay = DEFAULT_NORMAL_UPLOAD_DELAY;
 	config->sync_nonbusy_pause_time = DEFAULT_SYNC_NONBUSY_PAUSE_TIME;
+	config->cache_replace_policy = CACHE_POLICY_2Q;
+	config->path_cache_mem_limit = DEFAULT_PATH_CACHE_MEM_LIMIT;
 
 	while (!feof(fptr)) {
 		ret_ptr = fgets(tempbuf, 180, fptr);
@@ -584,6 +588,17 @@ int32_t read_system_config(const char *config_path, SYSTEM_CONF_STRUCT *config)
 			config->sync_nonbusy_pause_time = temp_val;
 			continue;
 		}
+		if (strcasecmp(argname, "path_cache_mem_limit") == 0) {
+			errno = 0;
+			temp_val = strtoll(argval, &num_check_ptr, 10);
+			if ((errno != 0) || (*num_check_ptr != '\0')) {
+				fclose(fptr);
+				write_log(0, "Number conversion error: %s\n", argname);
+				return -1;
+			}
+			config->path_cache_mem_limit = temp_val;
+			continue;
+		}
 		if (strcasecmp(argname, "current_backend") == 0) {
 			config->current_backend = -1;
 			if (strcasecmp(argval, "SWIFT") == 0)
@@ -603,6 +618,35 @@ int32_t read_system_config(const char *config_path, SYSTEM_CONF_STRUCT *config)
 			}
 			continue;
 		}
+		if (strcasecmp(argname, "cache_replace_policy") == 0) {
+			config->cache_replace_policy = -1;
+			if (strcasecmp(argval, "INODE") == 0)
+				config->cache_replace_policy =
+					CACHE_POLICY_INODE;
+			if (strcasecmp(argval, "LRU") == 0)
+				config->cache_replace_policy = CACHE_POLICY_LRU;
+			if (strcasecmp(argval, "2Q") == 0)
+				config->cache_replace_policy = CACHE_POLICY_2Q;
+			if (config->cache_replace_policy == -1) {
+				fclose(fptr);
+				write_log(0, "Unsupported cache replace policy\n");
+				return -1;
+			}
+			continue;
+		}
+		if (strcasecmp(argname, "cache_access_trace") == 0) {
+			config->cache_access_trace =
+			    (char *)malloc(strlen(argval) + 10);
+			if (!config->cache_access_trace) {
+				write_log(0,
+					"Out of memory when reading config\n");
+				fclose(fptr);
+				return -1;
+			}
+			snprintf(config->cache_access_trace,
+				 strlen(argval) + 10, "%s", argval);
+			continue;
+		}
 		/* Check if there is google drive folder name */
 		if (strcasecmp(argname, "googledrive_folder") == 0) {
 			config->googledrive_folder =
@@ -928,6 +972,10 @@ int32_t validate_system_config(SYSTEM_CONF_STRUCT *config)
 		write_log(0, "Meta space limit cannot be zero or less.\n");
 		return -1;
 	}
+	if (config->path_cache_mem_limit <= 0) {
+		write_log(0, "Path cache memory limit cannot be zero or less.\n");
+		return -1;
+	}
 	if (config->cache_update_delta < config->max_block_size) {
 		write_log(0, "cache_delta must be at least max_block_size\n");
 		return -1;
@@ -1228,6 +1276,22 @@ int32_t change_system_meta(int64_t system_size_delta,
 			sem_post(&(hcfs_system->something_to_replace));
 	}
 
+	/* Wake up cache management if replacement should start, or if
+	threads waiting on full cache might continue now */
+	if (cache_data_size_delta != 0) {
+		int32_t semval = 0;
+
+		if (cache_data_size_delta > 0)
+			semval = (hcfs_system->systemdata.cache_size >=
+				  CACHE_SOFT_LIMIT) ? 1 : 0;
+		else
+			sem_getvalue(&(hcfs_system->num_cache_sleep_sem),
+				     &semval);
+		if (semval > 0)
+			sem_check_and_release(&(hcfs_system->cache_event_sem),
+					      &semval);
+	}
+
 	ret = 0;
 	if (need_sync) {
 		ret = sync_hcfs_system_data(TRUE);
@@ -1497,7 +1561,7 @@ int32_t update_fs_backend_usage(FILE *fptr, int64_t fs_total_size_delta,
 	if (fs_cloud_stat.backend_num_inodes < 0)
 		fs_cloud_stat.backend_num_inodes = 0;
 
-	fs_cloud_stat.max_inode = sys_super_block->head.num_total_inodes + 1;
+	fs_cloud_stat.max_inode = SB_HEAD_COUNTER(num_total_inodes) + 1;
 
 	fs_cloud_stat.pinned_size += fs_pin_size_delta;
 	if (fs_cloud_stat.pinned_size < 0)
@@ -1919,6 +1983,8 @@ int32_t update_file_stats(FILE *metafptr, int64_t num_blocks_delta,
 	//FSEEK(metafptr, sizeof(HCFS_STAT) + sizeof(FILE_META_TYPE),
 	//	SEEK_SET);
 	//FWRITE(&meta_stats, sizeof(FILE_STATS_TYPE), 1, metafptr);
+	cache_usage_index_update(thisinode, meta_stats.cached_size,
+				 meta_stats.dirty_data_size);
 
 	diffstats.num_local = newdirstats.num_local - olddirstats.num_local;
 	diffstats.num_cloud = newdirstats.num_cloud - olddirstats.num_cloud;
@@ -2039,7 +2105,8 @@ int32_t _check_config(const SYSTEM_CONF_STRUCT *new_config)
 	free(name->superblock_name); \
 	free(name->unclaimed_name); \
 	free(name->hcfssystem_name); \
-	free(name->hcfspausesync_name);
+	free(name->hcfspausesync_name); \
+	free(name->cache_access_trace);
 
 /**
  * reload_system_config
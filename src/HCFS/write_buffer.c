@@ -0,0 +1,489 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Write-back buffers for small sequential writes. Each small write used to
+* lock the meta cache entry, update the block status, pwrite the block file
+* and update the file size and mount statistics. Sequential small writes
+* through a file handle are now collected in a per-inode buffer, and are
+* applied as one write when the next write does not continue the buffered
+* range, the buffer reaches a block boundary or WRITE_BUFFER_SIZE, the data
+* is older than WRITE_BUFFER_MAX_AGE_MS, or the file is synced, flushed,
+* closed, read or changed otherwise. Stat of the file only adds the size
+* and times of buffered writes, see write_buffer_update_stat().
+*
+* There is at most one buffer per inode, so buffered data is always
+* flushed before any other write to the same file. A failed flush is kept
+* in the buffer and reported to the next fsync or flush of the handle that
+* wrote the data. */
+
+#include "write_buffer.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fuseop.h"
+#include "logger.h"
+#include "macro.h"
+#include "params.h"
+
+static WRITE_BUFFER_CTL write_buffer_ctl;
+
+static inline uint32_t _write_buffer_hash(ino_t this_inode)
+{
+	return (uint32_t)((uint64_t)this_inode % WRITE_BUFFER_HASH_SIZE);
+}
+
+static int64_t _elapsed_ms(const struct timespec *since)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)(now.tv_sec - since->tv_sec) * 1000 +
+	       (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+static void _free_write_buffer(WRITE_BUFFER *wbuf)
+{
+	sem_destroy(&(wbuf->buf_sem));
+	free(wbuf->data);
+	free(wbuf);
+}
+
+/* Get a reference to the buffer of "this_inode". A new one is created if
+* "create" is TRUE and there is room for it. */
+static WRITE_BUFFER *_get_write_buffer(ino_t this_inode, BOOL create)
+{
+	WRITE_BUFFER *wbuf;
+	uint32_t index;
+
+	index = _write_buffer_hash(this_inode);
+	sem_wait(&(write_buffer_ctl.table_sem));
+	wbuf = write_buffer_ctl.hash_table[index];
+	while (wbuf != NULL) {
+		if (wbuf->this_inode == this_inode) {
+			wbuf->refcount++;
+			sem_post(&(write_buffer_ctl.table_sem));
+			return wbuf;
+		}
+		wbuf = wbuf->hash_next;
+	}
+
+	if ((create == FALSE) ||
+	    (write_buffer_ctl.num_buffers >= MAX_WRITE_BUFFERS)) {
+		sem_post(&(write_buffer_ctl.table_sem));
+		return NULL;
+	}
+
+	wbuf = calloc(1, sizeof(WRITE_BUFFER));
+	if (wbuf == NULL) {
+		sem_post(&(write_buffer_ctl.table_sem));
+		return NULL;
+	}
+	wbuf->data = malloc(WRITE_BUFFER_SIZE);
+	if (wbuf->data == NULL) {
+		sem_post(&(write_buffer_ctl.table_sem));
+		free(wbuf);
+		return NULL;
+	}
+	wbuf->this_inode = this_inode;
+	wbuf->fh = -1;
+	wbuf->refcount = 1;
+	sem_init(&(wbuf->buf_sem), 0, 1);
+	wbuf->hash_next = write_buffer_ctl.hash_table[index];
+	write_buffer_ctl.hash_table[index] = wbuf;
+	write_buffer_ctl.num_buffers++;
+	sem_post(&(write_buffer_ctl.table_sem));
+
+	return wbuf;
+}
+
+/* Unlock "wbuf" and return the reference. Buffers without data or errors
+* are removed from the table. Caller must hold buf_sem. */
+static void _release_write_buffer(WRITE_BUFFER *wbuf)
+{
+	WRITE_BUFFER **prev_ptr;
+	BOOL free_now;
+
+	sem_wait(&(write_buffer_ctl.table_sem));
+	if ((wbuf->removed == FALSE) && (wbuf->size == 0) &&
+	    (wbuf->errcode == 0)) {
+		prev_ptr = &(write_buffer_ctl.hash_table[
+				_write_buffer_hash(wbuf->this_inode)]);
+		while (*prev_ptr != NULL) {
+			if (*prev_ptr == wbuf) {
+				*prev_ptr = wbuf->hash_next;
+				break;
+			}
+			prev_ptr = &((*prev_ptr)->hash_next);
+		}
+		wbuf->hash_next = NULL;
+		wbuf->removed = TRUE;
+		write_buffer_ctl.num_buffers--;
+	}
+	wbuf->refcount--;
+	free_now = ((wbuf->refcount == 0) && (wbuf->removed == TRUE));
+	sem_post(&(write_buffer_ctl.table_sem));
+	sem_post(&(wbuf->buf_sem));
+
+	if (free_now == TRUE)
+		_free_write_buffer(wbuf);
+}
+
+/* Write out buffered data. Caller must hold buf_sem. */
+static int32_t _flush_write_buffer(WRITE_BUFFER *wbuf)
+{
+	int64_t ret;
+
+	if (wbuf->size == 0)
+		return 0;
+
+	ret = write_buffered_data(wbuf->mptr, wbuf->this_inode, wbuf->data,
+				  wbuf->size, wbuf->offset);
+	if ((ret >= 0) && (ret < (int64_t)wbuf->size))
+		ret = -EIO;
+	wbuf->size = 0;
+	if (ret < 0) {
+		write_log(0, "Error: Fail to flush write buffer of inode %"
+			  PRIu64 ". Code %" PRId64 "\n",
+			  (uint64_t)wbuf->this_inode, -ret);
+		wbuf->errcode = (int32_t)ret;
+		return (int32_t)ret;
+	}
+	return 0;
+}
+
+static BOOL _can_append(const WRITE_BUFFER *wbuf, int64_t fh, size_t size,
+			off_t offset)
+{
+	if (wbuf->fh != fh)
+		return FALSE;
+	if (offset != wbuf->offset + (off_t)wbuf->size)
+		return FALSE;
+	if (wbuf->size + size > WRITE_BUFFER_SIZE)
+		return FALSE;
+	if ((wbuf->offset / MAX_BLOCK_SIZE) != (offset / MAX_BLOCK_SIZE))
+		return FALSE;
+	if (_elapsed_ms(&(wbuf->first_write)) >= WRITE_BUFFER_MAX_AGE_MS)
+		return FALSE;
+	return TRUE;
+}
+
+/* Check if flushing all buffers could exceed the system quota or the
+* pinned space. Writes to pinned files fail with ENOSPC when pinned space
+* runs out, and the pin status of the file is not known here, so nothing
+* is buffered then and the write path checks the write itself. */
+static BOOL _may_run_out_of_space(void)
+{
+	int64_t max_buffered, max_pinned_size;
+
+	max_buffered = (int64_t)MAX_WRITE_BUFFERS * WRITE_BUFFER_SIZE;
+	if (hcfs_system->systemdata.system_size + max_buffered >
+	    hcfs_system->systemdata.system_quota)
+		return TRUE;
+
+	max_pinned_size = PINNED_LIMITS(P_PIN);
+	if (PINNED_LIMITS(P_HIGH_PRI_PIN) < max_pinned_size)
+		max_pinned_size = PINNED_LIMITS(P_HIGH_PRI_PIN);
+	if (hcfs_system->systemdata.pinned_size + max_buffered >
+	    max_pinned_size)
+		return TRUE;
+	return FALSE;
+}
+
+static void *_write_buffer_flusher(void *ptr)
+{
+	struct timespec wait_time;
+	BOOL terminating;
+
+	UNUSED(ptr);
+	while (TRUE) {
+		clock_gettime(CLOCK_REALTIME, &wait_time);
+		wait_time.tv_nsec +=
+		    (int64_t)WRITE_BUFFER_FLUSH_INTERVAL_MS * 1000000;
+		wait_time.tv_sec += wait_time.tv_nsec / 1000000000;
+		wait_time.tv_nsec %= 1000000000;
+		sem_timedwait(&(write_buffer_ctl.wakeup_sem), &wait_time);
+
+		sem_wait(&(write_buffer_ctl.table_sem));
+		terminating = write_buffer_ctl.terminating;
+		sem_post(&(write_buffer_ctl.table_sem));
+		if (terminating == TRUE)
+			break;
+
+		write_buffer_flush_all(TRUE);
+	}
+	return NULL;
+}
+
+int32_t init_write_buffer(void)
+{
+	int32_t ret;
+
+	memset(&write_buffer_ctl, 0, sizeof(WRITE_BUFFER_CTL));
+	sem_init(&(write_buffer_ctl.table_sem), 0, 1);
+	sem_init(&(write_buffer_ctl.wakeup_sem), 0, 0);
+
+	ret = pthread_create(&(write_buffer_ctl.flush_thread), NULL,
+			     &_write_buffer_flusher, NULL);
+	if (ret != 0) {
+		write_log(0, "Error: Fail to create write buffer thread. "
+			  "Code %d\n", ret);
+		return -ret;
+	}
+	return 0;
+}
+
+void destroy_write_buffer(void)
+{
+	sem_wait(&(write_buffer_ctl.table_sem));
+	write_buffer_ctl.terminating = TRUE;
+	sem_post(&(write_buffer_ctl.table_sem));
+	sem_post(&(write_buffer_ctl.wakeup_sem));
+	pthread_join(write_buffer_ctl.flush_thread, NULL);
+
+	write_buffer_flush_all(FALSE);
+}
+
+/************************************************************************
+*
+* Function name: write_buffer_append
+*        Inputs: MOUNT_T *mptr, ino_t this_inode, int64_t fh,
+*                const char *buf, size_t size, off_t offset
+*       Summary: Try to absorb a write of "size" bytes at "offset" through
+*                file handle "fh" into the write buffer of "this_inode".
+*                Buffered data that cannot be merged with the write is
+*                written out first. Caller must hold block_sem of "fh".
+*  Return value: "size" if buffered, 0 if the caller should write the
+*                data itself, or negation of error code.
+*
+*************************************************************************/
+int64_t write_buffer_append(MOUNT_T *mptr, ino_t this_inode, int64_t fh,
+			    const char *buf, size_t size, off_t offset)
+{
+	WRITE_BUFFER *wbuf;
+	BOOL can_buffer;
+	int32_t ret;
+
+	can_buffer = TRUE;
+	if ((size > MAX_BUFFERED_WRITE_SIZE) ||
+	    ((offset / MAX_BLOCK_SIZE) !=
+	     ((offset + (off_t)size - 1) / MAX_BLOCK_SIZE)))
+		can_buffer = FALSE;
+	/* Let the write path report running out of space right away */
+	if (_may_run_out_of_space() == TRUE)
+		can_buffer = FALSE;
+
+	while (TRUE) {
+		wbuf = _get_write_buffer(this_inode, can_buffer);
+		if (wbuf == NULL)
+			return 0;
+		sem_wait(&(wbuf->buf_sem));
+		if (wbuf->removed == FALSE)
+			break;
+		/* Emptied and dropped meanwhile */
+		_release_write_buffer(wbuf);
+		if (can_buffer == FALSE)
+			return 0;
+	}
+
+	if ((wbuf->size > 0) &&
+	    ((can_buffer == FALSE) ||
+	     (_can_append(wbuf, fh, size, offset) == FALSE))) {
+		ret = _flush_write_buffer(wbuf);
+		if ((ret < 0) && (wbuf->fh == fh)) {
+			wbuf->errcode = 0;
+			_release_write_buffer(wbuf);
+			return ret;
+		}
+	}
+
+	/* Errors of other handles stay until they are reported */
+	if ((can_buffer == FALSE) || (wbuf->errcode != 0)) {
+		_release_write_buffer(wbuf);
+		return 0;
+	}
+
+	if (wbuf->size == 0) {
+		wbuf->mptr = mptr;
+		wbuf->fh = fh;
+		wbuf->offset = offset;
+		clock_gettime(CLOCK_MONOTONIC, &(wbuf->first_write));
+	}
+	memcpy(wbuf->data + wbuf->size, buf, size);
+	wbuf->size += size;
+	clock_gettime(CLOCK_REALTIME, &(wbuf->last_write));
+
+	if ((((offset + (off_t)size) % MAX_BLOCK_SIZE) == 0) ||
+	    (wbuf->size + MAX_BUFFERED_WRITE_SIZE > WRITE_BUFFER_SIZE)) {
+		ret = _flush_write_buffer(wbuf);
+		if (ret < 0) {
+			wbuf->errcode = 0;
+			_release_write_buffer(wbuf);
+			return ret;
+		}
+	}
+
+	_release_write_buffer(wbuf);
+	return (int64_t)size;
+}
+
+/************************************************************************
+*
+* Function name: write_buffer_flush_inode
+*        Inputs: ino_t this_inode
+*       Summary: Write out buffered data of "this_inode", so that its size
+*                and content can be looked at. Errors are still kept for
+*                the handle that wrote the data.
+*  Return value: 0 if successful, or negation of error code.
+*
+*************************************************************************/
+int32_t write_buffer_flush_inode(ino_t this_inode)
+{
+	WRITE_BUFFER *wbuf;
+	int32_t ret;
+
+	if (write_buffer_ctl.num_buffers == 0)
+		return 0;
+
+	wbuf = _get_write_buffer(this_inode, FALSE);
+	if (wbuf == NULL)
+		return 0;
+	sem_wait(&(wbuf->buf_sem));
+	ret = 0;
+	if (wbuf->removed == FALSE)
+		ret = _flush_write_buffer(wbuf);
+	_release_write_buffer(wbuf);
+	return ret;
+}
+
+/************************************************************************
+*
+* Function name: write_buffer_update_stat
+*        Inputs: ino_t this_inode, HCFS_STAT *thisstat
+*       Summary: Add buffered writes of "this_inode" to "thisstat" read
+*                from the meta, without writing the data out. Size and
+*                blocks grow to the end of the buffered range, and mtime
+*                and ctime are set to the time of the last buffered write.
+*  Return value: None
+*
+*************************************************************************/
+void write_buffer_update_stat(ino_t this_inode, HCFS_STAT *thisstat)
+{
+	WRITE_BUFFER *wbuf;
+	off_t end_pos;
+
+	if (write_buffer_ctl.num_buffers == 0)
+		return;
+
+	wbuf = _get_write_buffer(this_inode, FALSE);
+	if (wbuf == NULL)
+		return;
+	sem_wait(&(wbuf->buf_sem));
+	if ((wbuf->removed == FALSE) && (wbuf->size > 0)) {
+		end_pos = wbuf->offset + (off_t)wbuf->size;
+		if (thisstat->size < end_pos) {
+			thisstat->size = end_pos;
+			thisstat->blocks = (thisstat->size + 511) / 512;
+		}
+		thisstat->mtime = wbuf->last_write.tv_sec;
+		thisstat->mtime_nsec = wbuf->last_write.tv_nsec;
+		thisstat->ctime = wbuf->last_write.tv_sec;
+		thisstat->ctime_nsec = wbuf->last_write.tv_nsec;
+	}
+	_release_write_buffer(wbuf);
+}
+
+/************************************************************************
+*
+* Function name: write_buffer_flush_fh
+*        Inputs: ino_t this_inode, int64_t fh
+*       Summary: Write out buffered data of "this_inode" for fsync, flush
+*                or release of file handle "fh", and collect the error of
+*                earlier failed flushes of data written through "fh".
+*  Return value: 0 if successful, or negation of error code.
+*
+*************************************************************************/
+int32_t write_buffer_flush_fh(ino_t this_inode, int64_t fh)
+{
+	WRITE_BUFFER *wbuf;
+	int32_t ret;
+
+	if (write_buffer_ctl.num_buffers == 0)
+		return 0;
+
+	wbuf = _get_write_buffer(this_inode, FALSE);
+	if (wbuf == NULL)
+		return 0;
+	sem_wait(&(wbuf->buf_sem));
+	ret = 0;
+	if (wbuf->removed == FALSE) {
+		_flush_write_buffer(wbuf);
+		if (wbuf->fh == fh) {
+			ret = wbuf->errcode;
+			wbuf->errcode = 0;
+		}
+	}
+	_release_write_buffer(wbuf);
+	return ret;
+}
+
+/************************************************************************
+*
+* Function name: write_buffer_flush_all
+*        Inputs: BOOL expired_only
+*       Summary: Write out all buffered data, or only data older than
+*                WRITE_BUFFER_MAX_AGE_MS if "expired_only" is TRUE.
+*  Return value: 0 if successful, or the first error met.
+*
+*************************************************************************/
+int32_t write_buffer_flush_all(BOOL expired_only)
+{
+	WRITE_BUFFER *wbuf, *flush_list[MAX_WRITE_BUFFERS];
+	int32_t count, num_flush, ret, errcode;
+
+	num_flush = 0;
+	sem_wait(&(write_buffer_ctl.table_sem));
+	for (count = 0; count < WRITE_BUFFER_HASH_SIZE; count++) {
+		wbuf = write_buffer_ctl.hash_table[count];
+		while ((wbuf != NULL) && (num_flush < MAX_WRITE_BUFFERS)) {
+			wbuf->refcount++;
+			flush_list[num_flush++] = wbuf;
+			wbuf = wbuf->hash_next;
+		}
+	}
+	sem_post(&(write_buffer_ctl.table_sem));
+
+	errcode = 0;
+	for (count = 0; count < num_flush; count++) {
+		wbuf = flush_list[count];
+		sem_wait(&(wbuf->buf_sem));
+		if ((wbuf->removed == FALSE) && (wbuf->size > 0) &&
+		    ((expired_only == FALSE) ||
+		     (_elapsed_ms(&(wbuf->first_write)) >=
+		      WRITE_BUFFER_MAX_AGE_MS))) {
+			ret = _flush_write_buffer(wbuf);
+			if ((ret < 0) && (errcode == 0))
+				errcode = ret;
+		}
+		_release_write_buffer(wbuf);
+	}
+	return errcode;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef GW20_HCFS_WRITE_BUFFER_H_
+#define GW20_HCFS_WRITE_BUFFER_H_
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "global.h"
+#include "meta.h"
+#include "mount_manager.h"
+
+/* Max bytes held by one write buffer */
+#define WRITE_BUFFER_SIZE (128 * 1024)
+/* Writes larger than this are never buffered */
+#define MAX_BUFFERED_WRITE_SIZE (32 * 1024)
+/* Max number of inodes with buffered data */
+#define MAX_WRITE_BUFFERS 32
+#define WRITE_BUFFER_HASH_SIZE 64
+/* Buffered data older than this (in milliseconds) is written out */
+#define WRITE_BUFFER_MAX_AGE_MS 500
+#define WRITE_BUFFER_FLUSH_INTERVAL_MS 250
+
+typedef struct WRITE_BUFFER {
+	ino_t this_inode;
+	MOUNT_T *mptr;
+	/* File handle the buffered data was written through */
+	int64_t fh;
+	off_t offset;
+	size_t size;
+	struct timespec first_write;
+	/* Wall clock time of the last buffered write, for mtime and ctime */
+	struct timespec last_write;
+	char *data;
+	/* Error of a failed flush, kept for the next fsync or flush of fh */
+	int32_t errcode;
+	/* buf_sem protects the fields above */
+	sem_t buf_sem;
+	/* Following fields are protected by table_sem */
+	int32_t refcount;
+	BOOL removed;
+	struct WRITE_BUFFER *hash_next;
+} WRITE_BUFFER;
+
+typedef struct {
+	sem_t table_sem;
+	WRITE_BUFFER *hash_table[WRITE_BUFFER_HASH_SIZE];
+	int32_t num_buffers;
+	BOOL terminating;
+	sem_t wakeup_sem;
+	pthread_t flush_thread;
+} WRITE_BUFFER_CTL;
+
+int32_t init_write_buffer(void);
+void destroy_write_buffer(void);
+int64_t write_buffer_append(MOUNT_T *mptr, ino_t this_inode, int64_t fh,
+			    const char *buf, size_t size, off_t offset);
+int32_t write_buffer_flush_inode(ino_t this_inode);
+void write_buffer_update_stat(ino_t this_inode, HCFS_STAT *thisstat);
+int32_t write_buffer_flush_fh(ino_t this_inode, int64_t fh);
+int32_t write_buffer_flush_all(BOOL expired_only);
+
+/* Implemented in fuseop.c. Writes data to the file as a single write
+request. Returns bytes written or negative error code. */
+int64_t write_buffered_data(MOUNT_T *mptr, ino_t this_inode,
+			    const char *buf, size_t size, off_t offset);
+
+#endif  /* GW20_HCFS_WRITE_BUFFER_H_ */
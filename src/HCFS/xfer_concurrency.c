@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/* Adaptive concurrency of uploads to the backend. The number of upload
+* slots starts at INIT_UPLOAD_CONCURRENCY and is raised by one each window
+* while throughput keeps up, so that high-latency links with spare bandwidth
+* get more parallel requests. It is halved when transfers fail or time out,
+* so that weak links are not flooded with requests that time out. */
+
+#include "xfer_concurrency.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "logger.h"
+
+void init_xfer_concurrency(XFER_CONCURRENCY *ctl, int32_t min_limit,
+			   int32_t max_limit, int32_t init_limit)
+{
+	memset(ctl, 0, sizeof(XFER_CONCURRENCY));
+	sem_init(&(ctl->ctl_sem), 0, 1);
+	ctl->min_limit = min_limit;
+	ctl->max_limit = max_limit;
+	if (init_limit < min_limit)
+		init_limit = min_limit;
+	if (init_limit > max_limit)
+		init_limit = max_limit;
+	ctl->limit = init_limit;
+	clock_gettime(CLOCK_MONOTONIC, &(ctl->window_start));
+}
+
+/* Returns the number of tokens to be posted. Caller holds ctl_sem */
+static int32_t _set_limit(XFER_CONCURRENCY *ctl, int32_t new_limit)
+{
+	int32_t delta, cancelled;
+
+	if (new_limit < ctl->min_limit)
+		new_limit = ctl->min_limit;
+	if (new_limit > ctl->max_limit)
+		new_limit = ctl->max_limit;
+	delta = new_limit - ctl->limit;
+	ctl->limit = new_limit;
+	if (delta <= 0) {
+		ctl->withheld -= delta;
+		return 0;
+	}
+
+	/* Slots still to be taken back are given up first */
+	cancelled = (delta < ctl->withheld) ? delta : ctl->withheld;
+	ctl->withheld -= cancelled;
+	return delta - cancelled;
+}
+
+/**
+ * Change the concurrency limit.
+ *
+ * @param ctl Concurrency controller.
+ * @param new_limit The new limit, which is clamped to the bounds.
+ *
+ * @return Number of tokens the caller should post to the slot semaphore.
+ */
+int32_t xfer_concurrency_set_limit(XFER_CONCURRENCY *ctl, int32_t new_limit)
+{
+	int32_t num_tokens;
+
+	sem_wait(&(ctl->ctl_sem));
+	num_tokens = _set_limit(ctl, new_limit);
+	sem_post(&(ctl->ctl_sem));
+	return num_tokens;
+}
+
+/**
+ * Record a finished transfer, and adjust the limit when a window is over.
+ *
+ * @param ctl Concurrency controller.
+ * @param xfer_size Bytes transferred.
+ * @param latency_ms Time spent on the transfer in milliseconds.
+ * @param success Whether the transfer succeeded.
+ * @param now Current monotonic time.
+ *
+ * @return Number of tokens the caller should post to the slot semaphore.
+ */
+int32_t xfer_concurrency_record(XFER_CONCURRENCY *ctl, int64_t xfer_size,
+				int64_t latency_ms, BOOL success,
+				const struct timespec *now)
+{
+	int64_t elapsed_ms, last_throughput;
+	int32_t old_limit, new_limit, num_tokens;
+
+	sem_wait(&(ctl->ctl_sem));
+	ctl->window_objs++;
+	if (success == TRUE)
+		ctl->window_bytes += xfer_size;
+	else
+		ctl->window_errors++;
+	ctl->window_latency_ms += latency_ms;
+
+	elapsed_ms = (now->tv_sec - ctl->window_start.tv_sec) * 1000 +
+		     (now->tv_nsec - ctl->window_start.tv_nsec) / 1000000;
+	if ((ctl->window_objs < ctl->limit) ||
+	    (elapsed_ms < XFER_WINDOW_SEC * 1000)) {
+		sem_post(&(ctl->ctl_sem));
+		return 0;
+	}
+
+	last_throughput = ctl->throughput;
+	ctl->throughput = (ctl->window_bytes / 1024) * 1000 / elapsed_ms;
+	ctl->avg_latency_ms = ctl->window_latency_ms / ctl->window_objs;
+
+	old_limit = ctl->limit;
+	if ((ctl->window_errors * 100 >
+	     ctl->window_objs * XFER_MAX_ERROR_PERCENT) ||
+	    (ctl->avg_latency_ms > XFER_MAX_LATENCY_MS)) {
+		new_limit = old_limit / 2;
+		ctl->last_increased = FALSE;
+	} else if ((ctl->last_increased == TRUE) &&
+		   (ctl->throughput * 100 <
+		    last_throughput * (100 - XFER_THPT_DROP_PERCENT))) {
+		/* More requests did not help */
+		new_limit = old_limit - 1;
+		ctl->last_increased = FALSE;
+	} else {
+		new_limit = old_limit + 1;
+		ctl->last_increased = (new_limit <= ctl->max_limit) ?
+				      TRUE : FALSE;
+	}
+
+	ctl->window_start = *now;
+	ctl->window_bytes = 0;
+	ctl->window_objs = 0;
+	ctl->window_errors = 0;
+	ctl->window_latency_ms = 0;
+
+	num_tokens = _set_limit(ctl, new_limit);
+	if (ctl->limit != old_limit)
+		write_log(8, "Concurrency changed from %d to %d. Throughput %"
+			  PRId64 " KB/s, latency %" PRId64 " ms\n", old_limit,
+			  ctl->limit, ctl->throughput, ctl->avg_latency_ms);
+	sem_post(&(ctl->ctl_sem));
+	return num_tokens;
+}
+
+/**
+ * Check if the token of a released slot should be taken back because the
+ * limit was lowered.
+ *
+ * @return TRUE if the token should not be posted back.
+ */
+BOOL xfer_concurrency_take_back(XFER_CONCURRENCY *ctl)
+{
+	BOOL ret;
+
+	ret = FALSE;
+	sem_wait(&(ctl->ctl_sem));
+	if (ctl->withheld > 0) {
+		ctl->withheld--;
+		ret = TRUE;
+	}
+	sem_post(&(ctl->ctl_sem));
+	return ret;
+}
+
+/* Output arguments can be NULL if not needed */
+void xfer_concurrency_get_stat(XFER_CONCURRENCY *ctl, int32_t *limit,
+			       int64_t *throughput, int64_t *avg_latency_ms)
+{
+	sem_wait(&(ctl->ctl_sem));
+	if (limit != NULL)
+		*limit = ctl->limit;
+	if (throughput != NULL)
+		*throughput = ctl->throughput;
+	if (avg_latency_ms != NULL)
+		*avg_latency_ms = ctl->avg_latency_ms;
+	sem_post(&(ctl->ctl_sem));
+}
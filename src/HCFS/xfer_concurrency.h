@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef GW20_HCFS_XFER_CONCURRENCY_H_
+#define GW20_HCFS_XFER_CONCURRENCY_H_
+
+#include <semaphore.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "global.h"
+
+/* Bounds of the number of concurrent uploads. Upload and sync thread
+slots are allocated for the upper bound */
+#define MIN_UPLOAD_CONCURRENCY 2
+#define INIT_UPLOAD_CONCURRENCY 16
+#define MIN_SYNC_CONCURRENCY 1
+
+/* The limit is adjusted each time this many seconds have passed and at
+least "limit" transfers finished since the last adjustment */
+#define XFER_WINDOW_SEC 2
+/* Halve the limit if more transfers than this percentage failed, or if
+a transfer took longer than this on average */
+#define XFER_MAX_ERROR_PERCENT 10
+#define XFER_MAX_LATENCY_MS 30000
+/* Step back if throughput dropped by this percentage after an increase */
+#define XFER_THPT_DROP_PERCENT 5
+
+/* Additive-increase, multiplicative-decrease control of the number of
+concurrent transfers. Slots are handed out through a counting semaphore
+that holds "limit" tokens. Tokens are posted when the limit is raised, and
+tokens of released slots are withheld when it is lowered. */
+typedef struct {
+	sem_t ctl_sem;
+	int32_t limit;
+	int32_t min_limit;
+	int32_t max_limit;
+	int32_t withheld;
+
+	/* Transfers finished in the current window */
+	struct timespec window_start;
+	int64_t window_bytes;
+	int64_t window_objs;
+	int64_t window_errors;
+	int64_t window_latency_ms;
+
+	/* Results of the last window */
+	int64_t throughput; /* KB/s */
+	int64_t avg_latency_ms;
+	BOOL last_increased;
+} XFER_CONCURRENCY;
+
+void init_xfer_concurrency(XFER_CONCURRENCY *ctl, int32_t min_limit,
+			   int32_t max_limit, int32_t init_limit);
+int32_t xfer_concurrency_set_limit(XFER_CONCURRENCY *ctl, int32_t new_limit);
+int32_t xfer_concurrency_record(XFER_CONCURRENCY *ctl, int64_t xfer_size,
+				int64_t latency_ms, BOOL success,
+				const struct timespec *now);
+BOOL xfer_concurrency_take_back(XFER_CONCURRENCY *ctl);
+void xfer_concurrency_get_stat(XFER_CONCURRENCY *ctl, int32_t *limit,
+			       int64_t *throughput, int64_t *avg_latency_ms);
+
+#endif  /* GW20_HCFS_XFER_CONCURRENCY_H_ */
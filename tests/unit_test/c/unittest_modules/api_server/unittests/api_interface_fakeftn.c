@@ -172,6 +172,17 @@ META_CACHE_ENTRY_STRUCT *meta_cache_lock_entry(ino_t this_inode)
 	return NULL;
 }
 
+int32_t meta_cache_get_stat(META_CACHE_STAT *cache_stat,
+			    int64_t *num_entries)
+{
+	cache_stat->num_hits = 100;
+	cache_stat->num_misses = 20;
+	cache_stat->num_evictions = 5;
+	cache_stat->mem_used = 4096;
+	*num_entries = 15;
+	return 0;
+}
+
 int32_t pin_inode(ino_t this_inode, int64_t *reserved_pinned_size)
 {
 	if (PIN_INODE_ROLLBACK == TRUE)
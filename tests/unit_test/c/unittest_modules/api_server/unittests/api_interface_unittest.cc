@@ -885,6 +885,38 @@ TEST_F(api_moduleTest, GetMetaSizeSuccess)
 	ASSERT_EQ(55667788, metasize);
 }
 
+TEST_F(api_moduleTest, GetMetaCacheStatSuccess)
+{
+	int64_t metacache_vals[6];
+
+	API_SEND(GETMETACACHESTAT);
+	API_RECV1(metacache_vals);
+	EXPECT_EQ(100, metacache_vals[0]);
+	EXPECT_EQ(20, metacache_vals[1]);
+	EXPECT_EQ(5, metacache_vals[2]);
+	EXPECT_EQ(15, metacache_vals[3]);
+	EXPECT_EQ(4096, metacache_vals[4]);
+	EXPECT_EQ(MAX_META_MEM_CACHE_BYTES, metacache_vals[5]);
+}
+
+TEST_F(api_moduleTest, GetCacheStallStatSuccess)
+{
+	int64_t stall_vals[CACHE_STALL_BUCKETS + 2];
+
+	memset(&(hcfs_system->cache_stall_stat), 0, sizeof(CACHE_STALL_STAT));
+	hcfs_system->cache_stall_stat.num_stalls[0] = 7;
+	hcfs_system->cache_stall_stat.num_stalls[3] = 2;
+	hcfs_system->cache_stall_stat.total_stall_ms = 1500;
+	hcfs_system->cache_stall_stat.max_stall_ms = 900;
+	API_SEND(GETCACHESTALLSTAT);
+	API_RECV1(stall_vals);
+	EXPECT_EQ(7, stall_vals[0]);
+	EXPECT_EQ(0, stall_vals[1]);
+	EXPECT_EQ(2, stall_vals[3]);
+	EXPECT_EQ(1500, stall_vals[CACHE_STALL_BUCKETS]);
+	EXPECT_EQ(900, stall_vals[CACHE_STALL_BUCKETS + 1]);
+}
+
 TEST_F(api_moduleTest, UpdateQuotaSuccess)
 {
 	int32_t retcode;
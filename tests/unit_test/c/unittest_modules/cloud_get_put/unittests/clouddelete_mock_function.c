@@ -100,6 +100,13 @@ int32_t hcfs_delete_object(char *objname,
 	return 200;
 }
 
+int32_t hcfs_delete_multipart_object(char *objname,
+                                     CURL_HANDLE *curl_handle,
+                                     added_info_t *more)
+{
+	return hcfs_delete_object(objname, curl_handle, more);
+}
+
 int32_t super_block_share_locking(void)
 {
 	MOCK();
@@ -129,6 +136,18 @@ int32_t super_block_share_release(void)
 	return 0;
 }
 
+int32_t super_block_list_locking(int32_t which_list)
+{
+	MOCK();
+	return 0;
+}
+
+int32_t super_block_list_release(int32_t which_list)
+{
+	MOCK();
+	return 0;
+}
+
 /* A mock function to return linear block indexing */
 int64_t seek_page2(FILE_META_TYPE *temp_meta, FILE *fptr, 
 	int64_t target_page, int64_t hint_page) 
@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+extern "C" {
+#include "dirty_queue.h"
+#include "params.h"
+}
+#include "gtest/gtest.h"
+
+#define MAX_MOCK_INODES 400
+
+/* Mock super block entries, indexed by inode number */
+static SUPER_BLOCK_ENTRY mock_entries[MAX_MOCK_INODES];
+static int32_t list_lock_count;
+
+extern "C" {
+int32_t write_log(int32_t level, const char *format, ...)
+{
+	return 0;
+}
+
+int32_t super_block_list_locking(int32_t which_list)
+{
+	list_lock_count++;
+	return 0;
+}
+
+int32_t super_block_list_release(int32_t which_list)
+{
+	list_lock_count--;
+	return 0;
+}
+
+int32_t read_super_block_entry(ino_t this_inode, SUPER_BLOCK_ENTRY *inode_ptr)
+{
+	if (this_inode <= 0 || this_inode >= MAX_MOCK_INODES)
+		return -EINVAL;
+	memcpy(inode_ptr, &(mock_entries[this_inode]),
+	       sizeof(SUPER_BLOCK_ENTRY));
+	return 0;
+}
+}
+
+class dirty_queueTest : public ::testing::Test {
+ protected:
+  ino_t last_inode;
+
+  virtual void SetUp()
+  {
+    sys_super_block = (SUPER_BLOCK_CONTROL *)
+        calloc(1, sizeof(SUPER_BLOCK_CONTROL));
+    memset(mock_entries, 0, sizeof(mock_entries));
+    list_lock_count = 0;
+    last_inode = 0;
+    reset_dirty_queues();
+  }
+
+  virtual void TearDown()
+  {
+    EXPECT_EQ(0, list_lock_count);
+    free(sys_super_block);
+  }
+
+  /* Append an inode to the mock dirty list */
+  void add_dirty(ino_t inode, uint32_t mode, int64_t size, char pin_status)
+  {
+    SUPER_BLOCK_ENTRY *entry = &(mock_entries[inode]);
+
+    entry->status = IS_DIRTY;
+    entry->inode_stat.mode = mode;
+    entry->inode_stat.size = size;
+    entry->pin_status = pin_status;
+    entry->this_index = inode;
+    if (last_inode == 0)
+      sys_super_block->head.first_dirty_inode = inode;
+    else
+      mock_entries[last_inode].util_ll_next = inode;
+    last_inode = inode;
+  }
+};
+
+TEST_F(dirty_queueTest, ClassOfEntries)
+{
+  add_dirty(2, S_IFREG, 1 << 30, ST_PIN);
+  add_dirty(3, S_IFDIR, 0, ST_UNPIN);
+  add_dirty(4, S_IFLNK, 0, ST_UNPIN);
+  add_dirty(5, S_IFREG, DIRTY_SMALL_FILE_SIZE, ST_UNPIN);
+  add_dirty(6, S_IFREG, DIRTY_SMALL_FILE_SIZE + 1, ST_UNPIN);
+  add_dirty(7, S_IFREG, 1 << 30, ST_PINNING);
+
+  EXPECT_EQ(DIRTY_CLASS_PIN, dirty_class_of(&(mock_entries[2])));
+  EXPECT_EQ(DIRTY_CLASS_META, dirty_class_of(&(mock_entries[3])));
+  EXPECT_EQ(DIRTY_CLASS_META, dirty_class_of(&(mock_entries[4])));
+  EXPECT_EQ(DIRTY_CLASS_SMALL, dirty_class_of(&(mock_entries[5])));
+  EXPECT_EQ(DIRTY_CLASS_BULK, dirty_class_of(&(mock_entries[6])));
+  EXPECT_EQ(DIRTY_CLASS_PIN, dirty_class_of(&(mock_entries[7])));
+}
+
+TEST_F(dirty_queueTest, PickByWeightedPriority)
+{
+  ino_t inode;
+  const ino_t expected[] = {20, 21, 22, 23, 10, 11, 2, 24, 12, 3, 4};
+
+  /* Bulk files are queued before the others */
+  for (inode = 2; inode <= 4; inode++)
+    add_dirty(inode, S_IFREG, 1 << 30, ST_UNPIN);
+  for (inode = 10; inode <= 12; inode++)
+    add_dirty(inode, S_IFREG, 100, ST_UNPIN);
+  for (inode = 20; inode <= 24; inode++)
+    add_dirty(inode, S_IFDIR, 0, ST_UNPIN);
+
+  for (uint32_t count = 0; count < sizeof(expected) / sizeof(ino_t); count++)
+    EXPECT_EQ(expected[count], dirty_queue_next());
+  EXPECT_EQ(0, dirty_queue_next());
+  EXPECT_EQ(0, dirty_queue_next());
+
+  /* Next round starts from the head of the list again */
+  reset_dirty_queues();
+  EXPECT_EQ(20, dirty_queue_next());
+}
+
+TEST_F(dirty_queueTest, FullQueueDoesNotLoseInodes)
+{
+  ino_t inode;
+  int32_t picked[MAX_MOCK_INODES];
+  int32_t num_picked, dir_pos;
+
+  /* More bulk files than a queue can hold, then a directory */
+  for (inode = 2; inode < 2 + DIRTY_QUEUE_SIZE + 50; inode++)
+    add_dirty(inode, S_IFREG, 1 << 30, ST_UNPIN);
+  add_dirty(inode, S_IFDIR, 0, ST_UNPIN);
+
+  memset(picked, 0, sizeof(picked));
+  num_picked = 0;
+  dir_pos = -1;
+  while ((inode = dirty_queue_next()) != 0) {
+    ASSERT_LT(inode, (ino_t)MAX_MOCK_INODES);
+    picked[inode]++;
+    if (S_ISDIR(mock_entries[inode].inode_stat.mode))
+      dir_pos = num_picked;
+    num_picked++;
+  }
+  EXPECT_EQ(DIRTY_QUEUE_SIZE + 51, num_picked);
+  for (inode = 2; inode < 2 + DIRTY_QUEUE_SIZE + 51; inode++)
+    EXPECT_EQ(1, picked[inode]);
+  /* The directory does not wait for all the bulk files */
+  EXPECT_LT(dir_pos, num_picked - 1);
+}
+
+TEST_F(dirty_queueTest, FullClassDoesNotBlockOthers)
+{
+  ino_t inode, last_bulk;
+  int32_t num_picked, dir_pos;
+
+  /* The directory is after more bulk files than a queue can hold */
+  for (inode = 2; inode < 2 + DIRTY_QUEUE_SIZE + 50; inode++)
+    add_dirty(inode, S_IFREG, 1 << 30, ST_UNPIN);
+  add_dirty(inode, S_IFDIR, 0, ST_UNPIN);
+  add_dirty(inode + 1, S_IFREG, 1 << 30, ST_UNPIN);
+
+  num_picked = 0;
+  dir_pos = -1;
+  last_bulk = 0;
+  while ((inode = dirty_queue_next()) != 0) {
+    if (S_ISDIR(mock_entries[inode].inode_stat.mode)) {
+      dir_pos = num_picked;
+    } else {
+      /* Skipped bulk files are revisited in list order */
+      EXPECT_GT(inode, last_bulk);
+      last_bulk = inode;
+    }
+    num_picked++;
+  }
+  EXPECT_EQ(DIRTY_QUEUE_SIZE + 52, num_picked);
+  /* Found by the scan without waiting for the bulk queue to drain */
+  EXPECT_GE(dir_pos, 0);
+  EXPECT_LE(dir_pos, 3);
+}
+
+TEST_F(dirty_queueTest, RevisitedListChangeFinishesClass)
+{
+  ino_t inode, removed;
+  int32_t num_picked;
+
+  for (inode = 2; inode < 2 + DIRTY_QUEUE_SIZE + 50; inode++)
+    add_dirty(inode, S_IFREG, 1 << 30, ST_UNPIN);
+  add_dirty(inode, S_IFDIR, 0, ST_UNPIN);
+
+  /* Queue the directory, so that the rest of bulk files are skipped */
+  for (num_picked = 0; num_picked < 3; num_picked++)
+    dirty_queue_next();
+  /* A skipped inode leaves the list before it is revisited */
+  removed = 2 + DIRTY_QUEUE_SIZE + 10;
+  mock_entries[removed].status = NO_LL;
+
+  while ((inode = dirty_queue_next()) != 0) {
+    EXPECT_LT(inode, removed);
+    num_picked++;
+  }
+  /* Every bulk file before the removed one, and the directory */
+  EXPECT_EQ(DIRTY_QUEUE_SIZE + 11, num_picked);
+}
+
+TEST_F(dirty_queueTest, ChangedListFinishesRound)
+{
+  add_dirty(2, S_IFDIR, 0, ST_UNPIN);
+  add_dirty(3, S_IFDIR, 0, ST_UNPIN);
+  mock_entries[3].status = NO_LL;
+  add_dirty(4, S_IFDIR, 0, ST_UNPIN);
+
+  EXPECT_EQ(2, dirty_queue_next());
+  EXPECT_EQ(0, dirty_queue_next());
+}
+
+TEST_F(dirty_queueTest, EmptyList)
+{
+  EXPECT_EQ(0, dirty_queue_next());
+}
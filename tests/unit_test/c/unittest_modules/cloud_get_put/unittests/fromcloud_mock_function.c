@@ -237,6 +237,19 @@ int32_t change_system_meta(int64_t system_data_size_delta,
 	return 0;
 }
 
+int64_t seek_page(META_CACHE_ENTRY_STRUCT *body_ptr, int64_t target_page,
+		int64_t hint_page)
+{
+	MOCK();
+	return sizeof(HCFS_STAT) + sizeof(FILE_META_TYPE);
+}
+
+int32_t meta_cache_close_file(META_CACHE_ENTRY_STRUCT *body_ptr)
+{
+	MOCK();
+	return 0;
+}
+
 int64_t seek_page2(FILE_META_TYPE *temp_meta, FILE *fptr,
 		int64_t target_page, int64_t hint_page)
 {
@@ -255,6 +255,7 @@ protected:
 	virtual void TearDown() {
 		sem_destroy(&download_curl_sem);
 		sem_destroy(&download_curl_control_sem);
+		free(prefetch_ptr);
 	}
 
 	PREFETCH_STRUCT_TYPE *prefetch_ptr;
@@ -337,6 +338,322 @@ TEST_F(prefetch_blockTest, PrefetchFail)
 
 //	End of unittest of prefetch_block()
 
+//	Unittest of enqueue_prefetch_block()
+
+class enqueue_prefetch_blockTest : public ::testing::Test {
+protected:
+	virtual void SetUp() {
+		/* No worker is started, so queued jobs stay in the queue */
+		memset(&prefetch_thread_ctl, 0, sizeof(PREFETCH_THREAD_CTL));
+		sem_init(&(prefetch_thread_ctl.ctl_op_sem), 0, 1);
+		sem_init(&(prefetch_thread_ctl.job_sem), 0, 0);
+	}
+
+	virtual void TearDown() {
+		sem_destroy(&(prefetch_thread_ctl.ctl_op_sem));
+		sem_destroy(&(prefetch_thread_ctl.job_sem));
+	}
+
+	int32_t queued_jobs() {
+		int32_t num_jobs;
+
+		sem_getvalue(&(prefetch_thread_ctl.job_sem), &num_jobs);
+		return num_jobs;
+	}
+};
+
+TEST_F(enqueue_prefetch_blockTest, InvalidBlockNo)
+{
+	EXPECT_EQ(-EINVAL, enqueue_prefetch_block(1, -1, 0, 0));
+	EXPECT_EQ(0, prefetch_thread_ctl.num_queued);
+}
+
+TEST_F(enqueue_prefetch_blockTest, Terminating)
+{
+	prefetch_thread_ctl.terminating = TRUE;
+
+	EXPECT_EQ(-ESHUTDOWN, enqueue_prefetch_block(1, 1, 0, 0));
+	EXPECT_EQ(0, prefetch_thread_ctl.num_queued);
+}
+
+TEST_F(enqueue_prefetch_blockTest, JobsQueuedInOrder)
+{
+	PREFETCH_STRUCT_TYPE *job;
+
+	EXPECT_EQ(0, enqueue_prefetch_block(1, 3, 5, 1000));
+	EXPECT_EQ(0, enqueue_prefetch_block(1, MAX_BLOCK_ENTRIES_PER_PAGE + 2,
+					    PREFETCH_ANY_SEQNUM, 0));
+
+	ASSERT_EQ(2, prefetch_thread_ctl.num_queued);
+	EXPECT_EQ(2, queued_jobs());
+	job = &(prefetch_thread_ctl.queue[0]);
+	EXPECT_EQ(1, job->this_inode);
+	EXPECT_EQ(3, job->block_no);
+	EXPECT_EQ(5, job->seqnum);
+	EXPECT_EQ(1000, job->page_start_fpos);
+	EXPECT_EQ(3, job->entry_index);
+	job = &(prefetch_thread_ctl.queue[1]);
+	EXPECT_EQ(MAX_BLOCK_ENTRIES_PER_PAGE + 2, job->block_no);
+	EXPECT_EQ(PREFETCH_ANY_SEQNUM, job->seqnum);
+	EXPECT_EQ(2, job->entry_index);
+}
+
+TEST_F(enqueue_prefetch_blockTest, QueuedDuplicateDropped)
+{
+	EXPECT_EQ(0, enqueue_prefetch_block(1, 3, 5, 1000));
+	EXPECT_EQ(0, enqueue_prefetch_block(1, 3, 5, 1000));
+	EXPECT_EQ(0, enqueue_prefetch_block(1, 3, PREFETCH_ANY_SEQNUM, 0));
+	EXPECT_EQ(1, prefetch_thread_ctl.num_queued);
+	EXPECT_EQ(1, queued_jobs());
+
+	/* Other inode, block or seqnum is a different job */
+	EXPECT_EQ(0, enqueue_prefetch_block(2, 3, 5, 1000));
+	EXPECT_EQ(0, enqueue_prefetch_block(1, 4, 5, 1000));
+	EXPECT_EQ(0, enqueue_prefetch_block(1, 3, 6, 1000));
+	EXPECT_EQ(4, prefetch_thread_ctl.num_queued);
+}
+
+TEST_F(enqueue_prefetch_blockTest, WorkingDuplicateDropped)
+{
+	prefetch_thread_ctl.working_active[0] = TRUE;
+	prefetch_thread_ctl.working[0].this_inode = 1;
+	prefetch_thread_ctl.working[0].block_no = 3;
+	prefetch_thread_ctl.working[0].seqnum = PREFETCH_ANY_SEQNUM;
+
+	EXPECT_EQ(0, enqueue_prefetch_block(1, 3, 5, 1000));
+	EXPECT_EQ(0, prefetch_thread_ctl.num_queued);
+
+	/* Finished jobs do not block new requests */
+	prefetch_thread_ctl.working_active[0] = FALSE;
+	EXPECT_EQ(0, enqueue_prefetch_block(1, 3, 5, 1000));
+	EXPECT_EQ(1, prefetch_thread_ctl.num_queued);
+}
+
+TEST_F(enqueue_prefetch_blockTest, QueueFull)
+{
+	int32_t count;
+
+	prefetch_thread_ctl.queue_head = MAX_PREFETCH_QUEUE_LEN - 1;
+	for (count = 0; count < MAX_PREFETCH_QUEUE_LEN; count++)
+		ASSERT_EQ(0, enqueue_prefetch_block(1, count, 0, 0));
+
+	EXPECT_EQ(-ENOSPC, enqueue_prefetch_block(1, count, 0, 0));
+	EXPECT_EQ(MAX_PREFETCH_QUEUE_LEN, prefetch_thread_ctl.num_queued);
+	/* Queue wraps around the end of the array */
+	EXPECT_EQ(0, prefetch_thread_ctl.queue[MAX_PREFETCH_QUEUE_LEN - 1].block_no);
+	EXPECT_EQ(1, prefetch_thread_ctl.queue[0].block_no);
+}
+
+//	End of unittest of enqueue_prefetch_block()
+
+//	Unittest of enqueue_waited_fetch()
+
+static int32_t fake_fetch_fn(void *arg)
+{
+	return *((int32_t *)arg);
+}
+
+class enqueue_waited_fetchTest : public enqueue_prefetch_blockTest {
+};
+
+TEST_F(enqueue_waited_fetchTest, Terminating)
+{
+	FETCH_WAIT_TYPE waiter;
+
+	prefetch_thread_ctl.terminating = TRUE;
+
+	EXPECT_EQ(-ESHUTDOWN, enqueue_waited_fetch(1, 1, &waiter));
+	EXPECT_EQ(0, prefetch_thread_ctl.num_queued);
+}
+
+TEST_F(enqueue_waited_fetchTest, QueueFull)
+{
+	FETCH_WAIT_TYPE waiter;
+	int32_t count;
+
+	for (count = 0; count < MAX_PREFETCH_QUEUE_LEN; count++)
+		ASSERT_EQ(0, enqueue_prefetch_block(1, count, 0, 0));
+
+	EXPECT_EQ(-ENOSPC, enqueue_waited_fetch(1, count, &waiter));
+	EXPECT_EQ(MAX_PREFETCH_QUEUE_LEN, prefetch_thread_ctl.num_queued);
+}
+
+TEST_F(enqueue_waited_fetchTest, QueuedBeforePrefetches)
+{
+	FETCH_WAIT_TYPE waiter1, waiter2;
+	PREFETCH_STRUCT_TYPE *job;
+
+	EXPECT_EQ(0, enqueue_prefetch_block(1, 3, 5, 1000));
+	EXPECT_EQ(0, enqueue_waited_fetch(1, 4, &waiter1));
+	/* Not dropped even if the block is already queued as a prefetch */
+	EXPECT_EQ(0, enqueue_waited_fetch(1, 3, &waiter2));
+
+	ASSERT_EQ(3, prefetch_thread_ctl.num_queued);
+	EXPECT_EQ(3, queued_jobs());
+	job = &(prefetch_thread_ctl.queue[prefetch_thread_ctl.queue_head]);
+	EXPECT_EQ(3, job->block_no);
+	EXPECT_EQ(&waiter2, job->waiter);
+	job = &(prefetch_thread_ctl.queue[(prefetch_thread_ctl.queue_head + 1) %
+					  MAX_PREFETCH_QUEUE_LEN]);
+	EXPECT_EQ(4, job->block_no);
+	EXPECT_EQ(&waiter1, job->waiter);
+	job = &(prefetch_thread_ctl.queue[(prefetch_thread_ctl.queue_head + 2) %
+					  MAX_PREFETCH_QUEUE_LEN]);
+	EXPECT_EQ(3, job->block_no);
+	EXPECT_TRUE(job->waiter == NULL);
+
+	/* Later prefetches of a block being fetched are dropped */
+	EXPECT_EQ(0, enqueue_prefetch_block(1, 4, 6, 0));
+	EXPECT_EQ(3, prefetch_thread_ctl.num_queued);
+}
+
+TEST_F(enqueue_waited_fetchTest, NotQueuedIfNoThreadIsFree)
+{
+	FETCH_WAIT_TYPE waiter1, waiter2;
+	int32_t count;
+
+	/* All but one thread are running prefetches */
+	for (count = 1; count < MAX_PREFETCH_CONCURRENCY; count++)
+		prefetch_thread_ctl.working_active[count] = TRUE;
+
+	EXPECT_EQ(0, enqueue_waited_fetch(1, 3, &waiter1));
+	EXPECT_EQ(-EBUSY, enqueue_waited_fetch(1, 4, &waiter2));
+	EXPECT_EQ(1, prefetch_thread_ctl.num_queued);
+	EXPECT_EQ(1, prefetch_thread_ctl.num_waited_queued);
+
+	/* A thread finished its prefetch */
+	prefetch_thread_ctl.working_active[1] = FALSE;
+	EXPECT_EQ(0, enqueue_waited_fetch(1, 4, &waiter2));
+	EXPECT_EQ(2, prefetch_thread_ctl.num_waited_queued);
+}
+
+static void *idle_worker(void *arg)
+{
+	return NULL;
+}
+
+TEST_F(enqueue_waited_fetchTest, DestroyFailsQueuedWaiters)
+{
+	FETCH_WAIT_TYPE waiter;
+	int32_t retcode = 0;
+	int32_t count;
+
+	for (count = 0; count < MAX_PREFETCH_CONCURRENCY; count++)
+		pthread_create(&(prefetch_thread_ctl.pf_thread[count]), NULL,
+			       idle_worker, NULL);
+	waiter.fetch_fn = fake_fetch_fn;
+	waiter.arg = &retcode;
+	sem_init(&(waiter.done), 0, 0);
+	ASSERT_EQ(0, enqueue_prefetch_block(1, 3, 5, 1000));
+	ASSERT_EQ(0, enqueue_waited_fetch(1, 4, &waiter));
+
+	/* Queued jobs are never run, and the waiter is not left waiting */
+	EXPECT_EQ(0, destroy_prefetch_control());
+	EXPECT_EQ(0, sem_trywait(&(waiter.done)));
+	EXPECT_EQ(-ESHUTDOWN, waiter.ret);
+	EXPECT_EQ(0, prefetch_thread_ctl.num_queued);
+	sem_destroy(&(waiter.done));
+}
+
+//	End of unittest of enqueue_waited_fetch()
+
+//	Unittest of init_prefetch_control()
+
+class init_prefetch_controlTest : public ::testing::Test {
+protected:
+	virtual void SetUp() {
+		memset(hcfs_system, 0, sizeof(SYSTEM_DATA_HEAD));
+		/* Workers drop jobs without fetching while sync is paused */
+		hcfs_system->sync_paused = TRUE;
+	}
+
+	virtual void TearDown() {
+		hcfs_system->sync_paused = FALSE;
+	}
+};
+
+TEST_F(init_prefetch_controlTest, WorkersDrainQueue)
+{
+	int32_t count, num_active;
+
+	ASSERT_EQ(0, init_prefetch_control());
+	for (count = 0; count < MAX_PREFETCH_QUEUE_LEN; count++)
+		ASSERT_EQ(0, enqueue_prefetch_block(1, count, 0, 0));
+
+	for (count = 0; count < 500; count++) {
+		sem_wait(&(prefetch_thread_ctl.ctl_op_sem));
+		num_active = 0;
+		for (int32_t slot = 0; slot < MAX_PREFETCH_CONCURRENCY; slot++)
+			if (prefetch_thread_ctl.working_active[slot] == TRUE)
+				num_active++;
+		if ((prefetch_thread_ctl.num_queued == 0) && (num_active == 0)) {
+			sem_post(&(prefetch_thread_ctl.ctl_op_sem));
+			break;
+		}
+		sem_post(&(prefetch_thread_ctl.ctl_op_sem));
+		usleep(10000);
+	}
+	EXPECT_EQ(0, prefetch_thread_ctl.num_queued);
+	EXPECT_EQ(0, num_active);
+
+	EXPECT_EQ(0, destroy_prefetch_control());
+	EXPECT_EQ(-ESHUTDOWN, enqueue_prefetch_block(1, 0, 0, 0));
+}
+
+/* All fetches wait for each other to start, so that they only finish if
+ * run at the same time */
+static sem_t waited_fetch_sem;
+static int32_t waited_fetch_started;
+
+static int32_t concurrent_fetch_fn(void *arg)
+{
+	int32_t count;
+
+	sem_wait(&waited_fetch_sem);
+	waited_fetch_started++;
+	sem_post(&waited_fetch_sem);
+	for (count = 0; count < 500; count++) {
+		sem_wait(&waited_fetch_sem);
+		if (waited_fetch_started >= MAX_PREFETCH_CONCURRENCY) {
+			sem_post(&waited_fetch_sem);
+			return *((int32_t *)arg);
+		}
+		sem_post(&waited_fetch_sem);
+		usleep(10000);
+	}
+	return -ETIMEDOUT;
+}
+
+TEST_F(init_prefetch_controlTest, WaitedFetchesRunConcurrently)
+{
+	FETCH_WAIT_TYPE waiter[MAX_PREFETCH_CONCURRENCY];
+	int32_t retcode[MAX_PREFETCH_CONCURRENCY];
+	int32_t count;
+
+	sem_init(&waited_fetch_sem, 0, 1);
+	waited_fetch_started = 0;
+	ASSERT_EQ(0, init_prefetch_control());
+	for (count = 0; count < MAX_PREFETCH_CONCURRENCY; count++) {
+		/* Error of the last fetch is returned to its waiter */
+		retcode[count] = (count == MAX_PREFETCH_CONCURRENCY - 1) ?
+				 -EIO : 0;
+		waiter[count].fetch_fn = concurrent_fetch_fn;
+		waiter[count].arg = &(retcode[count]);
+		sem_init(&(waiter[count].done), 0, 0);
+		ASSERT_EQ(0, enqueue_waited_fetch(1, count, &(waiter[count])));
+	}
+
+	for (count = 0; count < MAX_PREFETCH_CONCURRENCY; count++) {
+		sem_wait(&(waiter[count].done));
+		EXPECT_EQ(retcode[count], waiter[count].ret);
+		sem_destroy(&(waiter[count].done));
+	}
+	EXPECT_EQ(0, destroy_prefetch_control());
+	sem_destroy(&waited_fetch_sem);
+}
+
+//	End of unittest of init_prefetch_control()
+
 // Unittest for download_block_manager
 class download_block_managerTest : public ::testing::Test {
 protected:
@@ -241,15 +241,10 @@ public:
 	}
 
 	int32_t get_thread_index() {
-		int32_t found_idle = -1;
-		for (int32_t i = 0 ; i < MAX_UPLOAD_CONCURRENCY ; i++) {
-			if (upload_ctl.threads_in_use[i] == FALSE &&
-			    upload_ctl.threads_created[i] == FALSE) {
-				found_idle = i;
-				break;
-			}
-		}
-		return found_idle;
+		/* Take a slot from the free list */
+		if (upload_ctl.num_free_slots <= 0)
+			return -1;
+		return upload_ctl.free_slots[--upload_ctl.num_free_slots];
 	}
 
 	void init_delete_ctl() {
@@ -627,13 +622,7 @@ TEST_F(init_sync_controlTest, Multithread_ControlSuccess)
 		int32_t idle_thread = -1;
 		sem_wait(&sync_ctl.sync_queue_sem);
 		sem_wait(&sync_ctl.sync_op_sem);
-		for (int32_t t_idx = 0 ; t_idx < MAX_SYNC_CONCURRENCY ; t_idx++) {
-			if ((sync_ctl.threads_in_use[t_idx] == 0)
-			    && (sync_ctl.threads_created[t_idx] == FALSE)) {
-				idle_thread = t_idx;
-				break;
-			}
-		}
+		idle_thread = sync_ctl.free_slots[--sync_ctl.num_free_slots];
 		sync_ctl.threads_in_use[idle_thread] = i + 1;
 		sync_ctl.threads_created[idle_thread] = TRUE;
 		sync_ctl.threads_finished[idle_thread] = FALSE;
@@ -676,6 +665,7 @@ TEST_F(init_sync_controlTest, LocalMetaNotExist_DoNotUpdateSB)
 
 	sem_wait(&sync_ctl.sync_queue_sem);
 	sem_wait(&sync_ctl.sync_op_sem);
+	sync_ctl.num_free_slots--; /* Slot 0 is on top of the free list */
 	sync_ctl.threads_in_use[0] = 2;
 	sync_ctl.threads_created[0] = TRUE;
 	sync_ctl.threads_finished[0] = FALSE;
@@ -739,6 +729,7 @@ TEST_F(init_sync_controlTest, SyncFail_ContinueNextTime)
 
 	sem_wait(&sync_ctl.sync_queue_sem);
 	sem_wait(&sync_ctl.sync_op_sem);
+	sync_ctl.num_free_slots--; /* Slot 0 is on top of the free list */
 	sync_ctl.threads_in_use[0] = 2;
 	sync_ctl.threads_created[0] = TRUE;
 	sync_ctl.threads_finished[0] = FALSE;
@@ -791,6 +782,7 @@ TEST_F(init_sync_controlTest, SyncSuccess)
 
 	sem_wait(&sync_ctl.sync_queue_sem);
 	sem_wait(&sync_ctl.sync_op_sem);
+	sync_ctl.num_free_slots--; /* Slot 0 is on top of the free list */
 	sync_ctl.threads_in_use[0] = 2;
 	sync_ctl.threads_created[0] = TRUE;
 	sync_ctl.threads_finished[0] = FALSE;
@@ -118,6 +118,13 @@ int32_t hcfs_put_object(FILE *fptr, char *objname, CURL_HANDLE *curl_handle,
 	return 200;
 }
 
+int32_t hcfs_put_multipart_object(FILE *fptr, char *objname,
+                                  CURL_HANDLE *curl_handle,
+                                  HTTP_meta *object_meta, added_info_t *more)
+{
+	return hcfs_put_object(fptr, objname, curl_handle, object_meta, more);
+}
+
 int32_t do_block_delete(ino_t this_inode, int64_t block_no, int64_t seq,
 #if ENABLE(DEDUP)
                                 uint8_t *obj_id, CURL_HANDLE *curl_handle)
@@ -145,12 +152,44 @@ int32_t super_block_exclusive_locking(void)
 	return 0;
 }
 
+/* TRUE while the upload loop scans the dirty list */
+static BOOL scanning_dirty_list = FALSE;
+
+int32_t super_block_list_locking(int32_t which_list)
+{
+	MOCK();
+	scanning_dirty_list = TRUE;
+	return 0;
+}
+
+int32_t super_block_list_release(int32_t which_list)
+{
+	MOCK();
+	scanning_dirty_list = FALSE;
+	return 0;
+}
+
 int32_t read_super_block_entry(ino_t this_inode, SUPER_BLOCK_ENTRY *inode_ptr)
 {
+	int32_t count;
+
 	MOCK();
 	if (this_inode == 0)
 		return -1;
 
+	/* Walking the dirty list does not count as handling the inode */
+	if (scanning_dirty_list == TRUE) {
+		memset(inode_ptr, 0, sizeof(SUPER_BLOCK_ENTRY));
+		inode_ptr->status = IS_DIRTY;
+		(inode_ptr->inode_stat).mode = S_IFDIR;
+		for (count = 0; count < shm_test_data->num_inode - 1; count++)
+			if (shm_test_data->to_handle_inode[count] ==
+			    this_inode)
+				inode_ptr->util_ll_next =
+				    shm_test_data->to_handle_inode[count + 1];
+		return 0;
+	}
+
 	inode_ptr->status = IS_DIRTY;
 	inode_ptr->in_transit = FALSE;
 	inode_ptr->lastsync_time = fake_access_time;
@@ -180,6 +219,13 @@ int32_t write_super_block_entry(ino_t this_inode, SUPER_BLOCK_ENTRY *inode_ptr)
 	return 0;
 }
 
+int32_t super_block_start_transit(ino_t this_inode,
+				  SUPER_BLOCK_ENTRY *inode_ptr)
+{
+	MOCK();
+	return read_super_block_entry(this_inode, inode_ptr);
+}
+
 int32_t super_block_exclusive_release(void)
 {
 	MOCK();
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+extern "C" {
+#include "xfer_concurrency.h"
+}
+#include "gtest/gtest.h"
+
+extern "C" {
+int32_t write_log(int32_t level, const char *format, ...)
+{
+	return 0;
+}
+}
+
+class xfer_concurrencyTest : public ::testing::Test {
+ protected:
+  XFER_CONCURRENCY ctl;
+  struct timespec now;
+
+  virtual void SetUp()
+  {
+    init_xfer_concurrency(&ctl, 2, 32, 8);
+    now = ctl.window_start;
+  }
+
+  /* Finish a window of "limit" transfers of "size" bytes each, "errors" of
+  which failed, after XFER_WINDOW_SEC */
+  int32_t run_window(int64_t size, int64_t latency_ms, int32_t errors)
+  {
+    int32_t count, num_objs, num_tokens;
+
+    num_objs = ctl.limit;
+    num_tokens = 0;
+    now.tv_sec += XFER_WINDOW_SEC;
+    for (count = 0; count < num_objs; count++)
+      num_tokens += xfer_concurrency_record(&ctl, size, latency_ms,
+                                            (count < errors) ? FALSE : TRUE,
+                                            &now);
+    return num_tokens;
+  }
+};
+
+TEST_F(xfer_concurrencyTest, InitLimitIsClamped)
+{
+  init_xfer_concurrency(&ctl, 2, 32, 100);
+  EXPECT_EQ(32, ctl.limit);
+  init_xfer_concurrency(&ctl, 2, 32, 0);
+  EXPECT_EQ(2, ctl.limit);
+}
+
+TEST_F(xfer_concurrencyTest, NoChangeBeforeWindowEnds)
+{
+  int32_t count;
+
+  /* Enough transfers but not enough time */
+  for (count = 0; count < 20; count++)
+    EXPECT_EQ(0, xfer_concurrency_record(&ctl, 1048576, 100, TRUE, &now));
+  EXPECT_EQ(8, ctl.limit);
+}
+
+TEST_F(xfer_concurrencyTest, IncreaseWhenHealthy)
+{
+  int32_t limit;
+  int64_t throughput, latency;
+
+  EXPECT_EQ(1, run_window(1048576, 100, 0));
+  EXPECT_EQ(9, ctl.limit);
+  EXPECT_EQ(1, run_window(1048576, 100, 0));
+  EXPECT_EQ(10, ctl.limit);
+
+  xfer_concurrency_get_stat(&ctl, &limit, &throughput, &latency);
+  EXPECT_EQ(10, limit);
+  EXPECT_EQ(9 * 1024 / XFER_WINDOW_SEC, throughput);
+  EXPECT_EQ(100, latency);
+}
+
+TEST_F(xfer_concurrencyTest, HalveOnErrors)
+{
+  EXPECT_EQ(0, run_window(1048576, 100, 2));
+  EXPECT_EQ(4, ctl.limit);
+  EXPECT_EQ(4, ctl.withheld);
+}
+
+TEST_F(xfer_concurrencyTest, HalveOnHighLatency)
+{
+  EXPECT_EQ(0, run_window(1048576, XFER_MAX_LATENCY_MS + 1, 0));
+  EXPECT_EQ(4, ctl.limit);
+}
+
+TEST_F(xfer_concurrencyTest, StepBackWhenThroughputDrops)
+{
+  EXPECT_EQ(1, run_window(1048576, 100, 0));
+  EXPECT_EQ(9, ctl.limit);
+  /* 9 transfers of half the size give less throughput */
+  EXPECT_EQ(0, run_window(524288, 100, 0));
+  EXPECT_EQ(8, ctl.limit);
+  EXPECT_EQ(1, ctl.withheld);
+}
+
+TEST_F(xfer_concurrencyTest, WithheldTokensAreTakenBack)
+{
+  EXPECT_EQ(0, xfer_concurrency_set_limit(&ctl, 5));
+  EXPECT_EQ(3, ctl.withheld);
+  EXPECT_TRUE(xfer_concurrency_take_back(&ctl));
+  EXPECT_EQ(2, ctl.withheld);
+
+  /* Raising the limit gives up remaining withheld tokens first */
+  EXPECT_EQ(1, xfer_concurrency_set_limit(&ctl, 8));
+  EXPECT_EQ(0, ctl.withheld);
+  EXPECT_FALSE(xfer_concurrency_take_back(&ctl));
+}
+
+TEST_F(xfer_concurrencyTest, LimitStaysInBounds)
+{
+  EXPECT_EQ(0, xfer_concurrency_set_limit(&ctl, 0));
+  EXPECT_EQ(2, ctl.limit);
+  /* 6 tokens are still withheld */
+  EXPECT_EQ(24, xfer_concurrency_set_limit(&ctl, 100));
+  EXPECT_EQ(32, ctl.limit);
+  EXPECT_EQ(0, run_window(1048576, 100, 0));
+  EXPECT_EQ(32, ctl.limit);
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <openssl/sha.h>
+extern "C" {
+#include "obj_fingerprint.h"
+}
+
+/* obj_id as computed before streaming: hash of the whole object, first
+bytes, then last bytes of the rest */
+static void reference_obj_id(const uint8_t *data, size_t size,
+			     uint8_t obj_id[OBJID_LENGTH])
+{
+	size_t rest;
+
+	memset(obj_id, 0, OBJID_LENGTH);
+	SHA256(data, size, obj_id);
+	if (size < BYTES_TO_CHECK) {
+		memcpy(obj_id + SHA256_DIGEST_LENGTH, data, size);
+		return;
+	}
+	memcpy(obj_id + SHA256_DIGEST_LENGTH, data, BYTES_TO_CHECK);
+	rest = size - BYTES_TO_CHECK;
+	if (rest > BYTES_TO_CHECK)
+		rest = BYTES_TO_CHECK;
+	memcpy(obj_id + SHA256_DIGEST_LENGTH + BYTES_TO_CHECK,
+	       data + size - rest, rest);
+}
+
+TEST(obj_fingerprintTest, KnownHash)
+{
+	OBJ_FINGERPRINT_CTX ctx;
+	uint8_t obj_id[OBJID_LENGTH];
+	uint8_t expected[BYTES_TO_CHECK * 2] = {'a', 'b', 'c', 0, 0, 0, 0, 0};
+	char hash_str[65];
+	off_t size;
+	int32_t count;
+
+	ASSERT_EQ(0, fingerprint_init(&ctx));
+	ASSERT_EQ(0, fingerprint_update(&ctx, (const uint8_t *) "abc", 3));
+	ASSERT_EQ(0, fingerprint_final(&ctx, obj_id, &size));
+
+	for (count = 0; count < SHA256_DIGEST_LENGTH; count++)
+		sprintf(hash_str + (count * 2), "%02x", obj_id[count]);
+	EXPECT_STREQ("ba7816bf8f01cfea414140de5dae2223"
+		     "b00361a396177a9cb410ff61f20015ad", hash_str);
+	EXPECT_EQ(3, size);
+	EXPECT_EQ(0, memcmp(expected, obj_id + SHA256_DIGEST_LENGTH,
+			    sizeof(expected)));
+}
+
+TEST(obj_fingerprintTest, AnySplitMatchesWholeObject)
+{
+	OBJ_FINGERPRINT_CTX ctx;
+	uint8_t data[64], obj_id[OBJID_LENGTH], expected[OBJID_LENGTH];
+	size_t size, pos, len;
+	off_t obj_size;
+
+	srand(25);
+	for (pos = 0; pos < sizeof(data); pos++)
+		data[pos] = rand() & 0xFF;
+
+	for (size = 0; size <= 20; size++) {
+		reference_obj_id(data, size, expected);
+		/* Feed in random chunks, including empty ones */
+		ASSERT_EQ(0, fingerprint_init(&ctx));
+		for (pos = 0; pos < size; pos += len) {
+			len = rand() % 4;
+			if (len > size - pos)
+				len = size - pos;
+			ASSERT_EQ(0, fingerprint_update(&ctx, data + pos, len));
+		}
+		ASSERT_EQ(0, fingerprint_final(&ctx, obj_id, &obj_size));
+		EXPECT_EQ((off_t) size, obj_size);
+		EXPECT_EQ(0, memcmp(expected, obj_id, OBJID_LENGTH))
+		    << "size " << size;
+	}
+}
+
+TEST(obj_fingerprintTest, FileMatchesWholeObject)
+{
+	char path[] = "/tmp/obj_fingerprint_XXXXXX";
+	size_t size = 3 * FINGERPRINT_READ_SIZE + 3, pos;
+	uint8_t *data, obj_id[OBJID_LENGTH], expected[OBJID_LENGTH];
+	off_t obj_size;
+	int32_t fd;
+
+	data = (uint8_t *) malloc(size);
+	ASSERT_TRUE(data != NULL);
+	for (pos = 0; pos < size; pos++)
+		data[pos] = rand() & 0xFF;
+	fd = mkstemp(path);
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ((ssize_t) size, write(fd, data, size));
+	lseek(fd, 10, SEEK_SET);
+
+	reference_obj_id(data, size, expected);
+	EXPECT_EQ(0, fingerprint_fd(fd, obj_id, &obj_size));
+	EXPECT_EQ((off_t) size, obj_size);
+	EXPECT_EQ(0, memcmp(expected, obj_id, OBJID_LENGTH));
+	/* File offset is kept for the reader of the upload */
+	EXPECT_EQ(10, lseek(fd, 0, SEEK_CUR));
+
+	close(fd);
+	unlink(path);
+	free(data);
+}
@@ -360,9 +360,7 @@ int64_t open_fh(ino_t thisinode, int32_t flags, BOOL isdir)
 		dirh_ptr = &(system_fh_table.direntry_table[index]);
 		dirh_ptr->thisinode = thisinode;
 		dirh_ptr->flags = flags;
-		dirh_ptr->snapshot_ptr = NULL;
-		sem_init(&(dirh_ptr->snap_ref_sem), 0, 0);
-		sem_init(&(dirh_ptr->wait_ref_sem), 0, 1);
+		dirh_ptr->snapshot = NULL;
 		system_fh_table.have_nonsnap_dir = TRUE;
 	} else {
 		system_fh_table.entry_table_flags[index] = IS_FH;
@@ -372,6 +370,7 @@ int64_t open_fh(ino_t thisinode, int32_t flags, BOOL isdir)
 		system_fh_table.entry_table[index].flags = flags;
 
 		system_fh_table.entry_table[index].blockfptr = NULL;
+		system_fh_table.entry_table[index].block_fd = NULL;
 		system_fh_table.entry_table[index].opened_block = -1;
 		system_fh_table.entry_table[index].cached_page_index = -1;
 		system_fh_table.entry_table[index].cached_filepos = -1;
@@ -403,24 +402,65 @@ int32_t close_fh(int64_t index)
 		}
 		tmp_entry->meta_cache_ptr = NULL;
 		tmp_entry->blockfptr = NULL;
+		tmp_entry->block_fd = NULL;
 		tmp_entry->opened_block = -1;
 		sem_destroy(&(tmp_entry->block_sem));
 	} else {
 		tmp_DIRH_entry = &(system_fh_table.direntry_table[index]);
 
-		if (tmp_DIRH_entry->snapshot_ptr != NULL) {
-			fclose(tmp_DIRH_entry->snapshot_ptr);
-			tmp_DIRH_entry->snapshot_ptr = NULL;
-		}
+		tmp_DIRH_entry->snapshot = NULL;
 		system_fh_table.entry_table_flags[index] = NO_FH;
 		tmp_DIRH_entry->thisinode = 0;
-		sem_destroy(&(tmp_DIRH_entry->snap_ref_sem));
-		sem_destroy(&(tmp_DIRH_entry->wait_ref_sem));
 	}
 
 	return 0;
 }
 
+/* Snapshots in tests are owned by the test cases, so no reference is
+taken here */
+DIR_SNAPSHOT *get_dirh_snapshot(DIRH_ENTRY *dirh_ptr, BOOL drop_snapshot)
+{
+	MOCK();
+	if (drop_snapshot == TRUE) {
+		dirh_ptr->snapshot = NULL;
+		return NULL;
+	}
+	return dirh_ptr->snapshot;
+}
+
+void put_dir_snapshot(DIR_SNAPSHOT *snapshot)
+{
+	MOCK();
+	return;
+}
+
+int64_t find_dir_snapshot_page(const DIR_SNAPSHOT *snapshot,
+			       int64_t page_pos)
+{
+	MOCK();
+	int64_t count;
+
+	for (count = 0; count < snapshot->num_pages; count++)
+		if (snapshot->pages[count].this_page_pos == page_pos)
+			return count;
+	return -1;
+}
+
+DIR_ENTRY_PAGE *get_dir_snapshot_page(const DIR_SNAPSHOT *snapshot,
+				      int64_t index, DIR_ENTRY_PAGE *tmppage)
+{
+	MOCK();
+	if ((index < 0) || (index >= snapshot->num_pages))
+		return NULL;
+	return &(snapshot->pages[index]);
+}
+
+int32_t super_block_read(ino_t this_inode, struct SUPER_BLOCK_ENTRY *inode_ptr)
+{
+	MOCK();
+	return -ENOENT;
+}
+
 int64_t seek_page(META_CACHE_ENTRY_STRUCT *body_ptr, int64_t target_page,
 			int64_t hint_page)
 {
@@ -450,6 +490,23 @@ void prefetch_block(PREFETCH_STRUCT_TYPE *ptr)
 {
 	MOCK();
 }
+int32_t enqueue_prefetch_block(ino_t this_inode, int64_t block_no,
+			       int64_t seqnum, off_t page_start_fpos)
+{
+	MOCK();
+	if (num_prefetch_enqueued < MAX_FAKE_PREFETCH)
+		prefetch_enqueued[num_prefetch_enqueued++] = block_no;
+	return 0;
+}
+int32_t enqueue_waited_fetch(ino_t this_inode, int64_t block_no,
+			     FETCH_WAIT_TYPE *waiter)
+{
+	MOCK();
+	num_waited_fetch++;
+	waiter->ret = waiter->fetch_fn(waiter->arg);
+	sem_post(&(waiter->done));
+	return 0;
+}
 int32_t fetch_from_cloud(FILE *fptr,
 			 char action_from,
 			 char *objname,
@@ -464,6 +521,8 @@ int32_t fetch_from_cloud(FILE *fptr,
 
 	sscanf(objname, "data_%"PRIu64"_%lld_%lld",
 			(uint64_t *)&this_inode, &block_no, &seqnum);
+	if ((fail_fetch_block == TRUE) && (block_no == fail_fetch_block_no))
+		return -EIO;
 
 	switch (this_inode) {
 	case 14:
@@ -1047,6 +1106,56 @@ int32_t destroy_download_control(void)
 	MOCK();
 	return 0;
 }
+int32_t init_prefetch_control(void)
+{
+	MOCK();
+	return 0;
+}
+int32_t destroy_prefetch_control(void)
+{
+	MOCK();
+	return 0;
+}
+int32_t init_write_buffer(void)
+{
+	MOCK();
+	return 0;
+}
+void destroy_write_buffer(void)
+{
+	MOCK();
+}
+int64_t write_buffer_append(MOUNT_T *mptr, ino_t this_inode, int64_t fh,
+			    const char *buf, size_t size, off_t offset)
+{
+	MOCK();
+	return 0;
+}
+int32_t write_buffer_flush_inode(ino_t this_inode)
+{
+	MOCK();
+	return 0;
+}
+void write_buffer_update_stat(ino_t this_inode, HCFS_STAT *thisstat)
+{
+	MOCK();
+}
+int32_t write_buffer_flush_fh(ino_t this_inode, int64_t fh)
+{
+	MOCK();
+	return 0;
+}
+
+void cache_usage_index_touch(ino_t this_inode, BOOL is_modify)
+{
+	return;
+}
+
+void cache_policy_access(ino_t this_inode, int64_t start_block,
+			 int64_t end_block, BOOL is_write)
+{
+	return;
+}
 
 int32_t reset_dirstat_lookup(ino_t thisinode)
 {
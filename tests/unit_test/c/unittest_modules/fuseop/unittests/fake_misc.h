@@ -56,4 +56,14 @@ struct timespec updated_mtim;
 
 int32_t remove_apk_success;
 char verified_apk_name[400];
+
+#define MAX_FAKE_PREFETCH 32
+int32_t num_prefetch_enqueued;
+int64_t prefetch_enqueued[MAX_FAKE_PREFETCH];
+int32_t num_waited_fetch;
+
+/* Number of block entries of test files, and the block to fail fetching */
+int32_t fake_num_blocks;
+BOOL fail_fetch_block;
+int64_t fail_fetch_block_no;
 #define CORRECT_VALUE_SIZE 24269
@@ -326,6 +326,7 @@ int64_t open_fh(ino_t thisinode, int32_t flags, BOOL isdir)
 	system_fh_table.entry_table[index].flags = flags;
 
 	system_fh_table.entry_table[index].blockfptr = NULL;
+	system_fh_table.entry_table[index].block_fd = NULL;
 	system_fh_table.entry_table[index].opened_block = -1;
 	system_fh_table.entry_table[index].cached_page_index = -1;
 	system_fh_table.entry_table[index].cached_filepos = -1;
@@ -875,6 +876,14 @@ int32_t destroy_download_control(void)
 {
 	return 0;
 }
+int32_t init_prefetch_control(void)
+{
+	return 0;
+}
+int32_t destroy_prefetch_control(void)
+{
+	return 0;
+}
 
 int32_t reset_dirstat_lookup(ino_t thisinode)
 {
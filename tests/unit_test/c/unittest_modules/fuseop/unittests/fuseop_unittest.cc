@@ -47,6 +47,11 @@ extern "C" {
 #include "utils.h"
 #include "super_block.h"
 #include "mount_manager.h"
+#include "hcfs_fromcloud.h"
+#include "block_fd_cache.h"
+int32_t read_prefetch_cache(FH_ENTRY *fh_ptr, BLOCK_ENTRY_PAGE *tpage,
+		int64_t eindex, ino_t this_inode, int64_t block_index,
+		off_t this_page_fpos);
 }
 #include "gtest/gtest.h"
 
@@ -1263,6 +1268,9 @@ class hfuse_readTest : public ::testing::Test {
     after_update_block_page = FALSE;
     test_fetch_from_backend = FALSE;
     fake_block_status = ST_NONE;
+    fake_num_blocks = 0;
+    fail_fetch_block = FALSE;
+    num_waited_fetch = 0;
     hcfs_system->systemdata.system_size = 12800000;
     hcfs_system->systemdata.cache_size = 1200000;
     hcfs_system->systemdata.cache_blocks = 13;
@@ -1278,6 +1286,82 @@ class hfuse_readTest : public ::testing::Test {
     fetch_block_path(temppath, 15, 0);
     if (access(temppath, F_OK) == 0)
       unlink(temppath);
+    fetch_block_path(temppath, 15, 1);
+    if (access(temppath, F_OK) == 0)
+      unlink(temppath);
+    /* Block files of next tests are new files */
+    invalidate_inode_block_fds(15);
+    system_config->max_block_size = 2097152;
+    fake_num_blocks = 0;
+    fail_fetch_block = FALSE;
+  }
+
+  /* Read "size" bytes at offset 0 of a two block file in the cloud */
+  ssize_t read_cloud_blocks(char *buf, size_t size) {
+    int32_t fd;
+    ssize_t ret_size;
+
+    system_config->max_block_size = 102400;
+    fake_num_blocks = 2;
+    fake_block_status = ST_CLOUD;
+    test_fetch_from_backend = TRUE;
+
+    fd = open("/tmp/test_fuse/testread", O_RDONLY | O_DIRECT);
+    if (fd < 0)
+      return -1;
+    ret_size = pread(fd, buf, size, 0);
+    close(fd);
+    return ret_size;
+  }
+
+  /* Make a two block file in local disk, with "block0_size" bytes of 'a'
+   * in block 0 and "block1_size" bytes of 'b' in block 1 */
+  void make_local_blocks(size_t block0_size, size_t block1_size) {
+    char temppath[1024];
+    char *tempbuf;
+
+    system_config->max_block_size = 102400;
+    fake_num_blocks = 2;
+    fake_block_status = ST_LDISK;
+    tempbuf = (char *) malloc(102400);
+    memset(tempbuf, 'a', 102400);
+    fetch_block_path(temppath, 15, 0);
+    fptr = fopen(temppath, "w");
+    fwrite(tempbuf, block0_size, 1, fptr);
+    fclose(fptr);
+    memset(tempbuf, 'b', 102400);
+    fetch_block_path(temppath, 15, 1);
+    fptr = fopen(temppath, "w");
+    fwrite(tempbuf, block1_size, 1, fptr);
+    fclose(fptr);
+    fptr = NULL;
+    free(tempbuf);
+  }
+
+  /* Read "size" bytes at "offset", and return the block opened by the
+   * file handle, which is -1 if the reply is sent from the block files */
+  int64_t read_local_blocks(char *buf, size_t size, off_t offset,
+                            ssize_t *ret_size) {
+    int32_t fd;
+    int64_t opened_block;
+
+    fd = open("/tmp/test_fuse/testread", O_RDONLY | O_DIRECT);
+    if (fd < 0)
+      return -2;
+    *ret_size = pread(fd, buf, size, offset);
+    /* File handle of an inode is at the index of the inode number */
+    opened_block = system_fh_table.entry_table[15].opened_block;
+    close(fd);
+    return opened_block;
+  }
+
+  BOOL all_chars(const char *buf, char value, size_t size) {
+    size_t count;
+
+    for (count = 0; count < size; count++)
+      if (buf[count] != value)
+        return FALSE;
+    return TRUE;
   }
 };
 
@@ -1405,6 +1489,91 @@ TEST_F(hfuse_readTest, ReadCloudContent) {
   fptr = NULL;
 }
 
+TEST_F(hfuse_readTest, ReadCloudBlocksFetchedTogether) {
+  char *buf;
+
+  ASSERT_EQ(0, posix_memalign((void **)&buf, 4096, 131072));
+
+  EXPECT_EQ(131072, read_cloud_blocks(buf, 131072));
+  /* The second block is fetched by the prefetch threads */
+  EXPECT_EQ(1, num_waited_fetch);
+  EXPECT_EQ(0, strncmp(buf, "This is a test data", 19));
+  EXPECT_EQ(0, strncmp(buf + 102400, "This is a test data", 19));
+  free(buf);
+}
+
+TEST_F(hfuse_readTest, ReadCloudBlocksShortReadOnFetchFail) {
+  char *buf;
+
+  ASSERT_EQ(0, posix_memalign((void **)&buf, 4096, 131072));
+  fail_fetch_block = TRUE;
+  fail_fetch_block_no = 1;
+
+  /* Only the block before the failed one is returned */
+  EXPECT_EQ(102400, read_cloud_blocks(buf, 131072));
+  EXPECT_EQ(1, num_waited_fetch);
+  EXPECT_EQ(0, strncmp(buf, "This is a test data", 19));
+  free(buf);
+}
+
+TEST_F(hfuse_readTest, ReadCloudBlocksFirstFetchFail) {
+  char *buf;
+
+  ASSERT_EQ(0, posix_memalign((void **)&buf, 4096, 131072));
+  fail_fetch_block = TRUE;
+  fail_fetch_block_no = 0;
+
+  EXPECT_EQ(-1, read_cloud_blocks(buf, 131072));
+  EXPECT_EQ(EIO, errno);
+  free(buf);
+}
+
+TEST_F(hfuse_readTest, ReadLocalBlocksRepliedFromFiles) {
+  char *buf;
+  ssize_t ret_size;
+
+  ASSERT_EQ(0, posix_memalign((void **)&buf, 4096, 204800));
+  make_local_blocks(102400, 102400);
+
+  /* The reply spans both blocks without reading into a buffer */
+  EXPECT_EQ(-1, read_local_blocks(buf, 204800, 0, &ret_size));
+  ASSERT_EQ(204800, ret_size);
+  EXPECT_TRUE(all_chars(buf, 'a', 102400));
+  EXPECT_TRUE(all_chars(buf + 102400, 'b', 102400));
+  free(buf);
+}
+
+TEST_F(hfuse_readTest, ReadLocalBlocksPartialFinalBlock) {
+  char *buf;
+  ssize_t ret_size;
+
+  ASSERT_EQ(0, posix_memalign((void **)&buf, 4096, 102400));
+  make_local_blocks(102400, 102400);
+
+  /* Starts in the middle of block 0 and ends in the middle of block 1 */
+  EXPECT_EQ(-1, read_local_blocks(buf, 102400, 53248, &ret_size));
+  ASSERT_EQ(102400, ret_size);
+  EXPECT_TRUE(all_chars(buf, 'a', 49152));
+  EXPECT_TRUE(all_chars(buf + 49152, 'b', 53248));
+  free(buf);
+}
+
+TEST_F(hfuse_readTest, ReadShortLocalBlockFallsBackToBuffer) {
+  char *buf;
+  ssize_t ret_size;
+
+  ASSERT_EQ(0, posix_memalign((void **)&buf, 4096, 204800));
+  make_local_blocks(102400, 100);
+
+  /* Short block file is padded with zeros in the buffered read */
+  EXPECT_EQ(1, read_local_blocks(buf, 204800, 0, &ret_size));
+  ASSERT_EQ(204800, ret_size);
+  EXPECT_TRUE(all_chars(buf, 'a', 102400));
+  EXPECT_TRUE(all_chars(buf + 102400, 'b', 100));
+  EXPECT_TRUE(all_chars(buf + 102500, 0, 102300));
+  free(buf);
+}
+
 TEST_F(hfuse_readTest, ReadPagedOutRead) {
   int ret_val;
   int tmp_err;
@@ -2607,7 +2776,7 @@ TEST_F(hfuse_ll_readdirTest, TwoMaxPageEntriesWithSnapshot) {
   HCFS_STAT tempstat;
   char filename[100];
   DIRH_ENTRY *dirh_ptr;
-  char readdirsnap_metapath[100];
+  DIR_SNAPSHOT snapshot;
 
   /* Create the mock dir meta that is modified */
   fptr = fopen(readdir_metapath, "w");
@@ -2639,18 +2808,16 @@ TEST_F(hfuse_ll_readdirTest, TwoMaxPageEntriesWithSnapshot) {
   fclose(fptr);
 
   /* Create the snapshotted version */
-  snprintf(readdirsnap_metapath, 100, "%s_snap", readdir_metapath);
-  fptr = fopen(readdirsnap_metapath, "w");
-  setbuf(fptr, NULL);
-  fwrite(&tempstat, sizeof(HCFS_STAT), 1, fptr);
+  memset(&snapshot, 0, sizeof(DIR_SNAPSHOT));
+  snapshot.num_pages = 2;
+  snapshot.pages = (DIR_ENTRY_PAGE *) calloc(2, sizeof(DIR_ENTRY_PAGE));
   temphead.total_children = (2 * MAX_DIR_ENTRIES_PER_PAGE) - 2;
   temphead.root_entry_page = sizeof(HCFS_STAT) + sizeof(DIR_META_TYPE);
   temphead.next_xattr_page = 0;
   temphead.entry_page_gc_list = 0;
   temphead.tree_walk_list_head = temphead.root_entry_page;
-  fwrite(&temphead, sizeof(DIR_META_TYPE), 1, fptr);
+  memcpy(&(snapshot.dir_meta), &temphead, sizeof(DIR_META_TYPE));
 
-  ASSERT_EQ(sizeof(HCFS_STAT) + sizeof(DIR_META_TYPE), ftell(fptr));
   memset(&temppage, 0, sizeof(DIR_ENTRY_PAGE));
   temppage.num_entries = MAX_DIR_ENTRIES_PER_PAGE;
   temppage.this_page_pos = temphead.root_entry_page;
@@ -2670,7 +2837,7 @@ TEST_F(hfuse_ll_readdirTest, TwoMaxPageEntriesWithSnapshot) {
     temppage.dir_entries[count].d_type = D_ISREG;
   }
 
-  fwrite(&temppage, sizeof(DIR_ENTRY_PAGE), 1, fptr);
+  memcpy(&(snapshot.pages[0]), &temppage, sizeof(DIR_ENTRY_PAGE));
 
 // Second page
   memset(&temppage, 0, sizeof(DIR_ENTRY_PAGE));
@@ -2685,8 +2852,7 @@ TEST_F(hfuse_ll_readdirTest, TwoMaxPageEntriesWithSnapshot) {
     temppage.dir_entries[count].d_type = D_ISREG;
   }
 
-  fwrite(&temppage, sizeof(DIR_ENTRY_PAGE), 1, fptr);
-  fclose(fptr);
+  memcpy(&(snapshot.pages[1]), &temppage, sizeof(DIR_ENTRY_PAGE));
 
   dptr = opendir("/tmp/test_fuse/testlistdir");
   ASSERT_NE(0, dptr != NULL);
@@ -2698,7 +2864,7 @@ TEST_F(hfuse_ll_readdirTest, TwoMaxPageEntriesWithSnapshot) {
 
   /* Change to snapshot from here */
   dirh_ptr = &(system_fh_table.direntry_table[TEST_LISTDIR_INODE]);
-  dirh_ptr->snapshot_ptr = fopen(readdirsnap_metapath, "r");
+  dirh_ptr->snapshot = &snapshot;
   
   readdir_r(dptr, &tmp_dirent, &tmp_dirptr);
   ASSERT_NE(0, tmp_dirptr != NULL);
@@ -2715,7 +2881,7 @@ TEST_F(hfuse_ll_readdirTest, TwoMaxPageEntriesWithSnapshot) {
   readdir_r(dptr, &tmp_dirent, &tmp_dirptr);
   ASSERT_EQ(0, tmp_dirptr != NULL);
   closedir(dptr);
-  unlink(readdirsnap_metapath);
+  free(snapshot.pages);
 }
 
 /* End of the test case for the function hfuse_ll_readdir */
@@ -3689,3 +3855,125 @@ TEST_F(hfuse_ll_unlinkTest, UnlinkMinimalApkFile_RemoveEntry)
 	EXPECT_EQ(1, remove_apk_success);
 	EXPECT_STREQ(verified_apk_name, "base.apk");
 }
+
+/* Begin of the test case for the function read_prefetch_cache */
+
+class read_prefetch_cacheTest : public ::testing::Test
+{
+	protected:
+	FH_ENTRY fh;
+	BLOCK_ENTRY_PAGE page;
+
+	virtual void SetUp()
+	{
+		int32_t count;
+
+		memset(&fh, 0, sizeof(FH_ENTRY));
+		fh.last_read_block = -1;
+		fh.read_stride = 1;
+		fh.prefetch_depth = 1;
+		fh.prefetched_until = -1;
+		memset(&page, 0, sizeof(BLOCK_ENTRY_PAGE));
+		for (count = 0; count < MAX_BLOCK_ENTRIES_PER_PAGE; count++)
+			page.block_entries[count].status = ST_CLOUD;
+		num_prefetch_enqueued = 0;
+		hcfs_system->sync_paused = FALSE;
+	}
+
+	virtual void TearDown()
+	{
+		hcfs_system->sync_paused = FALSE;
+	}
+
+	int32_t read_block(int64_t block_index)
+	{
+		return read_prefetch_cache(&fh, &page, block_index, 10,
+					   block_index, 1000);
+	}
+};
+
+TEST_F(read_prefetch_cacheTest, SequentialReadDoublesDepth)
+{
+	int64_t expected[6] = {1, 2, 3, 4, 5, 6};
+
+	EXPECT_EQ(0, read_block(0));
+	EXPECT_EQ(1, fh.prefetch_depth);
+	EXPECT_EQ(0, read_block(1));
+	EXPECT_EQ(2, fh.prefetch_depth);
+	EXPECT_EQ(0, read_block(2));
+	EXPECT_EQ(4, fh.prefetch_depth);
+
+	/* Blocks already queued are not queued again */
+	ASSERT_EQ(6, num_prefetch_enqueued);
+	for (int32_t count = 0; count < 6; count++)
+		EXPECT_EQ(expected[count], prefetch_enqueued[count]);
+}
+
+TEST_F(read_prefetch_cacheTest, DepthIsBounded)
+{
+	for (int64_t count = 0; count < 10; count++)
+		EXPECT_EQ(0, read_block(count));
+	EXPECT_EQ(MAX_PREFETCH_DEPTH, fh.prefetch_depth);
+	EXPECT_EQ(9 + MAX_PREFETCH_DEPTH, fh.prefetched_until);
+}
+
+TEST_F(read_prefetch_cacheTest, StridedReadFollowsStride)
+{
+	int64_t expected[4] = {1, 4, 6, 8};
+
+	EXPECT_EQ(0, read_block(0));
+	EXPECT_EQ(0, read_block(2));
+	EXPECT_EQ(2, fh.read_stride);
+	EXPECT_EQ(1, fh.prefetch_depth);
+	EXPECT_EQ(0, read_block(4));
+	EXPECT_EQ(2, fh.prefetch_depth);
+
+	ASSERT_EQ(4, num_prefetch_enqueued);
+	for (int32_t count = 0; count < 4; count++)
+		EXPECT_EQ(expected[count], prefetch_enqueued[count]);
+}
+
+TEST_F(read_prefetch_cacheTest, RandomReadResetsDepth)
+{
+	EXPECT_EQ(0, read_block(10));
+	EXPECT_EQ(0, read_block(11));
+	EXPECT_EQ(2, fh.prefetch_depth);
+
+	num_prefetch_enqueued = 0;
+	EXPECT_EQ(0, read_block(3));
+	EXPECT_EQ(1, fh.read_stride);
+	EXPECT_EQ(1, fh.prefetch_depth);
+	ASSERT_EQ(1, num_prefetch_enqueued);
+	EXPECT_EQ(4, prefetch_enqueued[0]);
+}
+
+TEST_F(read_prefetch_cacheTest, LocalBlocksAreNotQueued)
+{
+	page.block_entries[1].status = ST_BOTH;
+	page.block_entries[2].status = ST_LDISK;
+
+	EXPECT_EQ(0, read_block(0));
+	EXPECT_EQ(0, num_prefetch_enqueued);
+	EXPECT_EQ(0, read_block(1));
+	ASSERT_EQ(1, num_prefetch_enqueued);
+	EXPECT_EQ(3, prefetch_enqueued[0]);
+}
+
+TEST_F(read_prefetch_cacheTest, SyncPaused_NextBlockInCloud)
+{
+	hcfs_system->sync_paused = TRUE;
+
+	EXPECT_EQ(-EIO, read_block(0));
+	EXPECT_EQ(0, num_prefetch_enqueued);
+}
+
+TEST_F(read_prefetch_cacheTest, SyncPaused_NextBlockLocal)
+{
+	hcfs_system->sync_paused = TRUE;
+	page.block_entries[1].status = ST_BOTH;
+
+	EXPECT_EQ(0, read_block(0));
+	EXPECT_EQ(0, num_prefetch_enqueued);
+}
+
+/* End of the test case for the function read_prefetch_cache */
@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define FUSE_USE_VERSION 29
+
+#include <stdio.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <errno.h>
+
+#include <fuse/fuse_lowlevel.h>
+
+extern "C" {
+#include "fuseop.h"
+#include "global.h"
+#include "params.h"
+#include "filetables.h"
+#include "mount_manager.h"
+#include "FS_manager.h"
+}
+#include "gtest/gtest.h"
+
+#include "fake_misc.h"
+
+/* hfuse_ll_readdirplus is called directly in this test, so replies to the
+kernel are replaced by the fakes below, which record the listed entries */
+
+#define TEST_DIRH 5
+#define MAX_REPLIED_ENTRIES 20
+/* Same size as an entry in libfuse, from the name offset in the kernel
+struct fuse_direntplus */
+#define FAKE_DIRENTPLUS_SIZE(name) ((152 + strlen(name) + 7) & ~((size_t) 7))
+
+SYSTEM_CONF_STRUCT *system_config;
+
+typedef struct {
+	char name[MAX_FILENAME_LEN + 1];
+	struct fuse_entry_param param;
+	off_t next_offset;
+} REPLIED_ENTRY;
+
+static MOUNT_T readdirplus_mount;
+static REPLIED_ENTRY replied_entries[MAX_REPLIED_ENTRIES];
+static int32_t num_replied_entries;
+static size_t replied_size;
+static int32_t replied_err;
+
+extern "C" {
+void hfuse_ll_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size,
+			  off_t offset, struct fuse_file_info *file_info);
+
+void *fuse_req_userdata(fuse_req_t req)
+{
+	return &readdirplus_mount;
+}
+
+size_t fuse_add_direntry_plus(fuse_req_t req, char *buf, size_t bufsize,
+			      const char *name,
+			      const struct fuse_entry_param *e, off_t off)
+{
+	size_t entry_size = FAKE_DIRENTPLUS_SIZE(name);
+
+	if ((buf == NULL) || (entry_size > bufsize))
+		return entry_size;
+	if (num_replied_entries < MAX_REPLIED_ENTRIES) {
+		strcpy(replied_entries[num_replied_entries].name, name);
+		memcpy(&(replied_entries[num_replied_entries].param), e,
+		       sizeof(struct fuse_entry_param));
+		replied_entries[num_replied_entries].next_offset = off;
+	}
+	num_replied_entries++;
+	return entry_size;
+}
+
+int fuse_reply_buf(fuse_req_t req, const char *buf, size_t size)
+{
+	replied_size = size;
+	return 0;
+}
+
+int fuse_reply_err(fuse_req_t req, int err)
+{
+	replied_err = err;
+	return 0;
+}
+}
+
+class readdirplusEnvironment : public ::testing::Environment {
+ public:
+  virtual void SetUp() {
+    system_config = (SYSTEM_CONF_STRUCT *) calloc(1, sizeof(SYSTEM_CONF_STRUCT));
+    hcfs_system = (SYSTEM_DATA_HEAD *) calloc(1, sizeof(SYSTEM_DATA_HEAD));
+    sem_init(&(hcfs_system->access_sem), 0, 1);
+    hcfs_system->data_app_root = TEST_APPROOT_INODE;
+
+    system_fh_table.entry_table_flags = (uint8_t *) calloc(100, sizeof(char));
+    system_fh_table.entry_table = (FH_ENTRY *) calloc(100, sizeof(FH_ENTRY));
+    system_fh_table.direntry_table =
+        (DIRH_ENTRY *) calloc(100, sizeof(DIRH_ENTRY));
+    sem_init(&(system_fh_table.fh_table_sem), 0, 1);
+
+    memset(&readdirplus_mount, 0, sizeof(MOUNT_T));
+    readdirplus_mount.f_ino = 1;
+    readdirplus_mount.volume_type = ANDROID_INTERNAL;
+  }
+
+  virtual void TearDown() {
+    free(system_fh_table.entry_table_flags);
+    free(system_fh_table.entry_table);
+    free(system_fh_table.direntry_table);
+    free(hcfs_system);
+    free(system_config);
+  }
+};
+
+::testing::Environment* const readdirplus_env =
+  ::testing::AddGlobalTestEnvironment(new readdirplusEnvironment);
+
+/* Begin of the test case for the function hfuse_ll_readdirplus */
+class hfuse_ll_readdirplusTest : public ::testing::Test {
+ protected:
+  struct fuse_file_info file_info;
+  int64_t page_pos;
+
+  virtual void SetUp() {
+    snprintf(readdir_metapath, 100, "/tmp/readdirplus_meta");
+    before_update_file_data = TRUE;
+    root_updated = FALSE;
+    hcfs_system->system_restoring = NOT_RESTORING;
+    hcfs_system->use_minimal_apk = FALSE;
+    system_fh_table.entry_table_flags[TEST_DIRH] = IS_DIRH;
+    system_fh_table.direntry_table[TEST_DIRH].thisinode = TEST_LISTDIR_INODE;
+    system_fh_table.direntry_table[TEST_DIRH].snapshot = NULL;
+    memset(&file_info, 0, sizeof(struct fuse_file_info));
+    file_info.fh = TEST_DIRH;
+    page_pos = sizeof(HCFS_STAT) + sizeof(DIR_META_TYPE);
+
+    memset(replied_entries, 0, sizeof(replied_entries));
+    num_replied_entries = 0;
+    replied_size = 0;
+    replied_err = 0;
+    write_dir_meta();
+  }
+
+  virtual void TearDown() {
+    system_fh_table.entry_table_flags[TEST_DIRH] = NO_FH;
+    if (access(readdir_metapath, F_OK) == 0)
+      unlink(readdir_metapath);
+  }
+
+  /* Write a dir meta of one page with ".", "..", "test1" and "test2" */
+  void write_dir_meta() {
+    FILE *fptr;
+    HCFS_STAT tempstat;
+    DIR_META_TYPE temphead;
+    DIR_ENTRY_PAGE temppage;
+
+    memset(&tempstat, 0, sizeof(HCFS_STAT));
+    memset(&temphead, 0, sizeof(DIR_META_TYPE));
+    temphead.total_children = 2;
+    temphead.root_entry_page = page_pos;
+    temphead.tree_walk_list_head = page_pos;
+
+    memset(&temppage, 0, sizeof(DIR_ENTRY_PAGE));
+    temppage.num_entries = 4;
+    temppage.this_page_pos = page_pos;
+    set_entry(&temppage, 0, TEST_LISTDIR_INODE, ".", D_ISDIR);
+    set_entry(&temppage, 1, 1, "..", D_ISDIR);
+    set_entry(&temppage, 2, 18, "test1", D_ISREG);
+    set_entry(&temppage, 3, 6, "test2", D_ISDIR);
+
+    fptr = fopen(readdir_metapath, "w");
+    ASSERT_TRUE(fptr != NULL);
+    fwrite(&tempstat, sizeof(HCFS_STAT), 1, fptr);
+    fwrite(&temphead, sizeof(DIR_META_TYPE), 1, fptr);
+    fwrite(&temppage, sizeof(DIR_ENTRY_PAGE), 1, fptr);
+    fclose(fptr);
+  }
+
+  void set_entry(DIR_ENTRY_PAGE *page, int32_t index, ino_t ino,
+                 const char *name, char d_type) {
+    page->dir_entries[index].d_ino = ino;
+    snprintf(page->dir_entries[index].d_name, MAX_FILENAME_LEN, "%s", name);
+    page->dir_entries[index].d_type = d_type;
+  }
+
+  /* Offset to continue listing after entry "index" of the page */
+  off_t next_offset(int32_t index) {
+    return page_pos * (MAX_DIR_ENTRIES_PER_PAGE + 1) + index + 1;
+  }
+};
+
+TEST_F(hfuse_ll_readdirplusTest, NotDirHandle) {
+  system_fh_table.entry_table_flags[TEST_DIRH] = IS_FH;
+
+  hfuse_ll_readdirplus(NULL, TEST_LISTDIR_INODE, 4096, 0, &file_info);
+  EXPECT_EQ(EBADF, replied_err);
+  EXPECT_EQ(0, num_replied_entries);
+}
+
+TEST_F(hfuse_ll_readdirplusTest, RepliesEntriesWithAttributes) {
+  hfuse_ll_readdirplus(NULL, TEST_LISTDIR_INODE, 4096, 0, &file_info);
+  ASSERT_EQ(0, replied_err);
+  ASSERT_EQ(4, num_replied_entries);
+  EXPECT_EQ(FAKE_DIRENTPLUS_SIZE(".") + FAKE_DIRENTPLUS_SIZE("..") +
+            FAKE_DIRENTPLUS_SIZE("test1") + FAKE_DIRENTPLUS_SIZE("test2"),
+            replied_size);
+
+  /* No lookup count is taken for "." and ".." */
+  EXPECT_STREQ(".", replied_entries[0].name);
+  EXPECT_EQ(0, replied_entries[0].param.ino);
+  EXPECT_EQ(TEST_LISTDIR_INODE, replied_entries[0].param.attr.st_ino);
+  EXPECT_TRUE(S_ISDIR(replied_entries[0].param.attr.st_mode));
+  EXPECT_STREQ("..", replied_entries[1].name);
+  EXPECT_EQ(0, replied_entries[1].param.ino);
+
+  EXPECT_STREQ("test1", replied_entries[2].name);
+  EXPECT_EQ(18, replied_entries[2].param.ino);
+  EXPECT_EQ(18, replied_entries[2].param.attr.st_ino);
+  EXPECT_EQ(S_IFREG | 0700, replied_entries[2].param.attr.st_mode);
+  EXPECT_STREQ("test2", replied_entries[3].name);
+  EXPECT_EQ(6, replied_entries[3].param.ino);
+  EXPECT_EQ(S_IFDIR | 0700, replied_entries[3].param.attr.st_mode);
+
+  for (int32_t count = 0; count < 4; count++)
+    EXPECT_EQ(next_offset(count), replied_entries[count].next_offset);
+}
+
+TEST_F(hfuse_ll_readdirplusTest, SmallBufferRepliesPartially) {
+  size_t size;
+
+  /* Only "." and ".." fit in the buffer */
+  size = FAKE_DIRENTPLUS_SIZE(".") + FAKE_DIRENTPLUS_SIZE("..");
+  hfuse_ll_readdirplus(NULL, TEST_LISTDIR_INODE, size, 0, &file_info);
+  ASSERT_EQ(0, replied_err);
+  ASSERT_EQ(2, num_replied_entries);
+  EXPECT_EQ(size, replied_size);
+  EXPECT_STREQ("..", replied_entries[1].name);
+  EXPECT_EQ(next_offset(1), replied_entries[1].next_offset);
+}
+
+TEST_F(hfuse_ll_readdirplusTest, ContinuesFromSnapshot) {
+  DIR_SNAPSHOT snapshot;
+
+  /* The dir was modified after listing "." and "..", and the snapshot
+     has the entries before the change */
+  memset(&snapshot, 0, sizeof(DIR_SNAPSHOT));
+  snapshot.num_pages = 1;
+  snapshot.pages = (DIR_ENTRY_PAGE *) calloc(1, sizeof(DIR_ENTRY_PAGE));
+  snapshot.dir_meta.total_children = 1;
+  snapshot.dir_meta.tree_walk_list_head = page_pos;
+  snapshot.pages[0].num_entries = 3;
+  snapshot.pages[0].this_page_pos = page_pos;
+  set_entry(&(snapshot.pages[0]), 0, TEST_LISTDIR_INODE, ".", D_ISDIR);
+  set_entry(&(snapshot.pages[0]), 1, 1, "..", D_ISDIR);
+  set_entry(&(snapshot.pages[0]), 2, 19, "removed", D_ISREG);
+  system_fh_table.direntry_table[TEST_DIRH].snapshot = &snapshot;
+
+  hfuse_ll_readdirplus(NULL, TEST_LISTDIR_INODE, 4096, next_offset(1),
+                       &file_info);
+  ASSERT_EQ(0, replied_err);
+  ASSERT_EQ(1, num_replied_entries);
+  EXPECT_STREQ("removed", replied_entries[0].name);
+  EXPECT_EQ(19, replied_entries[0].param.ino);
+  EXPECT_EQ(S_IFREG | 0500, replied_entries[0].param.attr.st_mode);
+  EXPECT_EQ(next_offset(2), replied_entries[0].next_offset);
+
+  system_fh_table.direntry_table[TEST_DIRH].snapshot = NULL;
+  free(snapshot.pages);
+}
+
+/* End of the test case for the function hfuse_ll_readdirplus */
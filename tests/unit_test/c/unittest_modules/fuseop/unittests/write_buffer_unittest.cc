@@ -0,0 +1,314 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+extern "C" {
+#include "write_buffer.h"
+#include "fuseop.h"
+#include "params.h"
+}
+#include "gtest/gtest.h"
+
+SYSTEM_CONF_STRUCT *system_config;
+
+/* Records of write_buffered_data calls */
+#define MAX_FLUSH_RECORDS 16
+typedef struct {
+	ino_t this_inode;
+	off_t offset;
+	size_t size;
+	char data[WRITE_BUFFER_SIZE];
+} FLUSH_RECORD;
+
+static FLUSH_RECORD flush_records[MAX_FLUSH_RECORDS];
+static int32_t num_flush_records;
+static int64_t flush_return_error;
+
+extern "C" {
+int32_t write_log(int32_t level, const char *format, ...)
+{
+	return 0;
+}
+
+int64_t write_buffered_data(MOUNT_T *mptr, ino_t this_inode,
+			    const char *buf, size_t size, off_t offset)
+{
+	FLUSH_RECORD *record;
+
+	if (num_flush_records < MAX_FLUSH_RECORDS) {
+		record = &flush_records[num_flush_records];
+		record->this_inode = this_inode;
+		record->offset = offset;
+		record->size = size;
+		memcpy(record->data, buf, size);
+	}
+	num_flush_records++;
+	if (flush_return_error != 0)
+		return flush_return_error;
+	return size;
+}
+}
+
+class write_bufferTest : public ::testing::Test {
+ protected:
+  virtual void SetUp()
+  {
+    system_config = (SYSTEM_CONF_STRUCT *)
+        calloc(1, sizeof(SYSTEM_CONF_STRUCT));
+    system_config->max_block_size = 65536;
+    hcfs_system = (SYSTEM_DATA_HEAD *) calloc(1, sizeof(SYSTEM_DATA_HEAD));
+    hcfs_system->systemdata.system_quota = 1024 * 1024 * 1024;
+    system_config->max_pinned_limit = (int64_t *)
+        calloc(NUM_PIN_TYPES, sizeof(int64_t));
+    system_config->max_pinned_limit[P_PIN] = 512 * 1024 * 1024;
+    system_config->max_pinned_limit[P_HIGH_PRI_PIN] = 512 * 1024 * 1024;
+    num_flush_records = 0;
+    flush_return_error = 0;
+    ASSERT_EQ(0, init_write_buffer());
+  }
+
+  virtual void TearDown()
+  {
+    flush_return_error = 0;
+    destroy_write_buffer();
+    free(hcfs_system);
+    free(system_config->max_pinned_limit);
+    free(system_config);
+  }
+
+  void fill(char *buf, size_t size, char val)
+  {
+    memset(buf, val, size);
+  }
+};
+
+TEST_F(write_bufferTest, SmallSequentialWritesAreMerged)
+{
+  char buf[4096];
+  int32_t count;
+
+  for (count = 0; count < 3; count++) {
+    fill(buf, sizeof(buf), 'a' + count);
+    ASSERT_EQ(4096, write_buffer_append(NULL, 2, 5, buf, sizeof(buf),
+                                        count * 4096));
+  }
+  EXPECT_EQ(0, num_flush_records);
+
+  ASSERT_EQ(0, write_buffer_flush_fh(2, 5));
+  ASSERT_EQ(1, num_flush_records);
+  EXPECT_EQ(2, flush_records[0].this_inode);
+  EXPECT_EQ(0, flush_records[0].offset);
+  EXPECT_EQ(3 * 4096, flush_records[0].size);
+  EXPECT_EQ('a', flush_records[0].data[0]);
+  EXPECT_EQ('b', flush_records[0].data[4096]);
+  EXPECT_EQ('c', flush_records[0].data[3 * 4096 - 1]);
+
+  /* Nothing left to flush */
+  ASSERT_EQ(0, write_buffer_flush_fh(2, 5));
+  EXPECT_EQ(1, num_flush_records);
+}
+
+TEST_F(write_bufferTest, NonSequentialWriteFlushesFirst)
+{
+  char buf[100] = {0};
+
+  fill(buf, sizeof(buf), 'x');
+  ASSERT_EQ(100, write_buffer_append(NULL, 2, 5, buf, 100, 0));
+  ASSERT_EQ(100, write_buffer_append(NULL, 2, 5, buf, 100, 5000));
+  ASSERT_EQ(1, num_flush_records);
+  EXPECT_EQ(0, flush_records[0].offset);
+  EXPECT_EQ(100, flush_records[0].size);
+
+  ASSERT_EQ(0, write_buffer_flush_inode(2));
+  ASSERT_EQ(2, num_flush_records);
+  EXPECT_EQ(5000, flush_records[1].offset);
+}
+
+TEST_F(write_bufferTest, StatIncludesBufferedWrites)
+{
+  char buf[100] = {0};
+  HCFS_STAT thisstat;
+
+  memset(&thisstat, 0, sizeof(HCFS_STAT));
+  thisstat.size = 50;
+  fill(buf, sizeof(buf), 'x');
+  ASSERT_EQ(100, write_buffer_append(NULL, 2, 5, buf, 100, 0));
+
+  /* Stat is updated without writing the data out */
+  write_buffer_update_stat(2, &thisstat);
+  EXPECT_EQ(0, num_flush_records);
+  EXPECT_EQ(100, thisstat.size);
+  EXPECT_EQ(1, thisstat.blocks);
+  EXPECT_NE(0, thisstat.mtime);
+  EXPECT_EQ(thisstat.mtime, thisstat.ctime);
+
+  /* Files without buffered writes are not changed */
+  memset(&thisstat, 0, sizeof(HCFS_STAT));
+  write_buffer_update_stat(3, &thisstat);
+  EXPECT_EQ(0, thisstat.size);
+  EXPECT_EQ(0, thisstat.mtime);
+}
+
+TEST_F(write_bufferTest, WriteFromOtherHandleFlushesFirst)
+{
+  char buf[100] = {0};
+
+  fill(buf, sizeof(buf), 'x');
+  ASSERT_EQ(100, write_buffer_append(NULL, 2, 5, buf, 100, 0));
+  /* Sequential, but through another handle */
+  ASSERT_EQ(100, write_buffer_append(NULL, 2, 6, buf, 100, 100));
+  ASSERT_EQ(1, num_flush_records);
+  EXPECT_EQ(0, flush_records[0].offset);
+
+  /* Buffered data of other inodes is not touched */
+  ASSERT_EQ(0, write_buffer_flush_inode(3));
+  EXPECT_EQ(1, num_flush_records);
+}
+
+TEST_F(write_bufferTest, LargeWriteIsNotBuffered)
+{
+  static char buf[MAX_BUFFERED_WRITE_SIZE + 1];
+
+  ASSERT_EQ(0, write_buffer_append(NULL, 2, 5, buf, sizeof(buf), 0));
+  EXPECT_EQ(0, num_flush_records);
+
+  /* Pending data is written before the large write */
+  ASSERT_EQ(100, write_buffer_append(NULL, 2, 5, buf, 100, 0));
+  ASSERT_EQ(0, write_buffer_append(NULL, 2, 5, buf, sizeof(buf), 100));
+  ASSERT_EQ(1, num_flush_records);
+  EXPECT_EQ(100, flush_records[0].size);
+}
+
+TEST_F(write_bufferTest, BlockBoundaryFlushes)
+{
+  char buf[4096];
+
+  fill(buf, sizeof(buf), 'x');
+  /* Write ending at the block boundary is written out at once */
+  ASSERT_EQ(4096, write_buffer_append(NULL, 2, 5, buf, sizeof(buf),
+                                      65536 - 4096));
+  ASSERT_EQ(1, num_flush_records);
+  EXPECT_EQ(65536 - 4096, flush_records[0].offset);
+
+  /* Write crossing the block boundary is not buffered */
+  ASSERT_EQ(0, write_buffer_append(NULL, 2, 5, buf, sizeof(buf),
+                                   65536 * 2 - 100));
+  EXPECT_EQ(1, num_flush_records);
+}
+
+TEST_F(write_bufferTest, BufferFullFlushes)
+{
+  char buf[MAX_BUFFERED_WRITE_SIZE];
+  int32_t count, num_writes;
+
+  system_config->max_block_size = 1048576;
+  num_writes = WRITE_BUFFER_SIZE / MAX_BUFFERED_WRITE_SIZE;
+  for (count = 0; count < num_writes; count++)
+    ASSERT_EQ(MAX_BUFFERED_WRITE_SIZE,
+              write_buffer_append(NULL, 2, 5, buf, sizeof(buf),
+                                  count * MAX_BUFFERED_WRITE_SIZE));
+  ASSERT_EQ(1, num_flush_records);
+  EXPECT_EQ(WRITE_BUFFER_SIZE, flush_records[0].size);
+}
+
+TEST_F(write_bufferTest, NoBufferingWhenSystemIsFull)
+{
+  char buf[100] = {0};
+
+  hcfs_system->systemdata.system_size =
+      hcfs_system->systemdata.system_quota;
+  ASSERT_EQ(0, write_buffer_append(NULL, 2, 5, buf, 100, 0));
+  EXPECT_EQ(0, num_flush_records);
+}
+
+TEST_F(write_bufferTest, NoBufferingWhenPinnedSpaceIsFull)
+{
+  char buf[100] = {0};
+
+  /* Buffered data could exceed the smaller pinned limit */
+  system_config->max_pinned_limit[P_PIN] = 256 * 1024 * 1024;
+  hcfs_system->systemdata.pinned_size = 256 * 1024 * 1024 -
+      WRITE_BUFFER_SIZE;
+  ASSERT_EQ(0, write_buffer_append(NULL, 2, 5, buf, 100, 0));
+  EXPECT_EQ(0, num_flush_records);
+
+  /* Enough room for all buffers */
+  hcfs_system->systemdata.pinned_size = 256 * 1024 * 1024 -
+      (int64_t)MAX_WRITE_BUFFERS * WRITE_BUFFER_SIZE;
+  ASSERT_EQ(100, write_buffer_append(NULL, 2, 5, buf, 100, 0));
+  ASSERT_EQ(0, write_buffer_flush_fh(2, 5));
+  EXPECT_EQ(1, num_flush_records);
+}
+
+TEST_F(write_bufferTest, FlushErrorReportedToOwner)
+{
+  char buf[100] = {0};
+
+  ASSERT_EQ(100, write_buffer_append(NULL, 2, 5, buf, 100, 0));
+  flush_return_error = -ENOSPC;
+  EXPECT_EQ(-ENOSPC, write_buffer_flush_inode(2));
+  flush_return_error = 0;
+
+  /* Other handles do not get the error nor buffer meanwhile */
+  EXPECT_EQ(0, write_buffer_flush_fh(2, 6));
+  EXPECT_EQ(0, write_buffer_append(NULL, 2, 6, buf, 100, 100));
+
+  EXPECT_EQ(-ENOSPC, write_buffer_flush_fh(2, 5));
+  EXPECT_EQ(0, write_buffer_flush_fh(2, 5));
+  EXPECT_EQ(1, num_flush_records);
+}
+
+TEST_F(write_bufferTest, FlushErrorReturnedToNextWrite)
+{
+  char buf[100] = {0};
+
+  ASSERT_EQ(100, write_buffer_append(NULL, 2, 5, buf, 100, 0));
+  flush_return_error = -EIO;
+  EXPECT_EQ(-EIO, write_buffer_append(NULL, 2, 5, buf, 100, 9000));
+  flush_return_error = 0;
+  EXPECT_EQ(0, write_buffer_flush_fh(2, 5));
+}
+
+TEST_F(write_bufferTest, ExpiredDataIsWrittenOut)
+{
+  char buf[100] = {0};
+  int32_t count;
+
+  ASSERT_EQ(100, write_buffer_append(NULL, 2, 5, buf, 100, 0));
+  for (count = 0; count < 40; count++) {
+    if (num_flush_records > 0)
+      break;
+    usleep(50000);
+  }
+  ASSERT_EQ(1, num_flush_records);
+  EXPECT_EQ(100, flush_records[0].size);
+}
+
+TEST_F(write_bufferTest, DestroyWritesOutEverything)
+{
+  char buf[100] = {0};
+
+  ASSERT_EQ(100, write_buffer_append(NULL, 2, 5, buf, 100, 0));
+  ASSERT_EQ(100, write_buffer_append(NULL, 3, 6, buf, 100, 0));
+  destroy_write_buffer();
+  EXPECT_EQ(2, num_flush_records);
+  ASSERT_EQ(0, init_write_buffer());
+}
@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+extern "C" {
+#include "cache_policy.h"
+}
+#include "gtest/gtest.h"
+
+extern "C" {
+int32_t write_log(int32_t level, const char *format, ...)
+{
+	return 0;
+}
+}
+
+#define TRACE_PATH "/tmp/cache_policy_trace"
+
+class cache_policyTest : public ::testing::Test {
+ protected:
+  virtual void TearDown()
+  {
+    destroy_cache_policy();
+    unlink(TRACE_PATH);
+  }
+
+  void expect_victim(ino_t inode, int64_t block)
+  {
+    ino_t victim_inode;
+    int64_t victim_block;
+
+    ASSERT_EQ(0, cache_policy_pick_victim(&victim_inode, &victim_block));
+    EXPECT_EQ(inode, victim_inode);
+    EXPECT_EQ(block, victim_block);
+  }
+};
+
+TEST_F(cache_policyTest, InodePolicyTracksNothing)
+{
+  ino_t victim_inode;
+  int64_t victim_block;
+
+  ASSERT_EQ(0, init_cache_policy(CACHE_POLICY_INODE, 100, TRACE_PATH));
+  EXPECT_FALSE(cache_policy_enabled());
+  cache_policy_access(2, 0, 10, FALSE);
+  EXPECT_EQ(CP_QUEUE_NONE, cache_policy_lookup(2, 0));
+  EXPECT_EQ(-ENOENT, cache_policy_pick_victim(&victim_inode, &victim_block));
+  EXPECT_NE(0, access(TRACE_PATH, F_OK));
+}
+
+TEST_F(cache_policyTest, InvalidArguments)
+{
+  EXPECT_EQ(-EINVAL, init_cache_policy(5, 100, NULL));
+  EXPECT_EQ(-EINVAL, init_cache_policy(CACHE_POLICY_LRU, 0, NULL));
+  ASSERT_EQ(0, init_cache_policy(CACHE_POLICY_INODE, 100, NULL));
+}
+
+TEST_F(cache_policyTest, LRUPicksLeastRecentlyUsed)
+{
+  ASSERT_EQ(0, init_cache_policy(CACHE_POLICY_LRU, 100, NULL));
+  EXPECT_TRUE(cache_policy_enabled());
+  cache_policy_access(2, 0, 2, FALSE);
+  cache_policy_access(3, 0, 0, TRUE);
+  cache_policy_access(2, 0, 0, FALSE);
+
+  expect_victim(2, 1);
+  cache_policy_evicted(2, 1);
+  EXPECT_EQ(CP_QUEUE_NONE, cache_policy_lookup(2, 1));
+  expect_victim(2, 2);
+  cache_policy_evicted(2, 2);
+  expect_victim(3, 0);
+}
+
+TEST_F(cache_policyTest, KeptAndForgottenBlocks)
+{
+  ASSERT_EQ(0, init_cache_policy(CACHE_POLICY_LRU, 100, NULL));
+  cache_policy_access(2, 0, 2, FALSE);
+
+  expect_victim(2, 0);
+  cache_policy_kept(2, 0);
+  expect_victim(2, 1);
+  cache_policy_forget(2, 1);
+  EXPECT_EQ(CP_QUEUE_NONE, cache_policy_lookup(2, 1));
+  expect_victim(2, 2);
+  cache_policy_forget(2, 2);
+  expect_victim(2, 0);
+}
+
+TEST_F(cache_policyTest, TwoQPagesOutOnceAccessedBlocksFirst)
+{
+  ASSERT_EQ(0, init_cache_policy(CACHE_POLICY_2Q, 100, NULL));
+  cache_policy_access(2, 0, 3, FALSE);
+  EXPECT_EQ(CP_QUEUE_A1IN, cache_policy_lookup(2, 0));
+
+  /* Re-access while in A1in does not promote the block */
+  cache_policy_access(2, 0, 0, FALSE);
+  EXPECT_EQ(CP_QUEUE_A1IN, cache_policy_lookup(2, 0));
+  expect_victim(2, 0);
+  cache_policy_evicted(2, 0);
+  EXPECT_EQ(CP_QUEUE_A1OUT, cache_policy_lookup(2, 0));
+
+  /* Block accessed again after paged out goes to Am */
+  cache_policy_access(2, 0, 0, FALSE);
+  EXPECT_EQ(CP_QUEUE_AM, cache_policy_lookup(2, 0));
+
+  /* Blocks in A1in are paged out before the hot block */
+  expect_victim(2, 1);
+  cache_policy_evicted(2, 1);
+  expect_victim(2, 2);
+  cache_policy_evicted(2, 2);
+  expect_victim(2, 3);
+  cache_policy_evicted(2, 3);
+  expect_victim(2, 0);
+  cache_policy_evicted(2, 0);
+  EXPECT_EQ(CP_QUEUE_NONE, cache_policy_lookup(2, 0));
+}
+
+TEST_F(cache_policyTest, TrackedBlocksAreLimited)
+{
+  ASSERT_EQ(0, init_cache_policy(CACHE_POLICY_2Q, 4, NULL));
+  cache_policy_access(2, 0, 9, FALSE);
+  EXPECT_EQ(CP_QUEUE_NONE, cache_policy_lookup(2, 5));
+  EXPECT_EQ(CP_QUEUE_A1IN, cache_policy_lookup(2, 6));
+  EXPECT_EQ(CP_QUEUE_A1IN, cache_policy_lookup(2, 9));
+
+  /* Ghost entries are limited too */
+  cache_policy_evicted(2, 6);
+  cache_policy_evicted(2, 7);
+  cache_policy_evicted(2, 8);
+  EXPECT_EQ(CP_QUEUE_NONE, cache_policy_lookup(2, 6));
+  EXPECT_EQ(CP_QUEUE_A1OUT, cache_policy_lookup(2, 7));
+  EXPECT_EQ(CP_QUEUE_A1OUT, cache_policy_lookup(2, 8));
+}
+
+TEST_F(cache_policyTest, AccessesAreTraced)
+{
+  FILE *fptr;
+  char line[100];
+
+  unlink(TRACE_PATH);
+  ASSERT_EQ(0, init_cache_policy(CACHE_POLICY_LRU, 100, TRACE_PATH));
+  cache_policy_access(2, 3, 4, FALSE);
+  cache_policy_access(5, 0, 0, TRUE);
+  destroy_cache_policy();
+  ASSERT_EQ(0, init_cache_policy(CACHE_POLICY_INODE, 100, NULL));
+
+  fptr = fopen(TRACE_PATH, "r");
+  ASSERT_TRUE(fptr != NULL);
+  ASSERT_TRUE(fgets(line, sizeof(line), fptr) != NULL);
+  EXPECT_STREQ("2 3 R\n", line);
+  ASSERT_TRUE(fgets(line, sizeof(line), fptr) != NULL);
+  EXPECT_STREQ("2 4 R\n", line);
+  ASSERT_TRUE(fgets(line, sizeof(line), fptr) != NULL);
+  EXPECT_STREQ("5 0 W\n", line);
+  EXPECT_TRUE(fgets(line, sizeof(line), fptr) == NULL);
+  fclose(fptr);
+}
@@ -18,8 +18,11 @@
  */
 #include "fuseop.h"
 #include "hcfs_cachebuild.h"
+#include "cache_policy.h"
 #include "mock_params.h"
 #include "super_block.h"
+#include "block_fd_cache.h"
+#include <errno.h>
 #include <inttypes.h>
 #include <stdarg.h>
 #include <string.h>
@@ -53,11 +56,68 @@ int32_t fetch_meta_path(char *pathname, ino_t this_inode)
 	return 0;
 }
 
-int32_t build_cache_usage(void)
+int32_t build_cache_usage_index(BOOL force_scan)
 {
 	return 0;
 }
 
+/* Pick the mock cache usage nodes one by one */
+int32_t cache_usage_index_pick_victim(ino_t *this_inode, int64_t recent_int)
+{
+	static int32_t pick_index = 0;
+
+	while (pick_index < CACHE_USAGE_NUM_ENTRIES) {
+		if (inode_cache_usage_hash[pick_index] != NULL) {
+			*this_inode = inode_cache_usage_hash[pick_index]->this_inode;
+			pick_index++;
+			return 0;
+		}
+		pick_index++;
+	}
+	return -ENOENT;
+}
+
+void cache_usage_index_reset_round(void)
+{
+	return;
+}
+
+void cache_usage_index_update(ino_t this_inode, int64_t cached_size,
+			      int64_t dirty_size)
+{
+	return;
+}
+
+void cache_usage_index_remove(ino_t this_inode)
+{
+	return;
+}
+
+BOOL cache_policy_enabled(void)
+{
+	return FALSE;
+}
+
+int32_t cache_policy_pick_victim(ino_t *this_inode, int64_t *block_no)
+{
+	return -ENOENT;
+}
+
+void cache_policy_evicted(ino_t this_inode, int64_t block_no)
+{
+	return;
+}
+
+void cache_policy_kept(ino_t this_inode, int64_t block_no)
+{
+	return;
+}
+
+void cache_policy_forget(ino_t this_inode, int64_t block_no)
+{
+	return;
+}
+
 int32_t super_block_read(ino_t this_inode, SUPER_BLOCK_ENTRY *inode_ptr)
 {
 	if (inode_ptr == NULL)
@@ -79,14 +139,6 @@ int32_t super_block_mark_dirty(ino_t this_inode)
 	return 0;	
 }
 
-CACHE_USAGE_NODE *return_cache_usage_node(ino_t this_inode)
-{
-	if (this_inode > 0)
-		nonempty_cache_hash_entries--;
-	
-	return NULL;
-}
-
 int64_t seek_page2(FILE_META_TYPE *temp_meta, FILE *fptr, 
 	int64_t target_page, int64_t hint_page)
 {	
@@ -130,3 +182,8 @@ int32_t change_system_meta(int64_t system_data_size_delta,
 	hcfs_system->systemdata.cache_blocks += cache_blocks_delta;
 	return 0;
 }
+
+void invalidate_block_fd(ino_t this_inode, int64_t block_no)
+{
+	return;
+}
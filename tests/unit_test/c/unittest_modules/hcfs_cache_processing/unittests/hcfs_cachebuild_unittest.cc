@@ -420,3 +420,217 @@ TEST_F(build_cache_usageTest, BuildCacheUsageSuccess)
 /*
 	End of unittest for build_cache_usage()
  */
+
+/*
+	Unittest for cache usage index
+ */
+
+class cache_usage_indexTest : public BaseClassForCacheUsageArray {
+protected:
+	char index_path[200];
+
+	void SetUp()
+	{
+		BaseClassForCacheUsageArray::SetUp();
+
+		system_config = (SYSTEM_CONF_STRUCT *)
+			malloc(sizeof(SYSTEM_CONF_STRUCT));
+		memset(system_config, 0, sizeof(SYSTEM_CONF_STRUCT));
+		init_mock_system_config();
+		system_config->metapath = (char *) malloc(100);
+		strcpy(METAPATH, "testpatterns_meta");
+		nftw(BLOCKPATH, do_delete, 20, FTW_DEPTH);
+		nftw(METAPATH, do_delete, 20, FTW_DEPTH);
+		mkdir(BLOCKPATH, 0700);
+		mkdir(METAPATH, 0700);
+		sprintf(index_path, "%s/cache_usage_index", METAPATH);
+		sem_init(&(hcfs_system->something_to_replace), 0, 0);
+		ASSERT_EQ(0, init_cache_usage_index());
+	}
+
+	void TearDown()
+	{
+		destroy_cache_usage_index();
+		nftw(BLOCKPATH, do_delete, 20, FTW_DEPTH);
+		nftw(METAPATH, do_delete, 20, FTW_DEPTH);
+		free(system_config->blockpath);
+		free(system_config->metapath);
+		free(system_config);
+
+		BaseClassForCacheUsageArray::TearDown();
+	}
+};
+
+TEST_F(cache_usage_indexTest, UpdateAndLookup)
+{
+	CACHE_USAGE_NODE node;
+
+	EXPECT_EQ(-ENOENT, cache_usage_index_lookup(5, &node));
+
+	cache_usage_index_update(5, 300, 100);
+	ASSERT_EQ(0, cache_usage_index_lookup(5, &node));
+	EXPECT_EQ(200, node.clean_cache_size);
+	EXPECT_EQ(100, node.dirty_cache_size);
+	EXPECT_GT(node.last_access_time, 0);
+
+	/* Nothing cached anymore */
+	cache_usage_index_update(5, 0, 0);
+	EXPECT_EQ(-ENOENT, cache_usage_index_lookup(5, &node));
+}
+
+TEST_F(cache_usage_indexTest, PickLeastRecentlyUsedFirst)
+{
+	ino_t victim;
+
+	cache_usage_index_update(1, 100, 0);
+	cache_usage_index_update(2, 300, 0);
+	cache_usage_index_update(3, 200, 0);
+	/* Only dirty data. Cannot be paged out */
+	cache_usage_index_update(4, 500, 500);
+
+	/* Used at the same time. Larger clean cache goes first */
+	sleep(1);
+	cache_usage_index_touch(2, FALSE);
+
+	ASSERT_EQ(0, cache_usage_index_pick_victim(&victim, 0));
+	EXPECT_EQ(3, victim);
+	ASSERT_EQ(0, cache_usage_index_pick_victim(&victim, 0));
+	EXPECT_EQ(1, victim);
+	ASSERT_EQ(0, cache_usage_index_pick_victim(&victim, 0));
+	EXPECT_EQ(2, victim);
+	EXPECT_EQ(-ENOENT, cache_usage_index_pick_victim(&victim, 0));
+}
+
+TEST_F(cache_usage_indexTest, RecentlyUsedSkipped)
+{
+	ino_t victim;
+
+	cache_usage_index_update(8, 100, 0);
+	EXPECT_EQ(-EAGAIN, cache_usage_index_pick_victim(&victim, 60));
+	ASSERT_EQ(0, cache_usage_index_pick_victim(&victim, 0));
+	EXPECT_EQ(8, victim);
+}
+
+TEST_F(cache_usage_indexTest, PickedAgainInNextRound)
+{
+	ino_t victim;
+	CACHE_USAGE_NODE node;
+
+	cache_usage_index_update(8, 100, 0);
+	cache_usage_index_update(9, 100, 0);
+	ASSERT_EQ(0, cache_usage_index_pick_victim(&victim, 0));
+	ASSERT_EQ(0, cache_usage_index_pick_victim(&victim, 0));
+
+	/* Changes of picked inodes are kept, but not picked in this round */
+	cache_usage_index_update(8, 50, 0);
+	cache_usage_index_remove(9);
+	EXPECT_EQ(-ENOENT, cache_usage_index_pick_victim(&victim, 0));
+	ASSERT_EQ(0, cache_usage_index_lookup(8, &node));
+	EXPECT_EQ(50, node.clean_cache_size);
+	EXPECT_EQ(-ENOENT, cache_usage_index_lookup(9, &node));
+
+	cache_usage_index_reset_round();
+	ASSERT_EQ(0, cache_usage_index_pick_victim(&victim, 0));
+	EXPECT_EQ(8, victim);
+	EXPECT_EQ(-ENOENT, cache_usage_index_pick_victim(&victim, 0));
+}
+
+TEST_F(cache_usage_indexTest, PersistAndLoadSuccess)
+{
+	CACHE_USAGE_NODE node;
+	int64_t count;
+
+	/* Index is complete after the (empty) scan */
+	ASSERT_EQ(0, build_cache_usage_index(FALSE));
+	for (count = 1; count <= 1000; count++)
+		cache_usage_index_update(count, count * 200, count * 100);
+	destroy_cache_usage_index();
+	ASSERT_EQ(0, access(index_path, F_OK));
+
+	ASSERT_EQ(0, init_cache_usage_index());
+	/* Removed once loaded */
+	EXPECT_NE(0, access(index_path, F_OK));
+	for (count = 1; count <= 1000; count++) {
+		ASSERT_EQ(0, cache_usage_index_lookup(count, &node));
+		EXPECT_EQ(count * 100, node.clean_cache_size);
+		EXPECT_EQ(count * 100, node.dirty_cache_size);
+	}
+}
+
+TEST_F(cache_usage_indexTest, InvalidPersistedIndexIgnored)
+{
+	CACHE_USAGE_NODE node;
+	FILE *fptr;
+
+	ASSERT_EQ(0, build_cache_usage_index(FALSE));
+	cache_usage_index_update(5, 300, 100);
+	destroy_cache_usage_index();
+
+	/* Truncated file */
+	truncate(index_path, sizeof(CACHE_USAGE_INDEX_HEAD) + 1);
+	ASSERT_EQ(0, init_cache_usage_index());
+	EXPECT_EQ(-ENOENT, cache_usage_index_lookup(5, &node));
+	EXPECT_NE(0, access(index_path, F_OK));
+	destroy_cache_usage_index();
+
+	/* Not saved if the index was never complete */
+	EXPECT_NE(0, access(index_path, F_OK));
+	fptr = fopen(index_path, "w");
+	fprintf(fptr, "garbage");
+	fclose(fptr);
+	ASSERT_EQ(0, init_cache_usage_index());
+	EXPECT_NE(0, access(index_path, F_OK));
+}
+
+TEST_F(cache_usage_indexTest, BuildFromScanKeepsNewerUsage)
+{
+	char path[500];
+	CACHE_USAGE_NODE node;
+	int32_t count, fd;
+	char buffer[100] = {0};
+	ino_t victim;
+
+	for (count = 0; count < NUMSUBDIR; count++) {
+		sprintf(path, "%s/sub_%d", BLOCKPATH, count);
+		ASSERT_EQ(0, mkdir(path, 0700));
+	}
+	/* A clean block of inode 10, and a dirty block of inode 11 */
+	fetch_block_path(path, 10, 0);
+	fd = creat(path, 0700);
+	pwrite(fd, buffer, 100, 0);
+	close(fd);
+	setxattr(path, "user.dirty", "F", 1, 0);
+	fetch_block_path(path, 11, 0);
+	fd = creat(path, 0700);
+	pwrite(fd, buffer, 100, 0);
+	close(fd);
+	setxattr(path, "user.dirty", "T", 1, 0);
+
+	/* Usage of inode 11 changed during the scan */
+	cache_usage_index_update(11, 8192, 0);
+
+	ASSERT_EQ(0, build_cache_usage_index(FALSE));
+	for (count = 0; count < CACHE_USAGE_NUM_ENTRIES; count++)
+		EXPECT_EQ(NULL, inode_cache_usage_hash[count]);
+
+	ASSERT_EQ(0, cache_usage_index_lookup(10, &node));
+	EXPECT_GT(node.clean_cache_size, 0);
+	EXPECT_EQ(0, node.dirty_cache_size);
+	ASSERT_EQ(0, cache_usage_index_lookup(11, &node));
+	EXPECT_EQ(8192, node.clean_cache_size);
+
+	/* Not scanned again once built */
+	unlink(path);
+	ASSERT_EQ(0, build_cache_usage_index(FALSE));
+	ASSERT_EQ(0, cache_usage_index_lookup(11, &node));
+
+	/* Forced scan replaces the index */
+	ASSERT_EQ(0, build_cache_usage_index(TRUE));
+	EXPECT_EQ(-ENOENT, cache_usage_index_lookup(11, &node));
+	ASSERT_EQ(0, cache_usage_index_pick_victim(&victim, 0));
+	EXPECT_EQ(10, victim);
+}
+
+/*
+	End of unittest for cache usage index
+ */
@@ -90,6 +90,7 @@ protected:
 		sem_init(&(hcfs_system->num_cache_sleep_sem), 1, 0); 
 		sem_init(&(hcfs_system->check_cache_sem), 1, 0); 
 		sem_init(&(hcfs_system->check_next_sem), 1, 0);
+		sem_init(&(hcfs_system->cache_event_sem), 1, 0);
 		system_config = (SYSTEM_CONF_STRUCT *)
 			malloc(sizeof(SYSTEM_CONF_STRUCT));
 		memset(system_config, 0, sizeof(SYSTEM_CONF_STRUCT));
@@ -279,7 +280,10 @@ protected:
 	void SetUp()
 	{
 		hcfs_system = (SYSTEM_DATA_HEAD *)malloc(sizeof(SYSTEM_DATA_HEAD));
+		memset(hcfs_system, 0, sizeof(SYSTEM_DATA_HEAD));
 
+		sem_init(&(hcfs_system->access_sem), 1, 1);
+		sem_init(&(hcfs_system->cache_event_sem), 1, 0);
 		sem_init(&(hcfs_system->num_cache_sleep_sem), 1, 0);
 		sem_init(&(hcfs_system->check_cache_sem), 1, 0);
 		sem_init(&(hcfs_system->check_next_sem), 1, 0);
@@ -378,4 +382,28 @@ TEST_F(sleep_on_cache_fullTest, NoSleepIfNegativeStatus)
 	pthread_join(thread1, (void **) &ptrret);
 	EXPECT_EQ(-3, retval);
 }
+TEST_F(sleep_on_cache_fullTest, WakeUpCacheManagementAndRecordStall)
+{
+	pthread_t thread1;
+	int32_t semval, retval;
+	int32_t *ptrret;
+	CACHE_STALL_STAT *stall_stat;
 
+	hcfs_system->systemdata.cache_replace_status = 0;
+	hcfs_system->sync_paused = FALSE;
+	pthread_create(&thread1, NULL, wrapper_sleep_on_cache_full, (void *) &retval);
+	sleep(2);
+	sem_getvalue(&(hcfs_system->cache_event_sem), &semval);
+	EXPECT_EQ(1, semval);
+	sem_post(&(hcfs_system->check_cache_sem));
+	ptrret = &retval;
+	pthread_join(thread1, (void **) &ptrret);
+	EXPECT_EQ(0, retval);
+
+	/* Slept for about 2 seconds */
+	stall_stat = &(hcfs_system->cache_stall_stat);
+	EXPECT_EQ(1, stall_stat->num_stalls[4]);
+	EXPECT_EQ(0, stall_stat->num_stalls[3]);
+	EXPECT_GE(stall_stat->total_stall_ms, 1900);
+	EXPECT_EQ(stall_stat->total_stall_ms, stall_stat->max_stall_ms);
+}
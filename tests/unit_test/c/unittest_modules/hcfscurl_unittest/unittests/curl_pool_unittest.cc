@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+extern "C" {
+#include "curl_pool.h"
+}
+#include "gtest/gtest.h"
+
+extern "C" {
+int32_t write_log(int32_t level, const char *format, ...)
+{
+	return 0;
+}
+}
+
+/* Keep-alive HTTP/1.1 server answering "ok" to every request, counting
+the connections it accepted */
+static int32_t server_fd;
+static int32_t server_port;
+static int32_t num_accepted;
+static pthread_t server_thread;
+
+static void *serve_conn(void *ptr)
+{
+	int32_t fd = *(int32_t *)ptr;
+	char buf[4096];
+	const char *resp =
+	    "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+	ssize_t len, used;
+
+	delete (int32_t *)ptr;
+	used = 0;
+	while ((len = read(fd, buf + used, sizeof(buf) - 1 - used)) > 0) {
+		used += len;
+		buf[used] = 0;
+		/* Requests carry no body */
+		while (strstr(buf, "\r\n\r\n") != NULL) {
+			char *end = strstr(buf, "\r\n\r\n") + 4;
+
+			if (write(fd, resp, strlen(resp)) < 0)
+				break;
+			used -= (end - buf);
+			memmove(buf, end, used + 1);
+		}
+	}
+	close(fd);
+	return NULL;
+}
+
+static void *serve_loop(void *ptr)
+{
+	int32_t fd;
+	pthread_t conn_thread;
+
+	while ((fd = accept(server_fd, NULL, NULL)) >= 0) {
+		__sync_fetch_and_add(&num_accepted, 1);
+		pthread_create(&conn_thread, NULL, serve_conn,
+			       new int32_t(fd));
+		pthread_detach(conn_thread);
+	}
+	return NULL;
+}
+
+class curl_poolEnvironment : public ::testing::Environment {
+ public:
+  virtual void SetUp()
+  {
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int32_t on = 1;
+
+    curl_global_init(CURL_GLOBAL_ALL);
+    server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    ASSERT_EQ(0, bind(server_fd, (struct sockaddr *)&addr, addr_len));
+    ASSERT_EQ(0, listen(server_fd, 128));
+    getsockname(server_fd, (struct sockaddr *)&addr, &addr_len);
+    server_port = ntohs(addr.sin_port);
+    pthread_create(&server_thread, NULL, serve_loop, NULL);
+  }
+
+  virtual void TearDown()
+  {
+    shutdown(server_fd, SHUT_RDWR);
+    close(server_fd);
+    pthread_join(server_thread, NULL);
+    curl_global_cleanup();
+  }
+};
+
+::testing::Environment* const curl_pool_env =
+	::testing::AddGlobalTestEnvironment(new curl_poolEnvironment);
+
+static size_t discard_body(void *ptr, size_t size, size_t nmemb, void *arg)
+{
+	return size * nmemb;
+}
+
+/* Set up a new easy handle, as done for each object transfer */
+static CURL *new_request(void)
+{
+	CURL *curl;
+	char url[100];
+
+	curl = curl_easy_init();
+	snprintf(url, sizeof(url), "http://127.0.0.1:%d/obj", server_port);
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, discard_body);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	return curl;
+}
+
+static long perform_once(void)
+{
+	CURL *curl;
+	long http_code = 0;
+
+	curl = new_request();
+	if (hcfs_curl_perform(curl) == CURLE_OK)
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+	curl_easy_cleanup(curl);
+	return http_code;
+}
+
+class curl_poolTest : public ::testing::Test {
+ protected:
+  virtual void SetUp()
+  {
+    num_accepted = 0;
+  }
+
+  virtual void TearDown()
+  {
+    destroy_curl_pool();
+  }
+};
+
+TEST_F(curl_poolTest, NotRunningFallsBackToEasyPerform)
+{
+  int32_t count;
+
+  EXPECT_FALSE(curl_pool_running());
+  /* Each new handle opens its own connection */
+  for (count = 0; count < 5; count++)
+    EXPECT_EQ(200, perform_once());
+  EXPECT_EQ(5, num_accepted);
+}
+
+TEST_F(curl_poolTest, ConnectionReusedAcrossHandles)
+{
+  int32_t count;
+
+  ASSERT_EQ(0, init_curl_pool());
+  EXPECT_TRUE(curl_pool_running());
+  for (count = 0; count < 20; count++)
+    EXPECT_EQ(200, perform_once());
+  EXPECT_EQ(1, num_accepted);
+}
+
+static void *perform_many(void *ptr)
+{
+  int32_t count, *num_ok = (int32_t *)ptr;
+
+  for (count = 0; count < 25; count++)
+    if (perform_once() == 200)
+      __sync_fetch_and_add(num_ok, 1);
+  return NULL;
+}
+
+TEST_F(curl_poolTest, ConcurrentTransfersShareThePool)
+{
+  pthread_t threads[8];
+  int32_t count, num_ok = 0;
+
+  ASSERT_EQ(0, init_curl_pool());
+  for (count = 0; count < 8; count++)
+    pthread_create(&threads[count], NULL, perform_many, &num_ok);
+  for (count = 0; count < 8; count++)
+    pthread_join(threads[count], NULL);
+
+  EXPECT_EQ(200, num_ok);
+  /* At most one connection per concurrent transfer */
+  EXPECT_LE(num_accepted, 8);
+}
+
+static size_t record_thread(void *ptr, size_t size, size_t nmemb, void *arg)
+{
+	*((pthread_t *)arg) = pthread_self();
+	return size * nmemb;
+}
+
+TEST_F(curl_poolTest, BlockingTransferRunsInCallingThread)
+{
+  CURL *curl;
+  pthread_t write_thread;
+
+  ASSERT_EQ(0, init_curl_pool());
+  curl = new_request();
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, record_thread);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &write_thread);
+  EXPECT_EQ(CURLE_OK, hcfs_curl_perform(curl));
+  curl_easy_cleanup(curl);
+  EXPECT_TRUE(pthread_equal(pthread_self(), write_thread));
+}
+
+TEST_F(curl_poolTest, DestroyedPoolFallsBackToEasyPerform)
+{
+  ASSERT_EQ(0, init_curl_pool());
+  EXPECT_EQ(200, perform_once());
+  EXPECT_EQ(200, perform_once());
+  EXPECT_EQ(1, num_accepted);
+
+  destroy_curl_pool();
+  EXPECT_FALSE(curl_pool_running());
+  EXPECT_EQ(200, perform_once());
+  EXPECT_EQ(2, num_accepted);
+}
@@ -510,6 +510,147 @@ TEST_F(hcfs_put_objectTest, S3PutObject_Retry_Success) /* Retry put success */
 	End of unittest of hcfs_put_object()
  */
 
+/*
+	Unittest of hcfs_put_multipart_object()
+ */
+class hcfs_put_multipart_objectTest : public hcfs_put_objectTest {
+protected:
+	void SetUp()
+	{
+		hcfs_put_objectTest::SetUp();
+		write_upload_id_flag = FALSE;
+		num_http_performs = 0;
+		memset(&obj_info, 0, sizeof(GOOGLEDRIVE_OBJ_INFO));
+	}
+
+	void TearDown()
+	{
+		write_list_header_flag = FALSE;
+		write_upload_id_flag = FALSE;
+		hcfs_put_objectTest::TearDown();
+	}
+
+	GOOGLEDRIVE_OBJ_INFO obj_info;
+
+	void set_object_size(off_t size)
+	{
+		ASSERT_EQ(0, ftruncate(fileno(fptr), size));
+	}
+};
+
+TEST_F(hcfs_put_multipart_objectTest, SmallObjectPutAtOnce)
+{
+	CURRENT_BACKEND = SWIFT;
+	curl_handle->curl_backend = SWIFT;
+	write_list_header_flag = TRUE;
+	set_object_size(MULTIPART_UPLOAD_THRESHOLD);
+	strcpy(obj_info.fileID, SWIFT_SEGMENTS_ID "3");
+
+	EXPECT_EQ(200, hcfs_put_multipart_object(fptr, objname, curl_handle,
+						 NULL, &obj_info));
+	EXPECT_EQ(1, num_http_performs);
+	/* No segments recorded */
+	EXPECT_STREQ("", obj_info.fileID);
+}
+
+TEST_F(hcfs_put_multipart_objectTest, SwiftLargeObjectPutInSegments)
+{
+	CURRENT_BACKEND = SWIFT;
+	curl_handle->curl_backend = SWIFT;
+	write_list_header_flag = TRUE;
+	set_object_size(2 * MULTIPART_PART_SIZE + 1);
+
+	EXPECT_EQ(200, hcfs_put_multipart_object(fptr, objname, curl_handle,
+						 NULL, &obj_info));
+	/* Three segments and the manifest */
+	EXPECT_EQ(4, num_http_performs);
+	EXPECT_STREQ(SWIFT_SEGMENTS_ID "3", obj_info.fileID);
+	EXPECT_EQ(-1, access("/dev/shm/swiftmanifest_test_.tmp", F_OK));
+}
+
+TEST_F(hcfs_put_multipart_objectTest, SwiftSegmentFailed)
+{
+	CURRENT_BACKEND = SWIFT;
+	curl_handle->curl_backend = SWIFT;
+	set_object_size(2 * MULTIPART_PART_SIZE + 1);
+
+	/* First segment gets no response, and nothing to clean up */
+	EXPECT_EQ(-1, hcfs_put_multipart_object(fptr, objname, curl_handle,
+						NULL, NULL));
+	EXPECT_EQ(1, num_http_performs);
+	EXPECT_EQ(-1, access("/dev/shm/swiftmanifest_test_.tmp", F_OK));
+}
+
+TEST_F(hcfs_put_multipart_objectTest, S3LargeObjectPutInParts)
+{
+	CURRENT_BACKEND = S3;
+	curl_handle->curl_backend = S3;
+	write_list_header_flag = TRUE;
+	write_upload_id_flag = TRUE;
+	set_object_size(2 * MULTIPART_PART_SIZE + 1);
+
+	EXPECT_EQ(200, hcfs_put_multipart_object(fptr, objname, curl_handle,
+						 NULL, NULL));
+	/* Initiate, three parts and complete */
+	EXPECT_EQ(5, num_http_performs);
+	EXPECT_EQ(-1, access("/dev/shm/s3multipartbody_test_.tmp", F_OK));
+	EXPECT_EQ(-1, access("/dev/shm/s3multipartresp_test_.tmp", F_OK));
+}
+
+TEST_F(hcfs_put_multipart_objectTest, S3NoUploadID)
+{
+	CURRENT_BACKEND = S3;
+	curl_handle->curl_backend = S3;
+	write_list_header_flag = TRUE;
+	set_object_size(2 * MULTIPART_PART_SIZE + 1);
+
+	EXPECT_EQ(-1, hcfs_put_multipart_object(fptr, objname, curl_handle,
+						NULL, NULL));
+	EXPECT_EQ(1, num_http_performs);
+}
+
+TEST_F(hcfs_put_multipart_objectTest, SwiftDeleteUnsegmentedBlock)
+{
+	CURRENT_BACKEND = SWIFT;
+	curl_handle->curl_backend = SWIFT;
+	write_list_header_flag = TRUE;
+
+	/* Only the object is deleted, without checking it first */
+	EXPECT_EQ(200, hcfs_delete_multipart_object(objname, curl_handle,
+						    &obj_info));
+	EXPECT_EQ(1, num_http_performs);
+}
+
+TEST_F(hcfs_put_multipart_objectTest, S3PartsWithinLimit)
+{
+	CURRENT_BACKEND = S3;
+	curl_handle->curl_backend = S3;
+	write_list_header_flag = TRUE;
+	write_upload_id_flag = TRUE;
+	set_object_size((off_t)MAX_UPLOAD_PARTS * MULTIPART_PART_SIZE + 1);
+
+	EXPECT_EQ(200, hcfs_put_multipart_object(fptr, objname, curl_handle,
+						 NULL, NULL));
+	/* Initiate, parts enlarged to fit the limit, and complete */
+	EXPECT_EQ(MAX_UPLOAD_PARTS + 2, num_http_performs);
+}
+
+TEST_F(hcfs_put_multipart_objectTest, SwiftDeleteSegmentedBlock)
+{
+	CURRENT_BACKEND = SWIFT;
+	curl_handle->curl_backend = SWIFT;
+	write_list_header_flag = TRUE;
+	strcpy(obj_info.fileID, SWIFT_SEGMENTS_ID "3");
+
+	/* The manifest and the three recorded segments */
+	EXPECT_EQ(200, hcfs_delete_multipart_object(objname, curl_handle,
+						    &obj_info));
+	EXPECT_EQ(4, num_http_performs);
+}
+/*
+	End of unittest of hcfs_put_multipart_object()
+ */
+
 /*
 	Unittest of hcfs_get_object()
  */
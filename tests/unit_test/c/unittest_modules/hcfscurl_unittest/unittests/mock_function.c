@@ -25,7 +25,24 @@
 #define MOCK() printf("[MOCK] hcfscurl mock_function.c line %4d func %s\n",  __LINE__, __func__)
 CURLcode curl_easy_setopt(CURL *handle, CURLoption option, ...)
 {
+	va_list alist;
+	FILE *fptr;
+	char buf[500];
+	int32_t retcode;
+
 	MOCK();
+	/* Response body of initiating multipart upload */
+	if ((option == CURLOPT_WRITEDATA) && (write_upload_id_flag == TRUE)) {
+		va_start(alist, option);
+		fptr = va_arg(alist, FILE *);
+		if (fptr != stdout)
+			fputs("<InitiateMultipartUploadResult>"
+			      "<UploadId>fake_upload_id</UploadId>"
+			      "</InitiateMultipartUploadResult>", fptr);
+		va_end(alist);
+		return CURLE_OK;
+	}
+
 	if ((write_auth_header_flag == FALSE) &&
 		(write_list_header_flag == FALSE))
 		return CURLE_OK;
@@ -33,11 +50,6 @@ CURLcode curl_easy_setopt(CURL *handle, CURLoption option, ...)
 	if (option != CURLOPT_WRITEHEADER)
 		return CURLE_OK;
 
-	va_list alist;
-	FILE *fptr;
-	char buf[500];
-	int32_t retcode;
-
 	/* "let_retry" is used to test retry connection */
 	if (let_retry == TRUE) {
 		retcode = 503; /* 503 will make caller retry */
@@ -53,7 +65,8 @@ CURLcode curl_easy_setopt(CURL *handle, CURLoption option, ...)
 		"X-Auth-Token: hello_swift_auth_string\n", retcode);
 	if (write_list_header_flag == TRUE)
 		sprintf(buf, "http/1.1 %d OK\n"
-		"X-Container-Object-Count: 5566\n", retcode);
+		"X-Container-Object-Count: 5566\n"
+		"ETag: \"fake_etag\"\n", retcode);
 
 	va_start(alist, option);
 	fptr = va_arg(alist, FILE *);
@@ -91,12 +104,18 @@ int32_t write_log(int32_t level, const char *format, ...)
 CURLcode curl_easy_perform(CURL *easy_handle)
 {
 	MOCK();
+	num_http_performs++;
 	if (http_perform_retry_fail == TRUE)
 		return -2;
 
 	return CURLE_OK;
 }
 
+CURLcode hcfs_curl_perform(CURL *curl)
+{
+	return curl_easy_perform(curl);
+}
+
 const char *curl_easy_strerror(CURLcode errornum)
 {
 	MOCK();
@@ -29,6 +29,9 @@ char s3_destroy;
 
 char let_retry;
 
+char write_upload_id_flag;
+int32_t num_http_performs;
+
 #undef b64encode_str
 int32_t b64encode_str(uint8_t *inputstr,
 		      char *outputstr,
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <errno.h>
+extern "C" {
+#include "block_map_cache.h"
+}
+#include "gtest/gtest.h"
+
+class block_map_cacheTest : public ::testing::Test {
+ protected:
+  virtual void SetUp()
+  {
+    cache = NULL;
+  }
+
+  virtual void TearDown()
+  {
+    block_map_cache_destroy(&cache);
+  }
+
+  int64_t page_pos(int64_t page_index)
+  {
+    return (page_index + 10) * 8192;
+  }
+
+  BLOCK_MAP_CACHE *cache;
+};
+
+TEST_F(block_map_cacheTest, GetFromEmptyCache)
+{
+  EXPECT_EQ(0, block_map_cache_get(cache, 5));
+  EXPECT_EQ(0, block_map_cache_shrink(cache));
+  EXPECT_EQ(0, block_map_cache_mem_usage(cache));
+}
+
+TEST_F(block_map_cacheTest, InvalidInput)
+{
+  EXPECT_EQ(-EINVAL, block_map_cache_put(&cache, 5, 0));
+  EXPECT_EQ(-EINVAL, block_map_cache_put(&cache, -1, page_pos(1)));
+  EXPECT_EQ(NULL, cache);
+}
+
+TEST_F(block_map_cacheTest, PutAndGet)
+{
+  int64_t count;
+
+  for (count = 1; count <= 600; count++)
+    ASSERT_EQ(0, block_map_cache_put(&cache, count, page_pos(count)));
+  ASSERT_TRUE(cache != NULL);
+  EXPECT_EQ(600, cache->num_pages);
+
+  /* Indices colliding in the hash table are kept apart */
+  for (count = 1; count <= 600; count++)
+    EXPECT_EQ(page_pos(count), block_map_cache_get(cache, count));
+  EXPECT_EQ(0, block_map_cache_get(cache, 601));
+  EXPECT_EQ((int64_t)(sizeof(BLOCK_MAP_CACHE) +
+                      600 * sizeof(BLOCK_MAP_CACHE_ENTRY)),
+            block_map_cache_mem_usage(cache));
+}
+
+TEST_F(block_map_cacheTest, PutReplacesPosition)
+{
+  ASSERT_EQ(0, block_map_cache_put(&cache, 3, page_pos(3)));
+  ASSERT_EQ(0, block_map_cache_put(&cache, 3, page_pos(30)));
+  EXPECT_EQ(1, cache->num_pages);
+  EXPECT_EQ(page_pos(30), block_map_cache_get(cache, 3));
+}
+
+TEST_F(block_map_cacheTest, ShrinkDropsLeastRecentlyUsed)
+{
+  ASSERT_EQ(0, block_map_cache_put(&cache, 1, page_pos(1)));
+  ASSERT_EQ(0, block_map_cache_put(&cache, 2, page_pos(2)));
+  ASSERT_EQ(0, block_map_cache_put(&cache, 3, page_pos(3)));
+
+  /* Page 1 becomes the most recently used one */
+  EXPECT_EQ(page_pos(1), block_map_cache_get(cache, 1));
+  EXPECT_EQ((int32_t)sizeof(BLOCK_MAP_CACHE_ENTRY),
+            block_map_cache_shrink(cache));
+  EXPECT_EQ(0, block_map_cache_get(cache, 2));
+  EXPECT_EQ(page_pos(1), block_map_cache_get(cache, 1));
+  EXPECT_EQ(page_pos(3), block_map_cache_get(cache, 3));
+
+  EXPECT_NE(0, block_map_cache_shrink(cache));
+  EXPECT_NE(0, block_map_cache_shrink(cache));
+  EXPECT_EQ(0, block_map_cache_shrink(cache));
+  EXPECT_EQ(0, cache->num_pages);
+}
+
+TEST_F(block_map_cacheTest, NumPagesIsBounded)
+{
+  int64_t count;
+
+  for (count = 0; count < MAX_BLOCK_MAP_CACHE_PAGES + 10; count++)
+    ASSERT_EQ(0, block_map_cache_put(&cache, count, page_pos(count)));
+  EXPECT_EQ(MAX_BLOCK_MAP_CACHE_PAGES, cache->num_pages);
+
+  /* The oldest pages are dropped first */
+  for (count = 0; count < 10; count++)
+    EXPECT_EQ(0, block_map_cache_get(cache, count));
+  EXPECT_EQ(page_pos(10), block_map_cache_get(cache, 10));
+}
+
+TEST_F(block_map_cacheTest, DestroySetsCacheToNull)
+{
+  ASSERT_EQ(0, block_map_cache_put(&cache, 1, page_pos(1)));
+  block_map_cache_destroy(&cache);
+  EXPECT_EQ(NULL, cache);
+  block_map_cache_destroy(&cache);
+}
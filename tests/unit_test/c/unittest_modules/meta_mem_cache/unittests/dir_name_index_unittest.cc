@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+extern "C" {
+#include "dir_name_index.h"
+#include "fuseop.h"
+}
+#include "gtest/gtest.h"
+
+class dir_name_indexTest : public ::testing::Test {
+ protected:
+  virtual void SetUp()
+  {
+    index = dir_name_index_create(0, FALSE);
+    ASSERT_NE(NULL, index);
+  }
+
+  virtual void TearDown()
+  {
+    dir_name_index_destroy(&index);
+  }
+
+  void make_entry(DIR_ENTRY *dentry, uint64_t d_ino, const char *name)
+  {
+    memset(dentry, 0, sizeof(DIR_ENTRY));
+    dentry->d_ino = d_ino;
+    dentry->d_type = D_ISREG;
+    strcpy(dentry->d_name, name);
+  }
+
+  DIR_NAME_INDEX *index;
+};
+
+TEST_F(dir_name_indexTest, LookupInEmptyIndex)
+{
+  DIR_ENTRY dentry;
+
+  EXPECT_EQ(-ENOENT, dir_name_index_lookup(index, ".nomedia", &dentry));
+  EXPECT_EQ(-ENOENT, dir_name_index_delete(index, ".nomedia"));
+  EXPECT_EQ(0, index->num_names);
+}
+
+TEST_F(dir_name_indexTest, InsertAndLookup)
+{
+  DIR_ENTRY dentry, result;
+
+  make_entry(&dentry, 100, "file1");
+  ASSERT_EQ(0, dir_name_index_insert(index, &dentry));
+
+  ASSERT_EQ(0, dir_name_index_lookup(index, "file1", &result));
+  EXPECT_EQ(100, result.d_ino);
+  EXPECT_EQ(D_ISREG, result.d_type);
+  EXPECT_STREQ("file1", result.d_name);
+  EXPECT_EQ(0, dir_name_index_lookup(index, "file1", NULL));
+  EXPECT_EQ(-ENOENT, dir_name_index_lookup(index, "FILE1", &result));
+  EXPECT_EQ(-ENOENT, dir_name_index_lookup(index, "file2", &result));
+}
+
+TEST_F(dir_name_indexTest, InsertExistingNameUpdatesEntry)
+{
+  DIR_ENTRY dentry, result;
+
+  make_entry(&dentry, 100, "file1");
+  ASSERT_EQ(0, dir_name_index_insert(index, &dentry));
+  dentry.d_ino = 200;
+  dentry.d_type = D_ISDIR;
+  ASSERT_EQ(0, dir_name_index_insert(index, &dentry));
+
+  EXPECT_EQ(1, index->num_names);
+  ASSERT_EQ(0, dir_name_index_lookup(index, "file1", &result));
+  EXPECT_EQ(200, result.d_ino);
+  EXPECT_EQ(D_ISDIR, result.d_type);
+}
+
+TEST_F(dir_name_indexTest, DeleteName)
+{
+  DIR_ENTRY dentry;
+  int64_t empty_usage;
+
+  empty_usage = dir_name_index_mem_usage(index);
+  make_entry(&dentry, 100, "file1");
+  ASSERT_EQ(0, dir_name_index_insert(index, &dentry));
+  EXPECT_LT(empty_usage, dir_name_index_mem_usage(index));
+
+  EXPECT_EQ(0, dir_name_index_delete(index, "file1"));
+  EXPECT_EQ(-ENOENT, dir_name_index_lookup(index, "file1", &dentry));
+  EXPECT_EQ(0, index->num_names);
+  EXPECT_EQ(empty_usage, dir_name_index_mem_usage(index));
+}
+
+TEST_F(dir_name_indexTest, CaseInsensitiveForExternalVolume)
+{
+  DIR_NAME_INDEX *ext_index;
+  DIR_ENTRY dentry, result;
+
+  ext_index = dir_name_index_create(0, TRUE);
+  ASSERT_NE(NULL, ext_index);
+  make_entry(&dentry, 100, "Music");
+  ASSERT_EQ(0, dir_name_index_insert(ext_index, &dentry));
+
+  ASSERT_EQ(0, dir_name_index_lookup(ext_index, "MUSIC", &result));
+  EXPECT_EQ(100, result.d_ino);
+
+  /* Renaming to another case updates the stored name */
+  make_entry(&dentry, 100, "music");
+  ASSERT_EQ(0, dir_name_index_insert(ext_index, &dentry));
+  EXPECT_EQ(1, ext_index->num_names);
+  ASSERT_EQ(0, dir_name_index_lookup(ext_index, "Music", &result));
+  EXPECT_STREQ("music", result.d_name);
+
+  EXPECT_EQ(0, dir_name_index_delete(ext_index, "MuSiC"));
+  EXPECT_EQ(0, ext_index->num_names);
+  dir_name_index_destroy(&ext_index);
+  EXPECT_EQ(NULL, ext_index);
+}
+
+TEST_F(dir_name_indexTest, GrowWithManyNames)
+{
+  DIR_ENTRY dentry;
+  char name[32];
+  int32_t count, num_names;
+
+  num_names = DIR_NAME_INDEX_MIN_BUCKETS * 8;
+  for (count = 0; count < num_names; count++) {
+    snprintf(name, sizeof(name), "file%d", count);
+    make_entry(&dentry, count + 1, name);
+    ASSERT_EQ(0, dir_name_index_insert(index, &dentry));
+  }
+  EXPECT_EQ(num_names, index->num_names);
+  EXPECT_LE(num_names, (int32_t)index->num_buckets);
+
+  for (count = 0; count < num_names; count++) {
+    snprintf(name, sizeof(name), "file%d", count);
+    ASSERT_EQ(0, dir_name_index_lookup(index, name, &dentry));
+    EXPECT_EQ((uint64_t)count + 1, dentry.d_ino);
+  }
+}
+
+TEST_F(dir_name_indexTest, MissingNamesNotFound)
+{
+  DIR_ENTRY dentry;
+  char name[32];
+  int32_t count, num_names, num_set_bits;
+  uint32_t bit;
+
+  num_names = 2000;
+  for (count = 0; count < num_names; count++) {
+    snprintf(name, sizeof(name), "file%d", count);
+    make_entry(&dentry, count + 1, name);
+    ASSERT_EQ(0, dir_name_index_insert(index, &dentry));
+  }
+  for (count = 0; count < num_names; count++) {
+    snprintf(name, sizeof(name), "missing%d", count);
+    EXPECT_EQ(-ENOENT, dir_name_index_lookup(index, name, &dentry));
+  }
+
+  /* Filter must stay sparse to reject missing names */
+  num_set_bits = 0;
+  for (bit = 0; bit < index->bloom_bits; bit++)
+    if (index->bloom[bit / 8] & (1 << (bit % 8)))
+      num_set_bits++;
+  EXPECT_GT(index->bloom_bits / 2, (uint32_t)num_set_bits);
+}
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <string.h>
+#include <errno.h>
+extern "C" {
+#include "dir_page_cache.h"
+}
+#include "gtest/gtest.h"
+
+class dir_page_cacheTest : public ::testing::Test {
+ protected:
+  virtual void SetUp()
+  {
+    cache = NULL;
+  }
+
+  virtual void TearDown()
+  {
+    dir_page_cache_destroy(&cache);
+  }
+
+  /* Page at pos "page_pos". Leaves have a parent and no children */
+  void make_page(DIR_ENTRY_PAGE *tpage, int64_t page_pos, BOOL is_leaf)
+  {
+    memset(tpage, 0, sizeof(DIR_ENTRY_PAGE));
+    tpage->this_page_pos = page_pos;
+    tpage->parent_page_pos = 1;
+    if (is_leaf == FALSE)
+      tpage->child_page_pos[0] = page_pos + 1;
+  }
+
+  int64_t leaf_pos(int32_t count)
+  {
+    return (int64_t)(count + 10) * sizeof(DIR_ENTRY_PAGE);
+  }
+
+  DIR_PAGE_CACHE *cache;
+};
+
+TEST_F(dir_page_cacheTest, GetFromEmptyCache)
+{
+  EXPECT_EQ(NULL, dir_page_cache_get(cache, 4096));
+  EXPECT_EQ(0, dir_page_cache_shrink(cache));
+  EXPECT_EQ(0, dir_page_cache_mem_usage(cache));
+}
+
+TEST_F(dir_page_cacheTest, InvalidPagePos)
+{
+  DIR_ENTRY_PAGE tpage;
+
+  make_page(&tpage, 0, TRUE);
+  EXPECT_EQ(-EINVAL, dir_page_cache_put(&cache, &tpage));
+}
+
+TEST_F(dir_page_cacheTest, PutAndGet)
+{
+  DIR_ENTRY_PAGE tpage, *cached;
+
+  make_page(&tpage, leaf_pos(0), TRUE);
+  tpage.num_entries = 5;
+  ASSERT_EQ(0, dir_page_cache_put(&cache, &tpage));
+  ASSERT_NE(NULL, cache);
+
+  cached = dir_page_cache_get(cache, leaf_pos(0));
+  ASSERT_NE(NULL, cached);
+  EXPECT_EQ(0, memcmp(&tpage, cached, sizeof(DIR_ENTRY_PAGE)));
+  EXPECT_EQ(NULL, dir_page_cache_get(cache, leaf_pos(1)));
+  EXPECT_EQ(1, cache->num_pages);
+  EXPECT_EQ(1, cache->num_leaves);
+  EXPECT_EQ((int64_t)(sizeof(DIR_PAGE_CACHE) + sizeof(DIR_PAGE_CACHE_ENTRY)),
+            dir_page_cache_mem_usage(cache));
+}
+
+TEST_F(dir_page_cacheTest, LeastRecentlyUsedLeafDropped)
+{
+  DIR_ENTRY_PAGE tpage;
+  int32_t count;
+
+  for (count = 0; count < MAX_DIR_PAGE_CACHE_LEAVES; count++) {
+    make_page(&tpage, leaf_pos(count), TRUE);
+    ASSERT_EQ(0, dir_page_cache_put(&cache, &tpage));
+  }
+  /* Touch the oldest leaf so that the second one is dropped */
+  ASSERT_NE(NULL, dir_page_cache_get(cache, leaf_pos(0)));
+
+  make_page(&tpage, leaf_pos(count), TRUE);
+  ASSERT_EQ(0, dir_page_cache_put(&cache, &tpage));
+
+  EXPECT_EQ(MAX_DIR_PAGE_CACHE_LEAVES, cache->num_leaves);
+  EXPECT_NE(NULL, dir_page_cache_get(cache, leaf_pos(0)));
+  EXPECT_EQ(NULL, dir_page_cache_get(cache, leaf_pos(1)));
+  EXPECT_NE(NULL, dir_page_cache_get(cache, leaf_pos(count)));
+}
+
+TEST_F(dir_page_cacheTest, InternalNodesArePinned)
+{
+  DIR_ENTRY_PAGE tpage;
+  int32_t count;
+
+  /* Root */
+  make_page(&tpage, leaf_pos(0), TRUE);
+  tpage.parent_page_pos = 0;
+  ASSERT_EQ(0, dir_page_cache_put(&cache, &tpage));
+  /* Internal node */
+  make_page(&tpage, leaf_pos(1), FALSE);
+  ASSERT_EQ(0, dir_page_cache_put(&cache, &tpage));
+
+  for (count = 2; count < MAX_DIR_PAGE_CACHE_LEAVES + 10; count++) {
+    make_page(&tpage, leaf_pos(count), TRUE);
+    ASSERT_EQ(0, dir_page_cache_put(&cache, &tpage));
+  }
+  EXPECT_EQ(MAX_DIR_PAGE_CACHE_LEAVES, cache->num_leaves);
+  EXPECT_EQ(MAX_DIR_PAGE_CACHE_LEAVES + 2, cache->num_pages);
+  EXPECT_NE(NULL, dir_page_cache_get(cache, leaf_pos(0)));
+  EXPECT_NE(NULL, dir_page_cache_get(cache, leaf_pos(1)));
+
+  /* Shrinking drops leaves only */
+  while (dir_page_cache_shrink(cache) > 0)
+    ;
+  EXPECT_EQ(0, cache->num_leaves);
+  EXPECT_EQ(2, cache->num_pages);
+  EXPECT_NE(NULL, dir_page_cache_get(cache, leaf_pos(0)));
+  EXPECT_NE(NULL, dir_page_cache_get(cache, leaf_pos(1)));
+}
+
+TEST_F(dir_page_cacheTest, UpdateCachedPage)
+{
+  DIR_ENTRY_PAGE tpage, *cached;
+
+  make_page(&tpage, leaf_pos(0), TRUE);
+  ASSERT_EQ(0, dir_page_cache_put(&cache, &tpage));
+
+  /* Not cached, nothing changes */
+  make_page(&tpage, leaf_pos(1), TRUE);
+  EXPECT_EQ(0, dir_page_cache_update(cache, &tpage));
+  EXPECT_EQ(1, cache->num_pages);
+
+  make_page(&tpage, leaf_pos(0), TRUE);
+  tpage.num_entries = 3;
+  EXPECT_EQ(1, dir_page_cache_update(cache, &tpage));
+  cached = dir_page_cache_get(cache, leaf_pos(0));
+  ASSERT_NE(NULL, cached);
+  EXPECT_EQ(3, cached->num_entries);
+
+  /* Leaf got children and becomes pinned */
+  make_page(&tpage, leaf_pos(0), FALSE);
+  EXPECT_EQ(1, dir_page_cache_update(cache, &tpage));
+  EXPECT_EQ(1, cache->num_pages);
+  EXPECT_EQ(0, cache->num_leaves);
+}
+
+TEST_F(dir_page_cacheTest, DestroyCache)
+{
+  DIR_ENTRY_PAGE tpage;
+
+  make_page(&tpage, leaf_pos(0), TRUE);
+  ASSERT_EQ(0, dir_page_cache_put(&cache, &tpage));
+  dir_page_cache_destroy(&cache);
+  EXPECT_EQ(NULL, cache);
+}
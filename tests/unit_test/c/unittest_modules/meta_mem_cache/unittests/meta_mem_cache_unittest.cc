@@ -29,6 +29,7 @@
 #include <time.h>
 #include <errno.h>
 #include <ftw.h>
+#include <pthread.h>
 extern "C" {
 #include "global.h"
 #include "params.h"
@@ -320,10 +321,83 @@ TEST_F(meta_cache_drop_pagesTest, SuccessDropAllPages)
 	EXPECT_EQ(FALSE, body_ptr->dir_entry_cache_dirty[0]);
 	EXPECT_EQ(FALSE, body_ptr->dir_entry_cache_dirty[1]);
 }
+
+TEST_F(meta_cache_drop_pagesTest, SuccessKeepBtreeNodeCache)
+{
+	DIR_ENTRY_PAGE tpage;
+
+	memset(&tpage, 0, sizeof(DIR_ENTRY_PAGE));
+	tpage.this_page_pos = 4096;
+	body_ptr->meta_opened = FALSE;
+	body_ptr->dir_entry_cache[0] = NULL;
+	body_ptr->dir_entry_cache[1] = NULL;
+	body_ptr->dir_page_cache = NULL;
+	ASSERT_EQ(0, dir_page_cache_put(&(body_ptr->dir_page_cache), &tpage));
+
+	/* Test */
+	sem_wait(&(body_ptr->access_sem));
+	EXPECT_EQ(0, meta_cache_drop_pages(body_ptr));
+	sem_post(&(body_ptr->access_sem));
+
+	/* Verify. Cached b-tree nodes are kept in step by the b-tree
+	 * updates and are not dropped */
+	ASSERT_TRUE(body_ptr->dir_page_cache != NULL);
+	EXPECT_TRUE(dir_page_cache_get(body_ptr->dir_page_cache, 4096) != NULL);
+	dir_page_cache_destroy(&(body_ptr->dir_page_cache));
+}
 /*
 	End of unit testing for meta_cache_drop_pages()
  */
 
+/*
+	Unit testing for meta_cache_refresh_dir_page()
+ */
+class meta_cache_refresh_dir_pageTest : public BaseClassWithMetaCacheEntry {
+protected:
+	void TearDown()
+	{
+		dir_page_cache_destroy(&(body_ptr->dir_page_cache));
+		BaseClassWithMetaCacheEntry::TearDown();
+	}
+};
+
+TEST_F(meta_cache_refresh_dir_pageTest, EntryNotLocked)
+{
+	DIR_ENTRY_PAGE tpage;
+
+	memset(&tpage, 0, sizeof(DIR_ENTRY_PAGE));
+	tpage.this_page_pos = 4096;
+	EXPECT_EQ(-EINVAL, meta_cache_refresh_dir_page(body_ptr, &tpage));
+}
+
+TEST_F(meta_cache_refresh_dir_pageTest, OnlyCachedNodeIsRefreshed)
+{
+	DIR_ENTRY_PAGE tpage;
+	DIR_ENTRY_PAGE *cached;
+
+	memset(&tpage, 0, sizeof(DIR_ENTRY_PAGE));
+	tpage.this_page_pos = 4096;
+	tpage.parent_page_pos = 8192;
+	tpage.num_entries = 1;
+	ASSERT_EQ(0, dir_page_cache_put(&(body_ptr->dir_page_cache), &tpage));
+
+	sem_wait(&(body_ptr->access_sem));
+	tpage.num_entries = 2;
+	EXPECT_EQ(0, meta_cache_refresh_dir_page(body_ptr, &tpage));
+	tpage.this_page_pos = 12288;
+	EXPECT_EQ(0, meta_cache_refresh_dir_page(body_ptr, &tpage));
+	sem_post(&(body_ptr->access_sem));
+
+	cached = dir_page_cache_get(body_ptr->dir_page_cache, 4096);
+	ASSERT_TRUE(cached != NULL);
+	EXPECT_EQ(2, cached->num_entries);
+	EXPECT_TRUE(dir_page_cache_get(body_ptr->dir_page_cache, 12288) == NULL);
+	EXPECT_EQ(1, body_ptr->dir_page_cache->num_pages);
+}
+/*
+	End of unit testing for meta_cache_refresh_dir_page()
+ */
+
 /*
 	Unit testing for meta_cache_push_dir_page()
  */
@@ -514,6 +588,7 @@ class meta_cache_unlock_entryTest : public ::testing::Test {
 		virtual void SetUp()
 		{
 			body_ptr = (META_CACHE_ENTRY_STRUCT *)malloc(sizeof(META_CACHE_ENTRY_STRUCT));
+			memset(body_ptr, 0, sizeof(META_CACHE_ENTRY_STRUCT));
 			sem_init(&(body_ptr->access_sem), 0, 1);
 		}
 
@@ -634,6 +709,335 @@ TEST_F(meta_cache_removeTest, RemoveAll)
 	End of unit testing for meta_cache_remove()
  */
 
+/*
+	Unit testing for meta_cache_lookup_stat_snapshot()
+ */
+class meta_cache_lookup_stat_snapshotTest : public ::testing::Test {
+protected:
+  void SetUp()
+  {
+    init_meta_cache_headers();
+    hcfs_system = (SYSTEM_DATA_HEAD *) malloc(sizeof(SYSTEM_DATA_HEAD));
+    hcfs_system->system_going_down = FALSE;
+    hcfs_system->backend_is_online = TRUE;
+    hcfs_system->sync_manual_switch = ON;
+    hcfs_system->sync_paused = OFF;
+    hcfs_system->system_restoring = NOT_RESTORING;
+  }
+
+  void TearDown()
+  {
+    release_meta_cache_headers();
+    free(hcfs_system);
+  }
+
+  void cache_inode(ino_t ino)
+  {
+    META_CACHE_ENTRY_STRUCT *tmp_meta_entry;
+
+    tmp_meta_entry = meta_cache_lock_entry(ino);
+    ASSERT_TRUE(tmp_meta_entry != NULL);
+    meta_cache_unlock_entry(tmp_meta_entry);
+  }
+};
+
+TEST_F(meta_cache_lookup_stat_snapshotTest, InodeNotCached)
+{
+	HCFS_STAT tmp_stat;
+
+	EXPECT_EQ(-ENOENT, meta_cache_lookup_stat_snapshot(0, &tmp_stat));
+	EXPECT_EQ(-ENOENT, meta_cache_lookup_stat_snapshot(5566, &tmp_stat));
+}
+
+TEST_F(meta_cache_lookup_stat_snapshotTest, GetCachedStat)
+{
+	HCFS_STAT tmp_stat, *expected_stat;
+
+	/* Two inodes on the same hash chain */
+	cache_inode(17);
+	cache_inode(17 + NUM_META_MEM_CACHE_HEADERS);
+
+	expected_stat = generate_mock_stat(17);
+	ASSERT_EQ(0, meta_cache_lookup_stat_snapshot(17, &tmp_stat));
+	EXPECT_EQ(0, memcmp(expected_stat, &tmp_stat, sizeof(HCFS_STAT)));
+	free(expected_stat);
+
+	expected_stat = generate_mock_stat(17 + NUM_META_MEM_CACHE_HEADERS);
+	ASSERT_EQ(0, meta_cache_lookup_stat_snapshot(
+			17 + NUM_META_MEM_CACHE_HEADERS, &tmp_stat));
+	EXPECT_EQ(0, memcmp(expected_stat, &tmp_stat, sizeof(HCFS_STAT)));
+	free(expected_stat);
+}
+
+TEST_F(meta_cache_lookup_stat_snapshotTest, RemovedInodeNotFound)
+{
+	HCFS_STAT tmp_stat;
+
+	cache_inode(23);
+	ASSERT_EQ(0, meta_cache_lookup_stat_snapshot(23, &tmp_stat));
+	ASSERT_EQ(0, meta_cache_remove(23));
+	EXPECT_EQ(-ENOENT, meta_cache_lookup_stat_snapshot(23, &tmp_stat));
+}
+
+/* Writer keeps changing nlink and size together while readers check that
+ * they never see a half-written stat */
+typedef struct {
+	ino_t ino;
+	int32_t num_updates;
+	int32_t num_torn;
+	BOOL stop;
+} STAT_SNAPSHOT_ARG;
+
+static void _set_nlink_and_size(ino_t ino, int64_t value)
+{
+	META_CACHE_ENTRY_STRUCT *tmp_meta_entry;
+	HCFS_STAT new_stat;
+
+	tmp_meta_entry = meta_cache_lock_entry(ino);
+	memcpy(&new_stat, &(tmp_meta_entry->this_stat), sizeof(HCFS_STAT));
+	new_stat.nlink = value;
+	new_stat.size = value;
+	/* Meta file is not mocked here. Only the cached stat matters, so
+	 * flush error is ignored. */
+	meta_cache_update_stat_nosync(ino, &new_stat, tmp_meta_entry);
+	tmp_meta_entry->something_dirty = FALSE;
+	meta_cache_unlock_entry(tmp_meta_entry);
+}
+
+static void *_stat_snapshot_writer(void *ptr)
+{
+	STAT_SNAPSHOT_ARG *arg = (STAT_SNAPSHOT_ARG *)ptr;
+
+	for (int32_t i = 1; i <= arg->num_updates; i++)
+		_set_nlink_and_size(arg->ino, i);
+	__atomic_store_n(&(arg->stop), TRUE, __ATOMIC_SEQ_CST);
+	return NULL;
+}
+
+static void *_stat_snapshot_reader(void *ptr)
+{
+	STAT_SNAPSHOT_ARG *arg = (STAT_SNAPSHOT_ARG *)ptr;
+	HCFS_STAT tmp_stat;
+
+	while (__atomic_load_n(&(arg->stop), __ATOMIC_SEQ_CST) == FALSE) {
+		if (meta_cache_lookup_stat_snapshot(arg->ino, &tmp_stat) < 0)
+			continue;
+		if ((int64_t)tmp_stat.nlink != (int64_t)tmp_stat.size)
+			__atomic_add_fetch(&(arg->num_torn), 1,
+					   __ATOMIC_SEQ_CST);
+	}
+	return NULL;
+}
+
+TEST_F(meta_cache_lookup_stat_snapshotTest, NoTornStatWithConcurrentUpdate)
+{
+	STAT_SNAPSHOT_ARG arg;
+	pthread_t writer, readers[4];
+
+	cache_inode(31);
+	_set_nlink_and_size(31, 0);
+	arg.ino = 31;
+	arg.num_updates = 20000;
+	arg.num_torn = 0;
+	arg.stop = FALSE;
+
+	for (int32_t i = 0; i < 4; i++)
+		pthread_create(&readers[i], NULL, _stat_snapshot_reader, &arg);
+	pthread_create(&writer, NULL, _stat_snapshot_writer, &arg);
+	pthread_join(writer, NULL);
+	for (int32_t i = 0; i < 4; i++)
+		pthread_join(readers[i], NULL);
+
+	EXPECT_EQ(0, arg.num_torn);
+}
+
+/* Microbenchmark of getattr-style lookups, comparing the locked path used
+ * by fetch_inode_stat() with the lockless snapshot. Throughput of each
+ * thread count is printed, and only correctness is asserted. */
+#define BENCH_NUM_INODES 64
+#define BENCH_LOOKUPS_PER_THREAD 20000
+
+typedef struct {
+	BOOL use_snapshot;
+	int32_t thread_index;
+	int32_t num_errors;
+} GETATTR_BENCH_ARG;
+
+static void *_getattr_bench_thread(void *ptr)
+{
+	GETATTR_BENCH_ARG *arg = (GETATTR_BENCH_ARG *)ptr;
+	META_CACHE_ENTRY_STRUCT *tmp_meta_entry;
+	HCFS_STAT tmp_stat;
+	ino_t ino;
+
+	memset(&tmp_stat, 0, sizeof(HCFS_STAT));
+	for (int32_t i = 0; i < BENCH_LOOKUPS_PER_THREAD; i++) {
+		ino = 100 + ((i + arg->thread_index) % BENCH_NUM_INODES);
+		if (arg->use_snapshot == TRUE) {
+			if (meta_cache_lookup_stat_snapshot(ino,
+						&tmp_stat) < 0)
+				arg->num_errors++;
+		} else {
+			tmp_meta_entry = meta_cache_lock_entry(ino);
+			if (tmp_meta_entry == NULL) {
+				arg->num_errors++;
+				continue;
+			}
+			meta_cache_lookup_file_data(ino, &tmp_stat, NULL,
+						    NULL, 0, tmp_meta_entry);
+			meta_cache_close_file(tmp_meta_entry);
+			meta_cache_unlock_entry(tmp_meta_entry);
+		}
+		if (tmp_stat.ino != ino)
+			arg->num_errors++;
+	}
+	return NULL;
+}
+
+static double _run_getattr_bench(int32_t num_threads, BOOL use_snapshot,
+				 int32_t *num_errors)
+{
+	pthread_t threads[32];
+	GETATTR_BENCH_ARG args[32];
+	struct timeval start_time, end_time;
+	double elapsed;
+
+	gettimeofday(&start_time, NULL);
+	for (int32_t i = 0; i < num_threads; i++) {
+		args[i].use_snapshot = use_snapshot;
+		args[i].thread_index = i;
+		args[i].num_errors = 0;
+		pthread_create(&threads[i], NULL, _getattr_bench_thread,
+			       &args[i]);
+	}
+	for (int32_t i = 0; i < num_threads; i++) {
+		pthread_join(threads[i], NULL);
+		*num_errors += args[i].num_errors;
+	}
+	gettimeofday(&end_time, NULL);
+
+	elapsed = (end_time.tv_sec - start_time.tv_sec) +
+		  0.000001 * (end_time.tv_usec - start_time.tv_usec);
+	if (elapsed <= 0)
+		elapsed = 0.000001;
+	return (num_threads * BENCH_LOOKUPS_PER_THREAD) / elapsed;
+}
+
+TEST_F(meta_cache_lookup_stat_snapshotTest, GetattrScalingBenchmark)
+{
+	double locked_rate, snapshot_rate;
+	int32_t num_errors = 0;
+
+	for (int32_t i = 0; i < BENCH_NUM_INODES; i++)
+		cache_inode(100 + i);
+
+	for (int32_t num_threads = 1; num_threads <= 32; num_threads *= 2) {
+		locked_rate = _run_getattr_bench(num_threads, FALSE,
+						 &num_errors);
+		snapshot_rate = _run_getattr_bench(num_threads, TRUE,
+						   &num_errors);
+		printf("getattr %2d threads: locked %.0f ops/s, "
+		       "snapshot %.0f ops/s\n", num_threads, locked_rate,
+		       snapshot_rate);
+	}
+	EXPECT_EQ(0, num_errors);
+}
+
+/*
+	End of unit testing for meta_cache_lookup_stat_snapshot()
+ */
+
+/*
+	Unit testing for meta_cache_get_stat()
+ */
+class meta_cache_get_statTest : public meta_cache_lookup_stat_snapshotTest {
+};
+
+TEST_F(meta_cache_get_statTest, CountHitMissAndMemory)
+{
+	META_CACHE_STAT cache_stat;
+	META_CACHE_ENTRY_STRUCT *tmp_meta_entry;
+	int64_t num_entries;
+	int64_t entry_size;
+
+	ASSERT_EQ(0, meta_cache_get_stat(&cache_stat, &num_entries));
+	EXPECT_EQ(0, cache_stat.num_hits);
+	EXPECT_EQ(0, cache_stat.num_misses);
+	EXPECT_EQ(0, cache_stat.mem_used);
+	EXPECT_EQ(0, num_entries);
+
+	cache_inode(41);
+	cache_inode(41);
+	ASSERT_EQ(0, meta_cache_get_stat(&cache_stat, &num_entries));
+	EXPECT_EQ(1, cache_stat.num_hits);
+	EXPECT_EQ(1, cache_stat.num_misses);
+	EXPECT_EQ(1, num_entries);
+	entry_size = sizeof(META_CACHE_LOOKUP_ENTRY_STRUCT);
+	EXPECT_EQ(entry_size, cache_stat.mem_used);
+
+	/* Cached dir page is charged when the entry is unlocked */
+	tmp_meta_entry = meta_cache_lock_entry(41);
+	tmp_meta_entry->dir_entry_cache[0] =
+		(DIR_ENTRY_PAGE *) malloc(sizeof(DIR_ENTRY_PAGE));
+	meta_cache_unlock_entry(tmp_meta_entry);
+	ASSERT_EQ(0, meta_cache_get_stat(&cache_stat, NULL));
+	EXPECT_EQ(entry_size + (int64_t) sizeof(DIR_ENTRY_PAGE),
+		  cache_stat.mem_used);
+
+	ASSERT_EQ(0, meta_cache_remove(41));
+	ASSERT_EQ(0, meta_cache_get_stat(&cache_stat, NULL));
+	EXPECT_EQ(0, cache_stat.mem_used);
+}
+
+TEST_F(meta_cache_get_statTest, ScanDoesNotEvictHotEntries)
+{
+	META_CACHE_STAT cache_stat;
+	HCFS_STAT tmp_stat;
+
+	/* Hot entries are hit several times */
+	for (int32_t count = 0; count <= META_CACHE_MAX_CLOCK_REF; count++)
+		for (ino_t ino = 100; ino < 110; ino++)
+			cache_inode(ino);
+
+	/* A scan touches each inode once, and then as many entries are
+	 * evicted */
+	for (ino_t ino = 1000; ino < 1200; ino++)
+		cache_inode(ino);
+	for (int32_t count = 0; count < 200; count++)
+		ASSERT_EQ(0, expire_meta_mem_cache_entry());
+
+	for (ino_t ino = 100; ino < 110; ino++)
+		EXPECT_EQ(0, meta_cache_lookup_stat_snapshot(ino, &tmp_stat));
+	for (ino_t ino = 1000; ino < 1200; ino++)
+		EXPECT_EQ(-ENOENT,
+			  meta_cache_lookup_stat_snapshot(ino, &tmp_stat));
+	ASSERT_EQ(0, meta_cache_get_stat(&cache_stat, NULL));
+	EXPECT_EQ(200, cache_stat.num_evictions);
+}
+
+TEST_F(meta_cache_get_statTest, OverBudgetWhenAllEntriesInUse)
+{
+	extern META_CACHE_STAT meta_cache_stat;
+	META_CACHE_ENTRY_STRUCT *held_entry, *tmp_meta_entry;
+
+	/* The only cached entry is held, so nothing can be evicted */
+	held_entry = meta_cache_lock_entry(51);
+	ASSERT_TRUE(held_entry != NULL);
+	meta_cache_stat.mem_used += MAX_META_MEM_CACHE_BYTES;
+
+	tmp_meta_entry = meta_cache_lock_entry(52);
+	ASSERT_TRUE(tmp_meta_entry != NULL);
+	EXPECT_EQ(2, current_meta_mem_cache_entries);
+
+	meta_cache_stat.mem_used -= MAX_META_MEM_CACHE_BYTES;
+	meta_cache_unlock_entry(tmp_meta_entry);
+	meta_cache_unlock_entry(held_entry);
+}
+
+/*
+	End of unit testing for meta_cache_get_stat()
+ */
+
 /*
 	Unit testing for meta_cache_update_file_data()
  */
@@ -1582,6 +1986,15 @@ class SomeEntryInMetaMemCacheArray : public ::testing::Test {
 			lptr->body.symlink_meta = NULL;
 			lptr->body.dir_entry_cache[0] = NULL;
 			lptr->body.dir_entry_cache[1] = NULL;
+			lptr->body.dir_page_cache = NULL;
+			lptr->body.name_index = NULL;
+			lptr->body.name_index_lookups = 0;
+			lptr->body.partial_name_index = NULL;
+			lptr->body.block_map_cache = NULL;
+			lptr->body.mmap_addr = NULL;
+			lptr->body.uploading_info.is_uploading = FALSE;
+			lptr->body.clock_ref = META_CACHE_MAX_CLOCK_REF;
+			lptr->body.mem_usage = 0;
 			gettimeofday(&(lptr->body.last_access_time), NULL);
 			sem_init(&(lptr->body.access_sem), 0, 1);
 		}
@@ -1607,8 +2020,31 @@ class expire_meta_mem_cache_entryTest : public SomeEntryInMetaMemCacheArray {
 
 TEST_F(expire_meta_mem_cache_entryTest, ExpireNothing)
 {
-	/* Expire nothing because period time < 0.5 sec */
+	META_CACHE_LOOKUP_ENTRY_STRUCT *lptr;
+
+	/* Expire nothing because all entries are locked */
+	for (int32_t i = 0; i < NUM_META_MEM_CACHE_HEADERS; i++)
+		for (lptr = meta_mem_cache[i].meta_cache_entries;
+		     lptr != NULL; lptr = lptr->next)
+			sem_wait(&(lptr->body.access_sem));
+
 	ASSERT_EQ(-EBUSY, expire_meta_mem_cache_entry());
+
+	for (int32_t i = 0; i < NUM_META_MEM_CACHE_HEADERS; i++)
+		for (lptr = meta_mem_cache[i].meta_cache_entries;
+		     lptr != NULL; lptr = lptr->next)
+			sem_post(&(lptr->body.access_sem));
+}
+
+TEST_F(expire_meta_mem_cache_entryTest, ExpireHotEntryAfterAging)
+{
+	int64_t num_entries;
+
+	/* All entries are hot, so the sweeps first age them and then
+	 * evict one */
+	num_entries = current_meta_mem_cache_entries;
+	ASSERT_EQ(0, expire_meta_mem_cache_entry());
+	EXPECT_EQ(num_entries - 1, current_meta_mem_cache_entries);
 }
 
 TEST_F(expire_meta_mem_cache_entryTest, ExpireEntrySuccess)
@@ -1625,8 +2061,15 @@ TEST_F(expire_meta_mem_cache_entryTest, ExpireEntrySuccess)
 		expired_ino_num = random()%5000 + 10000; /* An entry to be expired */
 		index = expired_ino_num % NUM_META_MEM_CACHE_HEADERS;
 		init_lookup_entry(lptr, expired_ino_num);
-		lptr->body.last_access_time.tv_sec -= 3;
+		lptr->body.clock_ref = 0; /* Cold entry */
 		push_lookup_entry(lptr, index);
+		/* Sweeps before may have aged the hot entries */
+		for (int32_t i = 0; i < NUM_META_MEM_CACHE_HEADERS; i++)
+			for (now = meta_mem_cache[i].meta_cache_entries;
+			     now != NULL; now = now->next)
+				if (now != lptr)
+					now->body.clock_ref =
+						META_CACHE_MAX_CLOCK_REF;
 		/* Test whether the entry is really expired */
 		ASSERT_EQ(0, expire_meta_mem_cache_entry());
 		now = meta_mem_cache[index].meta_cache_entries;
@@ -1655,6 +2098,7 @@ class meta_cache_seek_dir_entryTest : public ::testing::Test {
   virtual void SetUp()
   {
     body_ptr = (META_CACHE_ENTRY_STRUCT *)malloc(sizeof(META_CACHE_ENTRY_STRUCT));
+    memset(body_ptr, 0, sizeof(META_CACHE_ENTRY_STRUCT));
     sem_init(&(body_ptr->access_sem), 0, 1);
     /* Mock dir_entry_page */
     test_dir_entry = DIR_ENTRY{10, "test_name", 0};
@@ -1854,6 +2298,295 @@ TEST_F(meta_cache_seek_dir_entryTest, Success_Found_From_RootpageWithRebuild)
 	EXPECT_EQ(1, num_stat_rebuilt);
 }
 
+TEST_F(meta_cache_seek_dir_entryTest, Success_Found_From_CachedBtreeNodes)
+{
+	DIR_ENTRY_PAGE rootpage, leftpage, rightpage, emptypage;
+	DIR_ENTRY_PAGE verified_dir_entry_page;
+	DIR_META_TYPE dir_meta;
+	int32_t verified_index;
+	int64_t root_pos, left_pos, right_pos;
+	ino_t inode = INO__FETCH_META_PATH_SUCCESS;
+	FILE *fptr;
+
+	root_pos = sizeof(HCFS_STAT) + sizeof(DIR_META_TYPE);
+	left_pos = root_pos + sizeof(DIR_ENTRY_PAGE);
+	right_pos = left_pos + sizeof(DIR_ENTRY_PAGE);
+
+	/* Two-level b-tree. "test_name" is in the right leaf */
+	memset(&rootpage, 0, sizeof(DIR_ENTRY_PAGE));
+	rootpage.num_entries = 1;
+	rootpage.dir_entries[0] = DIR_ENTRY{30, "m_name", 0};
+	rootpage.this_page_pos = root_pos;
+	rootpage.child_page_pos[0] = left_pos;
+	rootpage.child_page_pos[1] = right_pos;
+	memset(&leftpage, 0, sizeof(DIR_ENTRY_PAGE));
+	leftpage.num_entries = 1;
+	leftpage.dir_entries[0] = DIR_ENTRY{40, "a_name", 0};
+	leftpage.this_page_pos = left_pos;
+	leftpage.parent_page_pos = root_pos;
+	memcpy(&rightpage, test_dir_entry_page, sizeof(DIR_ENTRY_PAGE));
+	memset(rightpage.child_page_pos, 0, sizeof(rightpage.child_page_pos));
+	rightpage.this_page_pos = right_pos;
+	rightpage.parent_page_pos = root_pos;
+	memset(&dir_meta, 0, sizeof(DIR_META_TYPE));
+	dir_meta.root_entry_page = root_pos;
+
+	mkdir(TMP_META_DIR, 0700);
+	fptr = fopen(TMP_META_FILE_PATH, "w+");
+	ASSERT_NE(NULL, fptr);
+	pwrite(fileno(fptr), &dir_meta, sizeof(DIR_META_TYPE), sizeof(HCFS_STAT));
+	pwrite(fileno(fptr), &rootpage, sizeof(DIR_ENTRY_PAGE), root_pos);
+	pwrite(fileno(fptr), &leftpage, sizeof(DIR_ENTRY_PAGE), left_pos);
+	pwrite(fileno(fptr), &rightpage, sizeof(DIR_ENTRY_PAGE), right_pos);
+	fclose(fptr);
+
+	body_ptr->inode_num = inode;
+	body_ptr->meta_opened = FALSE;
+
+	/* Test: root and the right leaf are read and cached */
+	sem_wait(&(body_ptr->access_sem));
+	ASSERT_EQ(0, meta_cache_seek_dir_entry(inode, &verified_dir_entry_page,
+		  &verified_index, "test_name", body_ptr, FALSE));
+	EXPECT_EQ(0, verified_index);
+	EXPECT_EQ(right_pos, verified_dir_entry_page.this_page_pos);
+	ASSERT_NE(NULL, body_ptr->dir_page_cache);
+	EXPECT_EQ(2, body_ptr->dir_page_cache->num_pages);
+	EXPECT_EQ(1, body_ptr->dir_page_cache->num_leaves);
+
+	/* Wipe the leaf in meta file. Lookup should still hit the cached
+	 * nodes once the page is gone from dir_entry_cache */
+	memset(&emptypage, 0, sizeof(DIR_ENTRY_PAGE));
+	fptr = fopen(TMP_META_FILE_PATH, "r+");
+	pwrite(fileno(fptr), &emptypage, sizeof(DIR_ENTRY_PAGE), right_pos);
+	fclose(fptr);
+	free(body_ptr->dir_entry_cache[0]);
+	body_ptr->dir_entry_cache[0] = NULL;
+	verified_index = -1;
+	ASSERT_EQ(0, meta_cache_seek_dir_entry(inode, &verified_dir_entry_page,
+		  &verified_index, "test_name", body_ptr, FALSE));
+	EXPECT_EQ(0, verified_index);
+
+	/* Not found in the cached leaf */
+	ASSERT_EQ(0, meta_cache_seek_dir_entry(inode, &verified_dir_entry_page,
+		  &verified_index, "zz_name", body_ptr, FALSE));
+	EXPECT_EQ(-1, verified_index);
+
+	/* Cached nodes are kept after dropping the pages */
+	ASSERT_EQ(0, meta_cache_drop_pages(body_ptr));
+	ASSERT_TRUE(body_ptr->dir_page_cache != NULL);
+	ASSERT_EQ(0, meta_cache_seek_dir_entry(inode, &verified_dir_entry_page,
+		  &verified_index, "test_name", body_ptr, FALSE));
+	EXPECT_EQ(0, verified_index);
+
+	/* Once the leaf is refreshed, the lookup sees the change */
+	emptypage.this_page_pos = right_pos;
+	emptypage.parent_page_pos = root_pos;
+	ASSERT_EQ(0, meta_cache_refresh_dir_page(body_ptr, &emptypage));
+	ASSERT_EQ(0, meta_cache_seek_dir_entry(inode, &verified_dir_entry_page,
+		  &verified_index, "test_name", body_ptr, FALSE));
+	EXPECT_EQ(-1, verified_index);
+	meta_cache_close_file(body_ptr);
+	sem_post(&(body_ptr->access_sem));
+
+	/* Free resource */
+	dir_page_cache_destroy(&(body_ptr->dir_page_cache));
+	free(body_ptr->dir_meta);
+	unlink(TMP_META_FILE_PATH);
+	rmdir(TMP_META_DIR);
+}
+
+TEST_F(meta_cache_seek_dir_entryTest, NameIndexBuiltForHotLargeDir)
+{
+	DIR_ENTRY_PAGE rootpage, verified_dir_entry_page;
+	DIR_META_TYPE dir_meta;
+	DIR_ENTRY dentry;
+	int32_t verified_index, count;
+	int64_t root_pos;
+	ino_t inode = INO__FETCH_META_PATH_SUCCESS;
+	FILE *fptr;
+
+	root_pos = sizeof(HCFS_STAT) + sizeof(DIR_META_TYPE);
+	memset(&rootpage, 0, sizeof(DIR_ENTRY_PAGE));
+	rootpage.num_entries = 2;
+	rootpage.dir_entries[0] = DIR_ENTRY{40, "a_name", 0};
+	rootpage.dir_entries[1] = DIR_ENTRY{10, "test_name", 0};
+	rootpage.this_page_pos = root_pos;
+	memset(&dir_meta, 0, sizeof(DIR_META_TYPE));
+	dir_meta.root_entry_page = root_pos;
+	dir_meta.tree_walk_list_head = root_pos;
+	/* Large enough for a name index */
+	dir_meta.total_children = MAX_DIR_ENTRIES_PER_PAGE + 1;
+
+	mkdir(TMP_META_DIR, 0700);
+	fptr = fopen(TMP_META_FILE_PATH, "w+");
+	ASSERT_NE(NULL, fptr);
+	pwrite(fileno(fptr), &dir_meta, sizeof(DIR_META_TYPE), sizeof(HCFS_STAT));
+	pwrite(fileno(fptr), &rootpage, sizeof(DIR_ENTRY_PAGE), root_pos);
+	fclose(fptr);
+
+	body_ptr->inode_num = inode;
+	body_ptr->meta_opened = FALSE;
+
+	sem_wait(&(body_ptr->access_sem));
+	for (count = 0; count < DIR_NAME_INDEX_HOT_LOOKUPS; count++) {
+		EXPECT_EQ(NULL, body_ptr->name_index);
+		ASSERT_EQ(0, meta_cache_seek_dir_entry(inode,
+			  &verified_dir_entry_page, &verified_index,
+			  ".nomedia", body_ptr, FALSE));
+		EXPECT_EQ(-1, verified_index);
+	}
+	ASSERT_NE(NULL, body_ptr->name_index);
+	EXPECT_EQ(2, body_ptr->name_index->num_names);
+	meta_cache_close_file(body_ptr);
+
+	/* Meta file is gone. Lookups are answered by the index */
+	unlink(TMP_META_FILE_PATH);
+	ASSERT_EQ(0, meta_cache_seek_dir_entry(inode, &verified_dir_entry_page,
+		  &verified_index, ".thumbnails", body_ptr, FALSE));
+	EXPECT_EQ(-1, verified_index);
+	ASSERT_EQ(0, meta_cache_lookup_dir_name(inode, "test_name", &dentry,
+		  body_ptr, FALSE));
+	EXPECT_EQ(10, dentry.d_ino);
+	EXPECT_EQ(-ENOENT, meta_cache_lookup_dir_name(inode, "TEST_NAME",
+		  &dentry, body_ptr, FALSE));
+
+	/* Index follows added and removed entries */
+	dentry = DIR_ENTRY{50, "new_name", 0};
+	EXPECT_EQ(0, meta_cache_name_index_add(body_ptr, &dentry));
+	ASSERT_EQ(0, meta_cache_lookup_dir_name(inode, "new_name", &dentry,
+		  body_ptr, FALSE));
+	EXPECT_EQ(50, dentry.d_ino);
+	EXPECT_EQ(0, meta_cache_name_index_remove(body_ptr, "a_name"));
+	EXPECT_EQ(-ENOENT, meta_cache_lookup_dir_name(inode, "a_name",
+		  &dentry, body_ptr, FALSE));
+
+	/* Removing a name not indexed drops the index */
+	EXPECT_EQ(0, meta_cache_name_index_remove(body_ptr, "a_name"));
+	EXPECT_EQ(NULL, body_ptr->name_index);
+	sem_post(&(body_ptr->access_sem));
+
+	free(body_ptr->dir_meta);
+	dir_page_cache_destroy(&(body_ptr->dir_page_cache));
+	rmdir(TMP_META_DIR);
+}
+
+TEST_F(meta_cache_seek_dir_entryTest, NameIndexBuiltOverLookups)
+{
+	DIR_ENTRY_PAGE tpage, verified_dir_entry_page;
+	DIR_META_TYPE dir_meta;
+	DIR_ENTRY dentry;
+	int32_t verified_index, count, num_pages;
+	int64_t root_pos;
+	ino_t inode = INO__FETCH_META_PATH_SUCCESS;
+	FILE *fptr;
+
+	/* A root and a chain of nodes twice the build step long. Only the
+	 * tree walk list is used to build the index. */
+	num_pages = DIR_NAME_INDEX_BUILD_PAGES * 2;
+	root_pos = sizeof(HCFS_STAT) + sizeof(DIR_META_TYPE);
+	memset(&dir_meta, 0, sizeof(DIR_META_TYPE));
+	dir_meta.root_entry_page = root_pos;
+	dir_meta.tree_walk_list_head = root_pos;
+	dir_meta.total_children = MAX_DIR_ENTRIES_PER_PAGE + num_pages;
+
+	mkdir(TMP_META_DIR, 0700);
+	fptr = fopen(TMP_META_FILE_PATH, "w+");
+	ASSERT_NE(NULL, fptr);
+	pwrite(fileno(fptr), &dir_meta, sizeof(DIR_META_TYPE), sizeof(HCFS_STAT));
+	for (count = 0; count < num_pages; count++) {
+		memset(&tpage, 0, sizeof(DIR_ENTRY_PAGE));
+		tpage.num_entries = 1;
+		tpage.dir_entries[0].d_ino = count + 1;
+		snprintf(tpage.dir_entries[0].d_name, MAX_FILENAME_LEN,
+			 "name_%d", count);
+		tpage.this_page_pos = root_pos + count * sizeof(DIR_ENTRY_PAGE);
+		if (count < num_pages - 1)
+			tpage.tree_walk_next = tpage.this_page_pos +
+					       sizeof(DIR_ENTRY_PAGE);
+		pwrite(fileno(fptr), &tpage, sizeof(DIR_ENTRY_PAGE),
+		       tpage.this_page_pos);
+	}
+	fclose(fptr);
+
+	body_ptr->inode_num = inode;
+	body_ptr->meta_opened = FALSE;
+
+	sem_wait(&(body_ptr->access_sem));
+	for (count = 0; count < DIR_NAME_INDEX_HOT_LOOKUPS; count++)
+		ASSERT_EQ(0, meta_cache_seek_dir_entry(inode,
+			  &verified_dir_entry_page, &verified_index,
+			  ".nomedia", body_ptr, FALSE));
+
+	/* Half of the nodes are walked so far */
+	EXPECT_EQ(NULL, body_ptr->name_index);
+	ASSERT_NE(NULL, body_ptr->partial_name_index);
+	EXPECT_EQ(DIR_NAME_INDEX_BUILD_PAGES,
+		  body_ptr->partial_name_index->num_names);
+
+	/* Changing the b-tree restarts the build */
+	ASSERT_EQ(0, meta_cache_track_dir_pages(body_ptr, TRUE));
+	ASSERT_EQ(0, meta_cache_track_dir_pages(body_ptr, FALSE));
+	EXPECT_EQ(NULL, body_ptr->partial_name_index);
+	for (count = 0; count < DIR_NAME_INDEX_HOT_LOOKUPS + 1; count++) {
+		EXPECT_EQ(NULL, body_ptr->name_index);
+		ASSERT_EQ(0, meta_cache_seek_dir_entry(inode,
+			  &verified_dir_entry_page, &verified_index,
+			  ".nomedia", body_ptr, FALSE));
+		EXPECT_EQ(-1, verified_index);
+	}
+	ASSERT_NE(NULL, body_ptr->name_index);
+	EXPECT_EQ(NULL, body_ptr->partial_name_index);
+	EXPECT_EQ(num_pages, body_ptr->name_index->num_names);
+	ASSERT_EQ(0, meta_cache_lookup_dir_name(inode, "name_40", &dentry,
+		  body_ptr, FALSE));
+	EXPECT_EQ(41, dentry.d_ino);
+	meta_cache_close_file(body_ptr);
+	sem_post(&(body_ptr->access_sem));
+
+	dir_name_index_destroy(&(body_ptr->name_index));
+	free(body_ptr->dir_meta);
+	dir_page_cache_destroy(&(body_ptr->dir_page_cache));
+	unlink(TMP_META_FILE_PATH);
+	rmdir(TMP_META_DIR);
+}
+
+TEST_F(meta_cache_seek_dir_entryTest, NameIndexNotBuiltForSmallDir)
+{
+	DIR_ENTRY_PAGE verified_dir_entry_page;
+	DIR_META_TYPE dir_meta;
+	int32_t verified_index, count;
+	ino_t inode = INO__FETCH_META_PATH_SUCCESS;
+
+	memset(&dir_meta, 0, sizeof(DIR_META_TYPE));
+	dir_meta.root_entry_page = sizeof(HCFS_STAT) + sizeof(DIR_META_TYPE);
+	dir_meta.total_children = 2;
+	body_ptr->dir_meta = (DIR_META_TYPE *)malloc(sizeof(DIR_META_TYPE));
+	memcpy(body_ptr->dir_meta, &dir_meta, sizeof(DIR_META_TYPE));
+	body_ptr->dir_entry_cache[0] = NULL;
+	body_ptr->dir_entry_cache[1] = NULL;
+	body_ptr->inode_num = inode;
+	body_ptr->meta_opened = FALSE;
+
+	mkdir(TMP_META_DIR, 0700);
+	mknod(TMP_META_FILE_PATH, 0700, S_IFREG);
+	truncate(TMP_META_FILE_PATH, dir_meta.root_entry_page +
+		 sizeof(DIR_ENTRY_PAGE));
+
+	sem_wait(&(body_ptr->access_sem));
+	for (count = 0; count < DIR_NAME_INDEX_HOT_LOOKUPS * 2; count++)
+		ASSERT_EQ(0, meta_cache_seek_dir_entry(inode,
+			  &verified_dir_entry_page, &verified_index,
+			  ".nomedia", body_ptr, FALSE));
+	EXPECT_EQ(NULL, body_ptr->name_index);
+	meta_cache_close_file(body_ptr);
+	sem_post(&(body_ptr->access_sem));
+
+	free(body_ptr->dir_meta);
+	dir_page_cache_destroy(&(body_ptr->dir_page_cache));
+	unlink(TMP_META_FILE_PATH);
+	rmdir(TMP_META_DIR);
+}
+
 /*
 	End of unit testing for meta_cache_seek_dir_entry()
  */
@@ -67,25 +67,18 @@ int32_t dentry_binary_search(DIR_ENTRY *entry_array, int32_t num_entries, DIR_EN
 			return i;
 		}
 	}
+	/* Entries are sorted, so the child to traverse is after all
+	 * entries with smaller names */
+	*index_to_insert = 0;
+	for (i=0 ; i<num_entries ; i++)
+		if (strcmp(new_entry->d_name, entry_array[i].d_name) > 0)
+			*index_to_insert = i + 1;
 	return -1;
 }
 
-int32_t search_dir_entry_btree(char *target_name, DIR_ENTRY_PAGE *tnode, int32_t fh, int32_t *result_index,
-			       DIR_ENTRY_PAGE *result_node, BOOL is_external)
+void dir_btree_track_pages(DIR_PAGE_CACHE *page_cache)
 {
-	DIR_ENTRY tmp_entry;
-	int32_t tmp_index;
-	int32_t ret;
-
-	strcpy(tmp_entry.d_name, target_name);
-	ret = dentry_binary_search(tnode->dir_entries, tnode->num_entries,
-		&tmp_entry, &tmp_index, is_external);
-	if (ret >= 0) {
-		memcpy(result_node, tnode, sizeof(DIR_ENTRY_PAGE));
-		*result_index = ret;
-		return 0;
-	} 
-	return -ENOENT;
+	return;
 }
 
 HCFS_STAT *generate_mock_stat(ino_t inode_num)
@@ -32,6 +32,7 @@
 #include "xattr_ops.h"
 #include "global.h"
 #include "do_restoration.h"
+#include "block_fd_cache.h"
 
 /* Global vars*/
 int32_t DELETE_DIR_ENTRY_BTREE_RESULT = 1;
@@ -184,6 +185,70 @@ int32_t meta_cache_drop_pages(META_CACHE_ENTRY_STRUCT *body_ptr)
 	return 0;
 }
 
+int32_t meta_cache_lookup_dir_name(ino_t this_inode, const char *childname,
+	DIR_ENTRY *dentry, META_CACHE_ENTRY_STRUCT *body_ptr, BOOL is_external)
+{
+	switch(this_inode) {
+	case INO_SEEK_DIR_ENTRY_OK:
+		memset(dentry, 0, sizeof(DIR_ENTRY));
+		dentry->d_ino = INO_SEEK_DIR_ENTRY_OK;
+		strcpy(dentry->d_name, childname);
+		return 0;
+	case INO_SEEK_DIR_ENTRY_NOTFOUND:
+		return -ENOENT;
+	case INO_SEEK_DIR_ENTRY_FAIL:
+		return -1;
+	default:
+		return -ENOENT;
+	}
+}
+
+int32_t meta_cache_name_index_add(META_CACHE_ENTRY_STRUCT *body_ptr,
+	const DIR_ENTRY *dentry)
+{
+	return 0;
+}
+
+int32_t meta_cache_name_index_remove(META_CACHE_ENTRY_STRUCT *body_ptr,
+	const char *name)
+{
+	return 0;
+}
+
+int32_t meta_cache_drop_name_index(META_CACHE_ENTRY_STRUCT *body_ptr)
+{
+	return 0;
+}
+
+int32_t meta_cache_track_dir_pages(META_CACHE_ENTRY_STRUCT *body_ptr,
+	BOOL enable)
+{
+	return 0;
+}
+
+int32_t meta_cache_refresh_dir_page(META_CACHE_ENTRY_STRUCT *body_ptr,
+	const DIR_ENTRY_PAGE *page)
+{
+	return 0;
+}
+
+int64_t meta_cache_lookup_block_map(META_CACHE_ENTRY_STRUCT *body_ptr,
+	int64_t page_index)
+{
+	return 0;
+}
+
+int32_t meta_cache_add_block_map(META_CACHE_ENTRY_STRUCT *body_ptr,
+	int64_t page_index, int64_t page_pos)
+{
+	return 0;
+}
+
+int32_t meta_cache_drop_block_map(META_CACHE_ENTRY_STRUCT *body_ptr)
+{
+	return 0;
+}
+
 
 int32_t meta_cache_remove(ino_t this_inode)
 {
@@ -536,7 +601,8 @@ int32_t change_system_meta_ignore_dirty(ino_t this_inode,
 				  need_sync);
 }
 
-int32_t handle_dirmeta_snapshot(ino_t thisinode, FILE *metafptr)
+int32_t handle_dirmeta_snapshot(ino_t thisinode,
+				META_CACHE_ENTRY_STRUCT *body_ptr)
 {
 	return 0;
 }
@@ -642,3 +708,13 @@ BOOL is_minapk(const char *filename)
 {
 	return FALSE;
 }
+
+void invalidate_inode_block_fds(ino_t this_inode)
+{
+	return;
+}
+
+void cache_usage_index_remove(ino_t this_inode)
+{
+	return;
+}
@@ -29,6 +29,14 @@ int32_t super_block_share_release(void)
 {
 	return 0;
 }
+int32_t super_block_list_locking(int32_t which_list)
+{
+	return 0;
+}
+int32_t super_block_list_release(int32_t which_list)
+{
+	return 0;
+}
 
 int32_t write_log(int32_t level, const char *format, ...)
 {
@@ -59,6 +59,17 @@ int32_t super_block_exclusive_release(void)
 	return 0;
 }
 
+int32_t super_block_update_lock_range(ino_t start_inode, int64_t num_inodes)
+{
+	return 0;
+}
+
+int32_t super_block_update_release_range(ino_t start_inode,
+					 int64_t num_inodes)
+{
+	return 0;
+}
+
 int32_t write_super_block_entry(ino_t this_inode, SUPER_BLOCK_ENTRY *inode_ptr)
 {
 	printf("Write entry\n");
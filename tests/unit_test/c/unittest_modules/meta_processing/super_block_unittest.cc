@@ -73,6 +73,11 @@ protected:
 	{
 		sb_path = "testpatterns/mock_super_block";
 		sys_super_block = (SUPER_BLOCK_CONTROL *)malloc(sizeof(SUPER_BLOCK_CONTROL));
+		memset(sys_super_block, 0, sizeof(SUPER_BLOCK_CONTROL));
+		for (int32_t count = 0; count < SB_ENTRY_LOCK_NUM; count++) {
+			sem_init(&(sys_super_block->entry_lock_sem[count]), 1, 1);
+			sem_init(&(sys_super_block->entry_update_sem[count]), 1, 1);
+		}
 	}
 	void TearDown()
 	{
@@ -252,6 +257,100 @@ TEST(super_block_initTest, InitSuccess)
 	unlink(unclaimedfile_path);
 }
 
+TEST(super_block_initTest, EntriesAreAccessedThroughMapping)
+{
+	char *sb_path = "testpatterns/sb_path";
+	char *unclaimedfile_path = "testpatterns/unclaimedfile_path";
+	SUPER_BLOCK_ENTRY entry, actual_entry;
+	SUPER_BLOCK_HEAD actual_head;
+	ino_t inode;
+	int32_t fd;
+
+	SUPERBLOCK = sb_path;
+	UNCLAIMEDFILE = unclaimedfile_path;
+	ASSERT_EQ(0, super_block_init());
+
+	/* Entry 3 leaves a hole for entries 1 and 2, entry 1 is appended */
+	memset(&entry, 0, sizeof(SUPER_BLOCK_ENTRY));
+	entry.this_index = 3;
+	ASSERT_EQ(0, write_super_block_entry(3, &entry));
+	entry.this_index = 1;
+	ASSERT_EQ(0, write_super_block_entry(1, &entry));
+	/* Update entries after the file is allocated */
+	for (inode = 1; inode <= 3; inode++) {
+		entry.this_index = inode;
+		entry.status = IS_DIRTY;
+		ASSERT_EQ(0, write_super_block_entry(inode, &entry));
+		ASSERT_EQ(0, read_super_block_entry(inode, &actual_entry));
+		EXPECT_EQ(0, memcmp(&entry, &actual_entry,
+				sizeof(SUPER_BLOCK_ENTRY)));
+	}
+	sys_super_block->head.num_total_inodes = 3;
+	EXPECT_EQ(0, super_block_destroy());
+
+	/* Verify */
+	fd = open(sb_path, O_RDONLY);
+	ASSERT_TRUE(fd > 0);
+	pread(fd, &actual_head, sizeof(SUPER_BLOCK_HEAD), 0);
+	EXPECT_EQ(3, actual_head.num_total_inodes);
+	for (inode = 1; inode <= 3; inode++) {
+		pread(fd, &actual_entry, sizeof(SUPER_BLOCK_ENTRY),
+			sizeof(SUPER_BLOCK_HEAD) +
+			(inode - 1) * sizeof(SUPER_BLOCK_ENTRY));
+		EXPECT_EQ(inode, actual_entry.this_index);
+		EXPECT_EQ(IS_DIRTY, actual_entry.status);
+	}
+	close(fd);
+
+	free(sys_super_block);
+	unlink(sb_path);
+	unlink(unclaimedfile_path);
+}
+
+TEST(super_block_initTest, EntriesBeyondFirstMappingAreAccessed)
+{
+	char *sb_path = "testpatterns/sb_path";
+	char *unclaimedfile_path = "testpatterns/unclaimedfile_path";
+	SUPER_BLOCK_ENTRY entry, actual_entry;
+	ino_t far_inode, inode;
+	int32_t fd;
+
+	SUPERBLOCK = sb_path;
+	UNCLAIMEDFILE = unclaimedfile_path;
+	ASSERT_EQ(0, super_block_init());
+
+	/* The file outgrows the mapping made at init */
+	far_inode = SB_MAP_MIN_LEN / sizeof(SUPER_BLOCK_ENTRY) * 3;
+	memset(&entry, 0, sizeof(SUPER_BLOCK_ENTRY));
+	entry.this_index = far_inode;
+	ASSERT_EQ(0, write_super_block_entry(far_inode, &entry));
+	entry.this_index = 1;
+	ASSERT_EQ(0, write_super_block_entry(1, &entry));
+	for (inode = 1; inode <= far_inode; inode += far_inode - 1) {
+		entry.this_index = inode;
+		entry.status = IS_DIRTY;
+		ASSERT_EQ(0, write_super_block_entry(inode, &entry));
+		ASSERT_EQ(0, read_super_block_entry(inode, &actual_entry));
+		EXPECT_EQ(0, memcmp(&entry, &actual_entry,
+				sizeof(SUPER_BLOCK_ENTRY)));
+	}
+	EXPECT_EQ(0, super_block_destroy());
+
+	/* Verify */
+	fd = open(sb_path, O_RDONLY);
+	ASSERT_TRUE(fd > 0);
+	pread(fd, &actual_entry, sizeof(SUPER_BLOCK_ENTRY),
+		sizeof(SUPER_BLOCK_HEAD) +
+		(far_inode - 1) * sizeof(SUPER_BLOCK_ENTRY));
+	EXPECT_EQ(far_inode, actual_entry.this_index);
+	EXPECT_EQ(IS_DIRTY, actual_entry.status);
+	close(fd);
+
+	free(sys_super_block);
+	unlink(sb_path);
+	unlink(unclaimedfile_path);
+}
+
 /*
 	End of unittest of super_block_init()
  */
@@ -290,6 +389,12 @@ protected:
 		sem_init(&(sys_super_block->share_lock_sem), 1, 1);
 		sem_init(&(sys_super_block->share_CR_lock_sem), 1, 1);
 		sys_super_block->share_counter = 0;
+		for (int32_t count = 0; count < SB_ENTRY_LOCK_NUM; count++) {
+			sem_init(&(sys_super_block->entry_lock_sem[count]), 1, 1);
+			sem_init(&(sys_super_block->entry_update_sem[count]), 1, 1);
+		}
+		for (int32_t count = 0; count < NUM_SB_LL; count++)
+			sem_init(&(sys_super_block->list_lock_sem[count]), 1, 1);
 
 		sys_super_block->iofptr = open(SUPERBLOCK, O_RDWR);
 
@@ -832,6 +937,101 @@ TEST_F(super_block_update_transitTest, SyncPointIsSet_RelocateInodeToLastOne)
 	End of unittest of supert_block_update_transit()
  */
 
+/*
+	Unittest of super_block_start_transit()
+ */
+
+class super_block_start_transitTest : public InitSuperBlockBaseClass {
+protected:
+	uint64_t write_entry(ino_t inode, char status, BOOL in_transit)
+	{
+		SUPER_BLOCK_ENTRY sb_entry;
+		uint64_t entry_filepos = sizeof(SUPER_BLOCK_HEAD) +
+			sizeof(SUPER_BLOCK_ENTRY) * (inode - 1);
+
+		ftruncate(sys_super_block->iofptr, sizeof(SUPER_BLOCK_HEAD) +
+			sizeof(SUPER_BLOCK_ENTRY) * inode);
+		memset(&sb_entry, 0, sizeof(SUPER_BLOCK_ENTRY));
+		sb_entry.status = status;
+		sb_entry.in_transit = in_transit;
+		sb_entry.mod_after_in_transit = TRUE;
+		sb_entry.lastsync_time = 123;
+		pwrite(sys_super_block->iofptr, &sb_entry,
+			sizeof(SUPER_BLOCK_ENTRY), entry_filepos);
+		return entry_filepos;
+	}
+};
+
+TEST_F(super_block_start_transitTest, ReadEntryFail)
+{
+	SUPER_BLOCK_ENTRY sb_entry;
+
+	close(sys_super_block->iofptr);
+	sys_super_block->iofptr = open("/testpatterns/not_exist", O_RDONLY, 0600);
+
+	EXPECT_EQ(-EBADF, super_block_start_transit(8, &sb_entry));
+}
+
+TEST_F(super_block_start_transitTest, DirtyInodeMarkedInTransit)
+{
+	ino_t inode = 8;
+	SUPER_BLOCK_ENTRY sb_entry;
+	uint64_t entry_filepos;
+
+	entry_filepos = write_entry(inode, IS_DIRTY, FALSE);
+
+	/* Run */
+	EXPECT_EQ(0, super_block_start_transit(inode, &sb_entry));
+
+	/* Verify */
+	EXPECT_EQ(IS_DIRTY, sb_entry.status);
+	EXPECT_EQ(123, sb_entry.lastsync_time);
+	pread(sys_super_block->iofptr, &sb_entry, sizeof(SUPER_BLOCK_ENTRY),
+		entry_filepos);
+	EXPECT_EQ(TRUE, sb_entry.in_transit);
+	EXPECT_EQ(FALSE, sb_entry.mod_after_in_transit);
+}
+
+TEST_F(super_block_start_transitTest, AlreadyInTransit_KeepModFlag)
+{
+	ino_t inode = 8;
+	SUPER_BLOCK_ENTRY sb_entry;
+	uint64_t entry_filepos;
+
+	entry_filepos = write_entry(inode, IS_DIRTY, TRUE);
+
+	/* Run */
+	EXPECT_EQ(0, super_block_start_transit(inode, &sb_entry));
+
+	/* Verify */
+	pread(sys_super_block->iofptr, &sb_entry, sizeof(SUPER_BLOCK_ENTRY),
+		entry_filepos);
+	EXPECT_EQ(TRUE, sb_entry.in_transit);
+	EXPECT_EQ(TRUE, sb_entry.mod_after_in_transit);
+}
+
+TEST_F(super_block_start_transitTest, NotDirty_NotMarked)
+{
+	ino_t inode = 8;
+	SUPER_BLOCK_ENTRY sb_entry;
+	uint64_t entry_filepos;
+
+	entry_filepos = write_entry(inode, NO_LL, FALSE);
+
+	/* Run */
+	EXPECT_EQ(0, super_block_start_transit(inode, &sb_entry));
+
+	/* Verify */
+	EXPECT_EQ(NO_LL, sb_entry.status);
+	pread(sys_super_block->iofptr, &sb_entry, sizeof(SUPER_BLOCK_ENTRY),
+		entry_filepos);
+	EXPECT_EQ(FALSE, sb_entry.in_transit);
+}
+
+/*
+	End of unittest of super_block_start_transit()
+ */
+
 
 /*
 	Unittest of super_block_to_delete()
@@ -2197,6 +2397,61 @@ TEST_F(super_block_share_releaseTest, ReleaseSuccess)
 	End of unittest of super_block_share_release()
  */
 
+/*
+	Unittest of super_block_list_locking()
+ */
+
+class super_block_list_lockingTest : public InitSuperBlockBaseClass {
+};
+
+TEST_F(super_block_list_lockingTest, ReadEntryWhenSuperBlockIsLocked)
+{
+	SUPER_BLOCK_ENTRY sb_entry, actual_entry;
+
+	memset(&sb_entry, 0, sizeof(SUPER_BLOCK_ENTRY));
+	sb_entry.this_index = 5;
+	ASSERT_EQ(0, write_super_block_entry(5, &sb_entry));
+
+	/* Readers of an entry do not wait for super block updates */
+	super_block_exclusive_locking();
+	EXPECT_EQ(0, super_block_read(5, &actual_entry));
+	super_block_exclusive_release();
+	EXPECT_EQ(5, actual_entry.this_index);
+}
+
+TEST_F(super_block_list_lockingTest, ListLocksReleasedAfterQueueing)
+{
+	SUPER_BLOCK_ENTRY sb_entry;
+	int32_t count, value;
+
+	memset(&sb_entry, 0, sizeof(SUPER_BLOCK_ENTRY));
+	sb_entry.this_index = 5;
+	sb_entry.pin_status = ST_UNPIN;
+	ASSERT_EQ(0, write_super_block_entry(5, &sb_entry));
+
+	ASSERT_EQ(0, ll_enqueue(5, TO_BE_DELETED, &sb_entry));
+	EXPECT_EQ(1, SB_HEAD_COUNTER(num_to_be_deleted));
+	EXPECT_EQ(5, sys_super_block->head.first_to_delete_inode);
+	ASSERT_EQ(0, pin_ll_enqueue(5, &sb_entry));
+	EXPECT_EQ(1, SB_HEAD_COUNTER(num_pinning_inodes));
+	ASSERT_EQ(0, ll_dequeue(5, &sb_entry));
+	EXPECT_EQ(0, SB_HEAD_COUNTER(num_to_be_deleted));
+	ASSERT_EQ(0, pin_ll_dequeue(5, &sb_entry));
+	EXPECT_EQ(0, SB_HEAD_COUNTER(num_pinning_inodes));
+
+	for (count = 0; count < NUM_SB_LL; count++) {
+		sem_getvalue(&(sys_super_block->list_lock_sem[count]), &value);
+		EXPECT_EQ(1, value);
+	}
+	EXPECT_EQ(-1, super_block_list_locking(NUM_SB_LL));
+	EXPECT_EQ(0, super_block_list_locking(SB_LL_DIRTY));
+	EXPECT_EQ(0, super_block_list_release(SB_LL_DIRTY));
+}
+
+/*
+	End of unittest of super_block_list_locking()
+ */
+
 /* Unittest for super_block_finish_pinning */
 class super_block_finish_pinningTest : public InitSuperBlockBaseClass {
 };
@@ -180,6 +180,10 @@ PATH_CACHE * init_pathcache(ino_t root_inode)
 {
 	return NULL;
 }
+int32_t delete_pathcache_snapshot(ino_t root_inode)
+{
+	return 0;
+}
 int32_t reset_dirstat_lookup(ino_t thisinode)
 {
 	return 0;
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "dir_statistics.h"
+#include "path_reconstruct.h"
+#include "dir_statistics_unittest.h"
+
+ino_t fake_parent[MAX_FAKE_INO];
+int32_t fake_num_parent_lookups;
+ino_t fake_lookup_fail_inode;
+int32_t fake_num_rebuilds;
+int32_t fake_threads_in_rebuild;
+
+int32_t write_log(int32_t level, const char *format, ...)
+{
+	return 0;
+}
+
+int32_t lookup_first_parent(ino_t self_inode, ino_t *parentptr)
+{
+	fake_num_parent_lookups++;
+	if (self_inode == fake_lookup_fail_inode)
+		return -EIO;
+	*parentptr = fake_parent[self_inode];
+	return 0;
+}
+
+int32_t fetch_all_parents(ino_t self_inode, int32_t *parentnum,
+			  ino_t **parentlist)
+{
+	*parentnum = 0;
+	*parentlist = NULL;
+	if (fake_parent[self_inode] == 0)
+		return 0;
+	*parentlist = malloc(sizeof(ino_t));
+	(*parentlist)[0] = fake_parent[self_inode];
+	*parentnum = 1;
+	return 0;
+}
+
+/* Recount one file under the root, as the rebuild queues changes */
+int32_t rebuild_dirstat_lookup(void)
+{
+	DIR_STATS_TYPE tmpstat;
+	int32_t ret;
+
+	fake_num_rebuilds++;
+	memset(&tmpstat, 0, sizeof(DIR_STATS_TYPE));
+	tmpstat.num_local = 1;
+	sem_wait(&(pathlookup_data_lock));
+	ret = update_dirstat_parent(FAKE_ROOT, &tmpstat);
+	fake_threads_in_rebuild = count_threads();
+	if (ret == 0)
+		ret = flush_dirstat_delta();
+	sem_post(&(pathlookup_data_lock));
+	return ret;
+}
+
+int32_t count_threads(void)
+{
+	DIR *dirp;
+	struct dirent *de;
+	int32_t num_threads = 0;
+
+	dirp = opendir("/proc/self/task");
+	if (dirp == NULL)
+		return -1;
+	while ((de = readdir(dirp)) != NULL) {
+		if (de->d_name[0] != '.')
+			num_threads++;
+	}
+	closedir(dirp);
+	return num_threads;
+}
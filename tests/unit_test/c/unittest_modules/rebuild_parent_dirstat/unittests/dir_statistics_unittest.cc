@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern "C" {
+#include "dir_statistics.h"
+#include "fuseop.h"
+#include "global.h"
+#include "params.h"
+#include "path_reconstruct.h"
+#include "dir_statistics_unittest.h"
+}
+#include "gtest/gtest.h"
+
+#define MOCK_METAPATH "/tmp/dir_statistics_meta"
+
+SYSTEM_CONF_STRUCT *system_config;
+
+class dir_statisticsTest : public ::testing::Test {
+ protected:
+  virtual void SetUp()
+  {
+    system_config = (SYSTEM_CONF_STRUCT *)
+        calloc(1, sizeof(SYSTEM_CONF_STRUCT));
+    system_config->metapath = (char *) MOCK_METAPATH;
+    hcfs_system = (SYSTEM_DATA_HEAD *) calloc(1, sizeof(SYSTEM_DATA_HEAD));
+    hcfs_system->system_restoring = NOT_RESTORING;
+    mkdir(MOCK_METAPATH, 0700);
+    sem_init(&(pathlookup_data_lock), 0, 1);
+
+    /* /2/3/4 and /2/5 */
+    memset(fake_parent, 0, sizeof(fake_parent));
+    fake_parent[2] = FAKE_ROOT;
+    fake_parent[3] = 2;
+    fake_parent[4] = 3;
+    fake_parent[5] = 2;
+    fake_num_parent_lookups = 0;
+    fake_lookup_fail_inode = 0;
+    fake_num_rebuilds = 0;
+    fake_threads_in_rebuild = 0;
+    ASSERT_EQ(0, init_dirstat_lookup());
+  }
+
+  virtual void TearDown()
+  {
+    char pathname[200];
+
+    destroy_dirstat_lookup();
+    MarkerPath(pathname, getpid());
+    unlink(pathname);
+    sprintf(pathname, "%s/dirstat_lookup_db", MOCK_METAPATH);
+    unlink(pathname);
+    rmdir(MOCK_METAPATH);
+    free(hcfs_system);
+    free(system_config);
+  }
+
+  void MarkerPath(char *pathname, pid_t pid)
+  {
+    sprintf(pathname, "%s/%s%d", MOCK_METAPATH, DIRSTAT_DELTA_MARKER,
+            (int32_t)pid);
+  }
+
+  BOOL HasMarker(void)
+  {
+    char pathname[200];
+
+    MarkerPath(pathname, getpid());
+    return (access(pathname, F_OK) == 0) ? TRUE : FALSE;
+  }
+
+  /* Queue a change of "num_local" local files under "baseinode" */
+  int32_t QueueLocal(ino_t baseinode, int64_t num_local)
+  {
+    DIR_STATS_TYPE tmpstat;
+    int32_t ret;
+
+    memset(&tmpstat, 0, sizeof(DIR_STATS_TYPE));
+    tmpstat.num_local = num_local;
+    sem_wait(&(pathlookup_data_lock));
+    ret = update_dirstat_parent(baseinode, &tmpstat);
+    sem_post(&(pathlookup_data_lock));
+    return ret;
+  }
+
+  int32_t Flush(void)
+  {
+    int32_t ret;
+
+    sem_wait(&(pathlookup_data_lock));
+    ret = flush_dirstat_delta();
+    sem_post(&(pathlookup_data_lock));
+    return ret;
+  }
+
+  /* Statistics of "thisinode" in the lookup db, without flushing */
+  int64_t StoredLocal(ino_t thisinode)
+  {
+    DIR_STATS_TYPE tmpstat;
+
+    memset(&tmpstat, 0, sizeof(DIR_STATS_TYPE));
+    pread(fileno(dirstat_lookup_data_fptr), &tmpstat,
+          sizeof(DIR_STATS_TYPE),
+          (thisinode - 1) * sizeof(DIR_STATS_TYPE));
+    return tmpstat.num_local;
+  }
+};
+
+TEST_F(dir_statisticsTest, QueuedChangeIsPending) {
+  EXPECT_FALSE(HasMarker());
+  ASSERT_EQ(0, QueueLocal(4, 1));
+
+  EXPECT_EQ(0, StoredLocal(4));
+  EXPECT_EQ(0, StoredLocal(FAKE_ROOT));
+  EXPECT_TRUE(HasMarker());
+}
+
+TEST_F(dir_statisticsTest, FlushSumsChangesOfAncestors) {
+  ASSERT_EQ(0, QueueLocal(4, 1));
+  ASSERT_EQ(0, QueueLocal(4, 2));
+  ASSERT_EQ(0, QueueLocal(3, 4));
+  ASSERT_EQ(0, QueueLocal(5, 8));
+
+  ASSERT_EQ(0, Flush());
+  EXPECT_EQ(3, StoredLocal(4));
+  EXPECT_EQ(7, StoredLocal(3));
+  EXPECT_EQ(8, StoredLocal(5));
+  EXPECT_EQ(15, StoredLocal(2));
+  EXPECT_EQ(15, StoredLocal(FAKE_ROOT));
+  /* The parent of each dir is looked up once */
+  EXPECT_EQ(5, fake_num_parent_lookups);
+  EXPECT_FALSE(HasMarker());
+
+  /* Nothing pending after a flush */
+  ASSERT_EQ(0, Flush());
+  EXPECT_EQ(15, StoredLocal(FAKE_ROOT));
+  EXPECT_EQ(5, fake_num_parent_lookups);
+}
+
+TEST_F(dir_statisticsTest, UpdateFileQueuesForParents) {
+  DIR_STATS_TYPE tmpstat;
+
+  memset(&tmpstat, 0, sizeof(DIR_STATS_TYPE));
+  tmpstat.num_cloud = 1;
+  tmpstat.num_local = -1;
+  ASSERT_EQ(0, update_dirstat_file(4, &tmpstat));
+  EXPECT_EQ(0, StoredLocal(3));
+
+  ASSERT_EQ(0, Flush());
+  memset(&tmpstat, 0, sizeof(DIR_STATS_TYPE));
+  pread(fileno(dirstat_lookup_data_fptr), &tmpstat,
+        sizeof(DIR_STATS_TYPE), 2 * sizeof(DIR_STATS_TYPE));
+  EXPECT_EQ(-1, tmpstat.num_local);
+  EXPECT_EQ(1, tmpstat.num_cloud);
+  /* The file itself is not a dir */
+  EXPECT_EQ(0, StoredLocal(4));
+}
+
+TEST_F(dir_statisticsTest, ReadFlushesPendingChanges) {
+  DIR_STATS_TYPE tmpstat;
+
+  ASSERT_EQ(0, QueueLocal(4, 2));
+  ASSERT_EQ(0, QueueLocal(5, 1));
+
+  ASSERT_EQ(0, read_dirstat_lookup(2, &tmpstat));
+  EXPECT_EQ(3, tmpstat.num_local);
+  EXPECT_EQ(3, StoredLocal(FAKE_ROOT));
+  EXPECT_FALSE(HasMarker());
+}
+
+TEST_F(dir_statisticsTest, ResetFlushesChangesOfInode) {
+  DIR_STATS_TYPE tmpstat;
+
+  ASSERT_EQ(0, QueueLocal(4, 2));
+  ASSERT_EQ(0, reset_dirstat_lookup(4));
+
+  /* The pending change went to the ancestors before the reset */
+  ASSERT_EQ(0, read_dirstat_lookup(4, &tmpstat));
+  EXPECT_EQ(0, tmpstat.num_local);
+  EXPECT_EQ(2, StoredLocal(3));
+}
+
+TEST_F(dir_statisticsTest, FlushOfOnlyPendingInode) {
+  ASSERT_EQ(0, QueueLocal(4, 2));
+
+  sem_wait(&(pathlookup_data_lock));
+  EXPECT_EQ(0, flush_dirstat_delta_of(5));
+  sem_post(&(pathlookup_data_lock));
+  EXPECT_EQ(0, StoredLocal(4));
+  EXPECT_TRUE(HasMarker());
+
+  sem_wait(&(pathlookup_data_lock));
+  EXPECT_EQ(0, flush_dirstat_delta_of(4));
+  sem_post(&(pathlookup_data_lock));
+  EXPECT_EQ(2, StoredLocal(4));
+  EXPECT_EQ(2, StoredLocal(FAKE_ROOT));
+  EXPECT_FALSE(HasMarker());
+}
+
+TEST_F(dir_statisticsTest, FlushWithoutLockRejected) {
+  EXPECT_EQ(-EINVAL, flush_dirstat_delta());
+  EXPECT_EQ(-EINVAL, flush_dirstat_delta_of(4));
+}
+
+TEST_F(dir_statisticsTest, FailedFlushIsRetried) {
+  ASSERT_EQ(0, QueueLocal(4, 2));
+  ASSERT_EQ(0, QueueLocal(5, 1));
+  fake_lookup_fail_inode = 3;
+  EXPECT_EQ(-EIO, Flush());
+  /* Only the change with a known path is added */
+  EXPECT_EQ(0, StoredLocal(4));
+  EXPECT_EQ(1, StoredLocal(5));
+  EXPECT_EQ(1, StoredLocal(2));
+  EXPECT_TRUE(HasMarker());
+
+  /* The change kept is added once by the next flush */
+  fake_lookup_fail_inode = 0;
+  ASSERT_EQ(0, Flush());
+  EXPECT_EQ(2, StoredLocal(4));
+  EXPECT_EQ(2, StoredLocal(3));
+  EXPECT_EQ(3, StoredLocal(2));
+  EXPECT_EQ(1, StoredLocal(5));
+  EXPECT_FALSE(HasMarker());
+}
+
+TEST_F(dir_statisticsTest, ChangesNotFlushedAtExitAreRebuilt) {
+  char pathname[200];
+
+  ASSERT_EQ(0, QueueLocal(4, 2));
+  fake_lookup_fail_inode = 3;
+  destroy_dirstat_lookup();
+  fake_lookup_fail_inode = 0;
+  ASSERT_EQ(0, init_dirstat_lookup());
+  EXPECT_EQ(1, fake_num_rebuilds);
+  MarkerPath(pathname, getpid());
+  EXPECT_NE(0, access(pathname, F_OK));
+}
+
+TEST_F(dir_statisticsTest, NoRebuildWithoutMarker) {
+  destroy_dirstat_lookup();
+  ASSERT_EQ(0, init_dirstat_lookup());
+  EXPECT_EQ(0, fake_num_rebuilds);
+}
+
+TEST_F(dir_statisticsTest, RebuildAtInitStartsNoThread) {
+  char pathname[200];
+  int32_t num_threads;
+  int32_t fd;
+
+  destroy_dirstat_lookup();
+  /* Marker left by a process that crashed */
+  MarkerPath(pathname, getpid() + 1);
+  fd = open(pathname, O_CREAT | O_WRONLY, 0600);
+  ASSERT_GE(fd, 0);
+  close(fd);
+
+  num_threads = count_threads();
+  ASSERT_EQ(0, init_dirstat_lookup());
+  EXPECT_EQ(1, fake_num_rebuilds);
+  EXPECT_EQ(num_threads, fake_threads_in_rebuild);
+  EXPECT_EQ(num_threads, count_threads());
+  EXPECT_EQ(1, StoredLocal(FAKE_ROOT));
+  EXPECT_NE(0, access(pathname, F_OK));
+
+  /* The flush thread starts with the first change after init */
+  ASSERT_EQ(0, QueueLocal(4, 1));
+  EXPECT_EQ(num_threads + 1, count_threads());
+}
+
+TEST_F(dir_statisticsTest, ForkedProcessFlushesOwnChanges) {
+  pid_t pid;
+  int32_t status;
+
+  ASSERT_EQ(0, QueueLocal(4, 2));
+
+  pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    int32_t num_threads;
+
+    /* Changes of the parent are not flushed by the child */
+    num_threads = count_threads();
+    if (QueueLocal(5, 1) != 0)
+      _exit(1);
+    if (count_threads() != num_threads + 1)
+      _exit(2);
+    if (!HasMarker())
+      _exit(3);
+    if (Flush() != 0)
+      _exit(4);
+    if ((StoredLocal(5) != 1) || (StoredLocal(4) != 0))
+      _exit(5);
+    _exit(0);
+  }
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  EXPECT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(0, WEXITSTATUS(status));
+
+  ASSERT_EQ(0, Flush());
+  EXPECT_EQ(2, StoredLocal(4));
+  EXPECT_EQ(3, StoredLocal(FAKE_ROOT));
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef DIR_STATISTICS_UNITTEST_H_
+#define DIR_STATISTICS_UNITTEST_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "global.h"
+
+#define MAX_FAKE_INO 20
+#define FAKE_ROOT 1
+
+/* Parent of each inode in the fake tree, 0 if none */
+extern ino_t fake_parent[MAX_FAKE_INO];
+/* Number of parent lookups done when flushing */
+extern int32_t fake_num_parent_lookups;
+/* Parent lookup of this inode fails if not 0 */
+extern ino_t fake_lookup_fail_inode;
+extern int32_t fake_num_rebuilds;
+/* Number of threads of this process when rebuilding */
+extern int32_t fake_threads_in_rebuild;
+
+int32_t count_threads(void);
+
+#endif  /* DIR_STATISTICS_UNITTEST_H_ */
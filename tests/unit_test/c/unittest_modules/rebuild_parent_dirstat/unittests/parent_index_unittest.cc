@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <errno.h>
+#include <string.h>
+extern "C" {
+#include "parent_index.h"
+}
+#include "gtest/gtest.h"
+
+class parent_indexTest : public ::testing::Test {
+ protected:
+  virtual void SetUp()
+  {
+    ASSERT_EQ(0, parent_index_init(&index, 0));
+  }
+
+  virtual void TearDown()
+  {
+    parent_index_destroy(&index);
+  }
+
+  PARENT_INDEX index;
+};
+
+TEST_F(parent_indexTest, EmptyIndex)
+{
+  ino_t parents[4];
+
+  EXPECT_EQ(PARENT_INDEX_MIN_SLOTS, index.num_slots);
+  EXPECT_EQ(0, parent_index_first(&index, 5));
+  EXPECT_EQ(0, parent_index_fetch(&index, 5, parents, 4));
+  EXPECT_EQ(-ENOENT, parent_index_delete(&index, 5, 2));
+  EXPECT_EQ(-ENOENT, parent_index_replace(&index, 5, 2, 3));
+  EXPECT_EQ(-EINVAL, parent_index_add(&index, 0, 2));
+  EXPECT_EQ(-EINVAL, parent_index_add(&index, 5, 0));
+}
+
+TEST_F(parent_indexTest, ParentsKeptInOrder)
+{
+  ino_t parents[4];
+
+  ASSERT_EQ(0, parent_index_add(&index, 5, 2));
+  ASSERT_EQ(0, parent_index_add(&index, 5, 3));
+  ASSERT_EQ(0, parent_index_add(&index, 5, 4));
+  ASSERT_EQ(0, parent_index_add(&index, 6, 2));
+
+  EXPECT_EQ(2, parent_index_first(&index, 5));
+  ASSERT_EQ(3, parent_index_fetch(&index, 5, parents, 4));
+  EXPECT_EQ(2, parents[0]);
+  EXPECT_EQ(3, parents[1]);
+  EXPECT_EQ(4, parents[2]);
+  /* Only the number of parents if there is no room */
+  EXPECT_EQ(3, parent_index_fetch(&index, 5, NULL, 0));
+
+  /* Deleting the first parent makes the next one first */
+  ASSERT_EQ(0, parent_index_delete(&index, 5, 2));
+  EXPECT_EQ(3, parent_index_first(&index, 5));
+  ASSERT_EQ(0, parent_index_replace(&index, 5, 3, 7));
+  ASSERT_EQ(2, parent_index_fetch(&index, 5, parents, 4));
+  EXPECT_EQ(7, parents[0]);
+  EXPECT_EQ(4, parents[1]);
+  EXPECT_EQ(2, parent_index_first(&index, 6));
+  EXPECT_EQ(6, index.max_child);
+}
+
+TEST_F(parent_indexTest, SameParentAddedTwice)
+{
+  ASSERT_EQ(0, parent_index_add(&index, 5, 2));
+  ASSERT_EQ(0, parent_index_add(&index, 5, 2));
+  ASSERT_EQ(0, parent_index_delete(&index, 5, 2));
+  EXPECT_EQ(2, parent_index_first(&index, 5));
+  ASSERT_EQ(0, parent_index_delete(&index, 5, 2));
+  EXPECT_EQ(0, parent_index_first(&index, 5));
+  EXPECT_EQ(0, index.num_used);
+}
+
+TEST_F(parent_indexTest, FindPair)
+{
+  EXPECT_EQ(FALSE, parent_index_find(&index, 5, 2));
+  ASSERT_EQ(0, parent_index_add(&index, 5, 2));
+  EXPECT_EQ(TRUE, parent_index_find(&index, 5, 2));
+  EXPECT_EQ(FALSE, parent_index_find(&index, 5, 3));
+  EXPECT_EQ(FALSE, parent_index_find(&index, 2, 5));
+}
+
+/* Adding the reserved number of pairs does not grow the table */
+TEST_F(parent_indexTest, ReserveRoom)
+{
+  ino_t child;
+  int64_t num_slots;
+
+  ASSERT_EQ(0, parent_index_reserve(&index, 5000));
+  num_slots = index.num_slots;
+  EXPECT_GT(num_slots, PARENT_INDEX_MIN_SLOTS);
+  for (child = 1; child <= 5000; child++)
+    ASSERT_EQ(0, parent_index_add(&index, child, 2));
+  EXPECT_EQ(num_slots, index.num_slots);
+  ASSERT_EQ(0, parent_index_reserve(&index, 0));
+  EXPECT_EQ(num_slots, index.num_slots);
+  EXPECT_EQ(2, parent_index_first(&index, 5000));
+}
+
+TEST_F(parent_indexTest, DeleteAll)
+{
+  ASSERT_EQ(0, parent_index_add(&index, 5, 2));
+  ASSERT_EQ(0, parent_index_add(&index, 6, 2));
+  ASSERT_EQ(0, parent_index_add(&index, 5, 3));
+  EXPECT_EQ(2, parent_index_delete_all(&index, 5));
+  EXPECT_EQ(0, parent_index_first(&index, 5));
+  EXPECT_EQ(2, parent_index_first(&index, 6));
+  EXPECT_EQ(0, parent_index_delete_all(&index, 5));
+}
+
+/* Deleting pairs from long probe sequences keeps the other pairs found */
+TEST_F(parent_indexTest, GrowDeleteAndShrink)
+{
+  ino_t child;
+  int64_t max_slots;
+
+  for (child = 1; child <= 100000; child++) {
+    ASSERT_EQ(0, parent_index_add(&index, child, child + 1));
+    if (child % 10 == 0) {
+      ASSERT_EQ(0, parent_index_add(&index, child, child + 2));
+    }
+  }
+  EXPECT_EQ(110000, index.num_used);
+  EXPECT_LE(index.num_used * 10,
+            index.num_slots * PARENT_INDEX_GROW_LOAD);
+  max_slots = index.num_slots;
+
+  for (child = 1; child <= 100000; child += 2)
+    ASSERT_EQ(0, parent_index_delete(&index, child, child + 1));
+  for (child = 1; child <= 100000; child++) {
+    if (child % 2 == 1) {
+      ASSERT_EQ(0, parent_index_first(&index, child));
+    } else {
+      ASSERT_EQ(child + 1, parent_index_first(&index, child));
+    }
+    if (child % 10 == 0) {
+      ASSERT_EQ(2, parent_index_fetch(&index, child, NULL, 0));
+    }
+  }
+
+  for (child = 1; child <= 100000; child++)
+    parent_index_delete_all(&index, child);
+  EXPECT_EQ(0, index.num_used);
+  EXPECT_LT(index.num_slots, max_slots);
+}
+
+TEST_F(parent_indexTest, IterateAllPairs)
+{
+  PARENT_INDEX_ITER iter;
+  PARENT_INDEX_SLOT pair;
+  PARENT_INDEX copy;
+  ino_t child, parents[2];
+  int64_t num_pairs;
+
+  for (child = 1; child <= 5000; child++) {
+    ASSERT_EQ(0, parent_index_add(&index, child, 2));
+    ASSERT_EQ(0, parent_index_add(&index, child, child + 1));
+  }
+
+  /* Adding the pairs in the order of the walk gives the same parents */
+  ASSERT_EQ(0, parent_index_init(&copy, 0));
+  num_pairs = 0;
+  parent_index_iter_init(&index, &iter);
+  while (parent_index_iter_next(&index, &iter, &pair) == TRUE) {
+    ASSERT_EQ(0, parent_index_add(&copy, pair.child, pair.parent));
+    num_pairs++;
+  }
+  EXPECT_EQ(10000, num_pairs);
+  for (child = 1; child <= 5000; child++) {
+    ASSERT_EQ(2, parent_index_fetch(&copy, child, parents, 2));
+    EXPECT_EQ(2, parents[0]);
+    EXPECT_EQ(child + 1, parents[1]);
+  }
+  parent_index_destroy(&copy);
+}
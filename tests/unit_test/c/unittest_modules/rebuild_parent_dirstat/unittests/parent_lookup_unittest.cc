@@ -0,0 +1,388 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern "C" {
+#include "fuseop.h"
+#include "parent_lookup.h"
+#include "path_reconstruct.h"
+#include "params.h"
+}
+#include "gtest/gtest.h"
+
+#define MOCK_METAPATH "/tmp/parent_lookup_meta"
+
+SYSTEM_CONF_STRUCT *system_config;
+
+class parent_lookupTest : public ::testing::Test {
+ protected:
+  virtual void SetUp()
+  {
+    system_config = (SYSTEM_CONF_STRUCT *)
+        calloc(1, sizeof(SYSTEM_CONF_STRUCT));
+    system_config->metapath = (char *) MOCK_METAPATH;
+    /* Shared with forked processes as in hfuse */
+    hcfs_system = (SYSTEM_DATA_HEAD *)
+        mmap(NULL, sizeof(SYSTEM_DATA_HEAD), PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    ASSERT_NE(MAP_FAILED, (void *)hcfs_system);
+    memset(hcfs_system, 0, sizeof(SYSTEM_DATA_HEAD));
+    mkdir(MOCK_METAPATH, 0700);
+    sem_init(&(pathlookup_data_lock), 0, 1);
+  }
+
+  virtual void TearDown()
+  {
+    destroy_parent_lookup();
+    RemoveFile("parentlookup_snapshot");
+    RemoveFile("parentlookup_log");
+    RemoveFile("pathlookup_db");
+    RemoveFile("parentlookup2_db");
+    rmdir(MOCK_METAPATH);
+    munmap(hcfs_system, sizeof(SYSTEM_DATA_HEAD));
+    free(system_config);
+  }
+
+  void MetaFile(char *pathname, const char *name)
+  {
+    sprintf(pathname, "%s/%s", MOCK_METAPATH, name);
+  }
+
+  void RemoveFile(const char *name)
+  {
+    char pathname[200];
+
+    MetaFile(pathname, name);
+    unlink(pathname);
+  }
+
+  int64_t FileSize(const char *name)
+  {
+    char pathname[200];
+    struct stat tmpstat;
+
+    MetaFile(pathname, name);
+    if (stat(pathname, &tmpstat) < 0)
+      return -1;
+    return tmpstat.st_size;
+  }
+
+  /* Returns the fd of the opened parent lookup log, or -1 */
+  int32_t LogFd()
+  {
+    char pathname[200], fdpath[100], target[200];
+    ssize_t ret_ssize;
+    int32_t fd;
+
+    MetaFile(pathname, "parentlookup_log");
+    for (fd = 0; fd < 1024; fd++) {
+      sprintf(fdpath, "/proc/self/fd/%d", fd);
+      ret_ssize = readlink(fdpath, target, sizeof(target) - 1);
+      if (ret_ssize <= 0)
+        continue;
+      target[ret_ssize] = 0;
+      if (strcmp(target, pathname) == 0)
+        return fd;
+    }
+    return -1;
+  }
+
+  /* Returns the parents of an inode as a string, such as "2,3" */
+  std::string Parents(ino_t self_inode)
+  {
+    ino_t *parentlist = NULL;
+    int32_t count, parentnum = 0;
+    std::string result;
+
+    sem_wait(&(pathlookup_data_lock));
+    EXPECT_EQ(0, fetch_all_parents(self_inode, &parentnum, &parentlist));
+    sem_post(&(pathlookup_data_lock));
+    for (count = 0; count < parentnum; count++) {
+      if (count > 0)
+        result += ",";
+      result += std::to_string((uint64_t)parentlist[count]);
+    }
+    free(parentlist);
+    return result;
+  }
+};
+
+TEST_F(parent_lookupTest, NotLocked)
+{
+  ino_t *parentlist = NULL;
+  int32_t parentnum;
+
+  ASSERT_EQ(0, init_parent_lookup());
+  EXPECT_EQ(-EINVAL, fetch_all_parents(5, &parentnum, &parentlist));
+  EXPECT_EQ(-EINVAL, lookup_add_parent(5, 2));
+}
+
+TEST_F(parent_lookupTest, ChangesKeptAfterRestart)
+{
+  ino_t parent;
+
+  ASSERT_EQ(0, init_parent_lookup());
+  sem_wait(&(pathlookup_data_lock));
+  EXPECT_EQ(0, lookup_add_parent(5, 2));
+  EXPECT_EQ(0, lookup_add_parent(5, 3));
+  EXPECT_EQ(0, lookup_add_parent(6, 2));
+  EXPECT_EQ(0, lookup_replace_parent(6, 2, 4));
+  EXPECT_EQ(0, lookup_delete_parent(5, 2));
+  EXPECT_EQ(-ENOENT, lookup_delete_parent(5, 2));
+  EXPECT_EQ(0, lookup_reset_parent(1, 0));
+  sem_post(&(pathlookup_data_lock));
+  EXPECT_EQ("3", Parents(5));
+  EXPECT_EQ("4", Parents(6));
+  /* Only the header and the six changes made */
+  EXPECT_EQ((int64_t)(sizeof(PARENT_LOG_HEAD) +
+                      6 * sizeof(PARENT_LOG_RECORD)),
+            FileSize("parentlookup_log"));
+  destroy_parent_lookup();
+
+  ASSERT_EQ(0, init_parent_lookup());
+  EXPECT_EQ("3", Parents(5));
+  EXPECT_EQ("4", Parents(6));
+  sem_wait(&(pathlookup_data_lock));
+  EXPECT_EQ(0, lookup_first_parent(6, &parent));
+  EXPECT_EQ(4, parent);
+  EXPECT_EQ(0, lookup_first_parent(1, &parent));
+  EXPECT_EQ(0, parent);
+  sem_post(&(pathlookup_data_lock));
+  /* The log is merged into the snapshot */
+  EXPECT_EQ((int64_t)sizeof(PARENT_LOG_HEAD), FileSize("parentlookup_log"));
+  EXPECT_EQ((int64_t)(sizeof(PARENT_SNAPSHOT_HEAD) +
+                      2 * sizeof(PARENT_INDEX_SLOT)),
+            FileSize("parentlookup_snapshot"));
+}
+
+TEST_F(parent_lookupTest, ResetParent)
+{
+  ASSERT_EQ(0, init_parent_lookup());
+  sem_wait(&(pathlookup_data_lock));
+  EXPECT_EQ(0, lookup_add_parent(5, 2));
+  EXPECT_EQ(0, lookup_add_parent(5, 3));
+  EXPECT_EQ(0, lookup_reset_parent(5, 7));
+  sem_post(&(pathlookup_data_lock));
+  EXPECT_EQ("7", Parents(5));
+  sem_wait(&(pathlookup_data_lock));
+  EXPECT_EQ(0, lookup_reset_parent(5, 0));
+  sem_post(&(pathlookup_data_lock));
+  EXPECT_EQ("", Parents(5));
+}
+
+TEST_F(parent_lookupTest, PartialLogRecordDropped)
+{
+  char pathname[200];
+  char garbage[10];
+  int32_t fd;
+
+  ASSERT_EQ(0, init_parent_lookup());
+  sem_wait(&(pathlookup_data_lock));
+  EXPECT_EQ(0, lookup_add_parent(5, 2));
+  sem_post(&(pathlookup_data_lock));
+  destroy_parent_lookup();
+
+  MetaFile(pathname, "parentlookup_log");
+  fd = open(pathname, O_WRONLY | O_APPEND);
+  memset(garbage, 0xFF, sizeof(garbage));
+  ASSERT_EQ((ssize_t)sizeof(garbage), write(fd, garbage, sizeof(garbage)));
+  close(fd);
+
+  ASSERT_EQ(0, init_parent_lookup());
+  EXPECT_EQ("2", Parents(5));
+  EXPECT_EQ((int64_t)sizeof(PARENT_LOG_HEAD), FileSize("parentlookup_log"));
+}
+
+TEST_F(parent_lookupTest, LogWriteFailKeepsIndex)
+{
+  char pathname[200];
+  int32_t log_fd, readonly_fd;
+
+  ASSERT_EQ(0, init_parent_lookup());
+  sem_wait(&(pathlookup_data_lock));
+  EXPECT_EQ(0, lookup_add_parent(5, 2));
+  sem_post(&(pathlookup_data_lock));
+
+  /* Writing to the log fails from here */
+  log_fd = LogFd();
+  ASSERT_GE(log_fd, 0);
+  MetaFile(pathname, "parentlookup_log");
+  readonly_fd = open(pathname, O_RDONLY);
+  ASSERT_GE(readonly_fd, 0);
+  ASSERT_EQ(log_fd, dup2(readonly_fd, log_fd));
+  close(readonly_fd);
+
+  sem_wait(&(pathlookup_data_lock));
+  EXPECT_EQ(-EBADF, lookup_add_parent(5, 3));
+  EXPECT_EQ(-EBADF, lookup_replace_parent(5, 2, 4));
+  EXPECT_EQ(-EBADF, lookup_delete_parent(5, 2));
+  EXPECT_EQ(-EBADF, lookup_reset_parent(5, 7));
+  sem_post(&(pathlookup_data_lock));
+  EXPECT_EQ("2", Parents(5));
+  EXPECT_EQ((int64_t)(sizeof(PARENT_LOG_HEAD) + sizeof(PARENT_LOG_RECORD)),
+            FileSize("parentlookup_log"));
+}
+
+TEST_F(parent_lookupTest, ImportOldLookupDb)
+{
+  char pathname[200];
+  PRIMARY_PARENT_T tmpparent;
+  PLOOKUP_HEAD_T lookup_head;
+  PLOOKUP_PAGE_T tmppage;
+  FILE *fptr;
+
+  /* Inode 5 has parents 2, 3 and 4, and inode 6 has parent 2 */
+  MetaFile(pathname, "pathlookup_db");
+  fptr = fopen(pathname, "w");
+  memset(&tmpparent, 0, sizeof(PRIMARY_PARENT_T));
+  tmpparent.parentinode = 2;
+  tmpparent.haveothers = TRUE;
+  pwrite(fileno(fptr), &tmpparent, sizeof(PRIMARY_PARENT_T),
+         4 * sizeof(PRIMARY_PARENT_T));
+  tmpparent.haveothers = FALSE;
+  pwrite(fileno(fptr), &tmpparent, sizeof(PRIMARY_PARENT_T),
+         5 * sizeof(PRIMARY_PARENT_T));
+  fclose(fptr);
+
+  MetaFile(pathname, "parentlookup2_db");
+  fptr = fopen(pathname, "w");
+  memset(&lookup_head, 0, sizeof(PLOOKUP_HEAD_T));
+  lookup_head.hash_head[5 % PLOOKUP_HASH_NUM_ENTRIES] =
+      sizeof(PLOOKUP_HEAD_T);
+  pwrite(fileno(fptr), &lookup_head, sizeof(PLOOKUP_HEAD_T), 0);
+  memset(&tmppage, 0, sizeof(PLOOKUP_PAGE_T));
+  tmppage.thisinode = 5;
+  tmppage.num_parents = 2;
+  tmppage.parents[0] = 3;
+  tmppage.parents[1] = 4;
+  pwrite(fileno(fptr), &tmppage, sizeof(PLOOKUP_PAGE_T),
+         sizeof(PLOOKUP_HEAD_T));
+  fclose(fptr);
+
+  ASSERT_EQ(0, init_parent_lookup());
+  EXPECT_EQ("2,3,4", Parents(5));
+  EXPECT_EQ("2", Parents(6));
+  EXPECT_EQ(-1, FileSize("pathlookup_db"));
+  EXPECT_EQ(-1, FileSize("parentlookup2_db"));
+  destroy_parent_lookup();
+
+  ASSERT_EQ(0, init_parent_lookup());
+  EXPECT_EQ("2,3,4", Parents(5));
+}
+
+/* A forked process reads the changes made by the owner from the log */
+TEST_F(parent_lookupTest, ForkedProcessFollowsLog)
+{
+  int32_t pipefd[2], status, count;
+  char tmpchar;
+  pid_t pid;
+
+  ASSERT_EQ(0, init_parent_lookup());
+  sem_wait(&(pathlookup_data_lock));
+  EXPECT_EQ(0, lookup_add_parent(5, 2));
+  sem_post(&(pathlookup_data_lock));
+  ASSERT_EQ(0, pipe(pipefd));
+
+  pid = fork();
+  if (pid == 0) {
+    if (read(pipefd[0], &tmpchar, 1) != 1)
+      _exit(1);
+    if (Parents(5) != "2,3" || Parents(6) != "2")
+      _exit(2);
+    sem_wait(&(pathlookup_data_lock));
+    if (lookup_add_parent(7, 2) != -EPERM)
+      _exit(3);
+    sem_post(&(pathlookup_data_lock));
+    _exit(0);
+  }
+
+  sem_wait(&(pathlookup_data_lock));
+  EXPECT_EQ(0, lookup_add_parent(5, 3));
+  /* Enough changes for merging the log into a new snapshot */
+  for (count = 0; count < PARENT_LOG_COMPACT_RECORDS / 2 + 1; count++) {
+    ASSERT_EQ(0, lookup_add_parent(8, 2));
+    ASSERT_EQ(0, lookup_delete_parent(8, 2));
+  }
+  EXPECT_EQ(0, lookup_add_parent(6, 2));
+  sem_post(&(pathlookup_data_lock));
+  EXPECT_GT((int64_t)(10 * sizeof(PARENT_LOG_RECORD)),
+            FileSize("parentlookup_log"));
+  ASSERT_EQ(1, write(pipefd[1], "x", 1));
+  waitpid(pid, &status, 0);
+  EXPECT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(0, WEXITSTATUS(status));
+  close(pipefd[0]);
+  close(pipefd[1]);
+}
+
+/* A forked process does not read the log until the owner changes it */
+TEST_F(parent_lookupTest, ForkedProcessSkipsUnchangedLog)
+{
+  PARENT_LOG_RECORD record;
+  int32_t pipefd[2], ackfd[2], status;
+  char tmpchar;
+  pid_t pid;
+
+  ASSERT_EQ(0, init_parent_lookup());
+  ASSERT_EQ(0, pipe(pipefd));
+  ASSERT_EQ(0, pipe(ackfd));
+
+  pid = fork();
+  if (pid == 0) {
+    if (read(pipefd[0], &tmpchar, 1) != 1)
+      _exit(1);
+    /* Logged without telling forked processes */
+    if (Parents(5) != "")
+      _exit(2);
+    if (write(ackfd[1], "x", 1) != 1)
+      _exit(1);
+    if (read(pipefd[0], &tmpchar, 1) != 1)
+      _exit(1);
+    if (Parents(5) != "2,3")
+      _exit(3);
+    _exit(0);
+  }
+
+  memset(&record, 0, sizeof(PARENT_LOG_RECORD));
+  record.op = PARENT_LOG_ADD;
+  record.self_inode = 5;
+  record.parent_inode1 = 2;
+  ASSERT_EQ((ssize_t)sizeof(PARENT_LOG_RECORD),
+            write(LogFd(), &record, sizeof(PARENT_LOG_RECORD)));
+  ASSERT_EQ(1, write(pipefd[1], "x", 1));
+  ASSERT_EQ(1, read(ackfd[0], &tmpchar, 1));
+
+  sem_wait(&(pathlookup_data_lock));
+  EXPECT_EQ(0, lookup_add_parent(5, 3));
+  sem_post(&(pathlookup_data_lock));
+  ASSERT_EQ(1, write(pipefd[1], "x", 1));
+  waitpid(pid, &status, 0);
+  EXPECT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(0, WEXITSTATUS(status));
+  close(pipefd[0]);
+  close(pipefd[1]);
+  close(ackfd[0]);
+  close(ackfd[1]);
+}
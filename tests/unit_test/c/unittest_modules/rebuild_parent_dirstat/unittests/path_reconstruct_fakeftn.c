@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "meta_mem_cache.h"
+#include "path_reconstruct_unittest.h"
+
+/* Fake dir tree, set up by the tests */
+ino_t fake_parent[MAX_FAKE_INO];
+char fake_name[MAX_FAKE_INO][MAX_FILENAME_LEN + 1];
+int32_t fake_num_lookups;
+
+int32_t write_log(int32_t level, const char *format, ...)
+{
+	return 0;
+}
+
+int32_t init_parent_lookup(void)
+{
+	return 0;
+}
+
+void destroy_parent_lookup(void)
+{
+	return;
+}
+
+int32_t lookup_reset_parent(ino_t self_inode, ino_t parent_inode)
+{
+	fake_parent[self_inode] = parent_inode;
+	return 0;
+}
+
+int32_t lookup_first_parent(ino_t self_inode, ino_t *parentptr)
+{
+	*parentptr = fake_parent[self_inode];
+	return 0;
+}
+
+int32_t fetch_all_parents(ino_t self_inode, int32_t *parentnum,
+			  ino_t **parentlist)
+{
+	*parentnum = 0;
+	*parentlist = NULL;
+	if (self_inode >= MAX_FAKE_INO || fake_parent[self_inode] == 0)
+		return 0;
+	*parentlist = malloc(sizeof(ino_t));
+	(*parentlist)[0] = fake_parent[self_inode];
+	*parentnum = 1;
+	return 0;
+}
+
+META_CACHE_ENTRY_STRUCT *meta_cache_lock_entry(ino_t this_inode)
+{
+	fake_num_lookups++;
+	return (META_CACHE_ENTRY_STRUCT *) malloc(
+	    sizeof(META_CACHE_ENTRY_STRUCT));
+}
+
+int32_t meta_cache_unlock_entry(META_CACHE_ENTRY_STRUCT *target_ptr)
+{
+	free(target_ptr);
+	return 0;
+}
+
+int32_t meta_cache_close_file(META_CACHE_ENTRY_STRUCT *body_ptr)
+{
+	return 0;
+}
+
+/* Dir meta has one page holding all children of the dir */
+int32_t meta_cache_lookup_dir_data(ino_t this_inode,
+				   HCFS_STAT *inode_stat,
+				   DIR_META_TYPE *dir_meta_ptr,
+				   DIR_ENTRY_PAGE *dir_page,
+				   META_CACHE_ENTRY_STRUCT *body_ptr)
+{
+	ino_t count;
+
+	if (dir_meta_ptr != NULL) {
+		memset(dir_meta_ptr, 0, sizeof(DIR_META_TYPE));
+		dir_meta_ptr->tree_walk_list_head = 1;
+	}
+	if (dir_page != NULL) {
+		dir_page->num_entries = 0;
+		dir_page->tree_walk_next = 0;
+		for (count = 1; count < MAX_FAKE_INO; count++) {
+			if (fake_parent[count] != this_inode)
+				continue;
+			if (dir_page->num_entries >= MAX_DIR_ENTRIES_PER_PAGE)
+				break;
+			dir_page->dir_entries[dir_page->num_entries].d_ino =
+			    count;
+			strcpy(dir_page->dir_entries[dir_page->num_entries]
+				   .d_name, fake_name[count]);
+			(dir_page->num_entries)++;
+		}
+	}
+	return 0;
+}
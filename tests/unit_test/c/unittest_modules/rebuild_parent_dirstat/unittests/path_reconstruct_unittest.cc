@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern "C" {
+#include "path_reconstruct.h"
+#include "params.h"
+#include "path_reconstruct_unittest.h"
+}
+#include "gtest/gtest.h"
+
+#define MOCK_METAPATH "/tmp/path_reconstruct_meta"
+
+SYSTEM_CONF_STRUCT *system_config;
+
+class path_reconstructTest : public ::testing::Test {
+ protected:
+  PATH_CACHE *cache;
+
+  virtual void SetUp()
+  {
+    system_config = (SYSTEM_CONF_STRUCT *)
+        calloc(1, sizeof(SYSTEM_CONF_STRUCT));
+    system_config->metapath = (char *) MOCK_METAPATH;
+    system_config->path_cache_mem_limit = DEFAULT_PATH_CACHE_MEM_LIMIT;
+    mkdir(MOCK_METAPATH, 0700);
+    sem_init(&(pathlookup_data_lock), 0, 1);
+    memset(fake_parent, 0, sizeof(fake_parent));
+    memset(fake_name, 0, sizeof(fake_name));
+    fake_num_lookups = 0;
+
+    /* /a/b/c */
+    AddFake(2, FAKE_ROOT, "a");
+    AddFake(3, 2, "b");
+    AddFake(4, 3, "c");
+    cache = init_pathcache(FAKE_ROOT);
+  }
+
+  virtual void TearDown()
+  {
+    char pathname[200];
+
+    if (cache != NULL)
+      destroy_pathcache(cache);
+    SnapshotPath(pathname);
+    unlink(pathname);
+    rmdir(MOCK_METAPATH);
+    free(system_config);
+  }
+
+  void AddFake(ino_t thisinode, ino_t parent, const char *name)
+  {
+    fake_parent[thisinode] = parent;
+    strcpy(fake_name[thisinode], name);
+  }
+
+  void SnapshotPath(char *pathname)
+  {
+    sprintf(pathname, "%s/pathcache_%d", MOCK_METAPATH, FAKE_ROOT);
+  }
+
+  std::string Path(ino_t thisinode)
+  {
+    char *result = NULL;
+    std::string path;
+
+    if (construct_path(cache, thisinode, &result, FAKE_ROOT) < 0)
+      return "";
+    path = result;
+    free(result);
+    return path;
+  }
+
+  PATH_LOOKUP *FindNode(ino_t thisinode)
+  {
+    PATH_LOOKUP *node;
+    int64_t count;
+
+    for (count = 0; count < cache->num_buckets; count++)
+      for (node = cache->hashtable[count]; node != NULL;
+           node = node->next)
+        if (node->child == thisinode)
+          return node;
+    return NULL;
+  }
+};
+
+TEST_F(path_reconstructTest, ConstructPathAndCacheIt)
+{
+  ASSERT_TRUE(cache != NULL);
+  EXPECT_EQ("/", Path(FAKE_ROOT));
+  EXPECT_EQ("/a/b/c", Path(4));
+  EXPECT_EQ(3, fake_num_lookups);
+  EXPECT_EQ(3, cache->num_nodes);
+
+  /* Cached now, ancestors included */
+  EXPECT_EQ("/a/b/c", Path(4));
+  EXPECT_EQ("/a/b", Path(3));
+  EXPECT_EQ(3, fake_num_lookups);
+}
+
+TEST_F(path_reconstructTest, NoParentIsNotFound)
+{
+  char *result = NULL;
+
+  ASSERT_TRUE(cache != NULL);
+  EXPECT_EQ(-ENOENT, construct_path(cache, 50, &result, FAKE_ROOT));
+  EXPECT_TRUE(result == NULL);
+}
+
+TEST_F(path_reconstructTest, AncestorsAndNamesAreShared)
+{
+  PATH_LOOKUP *node1, *node2;
+
+  ASSERT_TRUE(cache != NULL);
+  AddFake(5, 3, "same");
+  AddFake(6, 2, "x");
+  AddFake(7, 6, "same");
+  EXPECT_EQ("/a/b/c", Path(4));
+  EXPECT_EQ(3, fake_num_lookups);
+
+  /* Only the new leaf is looked up */
+  EXPECT_EQ("/a/b/same", Path(5));
+  EXPECT_EQ(4, fake_num_lookups);
+  EXPECT_EQ("/a/x/same", Path(7));
+  EXPECT_EQ(6, fake_num_lookups);
+
+  node1 = FindNode(5);
+  node2 = FindNode(7);
+  ASSERT_TRUE(node1 != NULL);
+  ASSERT_TRUE(node2 != NULL);
+  EXPECT_EQ(node1->name, node2->name);
+  EXPECT_EQ(2, node1->name->refcount);
+  EXPECT_EQ(FindNode(3), node1->parent_node);
+  EXPECT_EQ(2, FindNode(3)->num_children);
+}
+
+TEST_F(path_reconstructTest, DeletedDirIsLookedUpAgain)
+{
+  ASSERT_TRUE(cache != NULL);
+  EXPECT_EQ("/a/b/c", Path(4));
+
+  /* Rename "a" to "z" */
+  strcpy(fake_name[2], "z");
+  EXPECT_EQ(0, delete_pathcache_node(cache, 2));
+  EXPECT_EQ(3, cache->num_nodes);
+  EXPECT_EQ("/z/b/c", Path(4));
+  EXPECT_EQ(4, fake_num_lookups);
+
+  /* Leaves are removed */
+  EXPECT_EQ(0, delete_pathcache_node(cache, 4));
+  EXPECT_EQ(2, cache->num_nodes);
+  EXPECT_EQ(0, FindNode(3)->num_children);
+}
+
+TEST_F(path_reconstructTest, EvictLeavesWithinBudget)
+{
+  char name[20];
+  ino_t count;
+
+  destroy_pathcache(cache);
+  /* Hash tables plus a few dozen nodes */
+  system_config->path_cache_mem_limit =
+      2 * MIN_PATH_CACHE_BUCKETS * sizeof(void *) + 4096;
+  cache = init_pathcache(FAKE_ROOT);
+  ASSERT_TRUE(cache != NULL);
+
+  for (count = 10; count < 100; count++) {
+    sprintf(name, "file%d", (int32_t) count);
+    AddFake(count, 3, name);
+  }
+  for (count = 10; count < 100; count++) {
+    sprintf(name, "/a/b/file%d", (int32_t) count);
+    EXPECT_EQ(name, Path(count));
+    EXPECT_LE(cache->mem_used, cache->mem_limit);
+  }
+  EXPECT_LT(cache->num_nodes, 92);
+
+  /* Ancestors of cached leaves stay, as do the most recent leaves */
+  EXPECT_TRUE(FindNode(2) != NULL);
+  EXPECT_TRUE(FindNode(3) != NULL);
+  EXPECT_TRUE(FindNode(10) == NULL);
+  fake_num_lookups = 0;
+  EXPECT_EQ("/a/b/file99", Path(99));
+  EXPECT_EQ(0, fake_num_lookups);
+}
+
+TEST_F(path_reconstructTest, SnapshotWarmsNextCache)
+{
+  char pathname[200];
+
+  ASSERT_TRUE(cache != NULL);
+  AddFake(5, FAKE_ROOT, "d");
+  AddFake(6, 5, "e");
+  EXPECT_EQ("/a/b/c", Path(4));
+  EXPECT_EQ("/d/e", Path(6));
+  /* Subtree of a renamed dir is not saved */
+  EXPECT_EQ(0, delete_pathcache_node(cache, 5));
+
+  EXPECT_EQ(0, destroy_pathcache(cache));
+  SnapshotPath(pathname);
+  EXPECT_EQ(0, access(pathname, F_OK));
+
+  cache = init_pathcache(FAKE_ROOT);
+  ASSERT_TRUE(cache != NULL);
+  EXPECT_EQ(3, cache->num_nodes);
+  EXPECT_NE(0, access(pathname, F_OK));
+  fake_num_lookups = 0;
+  EXPECT_EQ("/a/b/c", Path(4));
+  EXPECT_EQ(0, fake_num_lookups);
+  EXPECT_EQ("/d/e", Path(6));
+  EXPECT_EQ(2, fake_num_lookups);
+}
+
+TEST_F(path_reconstructTest, DeletedVolumeLosesSnapshot)
+{
+  char pathname[200];
+
+  ASSERT_TRUE(cache != NULL);
+  EXPECT_EQ("/a/b/c", Path(4));
+  EXPECT_EQ(0, destroy_pathcache(cache));
+  cache = NULL;
+
+  /* The volume is deleted */
+  EXPECT_EQ(0, delete_pathcache_snapshot(FAKE_ROOT));
+  SnapshotPath(pathname);
+  EXPECT_NE(0, access(pathname, F_OK));
+  cache = init_pathcache(FAKE_ROOT);
+  ASSERT_TRUE(cache != NULL);
+  EXPECT_EQ(0, cache->num_nodes);
+}
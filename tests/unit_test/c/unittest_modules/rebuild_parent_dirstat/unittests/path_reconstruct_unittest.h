@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef PATH_RECONSTRUCT_UNITTEST_H_
+#define PATH_RECONSTRUCT_UNITTEST_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "params.h"
+
+#define MAX_FAKE_INO 200
+#define FAKE_ROOT 1
+
+/* Parent and name of each inode in the fake tree, 0 parent if none */
+extern ino_t fake_parent[MAX_FAKE_INO];
+extern char fake_name[MAX_FAKE_INO][MAX_FILENAME_LEN + 1];
+/* Number of dir lookups done for names not in the path cache */
+extern int32_t fake_num_lookups;
+
+#endif  /* PATH_RECONSTRUCT_UNITTEST_H_ */
@@ -68,3 +68,36 @@ int32_t fetch_all_parents(ino_t self_inode, int32_t *parentnum,
 	return 0;
 }
 
+int32_t lookup_first_parent(ino_t self_inode, ino_t *parentptr)
+{
+	*parentptr = 0;
+	if (self_inode < MAX_FAKE_INO)
+		*parentptr = fake_first_parent[self_inode];
+	return 0;
+}
+
+int32_t lookup_max_inode(ino_t *maxptr)
+{
+	ino_t this_inode;
+
+	*maxptr = 0;
+	for (this_inode = 1; this_inode < MAX_FAKE_INO; this_inode++)
+		if (fake_first_parent[this_inode] > 0)
+			*maxptr = this_inode;
+	return 0;
+}
+
+int32_t update_dirstat_parent(ino_t baseinode, DIR_STATS_TYPE *newstat)
+{
+	fake_queued_parent = baseinode;
+	fake_queued_local += newstat->num_local;
+	fake_queued_cloud += newstat->num_cloud;
+	fake_queued_hybrid += newstat->num_hybrid;
+	return 0;
+}
+
+int32_t flush_dirstat_delta(void)
+{
+	fake_num_flushes++;
+	return 0;
+}
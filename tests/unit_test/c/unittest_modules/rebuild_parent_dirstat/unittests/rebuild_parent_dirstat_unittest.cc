@@ -54,33 +54,18 @@ class rebuild_parent_statTest : public ::testing::Test {
     sem_init(&(pathlookup_data_lock), 0, 1);
 
     fake_num_parents = 0;
+    memset(fake_first_parent, 0, sizeof(fake_first_parent));
     dirstat_lookup_data_fptr = fopen(MOCK_DIRSTAT_PATH, "w+");
-    pathlookup_data_fptr = fopen(MOCK_PATHLOOKUP_PATH, "w+");
   }
 
   virtual void TearDown() {
     free(hcfs_system);
     fclose(dirstat_lookup_data_fptr);
-    fclose(pathlookup_data_fptr);
     unlink(MOCK_DIRSTAT_PATH);
-    unlink(MOCK_PATHLOOKUP_PATH);
    }
   void BuildMockPathlookup() {
-    PRIMARY_PARENT_T tmpparent;
-    off_t filepos;
-
-    tmpparent.haveothers = FALSE;
-    tmpparent.parentinode = FAKE_ROOT;
-    filepos = (off_t) ((FAKE_GRAND_PARENT - 1) *
-               sizeof(PRIMARY_PARENT_T));
-    pwrite(fileno(pathlookup_data_fptr), &tmpparent,
-          sizeof(PRIMARY_PARENT_T), filepos);
-
-    tmpparent.parentinode = FAKE_GRAND_PARENT;
-    filepos = (off_t) ((FAKE_EXIST_PARENT - 1) *
-               sizeof(PRIMARY_PARENT_T));
-    pwrite(fileno(pathlookup_data_fptr), &tmpparent,
-          sizeof(PRIMARY_PARENT_T), filepos);
+    fake_first_parent[FAKE_GRAND_PARENT] = FAKE_ROOT;
+    fake_first_parent[FAKE_EXIST_PARENT] = FAKE_GRAND_PARENT;
    }
   void fetch_meta_path(char *pathname, ino_t this_inode) {
     sprintf(pathname, "%s_%" PRIu64 "", MOCK_META_PATH,
@@ -402,4 +387,77 @@ TEST_F(rebuild_parent_statTest, FileObjectHaveMetaHybrid) {
 
 /* End of the test case for the function rebuild_parent_stat */
 
+/* Begin of the test case for the function rebuild_dirstat_lookup */
 
+class rebuild_dirstat_lookupTest : public rebuild_parent_statTest {
+ protected:
+  virtual void SetUp() {
+    rebuild_parent_statTest::SetUp();
+    fake_num_flushes = 0;
+    fake_queued_parent = 0;
+    fake_queued_local = 0;
+    fake_queued_cloud = 0;
+    fake_queued_hybrid = 0;
+  }
+
+  void WriteMockMeta(ino_t this_inode, mode_t mode, int64_t num_blocks,
+                     int64_t num_cached_blocks) {
+    HCFS_STAT tmpstat;
+    FILE_STATS_TYPE tmpmetastat;
+    char tmpmetapath[50];
+    FILE *fptr;
+
+    fetch_meta_path(tmpmetapath, this_inode);
+    fptr = fopen(tmpmetapath, "w+");
+    memset(&tmpstat, 0, sizeof(HCFS_STAT));
+    tmpstat.mode = mode;
+    pwrite(fileno(fptr), &tmpstat, sizeof(HCFS_STAT), 0);
+    memset(&tmpmetastat, 0, sizeof(FILE_STATS_TYPE));
+    tmpmetastat.num_blocks = num_blocks;
+    tmpmetastat.num_cached_blocks = num_cached_blocks;
+    pwrite(fileno(fptr), &tmpmetastat, sizeof(FILE_STATS_TYPE),
+           sizeof(HCFS_STAT) + sizeof(FILE_META_TYPE));
+    fclose(fptr);
+  }
+
+  void RemoveMockMeta(ino_t this_inode) {
+    char tmpmetapath[50];
+
+    fetch_meta_path(tmpmetapath, this_inode);
+    unlink(tmpmetapath);
+  }
+ };
+
+/* Files are counted again from the parent lookup db, and the old
+statistics are dropped */
+TEST_F(rebuild_dirstat_lookupTest, RecountFilesFromScratch) {
+  DIR_STATS_TYPE tmpstat;
+  off_t filepos;
+  struct stat dirstat_stat;
+
+  BuildMockPathlookup();
+  fake_first_parent[ONE_PARENT_INO] = FAKE_EXIST_PARENT;
+
+  memset(&tmpstat, 0, sizeof(DIR_STATS_TYPE));
+  tmpstat.num_local = 10;
+  filepos = (off_t) ((FAKE_ROOT - 1) * sizeof(DIR_STATS_TYPE));
+  pwrite(fileno(dirstat_lookup_data_fptr), &tmpstat,
+         sizeof(DIR_STATS_TYPE), filepos);
+
+  /* One hybrid file, and a dir that is not counted */
+  WriteMockMeta(ONE_PARENT_INO, S_IFREG | 0600, 10, 5);
+  WriteMockMeta(FAKE_EXIST_PARENT, S_IFDIR | 0700, 0, 0);
+
+  ASSERT_EQ(0, rebuild_dirstat_lookup());
+
+  fstat(fileno(dirstat_lookup_data_fptr), &dirstat_stat);
+  EXPECT_EQ(0, dirstat_stat.st_size);
+  EXPECT_EQ(FAKE_EXIST_PARENT, fake_queued_parent);
+  EXPECT_EQ(0, fake_queued_local);
+  EXPECT_EQ(0, fake_queued_cloud);
+  EXPECT_EQ(1, fake_queued_hybrid);
+  EXPECT_EQ(1, fake_num_flushes);
+
+  RemoveMockMeta(ONE_PARENT_INO);
+  RemoveMockMeta(FAKE_EXIST_PARENT);
+ }
@@ -26,7 +26,12 @@
 #define FAKE_GRAND_PARENT 3
 #define MOCK_META_PATH "/tmp/this_meta"
 #define MOCK_DIRSTAT_PATH "/tmp/dirstat"
-#define MOCK_PATHLOOKUP_PATH "/tmp/pathlookup"
+#define MAX_FAKE_INO 10
 
 int32_t fake_num_parents;
+/* First parent of each inode, or 0 if none */
+ino_t fake_first_parent[MAX_FAKE_INO];
+int32_t fake_num_flushes;
+ino_t fake_queued_parent;
+int64_t fake_queued_local, fake_queued_cloud, fake_queued_hybrid;
 
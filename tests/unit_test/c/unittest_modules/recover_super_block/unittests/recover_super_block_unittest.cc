@@ -122,6 +122,8 @@ FAKE_VALUE_FUNC(int32_t, super_block_share_locking);
 FAKE_VALUE_FUNC(int32_t, super_block_share_release);
 FAKE_VALUE_FUNC(int32_t, super_block_exclusive_locking);
 FAKE_VALUE_FUNC(int32_t, super_block_exclusive_release);
+FAKE_VALUE_FUNC(int32_t, super_block_update_lock_range, ino_t, int64_t);
+FAKE_VALUE_FUNC(int32_t, super_block_update_release_range, ino_t, int64_t);
 FAKE_VALUE_FUNC(int32_t, write_super_block_head);
 
 FAKE_VALUE_FUNC(int32_t, meta_cache_unlock_entry,META_CACHE_ENTRY_STRUCT*);
@@ -1300,12 +1302,16 @@ class recover_sb_queue_workerTest : public ::testing::Test
 	{
 		RESET_FAKE(super_block_exclusive_locking);
 		RESET_FAKE(super_block_exclusive_release);
+		RESET_FAKE(super_block_update_lock_range);
+		RESET_FAKE(super_block_update_release_range);
 	}
 
 	void TearDown()
 	{
 		ASSERT_EQ(super_block_exclusive_locking_fake.call_count,
 			  super_block_exclusive_release_fake.call_count);
+		ASSERT_EQ(super_block_update_lock_range_fake.call_count,
+			  super_block_update_release_range_fake.call_count);
 	}
 };
 
@@ -18,6 +18,7 @@
  */
 #include "meta_mem_cache.h"
 #include "mock_params.h"
+#include "block_fd_cache.h"
 
 META_CACHE_ENTRY_STRUCT *meta_cache_lock_entry(ino_t this_inode)
 {
@@ -52,3 +53,7 @@ int32_t write_log(int32_t level, const char *format, ...)
 	return 0;
 }
 
+void put_block_fd(BLOCK_FD_ENTRY *entry)
+{
+	return;
+}
@@ -18,6 +18,7 @@
  */
 #include <vector>
 #include <ftw.h>
+#include <sys/mman.h>
 #include "mock_params.h"
 #include "gtest/gtest.h"
 extern "C" {
@@ -192,6 +193,7 @@ class handle_dirmeta_snapshotTest : public ::testing::Test {
   protected:
     FILE *tmpfptr;
     char *tmpmeta;
+    META_CACHE_ENTRY_STRUCT *body_ptr;
     int errcode, ret;
     virtual void SetUp() {
       system_config = (SYSTEM_CONF_STRUCT *) malloc(sizeof(SYSTEM_CONF_STRUCT));
@@ -213,15 +215,72 @@ class handle_dirmeta_snapshotTest : public ::testing::Test {
         printf("%d\n", errcode);
       }
       tmpfptr = fopen(tmpmeta, "r+");
+      body_ptr = (META_CACHE_ENTRY_STRUCT *)
+              calloc(1, sizeof(META_CACHE_ENTRY_STRUCT));
+      body_ptr->fptr = tmpfptr;
     }
     virtual void TearDown() {
+      if (body_ptr->mmap_addr != NULL)
+        munmap(body_ptr->mmap_addr, body_ptr->mmap_len);
+      free(body_ptr);
       if (tmpfptr != NULL)
         fclose(tmpfptr);
       unlink(tmpmeta);
       nftw(METAPATH, do_delete, 20, FTW_DEPTH);
       free(METAPATH);
+      free(tmpmeta);
       free(system_config);
     }
+    /* Write a dir meta with "num_pages" pages on the tree walk list.
+       Pages are written in reverse order of the list. */
+    void write_dir_meta(int num_pages) {
+      HCFS_STAT tmpstat;
+      DIR_META_TYPE tmpmeta;
+      DIR_ENTRY_PAGE tmppage;
+      int count;
+
+      memset(&tmpstat, 0, sizeof(HCFS_STAT));
+      memset(&tmpmeta, 0, sizeof(DIR_META_TYPE));
+      tmpmeta.total_children = num_pages * 2;
+      if (num_pages > 0)
+        tmpmeta.tree_walk_list_head = page_pos(num_pages, 0);
+      pwrite(fileno(tmpfptr), &tmpstat, sizeof(HCFS_STAT), 0);
+      pwrite(fileno(tmpfptr), &tmpmeta, sizeof(DIR_META_TYPE),
+             sizeof(HCFS_STAT));
+      for (count = 0; count < num_pages; count++) {
+        memset(&tmppage, 0, sizeof(DIR_ENTRY_PAGE));
+        tmppage.this_page_pos = page_pos(num_pages, count);
+        if (count + 1 < num_pages)
+          tmppage.tree_walk_next = page_pos(num_pages, count + 1);
+        tmppage.num_entries = 1;
+        tmppage.dir_entries[0].d_ino = count + 100;
+        snprintf(tmppage.dir_entries[0].d_name, 10, "f%d", count);
+        pwrite(fileno(tmpfptr), &tmppage, sizeof(DIR_ENTRY_PAGE),
+               tmppage.this_page_pos);
+      }
+    }
+    /* Check pages of "snapshot" are those written by write_dir_meta */
+    void check_snapshot_pages(DIR_SNAPSHOT *snapshot, int num_pages) {
+      DIR_ENTRY_PAGE tmppage, *page;
+      int count;
+
+      ASSERT_EQ(num_pages, snapshot->num_pages);
+      for (count = 0; count < num_pages; count++) {
+        page = get_dir_snapshot_page(snapshot, count, &tmppage);
+        ASSERT_TRUE(page != NULL);
+        EXPECT_EQ(page_pos(num_pages, count), page->this_page_pos);
+        EXPECT_EQ(count + 100, page->dir_entries[0].d_ino);
+        EXPECT_EQ(count, find_dir_snapshot_page(snapshot,
+                                                page_pos(num_pages, count)));
+      }
+      EXPECT_TRUE(get_dir_snapshot_page(snapshot, num_pages, &tmppage) == NULL);
+      EXPECT_EQ(-1, find_dir_snapshot_page(snapshot, 1));
+    }
+    /* Position of the "index"-th page on the tree walk list */
+    int64_t page_pos(int num_pages, int index) {
+      return sizeof(HCFS_STAT) + sizeof(DIR_META_TYPE) +
+             (num_pages - 1 - index) * sizeof(DIR_ENTRY_PAGE);
+    }
 
 };
 
@@ -234,7 +293,7 @@ TEST_F(handle_dirmeta_snapshotTest, NoOpenedMetaFile) {
 TEST_F(handle_dirmeta_snapshotTest, AllSnapshotCreated) {
 
   system_fh_table.have_nonsnap_dir = FALSE;
-  ASSERT_EQ(0, handle_dirmeta_snapshot(0, tmpfptr));
+  ASSERT_EQ(0, handle_dirmeta_snapshot(0, body_ptr));
 }
 
 TEST_F(handle_dirmeta_snapshotTest, NoOpenedFilesOrDir) {
@@ -243,7 +302,7 @@ TEST_F(handle_dirmeta_snapshotTest, NoOpenedFilesOrDir) {
   system_fh_table.have_nonsnap_dir = TRUE;
   for (count = 0; count < MAX_OPEN_FILE_ENTRIES; count++)
     system_fh_table.entry_table_flags[count] = NO_FH;
-  ASSERT_EQ(0, handle_dirmeta_snapshot(0, tmpfptr));
+  ASSERT_EQ(0, handle_dirmeta_snapshot(0, body_ptr));
   ASSERT_EQ(FALSE, system_fh_table.have_nonsnap_dir);
 }
 
@@ -253,7 +312,7 @@ TEST_F(handle_dirmeta_snapshotTest, OnlyOpenedFiles) {
   system_fh_table.have_nonsnap_dir = TRUE;
   for (count = 0; count < MAX_OPEN_FILE_ENTRIES; count++)
     system_fh_table.entry_table_flags[count] = IS_FH;
-  ASSERT_EQ(0, handle_dirmeta_snapshot(0, tmpfptr));
+  ASSERT_EQ(0, handle_dirmeta_snapshot(0, body_ptr));
   ASSERT_EQ(FALSE, system_fh_table.have_nonsnap_dir);
 }
 
@@ -264,72 +323,100 @@ TEST_F(handle_dirmeta_snapshotTest, NoMatchedOpenedDir) {
   for (count = 0; count < MAX_OPEN_FILE_ENTRIES; count++) {
     system_fh_table.entry_table_flags[count] = IS_DIRH;
     system_fh_table.direntry_table[count].thisinode = 10;
-    system_fh_table.direntry_table[count].snapshot_ptr = NULL;
+    system_fh_table.direntry_table[count].snapshot = NULL;
   }
-  ASSERT_EQ(0, handle_dirmeta_snapshot(9, tmpfptr));
+  ASSERT_EQ(0, handle_dirmeta_snapshot(9, body_ptr));
   ASSERT_EQ(TRUE, system_fh_table.have_nonsnap_dir);
 }
 
 TEST_F(handle_dirmeta_snapshotTest, OneMatchedOpenedDir) {
   int count;
-  FILE *fptr1;
-  char tmpstr[100];
+  DIR_SNAPSHOT *snapshot;
 
   system_fh_table.have_nonsnap_dir = TRUE;
   for (count = 0; count < MAX_OPEN_FILE_ENTRIES; count++) {
     system_fh_table.entry_table_flags[count] = IS_DIRH;
     system_fh_table.direntry_table[count].thisinode = 10;
-    system_fh_table.direntry_table[count].snapshot_ptr = NULL;
+    system_fh_table.direntry_table[count].snapshot = NULL;
   }
   system_fh_table.direntry_table[0].thisinode = 9;
-  fprintf(tmpfptr, "testmetacontent\n");
-  rewind(tmpfptr);
-  EXPECT_EQ(0, handle_dirmeta_snapshot(9, tmpfptr));
+  write_dir_meta(3);
+  EXPECT_EQ(0, handle_dirmeta_snapshot(9, body_ptr));
   EXPECT_EQ(TRUE, system_fh_table.have_nonsnap_dir);
-  EXPECT_NE(0, (system_fh_table.direntry_table[0].snapshot_ptr != NULL));
-  fptr1 = system_fh_table.direntry_table[0].snapshot_ptr;
-  tmpstr[0] = 0;
-  fscanf(fptr1, "%s\n", tmpstr);
-  fclose(fptr1);
-  ASSERT_EQ(0, strcmp(tmpstr, "testmetacontent"));
+  snapshot = system_fh_table.direntry_table[0].snapshot;
+  ASSERT_TRUE(snapshot != NULL);
+  EXPECT_EQ(1, snapshot->refcount);
+  ASSERT_EQ(3, snapshot->num_pages);
+  /* Pages are kept in memory in tree walk order */
+  EXPECT_TRUE(snapshot->fptr == NULL);
+  EXPECT_EQ(snapshot->mem_size, system_fh_table.snapshot_mem_size);
+  check_snapshot_pages(snapshot, 3);
+  put_dir_snapshot(snapshot);
+  system_fh_table.direntry_table[0].snapshot = NULL;
+  EXPECT_EQ(0, system_fh_table.snapshot_mem_size);
+}
+
+TEST_F(handle_dirmeta_snapshotTest, OverMemoryLimitKeptInFile) {
+  int count;
+  DIR_SNAPSHOT *snapshot;
+
+  system_fh_table.have_nonsnap_dir = TRUE;
+  for (count = 0; count < MAX_OPEN_FILE_ENTRIES; count++)
+    system_fh_table.entry_table_flags[count] = NO_FH;
+  system_fh_table.entry_table_flags[0] = IS_DIRH;
+  system_fh_table.direntry_table[0].thisinode = 9;
+  system_fh_table.direntry_table[0].snapshot = NULL;
+  /* Pages of other snapshots use up all but room for 4 pages, so the
+     pages move to the file when the page array grows */
+  system_fh_table.snapshot_mem_size =
+      MAX_DIR_SNAPSHOT_MEM - 4 * sizeof(DIR_ENTRY_PAGE);
+  write_dir_meta(6);
+  EXPECT_EQ(0, handle_dirmeta_snapshot(9, body_ptr));
+  snapshot = system_fh_table.direntry_table[0].snapshot;
+  ASSERT_TRUE(snapshot != NULL);
+  EXPECT_TRUE(snapshot->fptr != NULL);
+  EXPECT_TRUE(snapshot->pages == NULL);
+  EXPECT_EQ(0, snapshot->mem_size);
+  EXPECT_EQ(MAX_DIR_SNAPSHOT_MEM - 4 * sizeof(DIR_ENTRY_PAGE),
+            system_fh_table.snapshot_mem_size);
+  /* The temp file is unlinked */
+  EXPECT_NE(0, access("/tmp/test_snapshot/tmp_dirmeta_snap", F_OK));
+  check_snapshot_pages(snapshot, 6);
+  put_dir_snapshot(snapshot);
+  system_fh_table.direntry_table[0].snapshot = NULL;
 }
 
 TEST_F(handle_dirmeta_snapshotTest, TwoMatchedOpenedDir) {
   int count, index;
-  FILE *fptr1;
-  char tmpstr[100];
+  DIR_SNAPSHOT *snapshot;
 
   system_fh_table.have_nonsnap_dir = TRUE;
   for (count = 0; count < MAX_OPEN_FILE_ENTRIES; count++) {
     system_fh_table.entry_table_flags[count] = IS_DIRH;
     system_fh_table.direntry_table[count].thisinode = 10;
-    system_fh_table.direntry_table[count].snapshot_ptr = NULL;
+    system_fh_table.direntry_table[count].snapshot = NULL;
   }
   index = MAX_OPEN_FILE_ENTRIES - 1;
   system_fh_table.direntry_table[0].thisinode = 9;
   system_fh_table.direntry_table[index].thisinode = 9;
-  fprintf(tmpfptr, "testmetacontent\n");
-  rewind(tmpfptr);
-  EXPECT_EQ(0, handle_dirmeta_snapshot(9, tmpfptr));
+  write_dir_meta(2);
+  EXPECT_EQ(0, handle_dirmeta_snapshot(9, body_ptr));
   EXPECT_EQ(TRUE, system_fh_table.have_nonsnap_dir);
-  EXPECT_NE(0, (system_fh_table.direntry_table[0].snapshot_ptr != NULL));
-  fptr1 = system_fh_table.direntry_table[0].snapshot_ptr;
-  tmpstr[0] = 0;
-  fscanf(fptr1, "%s\n", tmpstr);
-  fclose(fptr1);
-  EXPECT_EQ(0, strcmp(tmpstr, "testmetacontent"));
-  EXPECT_NE(0, (system_fh_table.direntry_table[index].snapshot_ptr != NULL));
-  fptr1 = system_fh_table.direntry_table[index].snapshot_ptr;
-  tmpstr[0] = 0;
-  fscanf(fptr1, "%s\n", tmpstr);
-  fclose(fptr1);
-  ASSERT_EQ(0, strcmp(tmpstr, "testmetacontent"));
+  /* Both handles share one snapshot */
+  snapshot = system_fh_table.direntry_table[0].snapshot;
+  ASSERT_TRUE(snapshot != NULL);
+  EXPECT_EQ(snapshot, system_fh_table.direntry_table[index].snapshot);
+  EXPECT_EQ(2, snapshot->refcount);
+  EXPECT_EQ(2, snapshot->num_pages);
+  put_dir_snapshot(snapshot);
+  put_dir_snapshot(snapshot);
+  system_fh_table.direntry_table[0].snapshot = NULL;
+  system_fh_table.direntry_table[index].snapshot = NULL;
 }
 
 TEST_F(handle_dirmeta_snapshotTest, ManyMatchedOpenedDir) {
   int count, index;
-  FILE *fptr1;
-  char tmpstr[100];
+  DIR_SNAPSHOT *snapshot;
 
   system_fh_table.have_nonsnap_dir = TRUE;
   for (count = 0; count < MAX_OPEN_FILE_ENTRIES; count++)
@@ -337,21 +424,91 @@ TEST_F(handle_dirmeta_snapshotTest, ManyMatchedOpenedDir) {
   for (count = 0; count < 100; count++) {
     system_fh_table.entry_table_flags[count] = IS_DIRH;
     system_fh_table.direntry_table[count].thisinode = 9;
-    system_fh_table.direntry_table[count].snapshot_ptr = NULL;
+    system_fh_table.direntry_table[count].snapshot = NULL;
   }
-  fprintf(tmpfptr, "testmetacontent\n");
-  rewind(tmpfptr);
-  EXPECT_EQ(0, handle_dirmeta_snapshot(9, tmpfptr));
+  write_dir_meta(1);
+  EXPECT_EQ(0, handle_dirmeta_snapshot(9, body_ptr));
   EXPECT_EQ(FALSE, system_fh_table.have_nonsnap_dir);
+  snapshot = system_fh_table.direntry_table[0].snapshot;
+  ASSERT_TRUE(snapshot != NULL);
+  EXPECT_EQ(100, snapshot->refcount);
   for (index = 0; index < 100; index++) {
-    EXPECT_NE(0, (system_fh_table.direntry_table[index].snapshot_ptr != NULL));
-    fptr1 = system_fh_table.direntry_table[index].snapshot_ptr;
-    tmpstr[0] = 0;
-    fscanf(fptr1, "%s\n", tmpstr);
-    fclose(fptr1);
-    EXPECT_EQ(0, strcmp(tmpstr, "testmetacontent"));
+    EXPECT_EQ(snapshot, system_fh_table.direntry_table[index].snapshot);
+    system_fh_table.direntry_table[index].snapshot = NULL;
+    put_dir_snapshot(snapshot);
   }
 }
 
+TEST_F(handle_dirmeta_snapshotTest, BrokenTreeWalkList) {
+  DIR_META_TYPE tmpmeta;
+  DIR_ENTRY_PAGE tmppage;
+  int count;
+
+  system_fh_table.have_nonsnap_dir = TRUE;
+  for (count = 0; count < MAX_OPEN_FILE_ENTRIES; count++)
+    system_fh_table.entry_table_flags[count] = NO_FH;
+  system_fh_table.entry_table_flags[0] = IS_DIRH;
+  system_fh_table.direntry_table[0].thisinode = 9;
+  system_fh_table.direntry_table[0].snapshot = NULL;
+  write_dir_meta(1);
+  /* Make the only page point to itself */
+  pread(fileno(tmpfptr), &tmppage, sizeof(DIR_ENTRY_PAGE), page_pos(1, 0));
+  tmppage.tree_walk_next = tmppage.this_page_pos;
+  pwrite(fileno(tmpfptr), &tmppage, sizeof(DIR_ENTRY_PAGE), page_pos(1, 0));
+
+  EXPECT_EQ(-EIO, handle_dirmeta_snapshot(9, body_ptr));
+  EXPECT_TRUE(system_fh_table.direntry_table[0].snapshot == NULL);
+}
+
 /* End of the test case for the function handle_dirmeta_snapshot */
 
+/* Begin of the test case for the function get_dirh_snapshot */
+class get_dirh_snapshotTest : public ::testing::Test {
+  protected:
+    DIR_SNAPSHOT *snapshot;
+    virtual void SetUp() {
+      init_system_fh_table();
+      snapshot = (DIR_SNAPSHOT *) calloc(1, sizeof(DIR_SNAPSHOT));
+      sem_init(&(snapshot->ref_sem), 0, 1);
+      snapshot->refcount = 1;
+      system_fh_table.entry_table_flags[0] = IS_DIRH;
+      system_fh_table.direntry_table[0].thisinode = 9;
+      system_fh_table.direntry_table[0].snapshot = snapshot;
+      system_fh_table.have_nonsnap_dir = FALSE;
+    }
+};
+
+TEST_F(get_dirh_snapshotTest, NoSnapshot) {
+  system_fh_table.direntry_table[0].snapshot = NULL;
+  EXPECT_TRUE(get_dirh_snapshot(&(system_fh_table.direntry_table[0]),
+                                FALSE) == NULL);
+  put_dir_snapshot(snapshot);
+}
+
+TEST_F(get_dirh_snapshotTest, TakeReference) {
+  EXPECT_EQ(snapshot,
+            get_dirh_snapshot(&(system_fh_table.direntry_table[0]), FALSE));
+  EXPECT_EQ(2, snapshot->refcount);
+  put_dir_snapshot(snapshot);
+  EXPECT_EQ(1, snapshot->refcount);
+  EXPECT_EQ(snapshot, system_fh_table.direntry_table[0].snapshot);
+  put_dir_snapshot(snapshot);
+}
+
+TEST_F(get_dirh_snapshotTest, DropWhileInUse) {
+  DIR_SNAPSHOT *in_use;
+
+  in_use = get_dirh_snapshot(&(system_fh_table.direntry_table[0]), FALSE);
+  ASSERT_EQ(snapshot, in_use);
+
+  /* Dropping from the handle keeps the snapshot for the reader */
+  EXPECT_TRUE(get_dirh_snapshot(&(system_fh_table.direntry_table[0]),
+                                TRUE) == NULL);
+  EXPECT_TRUE(system_fh_table.direntry_table[0].snapshot == NULL);
+  EXPECT_EQ(TRUE, system_fh_table.have_nonsnap_dir);
+  EXPECT_EQ(1, in_use->refcount);
+  put_dir_snapshot(in_use);
+}
+
+/* End of the test case for the function get_dirh_snapshot */
+
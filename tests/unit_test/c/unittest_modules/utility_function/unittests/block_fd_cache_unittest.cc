@@ -0,0 +1,313 @@
+/*
+ * Copyright (c) 2021 HopeBayTech.
+ *
+ * This file is part of Tera.
+ * See https://github.com/HopeBayMobile for further info.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+extern "C" {
+#include "block_fd_cache.h"
+}
+#include "gtest/gtest.h"
+
+#define TEST_BLOCK_DIR "block_fd_cache_test"
+#define TEST_INODE 5
+
+class block_fd_cacheTest : public ::testing::Test {
+protected:
+	void SetUp()
+	{
+		mkdir(TEST_BLOCK_DIR, 0700);
+		init_block_fd_cache();
+	}
+
+	void TearDown()
+	{
+		char path[200];
+
+		destroy_block_fd_cache();
+		for (int32_t count = 0;
+		     count <= MAX_BLOCK_FD_CACHE_ENTRIES + 1; count++) {
+			block_path(path, TEST_INODE, count);
+			unlink(path);
+			strcat(path, "_keep");
+			unlink(path);
+			block_path(path, TEST_INODE + 1, count);
+			unlink(path);
+			strcat(path, "_keep");
+			unlink(path);
+		}
+		rmdir(TEST_BLOCK_DIR);
+	}
+
+	void block_path(char *path, ino_t inode, int64_t block_no)
+	{
+		sprintf(path, "%s/block%d_%d", TEST_BLOCK_DIR, (int32_t)inode,
+			(int32_t)block_no);
+	}
+
+	/* Replace the block file with a new file of "content" */
+	void make_block(ino_t inode, int64_t block_no, const char *content)
+	{
+		char path[200], tmppath[200];
+		FILE *fptr;
+
+		block_path(path, inode, block_no);
+		sprintf(tmppath, "%s_tmp", path);
+		fptr = fopen(tmppath, "w");
+		ASSERT_TRUE(fptr != NULL);
+		fputs(content, fptr);
+		fclose(fptr);
+		ASSERT_EQ(0, rename(tmppath, path));
+	}
+
+	/* Keep a link to the current block file, so that it is not
+	 * removed when replaced */
+	void keep_block(ino_t inode, int64_t block_no)
+	{
+		char path[200], keeppath[200];
+
+		block_path(path, inode, block_no);
+		sprintf(keeppath, "%s_keep", path);
+		unlink(keeppath);
+		ASSERT_EQ(0, link(path, keeppath));
+	}
+
+	/* Read the cached file of the block through the cache */
+	void read_block(ino_t inode, int64_t block_no, char *buf)
+	{
+		char path[200];
+		BLOCK_FD_ENTRY *entry;
+		size_t ret_size;
+
+		block_path(path, inode, block_no);
+		entry = get_block_fd(inode, block_no, path);
+		ASSERT_TRUE(entry != NULL);
+		memset(buf, 0, 10);
+		fseek(entry->fptr, 0, SEEK_SET);
+		ret_size = fread(buf, 1, 9, entry->fptr);
+		ASSERT_GT(ret_size, 0);
+		put_block_fd(entry);
+	}
+};
+
+TEST_F(block_fd_cacheTest, OpenFailReturnsNull)
+{
+	char path[200];
+
+	block_path(path, TEST_INODE, 0);
+	errno = 0;
+	EXPECT_TRUE(get_block_fd(TEST_INODE, 0, path) == NULL);
+	EXPECT_EQ(ENOENT, errno);
+}
+
+TEST_F(block_fd_cacheTest, SameBlockSharesEntry)
+{
+	char path[200];
+	BLOCK_FD_ENTRY *entry1, *entry2;
+
+	make_block(TEST_INODE, 0, "old");
+	block_path(path, TEST_INODE, 0);
+	entry1 = get_block_fd(TEST_INODE, 0, path);
+	ASSERT_TRUE(entry1 != NULL);
+	entry2 = get_block_fd(TEST_INODE, 0, path);
+	EXPECT_EQ(entry1, entry2);
+	EXPECT_EQ(2, entry1->refcount);
+	put_block_fd(entry2);
+	put_block_fd(entry1);
+}
+
+TEST_F(block_fd_cacheTest, IdleFileIsKeptOpen)
+{
+	char buf[10];
+
+	make_block(TEST_INODE, 0, "old");
+	keep_block(TEST_INODE, 0);
+	read_block(TEST_INODE, 0, buf);
+	EXPECT_STREQ("old", buf);
+
+	/* Without invalidation the opened old file is still used */
+	make_block(TEST_INODE, 0, "new");
+	read_block(TEST_INODE, 0, buf);
+	EXPECT_STREQ("old", buf);
+}
+
+TEST_F(block_fd_cacheTest, RemovedFileIsReopened)
+{
+	char buf[10];
+
+	make_block(TEST_INODE, 0, "old");
+	read_block(TEST_INODE, 0, buf);
+
+	/* Block file removed by another process without invalidation */
+	make_block(TEST_INODE, 0, "new");
+	read_block(TEST_INODE, 0, buf);
+	EXPECT_STREQ("new", buf);
+}
+
+TEST_F(block_fd_cacheTest, InvalidateReopensFile)
+{
+	char buf[10];
+
+	make_block(TEST_INODE, 0, "old");
+	read_block(TEST_INODE, 0, buf);
+
+	invalidate_block_fd(TEST_INODE, 0);
+	make_block(TEST_INODE, 0, "new");
+	read_block(TEST_INODE, 0, buf);
+	EXPECT_STREQ("new", buf);
+}
+
+TEST_F(block_fd_cacheTest, InvalidateWhileReferenced)
+{
+	char path[200], buf[10];
+	BLOCK_FD_ENTRY *entry, *entry2;
+
+	make_block(TEST_INODE, 0, "old");
+	block_path(path, TEST_INODE, 0);
+	entry = get_block_fd(TEST_INODE, 0, path);
+	ASSERT_TRUE(entry != NULL);
+
+	invalidate_block_fd(TEST_INODE, 0);
+	make_block(TEST_INODE, 0, "new");
+	EXPECT_TRUE(entry->invalidated == TRUE);
+
+	/* The holder keeps the old file, and new users get the new one */
+	memset(buf, 0, sizeof(buf));
+	fseek(entry->fptr, 0, SEEK_SET);
+	EXPECT_GT(fread(buf, 1, 9, entry->fptr), 0);
+	EXPECT_STREQ("old", buf);
+	entry2 = get_block_fd(TEST_INODE, 0, path);
+	ASSERT_TRUE(entry2 != NULL);
+	EXPECT_NE(entry, entry2);
+	put_block_fd(entry2);
+	put_block_fd(entry);
+
+	read_block(TEST_INODE, 0, buf);
+	EXPECT_STREQ("new", buf);
+}
+
+TEST_F(block_fd_cacheTest, InvalidateInodeOnlyDropsThatInode)
+{
+	char buf[10];
+
+	make_block(TEST_INODE, 0, "old0");
+	make_block(TEST_INODE, 1, "old1");
+	make_block(TEST_INODE + 1, 0, "other");
+	keep_block(TEST_INODE + 1, 0);
+	read_block(TEST_INODE, 0, buf);
+	read_block(TEST_INODE, 1, buf);
+	read_block(TEST_INODE + 1, 0, buf);
+
+	invalidate_inode_block_fds(TEST_INODE);
+	make_block(TEST_INODE, 0, "new0");
+	make_block(TEST_INODE, 1, "new1");
+	make_block(TEST_INODE + 1, 0, "changed");
+	read_block(TEST_INODE, 0, buf);
+	EXPECT_STREQ("new0", buf);
+	read_block(TEST_INODE, 1, buf);
+	EXPECT_STREQ("new1", buf);
+	read_block(TEST_INODE + 1, 0, buf);
+	EXPECT_STREQ("other", buf);
+}
+
+TEST_F(block_fd_cacheTest, InvalidateAllDropsEveryInode)
+{
+	char buf[10];
+
+	make_block(TEST_INODE, 0, "old0");
+	make_block(TEST_INODE + 1, 0, "other");
+	read_block(TEST_INODE, 0, buf);
+	read_block(TEST_INODE + 1, 0, buf);
+
+	invalidate_all_block_fds();
+	make_block(TEST_INODE, 0, "new0");
+	make_block(TEST_INODE + 1, 0, "changed");
+	read_block(TEST_INODE, 0, buf);
+	EXPECT_STREQ("new0", buf);
+	read_block(TEST_INODE + 1, 0, buf);
+	EXPECT_STREQ("changed", buf);
+}
+
+TEST_F(block_fd_cacheTest, InvalidateBeforeInitIsNoop)
+{
+	destroy_block_fd_cache();
+
+	/* Must return instead of waiting on the uninitialized table */
+	invalidate_block_fd(TEST_INODE, 0);
+	invalidate_inode_block_fds(TEST_INODE);
+	invalidate_all_block_fds();
+
+	init_block_fd_cache();
+}
+
+TEST_F(block_fd_cacheTest, OldestIdleFileIsClosed)
+{
+	char buf[10];
+
+	make_block(TEST_INODE, 0, "old");
+	keep_block(TEST_INODE, 0);
+	read_block(TEST_INODE, 0, buf);
+	make_block(TEST_INODE, 0, "new");
+
+	/* Block 0 is the least recently used after these */
+	for (int32_t count = 1; count <= MAX_BLOCK_FD_CACHE_ENTRIES;
+	     count++) {
+		make_block(TEST_INODE, count, "x");
+		read_block(TEST_INODE, count, buf);
+	}
+	read_block(TEST_INODE, 0, buf);
+	EXPECT_STREQ("new", buf);
+}
+
+TEST_F(block_fd_cacheTest, ExclusiveLockBlocksSharedLock)
+{
+	char path[200];
+	BLOCK_FD_ENTRY *entry;
+	int32_t fd;
+
+	make_block(TEST_INODE, 0, "old");
+	block_path(path, TEST_INODE, 0);
+	entry = get_block_fd(TEST_INODE, 0, path);
+	ASSERT_TRUE(entry != NULL);
+
+	/* Another descriptor of the file cannot lock it meanwhile */
+	fd = open(path, O_RDONLY);
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(0, lock_block_fd(entry, LOCK_EX));
+	EXPECT_EQ(-1, flock(fd, LOCK_SH | LOCK_NB));
+	unlock_block_fd(entry, LOCK_EX);
+
+	/* Shared lockers share one flock, released by the last one */
+	ASSERT_EQ(0, lock_block_fd(entry, LOCK_SH));
+	ASSERT_EQ(0, lock_block_fd(entry, LOCK_SH));
+	EXPECT_EQ(-1, flock(fd, LOCK_EX | LOCK_NB));
+	unlock_block_fd(entry, LOCK_SH);
+	EXPECT_EQ(-1, flock(fd, LOCK_EX | LOCK_NB));
+	unlock_block_fd(entry, LOCK_SH);
+	EXPECT_EQ(0, flock(fd, LOCK_EX | LOCK_NB));
+	flock(fd, LOCK_UN);
+	close(fd);
+	put_block_fd(entry);
+}
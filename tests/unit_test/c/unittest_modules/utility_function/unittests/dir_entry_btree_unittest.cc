@@ -1082,3 +1082,129 @@ TEST_F(delete_dir_entry_btreeTest, DeleteSuccessFor_depth_exceed_2)
 	End of unittest of delete_dir_entry_btree()
  */
 
+
+/*
+	Unittest of dir_btree_track_pages()
+ */
+
+class dir_btree_track_pagesTest : public BaseClassInsertBtreeEntryIsUsable {
+	protected:
+		/* Cache every node of the tree, as lookups would do */
+		void cache_all_pages(DIR_PAGE_CACHE **cache)
+		{
+			DIR_META_TYPE meta;
+			DIR_ENTRY_PAGE node;
+			int64_t pos;
+
+			pread(fh, &meta, sizeof(DIR_META_TYPE), sizeof(HCFS_STAT));
+			pos = meta.tree_walk_list_head;
+			while (pos != 0) {
+				pread(fh, &node, sizeof(DIR_ENTRY_PAGE), pos);
+				ASSERT_EQ(0, dir_page_cache_put(cache, &node));
+				pos = node.tree_walk_next;
+			}
+		}
+
+		/* Every cached node should be the same as the one in meta file,
+		   and no node in the gc list should be cached */
+		void verify_cached_pages(DIR_PAGE_CACHE *cache)
+		{
+			DIR_META_TYPE meta;
+			DIR_ENTRY_PAGE node;
+			DIR_PAGE_CACHE_ENTRY *entry;
+			int64_t pos;
+
+			for (int32_t i = 0; i < DIR_PAGE_CACHE_HASH_SIZE; i++) {
+				entry = cache->hash_table[i];
+				while (entry != NULL) {
+					pread(fh, &node, sizeof(DIR_ENTRY_PAGE),
+					      entry->page.this_page_pos);
+					ASSERT_EQ(0, memcmp(&node, &(entry->page),
+						  sizeof(DIR_ENTRY_PAGE)))
+						<< "pos = " << node.this_page_pos;
+					entry = entry->hash_next;
+				}
+			}
+			pread(fh, &meta, sizeof(DIR_META_TYPE), sizeof(HCFS_STAT));
+			pos = meta.entry_page_gc_list;
+			while (pos != 0) {
+				ASSERT_TRUE(dir_page_cache_get(cache, pos) == NULL);
+				pread(fh, &node, sizeof(DIR_ENTRY_PAGE), pos);
+				pos = node.gc_list_next;
+			}
+		}
+};
+
+TEST_F(dir_btree_track_pagesTest, CachedNodesFollowInsertions)
+{
+	DIR_PAGE_CACHE *cache = NULL;
+	DIR_META_TYPE meta;
+	DIR_ENTRY_PAGE root_node;
+	DIR_ENTRY entry;
+	int32_t ret;
+
+	init_insert_many_entries(0, 500, "test_file");
+	cache_all_pages(&cache);
+	ASSERT_TRUE(cache != NULL);
+
+	/* Leaves split, but the root has room for the new children */
+	pread(fh, &meta, sizeof(DIR_META_TYPE), sizeof(HCFS_STAT));
+	pread(fh, &root_node, sizeof(DIR_ENTRY_PAGE), meta.root_entry_page);
+	dir_btree_track_pages(cache);
+	for (int32_t i = 500; i < 1000; i++) {
+		memset(&entry, 0, sizeof(DIR_ENTRY));
+		sprintf(entry.d_name, "test_file%d", i);
+		ret = insert_dir_entry_btree(&entry, &root_node, fh,
+			overflow_median, overflow_new_pos, &meta, tmp_entries,
+			tmp_child_pos, FALSE, sizeof(HCFS_STAT));
+		ASSERT_EQ(0, ret);
+		pread(fh, &meta, sizeof(DIR_META_TYPE), sizeof(HCFS_STAT));
+		pread(fh, &root_node, sizeof(DIR_ENTRY_PAGE),
+		      meta.root_entry_page);
+	}
+	dir_btree_track_pages(NULL);
+
+	verify_cached_pages(cache);
+	dir_page_cache_destroy(&cache);
+}
+
+TEST_F(dir_btree_track_pagesTest, CachedNodesFollowDeletions)
+{
+	int32_t num_entries = MAX_DIR_ENTRIES_PER_PAGE *
+			(MAX_DIR_ENTRIES_PER_PAGE / 4);
+	DIR_PAGE_CACHE *cache = NULL;
+	DIR_META_TYPE meta;
+	DIR_ENTRY_PAGE root_node;
+	DIR_ENTRY entry;
+
+	init_insert_many_entries(0, num_entries, "test_file");
+	cache_all_pages(&cache);
+	ASSERT_TRUE(cache != NULL);
+
+	/* Nodes are merged, rebalanced and moved to the gc list */
+	pread(fh, &meta, sizeof(DIR_META_TYPE), sizeof(HCFS_STAT));
+	pread(fh, &root_node, sizeof(DIR_ENTRY_PAGE), meta.root_entry_page);
+	dir_btree_track_pages(cache);
+	for (int32_t i = 0; i < num_entries; i++) {
+		if ((i % 10) == 0)
+			continue;
+		memset(&entry, 0, sizeof(DIR_ENTRY));
+		sprintf(entry.d_name, "test_file%d", i);
+		ASSERT_EQ(0, delete_dir_entry_btree(&entry, &root_node, fh,
+			&meta, tmp_entries, tmp_child_pos, FALSE,
+			sizeof(HCFS_STAT)));
+		pread(fh, &meta, sizeof(DIR_META_TYPE), sizeof(HCFS_STAT));
+		pread(fh, &root_node, sizeof(DIR_ENTRY_PAGE),
+		      meta.root_entry_page);
+	}
+	dir_btree_track_pages(NULL);
+
+	pread(fh, &meta, sizeof(DIR_META_TYPE), sizeof(HCFS_STAT));
+	EXPECT_NE(0, meta.entry_page_gc_list);
+	verify_cached_pages(cache);
+	dir_page_cache_destroy(&cache);
+}
+
+/*
+	End of unittest of dir_btree_track_pages()
+ */
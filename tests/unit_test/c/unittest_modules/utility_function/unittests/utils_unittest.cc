@@ -1223,11 +1223,18 @@ protected:
 			(SYSTEM_DATA_HEAD *)malloc(sizeof(SYSTEM_DATA_HEAD));
 		memset(hcfs_system, 0, sizeof(SYSTEM_DATA_HEAD));
 		sem_init(&(hcfs_system->access_sem), 0, 1);
+		sem_init(&(hcfs_system->num_cache_sleep_sem), 0, 0);
+		sem_init(&(hcfs_system->cache_event_sem), 0, 0);
+		system_config = (SYSTEM_CONF_STRUCT *)
+			calloc(1, sizeof(SYSTEM_CONF_STRUCT));
+		CACHE_SOFT_LIMIT = 100;
+		CACHE_HARD_LIMIT = 200;
 	}
 
 	void TearDown()
 	{
 		free(hcfs_system);
+		free(system_config);
 	}
 };
 
@@ -1245,6 +1252,37 @@ TEST_F(change_system_metaTest, UpdateSuccess)
 	EXPECT_EQ(5, hcfs_system->systemdata.dirty_cache_size);
 	EXPECT_EQ(6, hcfs_system->systemdata.unpin_dirty_data_size);
 }
+
+TEST_F(change_system_metaTest, WakeUpCacheManagementAtSoftLimit)
+{
+	int32_t semval;
+
+	ASSERT_EQ(0, change_system_meta(0, 0, 99, 0, 0, 0, FALSE));
+	sem_getvalue(&(hcfs_system->cache_event_sem), &semval);
+	EXPECT_EQ(0, semval);
+
+	/* Posted only once however many times soft limit is exceeded */
+	ASSERT_EQ(0, change_system_meta(0, 0, 1, 0, 0, 0, FALSE));
+	ASSERT_EQ(0, change_system_meta(0, 0, 1, 0, 0, 0, FALSE));
+	sem_getvalue(&(hcfs_system->cache_event_sem), &semval);
+	EXPECT_EQ(1, semval);
+}
+
+TEST_F(change_system_metaTest, WakeUpCacheManagementIfSpaceFreed)
+{
+	int32_t semval;
+
+	hcfs_system->systemdata.cache_size = 50;
+	ASSERT_EQ(0, change_system_meta(0, 0, -10, 0, 0, 0, FALSE));
+	sem_getvalue(&(hcfs_system->cache_event_sem), &semval);
+	EXPECT_EQ(0, semval);
+
+	/* Some thread is waiting on full cache */
+	sem_post(&(hcfs_system->num_cache_sleep_sem));
+	ASSERT_EQ(0, change_system_meta(0, 0, -10, 0, 0, 0, FALSE));
+	sem_getvalue(&(hcfs_system->cache_event_sem), &semval);
+	EXPECT_EQ(1, semval);
+}
 /*
  * End of unittest of change_system_meta()
  */
@@ -1263,6 +1301,8 @@ protected:
 
 		sys_super_block =
 		    (SUPER_BLOCK_CONTROL *)calloc(1, sizeof(SUPER_BLOCK_CONTROL));
+		system_config = (SYSTEM_CONF_STRUCT *)
+			calloc(1, sizeof(SYSTEM_CONF_STRUCT));
 
 	}
 
@@ -1270,6 +1310,7 @@ protected:
 	{
 		free(hcfs_system);
 		free(sys_super_block);
+		free(system_config);
 	}
 };
 